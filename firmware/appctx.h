@@ -14,8 +14,7 @@ struct arx_cmd_t {
   union {
     __packed struct {
       uint32_t desc_idx:16;     /*> Descriptor buffer index          */
-      uint32_t db_id:5;         /*> APPCTX doorbell id               */
-      uint32_t rsvd:11;
+      uint32_t db_id:16;        /*> APPCTX doorbell id               */
     };
 
     uint32_t __raw;
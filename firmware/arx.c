@@ -73,7 +73,7 @@ update_local_copy:
 static void poll_ctxqueues()
 {
   int idx;
-  ctassert(FLEXNIC_PL_APPCTX_NUM == 32);
+  ctassert(FLEXNIC_PL_APPCTX_NUM <= 64);    /*> ctx_queues[] in LM */
 
   for (;;) {
     /* This is a low priority task */
@@ -139,6 +139,7 @@ __forceinline void poll_arx()
     db = rd0.db_id;
     prepare_dma_cmd(&wr0, rd0.desc_idx, db);
     cls_incr((__cls void*) &dma_appctx_active[db]); /* Mark APPCTX as active for MSI-X */
+    JOURNAL_EVENT(ARX, db, rd0.desc_idx);
 
     __cls_workq_add_thread(ARX_WQ_RNUM, &rd0, sizeof(rd0), sig_done, &rd_sig0);
     __cls_workq_add_work(ARX_DMA_RNUM, &wr0, sizeof(wr0), sig_done, &wr_sig0);
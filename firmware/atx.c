@@ -24,14 +24,27 @@ __export __shared __cls __align4K struct dma_appctx_cmd_t dma_atx_wq[ATX_WQ_SIZE
 __shared __lmem struct flextcp_pl_appctx_queue_t ctx_queues[FLEXNIC_PL_APPCTX_NUM];
 __shared __gpr uint32_t seq;
 __shared __gpr uint64_t fp_queue_base;
-__shared __gpr uint32_t first_inactive_ctx;
 
-__shared __gpr uint32_t on_queue;
+/* Context bitmaps, one bit per context in words of 32 */
+#define ATX_CTX_WORDS       (FLEXNIC_PL_APPCTX_NUM / 32)
+#define ATX_CTX_WORD(IDX)   ((IDX) >> 5)
+#define ATX_CTX_BIT(IDX)    (1 << ((IDX) & 31))
+
+/* bitmap of contexts with a registered queue (len != 0), bit 0 is the sp */
+__shared __lmem uint32_t active_ctx[ATX_CTX_WORDS];
+/* bitmap of words of active_ctx[] with a bit set, scanned first */
+__shared __gpr uint32_t active_words;
+/* registration generation ctx_queues[] was loaded from, see fp_app_if.h */
+__shared __lmem uint32_t ctx_gen[FLEXNIC_PL_APPCTX_NUM];
+
+__shared __lmem uint32_t on_queue[ATX_CTX_WORDS];
 __shared __gpr uint32_t queue_head, queue_tail;
 __shared __lmem uint32_t sched_queue[FLEXNIC_PL_APPCTX_NUM];
 
 #define FP_QUEUE_TX_ADDR(IDX)     ((__mem40 void*) (fp_queue_base + (IDX << 6) + offsetof(struct flextcp_pl_appctx_t, tx)))
 #define FP_QUEUE_TAIL_ADDR(IDX)   ((__mem40 void*) (fp_queue_base + (IDX << 6) + offsetof(struct flextcp_pl_appctx_t, tx) + offsetof(struct flextcp_pl_appctx_queue_t, p_idx)))
+#define FP_CTX_GEN_ADDR(IDX)      ((__mem40 void*) (fp_queue_base + (IDX << 6) + offsetof(struct flextcp_pl_appctx_t, gen)))
+#define FP_CTX_GEN_ACK_ADDR(IDX)  ((__mem40 void*) (fp_queue_base + (IDX << 6) + offsetof(struct flextcp_pl_appctx_t, gen_ack)))
 
 __asm {
   .init_csr mecsr:NNPut 0;
@@ -53,6 +66,22 @@ __forceinline void init_desc_pool()
   }
 }
 
+/* Does not swap out! */
+__forceinline void activate_ctx(unsigned int idx)
+{
+  active_ctx[ATX_CTX_WORD(idx)] |= ATX_CTX_BIT(idx);
+  active_words |= (1 << ATX_CTX_WORD(idx));
+}
+
+/* Does not swap out! */
+__forceinline void deactivate_ctx(unsigned int idx)
+{
+  active_ctx[ATX_CTX_WORD(idx)] &= ~ATX_CTX_BIT(idx);
+  if (active_ctx[ATX_CTX_WORD(idx)] == 0) {
+    active_words &= ~(1 << ATX_CTX_WORD(idx));
+  }
+}
+
 __forceinline void read_ctxqueue(int idx)
 {
   __xread struct flextcp_pl_appctx_queue_t queue_xfer;
@@ -65,22 +94,56 @@ __forceinline void read_ctxqueue(int idx)
   return;
 }
 
-/** Poll updates to APPCTX on main thread */
+/**
+ * Poll registration state of all APPCTX on main thread. The slowpath hands out
+ * and reclaims doorbells in any order, so contexts are tracked in a bitmap.
+ *
+ * Every add and clear bumps the context's generation. A context whose
+ * generation changed (or whose length was cleared) is deactivated once it is
+ * no longer on the schedule queue, i.e. its posted descriptors drained. Only
+ * then is the new generation acknowledged in gen_ack and, with a non-zero
+ * length, ctx_queues[] loaded from the new registration. The slowpath waits
+ * for the ack before it frees or reuses the queue memory or the doorbell, so
+ * a clear and re-add between two samples cannot leave stale indices here.
+ */
 __forceinline void poll_inactive_queues()
 {
   __xread struct flextcp_pl_appctx_queue_t queue;
-  __mem40 void* addr;
+  __xread uint32_t gen;
+  __xwrite uint32_t gen_ack;
+  unsigned int idx, word;
+  uint32_t bit, ack;
 
-  while (first_inactive_ctx < FLEXNIC_PL_APPCTX_NUM) {
+  for (;;) {
     sleep((1 << 20) - 1);
 
-    /* Poll idle context */
-    addr = FP_QUEUE_TX_ADDR(first_inactive_ctx);
-    mem_read32(&queue, addr, sizeof(struct flextcp_pl_appctx_queue_t));
-    ctx_queues[first_inactive_ctx] = queue;
+    for (idx = 1; idx < FLEXNIC_PL_APPCTX_NUM; idx++) {
+      /* the slowpath writes the queue before the generation */
+      mem_read32(&gen, FP_CTX_GEN_ADDR(idx), sizeof(gen));
+      mem_read32(&queue, FP_QUEUE_TX_ADDR(idx), sizeof(struct flextcp_pl_appctx_queue_t));
+      word = ATX_CTX_WORD(idx);
+      bit = ATX_CTX_BIT(idx);
+      ack = 0;
 
-    if (ctx_queues[first_inactive_ctx].len != 0) {
-      first_inactive_ctx += 1;
+      __no_swap_begin();
+      if ((active_ctx[word] & bit) != 0 && (on_queue[word] & bit) == 0 &&
+          (queue.len == 0 || gen != ctx_gen[idx])) {
+        deactivate_ctx(idx);
+      }
+      if ((active_ctx[word] & bit) == 0 && gen != ctx_gen[idx]) {
+        ctx_gen[idx] = gen;
+        if (queue.len != 0) {
+          ctx_queues[idx] = queue;
+          activate_ctx(idx);
+        }
+        ack = 1;
+      }
+      __no_swap_end();
+
+      if (ack) {
+        gen_ack = gen;
+        mem_write32(&gen_ack, FP_CTX_GEN_ACK_ADDR(idx), sizeof(gen_ack));
+      }
     }
   }
 
@@ -144,7 +207,7 @@ __forceinline void poll_bump()
     __no_swap_begin();
     idx = sched_queue[queue_head];
     queue_head = (queue_head + 1) & (FLEXNIC_PL_APPCTX_NUM - 1);
-    on_queue &= ~(1 << idx);
+    on_queue[ATX_CTX_WORD(idx)] &= ~ATX_CTX_BIT(idx);
 
     head = ctx_queues[idx].c_idx;
     len_mask = ctx_queues[idx].len - 1;
@@ -157,37 +220,63 @@ __forceinline void poll_bump()
     if (ctx_queues[idx].p_idx != ctx_queues[idx].c_idx) {
       sched_queue[queue_tail] = idx;
       queue_tail = (queue_tail + 1) & (FLEXNIC_PL_APPCTX_NUM - 1);
-      on_queue |= (1 << idx);
+      on_queue[ATX_CTX_WORD(idx)] |= ATX_CTX_BIT(idx);
     }
     __no_swap_end();
 
     cls_workq_add_work(ATX_DMA_RNUM, &cmd_xfer, sizeof(cmd_xfer));
     STATS_INC(ATX);
+    JOURNAL_EVENT(ATX, idx, cmd.desc_idx | (cmd.seq << 16));
   }
 
   return;
 }
 
+/**
+ * Poll tail pointers of registered contexts. Words of active_ctx[] without a
+ * registered context are skipped via active_words, so a pass costs one tail
+ * read per registered context however many doorbells there are.
+ */
 __forceinline void poll_active_queues()
 {
-  int idx;
+  int idx, word;
   __xread uint32_t tail;
   __mem40 void* addr;
-  int x, y;
+  uint32_t words, pending, bit, gen;
 
   for (;;) {
-    for (idx = 1; idx < first_inactive_ctx; idx++) {
-      addr = FP_QUEUE_TAIL_ADDR(idx);
-      mem_read32(&tail, addr, sizeof(tail));
-
-      __no_swap_begin();
-      ctx_queues[idx].p_idx = tail;
-      if (((on_queue & (1 << idx)) == 0) && ctx_queues[idx].p_idx != ctx_queues[idx].c_idx) {
-        sched_queue[queue_tail] = idx;
-        queue_tail = (queue_tail + 1) & (FLEXNIC_PL_APPCTX_NUM - 1);
-        on_queue |= (1 << idx);
+    words = active_words;
+    while (words != 0) {
+      word = ffs(words);
+      words &= ~(1 << word);
+
+      /* only visit registered contexts */
+      pending = active_ctx[word];
+      if (word == 0) {
+        pending &= ~1;
+      }
+      while (pending != 0) {
+        idx = ffs(pending);
+        pending &= ~(1 << idx);
+        bit = (1 << idx);
+        idx += (word << 5);
+
+        gen = ctx_gen[idx];
+        addr = FP_QUEUE_TAIL_ADDR(idx);
+        mem_read32(&tail, addr, sizeof(tail));
+
+        __no_swap_begin();
+        /* skip if the registration changed while reading, tail is stale */
+        if ((active_ctx[word] & bit) != 0 && ctx_gen[idx] == gen) {
+          ctx_queues[idx].p_idx = tail;
+          if (((on_queue[word] & bit) == 0) && ctx_queues[idx].p_idx != ctx_queues[idx].c_idx) {
+            sched_queue[queue_tail] = idx;
+            queue_tail = (queue_tail + 1) & (FLEXNIC_PL_APPCTX_NUM - 1);
+            on_queue[word] |= bit;
+          }
+        }
+        __no_swap_end();
       }
-      __no_swap_end();
     }
 
     sleep(50);
@@ -199,18 +288,26 @@ __forceinline void poll_active_queues()
 int main()
 {
   SIGNAL start_sig;
+  unsigned int idx;
 
   if (ctx() == 0) {
     ctassert(sizeof(struct flextcp_pl_appctx_t) == 64);
     ctassert(sizeof(struct flextcp_pl_appctx_queue_t) == 16);
-    ctassert(FLEXNIC_PL_APPCTX_NUM == 32);
+    /* Whole bitmap words, one summary bit each; power of 2 for sched_queue */
+    ctassert(FLEXNIC_PL_APPCTX_NUM % 32 == 0 && ATX_CTX_WORDS <= 32);
+    ctassert((FLEXNIC_PL_APPCTX_NUM & (FLEXNIC_PL_APPCTX_NUM - 1)) == 0);
 
     fp_queue_base = (uint64_t) ((__mem40 void*) &fp_state.appctx[0]);
     nn_desc_pool = 0;
     seq = 0;
-    first_inactive_ctx = 1;
+    active_words = 0;
+    for (idx = 0; idx < ATX_CTX_WORDS; idx++) {
+      active_ctx[idx] = 0;
+      on_queue[idx] = 0;
+    }
+    for (idx = 0; idx < FLEXNIC_PL_APPCTX_NUM; idx++)
+      ctx_gen[idx] = 0;
     queue_head = queue_tail = 0;
-    on_queue = 0;
 
     init_desc_pool();
     cls_workq_setup(ATX_DMA_RNUM, (__cls void*) dma_atx_wq, ATX_WQ_SIZE * sizeof(struct dma_appctx_cmd_t));
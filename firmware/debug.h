@@ -5,10 +5,13 @@
 #define ME_DEBUG_H
 
 #include <nfp.h>
+#include <nfp/me.h>
 #include <nfp/mem_atomic.h>
 #include <nfp/mem_bulk.h>
+#include <nfp/mem_ring.h>
 
 #include "fp_debug.h"
+#include "fp_journal.h"
 
 extern __export __shared __emem struct flextcp_pl_debug fp_debug;
 
@@ -112,9 +115,30 @@ __intrinsic static void prof_clr(uint32_t _idx)
 #endif
 
 #if FP_JRNL_ENABLE
+/* ME field of journal records, see fp_journal.h */
+#define FP_JRNL_ME                ((((__ISLAND) - 32) << 4) | (__MEID & 0xF))
+
+__intrinsic static void journal_event(uint32_t _ev, uint32_t _a0, uint32_t _a1)
+{
+  __xwrite uint32_t _rec[FP_JRNL_WORDS];
+
+  _rec[0] = FP_JRNL_HDR(_ev, FP_JRNL_ME, ctx());
+  _rec[1] = local_csr_read(local_csr_timestamp_low);
+  _rec[2] = _a0;
+  _rec[3] = _a1;
+
+  /* One command per record, records of different MEs never interleave */
+  mem_ring_journal(MEM_RING_GET_NUM(fp_dbg_journal), MEM_RING_GET_MEMADDR(fp_dbg_journal), _rec, sizeof(_rec));
+}
+#endif
+
+#if FP_JRNL_ENABLE
+  /* Raw words break the record alignment flextoe-jrnl relies on */
   #define JOURNAL(_val)           mem_ring_journal_fast(MEM_RING_GET_NUM(fp_dbg_journal), MEM_RING_GET_MEMADDR(fp_dbg_journal), (_val))
+  #define JOURNAL_EVENT(_ev, _a0, _a1)  journal_event(FP_JRNL_##_ev, (_a0), (_a1))
 #else
   #define JOURNAL(_val)           do {} while(0)
+  #define JOURNAL_EVENT(_ev, _a0, _a1)  do {} while(0)
 #endif
 
 #endif /* ME_DEBUG_H */
@@ -96,7 +96,7 @@ struct dma_pkt_cmd_t {
       uint32_t bls:2;                 /*> Buffer list of the MU buffer */
       uint32_t muptr:29;              /*> Pointer to the MU buffer >>11 */
 
-      uint32_t rsvd2:16;
+      uint32_t flags:16;              /*> Flags                            */
       uint32_t seqr:5;                /*> Packet sequencer                 */
       uint32_t plen:11;               /*> Payload length */
 
@@ -106,8 +106,7 @@ struct dma_pkt_cmd_t {
       uint32_t param4;
 
       uint32_t desc_idx:16;           /*> Descriptor buffer index          */
-      uint32_t db_id:5;               /*> APPCTX doorbell id               */
-      uint32_t flags:11;              /*> Flags                            */
+      uint32_t db_id:16;              /*> APPCTX doorbell id               */
     };
 
     uint32_t __raw[8];
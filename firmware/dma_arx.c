@@ -48,6 +48,7 @@ issue_desc_dma(__xread struct dma_appctx_cmd_t* cmd,
     (uint32_t) (host_addr >> 32), (uint32_t) (host_addr));
 
   STATS_INC(DMA_ARX_DESC_ISSUE);
+  JOURNAL_EVENT(DMA_ARX_ISSUE, desc_idx, cmd->buf_pos);
 }
 
 __intrinsic void
@@ -57,6 +58,7 @@ issue_fwd(__gpr struct dma_appctx_cmd_t* cmd)
 
   /* Enqueue for pre-processing */
   desc_idx = cmd->desc_idx;
+  JOURNAL_EVENT(DMA_ARX_DONE, desc_idx, cmd->buf_pos);
   if (desc_idx != 0) {
     mem_ring_journal_fast(arx_pool_rnum, arx_pool_raddr_hi, desc_idx);
     STATS_INC(DMA_ARX_DESC_FWD_FREE);
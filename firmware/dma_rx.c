@@ -43,13 +43,12 @@ struct fwd_info_t {
       uint32_t bls:2;                 /*> Buffer list of the MU buffer */
       uint32_t muptr:29;              /*> Pointer to the MU buffer >>11 */
 
-      uint32_t rsvd2:16;
+      uint32_t flags:16;              /*> Flags                            */
       uint32_t seqr:5;                /*> Packet sequencer                 */
       uint32_t plen:11;               /*> Payload length */
 
       uint32_t desc_idx:16;           /*> Descriptor buffer index          */
-      uint32_t db_id:5;               /*> APPCTX doorbell id               */
-      uint32_t flags:11;              /*> Flags                            */
+      uint32_t db_id:16;              /*> APPCTX doorbell id               */
     };
 
     uint32_t __raw[4];
@@ -63,10 +62,19 @@ issue_fwd(__gpr struct fwd_info_t* fwd,
 {
   /* Send packet over NBI */
   if ((fwd->flags & WORK_RESULT_TX) != 0) {
-    pkt_nbi_send(fwd->isl + 32, fwd->pnum, &msi,
-        NET_HDR_LEN + 4, 0, TM_Q_DST, fwd->seqr, fwd->seq, fwd->cbs);
+    if ((fwd->flags & WORK_RESULT_SACK) != 0) {
+      /* Payload is out, SACK option can overwrite it */
+      pkt_ack_sack_place(fwd->isl + 32, fwd->pnum);
+      pkt_nbi_send(fwd->isl + 32, fwd->pnum, &msi,
+          NET_HDR_LEN + NET_TCP_OPT_LEN_PADSACK1 + 4, 0, TM_Q_DST,
+          fwd->seqr, fwd->seq, fwd->cbs);
+    } else {
+      pkt_nbi_send(fwd->isl + 32, fwd->pnum, &msi,
+          NET_HDR_LEN + 4, 0, TM_Q_DST, fwd->seqr, fwd->seq, fwd->cbs);
+    }
 
     STATS_INC(DMA_RX_FWD_ACK);
+    COUNTER_INC(TX_ACK);
   } else {
     pkt_nbi_drop_seq(fwd->isl + 32, fwd->pnum, &msi,
         NET_HDR_LEN + 4, 0, 0, fwd->seqr, fwd->seq, fwd->cbs);
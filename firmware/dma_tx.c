@@ -41,13 +41,12 @@ struct fwd_info_t {
       uint32_t bls:2;                 /*> Buffer list of the MU buffer */
       uint32_t muptr:29;              /*> Pointer to the MU buffer >>11 */
 
-      uint32_t rsvd2:16;
+      uint32_t flags:16;              /*> Flags                            */
       uint32_t seqr:5;                /*> Packet sequencer                 */
       uint32_t plen:11;               /*> Payload length */
 
       uint32_t desc_idx:16;           /*> Descriptor buffer index          */
-      uint32_t db_id:5;               /*> APPCTX doorbell id               */
-      uint32_t flags:11;              /*> Flags                            */
+      uint32_t db_id:16;              /*> APPCTX doorbell id               */
     };
 
     uint32_t __raw[4];
@@ -61,6 +60,7 @@ issue_fwd(__gpr struct fwd_info_t* fwd)
   pkt_nbi_send(fwd->isl + 32, fwd->pnum, &msi,
       fwd->plen + NET_HDR_LEN + 4, 0, TM_Q_DST, fwd->seqr, fwd->seq, PKTBUF_CTM_SIZE);
   STATS_INC(DMA_TX_FWD_SEG);
+  COUNTER_INC(TX_SEG);
 }
 
 __intrinsic void
@@ -2,10 +2,100 @@
 /* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
 
 #include <nfp.h>
+#include <nfp/mem_atomic.h>
 
 #include "packet_defs.h"
 #include "fp_mem.h"
 #include "pipeline.h"
+#include "tcp_ooo.h"
+#include "tcp_sack.h"
+#include "tcp_rack.h"
+#include "tcp_delack.h"
+#include "tcp_rxwnd.h"
+#include "tcp_wscale.h"
+
+/* Delayed ACK policy, from the fastpath configuration */
+__shared __lmem uint32_t delack_segs;
+__shared __lmem uint32_t delack_wnd;
+
+/* Always-on drop counter, see fp_mem.h */
+#define FLOWS_COUNT_DROP()  \
+          mem_incr64((__mem40 void*) &fp_state.counters.cnt[FP_CNT_RX_DROP])
+
+__intrinsic void flows_init()
+{
+  uint32_t segs;
+
+  segs = MIN(fp_state.cfg.delack_segs, TCP_DELACK_SEGS_MAX);
+  delack_segs = segs;
+  delack_wnd  = segs * TCP_MSS;
+}
+
+/**
+ * Flush delayed ACKs before sending a segment: it acknowledges everything
+ * received so far.
+ *
+ * @param fs Pointer to flow state.
+ *
+ * @return Flags to add to the result.
+ */
+__intrinsic uint32_t flows_delack_flush(__lmem struct flowst_tcp_t* fs)
+{
+  /* NOTE: Active LM address already points to FS */
+  uint32_t fs_flags, flags;
+
+  __asm {
+    ld_field_w_clr[fs_flags, 12, *l$index1[7], >>16];   // fs_flags = fs->flags
+  }
+  if (TCP_DELACK_PENDING(fs_flags) == 0)
+    return 0;
+
+  flags = 0;
+  if ((fs_flags & FLEXNIC_PL_FLOWST_RXCE) != 0) {
+    flags |= WORK_RESULT_ECE;
+  }
+  fs_flags = tcp_delack_sent(fs_flags);
+  __asm {
+    ld_field[*l$index1[7], 12, fs_flags, <<16];         // fs->flags = fs_flags
+  }
+  return flags;
+}
+
+/**
+ * Window field to advertise (see tcp_wscale.h).
+ *
+ * @param fs        Pointer to flow state.
+ * @param rx_avail  Free receive buffer space.
+ */
+__intrinsic uint32_t flows_win(__lmem struct flowst_tcp_t* fs,
+                               uint32_t rx_avail)
+{
+  /* NOTE: Active LM address already points to FS */
+  uint32_t wnd;
+
+  __asm {
+    alu[wnd, --, B, *l$index1[15]];     // wnd = fs->wnd
+  }
+  return tcp_wscale_win(wnd, rx_avail);
+}
+
+/**
+ * Peer's receive window from a received window field (see tcp_wscale.h).
+ *
+ * @param fs  Pointer to flow state.
+ * @param win Window field.
+ */
+__intrinsic uint32_t flows_remote_win(__lmem struct flowst_tcp_t* fs,
+                                      uint32_t win)
+{
+  /* NOTE: Active LM address already points to FS */
+  uint32_t wnd;
+
+  __asm {
+    alu[wnd, --, B, *l$index1[15]];     // wnd = fs->wnd
+  }
+  return tcp_wscale_remote(wnd, win);
+}
 
 /**
  * Calculate how many bytes can be sent based on unsent bytes in send buffer and
@@ -176,14 +266,77 @@ __intrinsic static int tcp_valid_rxseq(__lmem struct flowst_tcp_t *fs,
   return 0;
 }
 
+/**
+ * Retransmit the next part of the current hole if the flow is in selective
+ * recovery. tx_sent/tx_next_* are not modified, the segment comes from the
+ * already sent part of the TX buffer.
+ *
+ * @param fs      Pointer to flow state.
+ * @param tx_rtx  Selective recovery state (fs->tx_rtx).
+ * @param result  Work result to fill in.
+ *
+ * @return 0 if a segment was prepared, != 0 otherwise.
+ */
+__intrinsic int flows_tx_rtx(__lmem struct flowst_tcp_t*  fs,
+                                    uint32_t              tx_rtx,
+                           __xwrite struct work_result_t* result)
+{
+  /* NOTE: Active LM address already points to FS */
+  uint32_t tx_sack, rtx_next, rtx_end, payload_len, flags;
+  uint32_t tx_sent, tx_avail, fs_flags;
+  uint32_t una_seq, una_pos, rx_next_seq, rx_avail, tx_next_ts;
+
+  __asm {
+    alu[tx_sack, --, B, *l$index1[0]];        // tx_sack = fs->tx_sack
+  }
+  rtx_next = TCP_SACK_NXT(tx_rtx);
+  rtx_end = tcp_sack_hole_end(tx_sack, tx_rtx);
+  if (rtx_next >= rtx_end)
+    return -1;
+
+  payload_len = MIN(rtx_end - rtx_next, TCP_MSS);
+  tx_rtx += payload_len;
+
+  __asm {
+    alu[*l$index1[8], --, B, tx_rtx];             // fs->tx_rtx = tx_rtx
+    alu[tx_sent, --, B, *l$index1[3]];            // tx_sent = fs->tx_sent
+    alu[una_seq, *l$index1[4], -, tx_sent];       // una_seq = fs->tx_next_seq - tx_sent
+    alu[una_pos, *l$index1[5], -, tx_sent];       // una_pos = fs->tx_next_pos - tx_sent
+    alu[rx_next_seq, --, B, *l$index1[10]];       // rx_next_seq = fs->rx_next_seq
+    alu[rx_avail, --, B, *l$index1[9]];           // rx_avail = fs->rx_avail
+    alu[tx_next_ts, --, B, *l$index1[6]];         // tx_next_ts = fs->tx_next_ts
+    alu[tx_avail, --, B, *l$index1[1]];           // tx_avail = fs->tx_avail
+    ld_field_w_clr[fs_flags, 12, *l$index1[7], >>16];     // fs_flags = fs->flags
+  }
+
+  result->seq     = una_seq + rtx_next;
+  result->ack     = rx_next_seq;
+  result->win     = flows_win(fs, rx_avail);
+  result->ts_ecr  = tx_next_ts;
+
+  result->dma_pos = una_pos + rtx_next;
+  WORK_DMA_OFFSET_LEN_SET(result, payload_len, 0);
+
+  /* Make sure we don't send out the dummy byte for FIN */
+  flags = WORK_RESULT_TX | WORK_RESULT_DMA_PAYLOAD | flows_delack_flush(fs);
+  if (((fs_flags & FLEXNIC_PL_FLOWST_TXFIN) != 0) && (tx_avail == 0) &&
+      (rtx_next + payload_len == tx_sent)) {
+    flags |= WORK_RESULT_FIN;
+    WORK_DMA_OFFSET_LEN_SET(result, payload_len - 1, 0);
+  }
+  result->flags = flags;
+
+  return 0;
+}
+
 __intrinsic void flows_tx(
                           struct work_t*        work,
                    __lmem struct flowst_tcp_t*  fs,
                  __xwrite struct work_result_t* result)
 {
   uint32_t payload_len, avail, fin, flags;
-  uint32_t fs_flags, rx_avail, tx_avail;
-  uint32_t tx_next_seq, rx_next_seq, tx_next_ts, tx_next_pos;
+  uint32_t fs_flags, rx_avail, tx_avail, tx_sent, rack;
+  uint32_t tx_next_seq, rx_next_seq, tx_next_ts, tx_next_pos, tx_rtx;
 
   /* Set Active LM1 address as FS */
   __asm {
@@ -195,20 +348,33 @@ __intrinsic void flows_tx(
   result->work.__raw[1] = work->__raw[1];
   result->work.__raw[2] = work->__raw[2];
 
+  /* selective recovery: repair holes before sending new data */
+  __asm {
+    alu[tx_rtx, --, B, *l$index1[8]];         // tx_rtx = fs->tx_rtx
+  }
+  if (tx_rtx != 0) {
+    if (flows_tx_rtx(fs, tx_rtx, result) == 0)
+      return;
+  }
+
   avail = tcp_txavail(fs, 0);
-  flags = WORK_RESULT_TX | WORK_RESULT_DMA_PAYLOAD;
+  __asm {
+    ld_field_w_clr[fs_flags, 12, *l$index1[7], >>16];     // fs_flags = fs->flags
+  }
 
-  /* exit if there is no data available for TX */
-  if (avail == 0 && work->io.force == 0) {
+  /* exit if there is no data available for TX, forced sends without data
+   * only go out if an ACK is owed (delayed ACK timer, window update) */
+  if (avail == 0 &&
+      (work->io.force == 0 || TCP_DELACK_PENDING(fs_flags) == 0)) {
     result->flags = 0;
     return;
   }
   __critical_path();
 
   payload_len = MIN(avail, TCP_MSS);
+  flags = WORK_RESULT_TX | WORK_RESULT_DMA_PAYLOAD | flows_delack_flush(fs);
 
   __asm {
-    ld_field_w_clr[fs_flags, 12, *l$index1[7], >>16];     // fs_flags = fs->flags
     alu[tx_avail, --, B, *l$index1[1]];                   // tx_avail = fs->tx_avail
   }
   fin = ((fs_flags & FLEXNIC_PL_FLOWST_TXFIN) != 0) && (tx_avail == 0);
@@ -225,7 +391,7 @@ __intrinsic void flows_tx(
   }
   result->seq     = tx_next_seq;
   result->ack     = rx_next_seq;
-  result->win     = rx_avail;
+  result->win     = flows_win(fs, rx_avail);
 
   result->ts_ecr = tx_next_ts;
 
@@ -233,6 +399,20 @@ __intrinsic void flows_tx(
   result->dma_pos = tx_next_pos;
   WORK_DMA_OFFSET_LEN_SET(result, payload_len, 0);
 
+  /* first segment in flight: arm RACK deadline */
+  __asm {
+    alu[tx_sent, --, B, *l$index1[3]];                  // tx_sent = fs->tx_sent
+  }
+  if (tx_sent == 0) {
+    __asm {
+      ld_field_w_clr[rack, 3, *l$index1[7], >>0];       // rack = fs->rack_ts
+    }
+    rack = tcp_rack_arm(local_csr_read(local_csr_timestamp_low), rack);
+    __asm {
+      ld_field[*l$index1[7], 3, rack, >>0];             // fs->rack_ts = rack
+    }
+  }
+
   __asm {
     alu[*l$index1[4], *l$index1[4], +, payload_len];    // fs->tx_next_seq += payload_len
     alu[*l$index1[5], *l$index1[5], +, payload_len];    // fs->tx_next_pos += payload_len
@@ -255,7 +435,7 @@ __intrinsic void flows_ac(
                  __xwrite struct work_result_t*  result)
 {
   uint32_t rx_avail_prev, old_avail, new_avail, flags, fs_flags, rx_avail;
-  uint32_t rx_bump, tx_bump;
+  uint32_t rx_bump, tx_bump, wnd;
 
   /* Set Active LM1 address as FS */
   __asm {
@@ -273,20 +453,21 @@ __intrinsic void flows_ac(
   old_avail = tcp_txavail(fs, 0);
   new_avail = tcp_txavail(fs, tx_bump);
 
+  __asm {
+    ld_field_w_clr[fs_flags, 12, *l$index1[7], >>16];    // fs_flags = fs->flags
+    alu[wnd, --, B, *l$index1[15]];                      // wnd = fs->wnd
+  }
+
   /* mark connection as closed if requested */
   if (work->ac.fin)
-  {
-    __asm {
-      ld_field_w_clr[fs_flags, 12, *l$index1[7], >>16];    // fs_flags = fs->flags
-    }
     fs_flags |= FLEXNIC_PL_FLOWST_TXFIN;
-    __asm {
-      ld_field[*l$index1[7], 12, fs_flags, <<16];        // fs->flags = fs_flags
-    }
-  }
+
+  /* withhold freed space the window was shrunk by */
+  wnd = tcp_rxwnd_pay(wnd, &rx_bump);
 
   /* Update flow state */
   __asm {
+    alu[*l$index1[15], --, B, wnd];               // fs->wnd = wnd
     alu[rx_avail_prev, --, B, *l$index1[9]];      // rx_avail_prev = fs->rx_avail
     alu[*l$index1[9], *l$index1[9], +, rx_bump];  // fs->rx_avail += atx->msg.connupdate.rx_bump;
     alu[*l$index1[1], *l$index1[1], +, tx_bump];  // fs->tx_avail += atx->msg.connupdate.tx_bump;
@@ -304,9 +485,16 @@ __intrinsic void flows_ac(
    * we're not sending anyways. */
   if (new_avail == 0 && rx_avail_prev == 0 && rx_avail != 0) {
     flags |= WORK_RESULT_QM_FORCE;
+
+    /* the forced send is only a window update if an ACK is owed */
+    fs_flags = tcp_delack_owe(fs_flags);
   }
 #endif
 
+  __asm {
+    ld_field[*l$index1[7], 12, fs_flags, <<16];        // fs->flags = fs_flags
+  }
+
   result->flags = flags;
 }
 
@@ -317,15 +505,95 @@ __intrinsic void flows_reset_retransmit(__lmem struct flowst_tcp_t* fs)
 
   /* reset flow state as if we never transmitted those segments */
   __asm {
-    immed_w0[*l$index1[7], 0];                // fs->dupack_cnt = 0
+    immed_w0[*l$index1[7], 0];                // fs->rack_ts = 0
     alu[x, --, B, *l$index1[3]];              // x = fs->tx_sent
     alu[*l$index1[1], *l$index1[1], +, x]     // fs->tx_avail += x
     alu[*l$index1[2], *l$index1[2], +, x]     // fs->tx_remote_avail += x
     alu[*l$index1[4], *l$index1[4], -, x]     // fs->tx_next_seq -= x
     alu[*l$index1[5], *l$index1[5], -, x]     // fs->tx_next_pos -= x
     alu[*l$index1[3], --, B, 0]               // fs->tx_sent = 0
+    alu[*l$index1[0], --, B, 0]               // fs->tx_sack = 0
+    alu[*l$index1[8], --, B, 0]               // fs->tx_rtx = 0
+  }
+
+}
+
+/**
+ * Tail loss probe: (re)start selective recovery at snd_una with a single
+ * segment. The ACK for the probe drives the rest of the repair.
+ *
+ * @param fs  Pointer to flow state.
+ *
+ * @return Bytes to schedule for retransmission, 0 if no probe is sent.
+ */
+__intrinsic uint32_t flows_tlp(__lmem struct flowst_tcp_t* fs)
+{
+  /* NOTE: Active LM address already points to FS */
+  uint32_t tx_sack, tx_rtx, tx_sent, end;
+
+  __asm {
+    alu[tx_sack, --, B, *l$index1[0]];        // tx_sack = fs->tx_sack
+    alu[tx_rtx, --, B, *l$index1[8]];         // tx_rtx = fs->tx_rtx
+    alu[tx_sent, --, B, *l$index1[3]];        // tx_sent = fs->tx_sent
+  }
+
+  if (tx_sent == 0)
+    return 0;
+
+  if (tx_rtx != 0) {
+    tx_rtx = TCP_SACK_RTX(TCP_SACK_REC(tx_rtx), 0);
+  }
+  else if (tx_sent <= TCP_OOO_MAX) {
+    tx_rtx = TCP_SACK_RTX(tx_sent, 0);
+  }
+  else {
+    return 0;
+  }
+
+  __asm {
+    alu[*l$index1[8], --, B, tx_rtx];         // fs->tx_rtx = tx_rtx
+  }
+  end = tcp_sack_hole_end(tx_sack, tx_rtx);
+  return MIN(end, TCP_MSS);
+}
+
+/**
+ * Apply a receive window change from the slowpath (see tcp_rxwnd.h).
+ *
+ * @param fs    Pointer to flow state.
+ * @param delta Change in TCP_RXWND_QUANTUM units.
+ *
+ * @return Work result flags.
+ */
+__intrinsic uint32_t flows_rxwnd(__lmem struct flowst_tcp_t* fs, int32_t delta)
+{
+  /* NOTE: Active LM address already points to FS */
+  uint32_t fs_flags, rx_avail, wnd, grow, flags;
+
+  __asm {
+    ld_field_w_clr[fs_flags, 12, *l$index1[7], >>16];  // fs_flags = fs->flags
+    alu[rx_avail, --, B, *l$index1[9]];                // rx_avail = fs->rx_avail
+    alu[wnd, --, B, *l$index1[15]];                    // wnd = fs->wnd
   }
 
+  wnd = tcp_rxwnd_adjust(wnd, delta, &grow);
+
+  flags = 0;
+#if FORCE_SEND_WINUPDATE
+  /* window opened from zero, the peer may be waiting for it */
+  if (rx_avail == 0 && grow != 0) {
+    flags = WORK_RESULT_QM_FORCE;
+    fs_flags = tcp_delack_owe(fs_flags);
+  }
+#endif
+
+  __asm {
+    alu[*l$index1[9], *l$index1[9], +, grow];          // fs->rx_avail += grow
+    alu[*l$index1[15], --, B, wnd];                    // fs->wnd = wnd
+    ld_field[*l$index1[7], 12, fs_flags, <<16];        // fs->flags = fs_flags
+  }
+
+  return flags;
 }
 
 __intrinsic void flows_retx(
@@ -334,7 +602,7 @@ __intrinsic void flows_retx(
                    __xwrite struct work_result_t*  result)
 {
   uint32_t old_avail, new_avail;
-  uint32_t flags;
+  uint32_t flags, rtx_bump;
 
   /* Set Active LM1 address as FS */
   __asm {
@@ -347,6 +615,22 @@ __intrinsic void flows_retx(
   result->work.__raw[2] = work->__raw[2];
   flags = 0;
 
+  if (work->retx.rxwnd) {
+    result->flags = flows_rxwnd(fs, work->retx.delta);
+    return;
+  }
+
+  /* probe: no reset, no rate cut */
+  if (work->retx.probe) {
+    rtx_bump = flows_tlp(fs);
+    if (rtx_bump != 0) {
+      result->qm_bump = rtx_bump;
+      flags = WORK_RESULT_QM;
+    }
+    result->flags = flags;
+    return;
+  }
+
   old_avail = tcp_txavail(fs, 0);
   flows_reset_retransmit(fs);
   new_avail = tcp_txavail(fs, 0);
@@ -356,7 +640,143 @@ __intrinsic void flows_retx(
     flags = WORK_RESULT_QM;
   }
 
-  result->flags = flags;
+  result->flags = flags | WORK_RESULT_RETX;
+}
+
+/**
+ * Re-arm RACK after an ACK advanced snd_una.
+ *
+ * @param fs      Pointer to flow state.
+ * @param ts_ecr  TS echoed in the ACK.
+ */
+__intrinsic void flows_rack_ack(__lmem struct flowst_tcp_t* fs, uint32_t ts_ecr)
+{
+  /* NOTE: Active LM address already points to FS */
+  uint32_t tx_sent, rack;
+
+  __asm {
+    alu[tx_sent, --, B, *l$index1[3]];        // tx_sent = fs->tx_sent
+  }
+  rack = tcp_rack_ack(local_csr_read(local_csr_timestamp_low), ts_ecr, tx_sent);
+  __asm {
+    ld_field[*l$index1[7], 3, rack, >>0];     // fs->rack_ts = rack
+  }
+}
+
+/**
+ * Check whether an ACK that did not advance snd_una marks it as lost: the
+ * peer reports later data (SACK block or duplicate ACK) after the RACK
+ * deadline passed.
+ *
+ * @param pkt Packet summary.
+ * @param fs  Pointer to flow state.
+ *
+ * @return != 0 if snd_una is lost.
+ */
+__intrinsic int flows_rack_lost(__xread struct pkt_summary_t* pkt,
+                                 __lmem struct flowst_tcp_t*  fs)
+{
+  /* NOTE: Active LM address already points to FS */
+  uint32_t tx_sent, remote_avail, rack;
+
+  __asm {
+    alu[tx_sent, --, B, *l$index1[3]];            // tx_sent = fs->tx_sent
+    alu[remote_avail, --, B, *l$index1[2]];       // remote_avail = fs->tx_remote_avail
+    ld_field_w_clr[rack, 3, *l$index1[7], >>0];   // rack = fs->rack_ts
+  }
+
+  if (tx_sent == 0)
+    return 0;
+
+  /* window updates say nothing about later data */
+  if (pkt->sack_l == pkt->sack_r &&
+      flows_remote_win(fs, pkt->win) != remote_avail)
+    return 0;
+
+  return tcp_rack_expired(local_csr_read(local_csr_timestamp_low), rack);
+}
+
+/**
+ * Update the SACK scoreboard and selective recovery state for a valid ACK.
+ *
+ * @param pkt         Packet summary.
+ * @param fs          Pointer to flow state.
+ * @param tx_bump     Bytes acknowledged by this ACK (already applied to fs).
+ * @param lost        RACK declared snd_una lost.
+ * @param [out] rtx_bump  Bytes of the next hole to schedule for retransmission.
+ *
+ * @return 1 if recovery was entered, -1 if the caller has to fall back to
+ *         go-back-N, 0 otherwise.
+ */
+__intrinsic int flows_recovery_ack(__xread struct pkt_summary_t* pkt,
+                                    __lmem struct flowst_tcp_t*  fs,
+                                           uint32_t              tx_bump,
+                                           uint32_t              lost,
+                                           uint32_t*             rtx_bump)
+{
+  /* NOTE: Active LM address already points to FS */
+  uint32_t tx_sack, tx_rtx, tx_sent, una, end, nxt, fs_flags;
+  int ret;
+
+  __asm {
+    alu[tx_sack, --, B, *l$index1[0]];        // tx_sack = fs->tx_sack
+    alu[tx_rtx, --, B, *l$index1[8]];         // tx_rtx = fs->tx_rtx
+  }
+
+  *rtx_bump = 0;
+  ret = 0;
+
+  /* common case: nothing lost, nothing to track */
+  if ((tx_sack | tx_rtx | lost) == 0 && pkt->sack_l == pkt->sack_r)
+    return 0;
+
+  __asm {
+    alu[tx_sent, --, B, *l$index1[3]];        // tx_sent = fs->tx_sent
+    alu[una, *l$index1[4], -, tx_sent];       // una = fs->tx_next_seq - tx_sent
+    ld_field_w_clr[fs_flags, 12, *l$index1[7], >>16];   // fs_flags = fs->flags
+  }
+
+  if (tx_bump != 0) {
+    tx_rtx = tcp_sack_rtx_advance(tx_rtx, tx_bump);
+    tx_sack = tcp_sack_advance(tx_sack, tx_rtx, tx_bump);
+  }
+
+  /* without progress only bytes beyond those already scheduled are new */
+  nxt = TCP_SACK_NXT(tx_rtx);
+  if (tx_bump == 0 && tx_rtx != 0) {
+    end = tcp_sack_hole_end(tx_sack, tx_rtx);
+    nxt = MAX(nxt, end);
+  }
+
+  if (pkt->sack_l != pkt->sack_r && (fs_flags & FLEXNIC_PL_FLOWST_SACK) != 0) {
+    tx_sack = tcp_sack_update(tx_sack, pkt->sack_l - una, pkt->sack_r - una,
+        tx_sent);
+  }
+
+  if (tx_rtx != 0) {
+    /* partial ACK: move on to the next hole, a second hole reported extends
+     * the repair to the recovery point */
+    end = tcp_sack_hole_end(tx_sack, tx_rtx);
+    if (end > nxt) {
+      *rtx_bump = end - nxt;
+    }
+  }
+  else if (lost) {
+    if (tx_sack == 0 || tx_sent > TCP_OOO_MAX)
+      return -1;
+
+    /* enter recovery: repair up to the first SACKed block (with more than one
+     * hole: up to the recovery point) */
+    tx_rtx = TCP_SACK_RTX(tx_sent, 0);
+    *rtx_bump = tcp_sack_hole_end(tx_sack, tx_rtx);
+    ret = 1;
+  }
+
+  __asm {
+    alu[*l$index1[0], --, B, tx_sack];        // fs->tx_sack = tx_sack
+    alu[*l$index1[8], --, B, tx_rtx];         // fs->tx_rtx = tx_rtx
+  }
+  return ret;
 }
 
 __intrinsic void flows_ack(
@@ -366,15 +786,16 @@ __intrinsic void flows_ack(
                  __xwrite struct work_result_t*  result)
 {
   uint32_t old_avail, new_avail;
-  uint32_t tx_sent, tx_pos, dupack_cnt, win, next_ts, rx_next_seq, tx_next_seq, ooo_len, fs_flags;
-  uint32_t tx_bump, flags;
+  uint32_t tx_sent, tx_pos, lost, win, next_ts, rx_next_seq, tx_next_seq, ooo_len, fs_flags;
+  uint32_t tx_bump, rtx_bump, flags;
+  int rec;
 
   /* Set Active LM1 address as FS */
   __asm {
     local_csr_wr[local_csr_active_lm_addr_1, fs];
   }
 
-  tx_bump = 0;
+  tx_bump = rtx_bump = lost = 0;
   flags = 0;
 
   /* Copy work to result */
@@ -414,9 +835,9 @@ __intrinsic void flows_ack(
       }
 
       __asm {
-        immed_w0[*l$index1[7], 0];                      // fs->dupack_cnt = 0;
         alu[tx_sent, --, B, *l$index1[3]];              // tx_sent = fs->tx_sent
       }
+      flows_rack_ack(fs, pkt->ts_ecr);
 
       flags |= WORK_RESULT_DMA_ACDESC;
       if (tx_sent == 0) {
@@ -424,18 +845,18 @@ __intrinsic void flows_ack(
       }
     }
     else {
-      __asm {
-        ld_field_w_clr[dupack_cnt, 3, *l$index1[7], >>0];     // dupack_cnt = fs->dupack_cnt;
-        alu[dupack_cnt, dupack_cnt, +, 1];                    // dupack_cnt += 1
-        ld_field[*l$index1[7], 3, dupack_cnt, >>0];           // fs->dupack_cnt = dupack_cnt
-      }
+      lost = flows_rack_lost(pkt, fs);
+    }
 
-      if (dupack_cnt >= 3) {
+    /* SACK flows only retransmit the holes */
+    rec = flows_recovery_ack(pkt, fs, tx_bump, lost, &rtx_bump);
+    if (rec != 0) {
+      if (rec < 0) {
         /* reset to last acknowledged position */
         flows_reset_retransmit(fs);
-        flags |= WORK_RESULT_RETX;
-        goto finalize;
       }
+      flags |= WORK_RESULT_RETX;
+      goto finalize;
     }
   }
 
@@ -448,9 +869,9 @@ __intrinsic void flows_ack(
   }
 
   /* update remote window */
-  win = pkt->win;
+  win = flows_remote_win(fs, pkt->win);
   __asm {
-    alu[*l$index1[2], --, B, win];       // fs->tx_remote_avail = pkt->win;
+    alu[*l$index1[2], --, B, win];       // fs->tx_remote_avail = win;
   }
 
   /* update next ts */
@@ -462,7 +883,7 @@ __intrinsic void flows_ack(
   /* process FIN */
   if (pkt->flags & NET_TCP_FLAG_FIN) {
     __asm {
-      alu[ooo_len, --, B, *l$index1[12]];       // ooo_len = fs->rx_ooo_len;
+      alu[ooo_len, --, B, *l$index1[12]];       // ooo_len = fs->rx_ooo[0];
       ld_field_w_clr[fs_flags, 12, *l$index1[7], >>16];   // fs_flags = fs->flags
     }
 
@@ -484,7 +905,10 @@ finalize:
   /* Flow control: More receiver space? -> might need to start sending */
   new_avail = tcp_txavail(fs, 0);
   if (old_avail < new_avail) {
-    result->qm_bump = (new_avail - old_avail);
+    rtx_bump += (new_avail - old_avail);
+  }
+  if (rtx_bump != 0) {
+    result->qm_bump = rtx_bump;
     flags |= WORK_RESULT_QM;
   }
 
@@ -505,7 +929,7 @@ finalize:
     }
     result->seq = tx_next_seq;
     result->ack = rx_next_seq;
-    result->win = win;
+    result->win = flows_win(fs, win);
     result->ts_val = 0;                           // Ignore echo TS for OoO or discard data
     result->ts_ecr = next_ts;
 
@@ -527,21 +951,25 @@ __intrinsic void flows_seg(
   uint32_t payload_bytes, orig_payload;
   uint32_t flags;
   uint32_t old_avail, new_avail;
-  uint32_t tx_bump, rx_bump;
+  uint32_t tx_bump, rx_bump, rtx_bump;
   uint32_t diff, pos;
   uint32_t seq;
   uint32_t trim_start, trim_end;
   uint32_t tx_sent, tx_pos;
-  uint32_t dupack_cnt, fs_flags;
-  uint32_t tx_next_seq, rx_next_seq, rx_ooo_len, rx_ooo_start;
+  uint32_t fs_flags;
+  uint32_t tx_next_seq, rx_next_seq, rx_ooo, ooo_bump, sack_iv;
   uint32_t rx_avail, win, tx_next_ts;
+  uint32_t dack_seg, dack;
+  int ooo_slot;
 
   /* Set Active LM1 address as FS */
   __asm {
     local_csr_wr[local_csr_active_lm_addr_1, fs];
   }
 
-  tx_bump = rx_bump = 0;
+  tx_bump = rx_bump = rtx_bump = 0;
+  sack_iv = 0;
+  dack_seg = 0;
 #if SKIP_ACK
   flags = 0;
 #else
@@ -560,6 +988,7 @@ __intrinsic void flows_seg(
   /* check if we should drop this segment */
   if (tcp_trim_rxbuf(fs, pkt->seq, payload_bytes, &trim_start, &trim_end) != 0) {
     /* packet is completely outside of the unused receive buffer */
+    FLOWS_COUNT_DROP();
 #if SKIP_ACK
     flags |= WORK_RESULT_TX;
 #endif
@@ -568,6 +997,7 @@ __intrinsic void flows_seg(
 #else
   /* check if we should drop this segment */
   if (tcp_valid_rxseq(fs, pkt->seq, payload_bytes, &trim_start, &trim_end) != 0) {
+    FLOWS_COUNT_DROP();
 #if SKIP_ACK
     flags |= WORK_RESULT_TX;
 #endif
@@ -602,14 +1032,17 @@ __intrinsic void flows_seg(
       }
 
       __asm {
-        immed_w0[*l$index1[7], 0];                      // fs->dupack_cnt = 0;
         alu[tx_sent, --, B, *l$index1[3]];              // tx_sent = fs->tx_sent
       }
+      flows_rack_ack(fs, pkt->ts_ecr);
 
       flags |= WORK_RESULT_DMA_ACDESC;
       if (tx_sent == 0) {
         flags |= WORK_RESULT_TXP_ZERO;
       }
+
+      /* partial ACK during selective recovery */
+      flows_recovery_ack(pkt, fs, tx_bump, 0, &rtx_bump);
     }
   }
 
@@ -632,47 +1065,34 @@ __intrinsic void flows_seg(
       goto finalize;
     }
 
-    /* otherwise check if we can add it to the out of order interval */
+    /* otherwise record it in the out of order intervals */
     diff = seq - rx_next_seq;
+    ooo_slot = tcp_ooo_insert(fs->rx_ooo, diff, payload_bytes);
+    if (ooo_slot >= 0) {
+      sack_iv = fs->rx_ooo[ooo_slot];
+    }
     __asm {
-      alu[pos, *l$index1[11], +, diff]; // pos = rx_next_pos + diff
+      local_csr_wr[local_csr_active_lm_addr_1, fs];   // restore LM1 after C access
+    }
+    if (ooo_slot < 0) {
+      /* no room left: drop, peer will retransmit */
+      FLOWS_COUNT_DROP();
+      goto finalize;
     }
 
     __asm {
-      alu[rx_ooo_len, --, B, *l$index1[12]];    // rx_ooo_len = fs->rx_ooo_len;
-      alu[rx_ooo_start, --, B, *l$index1[13]];  // rx_ooo_start = fs->rx_ooo_start;
+      alu[pos, *l$index1[11], +, diff]; // pos = rx_next_pos + diff
     }
+    result->dma_pos = pos;
+    WORK_DMA_OFFSET_LEN_SET(result, payload_bytes, trim_start + (pkt->optx << 2));
+    flags |= WORK_RESULT_DMA_PAYLOAD;
 
-    if (rx_ooo_len == 0) {
-      __asm {
-        alu[*l$index1[12], --, B, payload_bytes];           // fs->rx_ooo_len = payload_bytes
-        alu[*l$index1[13], --, B, seq];                     // fs->rx_ooo_start = seq
-      }
-
-      result->dma_pos = pos;
-      WORK_DMA_OFFSET_LEN_SET(result, payload_bytes, trim_start);
-      flags |= WORK_RESULT_DMA_PAYLOAD;
-    } else if (seq + payload_bytes == rx_ooo_start) {
-      /* TODO: those two overlap checks should be more sophisticated */
-      __asm {
-        alu[*l$index1[12], *l$index1[12], +, payload_bytes];  // fs->rx_ooo_len += payload_bytes
-        alu[*l$index1[13], --, B, seq];                       // fs->rx_ooo_start = seq
-      }
-
-      result->dma_pos = pos;
-      WORK_DMA_OFFSET_LEN_SET(result, payload_bytes, trim_start);
-      flags |= WORK_RESULT_DMA_PAYLOAD;
-    } else if (rx_ooo_start + rx_ooo_len == seq) {
-      /* TODO: those two overlap checks should be more sophisticated */
-      __asm {
-        alu[*l$index1[12], *l$index1[12], +, payload_bytes];  // fs->rx_ooo_len += payload_bytes
-      }
-
-      result->dma_pos = pos;
-      WORK_DMA_OFFSET_LEN_SET(result, payload_bytes, trim_start);
-      flags |= WORK_RESULT_DMA_PAYLOAD;
-    } else {
-      /* FIXME */
+    /* report the interval containing this segment first */
+    __asm {
+      ld_field_w_clr[fs_flags, 12, *l$index1[7], >>16];   // fs_flags = fs->flags
+    }
+    if ((fs_flags & FLEXNIC_PL_FLOWST_SACK) != 0) {
+      flags |= WORK_RESULT_SACK;
     }
     goto finalize;
   }
@@ -688,9 +1108,9 @@ __intrinsic void flows_seg(
   };
 
   /* update remote window */
-  win = pkt->win;
+  win = flows_remote_win(fs, pkt->win);
   __asm {
-    alu[*l$index1[2], --, B, win];   // fs->tx_remote_avail = pkt->win;
+    alu[*l$index1[2], --, B, win];   // fs->tx_remote_avail = win;
   }
 
   /* make sure we don't receive anymore payload after FIN */
@@ -707,10 +1127,11 @@ __intrinsic void flows_seg(
       alu[pos, --, B, *l$index1[11]];                       // pos = fs->rx_next_pos
     }
     result->dma_pos = pos;
-    WORK_DMA_OFFSET_LEN_SET(result, payload_bytes, trim_start);
+    WORK_DMA_OFFSET_LEN_SET(result, payload_bytes, trim_start + (pkt->optx << 2));
     flags |= (WORK_RESULT_DMA_PAYLOAD | WORK_RESULT_DMA_ACDESC);
 
     rx_bump = payload_bytes;
+    dack_seg = TCP_DELACK_IN_ORDER;
     __asm {
       alu[*l$index1[9], *l$index1[9], -, payload_bytes];    // fs->rx_avail      -= payload_bytes;
       alu[*l$index1[10], *l$index1[10], +, payload_bytes];  // fs->rx_next_seq   += payload_bytes;
@@ -718,39 +1139,33 @@ __intrinsic void flows_seg(
     }
 
 #if ALLOW_OOO_RECV
-    /* if we have out of order segments, check whether buffer is continuous
-     * or superfluous */
+    /* if we have out of order segments, rebase them and check whether the
+     * first one is continuous now */
     __asm {
-      alu[rx_ooo_len, --, B, *l$index1[12]];        // rx_ooo_len = fs->rx_ooo_len
-      alu[rx_ooo_start, --, B, *l$index1[13]];      // rx_ooo_start = fs->rx_ooo_start
+      alu[rx_ooo, --, B, *l$index1[12]];            // rx_ooo = fs->rx_ooo[0]
     }
-    if (rx_ooo_len != 0) {
-      if (tcp_trim_rxbuf(fs, rx_ooo_start, rx_ooo_len, &trim_start, &trim_end) != 0) {
-        /* completely superfluous: drop out of order interval */
-        __asm {
-          alu[*l$index1[12], --, B, 0];           // fs->rx_ooo_len = 0;
-        }
-      } else {
+    if (rx_ooo != 0) {
+      ooo_bump = tcp_ooo_advance(fs->rx_ooo, payload_bytes);
+      rx_ooo = fs->rx_ooo[0];
+      __asm {
+        local_csr_wr[local_csr_active_lm_addr_1, fs];   // restore LM1 after C access
+      }
+
+      if (ooo_bump != 0) {
+        /* yay, we caught up, make continuous */
+        dack_seg |= TCP_DELACK_URGENT;
         __asm {
-          alu[*l$index1[13], *l$index1[13], +, trim_start];     // fs->rx_ooo_start += trim_start;
-          alu[*l$index1[12], *l$index1[12], -, trim_start];     // fs->rx_ooo_len -= trim_start;
-          alu[*l$index1[12], *l$index1[12], -, trim_end];       // fs->rx_ooo_len -= trim_end;
-          alu[rx_ooo_len, --, B, *l$index1[12]];                // rx_ooo_len = fs->rx_ooo_len
-          alu[rx_ooo_start, --, B, *l$index1[13]];              // rx_ooo_start = fs->rx_ooo_start
-          alu[rx_next_seq, --, B, *l$index1[10]];               // rx_next_seq = fs->rx_next_seq
+          alu[rx_bump, rx_bump, +, ooo_bump];             // rx_bump           += ooo_bump;
+          alu[*l$index1[9], *l$index1[9], -, ooo_bump];   // fs->rx_avail      -= ooo_bump;
+          alu[*l$index1[10], *l$index1[10], +, ooo_bump]; // fs->rx_next_seq   += ooo_bump;
+          alu[*l$index1[11], *l$index1[11], +, ooo_bump]; // temp = fs->rx_next_pos + ooo_bump;
         }
+      }
 
-        if (rx_ooo_len > 0 && rx_ooo_start == rx_next_seq) {
-          /* yay, we caught up, make continuous and drop OOO interval */
-
-          __asm {
-            alu[rx_bump, rx_bump, +, rx_ooo_len];             // rx_bump           += rx_ooo_len;
-            alu[*l$index1[9], *l$index1[9], -, rx_ooo_len];   // fs->rx_avail      -= rx_ooo_len;
-            alu[*l$index1[10], *l$index1[10], +, rx_ooo_len]; // fs->rx_next_seq   += rx_ooo_len;
-            alu[*l$index1[12], --, B, 0];                     // fs->rx_ooo_len     = 0;
-            alu[*l$index1[11], *l$index1[11], +, rx_ooo_len]; // temp = fs->rx_next_pos + rx_ooo_len;
-          }
-        }
+      /* still holes: point the peer at the data after the next one */
+      if (rx_ooo != 0 && (fs_flags & FLEXNIC_PL_FLOWST_SACK) != 0) {
+        sack_iv = rx_ooo;
+        flags |= WORK_RESULT_SACK;
       }
     }
     __critical_path();
@@ -760,10 +1175,10 @@ __intrinsic void flows_seg(
   if (((pkt->flags & NET_TCP_FLAG_FIN) != 0) && ((fs_flags & FLEXNIC_PL_FLOWST_RXFIN) == 0)) {
     __asm {
       alu[rx_next_seq, --, B, *l$index1[10]];   // rx_next_seq = fs->rx_next_seq;
-      alu[rx_ooo_len, --, B, *l$index1[12]];    // rx_ooo_len = fs->rx_ooo_len;
+      alu[rx_ooo, --, B, *l$index1[12]];        // rx_ooo = fs->rx_ooo[0];
     }
 
-    if ((rx_next_seq == pkt->seq + orig_payload) && (rx_ooo_len == 0)) {
+    if ((rx_next_seq == pkt->seq + orig_payload) && (rx_ooo == 0)) {
       flags |= (WORK_RESULT_FIN | WORK_RESULT_DMA_ACDESC | WORK_RESULT_TX);
       fs_flags |= FLEXNIC_PL_FLOWST_RXFIN;
 
@@ -779,7 +1194,10 @@ finalize:
   /* Flow control: More receiver space? -> might need to start sending */
   new_avail = tcp_txavail(fs, 0);
   if (old_avail < new_avail) {
-    result->qm_bump = (new_avail - old_avail);
+    rtx_bump += (new_avail - old_avail);
+  }
+  if (rtx_bump != 0) {
+    result->qm_bump = rtx_bump;
     flags |= WORK_RESULT_QM;
   }
 
@@ -790,6 +1208,27 @@ finalize:
     flags |= WORK_RESULT_ECNB;
   }
 
+#if !SKIP_ACK
+  /* delayed ACKs: ACK holes, FIN and a closing window right away */
+  __asm {
+    ld_field_w_clr[fs_flags, 12, *l$index1[7], >>16];   // fs_flags = fs->flags
+    alu[rx_avail, --, B, *l$index1[9]];                 // rx_avail = fs->rx_avail
+  }
+  if ((flags & (WORK_RESULT_FIN | WORK_RESULT_SACK)) != 0 || rx_avail < delack_wnd) {
+    dack_seg |= TCP_DELACK_URGENT;
+  }
+  fs_flags = tcp_delack_rx(fs_flags, pkt->ecn, dack_seg, delack_segs, &dack);
+  __asm {
+    ld_field[*l$index1[7], 12, fs_flags, <<16];         // fs->flags = fs_flags
+  }
+  if ((dack & TCP_DELACK_DELAY) != 0) {
+    flags &= ~WORK_RESULT_TX;
+    if ((dack & TCP_DELACK_ARM) != 0) {
+      flags |= WORK_RESULT_DELACK;
+    }
+  }
+#endif
+
   result->ts_val = pkt->ts_ecr;
 #if SKIP_ACK
   if (flags & WORK_RESULT_TX) {
@@ -801,13 +1240,30 @@ finalize:
       alu[tx_next_ts, --, B, *l$index1[6]];     // tx_next_ts = fs->tx_next_ts;
     }
     result->seq = tx_next_seq;
+#if SKIP_ACK
     result->ack = rx_next_seq;
-    result->win = rx_avail;
+#else
+    /* CE state changed: only ACK the delayed segments */
+    result->ack = ((dack & TCP_DELACK_PREV) != 0 ? rx_next_seq - rx_bump : rx_next_seq);
+#endif
+    if (flags & WORK_RESULT_SACK) {
+      /* SACK block follows the TS option, see prepare_ack_header() */
+      WORK_SACK_WIN_SET(result, flows_win(fs, rx_avail), TCP_OOO_LEN(sack_iv));
+      result->sack_left = rx_next_seq + TCP_OOO_OFF(sack_iv);
+    } else {
+      result->win = flows_win(fs, rx_avail);
+    }
     result->ts_ecr = tx_next_ts;
 
+#if SKIP_ACK
     if (pkt->ecn) {
       flags |= WORK_RESULT_ECE;
     }
+#else
+    if ((dack & TCP_DELACK_ECE) != 0) {
+      flags |= WORK_RESULT_ECE;
+    }
+#endif
 
 #if SKIP_ACK
   }
@@ -10,6 +10,8 @@
 #include "fp_mem.h"
 #include "pipeline.h"
 
+__intrinsic void flows_init();
+
 __intrinsic void flows_tx(
                           struct work_t*        work,
                    __lmem struct flowst_tcp_t*  fs,
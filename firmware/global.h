@@ -9,6 +9,9 @@
 
 __export __shared __emem __align8M struct flextcp_pl_mem fp_state;
 
+/* Always-on counters, see fp_mem.h. Posted increment, no signal to wait on. */
+#define COUNTER_INC(_cnt)  mem_incr64((__mem40 void*) &fp_state.counters.cnt[FP_CNT_##_cnt])
+
 #if FP_LOG_ENABLE || FP_STAT_ENABLE || FP_PROF_ENABLE
 __export __shared __emem struct flextcp_pl_debug fp_debug;
 #endif
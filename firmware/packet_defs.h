@@ -6,6 +6,7 @@
 
 #include <stdint.h>
 
+#include <nfp/mem_bulk.h>
 #include <pkt/pkt.h>
 #include <net/eth.h>
 #include <net/ip.h>
@@ -14,7 +15,8 @@
 /**
  * TCP Options definitions
  *
- * NOTE: Only EOL/NOOP/TS supported in fastpath
+ * NOTE: Only EOL/NOOP/TS supported in fastpath, plus the first block of a
+ *       padded SACK option directly after TS (see tcp_sack.h)
  *
  * Format:
  *  Kind:     1 byte
@@ -23,12 +25,16 @@
  */
 #define NET_TCP_OPT_KIND_EOL        0   /*> End of List indicator */
 #define NET_TCP_OPT_KIND_NOOP       1   /*> No-Option: used for padding */
+#define NET_TCP_OPT_KIND_SACK       5   /*> Selective ACK blocks */
 #define NET_TCP_OPT_KIND_TIMESTAMP  6   /*> Timestamp */
 
 #define NET_TCP_OPT_LEN_NOOP          1   /*> Length of No-Op */
 #define NET_TCP_OPT_LEN_TIMESTAMP     10  /*> Length of Timestamp option including kind + length */
 #define NET_TCP_OPT_LEN_PADTIMESTAMP    (2 * NET_TCP_OPT_LEN_NOOP + NET_TCP_OPT_LEN_TIMESTAMP)
 #define NET_TCP_OPT_LEN32_PADTIMESTAMP  (NET_TCP_OPT_LEN_PADTIMESTAMP/4)
+#define NET_TCP_OPT_LEN_SACK1         10  /*> Length of SACK option with one block */
+#define NET_TCP_OPT_LEN_PADSACK1        (2 * NET_TCP_OPT_LEN_NOOP + NET_TCP_OPT_LEN_SACK1)
+#define NET_TCP_OPT_LEN32_PADSACK1      (NET_TCP_OPT_LEN_PADSACK1/4)
 
 /* Type definition for Timestamp option */
 __packed struct tcp_timestamp_opt {
@@ -53,6 +59,21 @@ struct tcp_timestamp_padded_opt {
   };
 };
 
+/* Padded SACK option, first block only */
+struct tcp_sack_padded_opt {
+  union {
+    __packed struct {
+      uint8_t __noop1;      /*> No-option for padding */
+      uint8_t __noop2;      /*> No-option for padding */
+      uint8_t   opt_kind;   /*> Option Kind */
+      uint8_t   opt_length; /*> Option Header Length */
+      uint32_t  left;       /*> Left edge of first block */
+      uint32_t  right;      /*> Right edge of first block */
+    };
+    uint32_t __raw[NET_TCP_OPT_LEN32_PADSACK1];
+  };
+};
+
 /**
  * Packet structure (RAW: before preprocessing!)
  *
@@ -196,6 +217,7 @@ struct pkt_hdr_t {
 
 /**
  * Packet summary: Condensed protocol headers after processing
+ * NOTE: Stored after the NBI metadata, has to fit below PKT_NBI_OFFSET
  */
 struct pkt_summary_t {
   union {
@@ -204,18 +226,51 @@ struct pkt_summary_t {
       uint32_t ack;
 
       uint32_t ecn:1;
-      uint32_t rsvd:7;
+      uint32_t rsvd:3;
+      uint32_t optx:4;    /*> TCP option words after the padded TS option */
       uint32_t flags:8;
       uint32_t win:16;
 
       uint32_t ts_val;
       uint32_t ts_ecr;
+
+      uint32_t sack_l;    /*> First SACK block, sack_l == sack_r if none */
+      uint32_t sack_r;
     };
 
-    uint32_t __raw[5];
+    /* Once processed: SACK option of the ACK, see pkt_ack_sack_place() */
+    __packed struct {
+      uint32_t __rsvd[4];
+      uint32_t ack_sack[NET_TCP_OPT_LEN32_PADSACK1];
+    };
+
+    uint32_t __raw[7];
   };
 };
 
+/*> Offsets in the packet buffer of the staged and the sent ACK SACK option */
+#define PKT_ACK_SACK_STAGE_OFF  (sizeof(struct nbi_meta_catamaran) + 4 * sizeof(uint32_t))
+#define PKT_ACK_SACK_OFF        (PKT_NBI_OFFSET + MAC_PREPEND_BYTES + NET_HDR_LEN)
+
+/**
+ * Move the SACK option of an ACK in place, right after the padded TS option.
+ * Postprocessing stages it in the consumed packet summary because it
+ * overlaps the received payload; call once the payload DMA completed.
+ */
+__intrinsic static void pkt_ack_sack_place(uint32_t isl, uint32_t pnum)
+{
+  __xread uint32_t sack_rd[NET_TCP_OPT_LEN32_PADSACK1];
+  __xwrite uint32_t sack_wr[NET_TCP_OPT_LEN32_PADSACK1];
+  __mem40 uint8_t* pbuf;
+
+  pbuf = pkt_ctm_ptr40(isl, pnum, 0);
+  mem_read32(sack_rd, pbuf + PKT_ACK_SACK_STAGE_OFF, sizeof(sack_rd));
+  sack_wr[0] = sack_rd[0];
+  sack_wr[1] = sack_rd[1];
+  sack_wr[2] = sack_rd[2];
+  mem_write32(sack_wr, pbuf + PKT_ACK_SACK_OFF, sizeof(sack_wr));
+}
+
 #define TCPH_HDRLEN_FLAGS_WIN_SET(_HDR, _HLEN, _FLAGS, _WIN)  \
           (_HDR)->__raw[3] = (_HLEN) | ((_FLAGS) << 8) | ((_WIN) << 16)
 #define TCPH_CHKSUM_URP_SET(_HDR, _VAL)  \
@@ -89,6 +89,18 @@ struct work_t
       uint32_t plen:11;     /*> Payload length */
     } io;
 
+    __packed struct {
+      uint32_t type:2;      /*> WORK_TYPE_ */
+      uint32_t probe:1;     /*> Tail loss probe instead of timeout */
+      uint32_t rxwnd:1;     /*> Receive window change instead of timeout */
+      uint32_t rsvd0:28;
+
+      int32_t delta;        /*> rxwnd: change in TCP_RXWND_QUANTUM units */
+
+      uint32_t flow_id:16;
+      uint32_t rsvd2:16;
+    } retx;
+
     __packed struct {
       uint32_t type:2;      /*> WORK_TYPE_ */
       uint32_t fin:1;
@@ -119,11 +131,15 @@ struct work_t
 #define  WORK_RESULT_ECE                  (1 << 7)     /*> Generate ECN echo                 */
 #define  WORK_RESULT_TXP_ZERO             (1 << 8)     /*> If fs->tx_sent == 0               */
 #define  WORK_RESULT_ECNB                 (1 << 9)     /*> ECN echo received                 */
+#define  WORK_RESULT_SACK                 (1 << 10)    /*> Send SACK block after TS option   */
+#define  WORK_RESULT_DELACK               (1 << 11)    /*> Arm delayed ACK timer in QM       */
 
 #define WORK_TCPH_FLAGS_WIN_SET(_RSLT, _FLAGS, _WIN)    \
           (_RSLT)->__raw[5]  = ((NET_TCPPADTS_LEN32 <<  28) | ((_FLAGS) << 16) | (_WIN))
 #define WORK_DMA_OFFSET_LEN_SET(_RSLT, _LEN, _OFFSET)   \
           (_RSLT)->__raw[10]  =  (((_LEN) << 16) | (_OFFSET))
+#define WORK_SACK_WIN_SET(_RSLT, _WIN, _SACK_LEN)      \
+          (_RSLT)->win  =  (((_SACK_LEN) << 16) | (_WIN))
 
 /** Work Result */
 struct work_result_t
@@ -136,7 +152,7 @@ struct work_result_t
       uint32_t seq;
       uint32_t ack;
 
-      uint32_t win;
+      uint32_t win;           /*> Window field, with SACK: SACK block length in upper 16 bits */
 
       uint32_t ts_val;        /*> TS echo by remote peer */
       uint32_t ts_ecr;        /*> TS echo to remote peer */
@@ -150,9 +166,11 @@ struct work_result_t
       uint32_t ac_rx_bump;    /*> RX Bump to AC descriptor */
       uint32_t ac_tx_bump;    /*> TX Bump to AC descriptor */
       uint32_t flags;         /*> Refer to WORK_RESULT flags */
+
+      uint32_t sack_left;     /*> With SACK: left edge of the SACK block */
     };
 
-    uint32_t __raw[14];
+    uint32_t __raw[15];
   };
 };
 
@@ -22,6 +22,7 @@
 #include "desc_pool.h"
 #include "packet_defs.h"
 #include "pipeline.h"
+#include "tcp_sack.h"
 
 #include "shared.h"
 #include "global.h"
@@ -80,8 +81,11 @@ __forceinline unsigned int handle_mem_cache_miss(uint32_t flow_id)
 __intrinsic void prepare_ack_header(__xread struct work_result_t* result)
 {
   __xwrite struct hdr_tcp_t hdr;
+  __xwrite struct tcp_sack_padded_opt sack;
+  __xwrite unsigned int ip_len;
   __mem40 uint8_t* pbuf;
-  uint32_t tcp_flags, win;
+  uint32_t tcp_flags, win, hlen;
+  SIGNAL sig0, sig1;
 
   /* Skip header prep if no TX */
   if ((result->flags & WORK_RESULT_TX) == 0)
@@ -96,24 +100,59 @@ __intrinsic void prepare_ack_header(__xread struct work_result_t* result)
   if (result->flags & WORK_RESULT_ECE) {
     tcp_flags |= NET_TCP_FLAG_ECE;
   }
+  hlen = NET_TCPPADTS_LEN32;
   win = MIN(result->win, 0xFFFF);
-  hdr.__raw[3] = (NET_TCPPADTS_LEN32 <<  28) | (tcp_flags << 16) | (win);   // TCP offset, flags & window
-  hdr.__raw[4] = 0;                  // sum, urp = 0
-
+  if (result->flags & WORK_RESULT_SACK) {
+    /* SACK block length in the upper half */
+    hlen += NET_TCP_OPT_LEN32_PADSACK1;
+    win = result->win & 0xFFFF;
+  }
 #if TCP_TIMESTAMP_ENABLE
   hdr.tcpopts.__raw[0] = PKT_TCP_OPT_RAW0;
   hdr.tcpopts.ts_val = local_csr_read(local_csr_timestamp_low);
   hdr.tcpopts.ts_ecr = result->ts_ecr;
 #else
-  hdr.tcpopts.__raw[0] = 0;
-  hdr.tcpopts.ts_val = 0;
-  hdr.tcpopts.ts_ecr = 0;
+  if (result->flags & WORK_RESULT_SACK) {
+    /* an EOL would hide the SACK block */
+    hdr.tcpopts.__raw[0] = TCP_SACK_OPT_NOP;
+    hdr.tcpopts.ts_val = TCP_SACK_OPT_NOP;
+    hdr.tcpopts.ts_ecr = TCP_SACK_OPT_NOP;
+  } else {
+    hdr.tcpopts.__raw[0] = 0;
+    hdr.tcpopts.ts_val = 0;
+    hdr.tcpopts.ts_ecr = 0;
+  }
 #endif
+  hdr.__raw[3] = (hlen <<  28) | (tcp_flags << 16) | (win);   // TCP offset, flags & window
+  hdr.__raw[4] = 0;                  // sum, urp = 0
 
   /* Skip the first word in TCP header */
   pbuf = pkt_ctm_ptr40(result->work.io.isl + 32, result->work.io.pnum,
                   PKT_NBI_OFFSET + MAC_PREPEND_BYTES + NET_ETH_LEN + NET_IP4_LEN + 4);
-  mem_write32(&hdr.__raw[1], pbuf, sizeof(struct hdr_tcp_t) - 4);
+  if ((result->flags & WORK_RESULT_SACK) == 0) {
+    __critical_path();
+    mem_write32(&hdr.__raw[1], pbuf, sizeof(struct hdr_tcp_t) - 4);
+    return;
+  }
+  __mem_write32(&hdr.__raw[1], pbuf,
+            sizeof(struct hdr_tcp_t) - 4, sizeof(struct hdr_tcp_t) - 4,
+            sig_done, &sig0);
+
+  /* The SACK block goes where the received payload still is: stage it in
+   * the consumed packet summary, DMA moves it once the payload is out */
+  sack.__raw[0] = TCP_SACK_OPT_SACK1;
+  sack.left = result->sack_left;
+  sack.right = result->sack_left + (result->win >> 16);
+  pbuf = pkt_ctm_ptr40(result->work.io.isl + 32, result->work.io.pnum,
+                  PKT_ACK_SACK_STAGE_OFF);
+  __mem_write32(&sack, pbuf, sizeof(sack), sizeof(sack), sig_done, &sig1);
+  __wait_for_all(&sig0, &sig1);
+
+  /* Modify IP len, keep the TOS preprocess chose */
+  pbuf = pkt_ctm_ptr40(result->work.io.isl + 32, result->work.io.pnum,
+                  PKT_NBI_OFFSET + MAC_PREPEND_BYTES + NET_ETH_LEN + 2);
+  ip_len = (NET_IP4_LEN + NET_TCPPADTS_LEN + NET_TCP_OPT_LEN_PADSACK1) << 16;
+  mem_write8(&ip_len, pbuf, 2);
 }
 
 #define IP_RAW_WORD0(tos, len) (0x45000000 | (tos << 16) | (len)) /*> Ver: 4 | HL: 5 | TOS: y | LEN: x */
@@ -138,6 +177,9 @@ __intrinsic void prepare_seg_header(__xread struct work_result_t* result)
   if (result->flags & WORK_RESULT_FIN) {
     tcp_flags |= NET_TCP_FLAG_FIN;
   }
+  if (result->flags & WORK_RESULT_ECE) {
+    tcp_flags |= NET_TCP_FLAG_ECE;
+  }
   win = MIN(result->win, 0xFFFF);
   hdr.__raw[3] = (NET_TCPPADTS_LEN32 <<  28) | (tcp_flags << 16) | (win);   // TCP offset, flags & window
   hdr.__raw[4] = 0;                  // sum, urp = 0
@@ -216,11 +258,17 @@ __intrinsic void collect_cc_stats(__xread struct work_result_t* result)
     if ((result->flags & WORK_RESULT_ECNB) != 0) {
       mem_add32_imm(result->ac_tx_bump, (__mem40 uint64_t*) &cc_info->cnt_rx_ecn_bytes);
     }
+
+    /* Count received bytes for receive window autotuning */
+    if (result->ac_rx_bump != 0) {
+      mem_add32_imm(result->ac_rx_bump, (__mem40 uint64_t*) &cc_info->cnt_rx_bytes);
+    }
   }
 
   /* Count tx_drops */
   if ((result->flags & WORK_RESULT_RETX) != 0) {
     mem_incr32((__mem40 uint32_t*) &cc_info->cnt_tx_drops);
+    COUNTER_INC(RETX);
     mem_write32_atomic_imm(0, &cc_info->txp);
 
     /* Cut the rate by half => double the cycles */
@@ -352,24 +400,32 @@ int prepare_dma_cmd(__xread struct work_result_t* result,
   return ret;
 }
 
+__intrinsic void push_qm_force(__xread struct work_result_t* result)
+{
+  unsigned int rnum, raddr_hi;
+  __gpr struct schedule_t sched;
+
+  if ((result->flags & WORK_RESULT_QM_FORCE) == 0)
+    return;
+
+  rnum = QM_SCHED_RNUM_BASE + (__ISLAND - 32);
+  raddr_hi = MEM_RING_GET_MEMADDR(qm_sched_ring0);
+  sched.force = 1;
+  sched.flow_id = result->work.flow_id;
+  mem_workq_add_work_imm(rnum, raddr_hi, sched.__raw);
+  STATS_INC(QM_SCHEDULE);
+}
+
 __forceinline void postprocess_ac(__xread struct work_result_t* result)
 {
   unsigned int rnum, raddr_hi;
   unsigned int desc_idx;
-  __gpr struct schedule_t sched;
 
   /* Update QM */
   push_qm_bump(result);
 
   /* Push QM force */
-  if (result->flags & WORK_RESULT_QM_FORCE) {
-    rnum = QM_SCHED_RNUM_BASE + (__ISLAND - 32);
-    raddr_hi = MEM_RING_GET_MEMADDR(qm_sched_ring0);
-    sched.force = 1;
-    sched.flow_id = result->work.flow_id;
-    mem_workq_add_work_imm(rnum, raddr_hi, sched.__raw);
-    STATS_INC(QM_SCHEDULE);
-  }
+  push_qm_force(result);
 
   /* Free descriptor */
   rnum = MEM_RING_GET_NUM(atx_desc_ring);
@@ -388,6 +444,13 @@ __forceinline void postprocess_retx(__xread struct work_result_t* result)
   /* Update QM */
   push_qm_bump(result);
 
+  /* Receive window opened from zero */
+  push_qm_force(result);
+
+  /* Tail loss probes and window changes leave the rate alone */
+  if ((result->flags & WORK_RESULT_RETX) == 0)
+    return;
+
   /* Half the rate => double the cycles */
   flow_id = result->work.flow_id;
   mem_read_atomic(&tx_rate, (__mem40 uint32_t*) &fp_state.flows_cc_info[flow_id].tx_rate, sizeof(tx_rate));
@@ -397,6 +460,7 @@ __forceinline void postprocess_retx(__xread struct work_result_t* result)
   mem_write32_atomic_imm(0, (__mem40 uint32_t*) &fp_state.flows_cc_info[flow_id].txp);
 
   mem_incr32((__mem40 uint32_t*) (__mem40 uint32_t*) &fp_state.flows_cc_info[flow_id].cnt_tx_drops);
+  COUNTER_INC(RETX);
 }
 
 #define TM_Q_DST  NS_PLATFORM_NBI_TM_QID_UNTAGGED(PORT_IN_USE, 0)
@@ -449,6 +513,7 @@ __forceinline void postprocess_tx(__xread struct work_result_t* result)
     pkt_nbi_send(result->work.io.isl + 32, result->work.io.pnum, &msi,
         NET_HDR_LEN + 4, 0, TM_Q_DST, result->work.io.seqr, result->work.io.seq, PKTBUF_CTM_SIZE);
     STATS_INC(DMA_TX_FWD_SEG);
+    COUNTER_INC(TX_SEG);
     return;
   }
 
@@ -489,6 +554,13 @@ __forceinline void postprocess_rx(__xread struct work_result_t* result)
   /* Update QM */
   push_qm_bump(result);
 
+  /* Arm delayed ACK timer */
+  if (result->flags & WORK_RESULT_DELACK) {
+    rnum = MEM_RING_GET_NUM(qm_delack_ring);
+    raddr_hi = MEM_RING_GET_MEMADDR(qm_delack_ring);
+    mem_workq_add_work_imm(rnum, raddr_hi, flow_grp_mask | result->work.flow_id);
+  }
+
   /* Update CC stats */
   collect_cc_stats(result);
 
@@ -535,6 +607,9 @@ int main()
   /* Timestamp */
   uint32_t t_prev, t_curr, t_diff;
 
+  /* Work queue entries are at most 16 words */
+  ctassert(sizeof(struct work_result_t) <= 64);
+
   if (ctx() == 0) {
     reset_cache();
     enable_global_timestamp();
@@ -570,21 +645,25 @@ int main()
     switch (result.work.type) {
     case WORK_TYPE_AC:
       STATS_INC(AC_POSTPROC_IN);
+      JOURNAL_EVENT(POST_AC, result.work.flow_id, result.ac_tx_bump);
       postprocess_ac(&result);
       break;
 
     case WORK_TYPE_RETX:
       STATS_INC(RETX_POSTPROC_IN);
+      JOURNAL_EVENT(POST_RETX, result.work.flow_id, result.seq);
       postprocess_retx(&result);
       break;
 
     case WORK_TYPE_TX:
       STATS_INC(TX_POSTPROC_IN);
+      JOURNAL_EVENT(POST_TX, result.work.flow_id, result.seq);
       postprocess_tx(&result);
       break;
 
     case WORK_TYPE_RX:
       STATS_INC(RX_POSTPROC_IN);
+      JOURNAL_EVENT(POST_RX, result.work.flow_id, result.seq);
       postprocess_rx(&result);
       break;
     }
@@ -22,6 +22,7 @@
 #include "dma.h"
 #include "qman.h"
 #include "flow_lookup.h"
+#include "tcp_sack.h"
 
 #include "shared.h"
 #include "global.h"
@@ -37,26 +38,31 @@ __forceinline unsigned int get_flowgrp_rnum(uint32_t flow_grp)
   switch (flow_grp) {
   case 0:
     STATS_INC(GRP0);
+    COUNTER_INC(GRP0);
     rnum = MEM_RING_GET_NUM(flow_ring_0);
     break;
 
   case 1:
     STATS_INC(GRP1);
+    COUNTER_INC(GRP1);
     rnum = MEM_RING_GET_NUM(flow_ring_1);
     break;
 
   case 2:
     STATS_INC(GRP2);
+    COUNTER_INC(GRP2);
     rnum = MEM_RING_GET_NUM(flow_ring_2);
     break;
 
   case 3:
     STATS_INC(GRP3);
+    COUNTER_INC(GRP3);
     rnum = MEM_RING_GET_NUM(flow_ring_3);
     break;
 
   default:
     STATS_INC(RX_SP);
+    COUNTER_INC(RX_SP);
     rnum = MEM_RING_GET_NUM(flow_ring_sp);
     break;
   }
@@ -139,12 +145,38 @@ __intrinsic int validate_pkt_hdr(__xread struct pkt_hdr_t* hdr)
   int cond;
 
   cond =  ((hdr->tcp.flags & (~TCP_FP_FLAGS)) == 0) &&
+          (hdr->tcp.off >= NET_TCPPADTS_LEN32) &&
           (hdr->tcpopts.__raw[0] == PKT_TCP_OPT_RAW0);
 
   return cond;
 }
 
+/**
+ * Read the first SACK block if a padded SACK option follows the TS option,
+ * the layout of our own ACKs (tcp_sack.h) and of Linux. Other options are
+ * skipped.
+ */
+__intrinsic void read_sack_block(__mem40 uint8_t* pbuf, uint32_t optx,
+                                 uint32_t *sack_l, uint32_t *sack_r)
+{
+  __xread struct tcp_sack_padded_opt sack;
+
+  *sack_l = 0;
+  *sack_r = 0;
+  if (optx < NET_TCP_OPT_LEN32_PADSACK1)
+    return;
+
+  mem_read32(&sack, pbuf + PKT_NBI_OFFSET + MAC_PREPEND_BYTES - 2 + sizeof(struct pkt_hdr_t),
+             sizeof(sack));
+  if (((sack.__raw[0] & TCP_SACK_OPT_SACK_MASK) == TCP_SACK_OPT_SACK) &&
+      (sack.opt_length >= NET_TCP_OPT_LEN_SACK1)) {
+    *sack_l = sack.left;
+    *sack_r = sack.right;
+  }
+}
+
 __intrinsic void generate_pkt_summary(__xread struct pkt_hdr_t* hdr,
+                                  uint32_t optx, uint32_t sack_l, uint32_t sack_r,
                                   __xwrite struct pkt_summary_t* pkt_summary)
 {
   uint32_t raw;
@@ -152,11 +184,14 @@ __intrinsic void generate_pkt_summary(__xread struct pkt_hdr_t* hdr,
   pkt_summary->seq = hdr->tcp.seq;
   pkt_summary->ack = hdr->tcp.ack;
   raw = (hdr->__raw[12] & 0xFFFFFF); // TCP flags;
+  raw |= (optx << 24);
   if (hdr->ip.tos == 3) /* Congestion indicated */
     raw |= (1 << 31);
   pkt_summary->__raw[2] = raw;
   pkt_summary->ts_val = hdr->tcpopts.ts_val;
   pkt_summary->ts_ecr = hdr->tcpopts.ts_ecr;
+  pkt_summary->sack_l = sack_l;
+  pkt_summary->sack_r = sack_r;
 }
 
 struct pkt_hdr_preproc_t
@@ -383,11 +418,13 @@ __forceinline void preprocess_rx(__xread struct pkt_raw_t*     pkt,
 
   uint32_t seq, seqr;
   uint32_t flow_id, flow_grp;
+  uint32_t optx, sack_l, sack_r;
   __mem40 uint8_t* pbuf;
 
   __gpr struct work_t work;
 
   STATS_INC(RX_TOTAL);
+  COUNTER_INC(RX);
 
   flow_grp     = NUM_FLOW_GROUPS; /* SLOWPATH */
   work.io.type    = WORK_TYPE_RX;
@@ -408,7 +445,11 @@ __forceinline void preprocess_rx(__xread struct pkt_raw_t*     pkt,
   if (!validate_pkt_hdr(&hdr))
     goto FORWARD;
 
-  generate_pkt_summary(&hdr, &pkt_summary);
+  /* options beyond the padded TS option: only a SACK block is used */
+  optx = hdr.tcp.off - NET_TCPPADTS_LEN32;
+  read_sack_block(pbuf, optx, &sack_l, &sack_r);
+
+  generate_pkt_summary(&hdr, optx, sack_l, sack_r, &pkt_summary);
   prepare_ack_header(&hdr, &hdr_mod);
 
   /* Issue summary, header writes hoping for lookup to succeed! */
@@ -433,7 +474,7 @@ __forceinline void preprocess_rx(__xread struct pkt_raw_t*     pkt,
   }
 
   work.io.flow_id = flow_id;
-  work.io.plen   -= (MAC_PREPEND_BYTES + NET_HDR_LEN);
+  work.io.plen   -= (MAC_PREPEND_BYTES + NET_HDR_LEN + (optx << 2));
   __wait_for_all(&summary_sig, &hdr_mod_sig, &egress_cmd_sig, &pkt_msi_sig);
 
 FORWARD:
@@ -481,6 +522,7 @@ __forceinline void preprocess_tx(__xread struct schedule_t* sched,
   __xwrite struct work_t work_xfer;
 
   STATS_INC(TX_TOTAL);
+  COUNTER_INC(TX);
 
   /* Allocate PKT buffer */
   alloc_packet_buffer(&pkt_info);
@@ -554,6 +596,7 @@ __forceinline void preprocess_ac(__xread struct actx_bump_t* bump,
   __xwrite struct work_t work_xfer;
 
   STATS_INC(AC_TOTAL);
+  COUNTER_INC(AC);
 
   /* Read ATX descriptor */
   desc_idx = bump->desc_idx;
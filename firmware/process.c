@@ -316,6 +316,7 @@ int main() {
 
       sleep(1 << 10);
     }
+    flows_init();
 
     sleep(1 << 16);
 
@@ -10,41 +10,98 @@
 #include "qman.h"
 #include "fp_mem.h"
 #include "pipeline.h"
+#include "qm_sched.h"
 
 #include "shared.h"
 #include "debug.h"
 #include "global.h"
 
-#define QM_LOCAL_FIFO   256
 __shared __lmem uint32_t queue_status[QM_NUM_SLOTS];
-__shared __lmem uint32_t queue_local_fifo[QM_LOCAL_FIFO][2];
 
-__shared __gpr unsigned int queue_status_fifo;
+/* DRR state per app context (see qm_sched.h) */
+__shared __lmem uint32_t qm_ctx_len[QM_CTX_NUM];      /*> Flows owned */
+__shared __lmem int32_t  qm_ctx_deficit[QM_CTX_NUM];  /*> Segments left */
+__shared __lmem uint32_t qm_ctx_weight[QM_CTX_NUM];   /*> Cached qm_weight */
+
+/* Aggregate rate limits per app context */
+__shared __lmem int32_t  qm_ctx_tokens[QM_CTX_NUM];
+__shared __lmem uint32_t qm_ctx_rate[QM_CTX_NUM];     /*> Cached qm_rate */
+__shared __lmem uint32_t qm_ctx_burst[QM_CTX_NUM];    /*> Cached qm_burst */
+
+/* Context masks (QM_CTX_BIT) */
+__shared __lmem uint32_t qm_ctx_active[QM_CTX_WORDS];     /*> Flows queued */
+__shared __lmem uint32_t qm_ctx_limited[QM_CTX_WORDS];    /*> Token bucket */
+__shared __lmem uint32_t qm_ctx_throttled[QM_CTX_WORDS];  /*> Out of tokens */
+
+/* Strict-priority classes > 0, one FIFO each */
+__shared __lmem uint32_t qm_prio_len[QM_PRIO_NUM];    /*> Flows owned */
+
+__shared __gpr unsigned int qm_ctx_cur;
+__shared __gpr unsigned int qm_prio_active, qm_prio_waited, qm_prio_relief;
 __shared __gpr unsigned int qraddr;
 __shared __gpr unsigned int credits;
 
 __shared __gpr unsigned int current_slot, skip_slot;
-__shared __gpr unsigned int q_head, q_tail;
+
+/* Context gives up a flow. Does not swap out! */
+__forceinline void qm_ctx_release(unsigned int c)
+{
+  qm_ctx_len[c] -= 1;
+  if (qm_ctx_len[c] == 0) {
+    qm_ctx_active[QM_CTX_WORD(c)] &= ~QM_CTX_BIT(c);
+  }
+}
+
+/* Class FIFO gives up a flow. Does not swap out! */
+__forceinline void qm_prio_release(unsigned int cls)
+{
+  qm_prio_len[cls] -= 1;
+  if (qm_prio_len[cls] == 0) {
+    qm_prio_active &= ~QM_PRIO_BIT(cls);
+  }
+}
+
+/* Charge bytes scheduled to the context's token bucket. Does not swap out! */
+__forceinline void qm_ctx_charge(unsigned int c, uint32_t bytes)
+{
+  if ((qm_ctx_limited[QM_CTX_WORD(c)] & QM_CTX_BIT(c)) == 0) {
+    return;
+  }
+
+  qm_ctx_tokens[c] = qm_tb_charge(qm_ctx_tokens[c], bytes);
+  if (qm_ctx_tokens[c] <= 0) {
+    qm_ctx_throttled[QM_CTX_WORD(c)] |= QM_CTX_BIT(c);
+  }
+}
+
+/* Put a slot entry back past the next refill. Does not swap out! */
+__forceinline void qm_defer(unsigned int flow_id)
+{
+  unsigned int slot;
+
+  slot = (current_slot + QM_TB_SLOTS) & (QM_NUM_SLOTS - 1);
+  queue_status[slot] += 1;
+  mem_ring_journal_fast(QM_SLOT_RNUM_BASE + slot, qraddr, flow_id);
+}
 
 /* Does not swap out! */
 __forceinline void flow_add_to_queue(unsigned int flow_id, uint32_t avail, uint32_t rate)
 {
-  unsigned int slot, queue, secondary, qword, qbit;
-  unsigned int new_qtail;
+  unsigned int slot, queue, c, cls;
   unsigned int ts, chunk;
 
   /* Add to correct queue */
-  if (rate == 0) {  /* Add to fifo queue */
-    new_qtail = (q_tail + 1) & (QM_LOCAL_FIFO - 1);
-    if (avail < TCP_MSS || (q_head == new_qtail)) { /* Add to FIFO queue */
-      queue_status_fifo += 1;
-      mem_ring_journal_fast(QM_FIFO_RNUM, qraddr, flow_id);
-    }
-    else {  /* Add to local queue */
-      queue_local_fifo[q_tail][0] = flow_id;
-      queue_local_fifo[q_tail][1] = MIN(avail, 0x4000);
-      q_tail = new_qtail;
-    }
+  cls = QM_ENTRY_CLASS(flow_id);
+  if (rate == 0 && cls != 0) {  /* Add to the class FIFO */
+    qm_prio_len[cls] += 1;
+    qm_prio_active |= QM_PRIO_BIT(cls);
+    mem_ring_journal_fast(QM_PRIO_RNUM_BASE + cls, qraddr, flow_id);
+  }
+  else if (rate == 0) {  /* Add to the context's DRR queue */
+    c = QM_ENTRY_CTX(flow_id);
+    qm_ctx_len[c] += 1;
+    qm_ctx_active[QM_CTX_WORD(c)] |= QM_CTX_BIT(c);
+    mem_ring_journal_fast(QM_CTX_RNUM_BASE + c, qraddr, flow_id);
   }
   else {  /* Add to rate limit queue */
     /* rate is stored as clk cnts for transmitting 1 byte */
@@ -69,7 +126,7 @@ __forceinline void queue_postproc_poll()
   unsigned int rnum, raddr_hi, flow_id, flow_id_grp;
   unsigned int slot, queue, secondary, qword, qbit;
   __xread unsigned int flow_id_xfer;
-  __xread uint32_t cc[2];
+  __xread uint32_t cc[3];
   SIGNAL sig;
 
   __mem40 uint32_t* addr;
@@ -94,16 +151,58 @@ __forceinline void queue_postproc_poll()
                           sizeof(unsigned int), sizeof(unsigned int),
                           sig_done, &sig);
 
-    /* Read t_avail & tx_rate */
-    mem_read_atomic(cc, addr, 2 * sizeof(uint32_t));
+    /* Read tx_avail, tx_rate & qm_params */
+    mem_read_atomic(cc, addr, 3 * sizeof(uint32_t));
 
     /* Add to correct queue */
-    flow_add_to_queue(flow_id_grp, cc[0], cc[1]);
+    flow_add_to_queue(QM_ENTRY(flow_id_grp, cc[2]), cc[0], cc[1]);
   }
 
   return;
 }
 
+/* Delayed ACK timers: re-enqueue flow into the slot the timeout expires in */
+__forceinline void queue_delack_poll()
+{
+  unsigned int rnum, raddr_hi, flow_id_grp, slot, slots;
+  __xread unsigned int flow_id_xfer;
+  SIGNAL sig;
+
+  /* Timeout is configured by the slowpath */
+  while (fp_state.cfg.sig == 0) {
+    sleep(1 << 10);
+  }
+  slots = fp_state.cfg.delack_ts / QM_SLOT_RESOLUTION_TS_CLK_CNT;
+  if (slots == 0) {
+    slots = 1;
+  }
+  if (slots >= QM_NUM_SLOTS) {
+    slots = QM_NUM_SLOTS - 1;
+  }
+
+  rnum = MEM_RING_GET_NUM(qm_delack_ring);
+  raddr_hi = MEM_RING_GET_MEMADDR(qm_delack_ring);
+
+  __mem_workq_add_thread(rnum, raddr_hi, &flow_id_xfer,
+                        sizeof(unsigned int), sizeof(unsigned int),
+                        sig_done, &sig);
+  for (;;)
+  {
+    __wait_for_all(&sig);
+    flow_id_grp = flow_id_xfer;
+
+    /* Issue next read */
+    __mem_workq_add_thread(rnum, raddr_hi, &flow_id_xfer,
+                          sizeof(unsigned int), sizeof(unsigned int),
+                          sig_done, &sig);
+
+    slot = (current_slot + slots) & (QM_NUM_SLOTS - 1);
+    queue_status[slot] += 1;
+    mem_ring_journal_fast(QM_SLOT_RNUM_BASE + slot, qraddr,
+        flow_id_grp | QM_ENTRY_DELACK);
+  }
+}
+
 __forceinline void refresh_credits()
 {
   __xrw uint32_t update_credits;
@@ -115,25 +214,87 @@ __forceinline void refresh_credits()
   return;
 }
 
+/* Pick up parameters of context c from the slowpath. Does not swap out! */
+__forceinline void qm_ctx_params(unsigned int c, __xread uint32_t* params)
+{
+  unsigned int w = QM_CTX_WORD(c);
+  unsigned int bit = QM_CTX_BIT(c);
+  uint32_t rate, burst;
+
+  qm_ctx_weight[c] = qm_drr_weight(params[0]);
+
+  rate = params[1];
+  if (rate == 0) {
+    qm_ctx_limited[w] &= ~bit;
+    qm_ctx_throttled[w] &= ~bit;
+    return;
+  }
+
+  burst = MIN(params[2], QM_TB_BURST_MAX);
+  if ((qm_ctx_limited[w] & bit) == 0) {  /* Start with a full bucket */
+    qm_ctx_tokens[c] = burst << QM_TB_FRAC;
+    qm_ctx_limited[w] |= bit;
+  }
+  qm_ctx_rate[c] = rate;
+  qm_ctx_burst[c] = burst;
+}
+
+/* Refill token buckets every QM_TB_SLOTS slot lengths. Does not swap out! */
+#define QM_TB_CLK_CNT (QM_TB_SLOTS * QM_SLOT_RESOLUTION_TS_CLK_CNT)
+__forceinline void qm_tb_tick(unsigned int* tb_ts)
+{
+  unsigned int ts, pending, w, c;
+
+  ts = local_csr_read(local_csr_timestamp_low);
+  if (ts - *tb_ts < QM_TB_CLK_CNT) {
+    return;
+  }
+  /* Buckets fill up after a few intervals anyway, do not catch up */
+  *tb_ts = (ts - *tb_ts < 2 * QM_TB_CLK_CNT) ? *tb_ts + QM_TB_CLK_CNT : ts;
+
+  for (w = 0; w < QM_CTX_WORDS; w++) {
+    pending = qm_ctx_limited[w];
+    while (pending != 0) {
+      c = ffs(pending);
+      pending &= ~(1 << c);
+      c += (w << 5);
+
+      qm_ctx_tokens[c] = qm_tb_refill(qm_ctx_tokens[c], qm_ctx_rate[c], qm_ctx_burst[c]);
+      if (qm_ctx_tokens[c] > 0) {
+        qm_ctx_throttled[w] &= ~QM_CTX_BIT(c);
+      }
+    }
+  }
+}
+
 #define MIN_SLOT_CYCLES 8
 __forceinline void select_slot()
 {
-  unsigned int slot_ts, next_ts, cyc, deficit;
+  unsigned int slot_ts, next_ts, cyc, deficit, tb_ts, c;
+  __xread uint32_t params[3];
 
   slot_ts = local_csr_read(local_csr_timestamp_low);
   cyc     = QM_SLOT_RESOLUTION_TS_CLK_CNT;
   next_ts = slot_ts + cyc;
+  tb_ts   = slot_ts;
   deficit = 0;
   skip_slot = 0;
 
   for (;;) {
+    /* Parameters of one context per slot: weight, rate, burst */
+    c = current_slot & (QM_CTX_NUM - 1);
+    mem_read32(params, (__mem40 void*) &fp_state.appctx[c].qm_weight, sizeof(params));
+    qm_ctx_params(c, params);
+
     /* 16 cycles per cnt */
     sleep(cyc << 4);
+    qm_tb_tick(&tb_ts);
 
     /* Wait until all flows from the current slot are dequeued! */
     skip_slot = 1;  /*> Prevent adding more flows to the current slot */
     while (queue_status[current_slot] != 0) {
       sleep(50);
+      qm_tb_tick(&tb_ts);
     }
 
     /* Goto next slot */
@@ -149,113 +310,144 @@ __forceinline void select_slot()
   }
 }
 
-__forceinline void queue_localfifo_poll()
+/* Strict-priority classes, then two-level DRR over app contexts and their
+ * flows for class 0 (see qm_sched.h) */
+__forceinline void queue_drr_poll()
 {
-  unsigned int flow_id, local_avail, flow_id_grp, flow_grp;
-  __mem40 void* avail_addr;
+  __xread uint32_t queue_flow;
+  __xread uint32_t cc[2];
+  __xrw uint32_t avail;
+  SIGNAL cc_sig;
+  SIGNAL_PAIR avail_sig;
+
+  __mem40 uint32_t* avail_addr;
+
+  unsigned int c, i, n, granted, requeue, entry, flow_id, flow_grp;
+  unsigned int active, cls, ring;
 
   for (;;)
   {
-    if (q_head == q_tail) {
+    /* Nothing queued, or all contexts over their aggregate rate */
+    active = qm_prio_active;
+    if (qm_drr_ready(qm_ctx_active, qm_ctx_throttled)) {
+      active |= QM_PRIO_BIT(0);
+    }
+    if (active == 0) {
       sleep(100);
       continue;
     }
 
-    /* TX Queue is full! */
-    while (credits == 0) {
-      sleep(100);
-      refresh_credits();
+    /* Highest class first, unless lower classes waited too long */
+    __no_swap_begin();
+    cls = qm_prio_pick(active, qm_prio_waited, qm_prio_relief);
+    qm_prio_waited = qm_prio_wait(active, cls, qm_prio_waited);
+    if (qm_prio_waited == 0) {
+      qm_prio_relief = cls;
     }
 
-    flow_id_grp = queue_local_fifo[q_head][0];
-    local_avail = queue_local_fifo[q_head][1];
-    q_head = (q_head + 1) & (QM_LOCAL_FIFO - 1);
-
-    flow_id = flow_id_grp & 0xFFFF;
-    flow_grp = (flow_id_grp >> 16) & (NUM_FLOW_GROUPS - 1);
-
-    /* Schedule flow */
-    credits -= 1;
-    mem_workq_add_work_imm(QM_SCHED_RNUM_BASE + flow_grp, qraddr, flow_id);
-
-    avail_addr = (__mem40 uint32_t*) &fp_state.flows_cc_info[flow_id].tx_avail;
-    mem_subsat32_imm(TCP_MSS, avail_addr);
-    STATS_INC(QM_SCHEDULE);
-
-    local_avail -= TCP_MSS; /* Guaranteed to be > TCP_MSS */
-    flow_add_to_queue(flow_id, local_avail, 0);
-
-    if (credits < (FLOW_QM_CREDITS/4)) {
-      refresh_credits();
+    c = qm_ctx_cur;
+    if (cls != 0) {
+      ring = QM_PRIO_RNUM_BASE + cls;
+    } else {
+      /* Keep the turn while the context has deficit and flows, including
+       * flows in flight on the other thread */
+      if (qm_ctx_deficit[c] <= 0 || qm_ctx_len[c] == 0 ||
+          (qm_ctx_throttled[QM_CTX_WORD(c)] & QM_CTX_BIT(c)) != 0)
+      {
+        c = qm_drr_next_ctx(qm_ctx_active, qm_ctx_throttled, c);
+        qm_ctx_cur = c;
+        qm_ctx_deficit[c] = qm_drr_refill(qm_ctx_deficit[c], qm_ctx_weight[c]);
+      }
+      ring = QM_CTX_RNUM_BASE + c;
     }
-  }
-}
-
+    __no_swap_end();
 
-__forceinline void queue_fifo_poll()
-{
-  __xread uint32_t queue_flows[4];
-  __xread uint32_t rate;
-  __xrw uint32_t avail;
-  SIGNAL rate_sig;
-  SIGNAL_PAIR avail_sig;
+    mem_ring_get_freely(ring, qraddr, &queue_flow, sizeof(queue_flow));
 
-  __mem40 uint32_t* avail_addr;
-  __mem40 uint32_t* rate_addr;
+    /* All flows in flight, or the entry is not written yet */
+    if (queue_flow == 0) {
+      sleep(50);
+      continue;
+    }
 
-  unsigned int idx, flow_id, flow_id_grp, flow_grp;
+    entry = queue_flow;
+    flow_id = entry & 0xFFFF;
+    flow_grp = (entry >> 16) & (NUM_FLOW_GROUPS - 1);
+
+    /* Class FIFOs hold flows of any context, wait out a throttled one on the
+     * slot wheel */
+    if (cls != 0) {
+      c = QM_ENTRY_CTX(entry);
+      if ((qm_ctx_throttled[QM_CTX_WORD(c)] & QM_CTX_BIT(c)) != 0) {
+        __no_swap_begin();
+        qm_prio_release(cls);
+        qm_defer(entry);
+        __no_swap_end();
+        continue;
+      }
+    }
 
-  for (;;)
-  {
-    if (queue_status_fifo == 0) {
+    /* TX Queue is full! */
+    while (credits == 0) {
       sleep(100);
-      continue;
+      refresh_credits();
     }
 
-    /* Read upto 4 flows */
-    mem_ring_get_freely(QM_FIFO_RNUM, qraddr, queue_flows, sizeof(queue_flows));
-
-    for (idx = 0; idx < 4; idx++)
-    {
-      if (queue_flows[idx] == 0)
-        break;
+    /* Reserve credits for the burst */
+    if (cls != 0) {
+      n = qm_drr_burst(QM_DRR_BURST, credits);
+    } else {
+      n = qm_drr_burst(qm_ctx_deficit[c], credits);
+    }
+    credits -= n;
 
-      /* TX Queue is full! */
-      while (credits == 0) {
-        sleep(100);
-        refresh_credits();
-      }
+    /* rate, qm_params after avail */
+    avail_addr = (__mem40 uint32_t*) &fp_state.flows_cc_info[flow_id].tx_avail;
 
-      queue_status_fifo -= 1;
-      flow_id_grp = queue_flows[idx];
-      flow_id = flow_id_grp & 0xFFFF;
-      flow_grp = (flow_id_grp >> 16) & (NUM_FLOW_GROUPS - 1);
+    /* Subtract the burst from queue occupancy */
+    avail = n * TCP_MSS;
+    __mem_test_subsat(&avail, avail_addr, sizeof(avail), sizeof(avail), sig_done, &avail_sig);
+    __mem_read_atomic(cc, avail_addr + 1, sizeof(cc), sizeof(cc), sig_done, &cc_sig);
+    __wait_for_all(&avail_sig, &cc_sig);
 
-      /* Schedule flow */
-      credits -= 1;
+    /* Schedule flow */
+    granted = qm_drr_granted(avail, n, TCP_MSS);
+    for (i = 0; i < granted; i++) {
       mem_workq_add_work_imm(QM_SCHED_RNUM_BASE + flow_grp, qraddr, flow_id);
       STATS_INC(QM_SCHEDULE);
-
-      /* rate, avail in consecutive locations */
-      avail_addr = (__mem40 uint32_t*) &fp_state.flows_cc_info[flow_id].tx_avail;
-      rate_addr  = avail_addr + 1;
-
-      /* Subtract TCP_MSS from queue occupancy */
-      avail = TCP_MSS;
-      __mem_test_subsat(&avail, avail_addr, sizeof(avail), sizeof(avail), sig_done, &avail_sig);
-      __mem_read_atomic(&rate, rate_addr, sizeof(rate), sizeof(rate), sig_done, &rate_sig);
-      __wait_for_all(&avail_sig, &rate_sig);
-
-      /* Data available! */
-      if (avail > TCP_MSS) {
-        /* Add to correct queue */
-        flow_add_to_queue(flow_id_grp, avail - TCP_MSS, rate);
+    }
+    JOURNAL_EVENT(QM_DRR, flow_id, granted);
+
+    __no_swap_begin();
+    credits += n - granted;
+    qm_ctx_charge(c, MIN(avail, granted * TCP_MSS));
+
+    /* Data available! Back of the FIFO unless rate limited, moved or
+     * reclassified */
+    requeue = (avail > n * TCP_MSS);
+    if (cls != 0) {
+      qm_prio_release(cls);
+      if (requeue) {
+        flow_add_to_queue(QM_ENTRY(entry, cc[1]), avail - n * TCP_MSS, cc[0]);
       }
-
-      if (credits < (FLOW_QM_CREDITS/4)) {
-        refresh_credits();
+    } else {
+      qm_ctx_deficit[c] -= granted;
+      if (requeue && cc[0] == 0 && QM_PARAMS_CTX(cc[1]) == c &&
+          QM_PARAMS_CLASS(cc[1]) == 0)
+      {
+        mem_ring_journal_fast(QM_CTX_RNUM_BASE + c, qraddr, entry);
+      } else {
+        qm_ctx_release(c);
+        if (requeue) {
+          flow_add_to_queue(QM_ENTRY(entry, cc[1]), avail - n * TCP_MSS, cc[0]);
+        }
       }
     }
+    __no_swap_end();
+
+    if (credits < (FLOW_QM_CREDITS/4)) {
+      refresh_credits();
+    }
   }
 
   return;
@@ -264,15 +456,16 @@ __forceinline void queue_fifo_poll()
 __forceinline void queue_slot_poll()
 {
   __xread uint32_t queue_flows;
-  __xread uint32_t rate;
+  __xread uint32_t cc[2];
   __xrw uint32_t avail;
-  SIGNAL rate_sig;
+  SIGNAL cc_sig;
   SIGNAL_PAIR avail_sig;
 
   __mem40 uint32_t* avail_addr;
-  __mem40 uint32_t* rate_addr;
+  __mem40 uint32_t* cc_addr;
 
-  unsigned int idx, queue, flow_id, flow_id_grp, flow_grp;
+  unsigned int idx, queue, flow_id, flow_id_grp, flow_grp, c;
+  __gpr struct schedule_t sched;
 
   for (;;) {
     if (queue_status[current_slot] == 0) {
@@ -298,25 +491,47 @@ __forceinline void queue_slot_poll()
     flow_id = flow_id_grp & 0xFFFF;
     flow_grp = (flow_id_grp >> 16) & (NUM_FLOW_GROUPS - 1);
 
+    /* Delayed ACK timer expired: force a (possibly empty) transmission */
+    if ((flow_id_grp & QM_ENTRY_DELACK) != 0) {
+      credits -= 1;
+      sched.__raw = 0;
+      sched.force = 1;
+      sched.flow_id = flow_id;
+      mem_workq_add_work_imm(QM_SCHED_RNUM_BASE + flow_grp, qraddr, sched.__raw);
+      STATS_INC(QM_SCHEDULE);
+      JOURNAL_EVENT(QM_DELACK, flow_id, 0);
+      continue;
+    }
+
+    /* Context over its aggregate rate */
+    c = QM_ENTRY_CTX(flow_id_grp);
+    if ((qm_ctx_throttled[QM_CTX_WORD(c)] & QM_CTX_BIT(c)) != 0) {
+      qm_defer(flow_id_grp);
+      continue;
+    }
+
     /* Schedule flow */
     credits -= 1;
     mem_workq_add_work_imm(QM_SCHED_RNUM_BASE + flow_grp, qraddr, flow_id);
     STATS_INC(QM_SCHEDULE);
+    JOURNAL_EVENT(QM_SLOT, flow_id, flow_id_grp);
 
-    /* rate, avail in consecutive locations */
+    /* rate, qm_params after avail */
     avail_addr = (__mem40 uint32_t*) &fp_state.flows_cc_info[flow_id].tx_avail;
-    rate_addr  = avail_addr + 1;
+    cc_addr    = avail_addr + 1;
 
     /* Subtract TCP_MSS from queue occupancy */
     avail = TCP_MSS;
     __mem_test_subsat(&avail, avail_addr, sizeof(avail), sizeof(avail), sig_done, &avail_sig);
-    __mem_read_atomic(&rate, rate_addr, sizeof(rate), sizeof(rate), sig_done, &rate_sig);
-    __wait_for_all(&avail_sig, &rate_sig);
+    __mem_read_atomic(cc, cc_addr, sizeof(cc), sizeof(cc), sig_done, &cc_sig);
+    __wait_for_all(&avail_sig, &cc_sig);
+
+    qm_ctx_charge(c, MIN(avail, TCP_MSS));
 
     /* Data available! */
     if (avail > TCP_MSS) {
       /* Add to correct queue */
-      flow_add_to_queue(flow_id_grp, avail - TCP_MSS, rate);
+      flow_add_to_queue(QM_ENTRY(flow_id_grp, cc[1]), avail - TCP_MSS, cc[0]);
     }
 
     if (credits < (FLOW_QM_CREDITS/4)) {
@@ -329,13 +544,32 @@ __forceinline void queue_slot_poll()
 int main()
 {
   SIGNAL start_sig;
+  unsigned int i;
 
   if (ctx() == 0) {
     enable_global_timestamp();
 
-    queue_status_fifo = 0;
-    q_head = q_tail = 0;
-    qraddr = MEM_RING_GET_MEMADDR(qm_slot_fifo);
+    /* One DRR ring per context below the slot rings, see qman.h */
+    ctassert(QM_CTX_NUM % 32 == 0);
+    ctassert(QM_CTX_RNUM_BASE + QM_CTX_NUM <= QM_SLOT_RNUM_BASE);
+
+    for (i = 0; i < QM_CTX_WORDS; i++) {
+      qm_ctx_active[i] = 0;
+      qm_ctx_limited[i] = 0;
+      qm_ctx_throttled[i] = 0;
+    }
+    for (i = 0; i < QM_CTX_NUM; i++) {
+      qm_ctx_len[i] = 0;
+      qm_ctx_deficit[i] = 0;
+      qm_ctx_weight[i] = 1;
+      qm_ctx_tokens[i] = 0;
+    }
+    for (i = 0; i < QM_PRIO_NUM; i++) {
+      qm_prio_len[i] = 0;
+    }
+    qm_ctx_cur = 0;
+    qm_prio_active = qm_prio_waited = qm_prio_relief = 0;
+    qraddr = MEM_RING_GET_MEMADDR(qm_ctx_0);
 
     credits = 3*FLOW_QM_CREDITS/4 - 1;
 
@@ -362,11 +596,12 @@ int main()
     break;
 
   case 2:
-    queue_localfifo_poll();
+  case 3:
+    queue_drr_poll();
     break;
 
-  case 3:
-    queue_fifo_poll();
+  case 4:
+    queue_delack_poll();
     break;
 
   default:
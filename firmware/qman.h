@@ -33,18 +33,87 @@ struct queue_bump_t
 /* Each entry is 4 bytes */
 #define QM_NUM_SLOTS            512
 #define QM_NUM_SLOTS_PER_CYCLE  (QM_NUM_SLOTS/2)
-#define QM_FIFO_LEN     16384
+#define QM_CTX_LEN      16384   /*> A flow is queued at most once */
 #define QM_SLOT_LEN     512
-#define QM_FIFO_RNUM    511
-#define QM_SLOT_RNUM_BASE  (QM_FIFO_RNUM + 1)
+#define QM_PRIO_RNUM_BASE  444  /*> One ring per priority class > 0 */
+#define QM_CTX_RNUM_BASE   448  /*> One DRR ring per app context */
+#define QM_SLOT_RNUM_BASE  512  /*> QM_CTX_RNUM_BASE + FLEXNIC_PL_APPCTX_NUM */
 #define QM_SCHED_RNUM_BASE 256
 #define QM_SCHED_RING_SIZE 8192
+#define QM_ENTRY_DELACK    0x80000000 /*> Slot entry is a delayed ACK timer */
 MEM_RING_INIT(qm_bump_ring, 4096);
+MEM_RING_INIT(qm_delack_ring, 4096);
 MEM_RING_INIT_RN(qm_sched_ring0, QM_SCHED_RING_SIZE, 256);
 MEM_RING_INIT_RN(qm_sched_ring1, QM_SCHED_RING_SIZE, 257);
 MEM_RING_INIT_RN(qm_sched_ring2, QM_SCHED_RING_SIZE, 258);
 MEM_RING_INIT_RN(qm_sched_ring3, QM_SCHED_RING_SIZE, 259);
-MEM_RING_INIT_RN(qm_slot_fifo, 65536, 511);
+MEM_RING_INIT_RN(qm_prio_1, QM_CTX_LEN, 445);
+MEM_RING_INIT_RN(qm_prio_2, QM_CTX_LEN, 446);
+MEM_RING_INIT_RN(qm_prio_3, QM_CTX_LEN, 447);
+MEM_RING_INIT_RN(qm_ctx_0, QM_CTX_LEN, 448);
+MEM_RING_INIT_RN(qm_ctx_1, QM_CTX_LEN, 449);
+MEM_RING_INIT_RN(qm_ctx_2, QM_CTX_LEN, 450);
+MEM_RING_INIT_RN(qm_ctx_3, QM_CTX_LEN, 451);
+MEM_RING_INIT_RN(qm_ctx_4, QM_CTX_LEN, 452);
+MEM_RING_INIT_RN(qm_ctx_5, QM_CTX_LEN, 453);
+MEM_RING_INIT_RN(qm_ctx_6, QM_CTX_LEN, 454);
+MEM_RING_INIT_RN(qm_ctx_7, QM_CTX_LEN, 455);
+MEM_RING_INIT_RN(qm_ctx_8, QM_CTX_LEN, 456);
+MEM_RING_INIT_RN(qm_ctx_9, QM_CTX_LEN, 457);
+MEM_RING_INIT_RN(qm_ctx_10, QM_CTX_LEN, 458);
+MEM_RING_INIT_RN(qm_ctx_11, QM_CTX_LEN, 459);
+MEM_RING_INIT_RN(qm_ctx_12, QM_CTX_LEN, 460);
+MEM_RING_INIT_RN(qm_ctx_13, QM_CTX_LEN, 461);
+MEM_RING_INIT_RN(qm_ctx_14, QM_CTX_LEN, 462);
+MEM_RING_INIT_RN(qm_ctx_15, QM_CTX_LEN, 463);
+MEM_RING_INIT_RN(qm_ctx_16, QM_CTX_LEN, 464);
+MEM_RING_INIT_RN(qm_ctx_17, QM_CTX_LEN, 465);
+MEM_RING_INIT_RN(qm_ctx_18, QM_CTX_LEN, 466);
+MEM_RING_INIT_RN(qm_ctx_19, QM_CTX_LEN, 467);
+MEM_RING_INIT_RN(qm_ctx_20, QM_CTX_LEN, 468);
+MEM_RING_INIT_RN(qm_ctx_21, QM_CTX_LEN, 469);
+MEM_RING_INIT_RN(qm_ctx_22, QM_CTX_LEN, 470);
+MEM_RING_INIT_RN(qm_ctx_23, QM_CTX_LEN, 471);
+MEM_RING_INIT_RN(qm_ctx_24, QM_CTX_LEN, 472);
+MEM_RING_INIT_RN(qm_ctx_25, QM_CTX_LEN, 473);
+MEM_RING_INIT_RN(qm_ctx_26, QM_CTX_LEN, 474);
+MEM_RING_INIT_RN(qm_ctx_27, QM_CTX_LEN, 475);
+MEM_RING_INIT_RN(qm_ctx_28, QM_CTX_LEN, 476);
+MEM_RING_INIT_RN(qm_ctx_29, QM_CTX_LEN, 477);
+MEM_RING_INIT_RN(qm_ctx_30, QM_CTX_LEN, 478);
+MEM_RING_INIT_RN(qm_ctx_31, QM_CTX_LEN, 479);
+MEM_RING_INIT_RN(qm_ctx_32, QM_CTX_LEN, 480);
+MEM_RING_INIT_RN(qm_ctx_33, QM_CTX_LEN, 481);
+MEM_RING_INIT_RN(qm_ctx_34, QM_CTX_LEN, 482);
+MEM_RING_INIT_RN(qm_ctx_35, QM_CTX_LEN, 483);
+MEM_RING_INIT_RN(qm_ctx_36, QM_CTX_LEN, 484);
+MEM_RING_INIT_RN(qm_ctx_37, QM_CTX_LEN, 485);
+MEM_RING_INIT_RN(qm_ctx_38, QM_CTX_LEN, 486);
+MEM_RING_INIT_RN(qm_ctx_39, QM_CTX_LEN, 487);
+MEM_RING_INIT_RN(qm_ctx_40, QM_CTX_LEN, 488);
+MEM_RING_INIT_RN(qm_ctx_41, QM_CTX_LEN, 489);
+MEM_RING_INIT_RN(qm_ctx_42, QM_CTX_LEN, 490);
+MEM_RING_INIT_RN(qm_ctx_43, QM_CTX_LEN, 491);
+MEM_RING_INIT_RN(qm_ctx_44, QM_CTX_LEN, 492);
+MEM_RING_INIT_RN(qm_ctx_45, QM_CTX_LEN, 493);
+MEM_RING_INIT_RN(qm_ctx_46, QM_CTX_LEN, 494);
+MEM_RING_INIT_RN(qm_ctx_47, QM_CTX_LEN, 495);
+MEM_RING_INIT_RN(qm_ctx_48, QM_CTX_LEN, 496);
+MEM_RING_INIT_RN(qm_ctx_49, QM_CTX_LEN, 497);
+MEM_RING_INIT_RN(qm_ctx_50, QM_CTX_LEN, 498);
+MEM_RING_INIT_RN(qm_ctx_51, QM_CTX_LEN, 499);
+MEM_RING_INIT_RN(qm_ctx_52, QM_CTX_LEN, 500);
+MEM_RING_INIT_RN(qm_ctx_53, QM_CTX_LEN, 501);
+MEM_RING_INIT_RN(qm_ctx_54, QM_CTX_LEN, 502);
+MEM_RING_INIT_RN(qm_ctx_55, QM_CTX_LEN, 503);
+MEM_RING_INIT_RN(qm_ctx_56, QM_CTX_LEN, 504);
+MEM_RING_INIT_RN(qm_ctx_57, QM_CTX_LEN, 505);
+MEM_RING_INIT_RN(qm_ctx_58, QM_CTX_LEN, 506);
+MEM_RING_INIT_RN(qm_ctx_59, QM_CTX_LEN, 507);
+MEM_RING_INIT_RN(qm_ctx_60, QM_CTX_LEN, 508);
+MEM_RING_INIT_RN(qm_ctx_61, QM_CTX_LEN, 509);
+MEM_RING_INIT_RN(qm_ctx_62, QM_CTX_LEN, 510);
+MEM_RING_INIT_RN(qm_ctx_63, QM_CTX_LEN, 511);
 MEM_RING_INIT_RN(qm_slot_0, 2048, 512);
 MEM_RING_INIT_RN(qm_slot_1, 2048, 513);
 MEM_RING_INIT_RN(qm_slot_2, 2048, 514);
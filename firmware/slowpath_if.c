@@ -239,7 +239,13 @@ __forceinline void process_sptx_descriptor(unsigned int desc_idx,
     break;
 
   case FLEXTCP_PL_SPTX_CONN_RETX:
+  case FLEXTCP_PL_SPTX_CONN_PROBE:
+  case FLEXTCP_PL_SPTX_CONN_RXWND:
+    work.__raw[0] = 0;
     work.type = WORK_TYPE_RETX;
+    work.retx.probe = (sptx_xfer->type == FLEXTCP_PL_SPTX_CONN_PROBE);
+    work.retx.rxwnd = (sptx_xfer->type == FLEXTCP_PL_SPTX_CONN_RXWND);
+    work.retx.delta = sptx_xfer->msg.connrxwnd.delta;
     work.flow_id = sptx_xfer->msg.connretran.flow_id;
     flow_grp = sptx_xfer->msg.connretran.flow_grp;
 
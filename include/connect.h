@@ -25,12 +25,16 @@ PACKED_STRUCT(flexnic_info_t)
 
 #define FLEXNIC_FLAG_READY            (1 << 0)     /*> Flexnic is done initializing */
 #define FLEXNIC_FLAG_HUGEPAGES        (1 << 1)     /*> Huge pages should be used for the internal and dma memory */
+#define FLEXNIC_FLAG_HUGEPAGES_2M     (1 << 2)     /*> Dma memory is on 2 MB instead of 1 GB huge pages */
 
 /** Connect parameters */
 #define FLEXNIC_SHM_PREFIX    "/dev/shm"                    /*> Shared memory mount point */
 #define FLEXNIC_HUGE_PREFIX   "/dev/hugepages-1048576kB"    /*> Hugepages mount point */
+#define FLEXNIC_HUGE2M_PREFIX "/dev/hugepages"              /*> 2 MB hugepages mount point */
 #define FLEXNIC_NAME_INFO     "flextoe_info"       /*> Name for the info shared memory region */
 #define FLEXNIC_NAME_DMA_MEM  "flextoe_memory"     /*> Name for flexnic dma shared memory region */
+#define FLEXNIC_NAME_STATS    "flextoe_stats"      /*> Name for the telemetry shared memory region */
+#define FLEXNIC_NAME_CCTRACE  "flextoe_cctrace"    /*> Name for the congestion control trace region */
 #define FLEXNIC_INFO_BYTES    0x4000               /*> Size of the info shared memory region */
 
 /** Unix socket for initialization with application */
@@ -70,6 +70,9 @@ PACKED_ALIGN_STRUCT(flowst_mem_t, 32)
   };
 };
 
+/** Out-of-Order intervals tracked per flow */
+#define FLEXNIC_PL_OOO_NUM      3
+
 /** TCP state */
 PACKED_ALIGN_STRUCT(flowst_tcp_t, 64)
 {
@@ -77,7 +80,7 @@ PACKED_ALIGN_STRUCT(flowst_tcp_t, 64)
   {
     PACKED_STRUCT()
     {
-      uint32_t tx_len;                   /*> Length of transmission buffer */
+      uint32_t tx_sack;                  /*> SACK scoreboard (see tcp_sack.h) */
       uint32_t tx_avail;                 /*> Bytes in TX buffer ready for transmission */
       uint32_t tx_remote_avail;          /*> Available space in remote RX buffer */
       uint32_t tx_sent;                  /*> Unacknowledged bytes in TX buffer */
@@ -86,20 +89,17 @@ PACKED_ALIGN_STRUCT(flowst_tcp_t, 64)
       uint32_t tx_next_ts;               /*> Timestamp to echo in next packet */
 #if FIRMWARE
       uint16_t flags;                    /*> RX/TX Flags */
-      uint16_t dupack_cnt;               /*> Duplicate ACK count */
+      uint16_t rack_ts;                  /*> RACK deadline/window (see tcp_rack.h) */
 #else
-      uint16_t dupack_cnt;
+      uint16_t rack_ts;
       uint16_t flags;
 #endif
-      uint32_t rx_len;                   /*> Length of receive buffer */
+      uint32_t tx_rtx;                   /*> Selective recovery state (see tcp_sack.h) */
       uint32_t rx_avail;                 /*> Available RX buffer space */
       uint32_t rx_next_seq;              /*> Next sequence number expected */
       uint32_t rx_next_pos;              /*> Offset of next byte in RX buffer */
-      uint32_t rx_ooo_len;               /*> Length of Out-of-Order bytes */
-      uint32_t rx_ooo_start;             /*> Start position of Out-of-Order bytes */
-
-      uint32_t rsvd0;
-      uint32_t rsvd1;
+      uint32_t rx_ooo[FLEXNIC_PL_OOO_NUM]; /*> Out-of-Order intervals (see tcp_ooo.h) */
+      uint32_t wnd;                      /*> Window scaling and receive window debt */
     };
 
     uint32_t __raw[16];
@@ -107,7 +107,7 @@ PACKED_ALIGN_STRUCT(flowst_tcp_t, 64)
 };
 
 /** Congestion Control state */
-PACKED_ALIGN_STRUCT(flowst_cc_t, 32)
+PACKED_ALIGN_STRUCT(flowst_cc_t, 64)
 {
   PACKED_UNION()
   {
@@ -115,15 +115,18 @@ PACKED_ALIGN_STRUCT(flowst_cc_t, 32)
     {
       uint32_t tx_avail;              /*> Bytes available for transmission */
       uint32_t tx_rate;               /*> Transmission rate */
+      uint32_t qm_params;             /*> QM scheduling parameters (see qm_sched.h) */
       uint32_t rtt_est;               /*> Round Trip Time estimate */
       uint32_t txp;                   /*> tx_sent != 0 */
       uint32_t cnt_tx_drops;          /*> Counter drops */
       uint32_t cnt_rx_acks;           /*> Counter ACKs */
       uint32_t cnt_rx_ack_bytes;      /*> Counter acknowledged bytes */
       uint32_t cnt_rx_ecn_bytes;      /*> Counter ECN marked bytes */
+      uint32_t cnt_rx_bytes;          /*> Counter in-order payload bytes received */
+      uint32_t rsvd[6];
     };
 
-    uint32_t __raw[8];
+    uint32_t __raw[16];
   };
 };
 
@@ -132,6 +135,17 @@ PACKED_ALIGN_STRUCT(flowst_cc_t, 32)
 #define FLEXNIC_PL_FLOWST_TXFIN         (1 << 1)    /*> TX FIN requested */
 #define FLEXNIC_PL_FLOWST_SLOWPATH      (1 << 2)    /*> Redirect flow to slowpath permanently! */
 #define FLEXNIC_PL_FLOWST_RXFIN         (1 << 3)    /*> RX FIN reached */
+#define FLEXNIC_PL_FLOWST_SACK          (1 << 4)    /*> SACK permitted by peer */
+#define FLEXNIC_PL_FLOWST_RXCE          (1 << 5)    /*> Last segment was CE marked */
+#define FLEXNIC_PL_FLOWST_DACK_SHIFT    6           /*> Delayed segments (see tcp_delack.h) */
+#define FLEXNIC_PL_FLOWST_DACK_MASK     0xF
+
+/* Window word */
+#define FLEXNIC_PL_FLOWST_WS_RCV_SHIFT  0           /*> Receive window scale (see tcp_wscale.h) */
+#define FLEXNIC_PL_FLOWST_WS_SND_SHIFT  4           /*> Peer's window scale */
+#define FLEXNIC_PL_FLOWST_WS_MASK       0xF
+#define FLEXNIC_PL_FLOWST_RXWND_SHIFT   16          /*> Receive window debt (see tcp_rxwnd.h) */
+#define FLEXNIC_PL_FLOWST_RXWND_MASK    0xFFFF
 
 /* FIXME: Add STATIC asserts on struct sizes */
 
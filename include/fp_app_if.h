@@ -86,7 +86,11 @@ PACKED_STRUCT(flextcp_pl_appctx_t)
   struct flextcp_pl_appctx_queue_t tx;
   uint64_t last_ts;
   uint32_t appst_id;
-  uint32_t __pad[5];
+  uint32_t qm_weight;                           /*> QM DRR weight (see qm_sched.h) */
+  uint32_t qm_rate;                             /*> QM aggregate rate, 0: none */
+  uint32_t qm_burst;                            /*> QM aggregate burst [bytes] */
+  uint32_t gen;                                 /*> Bumped by sp on add/clear */
+  uint32_t gen_ack;                             /*> Last gen the ATX applied */
 };
 
 /** Application state */
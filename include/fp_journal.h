@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+#ifndef FLEXTOE_FP_JOURNAL_H_
+#define FLEXTOE_FP_JOURNAL_H_
+
+#include <stdint.h>
+
+/**
+ * Fastpath event journal
+ *
+ * With FP_JRNL_ENABLE the pipeline stages append fixed size records to the
+ * fp_dbg_journal ring (see JOURNAL_EVENT() in firmware/debug.h). A record is
+ * written with a single journal command, so records of different MEs never
+ * interleave, and as every record has the same power of two size they stay
+ * aligned in the ring and never straddle its end. The ring overwrites the
+ * oldest records once full and its tail lives in the queue engine, so a dump
+ * is ordered by the timestamps: the oldest record follows the largest step
+ * back in time.
+ *
+ *    word 0: event (8) | ME (8) | context (3) | #FP_JRNL_MAGIC (13)
+ *    word 1: timestamp_low of the writing ME
+ *    word 2: argument 0, the flow id for flow events
+ *    word 3: argument 1
+ *
+ * The ME field is (island - 32) << 4 | ME number + 4, as the low bits of
+ * __MEID. Timestamps tick every #FP_JRNL_TICK_CYC ME cycles and are
+ * synchronized across MEs once enable_global_timestamp() ran.
+ */
+
+#define FP_JRNL_WORDS       4
+#define FP_JRNL_BYTES       (FP_JRNL_WORDS * sizeof(uint32_t))
+#define FP_JRNL_TICK_CYC    16      /*> ME cycles per timestamp tick */
+
+#define FP_JRNL_EV_SHIFT    24
+#define FP_JRNL_EV_MASK     0xFF
+#define FP_JRNL_ME_SHIFT    16
+#define FP_JRNL_ME_MASK     0xFF
+#define FP_JRNL_CTX_SHIFT   13
+#define FP_JRNL_CTX_MASK    0x7
+#define FP_JRNL_MAGIC       0x1E70
+#define FP_JRNL_MAGIC_MASK  0x1FFF
+
+#define FP_JRNL_HDR(_ev, _me, _ctx) \
+    (((_ev) << FP_JRNL_EV_SHIFT) | ((_me) << FP_JRNL_ME_SHIFT) | \
+     ((_ctx) << FP_JRNL_CTX_SHIFT) | FP_JRNL_MAGIC)
+
+/* Journal events */
+enum fp_jrnl_ev_e {
+  FP_JRNL_NONE = 0,
+  FP_JRNL_QM_DRR,         /*> a0: flow, a1: segments granted */
+  FP_JRNL_QM_SLOT,        /*> a0: flow, a1: queue entry */
+  FP_JRNL_QM_DELACK,      /*> a0: flow */
+  FP_JRNL_POST_RX,        /*> a0: flow, a1: seq */
+  FP_JRNL_POST_TX,        /*> a0: flow, a1: seq */
+  FP_JRNL_POST_AC,        /*> a0: flow, a1: tx bump */
+  FP_JRNL_POST_RETX,      /*> a0: flow, a1: seq */
+  FP_JRNL_ATX,            /*> a0: app context, a1: descriptor | seq << 16 */
+  FP_JRNL_ARX,            /*> a0: app context, a1: descriptor */
+  FP_JRNL_DMA_ARX_ISSUE,  /*> a0: descriptor, a1: host buffer offset */
+  FP_JRNL_DMA_ARX_DONE,   /*> a0: descriptor, a1: host buffer offset */
+  FP_JRNL_EV_NUM,
+};
+
+#if !FIRMWARE
+#include <stddef.h>
+
+/** Decoded journal record */
+struct fp_jrnl_rec {
+  uint64_t ts;                    /*> Timestamp, unwrapped [ticks] */
+  uint32_t a0;
+  uint32_t a1;
+  uint8_t ev;                     /*> FP_JRNL_* */
+  uint8_t island;
+  uint8_t me;                     /*> ME number in the island */
+  uint8_t ctx;
+};
+
+static inline const char *fp_jrnl_ev_name(unsigned ev)
+{
+  static const char *names[FP_JRNL_EV_NUM] = {
+    "none", "qm_drr", "qm_slot", "qm_delack", "post_rx", "post_tx",
+    "post_ac", "post_retx", "atx", "arx", "dma_arx_issue", "dma_arx_done",
+  };
+
+  return ev < FP_JRNL_EV_NUM ? names[ev] : "unknown";
+}
+
+/** Pipeline stage an event belongs to */
+static inline const char *fp_jrnl_ev_stage(unsigned ev)
+{
+  switch (ev) {
+    case FP_JRNL_QM_DRR:
+    case FP_JRNL_QM_SLOT:
+    case FP_JRNL_QM_DELACK:
+      return "qman";
+    case FP_JRNL_POST_RX:
+    case FP_JRNL_POST_TX:
+    case FP_JRNL_POST_AC:
+    case FP_JRNL_POST_RETX:
+      return "postproc";
+    case FP_JRNL_ATX:
+      return "atx";
+    case FP_JRNL_ARX:
+      return "arx";
+    case FP_JRNL_DMA_ARX_ISSUE:
+    case FP_JRNL_DMA_ARX_DONE:
+      return "dma_arx";
+    default:
+      return "unknown";
+  }
+}
+
+/** Event is about a flow, a0 holds its id */
+static inline int fp_jrnl_ev_flow(unsigned ev)
+{
+  return ev >= FP_JRNL_QM_DRR && ev <= FP_JRNL_POST_RETX;
+}
+
+/**
+ * Decode the record at @p w, the timestamp is not unwrapped.
+ *
+ * @return 0 on success, -1 if @p w does not hold a record.
+ */
+static inline int fp_jrnl_decode(const uint32_t *w, struct fp_jrnl_rec *r)
+{
+  uint32_t hdr = w[0], me;
+
+  if ((hdr & FP_JRNL_MAGIC_MASK) != FP_JRNL_MAGIC) {
+    return -1;
+  }
+  r->ev = (hdr >> FP_JRNL_EV_SHIFT) & FP_JRNL_EV_MASK;
+  if (r->ev == FP_JRNL_NONE || r->ev >= FP_JRNL_EV_NUM) {
+    return -1;
+  }
+  me = (hdr >> FP_JRNL_ME_SHIFT) & FP_JRNL_ME_MASK;
+  if ((me & 0xF) < 4) {
+    return -1;
+  }
+
+  r->island = 32 + (me >> 4);
+  r->me = (me & 0xF) - 4;
+  r->ctx = (hdr >> FP_JRNL_CTX_SHIFT) & FP_JRNL_CTX_MASK;
+  r->ts = w[1];
+  r->a0 = w[2];
+  r->a1 = w[3];
+  return 0;
+}
+
+/**
+ * Find where the ring wrapped in a dump of @p num record slots.
+ *
+ * Going around the ring once, the step from the newest to the oldest record
+ * is the largest step back in time. MEs racing for the tail only cause small
+ * ones, and a ring that did not wrap yet steps back from its last record to
+ * its first.
+ *
+ * @param ts     Timestamps of the slots
+ * @param valid  Slot holds a record
+ *
+ * @return Slot of the oldest record.
+ */
+static inline size_t fp_jrnl_oldest(const uint32_t *ts, const uint8_t *valid,
+    size_t num)
+{
+  size_t i, prev, oldest = 0;
+  int32_t step, min_step = INT32_MAX;
+
+  for (prev = num; prev > 0 && !valid[prev - 1]; prev--);
+  if (prev-- == 0) {
+    return 0;
+  }
+
+  for (i = 0; i < num; i++) {
+    if (!valid[i]) {
+      continue;
+    }
+    step = (int32_t) (ts[i] - ts[prev]);
+    if (step < min_step) {
+      min_step = step;
+      oldest = i;
+    }
+    prev = i;
+  }
+  return oldest;
+}
+#endif /* !FIRMWARE */
+
+#endif /* FLEXTOE_FP_JOURNAL_H_ */
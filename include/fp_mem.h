@@ -11,6 +11,34 @@
 #include "fp_app_if.h"
 #include "flow_state.h"
 
+/**
+ * Fastpath counters maintained in every build, unlike the FP_STAT_ENABLE ones
+ * in fp_debug.h. One posted 64-bit increment per event, read with swapped
+ * 32-bit halves like the stats buffer.
+ */
+enum fp_cnt_e {
+  FP_CNT_RX,          /*> packets received from the MAC */
+  FP_CNT_RX_SP,       /*> received packets handed to the slowpath */
+  FP_CNT_RX_DROP,     /*> received segments outside the window or OOO space */
+  FP_CNT_TX,          /*> segments scheduled by the queue manager */
+  FP_CNT_TX_SEG,      /*> segments sent */
+  FP_CNT_TX_ACK,      /*> ACKs sent */
+  FP_CNT_RETX,        /*> retransmissions (go-back-N, hole repair, timeout) */
+  FP_CNT_AC,          /*> descriptors from application contexts */
+  FP_CNT_GRP0,        /*> received packets per flow group */
+  FP_CNT_GRP1,
+  FP_CNT_GRP2,
+  FP_CNT_GRP3,
+  FP_CNT_NUM,
+};
+
+#define FP_CNT_SLOTS  16
+
+PACKED_STRUCT(flextcp_pl_counters)
+{
+  uint64_t cnt[FP_CNT_SLOTS];
+};
+
 /******************************************************************************/
 PACKED_ALIGN_STRUCT(flextcp_pl_mem, 64)
 {
@@ -31,6 +59,9 @@ PACKED_ALIGN_STRUCT(flextcp_pl_mem, 64)
 
   /* registers for fastpath configuration */
   struct flextcp_pl_config cfg;
+
+  /* always-on fastpath counters */
+  struct flextcp_pl_counters counters;
 };
 
 #endif /* FLEXTOE_MEMIF_H_ */
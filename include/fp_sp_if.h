@@ -46,6 +46,8 @@ enum {
   FLEXTCP_PL_SPTX_FLOWHT_DEL,
   FLEXTCP_PL_SPTX_CONN_CLOSE,
   FLEXTCP_PL_SPTX_DEBUG_RESET,
+  FLEXTCP_PL_SPTX_CONN_PROBE,
+  FLEXTCP_PL_SPTX_CONN_RXWND,
 };
 
 /** Kernel TX queue entry */
@@ -65,6 +67,12 @@ PACKED_STRUCT(flextcp_pl_sptx_t)
       uint32_t flow_grp;
     } connretran;
     PACKED_STRUCT()
+    {
+      uint32_t flow_id;
+      uint32_t flow_grp;
+      int32_t delta;        /*> Window change in TCP_RXWND_QUANTUM units */
+    } connrxwnd;
+    PACKED_STRUCT()
     {
       uint32_t flow_id;
       uint32_t tx_rate;
@@ -123,7 +131,10 @@ PACKED_STRUCT(flextcp_pl_config)
 
   uint64_t poll_cycle_app;
 
-  uint8_t __pad2[16];
+  uint32_t delack_segs;     /*> ACK every n-th in-order segment, <= 1: all */
+  uint32_t delack_ts;       /*> Delayed ACK timeout (timestamp counts) */
+
+  uint8_t __pad2[8];
 };
 
 /* FIXME: Add STATIC asserts on struct sizes */
@@ -5,9 +5,9 @@
 #define FLEXTOE_PARAMS_H_
 
 /** Flow state parameters */
-#define FLEXNIC_PL_APPST_NUM        8
+#define FLEXNIC_PL_APPST_NUM        16
 #define FLEXNIC_PL_APPST_CTX_NUM    31
-#define FLEXNIC_PL_APPCTX_NUM       32
+#define FLEXNIC_PL_APPCTX_NUM       64      /*> At most one MSI-X vector each */
 #define FLEXNIC_PL_FLOWST_NUM       16384
 #define FLEXNIC_PL_FLOWHT_ENTRIES   (FLEXNIC_PL_FLOWST_NUM * 2)
 
@@ -0,0 +1,787 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+#ifndef FLEXTOE_QM_SCHED_H_
+#define FLEXTOE_QM_SCHED_H_
+
+#include <stdint.h>
+#include "params.h"
+
+/**
+ * Queue manager scheduling
+ *
+ * Flows that are not rate limited are scheduled by a two-level deficit round
+ * robin (DRR): over application contexts first, then over the flows of a
+ * context. Every context has a FIFO of its flows with data to send (one ring
+ * per doorbell id) and a weight, set by the slowpath in
+ * flextcp_pl_appctx_t.qm_weight. The current context is served until it used
+ * up its quantum of weight segments or has no flows queued, then the next
+ * context with queued flows in doorbell order takes over and adds its weight
+ * to the deficit. The deficit is reset once a context was passed over, except
+ * that an overdraft is carried into the next round.
+ *
+ * Inside a context the FIFO is served round robin with equal quanta: a flow
+ * gets up to #QM_DRR_BURST segments of #TCP_MSS bytes (bounded by the context's
+ * deficit) and goes to the back of the FIFO if it has more data. A context
+ * counts the flows it owns, including those being served, so it keeps its turn
+ * while its only flow is in flight.
+ *
+ * The context of a flow is kept in flowst_cc_t.qm_params, right after tx_rate,
+ * and is carried in queue entries (#QM_ENTRY_CTX_SHIFT). Rate-limited flows are
+ * paced by the slot wheel and bypass DRR.
+ *
+ * A context can also have an aggregate rate limit over all its flows, paced or
+ * not: a token bucket with rate and burst in flextcp_pl_appctx_t.qm_rate and
+ * qm_burst. Every segment scheduled for the context is charged to the bucket.
+ * Once it is empty the context is throttled: DRR passes it over and its
+ * entries on the slot wheel are put back #QM_TB_SLOTS slots later. The slot
+ * thread refills all buckets every #QM_TB_SLOTS slot lengths, by timestamp so
+ * a wheel falling behind does not slow down refills, and also picks up the
+ * parameters of one context per slot, so changes from the slowpath take effect
+ * within #QM_CTX_NUM slots.
+ *
+ * Flows can be put in one of #QM_PRIO_NUM strict-priority classes, set by the
+ * slowpath in qm_params (#QM_PARAMS_CLASS_SHIFT). Class 0 is the default and
+ * is scheduled by DRR as above. Flows of higher classes that are not rate
+ * limited bypass DRR and go to one FIFO per class instead, served round robin
+ * in bursts like a DRR context, and a higher class is always served first.
+ * So that bulk traffic in a high class cannot starve the others, the DRR
+ * threads count the turns the highest class got in a row while lower classes
+ * waited: after #QM_PRIO_STARVE of them the next lower class with work gets
+ * one turn, round robin. Aggregate rate limits still apply: entries of a
+ * throttled context are put on the slot wheel like paced flows and return to
+ * their class FIFO once scheduled from there.
+ *
+ * qm_sched_model replays the scheduler on the host, charging each decision a
+ * cycle-approximate cost, to check fairness, aggregate rates, latency of
+ * priority classes and measure scheduling throughput.
+ */
+
+#define QM_CTX_NUM            FLEXNIC_PL_APPCTX_NUM
+#define QM_CTX_WEIGHT_MAX     256     /*> Max weight [segments per round] */
+#define QM_DRR_BURST          4       /*> Max segments per flow and turn */
+
+#define QM_PRIO_NUM           4       /*> Priority classes, 0 is the lowest */
+#define QM_PRIO_STARVE        16      /*> Turns before lower classes get one */
+
+/* Queue entry: flow id (16) | flow group (4) | context (6) | class (2) | ... */
+#define QM_ENTRY_CTX_SHIFT    20
+#define QM_ENTRY_CTX_MASK     (QM_CTX_NUM - 1)
+#define QM_ENTRY_CTX(_E)      (((_E) >> QM_ENTRY_CTX_SHIFT) & QM_ENTRY_CTX_MASK)
+#define QM_ENTRY_CLASS_SHIFT  26
+#define QM_ENTRY_CLASS_MASK   (QM_PRIO_NUM - 1)
+#define QM_ENTRY_CLASS(_E)    (((_E) >> QM_ENTRY_CLASS_SHIFT) & QM_ENTRY_CLASS_MASK)
+#define QM_ENTRY_FLOW_GRP(_E) ((_E) & ((1 << QM_ENTRY_CTX_SHIFT) - 1))
+
+/* Token buckets, tokens and rate are bytes with QM_TB_FRAC fractional bits */
+#define QM_TB_SLOTS           64      /*> Refill interval [slot lengths] */
+#define QM_TB_FRAC            8
+#define QM_TB_BURST_MIN       4096    /*> [bytes] */
+#define QM_TB_BURST_MAX       (1 << 22)
+
+/* flowst_cc_t.qm_params: context (6) | ... | class (2) at bit 8 */
+#define QM_PARAMS_CTX(_P)     ((_P) & QM_ENTRY_CTX_MASK)
+#define QM_PARAMS_CLASS_SHIFT 8
+#define QM_PARAMS_CLASS(_P)   (((_P) >> QM_PARAMS_CLASS_SHIFT) & QM_ENTRY_CLASS_MASK)
+#define QM_PARAMS(_CTX, _CLS) \
+    (QM_PARAMS_CTX(_CTX) | (((_CLS) & QM_ENTRY_CLASS_MASK) << QM_PARAMS_CLASS_SHIFT))
+
+/** Queue entry for a flow (id and group) with parameters @p _P */
+#define QM_ENTRY(_FLOW_GRP, _P) \
+    (QM_ENTRY_FLOW_GRP(_FLOW_GRP) | (QM_PARAMS_CTX(_P) << QM_ENTRY_CTX_SHIFT) | \
+     (QM_PARAMS_CLASS(_P) << QM_ENTRY_CLASS_SHIFT))
+
+/** Bit of class @p _C in a mask of classes with work, highest class lowest */
+#define QM_PRIO_BIT(_C)       (1 << (QM_PRIO_NUM - 1 - (_C)))
+
+/* Context masks, one bit per context in words of 32 */
+#define QM_CTX_WORDS          (QM_CTX_NUM / 32)
+#define QM_CTX_WORD(_C)       ((_C) >> 5)
+#define QM_CTX_BIT(_C)        (1u << ((_C) & 31))
+
+#if FIRMWARE
+  #define QM_SCHED_FN         __intrinsic static
+  #define QM_SCHED_FFS(_X)    ffs(_X)
+  #define QM_SCHED_MEM        __lmem
+#else
+  #define QM_SCHED_FN         static inline
+  #define QM_SCHED_FFS(_X)    __builtin_ctz(_X)
+  #define QM_SCHED_MEM
+#endif
+
+/** Weight used for a context, 0 (never set) counts as 1 */
+QM_SCHED_FN uint32_t qm_drr_weight(uint32_t weight)
+{
+  if (weight == 0) {
+    return 1;
+  }
+  if (weight > QM_CTX_WEIGHT_MAX) {
+    return QM_CTX_WEIGHT_MAX;
+  }
+  return weight;
+}
+
+/**
+ * Context after @p cur in doorbell order with flows queued.
+ *
+ * @param active  Bit mask of contexts with flows, must not be 0
+ * @param cur     Current context
+ */
+QM_SCHED_FN uint32_t qm_drr_next(uint32_t active, uint32_t cur)
+{
+  uint32_t later;
+
+  /* 2 << 31 wraps to 0, so nothing comes after the last context */
+  later = active & ~((2u << cur) - 1);
+  if (later != 0) {
+    return QM_SCHED_FFS(later);
+  }
+  return QM_SCHED_FFS(active);
+}
+
+/**
+ * Context after @p cur in doorbell order with flows queued and tokens left.
+ *
+ * @param active     Context mask of contexts with flows
+ * @param throttled  Context mask of contexts out of tokens, must not cover
+ *                   all of @p active
+ * @param cur        Current context
+ */
+QM_SCHED_FN uint32_t qm_drr_next_ctx(QM_SCHED_MEM uint32_t *active,
+    QM_SCHED_MEM uint32_t *throttled, uint32_t cur)
+{
+  uint32_t i, w, ready;
+
+  /* Rest of the current word, then the other words and its start */
+  w = QM_CTX_WORD(cur);
+  ready = active[w] & ~throttled[w] & ~((QM_CTX_BIT(cur) << 1) - 1);
+  for (i = 0; ready == 0 && i < QM_CTX_WORDS; i++) {
+    w = (w + 1) & (QM_CTX_WORDS - 1);
+    ready = active[w] & ~throttled[w];
+  }
+  return (w << 5) + QM_SCHED_FFS(ready);
+}
+
+/** Any context with flows queued and tokens left */
+QM_SCHED_FN uint32_t qm_drr_ready(QM_SCHED_MEM uint32_t *active,
+    QM_SCHED_MEM uint32_t *throttled)
+{
+  uint32_t w;
+
+  for (w = 0; w < QM_CTX_WORDS; w++) {
+    if ((active[w] & ~throttled[w]) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** Deficit of a context taking over the turn */
+QM_SCHED_FN int32_t qm_drr_refill(int32_t deficit, uint32_t weight)
+{
+  if (deficit > 0) {
+    deficit = 0;
+  }
+  return deficit + (int32_t) weight;
+}
+
+/**
+ * Segments to ask for on a turn.
+ *
+ * @param deficit  Deficit of the context
+ * @param credits  Free TX credits, > 0
+ */
+QM_SCHED_FN uint32_t qm_drr_burst(int32_t deficit, uint32_t credits)
+{
+  uint32_t n = QM_DRR_BURST;
+
+  /* another thread may have used up the quantum meanwhile: overdraw by one */
+  if (deficit <= 0) {
+    return 1;
+  }
+  if ((uint32_t) deficit < n) {
+    n = deficit;
+  }
+  if (credits < n) {
+    n = credits;
+  }
+  return n;
+}
+
+/**
+ * Segments granted for a turn.
+ *
+ * @param avail  tx_avail before subtracting @p n segments
+ * @param n      Segments asked for
+ * @param mss    Segment size
+ */
+QM_SCHED_FN uint32_t qm_drr_granted(uint32_t avail, uint32_t n, uint32_t mss)
+{
+  uint32_t segs = 0;
+
+  /* no divide on the ME, n is small */
+  while (segs < n && avail > segs * mss) {
+    segs++;
+  }
+  return segs;
+}
+
+/**
+ * Tokens after a refill interval.
+ *
+ * @param tokens  Tokens in the bucket
+ * @param rate    Tokens added per interval (qm_rate)
+ * @param burst   Bucket size [bytes] (qm_burst), <= #QM_TB_BURST_MAX
+ */
+QM_SCHED_FN int32_t qm_tb_refill(int32_t tokens, uint32_t rate, uint32_t burst)
+{
+  int32_t max = (int32_t) (burst << QM_TB_FRAC);
+
+  tokens += (int32_t) rate;
+  if (tokens > max) {
+    tokens = max;
+  }
+  return tokens;
+}
+
+/** Tokens after scheduling @p bytes, <= 0 throttles the context */
+QM_SCHED_FN int32_t qm_tb_charge(int32_t tokens, uint32_t bytes)
+{
+  return tokens - (int32_t) (bytes << QM_TB_FRAC);
+}
+
+/**
+ * Class to serve next.
+ *
+ * @param active  Mask of classes with work (#QM_PRIO_BIT), must not be 0
+ * @param wait    Turns the highest class got while lower classes waited
+ * @param relief  Class that got the last turn for starvation protection
+ */
+QM_SCHED_FN uint32_t qm_prio_pick(uint32_t active, uint32_t wait,
+    uint32_t relief)
+{
+  uint32_t top, lower;
+
+  top = QM_SCHED_FFS(active);
+  lower = active & ~(1u << top);
+  if (lower == 0 || wait < QM_PRIO_STARVE) {
+    return QM_PRIO_NUM - 1 - top;
+  }
+  return QM_PRIO_NUM - 1 - qm_drr_next(lower, QM_PRIO_NUM - 1 - relief);
+}
+
+/**
+ * Turns lower classes waited after class @p cls got one.
+ *
+ * @param active  Mask of classes with work when @p cls was picked
+ * @param cls     Class picked by qm_prio_pick()
+ * @param wait    Turns waited before
+ */
+QM_SCHED_FN uint32_t qm_prio_wait(uint32_t active, uint32_t cls, uint32_t wait)
+{
+  /* the highest class was served and is not alone */
+  if ((active & (active - 1)) != 0 &&
+      QM_SCHED_FFS(active) == QM_PRIO_NUM - 1 - cls)
+  {
+    return wait + 1;
+  }
+  return 0;
+}
+
+#if !FIRMWARE
+#define QM_ME_MHZ             800     /*> ME clock */
+
+/** qm_rate for a limit of @p kbps, 0: no limit */
+static inline uint32_t qm_tb_rate(uint32_t kbps)
+{
+  uint64_t r;
+
+  if (kbps == 0) {
+    return 0;
+  }
+
+  /* bytes per refill interval of QM_TB_SLOTS slots of 256 cycles */
+  r = ((uint64_t) kbps * 125 * QM_TB_SLOTS * 256 << QM_TB_FRAC) /
+      (QM_ME_MHZ * 1000000ull);
+  if (r == 0) {
+    r = 1;
+  }
+  if (r > ((uint64_t) QM_TB_BURST_MAX << QM_TB_FRAC)) {
+    r = (uint64_t) QM_TB_BURST_MAX << QM_TB_FRAC;
+  }
+  return r;
+}
+
+/** Smallest qm_burst that sustains qm_rate @p rate */
+static inline uint32_t qm_tb_burst_min(uint32_t rate)
+{
+  uint32_t burst = (rate + (1 << QM_TB_FRAC) - 1) >> QM_TB_FRAC;
+
+  return (burst < QM_TB_BURST_MIN ? QM_TB_BURST_MIN : burst);
+}
+
+#define QM_MODEL_SLOTS        512     /*> QM_NUM_SLOTS */
+#define QM_MODEL_SLOT_CYC     256     /*> QM_SLOT_RESOLUTION_TS_CYC_CNT */
+#define QM_MODEL_SLOT_SHIFT   8       /*> QM_SLOT_RESOLUTION_TS_CYC_SHIFT */
+#define QM_MODEL_CREDITS      1024    /*> FLOW_QM_CREDITS */
+
+/* ME cycles per operation, with memory latency hidden by the other threads */
+#define QM_MODEL_CYC_DRR      40      /*> Pick a context and dequeue a flow */
+#define QM_MODEL_CYC_SEG      8       /*> Push one segment to a sched ring */
+#define QM_MODEL_CYC_SLOT     36      /*> Dequeue and schedule from a slot */
+
+/** Flow as seen by the queue manager */
+struct qm_sched_model_flow {
+  uint32_t avail;                 /*> tx_avail */
+  uint32_t rate;                  /*> tx_rate, 0: not rate limited */
+  uint32_t params;                /*> qm_params */
+  int32_t next;                   /*> Next flow in the same queue, -1: none */
+  int queued;                     /*> Flow is in a queue */
+  uint64_t tx_bytes;              /*> Bytes scheduled */
+};
+
+struct qm_sched_model_queue {
+  int32_t head;
+  int32_t tail;
+  uint32_t len;
+};
+
+struct qm_sched_model {
+  struct qm_sched_model_flow *flows;
+  uint32_t flows_num;
+  uint32_t mss;                   /*> TCP_MSS */
+  uint32_t pipe_cyc;              /*> Pipeline cycles per segment */
+
+  struct qm_sched_model_queue ctxq[QM_CTX_NUM];
+  int32_t deficit[QM_CTX_NUM];
+  uint32_t weight[QM_CTX_NUM];
+  uint32_t active[QM_CTX_WORDS];  /*> Contexts with flows */
+  uint32_t cur;                   /*> Context holding the turn */
+
+  struct qm_sched_model_queue prioq[QM_PRIO_NUM]; /*> Class FIFOs, 0 unused */
+  uint32_t prio_active;           /*> Classes with flows (QM_PRIO_BIT) */
+  uint32_t prio_wait;             /*> See qm_prio_wait() */
+  uint32_t prio_relief;           /*> See qm_prio_pick() */
+
+  int32_t tokens[QM_CTX_NUM];
+  uint32_t tb_rate[QM_CTX_NUM];   /*> qm_rate */
+  uint32_t tb_burst[QM_CTX_NUM];  /*> qm_burst */
+  uint32_t limited[QM_CTX_WORDS]; /*> Contexts with a token bucket */
+  uint32_t throttled[QM_CTX_WORDS]; /*> Contexts out of tokens */
+
+  struct qm_sched_model_queue slots[QM_MODEL_SLOTS];
+  uint32_t cur_slot;
+
+  uint32_t credits;
+  uint32_t pipe_debt;             /*> Pipeline cycles carried to next slot */
+
+  uint64_t cycles;                /*> Elapsed ME cycles */
+  uint64_t busy_cycles;           /*> Cycles spent scheduling */
+  uint64_t decisions;             /*> Flows dequeued */
+  uint64_t segments;              /*> Segments scheduled */
+  uint64_t ctx_bytes[QM_CTX_NUM]; /*> Bytes scheduled per context */
+};
+
+static inline void qm_sched_model_init(struct qm_sched_model *m,
+    struct qm_sched_model_flow *flows, uint32_t flows_num, uint32_t mss,
+    uint32_t pipe_cyc)
+{
+  uint32_t i;
+
+  m->flows = flows;
+  m->flows_num = flows_num;
+  m->mss = mss;
+  m->pipe_cyc = pipe_cyc;
+  for (i = 0; i < flows_num; i++) {
+    flows[i].avail = 0;
+    flows[i].rate = 0;
+    flows[i].params = 0;
+    flows[i].next = -1;
+    flows[i].queued = 0;
+    flows[i].tx_bytes = 0;
+  }
+  for (i = 0; i < QM_CTX_NUM; i++) {
+    m->ctxq[i].head = m->ctxq[i].tail = -1;
+    m->ctxq[i].len = 0;
+    m->deficit[i] = 0;
+    m->weight[i] = 1;
+    m->tokens[i] = 0;
+    m->tb_rate[i] = 0;
+    m->tb_burst[i] = 0;
+    m->ctx_bytes[i] = 0;
+  }
+  for (i = 0; i < QM_CTX_WORDS; i++) {
+    m->active[i] = 0;
+    m->limited[i] = 0;
+    m->throttled[i] = 0;
+  }
+  for (i = 0; i < QM_PRIO_NUM; i++) {
+    m->prioq[i].head = m->prioq[i].tail = -1;
+    m->prioq[i].len = 0;
+  }
+  for (i = 0; i < QM_MODEL_SLOTS; i++) {
+    m->slots[i].head = m->slots[i].tail = -1;
+    m->slots[i].len = 0;
+  }
+  m->cur = 0;
+  m->prio_active = 0;
+  m->prio_wait = 0;
+  m->prio_relief = 0;
+  m->cur_slot = 0;
+  m->credits = QM_MODEL_CREDITS;
+  m->pipe_debt = 0;
+  m->cycles = 0;
+  m->busy_cycles = 0;
+  m->decisions = 0;
+  m->segments = 0;
+}
+
+/** Weight update from the slowpath (nicif_appctx_weight()) */
+static inline void qm_sched_model_weight(struct qm_sched_model *m,
+    uint32_t ctx, uint32_t weight)
+{
+  m->weight[ctx & QM_ENTRY_CTX_MASK] = qm_drr_weight(weight);
+}
+
+/**
+ * Aggregate rate limit from the slowpath (nicif_appctx_ratelimit()), applied
+ * right away instead of within #QM_CTX_NUM slots.
+ *
+ * @param m      Model state
+ * @param ctx    Context
+ * @param kbps   Rate limit, 0 removes it
+ * @param burst  Bucket size [bytes], raised to what the rate needs
+ */
+static inline void qm_sched_model_ratelimit(struct qm_sched_model *m,
+    uint32_t ctx, uint32_t kbps, uint32_t burst)
+{
+  uint32_t w, bit, min;
+
+  ctx &= QM_ENTRY_CTX_MASK;
+  w = QM_CTX_WORD(ctx);
+  bit = QM_CTX_BIT(ctx);
+  m->tb_rate[ctx] = qm_tb_rate(kbps);
+  if (m->tb_rate[ctx] == 0) {
+    m->limited[w] &= ~bit;
+    m->throttled[w] &= ~bit;
+    return;
+  }
+
+  min = qm_tb_burst_min(m->tb_rate[ctx]);
+  m->tb_burst[ctx] = (burst < min ? min : burst);
+  if (m->tb_burst[ctx] > QM_TB_BURST_MAX) {
+    m->tb_burst[ctx] = QM_TB_BURST_MAX;
+  }
+  if ((m->limited[w] & bit) == 0) {
+    m->tokens[ctx] = m->tb_burst[ctx] << QM_TB_FRAC;
+    m->limited[w] |= bit;
+  }
+}
+
+/** Achieved rate of a context since the start [kbps] */
+static inline double qm_sched_model_kbps(struct qm_sched_model *m,
+    uint32_t ctx)
+{
+  if (m->cycles == 0) {
+    return 0;
+  }
+  return (double) m->ctx_bytes[ctx & QM_ENTRY_CTX_MASK] * 8 * QM_ME_MHZ *
+      1000 / m->cycles;
+}
+
+static inline void qm_sched_model_push(struct qm_sched_model *m,
+    struct qm_sched_model_queue *q, uint32_t f)
+{
+  m->flows[f].next = -1;
+  m->flows[f].queued = 1;
+  if (q->tail >= 0) {
+    m->flows[q->tail].next = f;
+  } else {
+    q->head = f;
+  }
+  q->tail = f;
+  q->len++;
+}
+
+static inline int32_t qm_sched_model_pop(struct qm_sched_model *m,
+    struct qm_sched_model_queue *q)
+{
+  int32_t f = q->head;
+
+  if (f < 0) {
+    return -1;
+  }
+  q->head = m->flows[f].next;
+  if (q->head < 0) {
+    q->tail = -1;
+  }
+  q->len--;
+  m->flows[f].queued = 0;
+  return f;
+}
+
+/** flow_add_to_queue(), @p skip: the current slot is being drained */
+static inline void qm_sched_model_add(struct qm_sched_model *m, uint32_t f,
+    uint32_t skip)
+{
+  struct qm_sched_model_flow *fl = &m->flows[f];
+  uint32_t ctx, cls, slot, chunk;
+
+  cls = QM_PARAMS_CLASS(fl->params);
+  if (fl->rate == 0 && cls != 0) {
+    qm_sched_model_push(m, &m->prioq[cls], f);
+    m->prio_active |= QM_PRIO_BIT(cls);
+    return;
+  }
+  if (fl->rate == 0) {
+    ctx = QM_PARAMS_CTX(fl->params);
+    qm_sched_model_push(m, &m->ctxq[ctx], f);
+    m->active[QM_CTX_WORD(ctx)] |= QM_CTX_BIT(ctx);
+    return;
+  }
+
+  chunk = (fl->avail < m->mss ? fl->avail : m->mss);
+  slot = ((uint32_t) (((uint64_t) fl->rate * chunk) >> 10) >>
+      QM_MODEL_SLOT_SHIFT) + skip;
+  if (slot >= QM_MODEL_SLOTS) {
+    slot = QM_MODEL_SLOTS - 1;
+  }
+  slot = (m->cur_slot + slot) & (QM_MODEL_SLOTS - 1);
+  qm_sched_model_push(m, &m->slots[slot], f);
+}
+
+/** Data for flow @p f posted, as in push_qm_bump() */
+static inline void qm_sched_model_bump(struct qm_sched_model *m, uint32_t f,
+    uint32_t bytes)
+{
+  struct qm_sched_model_flow *fl = &m->flows[f];
+
+  fl->avail += bytes;
+  if (!fl->queued && fl->avail == bytes && bytes != 0) {
+    qm_sched_model_add(m, f, 0);
+  }
+}
+
+/* schedule up to n segments of flow f, returns cycles spent */
+static inline uint32_t qm_sched_model_serve(struct qm_sched_model *m,
+    uint32_t f, uint32_t n, uint32_t *granted)
+{
+  struct qm_sched_model_flow *fl = &m->flows[f];
+  uint32_t segs, bytes, c;
+
+  segs = qm_drr_granted(fl->avail, n, m->mss);
+  bytes = segs * m->mss;
+  if (bytes > fl->avail) {
+    bytes = fl->avail;
+  }
+  fl->avail -= bytes;
+  fl->tx_bytes += bytes;
+
+  c = QM_PARAMS_CTX(fl->params);
+  m->ctx_bytes[c] += bytes;
+  if ((m->limited[QM_CTX_WORD(c)] & QM_CTX_BIT(c)) != 0) {
+    m->tokens[c] = qm_tb_charge(m->tokens[c], bytes);
+    if (m->tokens[c] <= 0) {
+      m->throttled[QM_CTX_WORD(c)] |= QM_CTX_BIT(c);
+    }
+  }
+  m->credits -= segs;
+  m->segments += segs;
+  m->decisions++;
+  *granted = segs;
+  return segs * QM_MODEL_CYC_SEG;
+}
+
+/* one DRR decision (queue_drr_poll()), returns cycles spent */
+static inline uint32_t qm_sched_model_drr(struct qm_sched_model *m)
+{
+  struct qm_sched_model_flow *fl;
+  uint32_t c, n, granted, cyc;
+  int32_t f;
+
+  c = m->cur;
+  if (m->deficit[c] <= 0 || m->ctxq[c].len == 0 ||
+      (m->throttled[QM_CTX_WORD(c)] & QM_CTX_BIT(c)) != 0)
+  {
+    c = qm_drr_next_ctx(m->active, m->throttled, c);
+    m->cur = c;
+    m->deficit[c] = qm_drr_refill(m->deficit[c], m->weight[c]);
+  }
+
+  f = qm_sched_model_pop(m, &m->ctxq[c]);
+  n = qm_drr_burst(m->deficit[c], m->credits);
+  cyc = QM_MODEL_CYC_DRR + qm_sched_model_serve(m, f, n, &granted);
+  m->deficit[c] -= granted;
+
+  fl = &m->flows[f];
+  if (fl->avail != 0 && fl->rate == 0 && QM_PARAMS_CTX(fl->params) == c &&
+      QM_PARAMS_CLASS(fl->params) == 0)
+  {
+    qm_sched_model_push(m, &m->ctxq[c], f);
+    return cyc;
+  }
+  if (m->ctxq[c].len == 0) {
+    m->active[QM_CTX_WORD(c)] &= ~QM_CTX_BIT(c);
+  }
+  if (fl->avail != 0) {
+    qm_sched_model_add(m, f, 1);
+  }
+  return cyc;
+}
+
+/* a DRR thread's turn: class FIFO or DRR, returns cycles spent */
+static inline uint32_t qm_sched_model_turn(struct qm_sched_model *m)
+{
+  struct qm_sched_model_queue *q;
+  uint32_t active, cls, c, granted, cyc, later;
+  int32_t f;
+
+  active = m->prio_active;
+  if (qm_drr_ready(m->active, m->throttled)) {
+    active |= QM_PRIO_BIT(0);
+  }
+  cls = qm_prio_pick(active, m->prio_wait, m->prio_relief);
+  m->prio_wait = qm_prio_wait(active, cls, m->prio_wait);
+  if (m->prio_wait == 0) {
+    m->prio_relief = cls;
+  }
+  if (cls == 0) {
+    return qm_sched_model_drr(m);
+  }
+
+  q = &m->prioq[cls];
+  f = qm_sched_model_pop(m, q);
+  if (q->len == 0) {
+    m->prio_active &= ~QM_PRIO_BIT(cls);
+  }
+
+  /* context over its aggregate rate: wait on the slot wheel */
+  c = QM_PARAMS_CTX(m->flows[f].params);
+  if ((m->throttled[QM_CTX_WORD(c)] & QM_CTX_BIT(c)) != 0) {
+    later = (m->cur_slot + QM_TB_SLOTS) & (QM_MODEL_SLOTS - 1);
+    qm_sched_model_push(m, &m->slots[later], f);
+    return QM_MODEL_CYC_DRR;
+  }
+
+  cyc = QM_MODEL_CYC_DRR + qm_sched_model_serve(m, f,
+      qm_drr_burst(QM_DRR_BURST, m->credits), &granted);
+  if (m->flows[f].avail != 0) {
+    qm_sched_model_add(m, f, 1);
+  }
+  return cyc;
+}
+
+/* qm_tb_tick(): refill token buckets */
+static inline void qm_sched_model_refill(struct qm_sched_model *m)
+{
+  uint32_t c;
+
+  for (c = 0; c < QM_CTX_NUM; c++) {
+    if ((m->limited[QM_CTX_WORD(c)] & QM_CTX_BIT(c)) == 0) {
+      continue;
+    }
+    m->tokens[c] = qm_tb_refill(m->tokens[c], m->tb_rate[c], m->tb_burst[c]);
+    if (m->tokens[c] > 0) {
+      m->throttled[QM_CTX_WORD(c)] &= ~QM_CTX_BIT(c);
+    }
+  }
+}
+
+/**
+ * Run the queue manager for one slot (#QM_MODEL_SLOT_CYC cycles). Rate-limited
+ * flows in the current slot go first, the wheel only advances once the slot is
+ * drained. Entries of throttled contexts are put back #QM_TB_SLOTS slots later.
+ * Class FIFOs and DRR decisions use the remaining cycles. The pipeline returns a credit every
+ * pipe_cyc cycles.
+ *
+ * @return Segments scheduled.
+ */
+static inline uint32_t qm_sched_model_slot(struct qm_sched_model *m)
+{
+  uint64_t segments = m->segments;
+  uint32_t budget = QM_MODEL_SLOT_CYC, cyc, granted, ret, later, c;
+  int32_t f;
+
+  if ((m->cycles / QM_MODEL_SLOT_CYC) % QM_TB_SLOTS == 0) {
+    qm_sched_model_refill(m);
+  }
+
+  /* credits returned by the pipeline */
+  if (m->pipe_cyc != 0) {
+    m->pipe_debt += QM_MODEL_SLOT_CYC;
+    ret = m->pipe_debt / m->pipe_cyc;
+    m->pipe_debt -= ret * m->pipe_cyc;
+  } else {
+    ret = QM_MODEL_CREDITS;
+  }
+  m->credits += ret;
+  if (m->credits > QM_MODEL_CREDITS) {
+    m->credits = QM_MODEL_CREDITS;
+  }
+
+  while (budget >= QM_MODEL_CYC_SLOT && m->credits != 0 &&
+      (f = qm_sched_model_pop(m, &m->slots[m->cur_slot])) >= 0)
+  {
+    c = QM_PARAMS_CTX(m->flows[f].params);
+    if ((m->throttled[QM_CTX_WORD(c)] & QM_CTX_BIT(c)) != 0) {
+      later = (m->cur_slot + QM_TB_SLOTS) & (QM_MODEL_SLOTS - 1);
+      qm_sched_model_push(m, &m->slots[later], f);
+      budget -= (QM_MODEL_CYC_SLOT < budget ? QM_MODEL_CYC_SLOT : budget);
+      m->busy_cycles += QM_MODEL_CYC_SLOT;
+      continue;
+    }
+
+    cyc = QM_MODEL_CYC_SLOT + qm_sched_model_serve(m, f, 1, &granted);
+    budget -= (cyc < budget ? cyc : budget);
+    m->busy_cycles += cyc;
+    if (m->flows[f].avail != 0) {
+      qm_sched_model_add(m, f, 1);
+    }
+  }
+  if (m->slots[m->cur_slot].len == 0) {
+    m->cur_slot = (m->cur_slot + 1) & (QM_MODEL_SLOTS - 1);
+  }
+
+  while (budget >= QM_MODEL_CYC_DRR && m->credits != 0 &&
+      (qm_drr_ready(m->active, m->throttled) || m->prio_active != 0))
+  {
+    cyc = qm_sched_model_turn(m);
+    budget -= (cyc < budget ? cyc : budget);
+    m->busy_cycles += cyc;
+  }
+
+  m->cycles += QM_MODEL_SLOT_CYC;
+  return m->segments - segments;
+}
+
+/**
+ * Jain's fairness index of the bytes scheduled per context, normalized by
+ * weight: 1 means every context got exactly its share.
+ *
+ * @param m     Model state
+ * @param ctxs  Bit mask of the contexts to compare (all backlogged), the
+ *              first 64 only
+ */
+static inline double qm_sched_model_fairness(struct qm_sched_model *m,
+    uint64_t ctxs)
+{
+  double x, sum = 0, sum_sq = 0;
+  uint32_t c, n = 0;
+
+  for (c = 0; c < QM_CTX_NUM && c < 64; c++) {
+    if ((ctxs & (1ull << c)) == 0) {
+      continue;
+    }
+    x = (double) m->ctx_bytes[c] / m->weight[c];
+    sum += x;
+    sum_sq += x * x;
+    n++;
+  }
+  if (n == 0 || sum_sq == 0) {
+    return 1;
+  }
+  return sum * sum / (n * sum_sq);
+}
+#endif /* !FIRMWARE */
+
+#endif /* FLEXTOE_QM_SCHED_H_ */
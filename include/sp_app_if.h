@@ -8,10 +8,17 @@
 
 #include "common.h"
 
+/** Context request does not prefer a NUMA node */
+#define SP_UXSOCK_NODE_ANY UINT32_MAX
+/** Application does not take part in reconnects */
+#define SP_UXSOCK_SESSION_NONE 0
+
 PACKED_STRUCT(sp_uxsock_request)
 {
   uint32_t rxq_len;
   uint32_t txq_len;
+  uint32_t numa_node;   /*> node of the thread using the context */
+  uint64_t session;     /*> token a restarted process reclaims state with */
 };
 
 PACKED_STRUCT(sp_uxsock_response)
@@ -40,6 +47,8 @@ enum {
   SP_APPOUT_LISTEN_OPEN,
   SP_APPOUT_LISTEN_CLOSE,
   SP_APPOUT_ACCEPT_CONN,
+  SP_APPOUT_CONN_KEEPALIVE,
+  SP_APPOUT_CONN_PRIORITY,
 };
 
 /** Open a new connection */
@@ -75,6 +84,30 @@ PACKED_STRUCT(sp_appout_conn_move)
   uint16_t db_id;
 };
 
+/** Configure keepalive for a connection, no response */
+PACKED_STRUCT(sp_appout_conn_keepalive)
+{
+  uint64_t opaque;
+  uint32_t remote_ip;
+  uint32_t local_ip;
+  uint16_t remote_port;
+  uint16_t local_port;
+  uint32_t idle;      /*> Idle time before first probe [s], 0 disables */
+  uint32_t intvl;     /*> Interval between probes [s] */
+  uint32_t cnt;       /*> Unanswered probes before reset */
+};
+
+/** Set the priority class of a connection, no response */
+PACKED_STRUCT(sp_appout_conn_priority)
+{
+  uint64_t opaque;
+  uint32_t remote_ip;
+  uint32_t local_ip;
+  uint16_t remote_port;
+  uint16_t local_port;
+  uint32_t cls;       /*> Queue manager class, 0 is the default */
+};
+
 #define SP_APPOUT_LISTEN_REUSEPORT    (1 << 0)
 
 /** Open listener */
@@ -109,6 +142,8 @@ PACKED_STRUCT(sp_appout)
     struct sp_appout_conn_open    conn_open;
     struct sp_appout_conn_close   conn_close;
     struct sp_appout_conn_move    conn_move;
+    struct sp_appout_conn_keepalive conn_keepalive;
+    struct sp_appout_conn_priority conn_priority;
 
     struct sp_appout_listen_open  listen_open;
     struct sp_appout_listen_close listen_close;
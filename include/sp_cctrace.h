@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+#ifndef SP_CCTRACE_H_
+#define SP_CCTRACE_H_
+
+#include <stdint.h>
+
+#include "common.h"
+
+/**
+ * Layout of the congestion control trace region (#FLEXNIC_NAME_CCTRACE).
+ *
+ * With --cc-trace-sample=N the slowpath appends one record per control
+ * interval of every connection whose flow id is a multiple of N, so sampled
+ * connections are traced completely. The region is a ring of
+ * sp_cctrace_hdr::rec_num records that the slowpath overwrites without
+ * waiting for readers.
+ *
+ * The slowpath writes record i at index i & (rec_num - 1) and then publishes
+ * it by setting head to i + 1. A reader copies the records between its own
+ * position and head, then reads head again: records older than the new
+ * head - rec_num may have been overwritten while copying and are lost, as are
+ * the ones the reader fell behind on by more than rec_num.
+ */
+
+#define SP_CCTRACE_MAGIC        0x45434152544343ULL  /*> "CCTRACE" */
+#define SP_CCTRACE_VERSION      1
+
+#define SP_CCTRACE_F_REXMIT     (1 << 0)  /*> Retransmission issued */
+#define SP_CCTRACE_F_TLP        (1 << 1)  /*> Tail loss probe issued */
+#define SP_CCTRACE_F_SLOWSTART  (1 << 2)  /*> Flow in slow start */
+
+/** One control interval of one connection */
+PACKED_STRUCT(sp_cctrace_rec)
+{
+  uint32_t ts_us;             /*> slowpath time of the update */
+  uint32_t flow_id;
+  uint32_t rtt;               /*> us, as used by the update */
+  uint32_t rate;              /*> kbps, computed rate */
+  uint32_t window;            /*> bytes, window-based DCTCP only */
+  uint32_t cc_state;          /*> DCTCP: ECN EWMA (UINT32_MAX is 1),
+                                  TIMELY: RTT gradient (signed) */
+  uint32_t ackb;              /*> bytes acked in the interval */
+  uint32_t ecnb;              /*> ECN marked bytes acked in the interval */
+  uint32_t acks;              /*> ACKs in the interval */
+  uint16_t drops;             /*> drops in the interval, saturating */
+  uint8_t flags;              /*> see SP_CCTRACE_F_* */
+  uint8_t __pad;
+};
+
+PACKED_STRUCT(sp_cctrace_hdr)
+{
+  uint64_t magic;
+  uint32_t version;
+  uint32_t size;              /*> size of the region in bytes */
+  uint32_t rec_num;           /*> ring size, power of 2 */
+  uint32_t sample;            /*> every sample-th flow id is traced */
+  uint32_t cc_algorithm;      /*> enum config_cc_algorithm */
+  uint32_t interval;          /*> control interval in RTTs */
+  volatile uint64_t head;     /*> records written so far */
+};
+
+PACKED_STRUCT(sp_cctrace)
+{
+  struct sp_cctrace_hdr hdr;
+  struct sp_cctrace_rec recs[];
+};
+
+/**
+ * Trace file written by flextoe-cctrace: this header followed by the records
+ * in the order the slowpath wrote them.
+ */
+#define SP_CCTRACE_FILE_MAGIC   0x454c494643434354ULL  /*> "TCCCFILE" */
+
+PACKED_STRUCT(sp_cctrace_file)
+{
+  uint64_t magic;
+  uint32_t version;           /*> SP_CCTRACE_VERSION */
+  uint32_t rec_size;          /*> sizeof(struct sp_cctrace_rec) */
+  uint32_t cc_algorithm;
+  uint32_t sample;
+  uint32_t interval;
+  uint32_t __pad;
+};
+
+static inline size_t sp_cctrace_size(uint32_t rec_num)
+{
+  return sizeof(struct sp_cctrace_hdr) +
+    (size_t) rec_num * sizeof(struct sp_cctrace_rec);
+}
+
+#endif /* SP_CCTRACE_H_ */
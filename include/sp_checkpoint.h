@@ -0,0 +1,158 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+#ifndef SP_CHECKPOINT_H_
+#define SP_CHECKPOINT_H_
+
+#include <stdint.h>
+
+#include "common.h"
+
+/**
+ * Slowpath checkpoint file (--checkpoint, --restore).
+ *
+ * A slowpath started with --checkpoint=FILE writes its control state to FILE
+ * when it exits and leaves the shared memory regions and the NIC running. A
+ * slowpath started with --restore re-attaches to both and continues from
+ * FILE. Everything the fastpath owns (flow state, queue indices, the SP rings)
+ * stays on the NIC and in packet memory, the file only holds what lives in
+ * the slowpath process.
+ *
+ * The file is the header followed by sp_ckpt_hdr::ctxs context records,
+ * sp_ckpt_hdr::listeners listener records, sp_ckpt_hdr::conns connection
+ * records, sp_ckpt_hdr::tws TIME_WAIT records and sp_ckpt_hdr::arps ARP
+ * records. Packet memory has no section of its own: every record names the
+ * ranges it owns, whatever is not named is free after a restore.
+ */
+
+#define SP_CKPT_MAGIC           0x54504b435053ULL  /*> "SPCKPT" */
+#define SP_CKPT_VERSION         3
+
+#define SP_CKPT_CC_BYTES        32    /*> Congestion control state */
+#define SP_CKPT_NO_LISTENER     UINT32_MAX
+
+/** Range of packet memory (see packetmem_alloc()) */
+PACKED_STRUCT(sp_ckpt_mem)
+{
+  uint64_t off;               /*> offset into the dma memory region */
+  uint32_t len;               /*> bytes, 0 if not allocated */
+  uint32_t zone;
+};
+
+PACKED_STRUCT(sp_ckpt_hdr)
+{
+  uint64_t magic;
+  uint32_t version;
+  uint32_t size;              /*> size of the file in bytes */
+  uint64_t shm_len;           /*> the remaining fields must match on restore */
+  uint32_t ip;
+  uint32_t nic_rx_len;
+  uint32_t nic_tx_len;
+  uint32_t cc_algorithm;      /*> cc state is re-initialized if different */
+  uint32_t ctxs;
+  uint32_t listeners;
+  uint32_t conns;
+  uint32_t tws;
+  uint32_t arps;
+  struct sp_ckpt_mem adminq_bufs;   /*> SP ring packet buffers */
+  struct sp_ckpt_mem adminq_desc;   /*> SP ring descriptors */
+};
+
+/** Application context, the application is implied by its contexts */
+PACKED_STRUCT(sp_ckpt_ctx)
+{
+  uint16_t app_id;
+  uint8_t app_closed;         /*> application teardown was in progress */
+  uint8_t numa_node;          /*> node buffers are allocated on */
+  uint32_t db_id;
+  uint32_t spin_len;          /*> entries */
+  uint32_t spin_pos;
+  uint32_t spout_len;
+  uint32_t spout_pos;
+  uint32_t rxq_len;           /*> entries */
+  uint32_t txq_len;
+  struct sp_ckpt_mem spin;
+  struct sp_ckpt_mem spout;
+  struct sp_ckpt_mem rxq;
+  struct sp_ckpt_mem txq;
+};
+
+PACKED_STRUCT(sp_ckpt_listener)
+{
+  uint64_t opaque;
+  uint16_t app_id;
+  uint16_t port;
+  uint32_t ctx_db;            /*> doorbell of the owning context */
+  uint32_t backlog;
+  uint32_t reuseport;
+};
+
+/**
+ * Connection. Open, closing and accepting connections are restored as they
+ * were, opens still in their handshake are failed towards the application.
+ */
+PACKED_STRUCT(sp_ckpt_conn)
+{
+  uint64_t opaque;
+  uint64_t remote_mac;
+  uint32_t remote_ip;
+  uint32_t local_ip;
+  uint16_t remote_port;
+  uint16_t local_port;
+  uint16_t app_id;
+  uint16_t flow_group;
+  uint32_t ctx_db;            /*> doorbell of the owning context */
+  uint32_t db_id;
+  uint32_t status;            /*> enum connection_status */
+  uint32_t listener;          /*> CONN_SYN_WAIT: listener record index */
+  uint32_t remote_seq;
+  uint32_t local_seq;
+  uint32_t syn_ts;
+  uint32_t flow_id;           /*> 0 if not in the flow table */
+  uint32_t flags;             /*> enum nicif_connection_flags */
+  uint32_t wscale;            /*> TCP_WSCALE() */
+  uint32_t eph_port;          /*> 1 if the local port is ephemeral */
+  struct sp_ckpt_mem rx;
+  struct sp_ckpt_mem tx;
+
+  uint32_t cc_rtt;
+  uint32_t cc_last_ackb;
+  uint32_t cc_last_ecnb;
+  uint32_t cc_last_rxb;
+  uint16_t cc_last_drops;
+  uint16_t cc_last_acks;
+  uint32_t cc_rate;
+  uint32_t cc_rexmits;
+  uint32_t rx_wnd;
+  uint64_t cc_total_drops;
+  uint64_t cc_total_ackb;
+  uint64_t cc_total_ecnb;
+  uint8_t cc[SP_CKPT_CC_BYTES];
+
+  uint32_t ka_idle;
+  uint32_t ka_intvl;
+  uint32_t ka_cnt;
+};
+
+/** TIME_WAIT entry that had not expired yet */
+PACKED_STRUCT(sp_ckpt_tw)
+{
+  uint64_t remote_mac;
+  uint32_t remote_ip;
+  uint16_t local_port;
+  uint16_t remote_port;
+  uint32_t local_seq;
+  uint32_t remote_seq;
+  uint32_t remaining;         /*> us until the entry expires */
+  uint32_t __pad;
+};
+
+/** Resolved ARP cache entry */
+PACKED_STRUCT(sp_ckpt_arp)
+{
+  uint64_t mac;
+  uint32_t ip;
+  uint32_t __pad;
+};
+
+#endif /* SP_CHECKPOINT_H_ */
@@ -0,0 +1,174 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+#ifndef SP_STATS_H_
+#define SP_STATS_H_
+
+#include <stdint.h>
+
+#include "common.h"
+
+/**
+ * Layout of the telemetry shared memory region (#FLEXNIC_NAME_STATS).
+ *
+ * The slowpath is the only writer and refreshes the whole region
+ * periodically. Readers map it read-only and use the sequence counter in the
+ * header like a seqlock: wait for an even value, copy the region, and retry
+ * if the counter changed in the meantime. Readers must check magic and
+ * version before interpreting anything past the header.
+ */
+
+#define SP_STATS_MAGIC          0x5354415445544f46ULL  /*> "FOTETATS" */
+#define SP_STATS_VERSION        7
+
+#define SP_STATS_FLOWGRPS       4     /*> Flow groups (RSS buckets) */
+#define SP_STATS_CTXS           FLEXNIC_PL_APPCTX_NUM
+#define SP_STATS_CONNS          1024  /*> Connections exported per snapshot */
+#define SP_STATS_FP_NUM         64    /*> Fastpath counter slots */
+#define SP_STATS_NAME_LEN       32
+#define SP_STATS_HIST_BUCKETS   24    /*> log2 buckets: [0,1], (1,2], (2,4].. */
+#define SP_STATS_NODES          8     /*> NUMA nodes of packet memory */
+
+#define SP_STATS_FLAG_FP_STATS  (1 << 0)  /*> Detailed fastpath counters */
+#define SP_STATS_FLAG_FP_PROF   (1 << 1)  /*> Fastpath profiling compiled in */
+
+/** log2 histogram, bucket i counts values v with 2^(i-1) < v <= 2^i */
+PACKED_STRUCT(sp_stats_hist)
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t buckets[SP_STATS_HIST_BUCKETS];
+};
+
+/** Slowpath counters (monotonic unless noted) */
+PACKED_STRUCT(sp_stats_global)
+{
+  uint64_t drops;             /*> drops detected by the fastpath */
+  uint64_t sp_rexmit;         /*> slowpath retransmission timeouts */
+  uint64_t sp_tlp;            /*> slowpath tail loss probes */
+  uint64_t ka_probes;         /*> keepalive probes sent */
+  uint64_t ka_resets;         /*> connections reset as dead or idle */
+  uint64_t ecn_marked;        /*> ECN marked bytes acked */
+  uint64_t acks;              /*> bytes acked */
+  uint64_t conn_opened;       /*> connections established */
+  uint64_t conn_closed;       /*> connections closed */
+  uint64_t conn_failed;       /*> connection attempts that failed */
+  uint64_t rx_packets;        /*> packets received from the fastpath */
+  uint64_t rx_unhandled;      /*> packets the slowpath could not process */
+  uint64_t conns;             /*> gauge: connections known to cc */
+  uint64_t apps;              /*> gauge: attached applications */
+};
+
+/** Per flow group (RSS bucket) */
+PACKED_STRUCT(sp_stats_flowgrp)
+{
+  uint64_t rx_packets;        /*> packets received from the fastpath */
+  uint64_t fp_packets;        /*> packets received by the fastpath */
+  uint32_t conns;             /*> gauge: connections in the flow group */
+  uint32_t __pad;
+};
+
+/**
+ * Named fastpath counter: the always-on ones (fp_mem.h) first, then pipeline
+ * stage, DMA and queue manager counters of FP_STAT_ENABLE builds.
+ */
+PACKED_STRUCT(sp_stats_fp)
+{
+  char name[SP_STATS_NAME_LEN];
+  uint64_t value;
+  uint64_t cycles;            /*> profiling sections only */
+};
+
+/** Packet memory per NUMA node */
+PACKED_STRUCT(sp_stats_node)
+{
+  uint64_t size;              /*> bytes of packet memory on the node */
+  uint64_t used;              /*> gauge: bytes allocated */
+  uint64_t allocs;            /*> allocations placed on the node */
+  uint64_t spills;            /*> allocations for the node placed elsewhere */
+  uint32_t zones;             /*> hugepages */
+  uint32_t ctxs;              /*> gauge: contexts on the node */
+};
+
+/** Per application context */
+PACKED_STRUCT(sp_stats_ctx)
+{
+  uint16_t app_id;
+  uint16_t db_id;
+  uint32_t conns;             /*> connections owned by the app */
+  uint32_t txq_depth;         /*> app -> NIC descriptors pending */
+  uint32_t rxq_depth;         /*> NIC -> app descriptors pending */
+  uint32_t txq_len;
+  uint32_t rxq_len;
+  uint32_t numa_node;         /*> node its buffers are allocated on */
+};
+
+/** Per connection */
+PACKED_STRUCT(sp_stats_conn)
+{
+  uint32_t flow_id;
+  uint32_t local_ip;
+  uint32_t remote_ip;
+  uint16_t local_port;
+  uint16_t remote_port;
+  uint16_t flow_group;
+  uint16_t db_id;
+  uint32_t status;
+  uint32_t rtt;               /*> us */
+  uint32_t rate;              /*> kbps */
+  uint32_t rexmits;           /*> slowpath retransmissions */
+  uint64_t drops;
+  uint64_t ackb;
+  uint64_t ecnb;
+};
+
+PACKED_STRUCT(sp_stats_hdr)
+{
+  uint64_t magic;
+  uint32_t version;
+  uint32_t size;              /*> size of the region in bytes */
+  volatile uint64_t seq;      /*> odd while an update is in progress */
+  uint64_t ts_us;             /*> slowpath time of last update */
+  uint32_t interval_us;       /*> update interval */
+  uint32_t flags;             /*> see SP_STATS_FLAG_* */
+  uint32_t num_fp;
+  uint32_t num_ctxs;
+  uint32_t num_conns;
+  uint32_t num_conns_total;   /*> connections, incl. ones not exported */
+  uint32_t num_nodes;
+  uint32_t nic_node;          /*> node for buffers without a context */
+  uint32_t shm_us;            /*> startup: shared memory set up */
+  uint32_t ready_us;          /*> startup: ready for applications */
+};
+
+PACKED_STRUCT(sp_stats)
+{
+  struct sp_stats_hdr hdr;
+  struct sp_stats_global sp;
+  struct sp_stats_flowgrp fgs[SP_STATS_FLOWGRPS];
+  struct sp_stats_hist rtt_hist;        /*> us, over open connections */
+  struct sp_stats_hist txq_hist;        /*> descriptors, over contexts */
+  struct sp_stats_fp fp[SP_STATS_FP_NUM];
+  struct sp_stats_node nodes[SP_STATS_NODES];
+  struct sp_stats_ctx ctxs[SP_STATS_CTXS];
+  struct sp_stats_conn conns[SP_STATS_CONNS];
+};
+
+static inline unsigned sp_stats_hist_bucket(uint64_t v)
+{
+  unsigned b = 0;
+
+  while (b < SP_STATS_HIST_BUCKETS - 1 && v > (1ULL << b)) {
+    b++;
+  }
+  return b;
+}
+
+static inline void sp_stats_hist_add(struct sp_stats_hist *h, uint64_t v)
+{
+  h->count++;
+  h->sum += v;
+  h->buckets[sp_stats_hist_bucket(v)]++;
+}
+
+#endif /* SP_STATS_H_ */
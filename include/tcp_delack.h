@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+#ifndef FLEXTOE_TCP_DELACK_H_
+#define FLEXTOE_TCP_DELACK_H_
+
+#include <stdint.h>
+#include "flow_state.h"
+#include "tcp_ooo.h"
+
+/**
+ * Delayed and coalesced ACKs
+ *
+ * The receive path ACKs every Nth in-order segment (flextcp_pl_config
+ * .delack_segs) and arms a timer in the queue manager for the first delayed
+ * one, which forces a bare ACK after delack_ts if nothing else acknowledged
+ * the data by then. Per flow two things are kept in the flags: the number of
+ * delayed segments (#FLEXNIC_PL_FLOWST_DACK_MASK) and the CE state of the
+ * last segment (#FLEXNIC_PL_FLOWST_RXCE). Any transmitted segment carries the
+ * current ACK and clears the count.
+ *
+ * Segments that do not just extend the in-order data (out-of-order data,
+ * duplicates, filled holes, FIN) and segments arriving with little receive
+ * buffer left are ACKed immediately.
+ *
+ * DCTCP counts all bytes covered by an ACK with ECE as marked, so an ACK must
+ * only cover segments with the same CE state (RFC 8257, 3.2): when the CE
+ * state changes with segments pending, the ACK covers just the delayed
+ * segments and echoes their state, and the new segment starts the next
+ * batch. Only an immediate ACK coinciding with a CE change covers both.
+ *
+ * tcp_delack_model replays the receive side and the sender's byte counters on
+ * the host, with the clock supplied by the caller.
+ */
+
+#define TCP_DELACK_SEGS_MAX   FLEXNIC_PL_FLOWST_DACK_MASK
+#define TCP_DELACK_BITS       (FLEXNIC_PL_FLOWST_RXCE | \
+    (FLEXNIC_PL_FLOWST_DACK_MASK << FLEXNIC_PL_FLOWST_DACK_SHIFT))
+#define TCP_DELACK_PENDING(_FL) \
+    (((_FL) >> FLEXNIC_PL_FLOWST_DACK_SHIFT) & FLEXNIC_PL_FLOWST_DACK_MASK)
+
+/* Segment properties for tcp_delack_rx() */
+#define TCP_DELACK_IN_ORDER   (1 << 0)    /*> Segment advanced rx_next_seq */
+#define TCP_DELACK_URGENT     (1 << 1)    /*> Needs an immediate ACK */
+
+/* Actions returned by tcp_delack_rx(), 0: ACK everything now */
+#define TCP_DELACK_DELAY      (1 << 0)    /*> Do not ACK this segment */
+#define TCP_DELACK_ARM        (1 << 1)    /*> First delayed segment: arm timer */
+#define TCP_DELACK_PREV       (1 << 2)    /*> ACK only data before the segment */
+#define TCP_DELACK_ECE        (1 << 3)    /*> Set ECE on the ACK */
+
+/**
+ * Decide how to acknowledge a received segment.
+ *
+ * @param fs_flags  Flow flags
+ * @param ce        Segment was CE marked
+ * @param seg       TCP_DELACK_IN_ORDER, TCP_DELACK_URGENT
+ * @param segs      Policy: ACK every @p segs segments, <= 1 disables delaying
+ * @param act       Output: TCP_DELACK_* actions
+ *
+ * @return Updated flow flags.
+ */
+TCP_OOO_FN uint32_t tcp_delack_rx(uint32_t fs_flags, uint32_t ce,
+    uint32_t seg, uint32_t segs, uint32_t *act)
+{
+  uint32_t pending, ce_prev;
+
+  pending = TCP_DELACK_PENDING(fs_flags);
+  ce_prev = ((fs_flags & FLEXNIC_PL_FLOWST_RXCE) != 0);
+  ce = (ce != 0);
+  fs_flags &= ~TCP_DELACK_BITS;
+  if (ce) {
+    fs_flags |= FLEXNIC_PL_FLOWST_RXCE;
+  }
+
+  if ((seg & TCP_DELACK_IN_ORDER) == 0) {
+    /* only delayed data is newly acknowledged, echo its state */
+    *act = ((pending != 0 ? ce_prev : ce) ? TCP_DELACK_ECE : 0);
+    return fs_flags;
+  }
+
+  if (segs <= 1 || (seg & TCP_DELACK_URGENT) != 0) {
+    *act = (ce ? TCP_DELACK_ECE : 0);
+    return fs_flags;
+  }
+
+  if (pending != 0 && ce != ce_prev) {
+    /* CE state changed: ACK the delayed segments only, this one starts the
+     * next batch (the timer is still armed) */
+    *act = TCP_DELACK_PREV | (ce_prev ? TCP_DELACK_ECE : 0);
+    return fs_flags | (1 << FLEXNIC_PL_FLOWST_DACK_SHIFT);
+  }
+
+  if (pending + 1 >= segs) {
+    *act = (ce ? TCP_DELACK_ECE : 0);
+    return fs_flags;
+  }
+
+  *act = TCP_DELACK_DELAY | (pending == 0 ? TCP_DELACK_ARM : 0);
+  return fs_flags | ((pending + 1) << FLEXNIC_PL_FLOWST_DACK_SHIFT);
+}
+
+/** A segment carrying the current ACK is sent: nothing is pending anymore */
+TCP_OOO_FN uint32_t tcp_delack_sent(uint32_t fs_flags)
+{
+  return fs_flags &
+      ~(FLEXNIC_PL_FLOWST_DACK_MASK << FLEXNIC_PL_FLOWST_DACK_SHIFT);
+}
+
+/** Mark an ACK as owed, so a forced transmission is not suppressed */
+TCP_OOO_FN uint32_t tcp_delack_owe(uint32_t fs_flags)
+{
+  if (TCP_DELACK_PENDING(fs_flags) != 0) {
+    return fs_flags;
+  }
+  return fs_flags | (1 << FLEXNIC_PL_FLOWST_DACK_SHIFT);
+}
+
+#if !FIRMWARE
+/** Receiver and DCTCP sender accounting touched by the host model */
+struct tcp_delack_model {
+  uint32_t flags;                 /*> Flow flags */
+  uint32_t segs;                  /*> Policy: segments per ACK */
+  uint32_t timeout;               /*> Policy: timer, in caller clock units */
+  uint32_t deadline;              /*> Timer deadline */
+  int armed;                      /*> Timer armed */
+
+  uint32_t rcv_nxt;               /*> rx_next_seq */
+  uint32_t acked;                 /*> Highest ACK sent */
+
+  uint64_t segments;              /*> Segments received */
+  uint64_t acks;                  /*> ACKs sent */
+  uint64_t ce_bytes;              /*> Bytes received with CE */
+  uint64_t ack_bytes;             /*> Bytes newly ACKed (cnt_rx_ack_bytes) */
+  uint64_t ecn_bytes;             /*> Bytes ACKed with ECE (cnt_rx_ecn_bytes) */
+};
+
+static inline void tcp_delack_model_ack(struct tcp_delack_model *m,
+    uint32_t ack, int ece)
+{
+  uint32_t bump = ack - m->acked;
+
+  m->acks++;
+  m->ack_bytes += bump;
+  if (ece) {
+    m->ecn_bytes += bump;
+  }
+  m->acked = ack;
+}
+
+/**
+ * Host model of an in-order segment in flows_seg(). Pending timers must be
+ * run with tcp_delack_model_timer() first.
+ *
+ * @param m       Model state
+ * @param now     Current time
+ * @param len     Payload length
+ * @param ce      Segment was CE marked
+ * @param urgent  Segment needs an immediate ACK
+ */
+static inline void tcp_delack_model_seg(struct tcp_delack_model *m,
+    uint32_t now, uint32_t len, int ce, int urgent)
+{
+  uint32_t act;
+
+  m->segments++;
+  if (ce) {
+    m->ce_bytes += len;
+  }
+  m->rcv_nxt += len;
+
+  m->flags = tcp_delack_rx(m->flags, ce, TCP_DELACK_IN_ORDER |
+      (urgent ? TCP_DELACK_URGENT : 0), m->segs, &act);
+  if ((act & TCP_DELACK_DELAY) != 0) {
+    if ((act & TCP_DELACK_ARM) != 0) {
+      m->armed = 1;
+      m->deadline = now + m->timeout;
+    }
+    return;
+  }
+
+  tcp_delack_model_ack(m, (act & TCP_DELACK_PREV) != 0 ?
+      m->rcv_nxt - len : m->rcv_nxt, (act & TCP_DELACK_ECE) != 0);
+}
+
+/** Host model of the timer forcing flows_tx() to send a bare ACK */
+static inline void tcp_delack_model_timer(struct tcp_delack_model *m,
+    uint32_t now)
+{
+  if (!m->armed || (int32_t) (now - m->deadline) < 0) {
+    return;
+  }
+  m->armed = 0;
+  if (TCP_DELACK_PENDING(m->flags) == 0) {
+    return;
+  }
+  tcp_delack_model_ack(m, m->rcv_nxt,
+      (m->flags & FLEXNIC_PL_FLOWST_RXCE) != 0);
+  m->flags = tcp_delack_sent(m->flags);
+}
+#endif /* !FIRMWARE */
+
+#endif /* FLEXTOE_TCP_DELACK_H_ */
@@ -0,0 +1,253 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+#ifndef FLEXTOE_TCP_OOO_H_
+#define FLEXTOE_TCP_OOO_H_
+
+#include <stdint.h>
+#include "flow_state.h"
+
+/**
+ * Out-of-order receive intervals
+ *
+ * Each flow keeps up to #FLEXNIC_PL_OOO_NUM intervals of data received beyond
+ * rx_next_seq (flowst_tcp_t.rx_ooo). An interval is one word: offset from
+ * rx_next_seq in the upper 16 bits, length in the lower 16 bits, 0 if unused.
+ * Offsets are relative, so they have to be rebased whenever rx_next_seq
+ * advances (tcp_ooo_advance()). Offsets are 16 bits: with window scaling
+ * (tcp_wscale.h) segments ending more than 64KB past rx_next_seq are not
+ * recorded.
+ *
+ * Invariants: used intervals come first, sorted by offset, non-empty, with
+ * offset > 0, and neither overlap nor touch each other. In particular
+ * rx_ooo[0] == 0 iff there is no out-of-order data.
+ *
+ * The same code runs in the fastpath (flows_seg()) and on the host, where
+ * tcp_ooo_rx() models the receive side of flows_seg().
+ */
+
+#define TCP_OOO_NUM           FLEXNIC_PL_OOO_NUM
+#define TCP_OOO_MAX           0xFFFF    /*> Max end offset of an interval */
+
+#define TCP_OOO_OFF(_IV)      ((_IV) >> 16)
+#define TCP_OOO_LEN(_IV)      ((_IV) & 0xFFFF)
+#define TCP_OOO_END(_IV)      (TCP_OOO_OFF(_IV) + TCP_OOO_LEN(_IV))
+#define TCP_OOO_IV(_OFF, _LEN)  (((_OFF) << 16) | (_LEN))
+
+#if FIRMWARE
+  #define TCP_OOO_FN          __intrinsic static
+  #define TCP_OOO_MEM         __lmem
+#else
+  #define TCP_OOO_FN          static inline
+  #define TCP_OOO_MEM
+#endif
+
+/**
+ * Add a segment to the interval set, merging it with all intervals it
+ * overlaps or touches. If the set is full, the interval furthest from
+ * rx_next_seq is evicted in favour of a closer one.
+ *
+ * @param iv  Interval set
+ * @param off Offset of the segment from rx_next_seq (> 0)
+ * @param len Segment length
+ *
+ * @return Index of the interval containing the segment, or -1 if the segment
+ *         was not recorded (and must be dropped).
+ */
+TCP_OOO_FN int tcp_ooo_insert(TCP_OOO_MEM uint32_t *iv, uint32_t off,
+    uint32_t len)
+{
+  uint32_t start, end, i, j, merged;
+
+  start = off;
+  end = off + len;
+  if (len == 0 || off == 0 || end > TCP_OOO_MAX) {
+    return -1;
+  }
+
+  /* skip intervals ending strictly before the segment */
+  for (i = 0; i < TCP_OOO_NUM && iv[i] != 0 && TCP_OOO_END(iv[i]) < start;
+      i++);
+
+  /* absorb all intervals overlapping or touching the segment */
+  for (j = i; j < TCP_OOO_NUM && iv[j] != 0 && TCP_OOO_OFF(iv[j]) <= end;
+      j++)
+  {
+    if (TCP_OOO_OFF(iv[j]) < start) {
+      start = TCP_OOO_OFF(iv[j]);
+    }
+    if (TCP_OOO_END(iv[j]) > end) {
+      end = TCP_OOO_END(iv[j]);
+    }
+  }
+  merged = j - i;
+
+  if (merged == 0) {
+    /* new interval: drop it if it would be the one evicted */
+    if (i == TCP_OOO_NUM) {
+      return -1;
+    }
+    for (j = TCP_OOO_NUM - 1; j > i; j--) {
+      iv[j] = iv[j - 1];
+    }
+    iv[i] = TCP_OOO_IV(start, end - start);
+    return i;
+  }
+
+  /* close the gap left by absorbed intervals */
+  iv[i] = TCP_OOO_IV(start, end - start);
+  for (j = i + 1; j < TCP_OOO_NUM; j++) {
+    iv[j] = (j + merged - 1 < TCP_OOO_NUM ? iv[j + merged - 1] : 0);
+  }
+  return i;
+}
+
+/**
+ * Rebase intervals after rx_next_seq advanced by @p bump in-order bytes.
+ * Intervals covered by the new data are trimmed or dropped. If the first
+ * interval becomes continuous with rx_next_seq it is removed as well and its
+ * length returned; the caller has to advance rx_next_seq by it.
+ *
+ * @param iv   Interval set
+ * @param bump Bytes rx_next_seq advanced by
+ *
+ * @return Additional bytes that are now in order.
+ */
+TCP_OOO_FN uint32_t tcp_ooo_advance(TCP_OOO_MEM uint32_t *iv, uint32_t bump)
+{
+  uint32_t i, n, off, end, deliver;
+
+  n = 0;
+  for (i = 0; i < TCP_OOO_NUM && iv[i] != 0; i++) {
+    off = TCP_OOO_OFF(iv[i]);
+    end = TCP_OOO_END(iv[i]);
+    if (end <= bump) {
+      continue;
+    }
+    off = (off > bump ? off - bump : 0);
+    iv[n++] = TCP_OOO_IV(off, end - bump - off);
+  }
+  for (i = n; i < TCP_OOO_NUM; i++) {
+    iv[i] = 0;
+  }
+
+  if (n == 0 || TCP_OOO_OFF(iv[0]) != 0) {
+    return 0;
+  }
+
+  /* first interval caught up: deliver it, rebase the rest */
+  deliver = TCP_OOO_LEN(iv[0]);
+  for (i = 0; i < TCP_OOO_NUM - 1; i++) {
+    iv[i] = (iv[i + 1] != 0 ?
+        TCP_OOO_IV(TCP_OOO_OFF(iv[i + 1]) - deliver, TCP_OOO_LEN(iv[i + 1])) :
+        0);
+  }
+  iv[TCP_OOO_NUM - 1] = 0;
+  return deliver;
+}
+
+#if !FIRMWARE
+/**
+ * Collect SACK blocks (RFC 2018) for the interval set: the interval with
+ * index @p recent first (the one containing the most recent segment), the
+ * remaining ones in sequence order.
+ *
+ * @param iv       Interval set
+ * @param recent   Index of most recently updated interval, or -1
+ * @param ack      Current rx_next_seq
+ * @param edges    Output: left/right edge pairs
+ * @param max      Maximum number of blocks
+ *
+ * @return Number of blocks written.
+ */
+static inline unsigned tcp_ooo_sack_blocks(const uint32_t *iv, int recent,
+    uint32_t ack, uint32_t *edges, unsigned max)
+{
+  unsigned i, n = 0;
+
+  if (recent >= 0 && recent < TCP_OOO_NUM && iv[recent] != 0 && n < max) {
+    edges[2 * n] = ack + TCP_OOO_OFF(iv[recent]);
+    edges[2 * n + 1] = ack + TCP_OOO_END(iv[recent]);
+    n++;
+  }
+  for (i = 0; i < TCP_OOO_NUM && iv[i] != 0 && n < max; i++) {
+    if ((int) i == recent) {
+      continue;
+    }
+    edges[2 * n] = ack + TCP_OOO_OFF(iv[i]);
+    edges[2 * n + 1] = ack + TCP_OOO_END(iv[i]);
+    n++;
+  }
+  return n;
+}
+
+/** Receive state touched by the host model of flows_seg() */
+struct tcp_ooo_rxstate {
+  uint32_t next_seq;              /*> rx_next_seq */
+  uint32_t avail;                 /*> rx_avail */
+  uint32_t iv[TCP_OOO_NUM];       /*> rx_ooo */
+};
+
+/**
+ * Host model of the payload handling in flows_seg(): trim the segment to the
+ * receive window, place it in order or in the interval set, and advance
+ * rx_next_seq. The application freeing buffer space (rx_avail += n) is up to
+ * the caller.
+ *
+ * @param st        Receive state
+ * @param seq       Segment sequence number
+ * @param len       Segment payload length
+ * @param sack_slot Output: interval to report in a SACK block, or -1
+ *
+ * @return Bytes that became available in order (rx_bump).
+ */
+static inline uint32_t tcp_ooo_rx(struct tcp_ooo_rxstate *st, uint32_t seq,
+    uint32_t len, int *sack_slot)
+{
+  uint32_t trim, trim_start, trim_end, bump;
+
+  *sack_slot = -1;
+
+  /* tcp_trim_rxbuf() */
+  trim = st->next_seq - seq;
+  if (trim <= len) {
+    trim_start = trim;
+    trim = len - trim;
+    trim_end = (trim <= st->avail ? 0 : trim - st->avail);
+  } else {
+    trim = -trim;
+    if (trim >= st->avail) {
+      return 0;
+    }
+    trim_start = 0;
+    trim_end = (st->avail - trim >= len ? 0 : len - (st->avail - trim));
+  }
+  len -= trim_start + trim_end;
+  seq += trim_start;
+
+  if (seq != st->next_seq) {
+    if (len != 0) {
+      *sack_slot = tcp_ooo_insert(st->iv, seq - st->next_seq, len);
+    }
+    return 0;
+  }
+  if (len == 0) {
+    return 0;
+  }
+
+  st->avail -= len;
+  st->next_seq += len;
+  bump = len;
+
+  if (st->iv[0] != 0) {
+    len = tcp_ooo_advance(st->iv, len);
+    st->avail -= len;
+    st->next_seq += len;
+    bump += len;
+    *sack_slot = (st->iv[0] != 0 ? 0 : -1);
+  }
+  return bump;
+}
+#endif /* !FIRMWARE */
+
+#endif /* FLEXTOE_TCP_OOO_H_ */
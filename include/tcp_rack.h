@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+#ifndef FLEXTOE_TCP_RACK_H_
+#define FLEXTOE_TCP_RACK_H_
+
+#include <stdint.h>
+
+/**
+ * Time-based loss detection (RACK, RFC 8985)
+ *
+ * There is no room for per-segment send times in the flow state, so the
+ * fastpath tracks a single 16-bit value (flowst_tcp_t.rack_ts) in a coarse
+ * clock derived from the TS option clock (TCP_RACK_TS()):
+ *
+ *  - with data in flight (tx_sent != 0): the time after which snd_una is
+ *    considered lost if the peer reports later data as delivered,
+ *  - otherwise: the RACK window (RTT plus reordering window) to arm the
+ *    deadline with when the next segment is sent, 0 if unknown.
+ *
+ * The send time of snd_una is approximated by the TS echoed in the ACK that
+ * made it snd_una, i.e. the send time of the segment right before it.
+ *
+ * Tails that do not produce ACKs are covered by tail loss probes, which the
+ * slowpath issues after two RTTs without progress, well before the
+ * retransmission timeout.
+ */
+
+#define TCP_RACK_TS_SHIFT     9       /*> RACK clock: TS clock >> 9 */
+#define TCP_RACK_TS(_TS)      (((_TS) >> TCP_RACK_TS_SHIFT) & 0xFFFF)
+#define TCP_RACK_WND_INIT     16      /*> Window before the first RTT sample */
+#define TCP_RACK_WND_MIN      2       /*> Lower bound for the window */
+#define TCP_RACK_WND_MAX      0x3FFF  /*> Keep deadlines within half the range */
+
+#if FIRMWARE
+  #define TCP_RACK_FN         __intrinsic static
+#else
+  #define TCP_RACK_FN         static inline
+#endif
+
+/** RACK window for an RTT sample: RTT plus RTT/4 reordering window */
+TCP_RACK_FN uint32_t tcp_rack_wnd(uint32_t now, uint32_t ts_ecr)
+{
+  uint32_t rtt, wnd;
+
+  if (ts_ecr == 0) {
+    return TCP_RACK_WND_INIT;
+  }
+
+  rtt = (TCP_RACK_TS(now) - TCP_RACK_TS(ts_ecr)) & 0xFFFF;
+  wnd = rtt + (rtt >> 2);
+  if (wnd < TCP_RACK_WND_MIN) {
+    wnd = TCP_RACK_WND_MIN;
+  }
+  if (wnd > TCP_RACK_WND_MAX) {
+    wnd = TCP_RACK_WND_MAX;
+  }
+  return wnd;
+}
+
+/**
+ * State after an ACK advanced snd_una.
+ *
+ * @param now     Current TS clock
+ * @param ts_ecr  TS echoed by the ACK, 0 if none
+ * @param sent    tx_sent after the ACK
+ *
+ * @return New rack_ts.
+ */
+TCP_RACK_FN uint32_t tcp_rack_ack(uint32_t now, uint32_t ts_ecr, uint32_t sent)
+{
+  uint32_t wnd = tcp_rack_wnd(now, ts_ecr);
+
+  if (sent == 0) {
+    return wnd;
+  }
+  if (ts_ecr == 0) {
+    ts_ecr = now;
+  }
+  return (TCP_RACK_TS(ts_ecr) + wnd) & 0xFFFF;
+}
+
+/** Arm the deadline when sending into an empty pipe */
+TCP_RACK_FN uint32_t tcp_rack_arm(uint32_t now, uint32_t rack)
+{
+  if (rack == 0) {
+    rack = TCP_RACK_WND_INIT;
+  }
+  return (TCP_RACK_TS(now) + rack) & 0xFFFF;
+}
+
+/** Has the deadline @p rack passed? */
+TCP_RACK_FN int tcp_rack_expired(uint32_t now, uint32_t rack)
+{
+  return ((TCP_RACK_TS(now) - rack) & 0x8000) == 0;
+}
+
+#endif /* FLEXTOE_TCP_RACK_H_ */
@@ -0,0 +1,227 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+#ifndef FLEXTOE_TCP_RXWND_H_
+#define FLEXTOE_TCP_RXWND_H_
+
+#include <stdint.h>
+#include "flow_state.h"
+#include "tcp_ooo.h"
+
+/**
+ * Receive window autotuning
+ *
+ * The receive buffer is mapped by the application, so its size is fixed when
+ * the connection is set up. What the slowpath tunes instead is how much of it
+ * the fastpath may advertise: a connection starts with rx_avail set to the
+ * window W instead of the buffer length, and the remaining reserve is never
+ * handed out. Growing W adds to rx_avail right away.
+ *
+ * Shrinking W must not retract a window already advertised, so it is lazy:
+ * the fastpath records the reduction as debt in the window word
+ * (flowst_tcp_t.wnd, in units of #TCP_RXWND_QUANTUM) and withholds whole
+ * quanta from the buffer space the application frees later.
+ * Growing cancels debt first. Per flow this keeps
+ *
+ *    rx_avail + unread bytes - debt * TCP_RXWND_QUANTUM == W
+ *
+ * Debt never exceeds the range W can shrink by, which fits the 16 bits as W
+ * is at most #TCP_RXWND_MAX. Freed space is only returned to the fastpath in
+ * batches of more than a quarter of the buffer (see
+ * flextcp_connection_rx_done()), so W must stay above that and bumps pay at
+ * least one quantum each, except for small ones sent along with TX bumps.
+ *
+ * The policy follows Linux DRS: per control interval the slowpath measures
+ * the in-order bytes received per RTT, grows the window to twice that at once,
+ * and lets it decay towards the target when the flow uses less than half of
+ * it. The sum of all windows is bounded by a global budget. tcp_rxwnd_model
+ * replays the fastpath side on the host.
+ *
+ * Flows that negotiated window scaling (tcp_wscale.h) grow up to the whole
+ * buffer (at most #TCP_RXWND_MAX), the others stop at 64KB, the largest
+ * unscaled window field.
+ * flextoe-tcpsim's rxwnd scenario compares fixed unscaled windows with tuned
+ * scaled ones.
+ */
+
+#define TCP_RXWND_SHIFT       10
+#define TCP_RXWND_QUANTUM     (1 << TCP_RXWND_SHIFT)
+#define TCP_RXWND_MAX_NOWS    (64 * TCP_RXWND_QUANTUM)  /*> Without window scaling */
+#define TCP_RXWND_DEBT_MAX    FLEXNIC_PL_FLOWST_RXWND_MASK
+#define TCP_RXWND_MAX         (TCP_RXWND_DEBT_MAX * TCP_RXWND_QUANTUM)
+#define TCP_RXWND_DEBT(_WND) \
+    (((_WND) >> FLEXNIC_PL_FLOWST_RXWND_SHIFT) & FLEXNIC_PL_FLOWST_RXWND_MASK)
+#define TCP_RXWND_SET(_WND, _DEBT) \
+    (((_WND) & ~(FLEXNIC_PL_FLOWST_RXWND_MASK << FLEXNIC_PL_FLOWST_RXWND_SHIFT)) \
+     | ((_DEBT) << FLEXNIC_PL_FLOWST_RXWND_SHIFT))
+
+/**
+ * Apply a window change from the slowpath.
+ *
+ * @param wnd       Window word
+ * @param delta     Change in quanta, < 0 shrinks
+ * @param grow      Output: bytes to add to rx_avail
+ *
+ * @return Updated window word.
+ */
+TCP_OOO_FN uint32_t tcp_rxwnd_adjust(uint32_t wnd, int32_t delta,
+    uint32_t *grow)
+{
+  uint32_t debt = TCP_RXWND_DEBT(wnd);
+
+  if (delta < 0) {
+    debt += -delta;
+    if (debt > TCP_RXWND_DEBT_MAX) {
+      debt = TCP_RXWND_DEBT_MAX;
+    }
+    *grow = 0;
+  } else if (debt >= (uint32_t) delta) {
+    debt -= delta;
+    *grow = 0;
+  } else {
+    *grow = ((uint32_t) delta - debt) << TCP_RXWND_SHIFT;
+    debt = 0;
+  }
+  return TCP_RXWND_SET(wnd, debt);
+}
+
+/**
+ * Pay off debt from buffer space freed by the application.
+ *
+ * @param wnd       Window word
+ * @param rx_bump   In: freed bytes, out: bytes to add to rx_avail
+ *
+ * @return Updated window word.
+ */
+TCP_OOO_FN uint32_t tcp_rxwnd_pay(uint32_t wnd, uint32_t *rx_bump)
+{
+  uint32_t debt, n;
+
+  debt = TCP_RXWND_DEBT(wnd);
+  if (debt == 0) {
+    return wnd;
+  }
+
+  n = *rx_bump >> TCP_RXWND_SHIFT;
+  if (n > debt) {
+    n = debt;
+  }
+  *rx_bump -= n << TCP_RXWND_SHIFT;
+  return TCP_RXWND_SET(wnd, debt - n);
+}
+
+#if !FIRMWARE
+/**
+ * Window for the next control interval.
+ *
+ * @param wnd       Current window
+ * @param rx_bytes  In-order bytes received during the interval
+ * @param interval  Length of the interval
+ * @param rtt       RTT estimate, same unit as @p interval
+ * @param wnd_min   Lower bound, multiple of #TCP_RXWND_QUANTUM
+ * @param wnd_max   Upper bound, multiple of #TCP_RXWND_QUANTUM
+ *
+ * @return New window, multiple of #TCP_RXWND_QUANTUM.
+ */
+static inline uint32_t tcp_rxwnd_tune(uint32_t wnd, uint32_t rx_bytes,
+    uint32_t interval, uint32_t rtt, uint32_t wnd_min, uint32_t wnd_max)
+{
+  uint64_t target;
+  uint32_t decay;
+
+  if (interval == 0) {
+    return wnd;
+  }
+
+  /* twice the bytes received per RTT, so the sender is never window limited
+   * while the application keeps up */
+  target = 2 * ((uint64_t) rx_bytes * rtt / interval);
+  target = (target + TCP_RXWND_QUANTUM - 1) &
+      ~(uint64_t) (TCP_RXWND_QUANTUM - 1);
+  if (target < wnd_min) {
+    target = wnd_min;
+  }
+  if (target > wnd_max) {
+    target = wnd_max;
+  }
+
+  if (target >= wnd) {
+    return target;
+  }
+  if (target >= wnd / 2) {
+    return wnd;
+  }
+
+  /* release half the excess, but at least one quantum */
+  decay = ((wnd - target) / 2) & ~(TCP_RXWND_QUANTUM - 1);
+  if (decay == 0) {
+    decay = TCP_RXWND_QUANTUM;
+  }
+  return wnd - decay;
+}
+
+/** Receive side of a flow in the fastpath, as touched by autotuning */
+struct tcp_rxwnd_model {
+  uint32_t wnd;                   /*> Window word */
+  uint32_t avail;                 /*> rx_avail */
+  uint32_t unread;                /*> Bytes in the buffer not read yet */
+  uint32_t rx_bytes;              /*> cnt_rx_bytes */
+};
+
+static inline void tcp_rxwnd_model_init(struct tcp_rxwnd_model *m,
+    uint32_t wnd)
+{
+  m->wnd = 0;
+  m->avail = wnd;
+  m->unread = 0;
+  m->rx_bytes = 0;
+}
+
+/** Peer sends @p len bytes in order, returns the bytes accepted */
+static inline uint32_t tcp_rxwnd_model_rx(struct tcp_rxwnd_model *m,
+    uint32_t len)
+{
+  if (len > m->avail) {
+    len = m->avail;
+  }
+  m->avail -= len;
+  m->unread += len;
+  m->rx_bytes += len;
+  return len;
+}
+
+/** Application reads up to @p len bytes (flows_ac()), returns bytes read */
+static inline uint32_t tcp_rxwnd_model_read(struct tcp_rxwnd_model *m,
+    uint32_t len)
+{
+  uint32_t bump;
+
+  if (len > m->unread) {
+    len = m->unread;
+  }
+  m->unread -= len;
+  bump = len;
+  m->wnd = tcp_rxwnd_pay(m->wnd, &bump);
+  m->avail += bump;
+  return len;
+}
+
+/** Window change from the slowpath (flows_retx()) */
+static inline void tcp_rxwnd_model_adjust(struct tcp_rxwnd_model *m,
+    int32_t delta)
+{
+  uint32_t grow;
+
+  m->wnd = tcp_rxwnd_adjust(m->wnd, delta, &grow);
+  m->avail += grow;
+}
+
+/** Window the fastpath converges to, compare with the slowpath's */
+static inline uint32_t tcp_rxwnd_model_wnd(struct tcp_rxwnd_model *m)
+{
+  return m->avail + m->unread -
+      (TCP_RXWND_DEBT(m->wnd) << TCP_RXWND_SHIFT);
+}
+#endif /* !FIRMWARE */
+
+#endif /* FLEXTOE_TCP_RXWND_H_ */
@@ -0,0 +1,386 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+#ifndef FLEXTOE_TCP_SACK_H_
+#define FLEXTOE_TCP_SACK_H_
+
+#include <stdint.h>
+#include "tcp_ooo.h"
+#include "tcp_rack.h"
+
+/**
+ * Sender SACK scoreboard and selective recovery
+ *
+ * For flows with #FLEXNIC_PL_FLOWST_SACK the fastpath keeps two words of
+ * sender state, both relative to snd_una (tx_next_seq - tx_sent):
+ *
+ *  - tx_sack: the lowest block SACKed by the peer, in the interval encoding of
+ *    tcp_ooo.h (offset << 16 | length), 0 if none, #TCP_SACK_HOLES once the
+ *    peer reported a block separated from it by another hole.
+ *  - tx_rtx: recovery point (tx_sent when recovery started) in the upper 16
+ *    bits, next byte of the current hole to retransmit in the lower 16 bits,
+ *    0 if the flow is not in recovery.
+ *
+ * Once RACK (tcp_rack.h) declares snd_una lost the sender enters recovery
+ * and retransmits the hole below the first SACKed block instead of
+ * everything after snd_una. Each partial ACK then starts on the next hole,
+ * until snd_una passes the recovery point (NewReno-style). With
+ * #TCP_SACK_HOLES the recovery instead repairs everything up to the recovery
+ * point in one round trip, like go-back-N, but without giving up the recovery
+ * state: later duplicate ACKs do not start another one. Without usable SACK
+ * information, with more than 64KB in flight, and on timeouts the fastpath
+ * falls back to go-back-N. Tail loss probes use the same recovery state,
+ * starting with a single segment at snd_una.
+ *
+ * Limits of the two-word encoding:
+ *
+ *  - 64KB: offsets are 16 bits. Peers that negotiated window scaling
+ *    (tcp_wscale.h) can open more, larger flights fall back to go-back-N.
+ *  - One block: there is no room for more, so with a second hole the
+ *    recovery resends the SACKed data above the first one as well. Repairing
+ *    one hole per round trip would send less, but finishes later than
+ *    go-back-N for every window with more than one hole. flextoe-tcpsim's
+ *    loss scenario fails if SACK is slower than go-back-N for any scripted
+ *    pattern.
+ *
+ * tcp_sack_txstate and its functions model flows_ack()/flows_tx()/
+ * flows_retx() on the host, in both modes, so loss patterns can be replayed
+ * deterministically against either.
+ */
+
+#define TCP_SACK_REC(_RTX)        ((_RTX) >> 16)      /*> Recovery point */
+#define TCP_SACK_NXT(_RTX)        ((_RTX) & 0xFFFF)   /*> Next byte to repair */
+#define TCP_SACK_RTX(_REC, _NXT)  (((_REC) << 16) | (_NXT))
+
+/** Scoreboard: more than one hole, no block tracked (empty interval) */
+#define TCP_SACK_HOLES            TCP_OOO_IV(TCP_OOO_MAX, 0)
+
+/**
+ * ACKs with a SACK block carry the padded TS option first, like every
+ * fastpath segment, followed by one padded SACK block (RFC 2018, as Linux
+ * sends them). The receive path only takes segments that start with the
+ * padded TS option (validate_pkt_hdr()) and reads the block right after it
+ * (read_sack_block()). Option words as the NFP sees them (network order).
+ */
+#define TCP_SACK_OPT_TS         0x0101080A  /*> NOP, NOP, TS, 10 */
+#define TCP_SACK_OPT_SACK1      0x0101050A  /*> NOP, NOP, SACK, 10: one block */
+#define TCP_SACK_OPT_SACK       0x01010500  /*> NOP, NOP, SACK, any length */
+#define TCP_SACK_OPT_SACK_MASK  0xFFFFFF00
+#define TCP_SACK_OPT_NOP        0x01010101
+#define TCP_SACK_OPT_LEN1       10          /*> SACK option with one block */
+#define TCP_SACK_OPT_WORDS      3           /*> Padded TS or padded SACK1 */
+
+/**
+ * Merge a SACK block into the scoreboard. A block separated from the current
+ * one by a hole turns it into #TCP_SACK_HOLES, which stays until the caller
+ * drops it.
+ *
+ * @param sb    Scoreboard
+ * @param left  Left edge relative to snd_una
+ * @param right Right edge relative to snd_una
+ * @param sent  Bytes in flight (tx_sent)
+ *
+ * @return Updated scoreboard.
+ */
+TCP_OOO_FN uint32_t tcp_sack_update(uint32_t sb, uint32_t left,
+    uint32_t right, uint32_t sent)
+{
+  uint32_t start, end;
+
+  /* ignore D-SACKs, stale and bogus blocks */
+  if (left == 0 || right <= left || right > sent || right > TCP_OOO_MAX ||
+      sb == TCP_SACK_HOLES)
+  {
+    return sb;
+  }
+
+  if (sb == 0) {
+    return TCP_OOO_IV(left, right - left);
+  }
+  if (right < TCP_OOO_OFF(sb) || left > TCP_OOO_END(sb)) {
+    return TCP_SACK_HOLES;
+  }
+
+  start = TCP_OOO_OFF(sb);
+  end = TCP_OOO_END(sb);
+  if (left < start) {
+    start = left;
+  }
+  if (right > end) {
+    end = right;
+  }
+  return TCP_OOO_IV(start, end - start);
+}
+
+/**
+ * Rebase the scoreboard after snd_una advanced by @p bump bytes. A block
+ * reached by the cumulative ACK is dropped. #TCP_SACK_HOLES is kept while
+ * the flow is in recovery (@p rtx already rebased), outside of it the holes
+ * are unknown once snd_una moves.
+ */
+TCP_OOO_FN uint32_t tcp_sack_advance(uint32_t sb, uint32_t rtx,
+    uint32_t bump)
+{
+  if (sb == TCP_SACK_HOLES) {
+    return (rtx != 0 ? sb : 0);
+  }
+  if (sb == 0 || TCP_OOO_OFF(sb) <= bump) {
+    return 0;
+  }
+  return TCP_OOO_IV(TCP_OOO_OFF(sb) - bump, TCP_OOO_LEN(sb));
+}
+
+/**
+ * Rebase the recovery state after snd_una advanced by @p bump bytes.
+ *
+ * @return Updated state, 0 once the recovery point is acknowledged.
+ */
+TCP_OOO_FN uint32_t tcp_sack_rtx_advance(uint32_t rtx, uint32_t bump)
+{
+  uint32_t nxt;
+
+  if (rtx == 0 || TCP_SACK_REC(rtx) <= bump) {
+    return 0;
+  }
+  nxt = TCP_SACK_NXT(rtx);
+  nxt = (nxt > bump ? nxt - bump : 0);
+  return TCP_SACK_RTX(TCP_SACK_REC(rtx) - bump, nxt);
+}
+
+/**
+ * End of the hole being repaired, relative to snd_una. #TCP_SACK_HOLES never
+ * starts below the recovery point.
+ */
+TCP_OOO_FN uint32_t tcp_sack_hole_end(uint32_t sb, uint32_t rtx)
+{
+  uint32_t end = TCP_SACK_REC(rtx);
+
+  if (sb != 0 && TCP_OOO_OFF(sb) < end) {
+    end = TCP_OOO_OFF(sb);
+  }
+  return end;
+}
+
+#if !FIRMWARE
+/**
+ * Host model of the options prepare_ack_header() writes for an ACK: padded
+ * TS option, then a padded SACK block unless @p left == @p right.
+ *
+ * @return Number of option words written (TCP_SACK_OPT_WORDS or twice that).
+ */
+static inline unsigned tcp_sack_ack_opts(uint32_t *opts, uint32_t ts_val,
+    uint32_t ts_ecr, uint32_t left, uint32_t right)
+{
+  opts[0] = TCP_SACK_OPT_TS;
+  opts[1] = ts_val;
+  opts[2] = ts_ecr;
+  if (left == right) {
+    return TCP_SACK_OPT_WORDS;
+  }
+  opts[3] = TCP_SACK_OPT_SACK1;
+  opts[4] = left;
+  opts[5] = right;
+  return 2 * TCP_SACK_OPT_WORDS;
+}
+
+/**
+ * Host model of validate_pkt_hdr() and read_sack_block() for the options of
+ * a received segment. Without a SACK block @p left == @p right == 0.
+ *
+ * @return 0 if the fastpath processes the segment, -1 if it goes to the
+ *         slowpath.
+ */
+static inline int tcp_sack_rx_opts(const uint32_t *opts, unsigned n,
+    uint32_t *ts_ecr, uint32_t *left, uint32_t *right)
+{
+  *left = 0;
+  *right = 0;
+  if (n < TCP_SACK_OPT_WORDS || opts[0] != TCP_SACK_OPT_TS) {
+    return -1;
+  }
+  *ts_ecr = opts[2];
+
+  if (n >= 2 * TCP_SACK_OPT_WORDS &&
+      (opts[3] & TCP_SACK_OPT_SACK_MASK) == TCP_SACK_OPT_SACK &&
+      (opts[3] & 0xFF) >= TCP_SACK_OPT_LEN1)
+  {
+    *left = opts[4];
+    *right = opts[5];
+  }
+  return 0;
+}
+
+/** Sender state touched by the host model of flows_ack()/flows_tx() */
+struct tcp_sack_txstate {
+  uint32_t una;                   /*> tx_next_seq - tx_sent */
+  uint32_t sent;                  /*> tx_sent */
+  uint32_t sb;                    /*> tx_sack */
+  uint32_t rtx;                   /*> tx_rtx */
+  uint32_t rack;                  /*> rack_ts */
+  int sack;                       /*> FLEXNIC_PL_FLOWST_SACK, 0: go-back-N */
+
+  uint32_t high;                  /*> Highest sequence sent, start at una */
+  uint64_t rtx_bytes;             /*> Payload bytes sent more than once */
+  uint32_t recoveries;            /*> Fast recoveries started */
+  uint32_t probes;                /*> Tail loss probes sent */
+};
+
+static inline void tcp_sack_gbn(struct tcp_sack_txstate *st)
+{
+  st->sent = 0;
+  st->sb = 0;
+  st->rtx = 0;
+  st->rack = 0;
+}
+
+/**
+ * Host model of the ACK handling in flows_ack(). @p sack_left ==
+ * @p sack_right means the ACK carried no SACK block. Every ACK that does not
+ * advance snd_una while data is in flight counts as evidence of later data
+ * being delivered.
+ *
+ * @param st      Sender state
+ * @param now     Current TS clock
+ * @param ack     Cumulative ACK
+ * @param ts_ecr  TS echoed by the ACK
+ *
+ * @return Bytes scheduled for selective retransmission.
+ */
+static inline uint32_t tcp_sack_tx_ack(struct tcp_sack_txstate *st,
+    uint32_t now, uint32_t ack, uint32_t ts_ecr, uint32_t sack_left,
+    uint32_t sack_right)
+{
+  uint32_t bump, end, nxt;
+  int lost = 0;
+
+  /* ALLOW_FUTURE_ACKS: after go-back-N the peer acknowledges data that has
+   * not been resent yet */
+  bump = ack - st->una;
+  if (bump > st->high - st->una) {
+    return 0;
+  }
+
+  if (bump != 0) {
+    st->una += bump;
+    st->sent = (bump < st->sent ? st->sent - bump : 0);
+    st->rack = tcp_rack_ack(now, ts_ecr, st->sent);
+    st->rtx = tcp_sack_rtx_advance(st->rtx, bump);
+    st->sb = tcp_sack_advance(st->sb, st->rtx, bump);
+  } else if (st->sent != 0) {
+    lost = tcp_rack_expired(now, st->rack);
+  }
+
+  /* without progress only bytes beyond those already scheduled are new */
+  nxt = TCP_SACK_NXT(st->rtx);
+  if (bump == 0 && st->rtx != 0) {
+    end = tcp_sack_hole_end(st->sb, st->rtx);
+    nxt = (end > nxt ? end : nxt);
+  }
+
+  if (st->sack && sack_left != sack_right) {
+    st->sb = tcp_sack_update(st->sb, sack_left - st->una,
+        sack_right - st->una, st->sent);
+  }
+
+  if (st->rtx != 0) {
+    end = tcp_sack_hole_end(st->sb, st->rtx);
+    return (end > nxt ? end - nxt : 0);
+  }
+  if (!lost) {
+    return 0;
+  }
+
+  st->recoveries++;
+  if (st->sb == 0 || st->sent > TCP_OOO_MAX) {
+    tcp_sack_gbn(st);
+    return 0;
+  }
+  st->rtx = TCP_SACK_RTX(st->sent, 0);
+  return tcp_sack_hole_end(st->sb, st->rtx);
+}
+
+/**
+ * Host model of segment selection in flows_tx(): repair the current hole
+ * first, then send new data.
+ *
+ * @param st    Sender state
+ * @param now   Current TS clock
+ * @param avail Bytes the flow may send (tcp_txavail())
+ * @param mss   Maximum segment size
+ * @param seq   Output: sequence number of the segment
+ *
+ * @return Payload length, 0 if there is nothing to send.
+ */
+static inline uint32_t tcp_sack_tx_next(struct tcp_sack_txstate *st,
+    uint32_t now, uint32_t avail, uint32_t mss, uint32_t *seq)
+{
+  uint32_t nxt, end, len, dup;
+
+  if (st->rtx != 0) {
+    nxt = TCP_SACK_NXT(st->rtx);
+    end = tcp_sack_hole_end(st->sb, st->rtx);
+    if (nxt < end) {
+      len = (end - nxt < mss ? end - nxt : mss);
+      *seq = st->una + nxt;
+      st->rtx += len;
+      st->rtx_bytes += len;
+      return len;
+    }
+  }
+
+  len = (avail < mss ? avail : mss);
+  if (len == 0) {
+    return 0;
+  }
+  if (st->sent == 0) {
+    st->rack = tcp_rack_arm(now, st->rack);
+  }
+  *seq = st->una + st->sent;
+  st->sent += len;
+
+  /* after go-back-N part of the segment may have been sent before */
+  dup = st->high - *seq;
+  if ((int32_t) dup > 0) {
+    st->rtx_bytes += (dup < len ? dup : len);
+  }
+  if ((int32_t) (*seq + len - st->high) > 0) {
+    st->high = *seq + len;
+  }
+  return len;
+}
+
+/**
+ * Host model of a tail loss probe in flows_retx(): (re)start repairing at
+ * snd_una with one segment.
+ *
+ * @return Bytes scheduled for retransmission.
+ */
+static inline uint32_t tcp_sack_tx_probe(struct tcp_sack_txstate *st,
+    uint32_t mss)
+{
+  uint32_t end;
+
+  if (st->sent == 0) {
+    return 0;
+  }
+  if (st->rtx != 0) {
+    st->rtx = TCP_SACK_RTX(TCP_SACK_REC(st->rtx), 0);
+  } else if (st->sent <= TCP_OOO_MAX) {
+    st->rtx = TCP_SACK_RTX(st->sent, 0);
+  } else {
+    return 0;
+  }
+
+  st->probes++;
+  end = tcp_sack_hole_end(st->sb, st->rtx);
+  return (end < mss ? end : mss);
+}
+
+/** Host model of flows_retx(): retransmission timeout */
+static inline void tcp_sack_tx_timeout(struct tcp_sack_txstate *st)
+{
+  tcp_sack_gbn(st);
+}
+#endif /* !FIRMWARE */
+
+#endif /* FLEXTOE_TCP_SACK_H_ */
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+#ifndef FLEXTOE_TCP_WSCALE_H_
+#define FLEXTOE_TCP_WSCALE_H_
+
+#include <stdint.h>
+#include "flow_state.h"
+#include "tcp_ooo.h"
+
+/**
+ * Window scaling (RFC 7323)
+ *
+ * The slowpath offers the option in every SYN and SYN-ACK it sends, with the
+ * smallest shift that covers the receive buffer (tcp_wscale_shift()), and
+ * uses it only if the peer's SYN or SYN-ACK carried the option as well. Both
+ * shifts go to the fastpath with the flow (flowst_tcp_t.wnd, 0 if not
+ * negotiated): rx_avail is shifted right for the window field of every
+ * segment it sends, the window field of every segment it receives is
+ * shifted left for tx_remote_avail. Segments of the handshake itself are
+ * never scaled, they are all built by the slowpath.
+ *
+ * Out-of-order intervals and the SACK scoreboard keep 16 bit offsets
+ * (tcp_ooo.h, tcp_sack.h): out-of-order data more than 64KB past
+ * rx_next_seq is dropped and resent by the peer, and losses with more than
+ * 64KB in flight are repaired with go-back-N.
+ */
+
+#define TCP_WSCALE_MAX        14        /*> Largest shift (RFC 7323 2.3) */
+
+#define TCP_WSCALE(_SND, _RCV) \
+    ((((_SND) & FLEXNIC_PL_FLOWST_WS_MASK) << FLEXNIC_PL_FLOWST_WS_SND_SHIFT) | \
+     (((_RCV) & FLEXNIC_PL_FLOWST_WS_MASK) << FLEXNIC_PL_FLOWST_WS_RCV_SHIFT))
+#define TCP_WSCALE_SND(_WND) \
+    (((_WND) >> FLEXNIC_PL_FLOWST_WS_SND_SHIFT) & FLEXNIC_PL_FLOWST_WS_MASK)
+#define TCP_WSCALE_RCV(_WND) \
+    (((_WND) >> FLEXNIC_PL_FLOWST_WS_RCV_SHIFT) & FLEXNIC_PL_FLOWST_WS_MASK)
+
+/**
+ * Window field to advertise.
+ *
+ * @param wnd       Window word (flowst_tcp_t.wnd)
+ * @param rx_avail  Free receive buffer space
+ */
+TCP_OOO_FN uint32_t tcp_wscale_win(uint32_t wnd, uint32_t rx_avail)
+{
+  uint32_t win = rx_avail >> TCP_WSCALE_RCV(wnd);
+
+  return (win > 0xFFFF ? 0xFFFF : win);
+}
+
+/**
+ * Peer's receive window from a window field.
+ *
+ * @param wnd       Window word (flowst_tcp_t.wnd)
+ * @param win       Window field of a received segment
+ */
+TCP_OOO_FN uint32_t tcp_wscale_remote(uint32_t wnd, uint32_t win)
+{
+  return win << TCP_WSCALE_SND(wnd);
+}
+
+#if !FIRMWARE
+/** Shift to offer for a receive buffer of @p len bytes */
+static inline uint32_t tcp_wscale_shift(uint32_t len)
+{
+  uint32_t shift = 0;
+
+  while (shift < TCP_WSCALE_MAX && (len >> shift) > 0xFFFF) {
+    shift++;
+  }
+  return shift;
+}
+#endif /* !FIRMWARE */
+
+#endif /* FLEXTOE_TCP_WSCALE_H_ */
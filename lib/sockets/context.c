@@ -209,6 +209,14 @@ static inline void ev_listen_accept(struct flextcp_context *ctx,
   if (ev->ev.listen_accept.status == 0) {
     s->data.connection.status = SOC_CONNECTED;
     flextcp_epoll_set(s, EPOLLOUT);
+
+    if ((s->flags & SOF_KEEPALIVE) == SOF_KEEPALIVE) {
+      flextcp_connection_keepalive(ctx, c, s->ka_idle, s->ka_intvl,
+          s->ka_cnt);
+    }
+    if (s->qm_class != 0) {
+      flextcp_connection_priority(ctx, c, s->qm_class);
+    }
   } else {
     s->data.connection.status = SOC_FAILED;
     flextcp_epoll_set(s, EPOLLERR);
@@ -235,6 +243,14 @@ static inline void ev_conn_open(struct flextcp_context *ctx,
   if (ev->ev.conn_open.status == 0) {
     s->data.connection.status = SOC_CONNECTED;
     flextcp_epoll_set(s, EPOLLOUT);
+
+    if ((s->flags & SOF_KEEPALIVE) == SOF_KEEPALIVE) {
+      flextcp_connection_keepalive(ctx, c, s->ka_idle, s->ka_intvl,
+          s->ka_cnt);
+    }
+    if (s->qm_class != 0) {
+      flextcp_connection_priority(ctx, c, s->qm_class);
+    }
   } else {
     s->data.connection.status = SOC_FAILED;
     flextcp_epoll_set(s, EPOLLERR);
@@ -61,6 +61,12 @@ int tas_socket(int domain, int type, int protocol)
 
   s->type = SOCK_SOCKET;
   s->flags = 0;
+  s->ka_idle = SOCK_KA_IDLE;
+  s->ka_intvl = SOCK_KA_INTVL;
+  s->ka_cnt = SOCK_KA_CNT;
+  s->prio = 0;
+  s->tos = 0;
+  s->qm_class = 0;
   flextcp_epoll_sockinit(s);
 
   if (nonblock) {
@@ -466,7 +472,14 @@ int tas_accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen,
     }
 
     ns->type = SOCK_CONNECTION;
-    ns->flags = (nonblock ? SOF_NONBLOCK : 0) | (cloexec ? SOF_CLOEXEC : 0);
+    ns->flags = (nonblock ? SOF_NONBLOCK : 0) | (cloexec ? SOF_CLOEXEC : 0) |
+      (s->flags & SOF_KEEPALIVE);
+    ns->ka_idle = s->ka_idle;
+    ns->ka_intvl = s->ka_intvl;
+    ns->ka_cnt = s->ka_cnt;
+    ns->prio = s->prio;
+    ns->tos = s->tos;
+    ns->qm_class = s->qm_class;
     ns->data.connection.status = SOC_CONNECTING;
     ns->data.connection.listener = s;
     ns->data.connection.rx_len_1 = 0;
@@ -704,11 +717,17 @@ int tas_getsockopt(int sockfd, int level, int optname, void *optval,
     /* reuseaddr is always on */
     res = 1;
   } else if (level == SOL_SOCKET && optname == SO_KEEPALIVE) {
-    /* keepalive is always disabled */
-    res = 0;
-  } else if (level == IPPROTO_TCP && (optname == TCP_KEEPIDLE ||
-        optname == TCP_KEEPINTVL || optname == TCP_KEEPCNT)) {
-    res = 0;
+    res = !!(s->flags & SOF_KEEPALIVE);
+  } else if (level == IPPROTO_TCP && optname == TCP_KEEPIDLE) {
+    res = s->ka_idle;
+  } else if (level == IPPROTO_TCP && optname == TCP_KEEPINTVL) {
+    res = s->ka_intvl;
+  } else if (level == IPPROTO_TCP && optname == TCP_KEEPCNT) {
+    res = s->ka_cnt;
+  } else if (level == SOL_SOCKET && optname == SO_PRIORITY) {
+    res = s->prio;
+  } else if (level == IPPROTO_IP && optname == IP_TOS) {
+    res = s->tos;
   } else if (level == SOL_SOCKET && optname == SO_LINGER) {
     fprintf(stderr, "flextcp getsockopt: SO_LINGER not implemented\n");
     errno = ENOPROTOOPT;
@@ -733,6 +752,48 @@ out:
   return ret;
 }
 
+/* pass keepalive settings to the slowpath if the socket is connected */
+static int sock_keepalive_update(struct socket *s)
+{
+  uint32_t idle = 0;
+
+  if (s->type != SOCK_CONNECTION ||
+      s->data.connection.status != SOC_CONNECTED)
+  {
+    return 0;
+  }
+
+  if ((s->flags & SOF_KEEPALIVE) == SOF_KEEPALIVE) {
+    idle = s->ka_idle;
+  }
+
+  if (flextcp_connection_keepalive(flextcp_sockctx_get(),
+        &s->data.connection.c, idle, s->ka_intvl, s->ka_cnt) != 0)
+  {
+    errno = ENOBUFS;
+    return -1;
+  }
+  return 0;
+}
+
+/* pass the priority class to the slowpath if the socket is connected */
+static int sock_prio_update(struct socket *s)
+{
+  if (s->type != SOCK_CONNECTION ||
+      s->data.connection.status != SOC_CONNECTED)
+  {
+    return 0;
+  }
+
+  if (flextcp_connection_priority(flextcp_sockctx_get(),
+        &s->data.connection.c, s->qm_class) != 0)
+  {
+    errno = ENOBUFS;
+    return -1;
+  }
+  return 0;
+}
+
 int tas_setsockopt(int sockfd, int level, int optname, const void *optval,
     socklen_t optlen)
 {
@@ -748,7 +809,7 @@ int tas_setsockopt(int sockfd, int level, int optname, const void *optval,
 
   if(level == IPPROTO_TCP && optname == TCP_NODELAY) {
     /* do nothing */
-    if (optlen != sizeof(int)) {
+    if (optlen < sizeof(int)) {
       errno = EINVAL;
       ret = -1;
       goto out;
@@ -772,7 +833,7 @@ int tas_setsockopt(int sockfd, int level, int optname, const void *optval,
       goto out;
     }
   } else if (level == SOL_SOCKET && optname == SO_REUSEPORT) {
-    if (optlen != sizeof(int)) {
+    if (optlen < sizeof(int)) {
       errno = EINVAL;
       ret = -1;
       goto out;
@@ -786,12 +847,67 @@ int tas_setsockopt(int sockfd, int level, int optname, const void *optval,
   } else if (level == SOL_SOCKET && optname == SO_REUSEADDR) {
     /* ignore silently */
   } else if (level == SOL_SOCKET && optname == SO_KEEPALIVE) {
-    /* ignore silently */
-  } else if (level == SOL_SOCKET && optname == SO_PRIORITY) {
-    /* ignore silently */
+    if (optlen < sizeof(int)) {
+      errno = EINVAL;
+      ret = -1;
+      goto out;
+    }
+
+    if (*(int *) optval != 0) {
+      s->flags |= SOF_KEEPALIVE;
+    } else {
+      s->flags &= ~SOF_KEEPALIVE;
+    }
+    ret = sock_keepalive_update(s);
+  } else if ((level == SOL_SOCKET && optname == SO_PRIORITY) ||
+      (level == IPPROTO_IP && optname == IP_TOS))
+  {
+    if (optlen < sizeof(int)) {
+      errno = EINVAL;
+      ret = -1;
+      goto out;
+    }
+
+    res = *(int *) optval;
+    if (res < 0 || res > (optname == SO_PRIORITY ? SOCK_PRIO_MAX : 0xff)) {
+      errno = EINVAL;
+      ret = -1;
+      goto out;
+    }
+
+    if (optname == SO_PRIORITY) {
+      s->prio = res;
+      s->qm_class = SOCK_CLASS_PRIO(res);
+    } else {
+      s->tos = res;
+      s->qm_class = SOCK_CLASS_TOS(res);
+    }
+    ret = sock_prio_update(s);
   } else if (level == IPPROTO_TCP && (optname == TCP_KEEPIDLE ||
        optname == TCP_KEEPINTVL || optname == TCP_KEEPCNT)) {
-    /* ignore silently */
+    if (optlen < sizeof(int)) {
+      errno = EINVAL;
+      ret = -1;
+      goto out;
+    }
+
+    res = *(int *) optval;
+    if (res < 1 || res > (optname == TCP_KEEPCNT ? SOCK_KA_CNT_MAX :
+          SOCK_KA_TIME_MAX))
+    {
+      errno = EINVAL;
+      ret = -1;
+      goto out;
+    }
+
+    if (optname == TCP_KEEPIDLE) {
+      s->ka_idle = res;
+    } else if (optname == TCP_KEEPINTVL) {
+      s->ka_intvl = res;
+    } else {
+      s->ka_cnt = res;
+    }
+    ret = sock_keepalive_update(s);
   } else if (level == SOL_SOCKET && optname == SO_LINGER) {
     fprintf(stderr, "flextcp setsockopt: SO_LINGER not implemented\n");
     errno = ENOPROTOOPT;
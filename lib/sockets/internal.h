@@ -28,8 +28,21 @@ enum socket_flags {
   SOF_BOUND = 2,
   SOF_REUSEPORT = 4,
   SOF_CLOEXEC = 8,
+  SOF_KEEPALIVE = 16,
 };
 
+/* keepalive defaults and limits, as in Linux */
+#define SOCK_KA_IDLE      7200
+#define SOCK_KA_INTVL     75
+#define SOCK_KA_CNT       9
+#define SOCK_KA_TIME_MAX  32767
+#define SOCK_KA_CNT_MAX   127
+
+/* queue manager priority class (0-3) from SO_PRIORITY (0-7) or IP_TOS */
+#define SOCK_PRIO_MAX         7
+#define SOCK_CLASS_PRIO(_P)   ((_P) >> 1)
+#define SOCK_CLASS_TOS(_T)    ((_T) >> 6)
+
 enum conn_status {
   SOC_CONNECTING = 0,
   SOC_CONNECTED = 1,
@@ -85,6 +98,14 @@ struct socket {
   struct sockaddr_in addr;
   uint8_t flags;
   uint8_t type;
+  /** keepalive: idle time and probe interval [s], probes (SOF_KEEPALIVE) */
+  uint16_t ka_idle;
+  uint16_t ka_intvl;
+  uint8_t ka_cnt;
+  /** SO_PRIORITY and IP_TOS as set, class from whichever was set last */
+  uint8_t prio;
+  uint8_t tos;
+  uint8_t qm_class;
   int refcnt;
   volatile uint32_t sp_lock;
 
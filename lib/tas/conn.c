@@ -403,6 +403,73 @@ int flextcp_connection_move(struct flextcp_context *ctx,
   return 0;
 }
 
+int flextcp_connection_keepalive(struct flextcp_context *ctx,
+        struct flextcp_connection *conn, uint32_t idle, uint32_t intvl,
+        uint32_t cnt)
+{
+  uint32_t pos = ctx->spin_head;
+  struct sp_appout *spin = ctx->spin_base;
+
+  spin += pos;
+
+  if (spin->type != SP_APPOUT_INVALID) {
+    fprintf(stderr, "flextcp_connection_keepalive: no queue space\n");
+    return -1;
+  }
+
+  spin->data.conn_keepalive.local_ip = conn->local_ip;
+  spin->data.conn_keepalive.remote_ip = conn->remote_ip;
+  spin->data.conn_keepalive.local_port = conn->local_port;
+  spin->data.conn_keepalive.remote_port = conn->remote_port;
+  spin->data.conn_keepalive.opaque = OPAQUE(conn);
+  spin->data.conn_keepalive.idle = idle;
+  spin->data.conn_keepalive.intvl = intvl;
+  spin->data.conn_keepalive.cnt = cnt;
+  MEM_BARRIER();
+  spin->type = SP_APPOUT_CONN_KEEPALIVE;
+  flextcp_sp_kick();
+
+  pos = pos + 1;
+  if (pos >= ctx->spin_len) {
+    pos = 0;
+  }
+  ctx->spin_head = pos;
+
+  return 0;
+}
+
+int flextcp_connection_priority(struct flextcp_context *ctx,
+        struct flextcp_connection *conn, uint32_t cls)
+{
+  uint32_t pos = ctx->spin_head;
+  struct sp_appout *spin = ctx->spin_base;
+
+  spin += pos;
+
+  if (spin->type != SP_APPOUT_INVALID) {
+    fprintf(stderr, "flextcp_connection_priority: no queue space\n");
+    return -1;
+  }
+
+  spin->data.conn_priority.local_ip = conn->local_ip;
+  spin->data.conn_priority.remote_ip = conn->remote_ip;
+  spin->data.conn_priority.local_port = conn->local_port;
+  spin->data.conn_priority.remote_port = conn->remote_port;
+  spin->data.conn_priority.opaque = OPAQUE(conn);
+  spin->data.conn_priority.cls = cls;
+  MEM_BARRIER();
+  spin->type = SP_APPOUT_CONN_PRIORITY;
+  flextcp_sp_kick();
+
+  pos = pos + 1;
+  if (pos >= ctx->spin_len) {
+    pos = 0;
+  }
+  ctx->spin_head = pos;
+
+  return 0;
+}
+
 static void connection_init(struct flextcp_connection *conn)
 {
   memset(conn, 0, sizeof(*conn));
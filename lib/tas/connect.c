@@ -43,7 +43,10 @@ int flexnic_driver_connect(struct flexnic_info_t **p_info, void **p_mem_start)
     goto error_unmap_info;
   }
 
-  m = util_map_region_huge(FLEXNIC_NAME_DMA_MEM, fi->dma_mem_size);
+  /* not faulted in, the slowpath populates what it hands out */
+  m = util_map_region_huge_pg(FLEXNIC_NAME_DMA_MEM, fi->dma_mem_size,
+      ((fi->flags & FLEXNIC_FLAG_HUGEPAGES_2M) ? HUGE_PAGE_SIZE_2M :
+       HUGE_PAGE_SIZE));
   if (m == NULL) {
     perror("flexnic_driver_connect: mapping dma memory failed");
     goto error_unmap_info;
@@ -304,4 +304,22 @@ int flextcp_connection_tx_possible(struct flextcp_context *ctx,
 int flextcp_connection_move(struct flextcp_context *ctx,
         struct flextcp_connection *conn);
 
+/** Configure keepalive probes for connection, @p idle = 0 disables.
+ *
+ * Times are in seconds. After @p idle seconds without receiving anything
+ * the slowpath probes the peer every @p intvl seconds, and resets the
+ * connection after @p cnt unanswered probes.
+ */
+int flextcp_connection_keepalive(struct flextcp_context *ctx,
+        struct flextcp_connection *conn, uint32_t idle, uint32_t intvl,
+        uint32_t cnt);
+
+/** Set the strict-priority class of the connection in the NIC queue manager.
+ *
+ * Classes go from 0 (default, lowest) to 3, segments of a higher class are
+ * scheduled first.
+ */
+int flextcp_connection_priority(struct flextcp_context *ctx,
+        struct flextcp_connection *conn, uint32_t cls);
+
 #endif /* TAS_LL_H_ */
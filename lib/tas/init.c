@@ -76,24 +76,24 @@ int flextcp_init(void)
 
 int flextcp_context_create(struct flextcp_context *ctx)
 {
-  static uint16_t ctx_id = 0;
-
   memset(ctx, 0, sizeof(struct flextcp_context));
 
-  ctx->ctx_id = __sync_fetch_and_add(&ctx_id, 1);
-  if (ctx->ctx_id >= FLEXNIC_PL_APPCTX_NUM) {
-    fprintf(stderr, "flextcp_context_create: maximum number of contexts "
-        "exeeded\n");
-    return -1;
-  }
-
   ctx->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
   if (ctx->evfd < 0) {
     perror("flextcp_context_create: eventfd for waiting fd failed");
     return -1;
   }
 
-  return flextcp_sp_newctx(ctx);
+  /* the slowpath allocates (and recycles) doorbells, it fails the request
+   * when all are in use */
+  if (flextcp_sp_newctx(ctx) != 0) {
+    fprintf(stderr, "flextcp_context_create: creating context failed\n");
+    close(ctx->evfd);
+    return -1;
+  }
+
+  ctx->ctx_id = ctx->db_id;
+  return 0;
 }
 
 static int sp_poll(struct flextcp_context *ctx, int num,
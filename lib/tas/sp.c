@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/syscall.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -19,6 +20,8 @@
 
 static int ksock_fd = -1;
 static int sp_evfd = 0;
+/** Reconnect token from FLEXTOE_SESSION, see flextcp_sp_connect() */
+static uint64_t sp_session = SP_UXSOCK_SESSION_NONE;
 
 void flextcp_sp_kick(void)
 {
@@ -36,6 +39,7 @@ int flextcp_sp_connect(void)
   ssize_t r;
   struct sockaddr_un saun;
   struct cmsghdr *cmsg;
+  const char *session;
 
   /* prepare socket address */
   memset(&saun, 0, sizeof(saun));
@@ -89,6 +93,12 @@ int flextcp_sp_connect(void)
   sp_evfd = *pfd;
   ksock_fd = fd;
 
+  /* a restart with the same token gets the contexts and listeners of the
+   * previous process back, if the slowpath still holds them */
+  if ((session = getenv("FLEXTOE_SESSION")) != NULL) {
+    sp_session = strtoull(session, NULL, 0);
+  }
+
   return 0;
 }
 
@@ -100,7 +110,15 @@ int flextcp_sp_newctx(struct flextcp_context *ctx)
   struct sp_uxsock_request req = {
       .rxq_len = NIC_RXQ_LEN,
       .txq_len = NIC_TXQ_LEN,
+      .numa_node = SP_UXSOCK_NODE_ANY,
+      .session = sp_session,
     };
+  unsigned cpu, node;
+
+  /* the slowpath places the context's buffers on the node of this thread */
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+    req.numa_node = node;
+  }
 
   /* send request on sp socket */
   struct iovec iov = {
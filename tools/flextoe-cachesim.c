@@ -0,0 +1,668 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * @brief Trace-driven simulator for the flow caches in preprocess.c.
+ * @file flextoe-cachesim.c
+ *
+ * The preprocess MEs keep two caches in local memory: flowhash_cache maps
+ * the 4-tuple of received segments to a flow id (direct mapped, indexed by the
+ * flow hash, a miss costs a lookup in the flow hash table in IMEM), and
+ * conn_cache holds flowst_conn_t of flows being transmitted (16 entries
+ * tagged in the ME CAM, LRU, a miss reads the entry from EMEM). Every ME has
+ * its own copy: received segments are spread over all preprocess MEs, segments
+ * to transmit go to the MEs of the island of the flow group.
+ *
+ * This replays a synthetic or captured (pcap) segment trace against the
+ * current organization and alternatives (set associative, fully associative,
+ * LRU or CLOCK replacement) and reports hit rates, memory accesses and an
+ * estimate of the cycles per lookup.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <arpa/inet.h>
+
+#include "util/rng.h"
+
+#define CACHES_MAX      16
+#define NUM_FLOW_GROUPS 4
+
+/* Rough cost model [ME cycles] */
+#define CYC_CAM         4       /*> CAM lookup with hardware LRU */
+#define CYC_WAY         6       /*> Compare one way in local memory */
+#define CYC_UPDATE      4       /*> Software LRU/CLOCK bookkeeping */
+#define CYC_IMEM        150     /*> IMEM access latency */
+#define CYC_EMEM        250     /*> EMEM access latency */
+#define CAM_ENTRIES     16
+
+enum cache_kind {
+  CK_FLOWHASH,
+  CK_CONN,
+};
+
+enum cache_policy {
+  CP_LRU,
+  CP_CLOCK,
+};
+
+/** One cache organization, one instance per ME */
+struct cache {
+  char spec[32];
+  enum cache_policy policy;
+  uint32_t sets;
+  uint32_t ways;
+  uint32_t mes;
+
+  uint32_t *tags;                 /*> Key + 1, 0: empty */
+  uint64_t *used;                 /*> LRU: last use */
+  uint8_t *ref;                   /*> CLOCK: reference bits */
+  uint32_t *hand;                 /*> CLOCK: hand per set */
+  uint64_t clock;
+
+  uint64_t lookups;
+  uint64_t hits;
+};
+
+struct event {
+  uint32_t conn;
+  uint8_t tx;
+};
+
+struct conn {
+  uint32_t remote_ip;
+  uint32_t local_ip;
+  uint16_t remote_port;
+  uint16_t local_port;
+  uint32_t hash;
+};
+
+struct trace {
+  struct event *ev;
+  size_t num;
+  size_t size;
+  struct conn *conns;
+  uint32_t conns_num;
+  uint32_t conns_size;
+};
+
+static struct utils_rng rng;
+
+/* CRC-32C of the flow key, as camht_hash() (modulo bit order) */
+static uint32_t flow_key_hash(const struct conn *c)
+{
+  uint8_t key[12];
+  uint32_t crc = 0xFFFFFFFF, v;
+  unsigned i, j;
+
+  v = htonl(c->remote_ip);
+  memcpy(key, &v, 4);
+  v = htonl(c->local_ip);
+  memcpy(key + 4, &v, 4);
+  key[8] = c->remote_port >> 8;
+  key[9] = c->remote_port;
+  key[10] = c->local_port >> 8;
+  key[11] = c->local_port;
+
+  for (i = 0; i < sizeof(key); i++) {
+    crc ^= key[i];
+    for (j = 0; j < 8; j++) {
+      crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+static int trace_add_event(struct trace *t, uint32_t conn, int tx)
+{
+  struct event *ev;
+
+  if (t->num == t->size) {
+    t->size = (t->size == 0 ? 4096 : t->size * 2);
+    if ((ev = realloc(t->ev, t->size * sizeof(*ev))) == NULL) {
+      fprintf(stderr, "flextoe-cachesim: realloc failed\n");
+      return -1;
+    }
+    t->ev = ev;
+  }
+  t->ev[t->num].conn = conn;
+  t->ev[t->num].tx = tx;
+  t->num++;
+  return 0;
+}
+
+static int trace_add_conn(struct trace *t, uint32_t rip, uint32_t lip,
+    uint16_t rp, uint16_t lp)
+{
+  struct conn *c;
+
+  if (t->conns_num == t->conns_size) {
+    t->conns_size = (t->conns_size == 0 ? 1024 : t->conns_size * 2);
+    if ((c = realloc(t->conns, t->conns_size * sizeof(*c))) == NULL) {
+      fprintf(stderr, "flextoe-cachesim: realloc failed\n");
+      return -1;
+    }
+    t->conns = c;
+  }
+  c = &t->conns[t->conns_num];
+  c->remote_ip = rip;
+  c->local_ip = lip;
+  c->remote_port = rp;
+  c->local_port = lp;
+  c->hash = flow_key_hash(c);
+  return t->conns_num++;
+}
+
+/**
+ * Synthetic trace: connection popularity follows a Zipf distribution with
+ * exponent @p skew, a connection sends or receives a train of segments at a
+ * time (geometric, mean @p burst), a fraction @p tx_frac of them transmitted.
+ */
+static int trace_synth(struct trace *t, uint32_t conns, double skew,
+    double burst, double tx_frac, uint64_t segs)
+{
+  double *cdf, sum = 0, u;
+  uint32_t i, lo, hi, c;
+  int tx;
+
+  if ((cdf = malloc(conns * sizeof(*cdf))) == NULL) {
+    fprintf(stderr, "flextoe-cachesim: malloc failed\n");
+    return -1;
+  }
+  for (i = 0; i < conns; i++) {
+    sum += 1.0 / pow(i + 1, skew);
+    cdf[i] = sum;
+  }
+  for (i = 0; i < conns; i++) {
+    cdf[i] /= sum;
+  }
+
+  /* clients from 10.1.0.0/16 to a server at 10.0.0.1:1234 */
+  for (i = 0; i < conns; i++) {
+    if (trace_add_conn(t, 0x0A010000 + (i >> 8) * 7 + 1, 0x0A000001,
+          10000 + (i % 50000), 1234) < 0)
+    {
+      free(cdf);
+      return -1;
+    }
+  }
+
+  while (t->num < segs) {
+    u = utils_rng_gend(&rng);
+    lo = 0;
+    hi = conns - 1;
+    while (lo < hi) {
+      c = (lo + hi) / 2;
+      if (cdf[c] < u) {
+        lo = c + 1;
+      } else {
+        hi = c;
+      }
+    }
+
+    tx = (utils_rng_gend(&rng) < tx_frac);
+    do {
+      if (trace_add_event(t, lo, tx) != 0) {
+        free(cdf);
+        return -1;
+      }
+    } while (t->num < segs && utils_rng_gend(&rng) < 1 - 1 / burst);
+  }
+
+  free(cdf);
+  return 0;
+}
+
+static uint32_t rd32(const uint8_t *p, int swap)
+{
+  uint32_t v;
+
+  memcpy(&v, p, 4);
+  return (swap ? __builtin_bswap32(v) : v);
+}
+
+/**
+ * Trace from a pcap capture (Ethernet, IPv4, TCP). Segments to @p local_ip
+ * are received, from it transmitted. Without a local address, the side that
+ * sent the first segment of a connection is the remote one.
+ */
+static int trace_pcap(struct trace *t, const char *path, uint32_t local_ip)
+{
+  uint8_t hdr[24], rec[16], *pkt = NULL;
+  uint32_t caplen, snaplen, off, sip, dip, i;
+  uint16_t sp, dp, etype;
+  struct conn *c;
+  int swap, tx, ret = -1;
+  int32_t conn;
+  FILE *f;
+
+  if ((f = fopen(path, "rb")) == NULL) {
+    fprintf(stderr, "flextoe-cachesim: opening %s failed: %s\n", path,
+        strerror(errno));
+    return -1;
+  }
+  if (fread(hdr, sizeof(hdr), 1, f) != 1) {
+    fprintf(stderr, "flextoe-cachesim: %s: short header\n", path);
+    goto out;
+  }
+  if (rd32(hdr, 0) == 0xa1b2c3d4 || rd32(hdr, 0) == 0xa1b23c4d) {
+    swap = 0;
+  } else if (rd32(hdr, 1) == 0xa1b2c3d4 || rd32(hdr, 1) == 0xa1b23c4d) {
+    swap = 1;
+  } else {
+    fprintf(stderr, "flextoe-cachesim: %s: not a pcap file\n", path);
+    goto out;
+  }
+  if (rd32(hdr + 20, swap) != 1) {
+    fprintf(stderr, "flextoe-cachesim: %s: link type is not Ethernet\n", path);
+    goto out;
+  }
+  snaplen = rd32(hdr + 16, swap);
+  if (snaplen == 0 || snaplen > 262144) {
+    snaplen = 262144;
+  }
+  if ((pkt = malloc(snaplen)) == NULL) {
+    fprintf(stderr, "flextoe-cachesim: malloc failed\n");
+    goto out;
+  }
+
+  while (fread(rec, sizeof(rec), 1, f) == 1) {
+    caplen = rd32(rec + 8, swap);
+    if (caplen > snaplen || fread(pkt, caplen, 1, f) != 1) {
+      break;
+    }
+
+    off = 14;
+    if (caplen < off + 20) {
+      continue;
+    }
+    etype = (pkt[12] << 8) | pkt[13];
+    if (etype == 0x8100) {
+      etype = (pkt[16] << 8) | pkt[17];
+      off += 4;
+    }
+    if (etype != 0x0800 || caplen < off + 20 || pkt[off + 9] != 6) {
+      continue;
+    }
+    sip = (pkt[off + 12] << 24) | (pkt[off + 13] << 16) |
+        (pkt[off + 14] << 8) | pkt[off + 15];
+    dip = (pkt[off + 16] << 24) | (pkt[off + 17] << 16) |
+        (pkt[off + 18] << 8) | pkt[off + 19];
+    off += (pkt[off] & 0xF) * 4;
+    if (caplen < off + 4) {
+      continue;
+    }
+    sp = (pkt[off] << 8) | pkt[off + 1];
+    dp = (pkt[off + 2] << 8) | pkt[off + 3];
+
+    if (local_ip != 0 && dip != local_ip && sip != local_ip) {
+      continue;
+    }
+
+    /* linear search is fine for the few thousand connections of a capture */
+    conn = -1;
+    for (i = 0; i < t->conns_num; i++) {
+      c = &t->conns[i];
+      if ((c->remote_ip == sip && c->local_ip == dip &&
+            c->remote_port == sp && c->local_port == dp) ||
+          (c->remote_ip == dip && c->local_ip == sip &&
+            c->remote_port == dp && c->local_port == sp))
+      {
+        conn = i;
+        break;
+      }
+    }
+    if (conn < 0) {
+      if (local_ip == 0 || dip == local_ip) {
+        conn = trace_add_conn(t, sip, dip, sp, dp);
+      } else {
+        conn = trace_add_conn(t, dip, sip, dp, sp);
+      }
+      if (conn < 0) {
+        goto out;
+      }
+    }
+
+    tx = (t->conns[conn].local_ip == sip && t->conns[conn].local_port == sp);
+    if (trace_add_event(t, conn, tx) != 0) {
+      goto out;
+    }
+  }
+  ret = 0;
+
+out:
+  free(pkt);
+  fclose(f);
+  return ret;
+}
+
+/* POLICY:SETSxWAYS, e.g. lru:128x1 */
+static int cache_parse(struct cache *c, const char *spec, uint32_t mes)
+{
+  char pol[8];
+  size_t n;
+
+  memset(c, 0, sizeof(*c));
+  if (sscanf(spec, "%7[a-z]:%ux%u", pol, &c->sets, &c->ways) != 3 ||
+      c->sets == 0 || c->ways == 0 || (c->sets & (c->sets - 1)) != 0)
+  {
+    fprintf(stderr, "flextoe-cachesim: invalid cache %s, expected "
+        "POLICY:SETSxWAYS with a power of 2 sets\n", spec);
+    return -1;
+  }
+  if (strcmp(pol, "lru") == 0) {
+    c->policy = CP_LRU;
+  } else if (strcmp(pol, "clock") == 0) {
+    c->policy = CP_CLOCK;
+  } else {
+    fprintf(stderr, "flextoe-cachesim: unknown policy %s\n", pol);
+    return -1;
+  }
+  snprintf(c->spec, sizeof(c->spec), "%s", spec);
+  c->mes = mes;
+
+  n = (size_t) mes * c->sets * c->ways;
+  c->tags = calloc(n, sizeof(*c->tags));
+  c->used = calloc(n, sizeof(*c->used));
+  c->ref = calloc(n, sizeof(*c->ref));
+  c->hand = calloc((size_t) mes * c->sets, sizeof(*c->hand));
+  if (c->tags == NULL || c->used == NULL || c->ref == NULL ||
+      c->hand == NULL)
+  {
+    fprintf(stderr, "flextoe-cachesim: calloc failed\n");
+    return -1;
+  }
+  return 0;
+}
+
+static void cache_free(struct cache *c)
+{
+  free(c->tags);
+  free(c->used);
+  free(c->ref);
+  free(c->hand);
+}
+
+/* look up key in the cache of ME me, insert on a miss */
+static void cache_access(struct cache *c, uint32_t me, uint32_t set,
+    uint32_t key)
+{
+  size_t base = ((size_t) me * c->sets + (set & (c->sets - 1))) * c->ways;
+  uint32_t *tags = c->tags + base, *hand, w, victim;
+  uint64_t *used = c->used + base;
+  uint8_t *ref = c->ref + base;
+
+  c->lookups++;
+  c->clock++;
+  for (w = 0; w < c->ways; w++) {
+    if (tags[w] == key + 1) {
+      c->hits++;
+      used[w] = c->clock;
+      ref[w] = 1;
+      return;
+    }
+  }
+
+  victim = 0;
+  if (c->policy == CP_LRU) {
+    for (w = 0; w < c->ways; w++) {
+      if (used[w] < used[victim]) {
+        victim = w;
+      }
+    }
+  } else {
+    /* second chance: clear reference bits until one is found unset */
+    hand = &c->hand[(size_t) me * c->sets + (set & (c->sets - 1))];
+    while (ref[*hand]) {
+      ref[*hand] = 0;
+      *hand = (*hand + 1) % c->ways;
+    }
+    victim = *hand;
+    *hand = (*hand + 1) % c->ways;
+  }
+
+  tags[victim] = key + 1;
+  used[victim] = c->clock;
+  ref[victim] = 1;
+}
+
+/* estimated cycles per lookup, with the miss path cost @p miss_cyc */
+static double cache_cycles(const struct cache *c, double miss_rate,
+    uint32_t miss_cyc)
+{
+  double probe;
+
+  if (c->sets == 1 && c->ways <= CAM_ENTRIES && c->policy == CP_LRU) {
+    probe = CYC_CAM;
+  } else {
+    /* half the ways on a hit, all on a miss */
+    probe = CYC_WAY * ((1 - miss_rate) * (c->ways + 1) / 2.0 +
+        miss_rate * c->ways);
+    if (c->ways > 1) {
+      probe += CYC_UPDATE;
+    }
+  }
+  return probe + miss_rate * miss_cyc;
+}
+
+static void print_caches(const char *title, struct cache *caches,
+    unsigned num, uint32_t mem_per_miss, uint32_t miss_cyc, const char *mem)
+{
+  double hit, miss;
+  unsigned i;
+
+  printf("\n%s\n", title);
+  printf("  %-16s %10s %8s %12s %10s\n", "cache", "lookups", "hit%",
+      mem, "cyc/lookup");
+  for (i = 0; i < num; i++) {
+    hit = (caches[i].lookups == 0 ? 0 :
+        (double) caches[i].hits / caches[i].lookups);
+    miss = (caches[i].lookups == 0 ? 0 : 1 - hit);
+    printf("  %-16s %10"PRIu64" %7.2f%% %12"PRIu64" %10.1f\n",
+        caches[i].spec, caches[i].lookups, 100 * hit,
+        (caches[i].lookups - caches[i].hits) * mem_per_miss,
+        cache_cycles(&caches[i], miss, miss_cyc));
+  }
+}
+
+static void print_usage(const char *progname)
+{
+  fprintf(stderr, "Usage: %s [OPTION]...\n"
+      "Trace:\n"
+      "  -p, --pcap=FILE       Replay a pcap capture [default: synthetic]\n"
+      "  -l, --local=IP        Local address in the capture\n"
+      "  -c, --conns=N         Synthetic: connections [default: 10000]\n"
+      "  -z, --zipf=S          Synthetic: popularity skew [default: 1.0]\n"
+      "  -b, --burst=N         Synthetic: mean segments per train "
+      "[default: 4]\n"
+      "  -t, --tx=FRAC         Synthetic: transmitted fraction "
+      "[default: 0.5]\n"
+      "  -n, --segments=N      Synthetic: segments [default: 10000000]\n"
+      "  -s, --seed=N          Random seed [default: 1]\n"
+      "Caches, POLICY:SETSxWAYS with POLICY lru or clock, repeatable:\n"
+      "  -f, --flowhash=SPEC   flowhash_cache [default: lru:128x1 (current), "
+      "lru:32x4,\n"
+      "                        clock:32x4, lru:1x128, clock:1x128]\n"
+      "  -k, --conn=SPEC       conn_cache [default: lru:1x16 (current), "
+      "clock:1x16,\n"
+      "                        lru:16x1, lru:16x4, clock:1x64]\n"
+      "  -r, --rx-mes=N        MEs receiving segments [default: 16]\n"
+      "  -x, --tx-mes=N        MEs per flow group transmitting [default: 4]\n"
+      "  -h, --help            Show this help\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+  static const struct option opts[] = {
+    { "pcap", required_argument, NULL, 'p' },
+    { "local", required_argument, NULL, 'l' },
+    { "conns", required_argument, NULL, 'c' },
+    { "zipf", required_argument, NULL, 'z' },
+    { "burst", required_argument, NULL, 'b' },
+    { "tx", required_argument, NULL, 't' },
+    { "segments", required_argument, NULL, 'n' },
+    { "seed", required_argument, NULL, 's' },
+    { "flowhash", required_argument, NULL, 'f' },
+    { "conn", required_argument, NULL, 'k' },
+    { "rx-mes", required_argument, NULL, 'r' },
+    { "tx-mes", required_argument, NULL, 'x' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  static const char *fh_default[] = {
+    "lru:128x1", "lru:32x4", "clock:32x4", "lru:1x128", "clock:1x128",
+  };
+  static const char *conn_default[] = {
+    "lru:1x16", "clock:1x16", "lru:16x1", "lru:16x4", "clock:1x64",
+  };
+  const char *fh_specs[CACHES_MAX], *conn_specs[CACHES_MAX];
+  struct cache fh[CACHES_MAX], cc[CACHES_MAX];
+  unsigned fh_num = 0, conn_num = 0, i;
+  struct trace t;
+  struct in_addr ia;
+  const char *pcap = NULL;
+  uint32_t local_ip = 0, conns = 10000, rx_mes = 16, tx_mes = 4, me, grp;
+  uint64_t segs = 10000000, rx = 0, seed = 1;
+  double skew = 1.0, burst = 4, tx_frac = 0.5;
+  struct event *ev;
+  size_t j;
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "p:l:c:z:b:t:n:s:f:k:r:x:h", opts,
+          NULL)) != -1)
+  {
+    switch (opt) {
+      case 'p':
+        pcap = optarg;
+        break;
+      case 'l':
+        if (inet_pton(AF_INET, optarg, &ia) != 1) {
+          fprintf(stderr, "flextoe-cachesim: invalid address %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        local_ip = ntohl(ia.s_addr);
+        break;
+      case 'c':
+        conns = atoi(optarg);
+        break;
+      case 'z':
+        skew = atof(optarg);
+        break;
+      case 'b':
+        burst = atof(optarg);
+        break;
+      case 't':
+        tx_frac = atof(optarg);
+        break;
+      case 'n':
+        segs = strtoull(optarg, NULL, 10);
+        break;
+      case 's':
+        seed = strtoull(optarg, NULL, 10);
+        break;
+      case 'f':
+      case 'k':
+        if ((opt == 'f' ? fh_num : conn_num) == CACHES_MAX) {
+          fprintf(stderr, "flextoe-cachesim: too many caches\n");
+          return EXIT_FAILURE;
+        }
+        if (opt == 'f') {
+          fh_specs[fh_num++] = optarg;
+        } else {
+          conn_specs[conn_num++] = optarg;
+        }
+        break;
+      case 'r':
+        rx_mes = atoi(optarg);
+        break;
+      case 'x':
+        tx_mes = atoi(optarg);
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (conns == 0 || burst < 1 || rx_mes == 0 || tx_mes == 0) {
+    fprintf(stderr, "flextoe-cachesim: invalid parameters\n");
+    return EXIT_FAILURE;
+  }
+  utils_rng_init(&rng, seed);
+
+  if (fh_num == 0) {
+    for (; fh_num < sizeof(fh_default) / sizeof(fh_default[0]); fh_num++) {
+      fh_specs[fh_num] = fh_default[fh_num];
+    }
+  }
+  if (conn_num == 0) {
+    for (; conn_num < sizeof(conn_default) / sizeof(conn_default[0]);
+        conn_num++)
+    {
+      conn_specs[conn_num] = conn_default[conn_num];
+    }
+  }
+  for (i = 0; i < fh_num; i++) {
+    if (cache_parse(&fh[i], fh_specs[i], rx_mes) != 0) {
+      return EXIT_FAILURE;
+    }
+  }
+  for (i = 0; i < conn_num; i++) {
+    if (cache_parse(&cc[i], conn_specs[i], NUM_FLOW_GROUPS * tx_mes) != 0) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  memset(&t, 0, sizeof(t));
+  if (pcap != NULL) {
+    if (trace_pcap(&t, pcap, local_ip) != 0) {
+      return EXIT_FAILURE;
+    }
+  } else if (trace_synth(&t, conns, skew, burst, tx_frac, segs) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  /* received segments go to any preprocess ME, segments to transmit to one
+   * of the MEs of the flow group's island; the flow id is the connection */
+  for (j = 0; j < t.num; j++) {
+    ev = &t.ev[j];
+    if (!ev->tx) {
+      rx++;
+      me = utils_rng_gen32(&rng) % rx_mes;
+      for (i = 0; i < fh_num; i++) {
+        cache_access(&fh[i], me, t.conns[ev->conn].hash, ev->conn);
+      }
+    } else {
+      grp = t.conns[ev->conn].hash & (NUM_FLOW_GROUPS - 1);
+      me = grp * tx_mes + utils_rng_gen32(&rng) % tx_mes;
+      for (i = 0; i < conn_num; i++) {
+        cache_access(&cc[i], me, ev->conn, ev->conn);
+      }
+    }
+  }
+
+  printf("%zu segments (%"PRIu64" received), %u connections, %u RX MEs, "
+      "%u TX MEs per flow group\n", t.num, rx, t.conns_num, rx_mes, tx_mes);
+  print_caches("flowhash_cache (RX, miss: 2 IMEM accesses)", fh, fh_num, 2,
+      2 * CYC_IMEM, "IMEM reads");
+  print_caches("conn_cache (TX, miss: 1 EMEM access)", cc, conn_num, 1,
+      CYC_EMEM, "EMEM reads");
+
+  for (i = 0; i < fh_num; i++) {
+    cache_free(&fh[i]);
+  }
+  for (i = 0; i < conn_num; i++) {
+    cache_free(&cc[i]);
+  }
+  free(t.ev);
+  free(t.conns);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,692 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * @brief Drain and analyze the slowpath congestion control trace.
+ * @file flextoe-cctrace.c
+ *
+ * drain copies records from the trace region (see sp_cctrace.h) into a trace
+ * file or CSV while the slowpath runs. analyze reads a trace file and reports
+ * per-flow statistics, how long each flow took to converge to its final
+ * rate, and Jain's fairness index over time, optionally writing gnuplot data
+ * and a script that plots both.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "connect.h"
+#include "sp_cctrace.h"
+
+#define DRAIN_BATCH 4096
+
+static const char *cc_names[] = {
+  "dctcp-win", "dctcp-rate", "timely", "const-rate",
+};
+
+static volatile int stop = 0;
+
+static void handle_signal(int signo)
+{
+  stop = 1;
+}
+
+static const char *cc_name(uint32_t alg)
+{
+  return alg < sizeof(cc_names) / sizeof(cc_names[0]) ? cc_names[alg] :
+    "unknown";
+}
+
+static void csv_head(FILE *f)
+{
+  fprintf(f, "ts_us,flow_id,rtt_us,rate_kbps,window,ecn_frac,cc_state,ackb,"
+      "ecnb,acks,drops,rexmit,tlp,slowstart\n");
+}
+
+static void csv_rec(FILE *f, const struct sp_cctrace_rec *r)
+{
+  fprintf(f, "%u,%u,%u,%u,%u,%.4f,%u,%u,%u,%u,%u,%u,%u,%u\n", r->ts_us,
+      r->flow_id, r->rtt, r->rate, r->window,
+      r->ackb != 0 ? (double) r->ecnb / r->ackb : 0.0, r->cc_state, r->ackb,
+      r->ecnb, r->acks, r->drops, !!(r->flags & SP_CCTRACE_F_REXMIT),
+      !!(r->flags & SP_CCTRACE_F_TLP), !!(r->flags & SP_CCTRACE_F_SLOWSTART));
+}
+
+/*****************************************************************************/
+/* drain */
+
+static const struct sp_cctrace *map_trace(void)
+{
+  char path[PATH_MAX];
+  const struct sp_cctrace *t;
+  struct stat st;
+  void *p;
+  int fd;
+
+  snprintf(path, PATH_MAX, "%s/%s", FLEXNIC_SHM_PREFIX, FLEXNIC_NAME_CCTRACE);
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    fprintf(stderr, "flextoe-cctrace: opening %s failed: %s (is the "
+        "slowpath running with --cc-trace-sample?)\n", path, strerror(errno));
+    return NULL;
+  }
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(struct sp_cctrace_hdr)) {
+    fprintf(stderr, "flextoe-cctrace: %s too small\n", path);
+    close(fd);
+    return NULL;
+  }
+
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror("flextoe-cctrace: mmap failed");
+    return NULL;
+  }
+
+  t = p;
+  if (t->hdr.magic != SP_CCTRACE_MAGIC) {
+    fprintf(stderr, "flextoe-cctrace: region not initialized\n");
+    return NULL;
+  }
+  if (t->hdr.version != SP_CCTRACE_VERSION ||
+      t->hdr.size != sp_cctrace_size(t->hdr.rec_num) ||
+      st.st_size < t->hdr.size)
+  {
+    fprintf(stderr, "flextoe-cctrace: version mismatch (region v%u, tool "
+        "v%u)\n", t->hdr.version, SP_CCTRACE_VERSION);
+    return NULL;
+  }
+  return t;
+}
+
+static int drain(int argc, char *argv[])
+{
+  const struct sp_cctrace *t;
+  struct sp_cctrace_rec *buf;
+  struct sp_cctrace_file fh;
+  struct timespec start, now;
+  const char *path = NULL;
+  FILE *out = stdout;
+  uint64_t pos, head, valid, n, skip, written = 0, lost = 0;
+  uint32_t mask, idx, chunk, i;
+  unsigned duration = 0, interval_ms = 10;
+  int csv = 0, opt;
+
+  while ((opt = getopt(argc, argv, "o:cd:i:")) != -1) {
+    switch (opt) {
+      case 'o':
+        path = optarg;
+        break;
+      case 'c':
+        csv = 1;
+        break;
+      case 'd':
+        duration = atoi(optarg);
+        break;
+      case 'i':
+        interval_ms = atoi(optarg);
+        break;
+      default:
+        return -1;
+    }
+  }
+  if (path == NULL && !csv && isatty(STDOUT_FILENO)) {
+    fprintf(stderr, "flextoe-cctrace: not writing a binary trace to a "
+        "terminal, use -o or -c\n");
+    return -1;
+  }
+
+  if ((t = map_trace()) == NULL) {
+    return -1;
+  }
+  if (path != NULL && (out = fopen(path, "w")) == NULL) {
+    fprintf(stderr, "flextoe-cctrace: opening %s failed: %s\n", path,
+        strerror(errno));
+    return -1;
+  }
+  if ((buf = malloc(DRAIN_BATCH * sizeof(*buf))) == NULL) {
+    perror("flextoe-cctrace: malloc failed");
+    return -1;
+  }
+
+  if (csv) {
+    csv_head(out);
+  } else {
+    memset(&fh, 0, sizeof(fh));
+    fh.magic = SP_CCTRACE_FILE_MAGIC;
+    fh.version = SP_CCTRACE_VERSION;
+    fh.rec_size = sizeof(struct sp_cctrace_rec);
+    fh.cc_algorithm = t->hdr.cc_algorithm;
+    fh.sample = t->hdr.sample;
+    fh.interval = t->hdr.interval;
+    fwrite(&fh, sizeof(fh), 1, out);
+  }
+
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  /* start with the oldest record still in the ring */
+  mask = t->hdr.rec_num - 1;
+  head = t->hdr.head;
+  pos = (head > t->hdr.rec_num ? head - t->hdr.rec_num : 0);
+
+  while (!stop) {
+    head = t->hdr.head;
+    __sync_synchronize();
+
+    if (head == pos) {
+      fflush(out);
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if (duration != 0 && now.tv_sec - start.tv_sec >= duration) {
+        break;
+      }
+      usleep(interval_ms * 1000);
+      continue;
+    }
+
+    /* fell behind by more than the ring */
+    if (head - pos > t->hdr.rec_num) {
+      lost += head - t->hdr.rec_num - pos;
+      pos = head - t->hdr.rec_num;
+    }
+
+    n = head - pos;
+    if (n > DRAIN_BATCH) {
+      n = DRAIN_BATCH;
+    }
+    idx = pos & mask;
+    chunk = (n < t->hdr.rec_num - idx ? n : t->hdr.rec_num - idx);
+    memcpy(buf, &t->recs[idx], chunk * sizeof(*buf));
+    memcpy(buf + chunk, &t->recs[0], (n - chunk) * sizeof(*buf));
+    __sync_synchronize();
+
+    /* drop what the slowpath overwrote while copying, including the slot of
+     * the unpublished record it may be writing right now */
+    head = t->hdr.head + 1;
+    valid = (head > t->hdr.rec_num ? head - t->hdr.rec_num : 0);
+    skip = 0;
+    if (valid > pos) {
+      skip = (valid - pos < n ? valid - pos : n);
+      lost += skip;
+    }
+
+    if (csv) {
+      for (i = skip; i < n; i++) {
+        csv_rec(out, &buf[i]);
+      }
+    } else {
+      fwrite(buf + skip, sizeof(*buf), n - skip, out);
+    }
+    written += n - skip;
+    pos += n;
+  }
+
+  fflush(out);
+  if (out != stdout) {
+    fclose(out);
+  }
+  fprintf(stderr, "flextoe-cctrace: %"PRIu64" records, %"PRIu64" lost\n",
+      written, lost);
+  free(buf);
+  return 0;
+}
+
+/*****************************************************************************/
+/* Trace files */
+
+struct trace {
+  struct sp_cctrace_file hdr;
+  struct sp_cctrace_rec *recs;
+  uint64_t *ts;                   /*> unwrapped timestamps [us] */
+  size_t num;
+};
+
+static int trace_read(const char *path, struct trace *tr)
+{
+  FILE *f;
+  size_t cap = 0;
+  uint64_t ts = 0;
+  uint32_t prev = 0;
+
+  if ((f = fopen(path, "r")) == NULL) {
+    fprintf(stderr, "flextoe-cctrace: opening %s failed: %s\n", path,
+        strerror(errno));
+    return -1;
+  }
+  if (fread(&tr->hdr, sizeof(tr->hdr), 1, f) != 1 ||
+      tr->hdr.magic != SP_CCTRACE_FILE_MAGIC ||
+      tr->hdr.version != SP_CCTRACE_VERSION ||
+      tr->hdr.rec_size != sizeof(struct sp_cctrace_rec))
+  {
+    fprintf(stderr, "flextoe-cctrace: %s is not a v%u trace file\n", path,
+        SP_CCTRACE_VERSION);
+    fclose(f);
+    return -1;
+  }
+
+  tr->recs = NULL;
+  tr->ts = NULL;
+  tr->num = 0;
+  for (;;) {
+    if (tr->num == cap) {
+      cap = (cap == 0 ? 4096 : cap * 2);
+      tr->recs = realloc(tr->recs, cap * sizeof(*tr->recs));
+      tr->ts = realloc(tr->ts, cap * sizeof(*tr->ts));
+      if (tr->recs == NULL || tr->ts == NULL) {
+        perror("flextoe-cctrace: realloc failed");
+        fclose(f);
+        return -1;
+      }
+    }
+    if (fread(&tr->recs[tr->num], sizeof(*tr->recs), 1, f) != 1) {
+      break;
+    }
+
+    /* 32-bit slowpath timestamps wrap after about 71 minutes */
+    if (tr->num > 0 && (int32_t) (tr->recs[tr->num].ts_us - prev) > 0) {
+      ts += (uint32_t) (tr->recs[tr->num].ts_us - prev);
+    }
+    prev = tr->recs[tr->num].ts_us;
+    tr->ts[tr->num++] = ts;
+  }
+
+  fclose(f);
+  return 0;
+}
+
+static int csv(int argc, char *argv[])
+{
+  struct trace tr;
+  size_t i;
+
+  if (optind >= argc) {
+    return -1;
+  }
+  if (trace_read(argv[optind], &tr) != 0) {
+    return -1;
+  }
+
+  csv_head(stdout);
+  for (i = 0; i < tr.num; i++) {
+    csv_rec(stdout, &tr.recs[i]);
+  }
+  return 0;
+}
+
+/*****************************************************************************/
+/* analyze */
+
+struct flow {
+  uint32_t flow_id;
+  size_t *idx;                    /*> records of this flow, in time order */
+  size_t num;
+  size_t cap;
+  uint64_t ackb;
+  uint64_t ecnb;
+  uint64_t drops;
+  uint32_t rexmits;
+  uint32_t tlps;
+  int64_t ss_exit;                /*> slow start exit [us], -1 if never */
+  int64_t converged;              /*> converged after [us], -1 if never */
+  double rate_final;              /*> mean rate in the last quarter [kbps] */
+  double rate_cv;                 /*> coefficient of variation, ditto */
+  double rtt_mean;
+};
+
+static struct flow *flow_get(struct flow **flows, size_t *num, size_t *cap,
+    uint32_t flow_id)
+{
+  struct flow *f;
+  size_t i;
+
+  /* traces hold a few sampled flows, a linear search will do */
+  for (i = 0; i < *num; i++) {
+    if ((*flows)[i].flow_id == flow_id) {
+      return &(*flows)[i];
+    }
+  }
+
+  if (*num == *cap) {
+    *cap = (*cap == 0 ? 64 : *cap * 2);
+    if ((*flows = realloc(*flows, *cap * sizeof(**flows))) == NULL) {
+      return NULL;
+    }
+  }
+  f = &(*flows)[(*num)++];
+  memset(f, 0, sizeof(*f));
+  f->flow_id = flow_id;
+  f->ss_exit = -1;
+  f->converged = -1;
+  return f;
+}
+
+/** Convergence: time after which all rates stay within tol of the final one */
+static void flow_analyze(const struct trace *tr, struct flow *f, double tol)
+{
+  size_t i, tail = f->num - (f->num >= 4 ? f->num / 4 : 1);
+  double sum = 0, sq = 0, r, rtt = 0;
+  uint64_t t0 = tr->ts[f->idx[0]];
+  int ss = 1;
+
+  for (i = 0; i < f->num; i++) {
+    const struct sp_cctrace_rec *rec = &tr->recs[f->idx[i]];
+
+    f->ackb += rec->ackb;
+    f->ecnb += rec->ecnb;
+    f->drops += rec->drops;
+    f->rexmits += !!(rec->flags & SP_CCTRACE_F_REXMIT);
+    f->tlps += !!(rec->flags & SP_CCTRACE_F_TLP);
+    rtt += rec->rtt;
+    if (ss && !(rec->flags & SP_CCTRACE_F_SLOWSTART)) {
+      ss = 0;
+      f->ss_exit = (i == 0 ? -1 : tr->ts[f->idx[i]] - t0);
+    }
+    if (i >= tail) {
+      sum += rec->rate;
+      sq += (double) rec->rate * rec->rate;
+    }
+  }
+  f->rtt_mean = rtt / f->num;
+
+  f->rate_final = sum / (f->num - tail);
+  r = sq / (f->num - tail) - f->rate_final * f->rate_final;
+  f->rate_cv = (f->rate_final > 0 && r > 0 ? sqrt(r) / f->rate_final :
+      0);
+
+  for (i = f->num; i > 0; i--) {
+    r = tr->recs[f->idx[i - 1]].rate;
+    if (r < f->rate_final * (1 - tol) || r > f->rate_final * (1 + tol)) {
+      break;
+    }
+  }
+  if (i < f->num) {
+    f->converged = tr->ts[f->idx[i]] - t0;
+  }
+}
+
+static double jain(const double *x, size_t n)
+{
+  double sum = 0, sq = 0;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    sum += x[i];
+    sq += x[i] * x[i];
+  }
+  return (sq > 0 ? sum * sum / (n * sq) : 1);
+}
+
+static int plot_write(const char *prefix, const struct trace *tr,
+    const struct flow *flows, size_t num_flows, const double *fair_t,
+    const double *fair_j, const unsigned *fair_n, const double *fair_tot,
+    size_t num_win)
+{
+  char path[PATH_MAX];
+  FILE *f;
+  size_t i, j;
+  uint64_t t0 = tr->ts[0];
+
+  snprintf(path, sizeof(path), "%s-rates.dat", prefix);
+  if ((f = fopen(path, "w")) == NULL) {
+    goto error;
+  }
+  /* one gnuplot data set per flow */
+  for (i = 0; i < num_flows; i++) {
+    fprintf(f, "# flow %u\n# t_s rate_mbps rtt_us ecn_frac\n",
+        flows[i].flow_id);
+    for (j = 0; j < flows[i].num; j++) {
+      const struct sp_cctrace_rec *r = &tr->recs[flows[i].idx[j]];
+      fprintf(f, "%.6f %.3f %u %.4f\n",
+          (tr->ts[flows[i].idx[j]] - t0) / 1e6, r->rate / 1e3, r->rtt,
+          r->ackb != 0 ? (double) r->ecnb / r->ackb : 0.0);
+    }
+    fprintf(f, "\n\n");
+  }
+  fclose(f);
+
+  snprintf(path, sizeof(path), "%s-fairness.dat", prefix);
+  if ((f = fopen(path, "w")) == NULL) {
+    goto error;
+  }
+  fprintf(f, "# t_s jain flows total_mbps\n");
+  for (i = 0; i < num_win; i++) {
+    fprintf(f, "%.6f %.4f %u %.3f\n", fair_t[i], fair_j[i], fair_n[i],
+        fair_tot[i] / 1e3);
+  }
+  fclose(f);
+
+  snprintf(path, sizeof(path), "%s.gp", prefix);
+  if ((f = fopen(path, "w")) == NULL) {
+    goto error;
+  }
+  fprintf(f,
+      "# gnuplot %s.gp\n"
+      "set terminal pngcairo size 1200,900\n"
+      "set output '%s.png'\n"
+      "set multiplot layout 2,1\n"
+      "set xlabel 'time [s]'\n"
+      "set title 'Per-flow rate (%s)'\n"
+      "set ylabel 'rate [Mbps]'\n"
+      "plot for [i=0:%zu] '%s-rates.dat' index i using 1:2 with lines "
+          "notitle\n"
+      "set title 'Jain fairness index'\n"
+      "set ylabel 'J'\n"
+      "set yrange [0:1.05]\n"
+      "plot '%s-fairness.dat' using 1:2 with lines notitle\n"
+      "unset multiplot\n",
+      prefix, prefix, cc_name(tr->hdr.cc_algorithm),
+      num_flows > 0 ? num_flows - 1 : 0, prefix, prefix);
+  fclose(f);
+  return 0;
+
+error:
+  fprintf(stderr, "flextoe-cctrace: writing %s failed: %s\n", path,
+      strerror(errno));
+  return -1;
+}
+
+static int analyze(int argc, char *argv[])
+{
+  struct trace tr;
+  struct flow *flows = NULL, *f;
+  size_t num_flows = 0, cap_flows = 0, i, j, w, num_win;
+  double tol = 0.1, *win_sum, *fair_t, *fair_j, *fair_tot, *x, j_sum = 0;
+  double j_min = 1;
+  uint64_t *win_cnt, win_us = 100000, t0, t_end;
+  unsigned *fair_n, n;
+  const char *prefix = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "w:t:p:")) != -1) {
+    switch (opt) {
+      case 'w':
+        win_us = strtoull(optarg, NULL, 10) * 1000;
+        break;
+      case 't':
+        tol = atof(optarg) / 100;
+        break;
+      case 'p':
+        prefix = optarg;
+        break;
+      default:
+        return -1;
+    }
+  }
+  if (optind >= argc || win_us == 0 || tol <= 0) {
+    return -1;
+  }
+  if (trace_read(argv[optind], &tr) != 0) {
+    return -1;
+  }
+  if (tr.num == 0) {
+    fprintf(stderr, "flextoe-cctrace: empty trace\n");
+    return -1;
+  }
+
+  /* group records by flow, the file is in time order already */
+  for (i = 0; i < tr.num; i++) {
+    if ((f = flow_get(&flows, &num_flows, &cap_flows,
+            tr.recs[i].flow_id)) == NULL)
+    {
+      perror("flextoe-cctrace: realloc failed");
+      return -1;
+    }
+    if (f->num == f->cap) {
+      f->cap = (f->cap == 0 ? 64 : f->cap * 2);
+      if ((f->idx = realloc(f->idx, f->cap * sizeof(*f->idx))) == NULL) {
+        perror("flextoe-cctrace: realloc failed");
+        return -1;
+      }
+    }
+    f->idx[f->num++] = i;
+  }
+
+  t0 = tr.ts[0];
+  t_end = tr.ts[tr.num - 1];
+  printf("%s, %zu records, %zu flows, %.3f s, every %u. flow id traced\n\n",
+      cc_name(tr.hdr.cc_algorithm), tr.num, num_flows, (t_end - t0) / 1e6,
+      tr.hdr.sample);
+  printf("%8s %8s %10s %10s %7s %8s %6s %7s %5s %10s %10s\n", "flow",
+      "samples", "rate_mbps", "rtt_us", "ecn", "drops", "retx", "tlp", "cv",
+      "ss_exit_ms", "conv_ms");
+
+  for (i = 0; i < num_flows; i++) {
+    f = &flows[i];
+    flow_analyze(&tr, f, tol);
+    printf("%8u %8zu %10.3f %10.1f %7.4f %8"PRIu64" %6u %7u %5.2f ",
+        f->flow_id, f->num, f->rate_final / 1e3, f->rtt_mean,
+        f->ackb != 0 ? (double) f->ecnb / f->ackb : 0.0, f->drops,
+        f->rexmits, f->tlps, f->rate_cv);
+    if (f->ss_exit >= 0) {
+      printf("%10.3f ", f->ss_exit / 1e3);
+    } else {
+      printf("%10s ", "-");
+    }
+    if (f->converged >= 0) {
+      printf("%10.3f\n", f->converged / 1e3);
+    } else {
+      printf("%10s\n", "-");
+    }
+  }
+
+  /* fairness: mean rate of each active flow per window */
+  num_win = (t_end - t0) / win_us + 1;
+  win_sum = calloc(num_flows, sizeof(*win_sum));
+  win_cnt = calloc(num_flows, sizeof(*win_cnt));
+  x = calloc(num_flows, sizeof(*x));
+  fair_t = calloc(num_win, sizeof(*fair_t));
+  fair_j = calloc(num_win, sizeof(*fair_j));
+  fair_tot = calloc(num_win, sizeof(*fair_tot));
+  fair_n = calloc(num_win, sizeof(*fair_n));
+  if (win_sum == NULL || win_cnt == NULL || x == NULL || fair_t == NULL ||
+      fair_j == NULL || fair_tot == NULL || fair_n == NULL)
+  {
+    perror("flextoe-cctrace: calloc failed");
+    return -1;
+  }
+
+  for (i = 0, w = 0; w < num_win; w++) {
+    memset(win_sum, 0, num_flows * sizeof(*win_sum));
+    memset(win_cnt, 0, num_flows * sizeof(*win_cnt));
+    for (; i < tr.num && tr.ts[i] - t0 < (w + 1) * win_us; i++) {
+      for (j = 0; flows[j].flow_id != tr.recs[i].flow_id; j++);
+      win_sum[j] += tr.recs[i].rate;
+      win_cnt[j]++;
+    }
+
+    for (j = 0, n = 0; j < num_flows; j++) {
+      if (win_cnt[j] > 0) {
+        x[n] = win_sum[j] / win_cnt[j];
+        fair_tot[w] += x[n++];
+      }
+    }
+    fair_t[w] = (w + 1) * win_us / 1e6;
+    fair_n[w] = n;
+    fair_j[w] = jain(x, n);
+    j_sum += fair_j[w];
+    if (fair_j[w] < j_min) {
+      j_min = fair_j[w];
+    }
+  }
+
+  printf("\nfairness over %zu windows of %.1f ms: jain mean %.4f min %.4f, "
+      "final %.4f with %u flows\n", num_win, win_us / 1e3, j_sum / num_win,
+      j_min, fair_j[num_win - 1], fair_n[num_win - 1]);
+  printf("converged: rate stays within %.0f%% of the mean of the last "
+      "quarter of the samples\n", tol * 100);
+
+  if (prefix != NULL) {
+    if (plot_write(prefix, &tr, flows, num_flows, fair_t, fair_j, fair_n,
+          fair_tot, num_win) != 0)
+    {
+      return -1;
+    }
+    printf("wrote %s-rates.dat, %s-fairness.dat; plot with gnuplot %s.gp\n",
+        prefix, prefix, prefix);
+  }
+  return 0;
+}
+
+/*****************************************************************************/
+
+static void print_usage(const char *progname)
+{
+  fprintf(stderr, "Usage: %s COMMAND [OPTION]...\n"
+      "\n"
+      "  drain [-o FILE] [-c] [-d SEC] [-i MS]\n"
+      "      Copy the trace of the running slowpath to FILE or stdout\n"
+      "      -c  CSV instead of a trace file\n"
+      "      -d  Stop after SEC seconds [default: on SIGINT]\n"
+      "      -i  Poll interval in ms [default: 10]\n"
+      "\n"
+      "  csv FILE\n"
+      "      Convert a trace file to CSV\n"
+      "\n"
+      "  analyze [-w MS] [-t PCT] [-p PREFIX] FILE\n"
+      "      Per-flow statistics, convergence and fairness\n"
+      "      -w  Fairness window in ms [default: 100]\n"
+      "      -t  Convergence tolerance in percent [default: 10]\n"
+      "      -p  Write PREFIX-rates.dat, PREFIX-fairness.dat and the gnuplot\n"
+      "          script PREFIX.gp\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret;
+
+  if (argc < 2) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  /* options follow the command */
+  optind = 2;
+  if (!strcmp(argv[1], "drain")) {
+    ret = drain(argc, argv);
+  } else if (!strcmp(argv[1], "csv")) {
+    ret = csv(argc, argv);
+  } else if (!strcmp(argv[1], "analyze")) {
+    ret = analyze(argc, argv);
+  } else {
+    ret = -1;
+  }
+
+  if (ret != 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
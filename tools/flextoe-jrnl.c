@@ -0,0 +1,623 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * @brief Decode and analyze fastpath journal dumps.
+ * @file flextoe-jrnl.c
+ *
+ * Reads a dump of the fastpath event journal as written by the jrnl console
+ * command (see fp_journal.h for the record format), puts the records back into
+ * time order across the ring wraparound and prints per-event rates, the
+ * largest gaps per pipeline stage and the latencies between stages: from a
+ * flow being scheduled by the queue manager to its segment reaching
+ * postprocessing, and from an ARX descriptor to the end of its DMA. Optionally
+ * the timeline of one flow is printed, or the whole journal is exported as
+ * Chrome trace JSON (chrome://tracing, Perfetto).
+ *
+ * With --synth a synthetic journal image is written instead, with a known
+ * stall, ring and timestamp wraparound, to check the decoder against.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <getopt.h>
+
+#include "util/rng.h"
+
+#include "params.h"
+#include "fp_journal.h"
+
+#define STAGE_NUM     5
+#define GAP_TOP       5       /*> Largest gaps printed per stage */
+#define DESC_NUM      65536
+
+struct jrnl_params {
+  const char *path;
+  const char *chrome;             /*> Chrome trace output */
+  uint32_t mhz;                   /*> ME clock */
+  uint32_t gap_us;                /*> Report gaps longer than this */
+  int64_t flow;                   /*> Flow to print, < 0: none */
+  uint32_t synth;                 /*> Records to synthesize, 0: decode */
+  uint32_t seed;
+};
+
+struct jrnl {
+  struct fp_jrnl_rec *recs;       /*> In time order */
+  size_t num;
+  size_t slots;
+  size_t invalid;                 /*> Slots not holding a record */
+  size_t oldest;                  /*> Slot of the oldest record */
+  int wrapped;
+  uint32_t ts_wraps;              /*> 32-bit timestamp wraparounds */
+  size_t reordered;               /*> Records older than their predecessor */
+};
+
+struct gap {
+  uint64_t ts;                    /*> End of the gap */
+  uint64_t len;
+};
+
+struct lat {
+  uint32_t *v;                    /*> [ticks] */
+  size_t num;
+  size_t cap;
+};
+
+static const char *stage_names[STAGE_NUM] = {
+  "qman", "postproc", "atx", "arx", "dma_arx",
+};
+
+static struct utils_rng rng;
+
+static int cmp_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+static int cmp_rec(const void *a, const void *b)
+{
+  const struct fp_jrnl_rec *x = a, *y = b;
+
+  return (x->ts > y->ts) - (x->ts < y->ts);
+}
+
+static int stage_idx(unsigned ev)
+{
+  int i;
+
+  for (i = 0; i < STAGE_NUM; i++) {
+    if (strcmp(stage_names[i], fp_jrnl_ev_stage(ev)) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static double ticks_us(const struct jrnl_params *p, uint64_t ticks)
+{
+  return (double) ticks * FP_JRNL_TICK_CYC / p->mhz;
+}
+
+static int lat_add(struct lat *l, uint64_t v)
+{
+  uint32_t *n;
+
+  if (l->num == l->cap) {
+    l->cap = (l->cap == 0 ? 1024 : l->cap * 2);
+    if ((n = realloc(l->v, l->cap * sizeof(*n))) == NULL) {
+      fprintf(stderr, "lat_add: realloc failed\n");
+      return -1;
+    }
+    l->v = n;
+  }
+  l->v[l->num++] = (v > UINT32_MAX ? UINT32_MAX : v);
+  return 0;
+}
+
+/** Read the dump and put the records into time order */
+static int jrnl_load(const struct jrnl_params *p, struct jrnl *j)
+{
+  FILE *f;
+  uint32_t *words, *ts, prev;
+  uint8_t *valid;
+  size_t len, i, k, n;
+  struct fp_jrnl_rec r;
+  uint64_t ts64;
+  int ret = -1;
+
+  if ((f = fopen(p->path, "rb")) == NULL) {
+    perror("jrnl_load: fopen failed");
+    return -1;
+  }
+  fseek(f, 0, SEEK_END);
+  len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  j->slots = len / FP_JRNL_BYTES;
+  words = malloc(j->slots * FP_JRNL_BYTES + 1);
+  ts = calloc(j->slots + 1, sizeof(*ts));
+  valid = calloc(j->slots + 1, sizeof(*valid));
+  j->recs = calloc(j->slots + 1, sizeof(*j->recs));
+  if (words == NULL || ts == NULL || valid == NULL || j->recs == NULL) {
+    fprintf(stderr, "jrnl_load: malloc failed\n");
+    goto out;
+  }
+  if (fread(words, FP_JRNL_BYTES, j->slots, f) != j->slots) {
+    fprintf(stderr, "jrnl_load: short read from %s\n", p->path);
+    goto out;
+  }
+  if (len % FP_JRNL_BYTES != 0) {
+    fprintf(stderr, "jrnl_load: ignoring %zu trailing bytes\n",
+        len % FP_JRNL_BYTES);
+  }
+
+  for (i = 0; i < j->slots; i++) {
+    if (fp_jrnl_decode(&words[i * FP_JRNL_WORDS], &r) == 0) {
+      valid[i] = 1;
+      ts[i] = r.ts;
+    } else {
+      j->invalid++;
+    }
+  }
+
+  j->oldest = fp_jrnl_oldest(ts, valid, j->slots);
+  for (i = 0; i < j->oldest && !valid[i]; i++);
+  j->wrapped = (i < j->oldest);
+
+  /* unwrap timestamps in ring order, small steps back are races for the
+   * tail and get sorted out below */
+  n = 0;
+  ts64 = 0;
+  prev = 0;
+  for (k = 0; k < j->slots; k++) {
+    i = (j->oldest + k) % j->slots;
+    if (!valid[i]) {
+      continue;
+    }
+    fp_jrnl_decode(&words[i * FP_JRNL_WORDS], &r);
+    if (n == 0) {
+      ts64 = 1ull << 40;
+    } else {
+      if ((uint32_t) r.ts < prev) {
+        if ((int32_t) ((uint32_t) r.ts - prev) >= 0) {
+          j->ts_wraps++;
+        } else {
+          j->reordered++;
+        }
+      }
+      ts64 += (int64_t) (int32_t) ((uint32_t) r.ts - prev);
+    }
+    prev = r.ts;
+    r.ts = ts64;
+    j->recs[n++] = r;
+  }
+  j->num = n;
+
+  /* rebase so the sort below sees no negative steps */
+  if (n > 0) {
+    uint64_t min = j->recs[0].ts;
+
+    for (i = 1; i < n; i++) {
+      if (j->recs[i].ts < min) {
+        min = j->recs[i].ts;
+      }
+    }
+    for (i = 0; i < n; i++) {
+      j->recs[i].ts -= min;
+    }
+  }
+  qsort(j->recs, n, sizeof(*j->recs), cmp_rec);
+  ret = 0;
+
+out:
+  free(valid);
+  free(ts);
+  free(words);
+  fclose(f);
+  return ret;
+}
+
+static void print_lat(const struct jrnl_params *p, const char *name,
+    struct lat *l)
+{
+  if (l->num == 0) {
+    printf("%-24s %10s\n", name, "-");
+    return;
+  }
+  qsort(l->v, l->num, sizeof(*l->v), cmp_u32);
+  printf("%-24s %10zu %9.2f %9.2f %9.2f %9.2f\n", name, l->num,
+      ticks_us(p, l->v[l->num / 2]),
+      ticks_us(p, l->v[(uint64_t) l->num * 99 / 100]),
+      ticks_us(p, l->v[(uint64_t) l->num * 999 / 1000]),
+      ticks_us(p, l->v[l->num - 1]));
+}
+
+/* keep the GAP_TOP largest gaps, sorted by length */
+static void gap_add(struct gap *top, uint64_t ts, uint64_t len)
+{
+  int i;
+
+  if (len <= top[GAP_TOP - 1].len) {
+    return;
+  }
+  for (i = GAP_TOP - 1; i > 0 && top[i - 1].len < len; i--) {
+    top[i] = top[i - 1];
+  }
+  top[i].ts = ts;
+  top[i].len = len;
+}
+
+static int analyze(const struct jrnl_params *p, const struct jrnl *j)
+{
+  static uint64_t desc_arx[DESC_NUM], desc_issue[DESC_NUM];
+  uint64_t counts[FP_JRNL_EV_NUM] = { 0 }, last[STAGE_NUM] = { 0 };
+  uint64_t *flow_sched, span, gap_ticks, stalls[STAGE_NUM] = { 0 };
+  struct gap top[STAGE_NUM][GAP_TOP];
+  struct lat qm_post = { 0 }, arx_issue = { 0 }, issue_done = { 0 };
+  const struct fp_jrnl_rec *r;
+  size_t i;
+  int s, k, ret = -1;
+
+  memset(top, 0, sizeof(top));
+  memset(desc_arx, 0, sizeof(desc_arx));
+  memset(desc_issue, 0, sizeof(desc_issue));
+  if ((flow_sched = calloc(FLEXNIC_PL_FLOWST_NUM, sizeof(*flow_sched)))
+      == NULL)
+  {
+    fprintf(stderr, "analyze: calloc failed\n");
+    return -1;
+  }
+
+  span = (j->num > 0 ? j->recs[j->num - 1].ts - j->recs[0].ts : 0);
+  gap_ticks = (uint64_t) p->gap_us * p->mhz / FP_JRNL_TICK_CYC;
+
+  /* timestamps are stored + 1, 0 marks no pending event */
+  for (i = 0; i < j->num; i++) {
+    r = &j->recs[i];
+    counts[r->ev]++;
+
+    if ((s = stage_idx(r->ev)) >= 0) {
+      if (last[s] != 0) {
+        gap_add(top[s], r->ts, r->ts + 1 - last[s]);
+        if (r->ts + 1 - last[s] >= gap_ticks) {
+          stalls[s]++;
+        }
+      }
+      last[s] = r->ts + 1;
+    }
+
+    switch (r->ev) {
+      case FP_JRNL_QM_DRR:
+      case FP_JRNL_QM_SLOT:
+      case FP_JRNL_QM_DELACK:
+        if (r->a0 < FLEXNIC_PL_FLOWST_NUM && flow_sched[r->a0] == 0) {
+          flow_sched[r->a0] = r->ts + 1;
+        }
+        break;
+      case FP_JRNL_POST_TX:
+        if (r->a0 < FLEXNIC_PL_FLOWST_NUM && flow_sched[r->a0] != 0) {
+          if (lat_add(&qm_post, r->ts + 1 - flow_sched[r->a0]) != 0) {
+            goto out;
+          }
+          flow_sched[r->a0] = 0;
+        }
+        break;
+      case FP_JRNL_ARX:
+        desc_arx[r->a1 % DESC_NUM] = r->ts + 1;
+        break;
+      case FP_JRNL_DMA_ARX_ISSUE:
+        k = r->a0 % DESC_NUM;
+        if (desc_arx[k] != 0) {
+          if (lat_add(&arx_issue, r->ts + 1 - desc_arx[k]) != 0) {
+            goto out;
+          }
+          desc_arx[k] = 0;
+        }
+        desc_issue[k] = r->ts + 1;
+        break;
+      case FP_JRNL_DMA_ARX_DONE:
+        k = r->a0 % DESC_NUM;
+        if (desc_issue[k] != 0) {
+          if (lat_add(&issue_done, r->ts + 1 - desc_issue[k]) != 0) {
+            goto out;
+          }
+          desc_issue[k] = 0;
+        }
+        break;
+    }
+  }
+
+  printf("%zu records in %zu slots, %zu invalid, span %.2f us\n", j->num,
+      j->slots, j->invalid, ticks_us(p, span));
+  printf("ring %s, oldest record in slot %zu, %u timestamp wraparounds, "
+      "%zu records out of order\n", j->wrapped ? "wrapped" : "not wrapped",
+      j->oldest, j->ts_wraps, j->reordered);
+
+  printf("\n%-24s %10s %12s\n", "event", "records", "rate[M/s]");
+  for (k = 1; k < FP_JRNL_EV_NUM; k++) {
+    printf("%-24s %10" PRIu64 " %12.3f\n", fp_jrnl_ev_name(k), counts[k],
+        span == 0 ? 0 : counts[k] / ticks_us(p, span));
+  }
+
+  printf("\n%-24s %10s %9s %9s %9s %9s\n", "latency", "samples", "p50[us]",
+      "p99[us]", "p99.9[us]", "max[us]");
+  print_lat(p, "qm -> postproc_tx", &qm_post);
+  print_lat(p, "arx -> dma_arx_issue", &arx_issue);
+  print_lat(p, "dma_arx_issue -> done", &issue_done);
+
+  printf("\nlargest gaps per stage, stalls are gaps of at least %u us\n",
+      p->gap_us);
+  for (s = 0; s < STAGE_NUM; s++) {
+    if (top[s][0].len == 0) {
+      continue;
+    }
+    printf("%-10s %6" PRIu64 " stalls:", stage_names[s], stalls[s]);
+    for (k = 0; k < GAP_TOP && top[s][k].len != 0; k++) {
+      printf(" %.2f us @%.2f", ticks_us(p, top[s][k].len),
+          ticks_us(p, top[s][k].ts - top[s][k].len));
+    }
+    printf("\n");
+  }
+  ret = 0;
+
+out:
+  free(issue_done.v);
+  free(arx_issue.v);
+  free(qm_post.v);
+  free(flow_sched);
+  return ret;
+}
+
+static void print_flow(const struct jrnl_params *p, const struct jrnl *j)
+{
+  const struct fp_jrnl_rec *r;
+  uint64_t prev = UINT64_MAX;
+  size_t i;
+
+  printf("\ntimeline of flow %" PRId64 "\n", p->flow);
+  printf("%12s %10s %-14s %-10s %10s\n", "ts[us]", "delta[us]", "event",
+      "me", "arg");
+  for (i = 0; i < j->num; i++) {
+    r = &j->recs[i];
+    if (!fp_jrnl_ev_flow(r->ev) || r->a0 != p->flow) {
+      continue;
+    }
+    printf("%12.3f %10.3f %-14s i%u.me%u.%u %#10x\n", ticks_us(p, r->ts),
+        prev == UINT64_MAX ? 0 : ticks_us(p, r->ts - prev),
+        fp_jrnl_ev_name(r->ev), r->island, r->me, r->ctx, r->a1);
+    prev = r->ts;
+  }
+}
+
+/**
+ * Chrome trace: one process per island and one thread per ME context, with
+ * an instant event per record. DMA of ARX descriptors is shown as a complete
+ * event per descriptor in its own process.
+ */
+static int export_chrome(const struct jrnl_params *p, const struct jrnl *j)
+{
+  static uint64_t issue[DESC_NUM];
+  static uint8_t named[64][16 * 8];
+  const struct fp_jrnl_rec *r;
+  const char *sep = "";
+  uint32_t k;
+  size_t i;
+  FILE *f;
+
+  if ((f = fopen(p->chrome, "w")) == NULL) {
+    perror("export_chrome: fopen failed");
+    return -1;
+  }
+  memset(issue, 0, sizeof(issue));
+  memset(named, 0, sizeof(named));
+
+  fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+      "\"args\":{\"name\":\"dma_arx descriptors\"}}");
+  sep = ",\n";
+
+  for (i = 0; i < j->num; i++) {
+    r = &j->recs[i];
+    k = r->me * 8 + r->ctx;
+    if (!named[r->island & 63][k]) {
+      named[r->island & 63][k] = 1;
+      fprintf(f, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,"
+          "\"args\":{\"name\":\"i%u\"}}", sep, r->island, r->island);
+      fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,"
+          "\"tid\":%u,\"args\":{\"name\":\"me%u.%u %s\"}}", sep, r->island,
+          k, r->me, r->ctx, fp_jrnl_ev_stage(r->ev));
+    }
+
+    fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+        "\"ts\":%.3f,\"pid\":%u,\"tid\":%u,\"args\":{\"a0\":%u,\"a1\":%u}}",
+        sep, fp_jrnl_ev_name(r->ev), fp_jrnl_ev_stage(r->ev),
+        ticks_us(p, r->ts), r->island, k, r->a0, r->a1);
+
+    if (r->ev == FP_JRNL_DMA_ARX_ISSUE) {
+      issue[r->a0 % DESC_NUM] = r->ts + 1;
+    } else if (r->ev == FP_JRNL_DMA_ARX_DONE &&
+        issue[r->a0 % DESC_NUM] != 0)
+    {
+      fprintf(f, "%s{\"name\":\"desc %u\",\"cat\":\"dma_arx\",\"ph\":\"X\","
+          "\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%u}", sep, r->a0,
+          ticks_us(p, issue[r->a0 % DESC_NUM] - 1),
+          ticks_us(p, r->ts + 1 - issue[r->a0 % DESC_NUM]), r->a0 % 64);
+      issue[r->a0 % DESC_NUM] = 0;
+    }
+  }
+  fprintf(f, "\n]}\n");
+
+  if (fclose(f) != 0) {
+    perror("export_chrome: fclose failed");
+    return -1;
+  }
+  return 0;
+}
+
+static void synth_put(uint32_t *img, size_t slots, uint64_t *pos,
+    unsigned ev, unsigned isl, unsigned me, unsigned ctx, uint32_t ts,
+    uint32_t a0, uint32_t a1)
+{
+  uint32_t *w = &img[(*pos % slots) * FP_JRNL_WORDS];
+
+  w[0] = FP_JRNL_HDR(ev, ((isl - 32) << 4) | (me + 4), ctx);
+  w[1] = ts;
+  w[2] = a0;
+  w[3] = a1;
+  (*pos)++;
+}
+
+/**
+ * Synthetic image: flows scheduled by the queue manager reach postprocessing
+ * 2-4 us later, ARX descriptors are DMAed 1-2 us later. The timestamp wraps
+ * around after 3/4 of the records and the pipeline stalls for 500 us after
+ * 7/8, more records than slots wrap the ring.
+ */
+static int synth(const struct jrnl_params *p)
+{
+  size_t slots = JOURNAL_SIZE / FP_JRNL_BYTES;
+  uint32_t *img, ts, step = p->mhz / FP_JRNL_TICK_CYC, flow, desc = 1;
+  uint64_t pos = 0;
+  FILE *f;
+  int ret = -1;
+
+  if ((img = calloc(slots, FP_JRNL_BYTES)) == NULL) {
+    fprintf(stderr, "synth: calloc failed\n");
+    return -1;
+  }
+
+  ts = -(uint32_t) ((uint64_t) p->synth * 3 / 4 * step);
+  while (pos < p->synth) {
+    if (pos / 5 == p->synth / 5 * 7 / 8) {
+      ts += 500 * step;
+    }
+
+    flow = utils_rng_gen32(&rng) % 64;
+    synth_put(img, slots, &pos, FP_JRNL_QM_SLOT, 36, 0,
+        5 + utils_rng_gen32(&rng) % 3, ts, flow, flow);
+    synth_put(img, slots, &pos, FP_JRNL_ARX, 36, 3,
+        utils_rng_gen32(&rng) % 8, ts + 1, utils_rng_gen32(&rng) % 32, desc);
+    synth_put(img, slots, &pos, FP_JRNL_DMA_ARX_ISSUE, 36, 4,
+        utils_rng_gen32(&rng) % 8, ts + step + utils_rng_gen32(&rng) % step,
+        desc, desc << 5);
+    synth_put(img, slots, &pos, FP_JRNL_POST_TX,
+        32 + utils_rng_gen32(&rng) % 4, 6, utils_rng_gen32(&rng) % 8,
+        ts + 2 * step + utils_rng_gen32(&rng) % (2 * step), flow, pos);
+    synth_put(img, slots, &pos, FP_JRNL_DMA_ARX_DONE, 36, 4,
+        utils_rng_gen32(&rng) % 8,
+        ts + 4 * step + utils_rng_gen32(&rng) % step, desc, desc << 5);
+
+    desc = desc % (DESC_NUM - 1) + 1;
+    ts += 5 * step;
+  }
+
+  if ((f = fopen(p->path, "wb")) == NULL) {
+    perror("synth: fopen failed");
+    goto out;
+  }
+  if (fwrite(img, FP_JRNL_BYTES, slots, f) != slots) {
+    perror("synth: fwrite failed");
+    fclose(f);
+    goto out;
+  }
+  fclose(f);
+  printf("%" PRIu64 " records in %zu slots, stall of 500 us after %" PRIu64
+      " records\n", pos, slots, (uint64_t) p->synth / 5 * 7 / 8 * 5);
+  ret = 0;
+
+out:
+  free(img);
+  return ret;
+}
+
+static void print_usage(const char *progname)
+{
+  fprintf(stderr, "Usage: %s [OPTION]... FILE\n"
+      "  -c, --chrome=OUT    Write Chrome trace JSON to OUT\n"
+      "  -f, --flow=ID       Print the timeline of flow ID\n"
+      "  -g, --gap=US        Count gaps of at least US as stalls "
+          "[default: 100]\n"
+      "  -m, --mhz=MHZ       ME clock [default: 800]\n"
+      "  -S, --synth=N       Write a synthetic image of N records to FILE\n"
+      "  -s, --seed=N        Random seed for --synth [default: 1]\n"
+      "  -h, --help          Show this help\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+  static const struct option opts[] = {
+    { "chrome", required_argument, NULL, 'c' },
+    { "flow", required_argument, NULL, 'f' },
+    { "gap", required_argument, NULL, 'g' },
+    { "mhz", required_argument, NULL, 'm' },
+    { "synth", required_argument, NULL, 'S' },
+    { "seed", required_argument, NULL, 's' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  struct jrnl_params p = {
+    .mhz = 800, .gap_us = 100, .flow = -1, .synth = 0, .seed = 1,
+  };
+  struct jrnl j;
+  int opt, ret;
+
+  while ((opt = getopt_long(argc, argv, "c:f:g:m:S:s:h", opts, NULL)) != -1) {
+    switch (opt) {
+      case 'c':
+        p.chrome = optarg;
+        break;
+      case 'f':
+        p.flow = atoll(optarg);
+        break;
+      case 'g':
+        p.gap_us = atoi(optarg);
+        break;
+      case 'm':
+        p.mhz = atoi(optarg);
+        break;
+      case 'S':
+        p.synth = atoi(optarg);
+        break;
+      case 's':
+        p.seed = atoi(optarg);
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc - 1 || p.mhz == 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  p.path = argv[optind];
+
+  if (p.synth != 0) {
+    utils_rng_init(&rng, p.seed);
+    return synth(&p) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  memset(&j, 0, sizeof(j));
+  if (jrnl_load(&p, &j) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  ret = analyze(&p, &j);
+  if (ret == 0 && p.flow >= 0) {
+    print_flow(&p, &j);
+  }
+  if (ret == 0 && p.chrome != NULL) {
+    ret = export_chrome(&p, &j);
+  }
+
+  free(j.recs);
+  return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
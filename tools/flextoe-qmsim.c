@@ -0,0 +1,273 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * @brief Replay queue manager scheduling on the host.
+ * @file flextoe-qmsim.c
+ *
+ * Runs the host model of the queue manager (see qm_sched.h) on a mix of bulk
+ * flows, which always have data to send, and RPC flows, which post a request
+ * after a random think time and wait until it was scheduled. The RPC flows
+ * run once in class 0 next to the bulk flows and once in a higher class, and
+ * the distribution of the time a request spends in the queue manager is
+ * printed for both, along with the share of segments left to the bulk flows.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <getopt.h>
+
+#include "util/rng.h"
+
+#include "qm_sched.h"
+
+#define BULK_BACKLOG  (1 << 20)   /*> Bytes kept queued per bulk flow */
+
+struct qmsim_params {
+  uint32_t bulk;                  /*> Bulk flows */
+  uint32_t rpc;                   /*> RPC flows */
+  uint32_t req;                   /*> Request size [bytes] */
+  uint32_t think;                 /*> Mean think time [slots] */
+  uint32_t cls;                   /*> Class of RPC flows in the second run */
+  uint32_t ctx;                   /*> Context of RPC flows, bulk flows use 0 */
+  uint32_t gbps;                  /*> Pipeline rate, 0: unlimited */
+  uint32_t mss;
+  uint32_t slots;                 /*> Slots to run */
+  uint32_t seed;
+};
+
+struct qmsim_result {
+  uint32_t *lat;                  /*> Request latencies [slots] */
+  uint32_t lat_num;
+  uint64_t bulk_segs;
+  uint64_t rpc_segs;
+};
+
+static struct utils_rng rng;
+
+static int cmp_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+static int run(const struct qmsim_params *p, uint32_t cls,
+    struct qmsim_result *r)
+{
+  struct qm_sched_model *m;
+  struct qm_sched_model_flow *flows;
+  uint32_t *next_req, *started, n, i, f, slot, pipe_cyc = 0;
+  uint64_t bulk_bytes = 0, rpc_bytes = 0;
+
+  n = p->bulk + p->rpc;
+  m = malloc(sizeof(*m));
+  flows = calloc(n, sizeof(*flows));
+  next_req = calloc(p->rpc, sizeof(*next_req));
+  started = calloc(p->rpc, sizeof(*started));
+  r->lat = malloc(sizeof(*r->lat) * p->slots);
+  if (m == NULL || flows == NULL || next_req == NULL || started == NULL ||
+      r->lat == NULL)
+  {
+    fprintf(stderr, "flextoe-qmsim: malloc failed\n");
+    return -1;
+  }
+
+  /* cycles per MSS segment at the pipeline rate */
+  if (p->gbps != 0) {
+    pipe_cyc = (uint64_t) p->mss * 8 * QM_ME_MHZ / (p->gbps * 1000);
+  }
+  qm_sched_model_init(m, flows, n, p->mss, pipe_cyc);
+
+  /* bulk flows in context 0 and class 0 */
+  for (f = 0; f < p->bulk; f++) {
+    qm_sched_model_bump(m, f, BULK_BACKLOG);
+  }
+  for (i = 0; i < p->rpc; i++) {
+    flows[p->bulk + i].params = QM_PARAMS(p->ctx, cls);
+    next_req[i] = utils_rng_gen32(&rng) % (2 * p->think + 1);
+    started[i] = UINT32_MAX;
+  }
+
+  r->lat_num = 0;
+  for (slot = 0; slot < p->slots; slot++) {
+    for (i = 0; i < p->rpc; i++) {
+      if (started[i] == UINT32_MAX && next_req[i] == slot) {
+        started[i] = slot;
+        qm_sched_model_bump(m, p->bulk + i, p->req);
+      }
+    }
+
+    qm_sched_model_slot(m);
+
+    /* request done once its last segment was scheduled */
+    for (i = 0; i < p->rpc; i++) {
+      if (started[i] != UINT32_MAX && flows[p->bulk + i].avail == 0) {
+        r->lat[r->lat_num++] = slot + 1 - started[i];
+        started[i] = UINT32_MAX;
+        next_req[i] = slot + 1 + utils_rng_gen32(&rng) % (2 * p->think + 1);
+      }
+    }
+
+    for (f = 0; f < p->bulk; f++) {
+      if (flows[f].avail < BULK_BACKLOG / 2) {
+        qm_sched_model_bump(m, f, BULK_BACKLOG / 2);
+      }
+    }
+  }
+
+  for (f = 0; f < n; f++) {
+    if (f < p->bulk) {
+      bulk_bytes += flows[f].tx_bytes;
+    } else {
+      rpc_bytes += flows[f].tx_bytes;
+    }
+  }
+  r->bulk_segs = (bulk_bytes + p->mss - 1) / p->mss;
+  r->rpc_segs = (rpc_bytes + p->mss - 1) / p->mss;
+
+  free(started);
+  free(next_req);
+  free(flows);
+  free(m);
+  return 0;
+}
+
+static double slots_us(uint32_t slots)
+{
+  return (double) slots * QM_MODEL_SLOT_CYC / QM_ME_MHZ;
+}
+
+static void print_result(const char *name, struct qmsim_result *r)
+{
+  uint32_t p50 = 0, p99 = 0, p999 = 0, max = 0;
+  uint64_t segs = r->bulk_segs + r->rpc_segs;
+
+  if (r->lat_num != 0) {
+    qsort(r->lat, r->lat_num, sizeof(*r->lat), cmp_u32);
+    p50 = r->lat[r->lat_num / 2];
+    p99 = r->lat[(uint64_t) r->lat_num * 99 / 100];
+    p999 = r->lat[(uint64_t) r->lat_num * 999 / 1000];
+    max = r->lat[r->lat_num - 1];
+  }
+
+  printf("%-10s %8u %9.2f %9.2f %9.2f %9.2f %7.1f%%\n", name, r->lat_num,
+      slots_us(p50), slots_us(p99), slots_us(p999), slots_us(max),
+      segs == 0 ? 0 : 100.0 * r->bulk_segs / segs);
+}
+
+static void print_usage(const char *progname)
+{
+  fprintf(stderr, "Usage: %s [OPTION]...\n"
+      "  -b, --bulk=N        Bulk flows [default: 64]\n"
+      "  -r, --rpc=N         RPC flows [default: 16]\n"
+      "  -q, --req=BYTES     Request size [default: 2048]\n"
+      "  -t, --think=SLOTS   Mean think time [default: 256]\n"
+      "  -c, --class=CLASS   Class of RPC flows to compare with [default: 3]\n"
+      "  -x, --ctx=CTX       Context of RPC flows [default: 0, as bulk]\n"
+      "  -g, --gbps=RATE     Pipeline rate, 0: unlimited [default: 40]\n"
+      "  -m, --mss=BYTES     Segment size [default: 1448]\n"
+      "  -n, --slots=N       Slots to run [default: 1000000]\n"
+      "  -s, --seed=N        Random seed [default: 1]\n"
+      "  -h, --help          Show this help\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+  static const struct option opts[] = {
+    { "bulk", required_argument, NULL, 'b' },
+    { "rpc", required_argument, NULL, 'r' },
+    { "req", required_argument, NULL, 'q' },
+    { "think", required_argument, NULL, 't' },
+    { "class", required_argument, NULL, 'c' },
+    { "ctx", required_argument, NULL, 'x' },
+    { "gbps", required_argument, NULL, 'g' },
+    { "mss", required_argument, NULL, 'm' },
+    { "slots", required_argument, NULL, 'n' },
+    { "seed", required_argument, NULL, 's' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  struct qmsim_params p = {
+    .bulk = 64, .rpc = 16, .req = 2048, .think = 256, .cls = 3, .ctx = 0,
+    .gbps = 40, .mss = 1448, .slots = 1000000, .seed = 1,
+  };
+  struct qmsim_result base, prio;
+  char name[16];
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "b:r:q:t:c:x:g:m:n:s:h", opts, NULL))
+      != -1)
+  {
+    switch (opt) {
+      case 'b':
+        p.bulk = atoi(optarg);
+        break;
+      case 'r':
+        p.rpc = atoi(optarg);
+        break;
+      case 'q':
+        p.req = atoi(optarg);
+        break;
+      case 't':
+        p.think = atoi(optarg);
+        break;
+      case 'c':
+        p.cls = atoi(optarg);
+        break;
+      case 'x':
+        p.ctx = atoi(optarg);
+        break;
+      case 'g':
+        p.gbps = atoi(optarg);
+        break;
+      case 'm':
+        p.mss = atoi(optarg);
+        break;
+      case 'n':
+        p.slots = atoi(optarg);
+        break;
+      case 's':
+        p.seed = atoi(optarg);
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (p.cls >= QM_PRIO_NUM || p.ctx >= QM_CTX_NUM || p.mss == 0 || p.req == 0 || p.rpc == 0 ||
+      p.bulk + p.rpc > UINT16_MAX)
+  {
+    fprintf(stderr, "flextoe-qmsim: invalid parameters\n");
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  utils_rng_init(&rng, p.seed);
+  if (run(&p, 0, &base) != 0) {
+    return EXIT_FAILURE;
+  }
+  utils_rng_init(&rng, p.seed);
+  if (run(&p, p.cls, &prio) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  printf("%u bulk flows, %u RPC flows, %u byte requests, %u Gbps, "
+      "%u slots of %.2f us\n", p.bulk, p.rpc, p.req, p.gbps, p.slots,
+      slots_us(1));
+  printf("%-10s %8s %9s %9s %9s %9s %8s\n", "rpc", "requests", "p50[us]",
+      "p99[us]", "p99.9[us]", "max[us]", "bulk");
+  print_result("class 0", &base);
+  snprintf(name, sizeof(name), "class %u", p.cls);
+  print_result(name, &prio);
+
+  free(prio.lat);
+  free(base.lat);
+  return EXIT_SUCCESS;
+}
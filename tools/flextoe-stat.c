@@ -0,0 +1,481 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * @brief Dump FlexTOE telemetry from the stats shared memory region.
+ * @file flextoe-stat.c
+ *
+ * Maps the region published by the slowpath (see sp_stats.h) read-only, takes
+ * a consistent snapshot and prints it in Prometheus text exposition format or
+ * as JSON.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "connect.h"
+#include "sp_stats.h"
+
+#define SNAPSHOT_RETRIES 1000
+
+enum output_format {
+  FMT_PROMETHEUS,
+  FMT_JSON,
+};
+
+static const char *conn_status_names[] = {
+  "syn_wait", "arp_pending", "syn_sent", "reg_synack", "open", "closed",
+  "failed",
+};
+
+static const void *map_stats(size_t *size)
+{
+  char path[PATH_MAX];
+  struct stat st;
+  void *p;
+  int fd;
+
+  snprintf(path, PATH_MAX, "%s/%s", FLEXNIC_SHM_PREFIX, FLEXNIC_NAME_STATS);
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    fprintf(stderr, "flextoe-stat: opening %s failed: %s\n", path,
+        strerror(errno));
+    return NULL;
+  }
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(struct sp_stats_hdr)) {
+    fprintf(stderr, "flextoe-stat: %s too small\n", path);
+    close(fd);
+    return NULL;
+  }
+
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror("flextoe-stat: mmap failed");
+    return NULL;
+  }
+
+  *size = st.st_size;
+  return p;
+}
+
+/** Copy the region, retrying while the slowpath updates it */
+static int snapshot(const void *region, size_t size, struct sp_stats *s)
+{
+  const volatile struct sp_stats_hdr *hdr = region;
+  uint64_t seq;
+  int i;
+
+  if (hdr->magic != SP_STATS_MAGIC) {
+    fprintf(stderr, "flextoe-stat: region not initialized\n");
+    return -1;
+  }
+  if (hdr->version != SP_STATS_VERSION || hdr->size != sizeof(*s) ||
+      size < sizeof(*s))
+  {
+    fprintf(stderr, "flextoe-stat: version mismatch (region v%u, tool v%u)\n",
+        hdr->version, SP_STATS_VERSION);
+    return -1;
+  }
+
+  for (i = 0; i < SNAPSHOT_RETRIES; i++) {
+    if ((seq = hdr->seq) & 1) {
+      usleep(10);
+      continue;
+    }
+    __sync_synchronize();
+    memcpy(s, region, sizeof(*s));
+    __sync_synchronize();
+    if (hdr->seq == seq) {
+      return 0;
+    }
+  }
+
+  fprintf(stderr, "flextoe-stat: no consistent snapshot\n");
+  return -1;
+}
+
+static const char *status_name(uint32_t status)
+{
+  if (status < sizeof(conn_status_names) / sizeof(conn_status_names[0])) {
+    return conn_status_names[status];
+  }
+  return "unknown";
+}
+
+static void ip_str(uint32_t ip, char *buf, size_t len)
+{
+  snprintf(buf, len, "%u.%u.%u.%u", ip >> 24, (ip >> 16) & 0xff,
+      (ip >> 8) & 0xff, ip & 0xff);
+}
+
+/*****************************************************************************/
+/* Prometheus */
+
+static void prom_head(const char *name, const char *type, const char *help)
+{
+  printf("# HELP flextoe_%s %s\n# TYPE flextoe_%s %s\n", name, help, name,
+      type);
+}
+
+static void prom_hist(const char *name, const char *help,
+    const struct sp_stats_hist *h)
+{
+  uint64_t cum = 0;
+  unsigned i;
+
+  prom_head(name, "histogram", help);
+  for (i = 0; i < SP_STATS_HIST_BUCKETS - 1; i++) {
+    cum += h->buckets[i];
+    printf("flextoe_%s_bucket{le=\"%llu\"} %"PRIu64"\n", name,
+        1ULL << i, cum);
+  }
+  printf("flextoe_%s_bucket{le=\"+Inf\"} %"PRIu64"\n", name, h->count);
+  printf("flextoe_%s_sum %"PRIu64"\n", name, h->sum);
+  printf("flextoe_%s_count %"PRIu64"\n", name, h->count);
+}
+
+static void print_prometheus(const struct sp_stats *s, int conns)
+{
+  const struct sp_stats_ctx *c;
+  const struct sp_stats_conn *cn;
+  char lip[16], rip[16];
+  unsigned i;
+
+#define SP_COUNTER(f, help) do {                                   \
+    prom_head("sp_" #f "_total", "counter", help);                 \
+    printf("flextoe_sp_" #f "_total %"PRIu64"\n", s->sp.f);        \
+  } while (0)
+#define SP_GAUGE(f, help) do {                                     \
+    prom_head("sp_" #f, "gauge", help);                            \
+    printf("flextoe_sp_" #f " %"PRIu64"\n", s->sp.f);              \
+  } while (0)
+
+  SP_COUNTER(drops, "Drops detected by the fastpath.");
+  SP_COUNTER(sp_rexmit, "Slowpath retransmission timeouts.");
+  SP_COUNTER(sp_tlp, "Slowpath tail loss probes.");
+  SP_COUNTER(ka_probes, "Keepalive probes sent.");
+  SP_COUNTER(ka_resets, "Connections reset by keepalive or idle timeout.");
+  SP_COUNTER(ecn_marked, "ECN marked bytes acknowledged.");
+  SP_COUNTER(acks, "Bytes acknowledged.");
+  SP_COUNTER(conn_opened, "Connections established.");
+  SP_COUNTER(conn_closed, "Connections closed.");
+  SP_COUNTER(conn_failed, "Connection attempts failed.");
+  SP_COUNTER(rx_packets, "Packets received by the slowpath.");
+  SP_COUNTER(rx_unhandled, "Packets the slowpath could not process.");
+  SP_GAUGE(conns, "Connections with congestion state.");
+  SP_GAUGE(apps, "Attached applications.");
+
+#undef SP_COUNTER
+#undef SP_GAUGE
+
+  prom_head("flowgroup_rx_packets_total", "counter",
+      "Slowpath packets per flow group.");
+  for (i = 0; i < SP_STATS_FLOWGRPS; i++) {
+    printf("flextoe_flowgroup_rx_packets_total{fg=\"%u\"} %"PRIu64"\n", i,
+        s->fgs[i].rx_packets);
+  }
+  prom_head("flowgroup_conns", "gauge", "Connections per flow group.");
+  for (i = 0; i < SP_STATS_FLOWGRPS; i++) {
+    printf("flextoe_flowgroup_conns{fg=\"%u\"} %u\n", i, s->fgs[i].conns);
+  }
+  prom_head("flowgroup_fp_packets_total", "counter",
+      "Fastpath packets per flow group.");
+  for (i = 0; i < SP_STATS_FLOWGRPS; i++) {
+    printf("flextoe_flowgroup_fp_packets_total{fg=\"%u\"} %"PRIu64"\n", i,
+        s->fgs[i].fp_packets);
+  }
+
+  if (s->hdr.num_fp > 0) {
+    prom_head("fp_events_total", "counter", "Fastpath pipeline counters.");
+    for (i = 0; i < s->hdr.num_fp && i < SP_STATS_FP_NUM; i++) {
+      printf("flextoe_fp_events_total{name=\"%.*s\"} %"PRIu64"\n",
+          SP_STATS_NAME_LEN, s->fp[i].name, s->fp[i].value);
+    }
+    prom_head("fp_cycles_total", "counter", "Fastpath profiled cycles.");
+    for (i = 0; i < s->hdr.num_fp && i < SP_STATS_FP_NUM; i++) {
+      if (s->fp[i].cycles != 0) {
+        printf("flextoe_fp_cycles_total{name=\"%.*s\"} %"PRIu64"\n",
+            SP_STATS_NAME_LEN, s->fp[i].name, s->fp[i].cycles);
+      }
+    }
+  }
+
+  prom_head("mem_node_bytes", "gauge", "Packet memory per NUMA node.");
+  for (i = 0; i < s->hdr.num_nodes && i < SP_STATS_NODES; i++) {
+    printf("flextoe_mem_node_bytes{node=\"%u\"} %"PRIu64"\n", i,
+        s->nodes[i].size);
+  }
+  prom_head("mem_node_used_bytes", "gauge",
+      "Allocated packet memory per NUMA node.");
+  for (i = 0; i < s->hdr.num_nodes && i < SP_STATS_NODES; i++) {
+    printf("flextoe_mem_node_used_bytes{node=\"%u\"} %"PRIu64"\n", i,
+        s->nodes[i].used);
+  }
+  prom_head("mem_node_allocs_total", "counter",
+      "Packet memory allocations placed on a NUMA node.");
+  for (i = 0; i < s->hdr.num_nodes && i < SP_STATS_NODES; i++) {
+    printf("flextoe_mem_node_allocs_total{node=\"%u\"} %"PRIu64"\n", i,
+        s->nodes[i].allocs);
+  }
+  prom_head("mem_node_spills_total", "counter",
+      "Allocations for a NUMA node placed on another node.");
+  for (i = 0; i < s->hdr.num_nodes && i < SP_STATS_NODES; i++) {
+    printf("flextoe_mem_node_spills_total{node=\"%u\"} %"PRIu64"\n", i,
+        s->nodes[i].spills);
+  }
+  prom_head("startup_shm_seconds", "gauge",
+      "Time to set up shared memory at startup.");
+  printf("flextoe_startup_shm_seconds %.6f\n", s->hdr.shm_us / 1e6);
+  prom_head("startup_ready_seconds", "gauge",
+      "Time until the slowpath accepted applications.");
+  printf("flextoe_startup_ready_seconds %.6f\n", s->hdr.ready_us / 1e6);
+  prom_head("mem_nic_node", "gauge", "NUMA node the NIC is attached to.");
+  printf("flextoe_mem_nic_node %u\n", s->hdr.nic_node);
+
+  prom_head("ctx_numa_node", "gauge", "NUMA node of a context's buffers.");
+  for (i = 0; i < s->hdr.num_ctxs && i < SP_STATS_CTXS; i++) {
+    c = &s->ctxs[i];
+    printf("flextoe_ctx_numa_node{app=\"%u\",db=\"%u\"} %u\n", c->app_id,
+        c->db_id, c->numa_node);
+  }
+  prom_head("ctx_conns", "gauge", "Connections per application context.");
+  for (i = 0; i < s->hdr.num_ctxs && i < SP_STATS_CTXS; i++) {
+    c = &s->ctxs[i];
+    printf("flextoe_ctx_conns{app=\"%u\",db=\"%u\"} %u\n", c->app_id,
+        c->db_id, c->conns);
+  }
+  prom_head("ctx_txq_depth", "gauge", "Pending app to NIC descriptors.");
+  for (i = 0; i < s->hdr.num_ctxs && i < SP_STATS_CTXS; i++) {
+    c = &s->ctxs[i];
+    printf("flextoe_ctx_txq_depth{app=\"%u\",db=\"%u\"} %u\n", c->app_id,
+        c->db_id, c->txq_depth);
+  }
+  prom_head("ctx_rxq_depth", "gauge", "Pending NIC to app descriptors.");
+  for (i = 0; i < s->hdr.num_ctxs && i < SP_STATS_CTXS; i++) {
+    c = &s->ctxs[i];
+    printf("flextoe_ctx_rxq_depth{app=\"%u\",db=\"%u\"} %u\n", c->app_id,
+        c->db_id, c->rxq_depth);
+  }
+
+  prom_hist("rtt_us", "RTT estimate of open connections.",
+      &s->rtt_hist);
+  prom_hist("txq_depth", "TX queue depth over contexts.",
+      &s->txq_hist);
+
+  if (!conns) {
+    return;
+  }
+
+#define CONN_METRIC(m, type, fmt, v, help) do {                         \
+    prom_head("conn_" m, type, help);                                   \
+    for (i = 0; i < s->hdr.num_conns && i < SP_STATS_CONNS; i++) {      \
+      cn = &s->conns[i];                                                \
+      ip_str(cn->local_ip, lip, sizeof(lip));                           \
+      ip_str(cn->remote_ip, rip, sizeof(rip));                          \
+      printf("flextoe_conn_" m "{flow=\"%u\",local=\"%s:%u\","          \
+          "remote=\"%s:%u\",status=\"%s\"} %" fmt "\n", cn->flow_id,    \
+          lip, cn->local_port, rip, cn->remote_port,                    \
+          status_name(cn->status), v);                                  \
+    }                                                                   \
+  } while (0)
+
+  CONN_METRIC("rtt_us", "gauge", PRIu32, cn->rtt, "RTT estimate.");
+  CONN_METRIC("rate_kbps", "gauge", PRIu32, cn->rate, "CC rate.");
+  CONN_METRIC("rexmits_total", "counter", PRIu32, cn->rexmits,
+      "Slowpath retransmissions.");
+  CONN_METRIC("drops_total", "counter", PRIu64, cn->drops, "Drops.");
+  CONN_METRIC("acked_bytes_total", "counter", PRIu64, cn->ackb,
+      "Bytes acknowledged.");
+  CONN_METRIC("ecn_bytes_total", "counter", PRIu64, cn->ecnb,
+      "ECN marked bytes acknowledged.");
+
+#undef CONN_METRIC
+}
+
+/*****************************************************************************/
+/* JSON */
+
+static void json_hist(const char *name, const struct sp_stats_hist *h,
+    const char *sep)
+{
+  unsigned i;
+
+  printf("  \"%s\": {\"count\": %"PRIu64", \"sum\": %"PRIu64", "
+      "\"buckets\": [", name, h->count, h->sum);
+  for (i = 0; i < SP_STATS_HIST_BUCKETS; i++) {
+    printf("%s%"PRIu64, (i == 0 ? "" : ", "), h->buckets[i]);
+  }
+  printf("]}%s\n", sep);
+}
+
+static void print_json(const struct sp_stats *s, int conns)
+{
+  const struct sp_stats_ctx *c;
+  const struct sp_stats_conn *cn;
+  char lip[16], rip[16];
+  unsigned i;
+
+  printf("{\n");
+  printf("  \"version\": %u, \"ts_us\": %"PRIu64", \"interval_us\": %u,\n",
+      s->hdr.version, s->hdr.ts_us, s->hdr.interval_us);
+
+  printf("  \"sp\": {\"drops\": %"PRIu64", \"sp_rexmit\": %"PRIu64", "
+      "\"sp_tlp\": %"PRIu64", \"ka_probes\": %"PRIu64", "
+      "\"ka_resets\": %"PRIu64", \"ecn_marked\": %"PRIu64", "
+      "\"acks\": %"PRIu64", "
+      "\"conn_opened\": %"PRIu64", \"conn_closed\": %"PRIu64", "
+      "\"conn_failed\": %"PRIu64", \"rx_packets\": %"PRIu64", "
+      "\"rx_unhandled\": %"PRIu64", \"conns\": %"PRIu64", "
+      "\"apps\": %"PRIu64"},\n",
+      s->sp.drops, s->sp.sp_rexmit, s->sp.sp_tlp, s->sp.ka_probes,
+      s->sp.ka_resets, s->sp.ecn_marked,
+      s->sp.acks, s->sp.conn_opened, s->sp.conn_closed, s->sp.conn_failed,
+      s->sp.rx_packets, s->sp.rx_unhandled, s->sp.conns, s->sp.apps);
+
+  printf("  \"flow_groups\": [");
+  for (i = 0; i < SP_STATS_FLOWGRPS; i++) {
+    printf("%s{\"rx_packets\": %"PRIu64", \"fp_packets\": %"PRIu64", "
+        "\"conns\": %u}", (i == 0 ? "" : ", "), s->fgs[i].rx_packets,
+        s->fgs[i].fp_packets, s->fgs[i].conns);
+  }
+  printf("],\n");
+
+  printf("  \"fp\": {");
+  for (i = 0; i < s->hdr.num_fp && i < SP_STATS_FP_NUM; i++) {
+    printf("%s\"%.*s\": {\"value\": %"PRIu64", \"cycles\": %"PRIu64"}",
+        (i == 0 ? "" : ", "), SP_STATS_NAME_LEN, s->fp[i].name,
+        s->fp[i].value, s->fp[i].cycles);
+  }
+  printf("},\n");
+
+  printf("  \"startup\": {\"shm_us\": %u, \"ready_us\": %u},\n",
+      s->hdr.shm_us, s->hdr.ready_us);
+  printf("  \"nic_node\": %u,\n", s->hdr.nic_node);
+  printf("  \"nodes\": [");
+  for (i = 0; i < s->hdr.num_nodes && i < SP_STATS_NODES; i++) {
+    printf("%s{\"size\": %"PRIu64", \"used\": %"PRIu64", "
+        "\"allocs\": %"PRIu64", \"spills\": %"PRIu64", \"zones\": %u, "
+        "\"ctxs\": %u}", (i == 0 ? "" : ", "), s->nodes[i].size,
+        s->nodes[i].used, s->nodes[i].allocs, s->nodes[i].spills,
+        s->nodes[i].zones, s->nodes[i].ctxs);
+  }
+  printf("],\n");
+
+  printf("  \"contexts\": [");
+  for (i = 0; i < s->hdr.num_ctxs && i < SP_STATS_CTXS; i++) {
+    c = &s->ctxs[i];
+    printf("%s\n    {\"app\": %u, \"db\": %u, \"node\": %u, "
+        "\"conns\": %u, \"txq_depth\": %u, \"txq_len\": %u, "
+        "\"rxq_depth\": %u, \"rxq_len\": %u}", (i == 0 ? "" : ","),
+        c->app_id, c->db_id, c->numa_node, c->conns, c->txq_depth,
+        c->txq_len, c->rxq_depth, c->rxq_len);
+  }
+  printf("],\n");
+
+  json_hist("rtt_hist", &s->rtt_hist, ",");
+  json_hist("txq_hist", &s->txq_hist, (conns ? "," : ""));
+
+  if (conns) {
+    printf("  \"conns_total\": %u,\n", s->hdr.num_conns_total);
+    printf("  \"conns\": [");
+    for (i = 0; i < s->hdr.num_conns && i < SP_STATS_CONNS; i++) {
+      cn = &s->conns[i];
+      ip_str(cn->local_ip, lip, sizeof(lip));
+      ip_str(cn->remote_ip, rip, sizeof(rip));
+      printf("%s\n    {\"flow\": %u, \"local\": \"%s:%u\", "
+          "\"remote\": \"%s:%u\", \"fg\": %u, \"db\": %u, "
+          "\"status\": \"%s\", \"rtt\": %u, \"rate\": %u, "
+          "\"rexmits\": %u, \"drops\": %"PRIu64", \"ackb\": %"PRIu64", "
+          "\"ecnb\": %"PRIu64"}", (i == 0 ? "" : ","), cn->flow_id, lip,
+          cn->local_port, rip, cn->remote_port, cn->flow_group, cn->db_id,
+          status_name(cn->status), cn->rtt, cn->rate, cn->rexmits,
+          cn->drops, cn->ackb, cn->ecnb);
+    }
+    printf("]\n");
+  }
+  printf("}\n");
+}
+
+static void print_usage(const char *progname)
+{
+  fprintf(stderr, "Usage: %s [OPTION]...\n"
+      "  -j, --json          JSON output [default: prometheus]\n"
+      "  -c, --conns         Include per-connection metrics\n"
+      "  -i, --interval=SEC  Repeat every SEC seconds\n"
+      "  -h, --help          Show this help\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+  static const struct option opts[] = {
+    { "json", no_argument, NULL, 'j' },
+    { "conns", no_argument, NULL, 'c' },
+    { "interval", required_argument, NULL, 'i' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  enum output_format fmt = FMT_PROMETHEUS;
+  struct sp_stats *s;
+  const void *region;
+  size_t size;
+  unsigned interval = 0;
+  int conns = 0, opt;
+
+  while ((opt = getopt_long(argc, argv, "jci:h", opts, NULL)) != -1) {
+    switch (opt) {
+      case 'j':
+        fmt = FMT_JSON;
+        break;
+      case 'c':
+        conns = 1;
+        break;
+      case 'i':
+        interval = atoi(optarg);
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if ((region = map_stats(&size)) == NULL) {
+    return EXIT_FAILURE;
+  }
+  if ((s = malloc(sizeof(*s))) == NULL) {
+    perror("flextoe-stat: malloc failed");
+    return EXIT_FAILURE;
+  }
+
+  do {
+    if (snapshot(region, size, s) != 0) {
+      return EXIT_FAILURE;
+    }
+
+    if (fmt == FMT_JSON) {
+      print_json(s, conns);
+    } else {
+      print_prometheus(s, conns);
+    }
+    fflush(stdout);
+
+    if (interval > 0) {
+      sleep(interval);
+    }
+  } while (interval > 0);
+
+  free(s);
+  return EXIT_SUCCESS;
+}
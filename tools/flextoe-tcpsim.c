@@ -0,0 +1,827 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * @brief Replay fastpath loss recovery on the host.
+ * @file flextoe-tcpsim.c
+ *
+ * Runs a bulk transfer between two FlexTOE flows over a modeled link: the
+ * sender is the host model of flows_ack()/flows_tx() (tcp_sack.h), the
+ * receiver the one of flows_seg() (tcp_ooo.h). Data segments can be dropped
+ * or delayed by their transmission index, so a loss or reordering pattern
+ * replays exactly. ACKs carry their options in the layout of
+ * prepare_ack_header() and are parsed like validate_pkt_hdr() does; ACKs the
+ * fastpath would hand to the slowpath are lost to the sender.
+ *
+ * Time advances in ticks of the RACK clock (TCP_RACK_TS_SHIFT). The
+ * slowpath's tail loss probe and retransmission timeout are modeled as fixed
+ * multiples of the round trip time.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <getopt.h>
+
+#include "util/rng.h"
+
+#include "tcp_ooo.h"
+#include "tcp_sack.h"
+#include "tcp_delack.h"
+#include "tcp_rxwnd.h"
+#include "tcp_wscale.h"
+
+#define SIM_SCRIPT_MAX    64        /*> Scripted drops/delays per run */
+#define SIM_PKTS_MAX      4096      /*> Packets on the wire per direction */
+#define SIM_ISN           0xFFFF0000 /*> Initial sequence, wraps early */
+#define SIM_DELACK_SEGS   100000    /*> Segments per delayed ACK run */
+#define SIM_DELACK_TO     20000     /*> Delayed ACK timer [ns], as default */
+#define SIM_RXWND_RTTS    1000      /*> Control intervals per autotuning run */
+#define SIM_RXWND_LINK    (128 * 1024) /*> Bytes the peer can send per RTT */
+#define SIM_RXWND_BUF     (256 * 1024) /*> Receive buffer with window scaling */
+
+/* ACK option layouts */
+enum sim_layout {
+  SIM_LAYOUT_TS_SACK,             /*> prepare_ack_header(): TS, then SACK */
+  SIM_LAYOUT_SACK_ONLY,           /*> SACK block in place of the TS option */
+};
+
+struct tcpsim_params {
+  uint32_t bytes;                 /*> Transfer size */
+  uint32_t mss;
+  uint32_t wnd;                   /*> Max bytes in flight */
+  uint32_t delay;                 /*> One-way delay [ticks] */
+  uint32_t burst;                 /*> Segments sent per tick */
+  uint32_t extra;                 /*> Extra delay of reordered segments */
+  uint32_t loss_pm;               /*> Random loss [1/1000] */
+  uint32_t seed;
+  int tlp;                        /*> Send tail loss probes */
+  int drop_new;                   /*> drop indices count new data only */
+
+  uint32_t drop[SIM_SCRIPT_MAX];  /*> Transmission indices to drop */
+  uint32_t drop_num;
+  uint32_t late[SIM_SCRIPT_MAX];  /*> Transmission indices to delay */
+  uint32_t late_num;
+};
+
+struct tcpsim_result {
+  int done;                       /*> All data delivered in order */
+  uint32_t ticks;
+  uint32_t segs;                  /*> Data segments sent */
+  uint64_t rtx_bytes;
+  uint32_t recoveries;
+  uint32_t probes;
+  uint32_t timeouts;
+  uint32_t acks;                  /*> ACKs sent by the receiver */
+  uint32_t acks_sack;             /*> ... with a SACK block */
+  uint32_t acks_slowpath;         /*> ... not taken by the sender's fastpath */
+};
+
+/** Segment or ACK on the wire */
+struct sim_pkt {
+  uint32_t at;                    /*> Arrival tick */
+  uint32_t seq;                   /*> Data: sequence, ACK: cumulative ACK */
+  uint32_t len;
+  uint32_t ts;                    /*> TS value */
+  uint32_t opts[2 * TCP_SACK_OPT_WORDS];
+  unsigned opts_num;
+};
+
+struct sim_wire {
+  struct sim_pkt pkts[SIM_PKTS_MAX];
+  unsigned num;
+};
+
+static struct utils_rng rng;
+
+static int script_has(const uint32_t *s, uint32_t num, uint32_t idx)
+{
+  uint32_t i;
+
+  for (i = 0; i < num; i++) {
+    if (s[i] == idx) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static struct sim_pkt *wire_push(struct sim_wire *w, uint32_t at)
+{
+  struct sim_pkt *pkt;
+
+  if (w->num == SIM_PKTS_MAX) {
+    return NULL;
+  }
+  pkt = &w->pkts[w->num++];
+  memset(pkt, 0, sizeof(*pkt));
+  pkt->at = at;
+  return pkt;
+}
+
+/** Remove the first packet (in send order) that arrived by @p tick */
+static int wire_pop(struct sim_wire *w, uint32_t tick, struct sim_pkt *pkt)
+{
+  unsigned i;
+
+  for (i = 0; i < w->num; i++) {
+    if (w->pkts[i].at <= tick) {
+      *pkt = w->pkts[i];
+      memmove(&w->pkts[i], &w->pkts[i + 1],
+          (w->num - i - 1) * sizeof(*pkt));
+      w->num--;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** Options of an ACK as the receiving fastpath writes them */
+static unsigned ack_opts(enum sim_layout layout, uint32_t *opts,
+    uint32_t ts_val, uint32_t ts_ecr, uint32_t left, uint32_t right)
+{
+  if (layout == SIM_LAYOUT_SACK_ONLY && left != right) {
+    opts[0] = TCP_SACK_OPT_SACK1;
+    opts[1] = left;
+    opts[2] = right;
+    return TCP_SACK_OPT_WORDS;
+  }
+  return tcp_sack_ack_opts(opts, ts_val, ts_ecr, left, right);
+}
+
+static int run(const struct tcpsim_params *p, int sack,
+    enum sim_layout layout, struct tcpsim_result *r)
+{
+  static struct sim_wire data, acks;
+  struct tcp_sack_txstate tx;
+  struct tcp_ooo_rxstate rx;
+  struct sim_pkt pkt, *out;
+  uint32_t tick, now, rtt, rto, progress, idx, idx_new, seq, len, avail, una;
+  uint32_t high;
+  uint32_t ts_recent, left, right, ts_ecr, max_ticks, i;
+  int slot, probed, in_order;
+
+  memset(r, 0, sizeof(*r));
+  memset(&tx, 0, sizeof(tx));
+  memset(&rx, 0, sizeof(rx));
+  data.num = 0;
+  acks.num = 0;
+
+  tx.una = SIM_ISN;
+  tx.high = SIM_ISN;
+  tx.sack = sack;
+  rx.next_seq = SIM_ISN;
+  rx.avail = TCP_OOO_MAX;
+
+  rtt = 2 * p->delay + 1;
+  rto = 4 * rtt;
+  max_ticks = 1000 * rtt + 100 * (p->bytes / p->mss);
+  progress = 1;
+  probed = 0;
+  ts_recent = 0;
+  idx = 0;
+  idx_new = 0;
+
+  for (tick = 1; rx.next_seq - SIM_ISN != p->bytes; tick++) {
+    if (tick > max_ticks) {
+      return -1;
+    }
+    now = tick << TCP_RACK_TS_SHIFT;
+
+    /* receiver: flows_seg(), the application reads everything right away */
+    while (wire_pop(&data, tick, &pkt)) {
+      in_order = (pkt.seq == rx.next_seq);
+      rx.avail += tcp_ooo_rx(&rx, pkt.seq, pkt.len, &slot);
+      if (in_order) {
+        ts_recent = pkt.ts;
+      }
+
+      left = right = 0;
+      if (slot >= 0) {
+        left = rx.next_seq + TCP_OOO_OFF(rx.iv[slot]);
+        right = left + TCP_OOO_LEN(rx.iv[slot]);
+        r->acks_sack++;
+      }
+      if ((out = wire_push(&acks, tick + p->delay)) == NULL) {
+        return -1;
+      }
+      out->seq = rx.next_seq;
+      out->opts_num = ack_opts(layout, out->opts, now, ts_recent, left,
+          right);
+      r->acks++;
+    }
+
+    /* sender: flows_ack() */
+    while (wire_pop(&acks, tick, &pkt)) {
+      if (tcp_sack_rx_opts(pkt.opts, pkt.opts_num, &ts_ecr, &left, &right)
+          != 0)
+      {
+        r->acks_slowpath++;
+        continue;
+      }
+      una = tx.una;
+      tcp_sack_tx_ack(&tx, now, pkt.seq, ts_ecr, left, right);
+      if (tx.una != una) {
+        progress = tick;
+        probed = 0;
+      }
+    }
+
+    /* slowpath timers */
+    if (tx.sent == 0) {
+      progress = tick;
+      probed = 0;
+    } else if (tick - progress >= rto) {
+      tcp_sack_tx_timeout(&tx);
+      r->timeouts++;
+      progress = tick;
+      probed = 0;
+    } else if (p->tlp && !probed && tick - progress >= 2 * rtt) {
+      tcp_sack_tx_probe(&tx, p->mss);
+      probed = 1;
+    }
+
+    /* sender: flows_tx() */
+    for (i = 0; i < p->burst; i++) {
+      avail = p->bytes - (tx.una - SIM_ISN) - tx.sent;
+      if (tx.sent >= p->wnd) {
+        avail = 0;
+      } else if (avail > p->wnd - tx.sent) {
+        avail = p->wnd - tx.sent;
+      }
+      high = tx.high;
+      if ((len = tcp_sack_tx_next(&tx, now, avail, p->mss, &seq)) == 0) {
+        break;
+      }
+
+      idx++;
+      if (seq == high) {
+        idx_new++;
+      }
+      r->segs++;
+      if (script_has(p->drop, p->drop_num, !p->drop_new ? idx :
+            (seq == high ? idx_new : 0)) ||
+          (p->loss_pm != 0 && utils_rng_gen32(&rng) % 1000 < p->loss_pm))
+      {
+        continue;
+      }
+      out = wire_push(&data, tick + p->delay +
+          (script_has(p->late, p->late_num, idx) ? p->extra : 0));
+      if (out == NULL) {
+        return -1;
+      }
+      out->seq = seq;
+      out->len = len;
+      out->ts = now;
+    }
+  }
+
+  r->done = 1;
+  r->ticks = tick;
+  r->rtx_bytes = tx.rtx_bytes;
+  r->recoveries = tx.recoveries;
+  r->probes = tx.probes;
+  return 0;
+}
+
+static void print_header(void)
+{
+  printf("%-16s %8s %6s %9s %5s %5s %5s %7s %6s %6s\n", "run", "ticks",
+      "segs", "rtx[B]", "rec", "tlp", "rto", "acks", "sack", "slowp");
+}
+
+static void print_result(const char *name, const struct tcpsim_result *r)
+{
+  if (!r->done) {
+    printf("%-16s %8s\n", name, "stalled");
+    return;
+  }
+  printf("%-16s %8u %6u %9" PRIu64 " %5u %5u %5u %7u %6u %6u\n", name,
+      r->ticks, r->segs, r->rtx_bytes, r->recoveries, r->probes,
+      r->timeouts, r->acks, r->acks_sack, r->acks_slowpath);
+}
+
+/**
+ * FlexTOE to FlexTOE: the scripted pattern with SACK and with go-back-N,
+ * and with ACKs in the SACK-only layout, which the receiving fastpath
+ * rejects. Fails unless SACK recovery delivers everything without any ACK
+ * going to the slowpath.
+ */
+static int scenario_wire(const struct tcpsim_params *p)
+{
+  struct tcpsim_result sack, gbn, old;
+  uint32_t opts[2 * TCP_SACK_OPT_WORDS], ts_ecr, left, right;
+  unsigned n;
+  int ret = 0;
+
+  /* the layout prepare_ack_header() writes parses back unchanged */
+  n = tcp_sack_ack_opts(opts, 1, 2, 100, 200);
+  if (n != 2 * TCP_SACK_OPT_WORDS ||
+      tcp_sack_rx_opts(opts, n, &ts_ecr, &left, &right) != 0 ||
+      ts_ecr != 2 || left != 100 || right != 200)
+  {
+    fprintf(stderr, "flextoe-tcpsim: TS+SACK options not parsed\n");
+    ret = -1;
+  }
+  n = ack_opts(SIM_LAYOUT_SACK_ONLY, opts, 1, 2, 100, 200);
+  if (tcp_sack_rx_opts(opts, n, &ts_ecr, &left, &right) != -1) {
+    fprintf(stderr, "flextoe-tcpsim: SACK-only options not rejected\n");
+    ret = -1;
+  }
+
+  printf("%u drops, %u late, %u/1000 loss\n", p->drop_num, p->late_num,
+      p->loss_pm);
+  utils_rng_init(&rng, p->seed);
+  run(p, 1, SIM_LAYOUT_TS_SACK, &sack);
+  utils_rng_init(&rng, p->seed);
+  run(p, 0, SIM_LAYOUT_TS_SACK, &gbn);
+  utils_rng_init(&rng, p->seed);
+  run(p, 1, SIM_LAYOUT_SACK_ONLY, &old);
+
+  print_header();
+  print_result("sack", &sack);
+  print_result("go-back-n", &gbn);
+  print_result("sack, sack-only", &old);
+
+  if (!sack.done || sack.acks_slowpath != 0 ||
+      (p->drop_num != 0 && sack.acks_sack == 0))
+  {
+    fprintf(stderr, "flextoe-tcpsim: SACK recovery failed\n");
+    ret = -1;
+  }
+  if (!gbn.done) {
+    fprintf(stderr, "flextoe-tcpsim: go-back-N recovery failed\n");
+    ret = -1;
+  }
+  return ret;
+}
+
+/** Loss patterns for scenario_loss(), indices relative to the window */
+static const struct {
+  const char *name;
+  uint32_t drop[8];               /*> In units of 1/32 window, +1 */
+  uint32_t drop_num;
+  uint32_t loss_pm;
+} patterns[] = {
+  { "single", { 1 }, 1, 0 },
+  { "burst 3", { 1, 2, 3 }, 3, 0 },
+  { "2 holes", { 1, 17 }, 2, 0 },
+  { "4 holes", { 1, 9, 17, 25 }, 4, 0 },
+  { "8 holes", { 1, 5, 9, 13, 17, 21, 25, 29 }, 8, 0 },
+  { "random 0.5%", { 0 }, 0, 5 },
+  { "random 2%", { 0 }, 0, 20 },
+};
+
+/**
+ * Scripted loss patterns, each with SACK and go-back-N. The scripted drops
+ * all fall into one window of data in the middle of the transfer. Fails if
+ * SACK takes longer than go-back-N for any of them; random loss hits
+ * different segments in the two runs and is only reported.
+ */
+static int scenario_loss(const struct tcpsim_params *p)
+{
+  struct tcpsim_params q;
+  struct tcpsim_result sack, gbn;
+  uint32_t wnd_segs, base, i, j;
+  int ret = 0;
+
+  wnd_segs = p->wnd / p->mss;
+  base = p->bytes / p->mss / 2;
+
+  printf("%-12s %8s %8s %7s %10s %10s %6s\n", "pattern", "sack", "gbn",
+      "ticks", "sack rtx", "gbn rtx", "rtx");
+  for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+    q = *p;
+    q.drop_num = patterns[i].drop_num;
+    for (j = 0; j < q.drop_num; j++) {
+      q.drop[j] = base + (patterns[i].drop[j] - 1) * wnd_segs / 32;
+    }
+    q.late_num = 0;
+    q.loss_pm = patterns[i].loss_pm;
+    q.drop_new = 1;
+
+    utils_rng_init(&rng, p->seed);
+    run(&q, 1, SIM_LAYOUT_TS_SACK, &sack);
+    utils_rng_init(&rng, p->seed);
+    run(&q, 0, SIM_LAYOUT_TS_SACK, &gbn);
+    if (!sack.done || !gbn.done) {
+      printf("%-12s %8s\n", patterns[i].name, "stalled");
+      ret = -1;
+      continue;
+    }
+    printf("%-12s %8u %8u %6.2fx %10" PRIu64 " %10" PRIu64 " %5.2fx\n",
+        patterns[i].name, sack.ticks, gbn.ticks,
+        (double) sack.ticks / gbn.ticks, sack.rtx_bytes, gbn.rtx_bytes,
+        gbn.rtx_bytes == 0 ? 0 : (double) sack.rtx_bytes / gbn.rtx_bytes);
+    if (patterns[i].loss_pm == 0 && sack.ticks > gbn.ticks) {
+      fprintf(stderr, "flextoe-tcpsim: SACK slower than go-back-N (%s)\n",
+          patterns[i].name);
+      ret = -1;
+    }
+  }
+  return ret;
+}
+
+/**
+ * Tail drops: the last 1 to 8 segments of the transfer and the whole last
+ * window, recovered with tail loss probes and with the retransmission
+ * timeout alone. Fails if a probe does not avoid the timeout.
+ */
+static int scenario_tail(const struct tcpsim_params *p)
+{
+  static const uint32_t tails[] = { 1, 2, 4, 8, 0 };
+  struct tcpsim_params q;
+  struct tcpsim_result base, tlp, rto;
+  uint32_t i, j, k;
+  char name[16];
+  int ret = 0;
+
+  q = *p;
+  q.drop_num = 0;
+  q.late_num = 0;
+  q.loss_pm = 0;
+  if (run(&q, 1, SIM_LAYOUT_TS_SACK, &base) != 0) {
+    fprintf(stderr, "flextoe-tcpsim: loss-free run failed\n");
+    return -1;
+  }
+
+  printf("%-12s %8s %8s %8s %6s %6s\n", "tail", "tlp", "rto only",
+      "no loss", "probes", "rtos");
+  for (i = 0; i < sizeof(tails) / sizeof(tails[0]); i++) {
+    /* 0: the whole last window */
+    k = (tails[i] != 0 ? tails[i] : p->wnd / p->mss);
+    if (k > base.segs || k > SIM_SCRIPT_MAX) {
+      continue;
+    }
+    q.drop_num = k;
+    for (j = 0; j < k; j++) {
+      q.drop[j] = base.segs - j;
+    }
+
+    q.tlp = 1;
+    run(&q, 1, SIM_LAYOUT_TS_SACK, &tlp);
+    q.tlp = 0;
+    run(&q, 1, SIM_LAYOUT_TS_SACK, &rto);
+    if (!tlp.done || !rto.done) {
+      printf("%-12u %8s\n", k, "stalled");
+      ret = -1;
+      continue;
+    }
+
+    snprintf(name, sizeof(name), "%u seg%s", k, k == 1 ? "" : "s");
+    printf("%-12s %8u %8u %8u %6u %6u\n", name, tlp.ticks, rto.ticks,
+        base.ticks, tlp.probes, tlp.timeouts);
+    if (tlp.timeouts != 0) {
+      ret = -1;
+    }
+  }
+  if (ret != 0) {
+    fprintf(stderr, "flextoe-tcpsim: tail loss probes failed\n");
+  }
+  return ret;
+}
+
+/** Arrival patterns for scenario_delack() */
+static const struct {
+  const char *name;
+  uint32_t burst;                 /*> Segments per burst */
+  uint32_t gap;                   /*> Between bursts [ns] */
+} arrivals[] = {
+  { "bulk", 1, 0 },
+  { "rpc 4", 4, 50000 },
+  { "rpc 1", 1, 50000 },
+};
+
+/**
+ * Delayed ACK policies against arrival patterns: ACKs the receive path
+ * sends per 100 segments, the resulting share of pipeline packets saved
+ * compared to ACKing every segment, the share of ACKs only the timer sent
+ * (each up to SIM_DELACK_TO late), and how far the marked fraction a DCTCP
+ * sender sees is off. Segments arrive at 40 Gbps within bursts, 10% of them
+ * are CE marked in runs.
+ */
+static int scenario_delack(const struct tcpsim_params *p)
+{
+  static const uint32_t policies[] = { 1, 2, 4, 8, TCP_DELACK_SEGS_MAX };
+  struct tcp_delack_model m;
+  uint64_t acks, timed;
+  uint32_t i, j, k, now, seg_ns;
+  double ce, ecn, saved;
+  int mark;
+
+  seg_ns = p->mss * 8 / 40;
+
+  printf("%-8s %5s %9s %9s %8s %8s %8s\n", "arrival", "segs", "acks/100",
+      "pkts/MB", "saved", "by timer", "ecn err");
+  for (i = 0; i < sizeof(arrivals) / sizeof(arrivals[0]); i++) {
+    for (j = 0; j < sizeof(policies) / sizeof(policies[0]); j++) {
+      memset(&m, 0, sizeof(m));
+      m.segs = policies[j];
+      m.timeout = SIM_DELACK_TO;
+      utils_rng_init(&rng, p->seed);
+      mark = 0;
+      now = 0;
+      timed = 0;
+
+      for (k = 0; k < SIM_DELACK_SEGS; k++) {
+        now += (k % arrivals[i].burst == 0 ? arrivals[i].gap : 0) + seg_ns;
+        acks = m.acks;
+        tcp_delack_model_timer(&m, now);
+        timed += m.acks - acks;
+
+        /* runs of 8 segments on average */
+        if (utils_rng_gen32(&rng) % 8 == 0) {
+          mark = (utils_rng_gen32(&rng) % 10 == 0);
+        }
+        tcp_delack_model_seg(&m, now, p->mss, mark, 0);
+      }
+      tcp_delack_model_timer(&m, now + SIM_DELACK_TO);
+
+      ce = (double) m.ce_bytes / ((uint64_t) SIM_DELACK_SEGS * p->mss);
+      ecn = (m.ack_bytes == 0 ? 0 : (double) m.ecn_bytes / m.ack_bytes);
+      saved = 1 - (double) (m.segments + m.acks) / (2 * m.segments);
+      printf("%-8s %5u %9.1f %9.1f %7.1f%% %7.1f%% %8.4f\n",
+          arrivals[i].name, policies[j], 100.0 * m.acks / m.segments,
+          (double) (m.segments + m.acks) * (1 << 20) /
+          ((uint64_t) SIM_DELACK_SEGS * p->mss), 100 * saved,
+          100.0 * timed / m.acks, ecn - ce);
+    }
+  }
+  return 0;
+}
+
+/** Application read rates for scenario_rxwnd() [bytes per RTT] */
+static const struct {
+  const char *name;
+  uint32_t read;
+  uint32_t stop;                  /*> Stops reading after this many RTTs */
+} readers[] = {
+  { "fast", UINT32_MAX, UINT32_MAX },
+  { "32KB/rtt", 32 * 1024, UINT32_MAX },
+  { "8KB/rtt", 8 * 1024, UINT32_MAX },
+  { "stalls", UINT32_MAX, SIM_RXWND_RTTS / 2 },
+};
+
+/**
+ * Receive window autotuning: one flow per application read rate, the
+ * slowpath's control loop (tcp_rxwnd_tune() with the budget clamp of
+ * rxwnd_update()) against the fastpath model, once per RTT. Runs with fixed
+ * unscaled 64KB windows, and with autotuning on a scaled 256KB buffer,
+ * without and with a budget of one and a half unscaled windows. The peer
+ * sends what the window field announces. Fails if the fastpath does not
+ * converge to the slowpath's window, ever retracts the advertised right
+ * edge, or if the fast reader does not get more out of the tuned window.
+ */
+static int scenario_rxwnd(const struct tcpsim_params *p)
+{
+  const uint32_t n = sizeof(readers) / sizeof(readers[0]);
+  const uint32_t wnd_min = 16 * TCP_RXWND_QUANTUM;
+  const uint64_t budgets[3] = { 0, UINT64_MAX, 3 * TCP_RXWND_MAX_NOWS / 2 };
+  struct tcp_rxwnd_model m[n];
+  uint64_t total, room, got[3][n];
+  uint32_t wnd[3][n], rx[n], edge[n], ws[3], next, rtt, i, run;
+  uint32_t errs = 0, retracts = 0;
+
+  ws[0] = 0;
+  ws[1] = ws[2] = TCP_WSCALE(0, tcp_wscale_shift(SIM_RXWND_BUF));
+
+  for (run = 0; run < 3; run++) {
+    total = 0;
+    for (i = 0; i < n; i++) {
+      wnd[run][i] = (run != 0 ? wnd_min : TCP_RXWND_MAX_NOWS);
+      tcp_rxwnd_model_init(&m[i], wnd[run][i]);
+      edge[i] = wnd[run][i];
+      got[run][i] = 0;
+      total += wnd[run][i];
+    }
+
+    for (rtt = 0; rtt < SIM_RXWND_RTTS; rtt++) {
+      for (i = 0; i < n; i++) {
+        rx[i] = tcp_wscale_win(ws[run], m[i].avail) <<
+            TCP_WSCALE_RCV(ws[run]);
+        if (rx[i] > SIM_RXWND_LINK) {
+          rx[i] = SIM_RXWND_LINK;
+        }
+        rx[i] = tcp_rxwnd_model_rx(&m[i], rx[i]);
+        got[run][i] += rx[i];
+        if (rtt < readers[i].stop) {
+          tcp_rxwnd_model_read(&m[i], readers[i].read);
+        }
+      }
+      if (run == 0) {
+        continue;
+      }
+
+      /* rxwnd_update() */
+      for (i = 0; i < n; i++) {
+        next = tcp_rxwnd_tune(wnd[run][i], rx[i], 1, 1, wnd_min,
+            SIM_RXWND_BUF);
+        if (next > wnd[run][i]) {
+          room = (budgets[run] > total ? budgets[run] - total : 0);
+          room &= ~(uint64_t) (TCP_RXWND_QUANTUM - 1);
+          if (next - wnd[run][i] > room) {
+            next = wnd[run][i] + room;
+          }
+        }
+        total += next;
+        total -= wnd[run][i];
+        tcp_rxwnd_model_adjust(&m[i],
+            ((int32_t) next - (int32_t) wnd[run][i]) / TCP_RXWND_QUANTUM);
+        wnd[run][i] = next;
+      }
+
+      for (i = 0; i < n; i++) {
+        /* right edge relative to the bytes received so far */
+        if ((int32_t) (m[i].rx_bytes + m[i].avail - edge[i]) < 0) {
+          retracts++;
+        }
+        edge[i] = m[i].rx_bytes + m[i].avail;
+      }
+    }
+
+    for (i = 0; i < n && run != 0; i++) {
+      /* let the application catch up, debt is paid from what it frees */
+      tcp_rxwnd_model_read(&m[i], UINT32_MAX);
+      if (tcp_rxwnd_model_wnd(&m[i]) != wnd[run][i]) {
+        errs++;
+      }
+    }
+  }
+
+  printf("%-10s %20s %20s %20s\n", "reader", "fixed [B/rtt, wnd]",
+      "tuned", "tuned, budget 96KB");
+  for (i = 0; i < n; i++) {
+    printf("%-10s", readers[i].name);
+    for (run = 0; run < 3; run++) {
+      printf(" %10" PRIu64 " %9u", got[run][i] / SIM_RXWND_RTTS,
+          wnd[run][i]);
+    }
+    printf("\n");
+  }
+
+  if (errs != 0 || retracts != 0) {
+    fprintf(stderr, "flextoe-tcpsim: %u windows off, %u retractions\n",
+        errs, retracts);
+    return -1;
+  }
+  if (got[1][0] <= got[0][0]) {
+    fprintf(stderr, "flextoe-tcpsim: tuned window no faster than 64KB\n");
+    return -1;
+  }
+  return 0;
+}
+
+static const struct {
+  const char *name;
+  int (*run)(const struct tcpsim_params *p);
+} scenarios[] = {
+  { "wire", scenario_wire },
+  { "loss", scenario_loss },
+  { "tail", scenario_tail },
+  { "delack", scenario_delack },
+  { "rxwnd", scenario_rxwnd },
+};
+
+static int parse_script(const char *arg, uint32_t *s, uint32_t *num)
+{
+  char *end;
+
+  *num = 0;
+  while (*arg != 0) {
+    if (*num == SIM_SCRIPT_MAX) {
+      return -1;
+    }
+    s[(*num)++] = strtoul(arg, &end, 10);
+    if (end == arg || (*end != ',' && *end != 0)) {
+      return -1;
+    }
+    arg = (*end == ',' ? end + 1 : end);
+  }
+  return 0;
+}
+
+static void print_usage(const char *progname)
+{
+  fprintf(stderr, "Usage: %s [OPTION]... [SCENARIO]\n"
+      "Scenarios: wire [default], loss, tail, delack, rxwnd\n"
+      "  -b, --bytes=BYTES   Transfer size [default: 1048576]\n"
+      "  -m, --mss=BYTES     Segment size [default: 1448]\n"
+      "  -w, --wnd=BYTES     Max bytes in flight [default: 46336]\n"
+      "  -d, --delay=TICKS   One-way delay [default: 8]\n"
+      "  -u, --burst=N       Segments sent per tick [default: 4]\n"
+      "  -l, --drop=I,...    Drop these data segments, 1: first sent\n"
+      "                      [default: 20,60,61,62,300]\n"
+      "  -r, --late=I,...    Delay these data segments [default: 100]\n"
+      "  -e, --extra=TICKS   Extra delay of late segments [default: 3]\n"
+      "  -p, --loss=N        Random loss per 1000 segments [default: 0]\n"
+      "  -n, --no-tlp        No tail loss probes\n"
+      "  -s, --seed=N        Random seed [default: 1]\n"
+      "  -h, --help          Show this help\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+  static const struct option opts[] = {
+    { "bytes", required_argument, NULL, 'b' },
+    { "mss", required_argument, NULL, 'm' },
+    { "wnd", required_argument, NULL, 'w' },
+    { "delay", required_argument, NULL, 'd' },
+    { "burst", required_argument, NULL, 'u' },
+    { "drop", required_argument, NULL, 'l' },
+    { "late", required_argument, NULL, 'r' },
+    { "extra", required_argument, NULL, 'e' },
+    { "loss", required_argument, NULL, 'p' },
+    { "no-tlp", no_argument, NULL, 'n' },
+    { "seed", required_argument, NULL, 's' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  struct tcpsim_params p = {
+    .bytes = 1 << 20, .mss = 1448, .wnd = 32 * 1448, .delay = 8, .burst = 4,
+    .extra = 3, .loss_pm = 0, .seed = 1, .tlp = 1,
+    .drop = { 20, 60, 61, 62, 300 }, .drop_num = 5,
+    .late = { 100 }, .late_num = 1,
+  };
+  const char *scenario = "wire";
+  unsigned i;
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "b:m:w:d:u:l:r:e:p:ns:h", opts, NULL))
+      != -1)
+  {
+    switch (opt) {
+      case 'b':
+        p.bytes = atoi(optarg);
+        break;
+      case 'm':
+        p.mss = atoi(optarg);
+        break;
+      case 'w':
+        p.wnd = atoi(optarg);
+        break;
+      case 'd':
+        p.delay = atoi(optarg);
+        break;
+      case 'u':
+        p.burst = atoi(optarg);
+        break;
+      case 'l':
+        if (parse_script(optarg, p.drop, &p.drop_num) != 0) {
+          fprintf(stderr, "flextoe-tcpsim: invalid drop list\n");
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'r':
+        if (parse_script(optarg, p.late, &p.late_num) != 0) {
+          fprintf(stderr, "flextoe-tcpsim: invalid late list\n");
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'e':
+        p.extra = atoi(optarg);
+        break;
+      case 'p':
+        p.loss_pm = atoi(optarg);
+        break;
+      case 'n':
+        p.tlp = 0;
+        break;
+      case 's':
+        p.seed = atoi(optarg);
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (optind < argc) {
+    scenario = argv[optind];
+  }
+  /* out-of-order and SACK offsets are 16 bits, also with window scaling */
+  if (p.mss == 0 || p.mss > p.wnd || p.wnd > TCP_OOO_MAX || p.bytes == 0 ||
+      p.delay == 0 || p.burst == 0 || p.loss_pm >= 1000)
+  {
+    fprintf(stderr, "flextoe-tcpsim: invalid parameters\n");
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (p.seed == 0) {
+    p.seed = 1;
+  }
+
+  for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    if (strcmp(scenarios[i].name, scenario) == 0) {
+      printf("%u bytes, mss %u, wnd %u, delay %u ticks, %u segments/tick\n",
+          p.bytes, p.mss, p.wnd, p.delay, p.burst);
+      return (scenarios[i].run(&p) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+  fprintf(stderr, "flextoe-tcpsim: unknown scenario %s\n", scenario);
+  print_usage(argv[0]);
+  return EXIT_FAILURE;
+}
@@ -20,6 +20,21 @@
  * just communicates on the sockets and uses two queues #ux_to_poll and
  * #poll_to_ux to communicate with the main thread. The main thread then calls
  * into other modules to register the context with flexnic etc.
+ *
+ * When the unix socket of an application is closed, the ux socket thread only
+ * marks it closed. The main thread then closes its listeners and connections
+ * and, once no connection refers to the application anymore, clears its
+ * contexts on the NIC and returns doorbells, application id and queue memory.
+ *
+ * Applications that pass a session token in their context requests are
+ * detached instead when the socket closes: the connections of the exited
+ * process are closed, but contexts and listeners stay for the grace period
+ * (--app-grace-period). SYNs keep going to the listener backlogs. When a new
+ * process of the session asks for contexts, the poll thread moves this state
+ * over: contexts are reset and registered again with the new eventfd, and
+ * listen requests on the old ports take over the listeners with their
+ * backlog. Whatever the new process does not ask for is freed once the grace
+ * period ends.
  */
 
 #include <stdlib.h>
@@ -35,12 +50,14 @@
 
 #include "util/common.h"
 #include "util/nbqueue.h"
+#include "util/timeout.h"
 
 #include "flextoe.h"
 #include "internal.h"
 #include "fp_mem.h"
 #include "appif.h"
 #include "sp_app_if.h"
+#include "sp_checkpoint.h"
 
 /** epoll data for listening socket */
 #define EP_LISTEN (NULL)
@@ -54,6 +71,24 @@ static void uxsocket_notify(void);
 static void uxsocket_error(struct application *app);
 static void uxsocket_receive(struct application *app);
 static void uxsocket_notify_app(struct application *app);
+static int app_teardown(struct application *app);
+static void app_close_conns(struct application *app);
+static void app_complete(struct application *app);
+static void app_detach(struct application *app);
+static int app_reclaim(struct application *app);
+static void app_adopt(struct application *app, struct application *old);
+static void app_release_spares(struct application *app);
+static struct app_context *ctx_alloc(struct application *app,
+    struct app_doorbell *adb, int evfd);
+static void ctx_reuse(struct application *app, struct app_context *ctx,
+    int evfd);
+static void ctx_response(struct application *app, struct app_context *ctx);
+static void ctx_retire(struct app_context *ctx);
+static void ctx_free(struct app_context *ctx);
+static struct app_doorbell *doorbell_alloc(void);
+static void doorbell_free(struct app_doorbell *adb);
+static int app_id_alloc(uint16_t *id);
+static void app_id_free(uint16_t id);
 
 /** Listening UX socket for applications to connect to */
 static int uxfd = -1;
@@ -69,14 +104,25 @@ static struct nbqueue ux_to_poll;
 /** Pthread handle for UX socket thread */
 static pthread_t pt_ux;
 
-/** Freelist for NIC doorbells to be allocated to applications. */
+/** Freelist for NIC doorbells to be allocated to applications, doorbells are
+ * returned at the tail to maximize the time until an id is handed out again. */
 static struct app_doorbell *free_doorbells = NULL;
-/** Next unused application id, used for allocation */
-static uint16_t app_id_next = 0;
+static struct app_doorbell *free_doorbells_tail = NULL;
+/** Bitmap of application ids in use */
+static uint32_t app_ids_used = 0;
+STATIC_ASSERT(FLEXNIC_PL_APPST_NUM <= 32, app_ids_used_bits);
+/** Protects doorbell and application id allocation (UX and poll thread) */
+static pthread_mutex_t ids_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /** Linked list of all application structs */
 static struct application *applications = NULL;
 
+/** Doorbells held by restored contexts, not put on the freelist */
+static uint8_t restored_doorbells[FLEXNIC_PL_APPCTX_NUM];
+
+/** Cleared contexts waiting for the NIC to let go of their queues */
+static struct app_context *retired_contexts = NULL;
+
 int appif_init(void)
 {
   struct app_doorbell *adb;
@@ -87,14 +133,16 @@ int appif_init(void)
   }
 
   /* create freelist of doorbells (0 is used by sp) */
-  for (i = FLEXNIC_PL_APPCTX_NUM; i > 0; i--) {
+  for (i = 1; i < FLEXNIC_PL_APPCTX_NUM; i++) {
+    if (restored_doorbells[i]) {
+      continue;
+    }
     if ((adb = malloc(sizeof(*adb))) == NULL) {
       perror("appif_init: malloc doorbell failed");
       return -1;
     }
     adb->id = i;
-    adb->next = free_doorbells;
-    free_doorbells = adb;
+    doorbell_free(adb);
   }
 
   nbqueue_init(&ux_to_poll);
@@ -110,13 +158,22 @@ int appif_init(void)
 unsigned appif_poll(void)
 {
   uint8_t *p;
-  struct application *app;
-  struct app_context *ctx;
-  ssize_t ret;
+  struct application *app, **papp;
+  struct app_context *ctx, **pctx;
   uint64_t rxq_off, txq_off;
-  uint64_t cnt = 1;
   unsigned n = 0;
 
+  /* free retired contexts the NIC is done with */
+  for (pctx = &retired_contexts; (ctx = *pctx) != NULL;) {
+    if (nicif_appctx_idle(ctx->doorbell->id)) {
+      *pctx = ctx->next;
+      ctx_free(ctx);
+      n++;
+    } else {
+      pctx = &ctx->next;
+    }
+  }
+
   /* add new applications to list */
   while ((p = nbqueue_deq(&ux_to_poll)) != NULL) {
     app = (struct application *) (p - offsetof(struct application, nqe));
@@ -124,7 +181,40 @@ unsigned appif_poll(void)
     applications = app;
   }
 
-  for (app = applications; app != NULL; app = app->next) {
+  papp = &applications;
+  while ((app = *papp) != NULL) {
+    /* tear down closed applications, may take several rounds */
+    if (app->closed) {
+      if (app_teardown(app)) {
+        *papp = app->next;
+        free(app->resp);
+        free(app);
+        n++;
+      } else {
+        papp = &app->next;
+      }
+      continue;
+    }
+    papp = &app->next;
+
+    /* exited with a session, nothing to poll until it is reclaimed */
+    if (app->detached) {
+      app_detach(app);
+      continue;
+    }
+
+    /* context request of an application with a session */
+    if (app->need_reclaim && app_reclaim(app)) {
+      app->need_reclaim = false;
+    }
+
+    /* the previous process had more than the new one asked for */
+    if ((app->spare_contexts != NULL || app->spare_listeners != NULL) &&
+        (int32_t) (app->grace_end - util_timeout_time_us()) <= 0)
+    {
+      app_release_spares(app);
+    }
+
     /* register context with NIC */
     if (app->need_reg_ctx != NULL) {
       ctx = app->need_reg_ctx;
@@ -133,19 +223,15 @@ unsigned appif_poll(void)
       rxq_off = (uint64_t) flextoe_dma_mem + app->resp->rxq_off;
       txq_off = (uint64_t) flextoe_dma_mem + app->resp->txq_off;
 
+      app->comp.status = 0;
       if (nicif_appctx_add(app->id, ctx->doorbell->id, rxq_off,
             app->req.rxq_len, txq_off, app->req.txq_len, ctx->evfd) != 0)
       {
+        /* UX thread reports the error and closes the application */
         fprintf(stderr, "appif_poll: registering context failed\n");
-        uxsocket_error(app);
-        continue;
-      }
-
-      nbqueue_enq(&poll_to_ux, &app->comp.el);
-      ret = write(notifyfd, &cnt, sizeof(cnt));
-      if (ret <= 0) {
-        perror("appif_poll: error writing to notify fd");
+        app->comp.status = -1;
       }
+      app_complete(app);
     }
 
     for (ctx = app->contexts; ctx != NULL; ctx = ctx->next) {
@@ -312,10 +398,19 @@ static void uxsocket_accept(void)
     return;
   }
 
+  if (app_id_alloc(&app->id) != 0) {
+    fprintf(stderr, "uxsocket_accept: too many applications (max=%u)\n",
+        FLEXNIC_PL_APPST_NUM);
+    free(app);
+    close(cfd);
+    return;
+  }
+
   sz = sizeof(*app->resp);
   app->resp_sz = sz;
   if ((app->resp = malloc(sz)) == NULL) {
     fprintf(stderr, "uxsocket_accept: malloc of app resp struct failed\n");
+    app_id_free(app->id);
     free(app);
     close(cfd);
     return;
@@ -326,6 +421,7 @@ static void uxsocket_accept(void)
   ev.data.ptr = app;
   if (epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev) != 0) {
     perror("uxsocket_accept: epoll_ctl failed");
+    app_id_free(app->id);
     free(app->resp);
     free(app);
     close(cfd);
@@ -333,12 +429,22 @@ static void uxsocket_accept(void)
   }
 
   app->fd = cfd;
+  app->req_rx = 0;
   app->contexts = NULL;
   app->need_reg_ctx = NULL;
   app->closed = false;
   app->conns = NULL;
   app->listeners = NULL;
-  app->id = app_id_next++;
+  app->conn_refs = 0;
+  app->comp_pending = false;
+  app->session = SP_UXSOCK_SESSION_NONE;
+  app->detached = false;
+  app->detach_done = false;
+  app->need_reclaim = false;
+  app->reclaim_evfd = -1;
+  app->reclaim_done = false;
+  app->spare_contexts = NULL;
+  app->spare_listeners = NULL;
   nbqueue_enq(&ux_to_poll, &app->nqe);
 }
 
@@ -358,39 +464,546 @@ static void uxsocket_notify(void)
   while ((p = nbqueue_deq(&poll_to_ux)) != NULL) {
     app = (struct application *) (p - offsetof(struct application, comp.el));
     uxsocket_notify_app(app);
+
+    /* poll thread may free the application from here on */
+    MEM_BARRIER();
+    app->comp_pending = false;
+  }
+}
+
+unsigned appif_stats(struct sp_stats_ctx *st, unsigned max, unsigned *n_apps)
+{
+  struct application *app;
+  struct app_context *ctx;
+  struct connection *c;
+  unsigned n = 0, apps = 0;
+  uint32_t i;
+
+  for (app = applications; app != NULL; app = app->next) {
+    if (app->closed || app->detached) {
+      continue;
+    }
+    apps++;
+
+    for (ctx = app->contexts; ctx != NULL && n < max; ctx = ctx->next) {
+      if (ctx->ready == 0) {
+        continue;
+      }
+
+      st[n].app_id = app->id;
+      st[n].db_id = ctx->doorbell->id;
+      st[n].numa_node = ctx->numa_node;
+      st[n].conns = 0;
+      for (c = app->conns; c != NULL; c = c->app_next) {
+        st[n].conns += (c->ctx == ctx);
+      }
+
+      /* entries are invalidated by the consumer */
+      st[n].rxq_len = ctx->rxq_len;
+      st[n].rxq_depth = 0;
+      for (i = 0; i < ctx->rxq_len; i++) {
+        st[n].rxq_depth += (ctx->rxq_base[i].type != FLEXTCP_PL_ARX_INVALID);
+      }
+      st[n].txq_len = ctx->txq_len;
+      st[n].txq_depth = 0;
+      for (i = 0; i < ctx->txq_len; i++) {
+        st[n].txq_depth += (ctx->txq_base[i].type != FLEXTCP_PL_ATX_INVALID);
+      }
+      n++;
+    }
   }
+
+  *n_apps = apps;
+  return n;
 }
 
+/**
+ * Mark application as closed, the poll thread tears down its state. With a
+ * session it is only detached, a restart may still reclaim its state.
+ */
 static void uxsocket_error(struct application *app)
 {
+  if (app->closed || app->detached) {
+    return;
+  }
+
+  /* restored applications have no socket */
+  if (app->fd >= 0) {
+    close(app->fd);
+  }
+  MEM_BARRIER();
+  if (app->session != SP_UXSOCK_SESSION_NONE && config.app_grace > 0) {
+    app->detached = true;
+  } else {
+    app->closed = true;
+  }
+}
+
+/**
+ * Release state of a closed application (poll thread). Returns 1 once all
+ * state is released and the application struct can be freed, 0 while
+ * connections still refer to the application.
+ */
+static int app_teardown(struct application *app)
+{
+  struct listener *l;
   struct app_context *ctx;
 
-  close(app->fd);
+  /* stop accepting new connections */
+  app_release_spares(app);
+  while ((l = app->listeners) != NULL) {
+    app->listeners = l->app_next;
+    if (tcp_listen_close(l) != 0) {
+      fprintf(stderr, "app_teardown: closing listener failed\n");
+    }
+  }
+
+  app_close_conns(app);
+  if (app->conn_refs > 0 || app->comp_pending) {
+    return 0;
+  }
 
-  /* Close app contexts */
-  ctx = app->contexts;
-  while (ctx != NULL) {
-    // TODO: Close connections
+  while ((ctx = app->contexts) != NULL) {
+    app->contexts = ctx->next;
 
     if (nicif_appctx_clear(app->id, ctx->doorbell->id) != 0) {
-      fprintf(stderr, "%s: failed to free appctx (id:%u db:%u)\n",
-              __func__, app->id, ctx->doorbell->id);
+      fprintf(stderr, "app_teardown: failed to free appctx (id:%u db:%u)\n",
+              app->id, ctx->doorbell->id);
     }
+    ctx_retire(ctx);
+  }
+
+  app_id_free(app->id);
+  return 1;
+}
 
-    ctx = ctx->next;
+/**
+ * Close the open connections of an application that is going away. The close
+ * timeout releases them through appif_conn_closed, connections still being
+ * established are closed once they are open.
+ */
+static void app_close_conns(struct application *app)
+{
+  struct connection *c;
 
-    // TODO: Free appctx
+  for (c = app->conns; c != NULL; c = c->app_next) {
+    if (c->status == CONN_OPEN) {
+      tcp_close(c);
+    }
   }
+}
 
-  app->closed = true;
+/** Pass the completion of a context request to the UX thread */
+static void app_complete(struct application *app)
+{
+  uint64_t cnt = 1;
+  ssize_t ret;
+
+  app->comp_pending = true;
+  MEM_BARRIER();
+  nbqueue_enq(&poll_to_ux, &app->comp.el);
+  ret = write(notifyfd, &cnt, sizeof(cnt));
+  if (ret <= 0) {
+    perror("app_complete: error writing to notify fd");
+  }
+}
+
+/**
+ * Drop what only the exited process of a detached application could use. Its
+ * contexts and listeners stay until the grace period ends, then the
+ * application is torn down like a closed one.
+ */
+static void app_detach(struct application *app)
+{
+  struct listener *l;
+  uint32_t now = util_timeout_time_us();
+
+  if (!app->detach_done) {
+    app->detach_done = true;
+    app->grace_end = now + config.app_grace * 1000;
+
+    /* exited before it got a context, nothing to keep */
+    if (app->contexts == NULL && app->spare_contexts == NULL) {
+      app->closed = true;
+      return;
+    }
+
+    for (l = app->listeners; l != NULL; l = l->app_next) {
+      tcp_listen_detach(l);
+    }
+
+    if (!config.quiet) {
+      printf("appif: application %u exited, keeping its session for %u ms\n",
+          app->id, config.app_grace);
+    }
+  }
+
+  app_close_conns(app);
+  if ((int32_t) (app->grace_end - now) <= 0) {
+    app->closed = true;
+  }
+}
+
+/**
+ * Serve a context request of an application with a session (poll thread). The
+ * first one takes over the state of the session's detached application, once
+ * its connections are gone. Returns 0 to be called again later, 1 once the
+ * request is handled.
+ */
+static int app_reclaim(struct application *app)
+{
+  struct application *old;
+  struct app_context *ctx, **pctx, **pmatch = NULL;
+  struct app_doorbell *adb;
+
+  if (!app->reclaim_done) {
+    for (old = applications; old != NULL; old = old->next) {
+      if (old != app && old->detached && !old->closed &&
+          old->session == app->session)
+      {
+        break;
+      }
+    }
+    if (old != NULL) {
+      /* closed connections still refer to the contexts */
+      if (!old->detach_done || old->conn_refs > 0) {
+        return 0;
+      }
+      app_adopt(app, old);
+    }
+    app->reclaim_done = true;
+  }
+
+  /* a spare context with the requested queues, on the requested node if any */
+  for (pctx = &app->spare_contexts; (ctx = *pctx) != NULL;
+      pctx = &ctx->next)
+  {
+    if (ctx->rxq_len * sizeof(struct flextcp_pl_arx_t) != app->req.rxq_len ||
+        ctx->txq_len * sizeof(struct flextcp_pl_atx_t) != app->req.txq_len)
+    {
+      continue;
+    }
+    if (pmatch == NULL || ctx->numa_node == app->req.numa_node) {
+      pmatch = pctx;
+    }
+  }
+
+  if (pmatch != NULL) {
+    /* cleared when adopted, the NIC may still hold the old queue state */
+    if (!nicif_appctx_idle((*pmatch)->doorbell->id)) {
+      return 0;
+    }
+    ctx = *pmatch;
+    *pmatch = ctx->next;
+    ctx_reuse(app, ctx, app->reclaim_evfd);
+  } else if ((adb = doorbell_alloc()) == NULL ||
+      (ctx = ctx_alloc(app, adb, app->reclaim_evfd)) == NULL)
+  {
+    /* UX thread reports the error and closes the application */
+    fprintf(stderr, "app_reclaim: allocating context failed\n");
+    if (adb != NULL) {
+      doorbell_free(adb);
+    }
+    close(app->reclaim_evfd);
+    app->comp.status = -1;
+    app_complete(app);
+    return 1;
+  }
+
+  /* registered with the NIC like a new context */
+  app->need_reg_ctx_done = ctx;
+  app->need_reg_ctx = ctx;
+  return 1;
+}
+
+/** Move contexts and listeners of a detached application to a new process */
+static void app_adopt(struct application *app, struct application *old)
+{
+  struct app_context *ctx;
+  struct listener *l;
+  unsigned n_ctx = 0, n_l = 0;
+
+  /* contexts are registered again under the new application id, each once
+   * the NIC acknowledged the clear (see app_reclaim) */
+  while ((ctx = old->contexts) != NULL) {
+    old->contexts = ctx->next;
+    if (nicif_appctx_clear(old->id, ctx->doorbell->id) != 0) {
+      fprintf(stderr, "app_adopt: failed to clear appctx (id:%u db:%u)\n",
+          old->id, ctx->doorbell->id);
+    }
+    ctx->next = old->spare_contexts;
+    old->spare_contexts = ctx;
+  }
+  while ((ctx = old->spare_contexts) != NULL) {
+    old->spare_contexts = ctx->next;
+    ctx->app = app;
+    ctx->next = app->spare_contexts;
+    app->spare_contexts = ctx;
+    n_ctx++;
+  }
+
+  /* listeners were detached along with the application */
+  while ((l = old->listeners) != NULL) {
+    old->listeners = l->app_next;
+    l->app_next = old->spare_listeners;
+    old->spare_listeners = l;
+  }
+  while ((l = old->spare_listeners) != NULL) {
+    old->spare_listeners = l->app_next;
+    l->app_next = app->spare_listeners;
+    app->spare_listeners = l;
+    n_l++;
+  }
+
+  app->grace_end = old->grace_end;
+  if (!config.quiet) {
+    printf("appif: application %u reclaims %u contexts and %u listeners of "
+        "application %u\n", app->id, n_ctx, n_l, old->id);
+  }
+
+  /* nothing left but the application id */
+  old->closed = true;
+}
+
+/** Free contexts and listeners of a previous process nobody reclaimed */
+static void app_release_spares(struct application *app)
+{
+  struct app_context *ctx;
+  struct listener *l;
+
+  /* listeners may refer to the contexts */
+  while ((l = app->spare_listeners) != NULL) {
+    app->spare_listeners = l->app_next;
+    if (tcp_listen_close(l) != 0) {
+      fprintf(stderr, "app_release_spares: closing listener failed\n");
+    }
+  }
+
+  /* cleared on the NIC when they were adopted, maybe not acknowledged yet */
+  while ((ctx = app->spare_contexts) != NULL) {
+    app->spare_contexts = ctx->next;
+    ctx_retire(ctx);
+  }
+}
+
+struct app_context *appif_ctx_lookup(uint16_t app_id, uint32_t db_id)
+{
+  struct application *app;
+  struct app_context *ctx;
+
+  for (app = applications; app != NULL; app = app->next) {
+    if (app->id != app_id) {
+      continue;
+    }
+    for (ctx = app->contexts; ctx != NULL; ctx = ctx->next) {
+      if (ctx->ready != 0 && ctx->doorbell->id == db_id) {
+        return ctx;
+      }
+    }
+  }
+  return NULL;
+}
+
+int appif_checkpoint(FILE *f, uint32_t *n)
+{
+  struct sp_ckpt_ctx rec;
+  struct application *app;
+  struct app_context *ctx;
+
+  *n = 0;
+  memset(&rec, 0, sizeof(rec));
+  for (app = applications; app != NULL; app = app->next) {
+    /* contexts still being registered are dropped, the application sees its
+     * socket close and gives up on them */
+    for (ctx = app->contexts; ctx != NULL; ctx = ctx->next) {
+      if (ctx->ready == 0) {
+        continue;
+      }
+
+      rec.app_id = app->id;
+      rec.app_closed = app->closed || app->detached;
+      rec.db_id = ctx->doorbell->id;
+      rec.spin_len = ctx->spin_len;
+      rec.spin_pos = ctx->spin_pos;
+      rec.spout_len = ctx->spout_len;
+      rec.spout_pos = ctx->spout_pos;
+      rec.rxq_len = ctx->rxq_len;
+      rec.txq_len = ctx->txq_len;
+      rec.numa_node = ctx->numa_node;
+      packetmem_checkpoint(ctx->handles.spinq, &rec.spin);
+      packetmem_checkpoint(ctx->handles.spoutq, &rec.spout);
+      packetmem_checkpoint(ctx->handles.rxq, &rec.rxq);
+      packetmem_checkpoint(ctx->handles.txq, &rec.txq);
+
+      if (fwrite(&rec, sizeof(rec), 1, f) != 1) {
+        fprintf(stderr, "appif_checkpoint: fwrite failed\n");
+        return -1;
+      }
+      (*n)++;
+    }
+  }
+  return 0;
+}
+
+/** Find or create the restored application with this id */
+static struct application *app_restore(const struct sp_ckpt_ctx *rec)
+{
+  struct application *app;
+
+  for (app = applications; app != NULL; app = app->next) {
+    if (app->id == rec->app_id) {
+      return app;
+    }
+  }
+
+  if (rec->app_id >= FLEXNIC_PL_APPST_NUM ||
+      (app_ids_used & (1U << rec->app_id)) != 0)
+  {
+    fprintf(stderr, "app_restore: invalid application id %u\n", rec->app_id);
+    return NULL;
+  }
+  if ((app = calloc(1, sizeof(*app))) == NULL) {
+    fprintf(stderr, "app_restore: calloc failed\n");
+    return NULL;
+  }
+
+  app_ids_used |= 1U << rec->app_id;
+  app->id = rec->app_id;
+  app->fd = -1;
+  app->closed = rec->app_closed;
+  app->next = applications;
+  applications = app;
+  return app;
+}
+
+int appif_restore(const struct sp_ckpt_ctx *recs, uint32_t n)
+{
+  const struct sp_ckpt_ctx *rec;
+  struct application *app;
+  struct app_context *ctx;
+  uint32_t i;
+
+  for (i = 0; i < n; i++) {
+    rec = &recs[i];
+    if (rec->db_id == 0 || rec->db_id >= FLEXNIC_PL_APPCTX_NUM ||
+        restored_doorbells[rec->db_id])
+    {
+      fprintf(stderr, "appif_restore: invalid doorbell %u\n", rec->db_id);
+      return -1;
+    }
+    if (rec->spin_len == 0 || rec->spout_len == 0 ||
+        rec->spin.len < rec->spin_len * sizeof(struct sp_appout) ||
+        rec->spout.len < rec->spout_len * sizeof(struct sp_appin) ||
+        rec->spin_pos >= rec->spin_len || rec->spout_pos >= rec->spout_len)
+    {
+      fprintf(stderr, "appif_restore: invalid queues for doorbell %u\n",
+          rec->db_id);
+      return -1;
+    }
+
+    if ((app = app_restore(rec)) == NULL) {
+      return -1;
+    }
+    if ((ctx = calloc(1, sizeof(*ctx))) == NULL ||
+        (ctx->doorbell = malloc(sizeof(*ctx->doorbell))) == NULL)
+    {
+      fprintf(stderr, "appif_restore: malloc failed\n");
+      free(ctx);
+      return -1;
+    }
+    if (packetmem_reserve(&rec->spin, &ctx->handles.spinq) != 0 ||
+        packetmem_reserve(&rec->spout, &ctx->handles.spoutq) != 0 ||
+        packetmem_reserve(&rec->rxq, &ctx->handles.rxq) != 0 ||
+        packetmem_reserve(&rec->txq, &ctx->handles.txq) != 0)
+    {
+      fprintf(stderr, "appif_restore: reserving queues failed\n");
+      return -1;
+    }
+
+    ctx->app = app;
+    ctx->doorbell->id = rec->db_id;
+    restored_doorbells[rec->db_id] = 1;
+
+    ctx->spin_base = (uint8_t *) flextoe_dma_mem + rec->spin.off;
+    ctx->spin_len = rec->spin_len;
+    ctx->spin_pos = rec->spin_pos;
+    ctx->spout_base = (uint8_t *) flextoe_dma_mem + rec->spout.off;
+    ctx->spout_len = rec->spout_len;
+    ctx->spout_pos = rec->spout_pos;
+    ctx->rxq_base = (struct flextcp_pl_arx_t *)
+      ((uint8_t *) flextoe_dma_mem + rec->rxq.off);
+    ctx->rxq_len = rec->rxq_len;
+    ctx->txq_base = (struct flextcp_pl_atx_t *)
+      ((uint8_t *) flextoe_dma_mem + rec->txq.off);
+    ctx->txq_len = rec->txq_len;
+    ctx->numa_node = (rec->numa_node < config.numa_nodes ?
+        rec->numa_node : packetmem_nic_node());
+
+    /* the NIC still has the context and its eventfd, the slowpath has no
+     * eventfd to kick until the application reconnects */
+    ctx->evfd = -1;
+    ctx->ready = 1;
+    ctx->next = app->contexts;
+    app->contexts = ctx;
+  }
+  return 0;
+}
+
+static struct app_doorbell *doorbell_alloc(void)
+{
+  struct app_doorbell *adb;
+
+  pthread_mutex_lock(&ids_mutex);
+  if ((adb = free_doorbells) != NULL) {
+    free_doorbells = adb->next;
+    if (free_doorbells == NULL) {
+      free_doorbells_tail = NULL;
+    }
+  }
+  pthread_mutex_unlock(&ids_mutex);
+  return adb;
+}
+
+static void doorbell_free(struct app_doorbell *adb)
+{
+  adb->next = NULL;
+
+  pthread_mutex_lock(&ids_mutex);
+  if (free_doorbells_tail != NULL) {
+    free_doorbells_tail->next = adb;
+  } else {
+    free_doorbells = adb;
+  }
+  free_doorbells_tail = adb;
+  pthread_mutex_unlock(&ids_mutex);
+}
+
+static int app_id_alloc(uint16_t *id)
+{
+  int ret = -1;
+
+  pthread_mutex_lock(&ids_mutex);
+  if (~app_ids_used & ((1ULL << FLEXNIC_PL_APPST_NUM) - 1)) {
+    *id = __builtin_ctz(~app_ids_used);
+    app_ids_used |= 1U << *id;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&ids_mutex);
+  return ret;
+}
+
+static void app_id_free(uint16_t id)
+{
+  pthread_mutex_lock(&ids_mutex);
+  app_ids_used &= ~(1U << id);
+  pthread_mutex_unlock(&ids_mutex);
 }
 
 static void uxsocket_receive(struct application *app)
 {
   ssize_t rx;
   struct app_context *ctx;
-  uintptr_t off_in, off_out, off_rxq, off_txq;
-  size_t spin_qsize, spout_qsize, ctx_sz;
+  struct app_doorbell *adb;
   struct epoll_event ev;
   int evfd = 0;
 
@@ -432,66 +1045,164 @@ static void uxsocket_receive(struct application *app)
 
   /* request complete */
   app->req_rx = 0;
+  assert(evfd != 0);	// XXX: Will be 0 if request was broken up
+
+  /* check queue sizes before anything is allocated */
+  if (!RTE_IS_POWER_OF_2(app->req.rxq_len/sizeof(struct flextcp_pl_arx_t)))
+  {
+    fprintf(stderr, "uxsocket_receive: invalid rxq length\n");
+    goto error_abort_app;
+  }
+  if (!RTE_IS_POWER_OF_2(app->req.txq_len/sizeof(struct flextcp_pl_atx_t)))
+  {
+    fprintf(stderr, "uxsocket_receive: invalid txq length\n");
+    goto error_abort_app;
+  }
+
+  /* no longer wait on epoll in for this socket until we get the completion */
+  ev.events = EPOLLRDHUP | EPOLLERR;
+  ev.data.ptr = app;
+  if (epoll_ctl(epfd, EPOLL_CTL_MOD, app->fd, &ev) != 0) {
+    /* not sure how to  handle this */
+    perror("uxsocket_receive: epoll_ctl failed");
+    abort();
+  }
+
+  /* the poll thread knows about state of previous processes of the session */
+  app->session = app->req.session;
+  if (app->session != SP_UXSOCK_SESSION_NONE) {
+    app->reclaim_evfd = evfd;
+    MEM_BARRIER();
+    app->need_reclaim = true;
+    return;
+  }
+
+  /* allocate doorbell */
+  if ((adb = doorbell_alloc()) == NULL) {
+    fprintf(stderr, "uxsocket_receive: allocating doorbell failed\n");
+    goto error_dballoc;
+  }
+
+  if ((ctx = ctx_alloc(app, adb, evfd)) == NULL) {
+    doorbell_free(adb);
+    goto error_abort_app;
+  }
+
+  app->need_reg_ctx_done = ctx;
+  MEM_BARRIER();
+  app->need_reg_ctx = ctx;
+
+#if 0
+  /* send out response */
+  tx = send(app->fd, &resp, sizeof(resp), 0);
+  if (tx < 0) {
+    perror("uxsocket_receive: send failed");
+    goto error_abort_app;
+  } else if (tx < sizeof(resp)) {
+    /* FIXME */
+    fprintf(stderr, "uxsocket_receive: short send for response (TODO)\n");
+    goto error_abort_app;
+  }
+#endif
+
+  return;
+
+
+error_dballoc:
+  /* out of contexts: fail this request but keep the application */
+  if (evfd > 0) {
+    close(evfd);
+  }
+  app->resp->status = -1;
+  if (send(app->fd, app->resp, app->resp_sz, 0) != app->resp_sz) {
+    perror("uxsocket_receive: send failed");
+    uxsocket_error(app);
+    return;
+  }
+
+  /* wait for epoll in again */
+  ev.events = EPOLLIN | EPOLLRDHUP | EPOLLERR;
+  ev.data.ptr = app;
+  if (epoll_ctl(epfd, EPOLL_CTL_MOD, app->fd, &ev) != 0) {
+    perror("uxsocket_receive: epoll_ctl failed");
+    abort();
+  }
+  return;
+
+error_abort_app:
+  uxsocket_error(app);
+  return;
+}
+
+/**
+ * Allocate queues for a new context and link it to the application, with the
+ * response to the context request in app->resp. Called on the UX thread, and
+ * on the poll thread for applications with a session.
+ */
+static struct app_context *ctx_alloc(struct application *app,
+    struct app_doorbell *adb, int evfd)
+{
+  struct app_context *ctx;
+  uintptr_t off_in, off_out, off_rxq, off_txq;
+  size_t spin_qsize, spout_qsize;
 
   /* allocate context struct */
-  ctx_sz = sizeof(*ctx);
-  if ((ctx = malloc(ctx_sz)) == NULL) {
-    perror("uxsocket_receive: ctx malloc failed");
-    goto error_ctxmalloc;
+  if ((ctx = malloc(sizeof(*ctx))) == NULL) {
+    perror("ctx_alloc: ctx malloc failed");
+    return NULL;
   }
 
   /* queue sizes */
   spin_qsize = config.app_spin_len;
   spout_qsize = config.app_spout_len;
 
+  /* buffers go to the application's node, the NIC's if it did not say */
+  if (app->req.numa_node < config.numa_nodes) {
+    ctx->numa_node = app->req.numa_node;
+  } else {
+    ctx->numa_node = packetmem_nic_node();
+  }
+
   /* allocate packet memory for sp queues */
-  if (packetmem_alloc(spin_qsize, &off_in, &ctx->handles.spinq) != 0) {
-    fprintf(stderr, "uxsocket_receive: packetmem_alloc in failed\n");
+  if (packetmem_alloc_node(spin_qsize, ctx->numa_node, &off_in,
+        &ctx->handles.spinq) != 0)
+  {
+    fprintf(stderr, "ctx_alloc: packetmem_alloc in failed\n");
     goto error_pktmem_in;
   }
-  if (packetmem_alloc(spout_qsize, &off_out, &ctx->handles.spoutq) != 0) {
-    fprintf(stderr, "uxsocket_receive: packetmem_alloc out failed\n");
+  if (packetmem_alloc_node(spout_qsize, ctx->numa_node, &off_out,
+        &ctx->handles.spoutq) != 0)
+  {
+    fprintf(stderr, "ctx_alloc: packetmem_alloc out failed\n");
     goto error_pktmem_out;
   }
 
   /* allocate packet memory for flexnic queues */
-  if (!RTE_IS_POWER_OF_2(app->req.rxq_len/sizeof(struct flextcp_pl_arx_t)))
-  {
-    fprintf(stderr, "uxsocket_receive: packetmem_alloc rxq failed\n");
-    goto error_pktmem;
-  }
-  if (!RTE_IS_POWER_OF_2(app->req.txq_len/sizeof(struct flextcp_pl_atx_t)))
-  {
-    fprintf(stderr, "uxsocket_receive: packetmem_alloc txq failed\n");
-    goto error_pktmem;
-  }
-  if (packetmem_alloc(app->req.rxq_len, &off_rxq, &ctx->handles.rxq)
-      != 0)
+  if (packetmem_alloc_node(app->req.rxq_len, ctx->numa_node, &off_rxq,
+        &ctx->handles.rxq) != 0)
   {
-    fprintf(stderr, "uxsocket_receive: packetmem_alloc rxq failed\n");
+    fprintf(stderr, "ctx_alloc: packetmem_alloc rxq failed\n");
     goto error_pktmem;
   }
-  if (packetmem_alloc(app->req.txq_len, &off_txq, &ctx->handles.txq)
-      != 0)
+  if (packetmem_alloc_node(app->req.txq_len, ctx->numa_node, &off_txq,
+        &ctx->handles.txq) != 0)
   {
-    fprintf(stderr, "uxsocket_receive: packetmem_alloc txq failed\n");
+    fprintf(stderr, "ctx_alloc: packetmem_alloc txq failed\n");
     packetmem_free(ctx->handles.rxq);
     goto error_pktmem;
   }
   memset((uint8_t *) flextoe_dma_mem + off_rxq, 0, app->req.rxq_len);
   memset((uint8_t *) flextoe_dma_mem + off_txq, 0, app->req.txq_len);
-  app->resp->rxq_off = off_rxq;
-  app->resp->txq_off = off_txq;
-
-  /* allocate doorbell */
-  if ((ctx->doorbell = free_doorbells) == NULL) {
-    fprintf(stderr, "uxsocket_receive: allocating doorbell failed\n");
-    goto error_dballoc;
-  }
-  free_doorbells = ctx->doorbell->next;
+  ctx->rxq_base = (struct flextcp_pl_arx_t *)
+    ((uint8_t *) flextoe_dma_mem + off_rxq);
+  ctx->rxq_len = app->req.rxq_len / sizeof(struct flextcp_pl_arx_t);
+  ctx->txq_base = (struct flextcp_pl_atx_t *)
+    ((uint8_t *) flextoe_dma_mem + off_txq);
+  ctx->txq_len = app->req.txq_len / sizeof(struct flextcp_pl_atx_t);
 
   /* initialize queuepair struct and queues */
   ctx->app = app;
+  ctx->doorbell = adb;
 
   ctx->spin_base = (uint8_t *) flextoe_dma_mem + off_in;
   ctx->spin_len = spin_qsize / sizeof(struct sp_appout);
@@ -504,62 +1215,92 @@ static void uxsocket_receive(struct application *app)
   memset(ctx->spout_base, 0, spout_qsize);
 
   ctx->ready = 0;
-  assert(evfd != 0);	// XXX: Will be 0 if request was broken up
   ctx->evfd = evfd;
 
   ctx->next = app->contexts;
   MEM_BARRIER();
   app->contexts = ctx;
 
-  /* initialize response */
-  app->resp->app_out_off = off_in;
-  app->resp->app_out_len = spin_qsize;
-  app->resp->app_in_off = off_out;
-  app->resp->app_in_len = spout_qsize;
-  app->resp->flexnic_db_id = ctx->doorbell->id;
-  app->resp->status = 0;
+  ctx_response(app, ctx);
+  return ctx;
 
-  /* no longer wait on epoll in for this socket until we get the completion */
-  ev.events = EPOLLRDHUP | EPOLLERR;
-  ev.data.ptr = app;
-  if (epoll_ctl(epfd, EPOLL_CTL_MOD, app->fd, &ev) != 0) {
-    /* not sure how to  handle this */
-    perror("uxsocket_receive: epoll_ctl failed");
-    abort();
-  }
+error_pktmem:
+  packetmem_free(ctx->handles.spoutq);
+error_pktmem_out:
+  packetmem_free(ctx->handles.spinq);
+error_pktmem_in:
+  free(ctx);
+  return NULL;
+}
 
-  app->need_reg_ctx_done = ctx;
-  MEM_BARRIER();
-  app->need_reg_ctx = ctx;
+/**
+ * Hand a context of the session's previous process to the new one. Only once
+ * the NIC acknowledged its clear: nicif_appctx_add() then starts the queues
+ * over from index 0 and the NIC loads them as a new registration.
+ */
+static void ctx_reuse(struct application *app, struct app_context *ctx,
+    int evfd)
+{
+  /* whatever the exited process left in the queues is stale */
+  memset(ctx->spin_base, 0, ctx->spin_len * sizeof(struct sp_appout));
+  memset(ctx->spout_base, 0, ctx->spout_len * sizeof(struct sp_appin));
+  memset(ctx->rxq_base, 0, ctx->rxq_len * sizeof(struct flextcp_pl_arx_t));
+  memset(ctx->txq_base, 0, ctx->txq_len * sizeof(struct flextcp_pl_atx_t));
+  ctx->spin_pos = 0;
+  ctx->spout_pos = 0;
 
-#if 0
-  /* send out response */
-  tx = send(app->fd, &resp, sizeof(resp), 0);
-  if (tx < 0) {
-    perror("uxsocket_receive: send failed");
-    goto error_abort_app;
-  } else if (tx < sizeof(resp)) {
-    /* FIXME */
-    fprintf(stderr, "uxsocket_receive: short send for response (TODO)\n");
-    goto error_abort_app;
+  if (ctx->evfd >= 0) {
+    close(ctx->evfd);
   }
-#endif
+  ctx->evfd = evfd;
+  ctx->ready = 0;
 
-  return;
+  ctx->next = app->contexts;
+  app->contexts = ctx;
 
+  ctx_response(app, ctx);
+}
 
-error_dballoc:
-  /* TODO: for () packetmem_free(ctx->txq_handle) */
-error_pktmem:
+/** Fill in the response to the context request */
+static void ctx_response(struct application *app, struct app_context *ctx)
+{
+  app->resp->app_out_off = (uint8_t *) ctx->spin_base -
+    (uint8_t *) flextoe_dma_mem;
+  app->resp->app_out_len = ctx->spin_len * sizeof(struct sp_appout);
+  app->resp->app_in_off = (uint8_t *) ctx->spout_base -
+    (uint8_t *) flextoe_dma_mem;
+  app->resp->app_in_len = ctx->spout_len * sizeof(struct sp_appin);
+  app->resp->rxq_off = (uint8_t *) ctx->rxq_base -
+    (uint8_t *) flextoe_dma_mem;
+  app->resp->txq_off = (uint8_t *) ctx->txq_base -
+    (uint8_t *) flextoe_dma_mem;
+  app->resp->flexnic_db_id = ctx->doorbell->id;
+  app->resp->status = 0;
+}
+
+/**
+ * Free a cleared context once the NIC acknowledged the clear, until then it
+ * may still read descriptors from the queues (see nicif_appctx_idle).
+ */
+static void ctx_retire(struct app_context *ctx)
+{
+  ctx->app = NULL;
+  ctx->next = retired_contexts;
+  retired_contexts = ctx;
+}
+
+/** Return doorbell and queue memory of a context no longer on the NIC */
+static void ctx_free(struct app_context *ctx)
+{
+  if (ctx->evfd >= 0) {
+    close(ctx->evfd);
+  }
+  doorbell_free(ctx->doorbell);
+  packetmem_free(ctx->handles.txq);
+  packetmem_free(ctx->handles.rxq);
   packetmem_free(ctx->handles.spoutq);
-error_pktmem_out:
   packetmem_free(ctx->handles.spinq);
-error_pktmem_in:
   free(ctx);
-error_ctxmalloc:
-error_abort_app:
-  uxsocket_error(app);
-  return;
 }
 
 static void uxsocket_notify_app(struct application *app)
@@ -568,12 +1309,14 @@ static void uxsocket_notify_app(struct application *app)
   struct epoll_event ev;
   struct app_context *ctx;
 
+  if (app->closed || app->detached) {
+    return;
+  }
+
   if (app->comp.status != 0) {
-    /* TODO: cleanup and return error */
     fprintf(stderr, "uxsocket_notify_app: status = %d, terminating app\n",
         app->comp.status);
     goto error_status;
-    return;
   }
 
   ctx = app->need_reg_ctx_done;
@@ -31,7 +31,15 @@ struct app_context {
 
   struct app_doorbell *doorbell;
 
+  /* NIC queues, only read for telemetry */
+  struct flextcp_pl_arx_t *rxq_base;
+  uint32_t rxq_len;
+  struct flextcp_pl_atx_t *txq_base;
+  uint32_t txq_len;
+
   int ready, evfd;
+  /* NUMA node the queues and connection buffers are placed on */
+  int numa_node;
   uint64_t last_ts;
   struct app_context *next;
 
@@ -60,9 +68,38 @@ struct application {
   struct listener   *listeners;
 
   struct nicif_completion comp;
+  /** Registration completion still queued for the UX thread */
+  volatile bool comp_pending;
+
+  /** Connections (incl. pending accepts) referencing one of the contexts */
+  uint32_t conn_refs;
 
   uint16_t id;
   volatile bool closed;
+
+  /**
+   * @name Session reconnect
+   * @{
+   */
+    /** Token from the context requests, SP_UXSOCK_SESSION_NONE if none */
+    uint64_t session;
+    /** Socket closed, state is kept for a restart of the session */
+    volatile bool detached;
+    /** Connections and accepts of the exited process were dropped */
+    bool detach_done;
+    /** Context request waiting for the poll thread (see app_reclaim()) */
+    volatile bool need_reclaim;
+    /** Eventfd passed with that request */
+    int reclaim_evfd;
+    /** Detached application of the session was looked for */
+    bool reclaim_done;
+    /** Contexts of the previous process not handed out again yet */
+    struct app_context *spare_contexts;
+    /** Listeners of the previous process not opened again yet */
+    struct listener *spare_listeners;
+    /** End of the grace period for detached or spare state [us] */
+    uint32_t grace_end;
+  /**@}*/
 };
 
 /**
@@ -22,6 +22,10 @@ static int spin_conn_move(struct application *app, struct app_context *ctx,
     volatile struct sp_appout *spin, volatile struct sp_appin *spout);
 static int spin_conn_close(struct application *app, struct app_context *ctx,
     volatile struct sp_appout *spin, volatile struct sp_appin *spout);
+static int spin_conn_keepalive(struct application *app,
+    struct app_context *ctx, volatile struct sp_appout *spin);
+static int spin_conn_priority(struct application *app,
+    struct app_context *ctx, volatile struct sp_appout *spin);
 static int spin_listen_open(struct application *app, struct app_context *ctx,
     volatile struct sp_appout *spin, volatile struct sp_appin *spout);
 static int spin_accept_conn(struct application *app, struct app_context *ctx,
@@ -31,6 +35,11 @@ static void appif_ctx_kick(struct app_context *ctx)
 {
   assert(ctx->evfd != 0);
 
+  /* restored context, see appif_restore() */
+  if (ctx->evfd < 0) {
+    return;
+  }
+
   /* FIXME: Skip kick if time_delta < poll_cycle */
   uint64_t val = 1;
   if (write(ctx->evfd, &val, sizeof(uint64_t)) != sizeof(uint64_t)) {
@@ -40,14 +49,86 @@ static void appif_ctx_kick(struct app_context *ctx)
   ctx->last_ts = util_rdtsc();
 }
 
+/** Remove connection from application connection list */
+static int app_conn_unlink(struct application *app, struct connection *c)
+{
+  struct connection *c_i;
+
+  if (app->conns == c) {
+    app->conns = c->app_next;
+    return 0;
+  }
+
+  for (c_i = app->conns; c_i != NULL && c_i->app_next != c;
+      c_i = c_i->app_next);
+  if (c_i == NULL) {
+    return -1;
+  }
+  c_i->app_next = c->app_next;
+  return 0;
+}
+
+void appif_ctx_conn_ref(struct app_context *ctx)
+{
+  ctx->app->conn_refs++;
+}
+
+void appif_ctx_conn_unref(struct app_context *ctx)
+{
+  assert(ctx->app->conn_refs > 0);
+  ctx->app->conn_refs--;
+}
+
+void appif_ctx_ids(const struct app_context *ctx, uint16_t *app_id,
+    uint32_t *db_id)
+{
+  *app_id = ctx->app->id;
+  *db_id = ctx->doorbell->id;
+}
+
+int appif_ctx_node(const struct app_context *ctx)
+{
+  return ctx->numa_node;
+}
+
+void appif_listen_restored(struct listener *l)
+{
+  struct application *app = l->ctx->app;
+
+  l->app_next = app->listeners;
+  app->listeners = l;
+}
+
+void appif_conn_restored(struct connection *c)
+{
+  struct application *app = c->ctx->app;
+
+  c->app_next = app->conns;
+  app->conns = c;
+}
+
 void appif_conn_opened(struct connection *c, int status)
 {
   struct app_context *ctx = c->ctx;
+  struct application *app = ctx->app;
   volatile struct sp_appin *spout = ctx->spout_base;
   uint32_t spout_pos = ctx->spout_pos;
 
   spout += spout_pos;
 
+  /* failed connections were added to the list by spin_conn_open */
+  if (status != 0) {
+    app_conn_unlink(app, c);
+  }
+
+  /* nobody left to notify, open connections are closed by the teardown */
+  if (app->closed || app->detached) {
+    if (status != 0) {
+      tcp_destroy(c);
+    }
+    return;
+  }
+
   /* make sure we have room for a response */
   if (spout->type != SP_APPIN_INVALID) {
     fprintf(stderr, "appif_conn_opened: No space in spout queue (TODO)\n");
@@ -87,12 +168,15 @@ void appif_conn_closed(struct connection *c, int status)
 {
   struct app_context *ctx = c->ctx;
   struct application *app = ctx->app;
-  struct connection *c_i;
   volatile struct sp_appin *spout = ctx->spout_base;
   uint32_t spout_pos = ctx->spout_pos;
 
   spout += spout_pos;
 
+  if (app->closed || app->detached) {
+    goto unlink;
+  }
+
   /* make sure we have room for a response */
   if (spout->type != SP_APPIN_INVALID) {
     fprintf(stderr, "appif_conn_closed: No space in spout queue (TODO)\n");
@@ -112,17 +196,11 @@ void appif_conn_closed(struct connection *c, int status)
   }
   ctx->spout_pos = spout_pos;
 
+unlink:
   /* remove from app connection list */
-  if (app->conns == c) {
-    app->conns = c->app_next;
-  } else {
-    for (c_i = app->conns; c_i != NULL && c_i->app_next != c;
-        c_i = c_i->app_next);
-    if (c_i == NULL) {
-      fprintf(stderr, "appif_conn_closed: connection not found\n");
-      abort();
-    }
-    c_i->app_next = c->app_next;
+  if (app_conn_unlink(app, c) != 0) {
+    fprintf(stderr, "appif_conn_closed: connection not found\n");
+    abort();
   }
 }
 
@@ -135,6 +213,11 @@ void appif_listen_newconn(struct listener *l, uint32_t remote_ip,
 
   spout += spout_pos;
 
+  /* a detached listener keeps its backlog for the next process */
+  if (ctx->app->closed || ctx->app->detached || l->detached) {
+    return;
+  }
+
   /* make sure we have room for a response */
   if (spout->type != SP_APPIN_INVALID) {
     fprintf(stderr, "appif_listen_newconn: No space in spout queue (TODO)\n");
@@ -165,6 +248,17 @@ void appif_accept_conn(struct connection *c, int status)
 
   spout += spout_pos;
 
+  /* keep accepted connections on the list so the teardown closes them */
+  if (app->closed || app->detached) {
+    if (status == 0) {
+      c->app_next = app->conns;
+      app->conns = c;
+    } else {
+      tcp_destroy(c);
+    }
+    return;
+  }
+
   /* make sure we have room for a response */
   if (spout->type != SP_APPIN_INVALID) {
     fprintf(stderr, "appif_accept_conn: No space in spout queue (TODO)\n");
@@ -244,6 +338,16 @@ unsigned appif_ctx_poll(struct application *app, struct app_context *ctx)
       spout_inc += spin_conn_close(app, ctx, spin, spout);
       break;
 
+    case SP_APPOUT_CONN_KEEPALIVE:
+      /* keepalive configuration, no response */
+      spin_conn_keepalive(app, ctx, spin);
+      break;
+
+    case SP_APPOUT_CONN_PRIORITY:
+      /* priority class, no response */
+      spin_conn_priority(app, ctx, spin);
+      break;
+
     case SP_APPOUT_LISTEN_OPEN:
       /* listen request */
       spout_inc += spin_listen_open(app, ctx, spin, spout);
@@ -403,10 +507,94 @@ error:
   return 1;
 }
 
+static int spin_conn_keepalive(struct application *app,
+    struct app_context *ctx, volatile struct sp_appout *spin)
+{
+  struct connection *conn;
+
+  /* hash lookup, this is issued for every new connection with keepalive */
+  conn = tcp_conn_lookup(spin->data.conn_keepalive.local_ip,
+      spin->data.conn_keepalive.local_port,
+      spin->data.conn_keepalive.remote_ip,
+      spin->data.conn_keepalive.remote_port);
+  if (conn == NULL || conn->ctx == NULL || conn->ctx->app != app ||
+      conn->opaque != spin->data.conn_keepalive.opaque)
+  {
+    fprintf(stderr, "spin_conn_keepalive: connection not found\n");
+    return -1;
+  }
+
+  if (keepalive_conn_set(conn, spin->data.conn_keepalive.idle,
+        spin->data.conn_keepalive.intvl, spin->data.conn_keepalive.cnt) != 0)
+  {
+    fprintf(stderr, "spin_conn_keepalive: keepalive_conn_set failed\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+static int spin_conn_priority(struct application *app,
+    struct app_context *ctx, volatile struct sp_appout *spin)
+{
+  struct connection *conn;
+
+  conn = tcp_conn_lookup(spin->data.conn_priority.local_ip,
+      spin->data.conn_priority.local_port,
+      spin->data.conn_priority.remote_ip,
+      spin->data.conn_priority.remote_port);
+  if (conn == NULL || conn->ctx == NULL || conn->ctx->app != app ||
+      conn->opaque != spin->data.conn_priority.opaque)
+  {
+    fprintf(stderr, "spin_conn_priority: connection not found\n");
+    return -1;
+  }
+  if (conn->status != CONN_OPEN) {
+    fprintf(stderr, "spin_conn_priority: connection not open\n");
+    return -1;
+  }
+
+  if (nicif_connection_class(conn->flow_id, spin->data.conn_priority.cls)
+      != 0)
+  {
+    fprintf(stderr, "spin_conn_priority: nicif_connection_class failed\n");
+    return -1;
+  }
+
+  return 0;
+}
+
 static int spin_listen_open(struct application *app, struct app_context *ctx,
     volatile struct sp_appout *spin, volatile struct sp_appin *spout)
 {
-  struct listener *listen;
+  struct listener *listen, **pl;
+
+  /* the previous process of the session left a listener on this port */
+  for (pl = &app->spare_listeners; (listen = *pl) != NULL;
+      pl = &listen->app_next)
+  {
+    if (listen->port == spin->data.listen_open.local_port) {
+      break;
+    }
+  }
+  if (listen != NULL) {
+    *pl = listen->app_next;
+    listen->app_next = app->listeners;
+    app->listeners = listen;
+
+    spout->data.status.opaque = spin->data.listen_open.opaque;
+    spout->data.status.status = 0;
+    MEM_BARRIER();
+    spout->type = SP_APPIN_STATUS_LISTEN_OPEN;
+
+    /* queued SYNs are announced after the status, take the entry here */
+    if (++ctx->spout_pos >= ctx->spout_len) {
+      ctx->spout_pos = 0;
+    }
+    tcp_listen_reattach(listen, ctx, spin->data.listen_open.opaque);
+    appif_ctx_kick(ctx);
+    return 0;
+  }
 
   if (tcp_listen(ctx, spin->data.listen_open.opaque,
       spin->data.listen_open.local_port, spin->data.listen_open.backlog,
@@ -15,18 +15,29 @@
 
 #include "flextoe.h"
 #include "internal.h"
+#include "sp_checkpoint.h"
 
 struct eth_addr eth_addr;
 
 #define ARP_DEBUG(x...) do { } while (0)
 // #define ARP_DEBUG(x...) fprintf(stderr, "arp: " x)
 
+/* number of buckets in the ARP cache hash table */
+#define ARP_HTSIZE 1024
+
 struct arp_entry {
   int status;
   uint32_t ip;
   uint8_t mac[ETH_ALEN];
   struct nicif_completion *compl;
 
+  /* time when the mac was last confirmed by a reply */
+  uint32_t confirm_ts;
+  /* time of the last lookup, idle entries are evicted */
+  uint32_t used_ts;
+  /* re-validation request outstanding (status 0 only) */
+  int probing;
+
   uint32_t timeout;
   struct timeout to;
 
@@ -37,11 +48,17 @@ struct arp_entry {
 static inline int response_tx(const void *dst_mac, uint32_t dst_ip);
 static inline int request_tx(uint32_t dst_ip);
 static inline struct arp_entry *ae_lookup(uint32_t ip);
+static inline void ae_insert(struct arp_entry *ae);
+static inline void ae_remove(struct arp_entry *ae);
+static void probe_timeout(struct arp_entry *ae);
 
-static struct arp_entry *arp_table = NULL;
+static struct arp_entry *arp_table[ARP_HTSIZE];
 
 #define GRATUITOUS_ARP_TIMEOUT_US       (1000 * 1000 * 5)    /* 5 seconds */
+#define ARP_REACHABLE_US                (1000 * 1000 * 60)   /* 60 seconds */
+#define ARP_GC_IDLE_US                  (4 * ARP_REACHABLE_US)
 static struct timeout grat_arp_to;
+static struct timeout gc_arp_to;
 
 int arp_init(void)
 {
@@ -54,9 +71,10 @@ int arp_init(void)
   memcpy(&eth_addr, &flextoe_info->mac_address, ETH_ADDR_LEN);
   memcpy(lb->mac, &eth_addr, ETH_ADDR_LEN);
   lb->compl = NULL;
-  lb->next = NULL;
-  lb->prev = NULL;
-  arp_table = lb;
+  lb->confirm_ts = 0;
+  lb->used_ts = 0;
+  lb->probing = 0;
+  ae_insert(lb);
 
   mac = 0;
   memcpy(&mac, &eth_addr, ETH_ADDR_LEN);
@@ -72,6 +90,7 @@ int arp_init(void)
   }
 
   util_timeout_arm(&timeout_mgr, &grat_arp_to, GRATUITOUS_ARP_TIMEOUT_US, TO_ARP_GRAT);
+  util_timeout_arm(&timeout_mgr, &gc_arp_to, ARP_REACHABLE_US, TO_ARP_GC);
 
   return 0;
 }
@@ -79,6 +98,7 @@ int arp_init(void)
 int arp_request(struct nicif_completion *comp, uint32_t ip, uint64_t *mac)
 {
   struct arp_entry *ae;
+  uint32_t now;
 
   *mac = 0;
   /* found entry */
@@ -86,6 +106,22 @@ int arp_request(struct nicif_completion *comp, uint32_t ip, uint64_t *mac)
     if (ae->status == 0) {
       ARP_DEBUG("lookup succeeded (%x)\n", ip);
       memcpy(mac, ae->mac, 6);
+
+      /* entry aged out: keep using it, but re-validate with a new request,
+       * the reply refreshes the mac, no reply invalidates the entry */
+      now = util_timeout_time_us();
+      ae->used_ts = now;
+      if (ip != config.ip && !ae->probing &&
+          now - ae->confirm_ts >= ARP_REACHABLE_US)
+      {
+        ARP_DEBUG("probing stale entry (%x)\n", ip);
+        ae->probing = 1;
+        if (request_tx(ip) != 0) {
+          fprintf(stderr, "%s: sending out probe failed\n", __func__);
+        }
+        ae->timeout = config.arp_to;
+        util_timeout_arm(&timeout_mgr, &ae->to, ae->timeout, TO_ARP_PROBE);
+      }
       return 0;
     } else {
       /* request still pending */
@@ -105,6 +141,8 @@ int arp_request(struct nicif_completion *comp, uint32_t ip, uint64_t *mac)
 
   ae->status = 1;
   ae->ip = ip;
+  ae->used_ts = util_timeout_time_us();
+  ae->probing = 0;
   ae->compl = comp;
   comp->el.next = NULL;
   comp->ptr = mac;
@@ -119,13 +157,8 @@ int arp_request(struct nicif_completion *comp, uint32_t ip, uint64_t *mac)
   ae->timeout = config.arp_to;
   util_timeout_arm(&timeout_mgr, &ae->to, ae->timeout, TO_ARP_REQ);
 
-  /* insert into list */
-  ae->prev = NULL;
-  ae->next = arp_table;
-  if (arp_table != NULL) {
-    arp_table->prev = ae;
-  }
-  arp_table = ae;
+  /* insert into cache */
+  ae_insert(ae);
 
   ARP_DEBUG("request sent (%x)\n", ip);
 
@@ -175,7 +208,7 @@ void arp_packet(const void *pkt, uint16_t len)
       return;
     }
 
-    if (ae->status == 1) {
+    if (ae->status == 1 || ae->probing) {
       /* disarm timeout */
       util_timeout_disarm(&timeout_mgr, &ae->to);
     }
@@ -183,6 +216,8 @@ void arp_packet(const void *pkt, uint16_t len)
     /* fill in information on arp entry */
     memcpy(ae->mac, &arp->sha, ETH_ADDR_LEN);
     ae->status = 0;
+    ae->probing = 0;
+    ae->confirm_ts = util_timeout_time_us();
 
     /* notify waiting connections */
     for (comp = ae->compl; comp != NULL; comp = comp_next) {
@@ -214,6 +249,11 @@ void arp_timeout(struct timeout *to, enum timeout_type type)
 
   ARP_DEBUG("arp_timeout(%x): timeout=%uus\n", ae->ip, ae->timeout);
 
+  if (type == TO_ARP_PROBE) {
+    probe_timeout(ae);
+    return;
+  }
+
   /* the arp entry should not be ready or the timeout would have been
    * cancelled */
   if (ae->status == 0) {
@@ -241,14 +281,7 @@ void arp_timeout(struct timeout *to, enum timeout_type type)
     }
 
     /* remove arp entry from cache */
-    if (ae->prev != NULL) {
-      ae->prev->next = ae->next;
-    } else {
-      arp_table = ae->next;
-    }
-    if (ae->next != NULL) {
-      ae->next->prev = ae->prev;
-    }
+    ae_remove(ae);
 
     /* free entry */
     free(ae);
@@ -265,6 +298,50 @@ void arp_timeout(struct timeout *to, enum timeout_type type)
   util_timeout_arm(&timeout_mgr, &ae->to, ae->timeout, TO_ARP_REQ);
 }
 
+/** Re-validation of a stale entry got no reply (yet) */
+static void probe_timeout(struct arp_entry *ae)
+{
+  if (ae->timeout * 2 >= config.arp_to_max) {
+    /* peer is gone or changed its address: drop the stale mac, the next
+     * lookup resolves from scratch */
+    ARP_DEBUG("probe_timeout: probe for %x failed\n", ae->ip);
+    ae_remove(ae);
+    free(ae);
+    return;
+  }
+
+  if (request_tx(ae->ip) != 0) {
+    fprintf(stderr, "probe_timeout: sending out probe failed\n");
+  }
+  ae->timeout *= 2;
+  util_timeout_arm(&timeout_mgr, &ae->to, ae->timeout, TO_ARP_PROBE);
+}
+
+void arp_gc_timeout(struct timeout *to, enum timeout_type type)
+{
+  struct arp_entry *ae, *ae_next;
+  uint32_t i, now = util_timeout_time_us();
+
+  /* evict resolved entries nobody looked up for a while, pending requests
+   * and probes have timeouts of their own */
+  for (i = 0; i < ARP_HTSIZE; i++) {
+    for (ae = arp_table[i]; ae != NULL; ae = ae_next) {
+      ae_next = ae->next;
+      if (ae->status != 0 || ae->probing || ae->ip == config.ip ||
+          now - ae->used_ts < ARP_GC_IDLE_US)
+      {
+        continue;
+      }
+
+      ARP_DEBUG("arp_gc_timeout: evicting %x\n", ae->ip);
+      ae_remove(ae);
+      free(ae);
+    }
+  }
+
+  util_timeout_arm(&timeout_mgr, to, ARP_REACHABLE_US, TO_ARP_GC);
+}
+
 static inline int response_tx(const void *dst_mac, uint32_t dst_ip)
 {
   struct pkt_arp *parp_out;
@@ -339,14 +416,98 @@ void gratuitous_arp_timeout(struct timeout *to, enum timeout_type type)
   util_timeout_arm(&timeout_mgr, to, GRATUITOUS_ARP_TIMEOUT_US, TO_ARP_GRAT);
 }
 
+int arp_checkpoint(FILE *f, uint32_t *n)
+{
+  struct sp_ckpt_arp rec;
+  struct arp_entry *ae;
+  uint32_t i;
+
+  *n = 0;
+  memset(&rec, 0, sizeof(rec));
+  for (i = 0; i < ARP_HTSIZE; i++) {
+    for (ae = arp_table[i]; ae != NULL; ae = ae->next) {
+      /* pending requests are retried by whoever needs the entry again */
+      if (ae->status != 0 || ae->ip == config.ip) {
+        continue;
+      }
+
+      rec.ip = ae->ip;
+      rec.mac = 0;
+      memcpy(&rec.mac, ae->mac, ETH_ALEN);
+      if (fwrite(&rec, sizeof(rec), 1, f) != 1) {
+        fprintf(stderr, "arp_checkpoint: fwrite failed\n");
+        return -1;
+      }
+      (*n)++;
+    }
+  }
+  return 0;
+}
+
+int arp_restore(const struct sp_ckpt_arp *recs, uint32_t n)
+{
+  struct arp_entry *ae;
+  uint32_t i, now = util_timeout_time_us();
+
+  for (i = 0; i < n; i++) {
+    if (ae_lookup(recs[i].ip) != NULL) {
+      continue;
+    }
+    if ((ae = malloc(sizeof(*ae))) == NULL) {
+      fprintf(stderr, "arp_restore: malloc failed\n");
+      return -1;
+    }
+
+    ae->status = 0;
+    ae->ip = recs[i].ip;
+    memcpy(ae->mac, &recs[i].mac, ETH_ALEN);
+    ae->compl = NULL;
+    /* age is unknown, the next lookup re-validates the entry */
+    ae->confirm_ts = now - ARP_REACHABLE_US;
+    ae->used_ts = now;
+    ae->probing = 0;
+    ae_insert(ae);
+  }
+  return 0;
+}
+
+static inline uint32_t ae_hash(uint32_t ip)
+{
+  return (ip * 2654435761u) >> 22;   /* 10 bits = ARP_HTSIZE */
+}
+
 static inline struct arp_entry *ae_lookup(uint32_t ip)
 {
   struct arp_entry *ae;
 
-  for (ae = arp_table; ae != NULL; ae = ae->next) {
+  for (ae = arp_table[ae_hash(ip)]; ae != NULL; ae = ae->next) {
     if (ae->ip == ip) {
       return ae;
     }
   }
   return NULL;
 }
+
+static inline void ae_insert(struct arp_entry *ae)
+{
+  struct arp_entry **bucket = &arp_table[ae_hash(ae->ip)];
+
+  ae->prev = NULL;
+  ae->next = *bucket;
+  if (*bucket != NULL) {
+    (*bucket)->prev = ae;
+  }
+  *bucket = ae;
+}
+
+static inline void ae_remove(struct arp_entry *ae)
+{
+  if (ae->prev != NULL) {
+    ae->prev->next = ae->next;
+  } else {
+    arp_table[ae_hash(ae->ip)] = ae->next;
+  }
+  if (ae->next != NULL) {
+    ae->next->prev = ae->prev;
+  }
+}
@@ -0,0 +1,532 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * @brief Packet capture of slowpath traffic.
+ * @file capture.c
+ * @addtogroup tas-sp-capture
+ *
+ * The slowpath copies matching frames into a single producer, single
+ * consumer ring and never blocks on it: if the ring is full the frame is
+ * counted as dropped. A writer thread drains the ring into pcapng files.
+ */
+
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <rte/common.h>
+
+#include "util/common.h"
+
+#include "flextoe.h"
+#include "internal.h"
+#include "packet_defs.h"
+
+#define CAPTURE_TERMS_MAX   16
+
+/* pcapng block types and options */
+#define PCAPNG_SHB          0x0A0D0D0A
+#define PCAPNG_IDB          0x00000001
+#define PCAPNG_EPB          0x00000006
+#define PCAPNG_BOM          0x1A2B3C4D
+#define PCAPNG_LINK_ETH     1
+#define PCAPNG_OPT_END      0
+#define PCAPNG_IF_TSRESOL   9
+#define PCAPNG_EPB_FLAGS    2
+
+enum capture_term_kind {
+  CT_ARP,
+  CT_IP,
+  CT_TCP,
+  CT_HOST,
+  CT_PORT,
+  CT_FLAGS,
+};
+
+#define CT_SRC  1
+#define CT_DST  2
+
+/** Filter primitive, a filter is an OR of AND groups of these */
+struct capture_term {
+  uint8_t kind;
+  uint8_t dir;                    /*> CT_SRC | CT_DST */
+  uint8_t neg;
+  uint8_t group_start;            /*> First term after an "or" */
+  uint32_t val;
+};
+
+/** Ring slot, followed by snaplen bytes of packet data */
+struct capture_slot {
+  uint64_t ts;                    /*> Wall clock [ns] */
+  uint16_t len;
+  uint16_t caplen;
+  uint8_t dir;
+} __attribute__((aligned(8)));
+
+int capture_on = 0;
+
+static struct capture_term terms[CAPTURE_TERMS_MAX];
+static unsigned terms_num;
+
+static uint8_t *ring;
+static size_t slot_size;
+static uint32_t ring_mask;
+static uint32_t ring_head;        /*> Written by the slowpath only */
+static uint32_t ring_tail;        /*> Written by the writer only */
+
+static uint64_t cap_packets;
+static uint64_t cap_drops;
+
+static pthread_t writer_thread;
+static int writer_stop;
+static FILE *out;
+static uint64_t out_bytes;
+static unsigned out_idx;
+
+static int filter_parse(const char *expr);
+static void *writer_main(void *arg);
+
+int capture_init(void)
+{
+  if (config.pcap_path[0] == 0) {
+    return 0;
+  }
+
+  if (filter_parse(config.pcap_filter) != 0) {
+    return -1;
+  }
+
+  slot_size = RTE_ALIGN(sizeof(struct capture_slot) + config.pcap_snaplen, 8);
+  if ((ring = calloc(config.pcap_ring_len, slot_size)) == NULL) {
+    fprintf(stderr, "capture_init: calloc ring failed\n");
+    return -1;
+  }
+  ring_mask = config.pcap_ring_len - 1;
+
+  if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+    fprintf(stderr, "capture_init: pthread_create failed\n");
+    free(ring);
+    ring = NULL;
+    return -1;
+  }
+
+  capture_on = !config.pcap_paused;
+  return 0;
+}
+
+int capture_enable(int on)
+{
+  if (ring == NULL) {
+    return -1;
+  }
+
+  __atomic_store_n(&capture_on, !!on, __ATOMIC_RELAXED);
+  return 0;
+}
+
+void capture_cleanup(void)
+{
+  if (ring == NULL) {
+    return;
+  }
+
+  capture_on = 0;
+  __atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+  pthread_join(writer_thread, NULL);
+
+  if (!config.quiet) {
+    printf("capture: %"PRIu64" packets, %"PRIu64" dropped\n",
+        cap_packets, cap_drops);
+  }
+  free(ring);
+  ring = NULL;
+}
+
+/*****************************************************************************/
+/* Filter */
+
+static int filter_match(const uint8_t *pkt, uint16_t len)
+{
+  const struct eth_hdr *eth = (const struct eth_hdr *) pkt;
+  const struct ip_hdr *ip = (const struct ip_hdr *) (eth + 1);
+  const struct tcp_hdr *tcp = (const struct tcp_hdr *) (ip + 1);
+  uint16_t type;
+  unsigned i;
+  int is_ip, is_tcp, m, group = 1;
+
+  if (terms_num == 0) {
+    return 1;
+  }
+  if (len < sizeof(*eth)) {
+    return 0;
+  }
+
+  type = f_beui16(eth->type);
+  is_ip = (type == ETH_TYPE_IP && len >= sizeof(*eth) + sizeof(*ip));
+  is_tcp = (is_ip && ip->proto == IP_PROTO_TCP &&
+      len >= sizeof(*eth) + sizeof(*ip) + sizeof(*tcp));
+
+  for (i = 0; i < terms_num; i++) {
+    if (terms[i].group_start) {
+      if (group) {
+        return 1;
+      }
+      group = 1;
+    } else if (!group) {
+      continue;
+    }
+
+    switch (terms[i].kind) {
+      case CT_ARP:
+        m = (type == ETH_TYPE_ARP);
+        break;
+      case CT_IP:
+        m = is_ip;
+        break;
+      case CT_TCP:
+        m = is_tcp;
+        break;
+      case CT_HOST:
+        m = is_ip &&
+          (((terms[i].dir & CT_SRC) && f_beui32(ip->src) == terms[i].val) ||
+           ((terms[i].dir & CT_DST) && f_beui32(ip->dest) == terms[i].val));
+        break;
+      case CT_PORT:
+        m = is_tcp &&
+          (((terms[i].dir & CT_SRC) && f_beui16(tcp->src) == terms[i].val) ||
+           ((terms[i].dir & CT_DST) && f_beui16(tcp->dest) == terms[i].val));
+        break;
+      case CT_FLAGS:
+        m = is_tcp && (TCPH_FLAGS(tcp) & terms[i].val) != 0;
+        break;
+      default:
+        m = 0;
+        break;
+    }
+    group = (m != terms[i].neg);
+  }
+
+  return group;
+}
+
+/**
+ * Parse a filter in a subset of the tcpdump syntax: primitives "arp", "ip",
+ * "tcp", "[src|dst] host ADDR", "[src|dst] port PORT" and the TCP flags
+ * "syn", "ack", "fin", "rst", each optionally negated with "not", combined
+ * with "and" and "or" where "and" binds stronger. No parentheses.
+ */
+static int filter_parse(const char *expr)
+{
+  char buf[CONFIG_PCAP_FILTER_MAX], *tok, *save = NULL;
+  struct capture_term *t = NULL;
+  struct in_addr addr;
+  unsigned long port;
+  char *end;
+  int expect_term = 1, group_start = 0;
+
+  terms_num = 0;
+  strncpy(buf, expr, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = 0;
+
+  for (tok = strtok_r(buf, " \t", &save); tok != NULL;
+      tok = strtok_r(NULL, " \t", &save))
+  {
+    if (!expect_term) {
+      if (!strcmp(tok, "and") || !strcmp(tok, "&&")) {
+        expect_term = 1;
+        continue;
+      } else if (!strcmp(tok, "or") || !strcmp(tok, "||")) {
+        expect_term = 1;
+        group_start = 1;
+        continue;
+      }
+      goto error;
+    }
+
+    if (t == NULL) {
+      if (terms_num == CAPTURE_TERMS_MAX) {
+        fprintf(stderr, "capture filter: more than %u primitives\n",
+            CAPTURE_TERMS_MAX);
+        return -1;
+      }
+      t = &terms[terms_num];
+      memset(t, 0, sizeof(*t));
+      t->dir = CT_SRC | CT_DST;
+      t->group_start = group_start;
+    }
+
+    if (!strcmp(tok, "not") || !strcmp(tok, "!")) {
+      t->neg = !t->neg;
+      continue;
+    } else if (!strcmp(tok, "src")) {
+      t->dir = CT_SRC;
+      continue;
+    } else if (!strcmp(tok, "dst")) {
+      t->dir = CT_DST;
+      continue;
+    } else if (!strcmp(tok, "arp")) {
+      t->kind = CT_ARP;
+    } else if (!strcmp(tok, "ip")) {
+      t->kind = CT_IP;
+    } else if (!strcmp(tok, "tcp")) {
+      t->kind = CT_TCP;
+    } else if (!strcmp(tok, "syn")) {
+      t->kind = CT_FLAGS;
+      t->val = TCP_SYN;
+    } else if (!strcmp(tok, "ack")) {
+      t->kind = CT_FLAGS;
+      t->val = TCP_ACK;
+    } else if (!strcmp(tok, "fin")) {
+      t->kind = CT_FLAGS;
+      t->val = TCP_FIN;
+    } else if (!strcmp(tok, "rst")) {
+      t->kind = CT_FLAGS;
+      t->val = TCP_RST;
+    } else if (!strcmp(tok, "host")) {
+      if ((tok = strtok_r(NULL, " \t", &save)) == NULL ||
+          inet_pton(AF_INET, tok, &addr) != 1)
+      {
+        goto error;
+      }
+      t->kind = CT_HOST;
+      t->val = ntohl(addr.s_addr);
+    } else if (!strcmp(tok, "port")) {
+      if ((tok = strtok_r(NULL, " \t", &save)) == NULL) {
+        goto error;
+      }
+      port = strtoul(tok, &end, 10);
+      if (!*tok || *end || port > UINT16_MAX) {
+        goto error;
+      }
+      t->kind = CT_PORT;
+      t->val = port;
+    } else {
+      goto error;
+    }
+
+    /* src/dst only qualify host and port */
+    if (t->dir != (CT_SRC | CT_DST) && t->kind != CT_HOST &&
+        t->kind != CT_PORT)
+    {
+      goto error;
+    }
+
+    terms_num++;
+    t = NULL;
+    expect_term = 0;
+    group_start = 0;
+  }
+
+  if (expect_term && (terms_num > 0 || t != NULL)) {
+    tok = "end of filter";
+    goto error;
+  }
+  return 0;
+
+error:
+  fprintf(stderr, "capture filter: unexpected %s\n",
+      tok != NULL ? tok : "end of filter");
+  terms_num = 0;
+  return -1;
+}
+
+/*****************************************************************************/
+/* Slowpath side */
+
+void capture_packet(const void *pkt, uint16_t len, enum capture_dir dir)
+{
+  struct capture_slot *slot;
+  struct timespec ts;
+  uint32_t head = ring_head;
+
+  if (!filter_match(pkt, len)) {
+    return;
+  }
+
+  if (head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) > ring_mask) {
+    cap_drops++;
+    return;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  slot = (struct capture_slot *) (ring + (size_t) (head & ring_mask) *
+      slot_size);
+  slot->ts = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  slot->len = len;
+  slot->caplen = MIN(len, config.pcap_snaplen);
+  slot->dir = dir;
+  memcpy(slot + 1, pkt, slot->caplen);
+
+  __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*****************************************************************************/
+/* Writer thread */
+
+static int block_write(uint32_t type, const void *body, size_t body_len,
+    const void *data, size_t data_len, const void *opts, size_t opts_len)
+{
+  static const uint8_t pad[4];
+  size_t data_pad = RTE_ALIGN(data_len, 4) - data_len;
+  uint32_t total = 12 + body_len + data_len + data_pad + opts_len;
+
+  if (fwrite(&type, 4, 1, out) != 1 ||
+      fwrite(&total, 4, 1, out) != 1 ||
+      (body_len > 0 && fwrite(body, body_len, 1, out) != 1) ||
+      (data_len > 0 && fwrite(data, data_len, 1, out) != 1) ||
+      (data_pad > 0 && fwrite(pad, data_pad, 1, out) != 1) ||
+      (opts_len > 0 && fwrite(opts, opts_len, 1, out) != 1) ||
+      fwrite(&total, 4, 1, out) != 1)
+  {
+    return -1;
+  }
+
+  out_bytes += total;
+  return 0;
+}
+
+static int file_open(void)
+{
+  char path[PATH_MAX + 16];
+  struct {
+    uint32_t bom;
+    uint16_t major;
+    uint16_t minor;
+    int64_t section_len;
+  } __attribute__((packed)) shb = { PCAPNG_BOM, 1, 0, -1 };
+  struct {
+    uint16_t link;
+    uint16_t reserved;
+    uint32_t snaplen;
+  } idb = { PCAPNG_LINK_ETH, 0, config.pcap_snaplen };
+  /* if_tsresol: nanoseconds */
+  struct {
+    uint16_t code;
+    uint16_t len;
+    uint8_t val[4];
+    uint16_t end_code;
+    uint16_t end_len;
+  } idb_opts = { PCAPNG_IF_TSRESOL, 1, { 9 }, PCAPNG_OPT_END, 0 };
+
+  if (config.pcap_files > 1) {
+    snprintf(path, sizeof(path), "%s.%u", config.pcap_path, out_idx);
+    out_idx = (out_idx + 1) % config.pcap_files;
+  } else {
+    snprintf(path, sizeof(path), "%s", config.pcap_path);
+  }
+
+  if ((out = fopen(path, "w")) == NULL) {
+    fprintf(stderr, "capture: opening %s failed: %s\n", path,
+        strerror(errno));
+    return -1;
+  }
+
+  out_bytes = 0;
+  if (block_write(PCAPNG_SHB, &shb, sizeof(shb), NULL, 0, NULL, 0) != 0 ||
+      block_write(PCAPNG_IDB, &idb, sizeof(idb), NULL, 0, &idb_opts,
+        sizeof(idb_opts)) != 0)
+  {
+    fprintf(stderr, "capture: writing %s failed\n", path);
+    fclose(out);
+    out = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+static int slot_write(const struct capture_slot *slot)
+{
+  struct {
+    uint32_t iface;
+    uint32_t ts_high;
+    uint32_t ts_low;
+    uint32_t caplen;
+    uint32_t len;
+  } epb = { 0, slot->ts >> 32, slot->ts, slot->caplen, slot->len };
+  /* epb_flags: inbound 1, outbound 2 */
+  struct {
+    uint16_t code;
+    uint16_t len;
+    uint32_t flags;
+    uint16_t end_code;
+    uint16_t end_len;
+  } opts = { PCAPNG_EPB_FLAGS, 4, (slot->dir == CAPTURE_RX ? 1 : 2),
+    PCAPNG_OPT_END, 0 };
+  size_t size = 12 + sizeof(epb) + RTE_ALIGN(slot->caplen, 4) + sizeof(opts);
+
+  if (config.pcap_max_size != 0 &&
+      out_bytes + size > config.pcap_max_size)
+  {
+    fclose(out);
+    out = NULL;
+
+    if (config.pcap_files <= 1) {
+      fprintf(stderr, "capture: size limit reached, capture stopped\n");
+      __atomic_store_n(&capture_on, 0, __ATOMIC_RELAXED);
+      return -1;
+    }
+    if (file_open() != 0) {
+      __atomic_store_n(&capture_on, 0, __ATOMIC_RELAXED);
+      return -1;
+    }
+  }
+
+  if (block_write(PCAPNG_EPB, &epb, sizeof(epb), slot + 1, slot->caplen,
+        &opts, sizeof(opts)) != 0)
+  {
+    fprintf(stderr, "capture: write failed, capture stopped\n");
+    __atomic_store_n(&capture_on, 0, __ATOMIC_RELAXED);
+    return -1;
+  }
+
+  cap_packets++;
+  return 0;
+}
+
+static void *writer_main(void *arg)
+{
+  uint32_t tail = 0, head;
+  int stop = 0;
+
+  if (file_open() != 0) {
+    __atomic_store_n(&capture_on, 0, __ATOMIC_RELAXED);
+  }
+
+  while (!stop) {
+    stop = __atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+      if (out != NULL) {
+        fflush(out);
+      }
+      if (!stop) {
+        usleep(1000);
+      }
+      continue;
+    }
+
+    for (; tail != head; tail++) {
+      if (out != NULL) {
+        slot_write((struct capture_slot *) (ring +
+              (size_t) (tail & ring_mask) * slot_size));
+      }
+    }
+    __atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+  }
+
+  if (out != NULL) {
+    fclose(out);
+    out = NULL;
+  }
+  return NULL;
+}
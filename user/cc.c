@@ -9,11 +9,15 @@
 
 #include "flextoe.h"
 #include "internal.h"
+#include "tcp_rxwnd.h"
+#include "sp_cctrace.h"
 
 #define CONF_MSS 1400
 
-static inline void issue_retransmits(struct connection *c,
+static inline uint8_t issue_retransmits(struct connection *c,
     struct nicif_connection_stats *stats, uint32_t cur_ts);
+static inline void cc_trace(struct connection *c,
+    struct nicif_connection_stats *stats, uint8_t flags, uint32_t cur_ts);
 
 static inline void dctcp_win_init(struct connection *c);
 static inline void dctcp_win_update(struct connection *c,
@@ -33,9 +37,16 @@ static inline void const_rate_update(struct connection *c,
 
 static inline uint32_t window_to_rate(uint32_t window, uint32_t rtt);
 
+static inline void cc_algorithm_init(struct connection *conn);
+static inline void rxwnd_init(struct connection *c);
+static inline void rxwnd_update(struct connection *c,
+    struct nicif_connection_stats *stats, uint32_t diff_ts);
+static inline void rxwnd_remove(struct connection *c);
+
 static uint32_t last_ts = 0;
 static struct connection *cc_conns = NULL;
 static struct connection *next_conn = NULL;
+static uint64_t rxwnd_total = 0;
 
 int cc_init(void)
 {
@@ -70,6 +81,7 @@ unsigned cc_poll(uint32_t cur_ts)
   uint32_t diff_ts;
   uint32_t last;
   unsigned n = 0;
+  uint8_t flags;
 
   diff_ts = cur_ts - last_ts;
   if (0 && diff_ts < config.cc_control_granularity)
@@ -111,9 +123,20 @@ unsigned cc_poll(uint32_t cur_ts)
     c->cc_last_ecnb = stats.c_ecnb;
     stats.c_ecnb -= last;
 
+    last = c->cc_last_rxb;
+    c->cc_last_rxb = stats.c_rxb;
+    stats.c_rxb -= last;
+
+    if (stats.c_acks != 0 || stats.c_rxb != 0) {
+      keepalive_conn_active(c);
+    }
+
     spstats.drops += stats.c_drops;
     spstats.ecn_marked += stats.c_ecnb;
     spstats.acks += stats.c_ackb;
+    c->cc_total_drops += stats.c_drops;
+    c->cc_total_ecnb += stats.c_ecnb;
+    c->cc_total_ackb += stats.c_ackb;
 
     switch (config.cc_algorithm) {
       case CONFIG_CC_DCTCP_WIN:
@@ -139,8 +162,15 @@ unsigned cc_poll(uint32_t cur_ts)
         break;
     }
 
-    issue_retransmits(c, &stats, cur_ts);
+    flags = issue_retransmits(c, &stats, cur_ts);
     nicif_connection_setrate(c->flow_id, c->cc_rate);
+    rxwnd_update(c, &stats, cur_ts - c->cc_last_ts);
+
+    if (config.cc_trace_sample != 0 &&
+        c->flow_id % config.cc_trace_sample == 0)
+    {
+      cc_trace(c, &stats, flags, cur_ts);
+    }
 
     c->cc_last_ts = cur_ts;
 
@@ -159,7 +189,65 @@ void cc_conn_init(struct connection *conn)
   conn->cc_last_ts = cur_ts;
   conn->cc_rtt = config.tcp_rtt_init;
   conn->cc_rexmits = 0;
+  conn->cc_total_drops = 0;
+  conn->cc_total_ackb = 0;
+  conn->cc_total_ecnb = 0;
+  conn->cc_last_rxb = 0;
+  rxwnd_init(conn);
+  cc_algorithm_init(conn);
+}
+
+void cc_conn_restore(struct connection *conn, int reinit)
+{
+  conn->cc_next = cc_conns;
+  cc_conns = conn;
+
+  /* the fast path counters were not read while no slowpath was running, the
+   * first interval after the restart covers that time */
+  conn->cc_last_ts = cur_ts;
+  conn->cnt_tx_pending = 0;
+  conn->ts_tx_pending = 0;
+  if (config.tcp_rxwnd_min != 0) {
+    rxwnd_total += conn->rx_wnd;
+  }
+
+  if (reinit) {
+    cc_algorithm_init(conn);
+  }
+}
+
+struct connection *cc_conn_first(void)
+{
+  return cc_conns;
+}
+
+void cc_conn_remove(struct connection *conn)
+{
+  struct connection *cp = NULL;
+
+  rxwnd_remove(conn);
 
+  if (next_conn == conn) {
+    next_conn = conn->cc_next;
+  }
+
+  if (cc_conns == conn) {
+    cc_conns = conn->cc_next;
+  } else {
+    for (cp = cc_conns; cp != NULL && cp->cc_next != conn;
+        cp = cp->cc_next);
+    if (cp == NULL) {
+      fprintf(stderr, "%s: connection not found\n", __func__);
+      abort();
+    }
+
+    cp->cc_next = conn->cc_next;
+  }
+}
+
+/** Reset the state of the configured algorithm */
+static inline void cc_algorithm_init(struct connection *conn)
+{
   switch (config.cc_algorithm) {
     case CONFIG_CC_DCTCP_WIN:
       dctcp_win_init(conn);
@@ -185,32 +273,76 @@ void cc_conn_init(struct connection *conn)
   }
 }
 
-void cc_conn_remove(struct connection *conn)
+/******************************************************************************/
+/* Receive window autotuning */
+
+static inline void rxwnd_init(struct connection *c)
 {
-  struct connection *cp = NULL;
+  if (config.tcp_rxwnd_min == 0) {
+    c->rx_wnd = c->rx_len;
+    return;
+  }
 
-  if (next_conn == conn) {
-    next_conn = conn->cc_next;
+  /* the minimum is granted even if it exceeds the budget */
+  c->rx_wnd = config.tcp_rxwnd_min;
+  rxwnd_total += c->rx_wnd;
+}
+
+static inline void rxwnd_update(struct connection *c,
+    struct nicif_connection_stats *stats, uint32_t diff_ts)
+{
+  uint32_t rtt, wnd, wnd_max;
+  uint64_t room;
+
+  if (config.tcp_rxwnd_min == 0) {
+    return;
   }
 
-  if (cc_conns == conn) {
-    cc_conns = conn->cc_next;
-  } else {
-    for (cp = cc_conns; cp != NULL && cp->cc_next != conn;
-        cp = cp->cc_next);
-    if (cp == NULL) {
-      fprintf(stderr, "%s: connection not found\n", __func__);
-      abort();
+  rtt = (stats->rtt != 0 ? stats->rtt : config.tcp_rtt_init);
+  wnd_max = MIN(c->rx_len, (c->flags & NICIF_CONN_WSCALE) != 0 ?
+      TCP_RXWND_MAX : TCP_RXWND_MAX_NOWS);
+  wnd = tcp_rxwnd_tune(c->rx_wnd, stats->c_rxb, diff_ts, rtt,
+      config.tcp_rxwnd_min, wnd_max);
+
+  /* only grow into what is left of the budget */
+  if (wnd > c->rx_wnd && config.tcp_rxwnd_budget != 0) {
+    room = (config.tcp_rxwnd_budget > rxwnd_total ?
+        config.tcp_rxwnd_budget - rxwnd_total : 0);
+    room &= ~(uint64_t) (TCP_RXWND_QUANTUM - 1);
+    if (wnd - c->rx_wnd > room) {
+      wnd = c->rx_wnd + room;
     }
+  }
 
-    cp->cc_next = conn->cc_next;
+  if (wnd == c->rx_wnd) {
+    return;
   }
+
+  /* on failure try again next interval */
+  if (nicif_connection_rxwnd(c->flow_id, c->flow_group,
+        ((int32_t) wnd - (int32_t) c->rx_wnd) / TCP_RXWND_QUANTUM) != 0)
+  {
+    return;
+  }
+
+  rxwnd_total = rxwnd_total - c->rx_wnd + wnd;
+  c->rx_wnd = wnd;
 }
 
-static inline void issue_retransmits(struct connection *c,
+static inline void rxwnd_remove(struct connection *c)
+{
+  if (config.tcp_rxwnd_min != 0) {
+    rxwnd_total -= c->rx_wnd;
+  }
+}
+
+/******************************************************************************/
+
+static inline uint8_t issue_retransmits(struct connection *c,
     struct nicif_connection_stats *stats, uint32_t cur_ts)
 {
   uint32_t rtt = (stats->rtt != 0 ? stats->rtt : config.tcp_rtt_init);
+  uint8_t flags = 0;
 
   /* check for re-transmits */
   if (stats->txp && stats->c_ackb == 0) {
@@ -223,11 +355,65 @@ static inline void issue_retransmits(struct connection *c,
         c->cnt_tx_pending = 0;
         spstats.sp_rexmit++;
         c->cc_rexmits++;
+        flags |= SP_CCTRACE_F_REXMIT;
       }
     }
+
+    /* probe for tail losses well before the timeout fires */
+    if (c->cnt_tx_pending == config.cc_tlp_ints &&
+        nicif_connection_probe(c->flow_id, c->flow_group) == 0)
+    {
+      spstats.sp_tlp++;
+      flags |= SP_CCTRACE_F_TLP;
+    }
   } else {
     c->cnt_tx_pending = 0;
   }
+
+  return flags;
+}
+
+/** Record the inputs and outputs of this control interval */
+static inline void cc_trace(struct connection *c,
+    struct nicif_connection_stats *stats, uint8_t flags, uint32_t cur_ts)
+{
+  struct sp_cctrace_rec rec = {
+    .ts_us = cur_ts,
+    .flow_id = c->flow_id,
+    .rtt = c->cc_rtt,
+    .rate = c->cc_rate,
+    .ackb = stats->c_ackb,
+    .ecnb = stats->c_ecnb,
+    .acks = stats->c_acks,
+    .drops = stats->c_drops,
+    .flags = flags,
+  };
+
+  switch (config.cc_algorithm) {
+    case CONFIG_CC_DCTCP_WIN:
+      rec.window = c->cc.dctcp_win.window;
+      rec.cc_state = c->cc.dctcp_win.ecn_rate;
+      if (c->cc.dctcp_win.slowstart)
+        rec.flags |= SP_CCTRACE_F_SLOWSTART;
+      break;
+
+    case CONFIG_CC_DCTCP_RATE:
+      rec.cc_state = c->cc.dctcp_rate.ecn_rate;
+      if (c->cc.dctcp_rate.slowstart)
+        rec.flags |= SP_CCTRACE_F_SLOWSTART;
+      break;
+
+    case CONFIG_CC_TIMELY:
+      rec.cc_state = c->cc.timely.rtt_diff;
+      if (c->cc.timely.slowstart)
+        rec.flags |= SP_CCTRACE_F_SLOWSTART;
+      break;
+
+    default:
+      break;
+  }
+
+  stats_cctrace(&rec);
 }
 
 /******************************************************************************/
@@ -0,0 +1,1222 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * @brief Offline congestion control simulator.
+ * @file ccsim.c
+ *
+ * Links the slowpath's cc.c and config.c unmodified against a discrete event
+ * model of the fastpath and a one-switch network, so congestion control
+ * changes and cc-* parameters can be evaluated without NICs.
+ *
+ * Every host has an uplink of the bottleneck rate into an output queued
+ * switch, the switch port towards each receiving host has a shared buffer,
+ * marks ECN CE when the queue is above K on enqueue and drops on overflow.
+ * The model fastpath paces each flow at the rate cc.c set and keeps at most a
+ * send buffer worth of data unacknowledged. Loss recovery uses the host
+ * models of the fastpath (tcp_sack.h, tcp_rack.h, tcp_ooo.h): receivers keep
+ * out-of-order data and ack every segment, with a SACK block while there is
+ * a gap; senders declare snd_una lost by RACK and repair the holes below the
+ * SACKed data, falling back to go-back-N like the NIC. Only starting a recovery and
+ * retransmissions requested by cc.c halve the rate (WORK_RESULT_RETX),
+ * partial ACKs and tail loss probes from cc.c leave it alone. The counters
+ * and RTT estimate cc.c reads through nicif_connection_stats() are kept like
+ * on the NIC.
+ *
+ * Time is virtual: cc_poll() runs every cc-control-granularity, one call
+ * per 128 connections so that all of them are visited.
+ *
+ * Afterwards the simulator prints throughput, queue occupancy, Jain fairness
+ * over measurement windows, convergence after each flow start and flow
+ * completion times, and a final "result" line of key=value pairs for
+ * scripted parameter sweeps. With -o the sampled CC trace (cc-trace-sample)
+ * is written as a flextoe-cctrace file.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "util/common.h"
+#include "util/rng.h"
+
+#include "flextoe.h"
+#include "internal.h"
+#include "sp_cctrace.h"
+#include "tcp_ooo.h"
+#include "tcp_sack.h"
+
+struct configuration config;
+struct sp_statistics spstats;
+uint32_t cur_ts;
+
+#define SIM_MSS         1448
+#define SIM_WIRE_OVH    78          /*> Headers, preamble, IFG */
+#define SAMPLE_NS       5000        /*> Queue sampling interval */
+#define CC_BATCH        128         /*> Connections per cc_poll() call */
+#define SIM_TS_NS       20          /*> TS clock: 16 ME cycles at 800 MHz */
+
+enum workload_e {
+  WL_INCAST,
+  WL_LONGLIVED,
+  WL_ALLTOALL,
+  WL_MIX,
+};
+
+enum event_e {
+  EV_START,       /*> Flow starts */
+  EV_SEND,        /*> Flow may send */
+  EV_ARRIVE,      /*> Segment reaches switch port */
+  EV_DEPART,      /*> Segment leaves switch port */
+  EV_RECV,        /*> Segment reaches receiver */
+  EV_ACK,         /*> ACK reaches sender */
+  EV_CC,          /*> Control loop */
+  EV_SAMPLE,      /*> Queue sample */
+  EV_WINDOW,      /*> End of measurement window */
+  EV_SHORT,       /*> Next short flow arrives (mix) */
+};
+
+struct sim_seg {
+  uint64_t ts;                /*> Sent at, echoed by the ACK */
+  uint64_t seq;               /*> Data: first byte, ACK: cumulative ack */
+  uint32_t len;
+  uint32_t ecr;               /*> ACK: TS clock of last in-order segment */
+  uint32_t sack_l;            /*> ACK: SACK block, sack_l == sack_r if none */
+  uint32_t sack_r;
+  uint8_t ce;
+};
+
+struct event {
+  uint64_t t;
+  uint64_t order;             /*> Tie break: FIFO for equal times */
+  uint32_t type;
+  uint32_t flow;
+  struct sim_seg seg;
+};
+
+struct sim_flow {
+  struct connection *c;
+  uint32_t src;
+  uint32_t dst;
+  int finite;
+  int active;
+  int done;
+  int send_pending;           /*> EV_SEND scheduled */
+  uint64_t size;
+  uint64_t t_start;
+  uint64_t t_end;
+
+  /* model fastpath state */
+  uint64_t snd_una;           /*> 64-bit tx.una */
+  struct tcp_sack_txstate tx;
+  uint64_t next_tx;
+  uint64_t rcv_nxt;           /*> 64-bit rx.next_seq */
+  struct tcp_ooo_rxstate rx;
+  uint32_t ts_recent;         /*> Echoed by ACKs */
+  uint32_t rate;              /*> kbps, 0: line rate */
+  uint32_t srtt;              /*> ns */
+  uint32_t cnt_drops;
+  uint32_t cnt_acks;
+  uint32_t cnt_ackb;
+  uint32_t cnt_ecnb;
+
+  uint64_t acked;
+  uint64_t win_base;          /*> acked at start of measurement window */
+};
+
+struct sim_port {
+  uint64_t free_at;
+  uint32_t qbytes;
+  uint32_t qmax;
+  uint64_t tx_bytes;
+  uint64_t pkts;
+  uint64_t marks;
+  uint64_t drops;
+  int used;
+};
+
+struct window {
+  uint64_t t_start;
+  uint64_t t_end;
+  double jain;
+  unsigned num;
+};
+
+struct samples {
+  uint32_t *v;
+  size_t num;
+  size_t cap;
+};
+
+static struct {
+  enum workload_e wl;
+  unsigned n;
+  uint64_t bytes;
+  uint32_t stagger_ms;
+  double load;
+  uint32_t bw;                /*> Gbps */
+  uint32_t rtt;               /*> base RTT, us */
+  uint32_t ecn_k;             /*> bytes, 0: no marking */
+  uint32_t buf;               /*> bytes */
+  uint64_t duration;          /*> ns */
+  uint64_t window;            /*> ns */
+  double jain_thr;
+  uint64_t seed;
+  int verbose;
+} params = {
+  .wl = WL_INCAST,
+  .n = 16,
+  .bytes = 64 * 1024,
+  .stagger_ms = 10,
+  .load = 0.5,
+  .rtt = 20,
+  .ecn_k = 64 * 1024,
+  .buf = 1024 * 1024,
+  .duration = 100 * 1000000ull,
+  .window = 500 * 1000,
+  .jain_thr = 0.9,
+  .seed = 1,
+};
+
+static struct event *heap;
+static size_t heap_num, heap_cap;
+static uint64_t ev_order;
+static uint64_t now;
+
+static struct sim_flow **flows;
+static uint32_t flows_num, flows_cap;
+static unsigned conns_open;
+static unsigned finite_left;
+
+static struct sim_port *ports;
+static uint64_t *host_free;
+static uint32_t hosts_num;
+
+static struct window *windows;
+static size_t windows_num, windows_cap;
+static struct samples qsamples;
+static struct utils_rng rng;
+static FILE *trace_f;
+
+/* delays in ns */
+static uint64_t d_up, d_down, d_ack;
+
+static inline uint64_t ser_ns(uint32_t len, uint32_t gbps)
+{
+  return ((uint64_t) (len + SIM_WIRE_OVH) * 8 + gbps - 1) / gbps;
+}
+
+/** Fastpath TS clock (timestamp_low) at the current time */
+static inline uint32_t ts_clock(void)
+{
+  return now / SIM_TS_NS;
+}
+
+/******************************************************************************/
+/* Event queue */
+
+static inline int ev_before(const struct event *a, const struct event *b)
+{
+  return a->t < b->t || (a->t == b->t && a->order < b->order);
+}
+
+static void ev_push(uint64_t t, uint32_t type, uint32_t flow,
+    const struct sim_seg *seg)
+{
+  struct event ev, tmp;
+  size_t i, p;
+
+  if (heap_num == heap_cap) {
+    heap_cap = (heap_cap == 0 ? 1024 : heap_cap * 2);
+    if ((heap = realloc(heap, heap_cap * sizeof(*heap))) == NULL) {
+      fprintf(stderr, "ccsim: realloc failed\n");
+      abort();
+    }
+  }
+
+  ev.t = t;
+  ev.order = ev_order++;
+  ev.type = type;
+  ev.flow = flow;
+  if (seg != NULL) {
+    ev.seg = *seg;
+  } else {
+    memset(&ev.seg, 0, sizeof(ev.seg));
+  }
+
+  i = heap_num++;
+  heap[i] = ev;
+  while (i > 0) {
+    p = (i - 1) / 2;
+    if (!ev_before(&heap[i], &heap[p]))
+      break;
+    tmp = heap[p];
+    heap[p] = heap[i];
+    heap[i] = tmp;
+    i = p;
+  }
+}
+
+static void ev_pop(struct event *ev)
+{
+  struct event tmp;
+  size_t i = 0, l, m;
+
+  *ev = heap[0];
+  heap[0] = heap[--heap_num];
+  for (;;) {
+    l = 2 * i + 1;
+    m = i;
+    if (l < heap_num && ev_before(&heap[l], &heap[m]))
+      m = l;
+    if (l + 1 < heap_num && ev_before(&heap[l + 1], &heap[m]))
+      m = l + 1;
+    if (m == i)
+      break;
+    tmp = heap[m];
+    heap[m] = heap[i];
+    heap[i] = tmp;
+    i = m;
+  }
+}
+
+static void samples_add(struct samples *s, uint32_t v)
+{
+  if (s->num == s->cap) {
+    s->cap = (s->cap == 0 ? 4096 : s->cap * 2);
+    if ((s->v = realloc(s->v, s->cap * sizeof(*s->v))) == NULL) {
+      fprintf(stderr, "ccsim: realloc failed\n");
+      abort();
+    }
+  }
+  s->v[s->num++] = v;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+  return (x > y) - (x < y);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+/******************************************************************************/
+/* Model fastpath */
+
+static uint32_t flow_add(uint32_t src, uint32_t dst, uint64_t size,
+    uint64_t t_start)
+{
+  struct sim_flow *f;
+  uint32_t id = flows_num;
+
+  if (flows_num == flows_cap) {
+    flows_cap = (flows_cap == 0 ? 64 : flows_cap * 2);
+    if ((flows = realloc(flows, flows_cap * sizeof(*flows))) == NULL) {
+      fprintf(stderr, "ccsim: realloc failed\n");
+      abort();
+    }
+  }
+  if ((f = calloc(1, sizeof(*f))) == NULL ||
+      (f->c = calloc(1, sizeof(*f->c))) == NULL)
+  {
+    fprintf(stderr, "ccsim: calloc failed\n");
+    abort();
+  }
+  flows[flows_num++] = f;
+
+  f->src = src;
+  f->dst = dst;
+  f->finite = (size != 0);
+  f->size = (size != 0 ? size : UINT64_MAX);
+  f->t_start = t_start;
+  if (f->finite)
+    finite_left++;
+
+  ports[dst].used = 1;
+  ev_push(t_start, EV_START, id, NULL);
+  return id;
+}
+
+static void seg_send(struct sim_flow *f, uint32_t id, uint64_t seq,
+    uint32_t len)
+{
+  struct sim_seg seg;
+  uint64_t t;
+
+  memset(&seg, 0, sizeof(seg));
+  seg.ts = now;
+  seg.seq = seq;
+  seg.len = len;
+
+  /* host uplink is a FIFO at the same rate as the switch ports */
+  t = MAX(now, host_free[f->src]) + ser_ns(seg.len, params.bw);
+  host_free[f->src] = t;
+  ev_push(t + d_up, EV_ARRIVE, id, &seg);
+}
+
+/** New bytes the flow may send, like tcp_txavail() */
+static uint32_t flow_txavail(const struct sim_flow *f)
+{
+  uint64_t wnd, left;
+
+  wnd = MIN(f->c->tx_len, config.tcp_rxbuf_len);
+  left = f->size - f->snd_una - f->tx.sent;
+  if (f->tx.sent >= wnd)
+    return 0;
+  return MIN(wnd - f->tx.sent, left);
+}
+
+/** Is part of the current hole still to be retransmitted? */
+static int flow_repair(const struct sim_flow *f)
+{
+  return f->tx.rtx != 0 &&
+    TCP_SACK_NXT(f->tx.rtx) < tcp_sack_hole_end(f->tx.sb, f->tx.rtx);
+}
+
+static void flow_send(uint32_t id)
+{
+  struct sim_flow *f = flows[id];
+  uint32_t avail, len, seq;
+
+  if (!f->active || f->send_pending)
+    return;
+
+  avail = flow_txavail(f);
+  if (avail == 0 && !flow_repair(f))
+    return;
+
+  if (now < f->next_tx || now < host_free[f->src]) {
+    f->send_pending = 1;
+    ev_push(MAX(f->next_tx, host_free[f->src]), EV_SEND, id, NULL);
+    return;
+  }
+
+  if ((len = tcp_sack_tx_next(&f->tx, ts_clock(), avail, SIM_MSS, &seq)) == 0)
+    return;
+  seg_send(f, id, f->snd_una + (uint32_t) (seq - f->tx.una), len);
+
+  /* pace at the rate cc.c set (kbps) */
+  if (f->rate != 0) {
+    f->next_tx = now + (len + SIM_WIRE_OVH) * 8 * 1000000ull / f->rate;
+  } else {
+    f->next_tx = now;
+  }
+
+  f->send_pending = 1;
+  ev_push(MAX(f->next_tx, host_free[f->src]), EV_SEND, id, NULL);
+}
+
+static void flow_start(uint32_t id)
+{
+  struct sim_flow *f = flows[id];
+  struct connection *c = f->c;
+
+  /* like an established connection in tcp.c */
+  c->status = CONN_OPEN;
+  c->flow_id = id;
+  c->flow_group = 0;
+  c->remote_ip = f->dst;
+  c->local_ip = f->src;
+  c->rx_len = config.tcp_rxbuf_len;
+  c->tx_len = config.tcp_txbuf_len;
+  cur_ts = now / 1000;
+  cc_conn_init(c);
+
+  /* both ends are FlexTOE with SACK negotiated, sequence numbers from 0 */
+  f->tx.sack = 1;
+  f->rx.avail = MIN(config.tcp_rxbuf_len, TCP_OOO_MAX);
+  f->rate = c->cc_rate;
+  f->active = 1;
+  conns_open++;
+  flow_send(id);
+}
+
+static void flow_finish(uint32_t id)
+{
+  struct sim_flow *f = flows[id];
+
+  f->active = 0;
+  f->done = 1;
+  f->t_end = now;
+  f->c->status = CONN_CLOSED;
+  cc_conn_remove(f->c);
+  conns_open--;
+  finite_left--;
+}
+
+static void port_arrive(uint32_t id, struct sim_seg *seg)
+{
+  struct sim_flow *f = flows[id];
+  struct sim_port *p = &ports[f->dst];
+  uint32_t wire = seg->len + SIM_WIRE_OVH;
+  uint64_t t;
+
+  if (p->qbytes + wire > params.buf) {
+    p->drops++;
+    return;
+  }
+
+  if (params.ecn_k != 0 && p->qbytes > params.ecn_k) {
+    seg->ce = 1;
+    p->marks++;
+  }
+  p->qbytes += wire;
+  p->qmax = MAX(p->qmax, p->qbytes);
+  p->pkts++;
+
+  t = MAX(now, p->free_at) + ser_ns(seg->len, params.bw);
+  p->free_at = t;
+  ev_push(t, EV_DEPART, id, seg);
+}
+
+static void port_depart(uint32_t id, struct sim_seg *seg)
+{
+  struct sim_port *p = &ports[flows[id]->dst];
+
+  p->qbytes -= seg->len + SIM_WIRE_OVH;
+  p->tx_bytes += seg->len;
+  ev_push(now + d_down, EV_RECV, id, seg);
+}
+
+static void flow_recv(uint32_t id, struct sim_seg *seg)
+{
+  struct sim_flow *f = flows[id];
+  uint32_t bump;
+  int slot;
+
+  /* flows_seg(), the application reads everything right away */
+  if ((uint32_t) seg->seq == f->rx.next_seq) {
+    f->ts_recent = seg->ts / SIM_TS_NS;
+  }
+  bump = tcp_ooo_rx(&f->rx, seg->seq, seg->len, &slot);
+  f->rx.avail += bump;
+  f->rcv_nxt += bump;
+
+  seg->seq = f->rcv_nxt;
+  seg->ecr = f->ts_recent;
+  seg->sack_l = seg->sack_r = 0;
+  if (slot >= 0) {
+    seg->sack_l = f->rx.next_seq + TCP_OOO_OFF(f->rx.iv[slot]);
+    seg->sack_r = seg->sack_l + TCP_OOO_LEN(f->rx.iv[slot]);
+  }
+  ev_push(now + d_ack, EV_ACK, id, seg);
+}
+
+static void flow_ack(uint32_t id, struct sim_seg *seg)
+{
+  struct sim_flow *f = flows[id];
+  uint32_t rtt, ackb, una, recoveries;
+
+  if (!f->active)
+    return;
+
+  rtt = now - seg->ts;
+  f->srtt = (f->srtt == 0 ? rtt : (7 * (uint64_t) f->srtt + rtt) / 8);
+  f->cnt_acks++;
+
+  /* flows_ack(): RACK, SACK scoreboard, selective recovery */
+  una = f->tx.una;
+  recoveries = f->tx.recoveries;
+  tcp_sack_tx_ack(&f->tx, ts_clock(), seg->seq, seg->ecr, seg->sack_l,
+      seg->sack_r);
+
+  if ((ackb = f->tx.una - una) != 0) {
+    f->cnt_ackb += ackb;
+    if (seg->ce)
+      f->cnt_ecnb += ackb;
+    f->acked += ackb;
+    f->snd_una += ackb;
+
+    if (f->snd_una >= f->size) {
+      flow_finish(id);
+      return;
+    }
+  }
+
+  /* recovery started (WORK_RESULT_RETX): halve the rate like the NIC */
+  if (f->tx.recoveries != recoveries) {
+    f->cnt_drops++;
+    f->rate /= 2;
+  }
+
+  flow_send(id);
+}
+
+int nicif_connection_stats(uint32_t f_id,
+    struct nicif_connection_stats *p_stats)
+{
+  struct sim_flow *f;
+
+  if (f_id >= flows_num) {
+    fprintf(stderr, "%s: bad flow id\n", __func__);
+    return -1;
+  }
+  f = flows[f_id];
+
+  p_stats->rtt = (f->srtt + 500) / 1000;
+  p_stats->txp = (f->tx.sent != 0);
+  p_stats->c_drops = (uint16_t) f->cnt_drops;
+  p_stats->c_acks = (uint16_t) f->cnt_acks;
+  p_stats->c_ackb = f->cnt_ackb;
+  p_stats->c_ecnb = f->cnt_ecnb;
+  p_stats->c_rxb = 0;
+  return 0;
+}
+
+int nicif_connection_setrate(uint32_t f_id, uint32_t rate)
+{
+  if (f_id >= flows_num) {
+    fprintf(stderr, "%s: bad flow id\n", __func__);
+    return -1;
+  }
+
+  flows[f_id]->rate = rate;
+  return 0;
+}
+
+int nicif_connection_retransmit(uint32_t f_id, uint16_t flow_group)
+{
+  struct sim_flow *f;
+
+  if (f_id >= flows_num) {
+    fprintf(stderr, "%s: bad flow id\n", __func__);
+    return -1;
+  }
+  f = flows[f_id];
+
+  /* flows_retx(): go back N, WORK_RESULT_RETX */
+  tcp_sack_tx_timeout(&f->tx);
+  f->cnt_drops++;
+  f->rate /= 2;
+  flow_send(f_id);
+  return 0;
+}
+
+int nicif_connection_probe(uint32_t f_id, uint16_t flow_group)
+{
+  struct sim_flow *f;
+
+  if (f_id >= flows_num) {
+    fprintf(stderr, "%s: bad flow id\n", __func__);
+    return -1;
+  }
+  f = flows[f_id];
+
+  /* tail loss probe: repair from snd_una, no rate cut */
+  tcp_sack_tx_probe(&f->tx, SIM_MSS);
+  flow_send(f_id);
+  return 0;
+}
+
+int nicif_connection_rxwnd(uint32_t f_id, uint16_t flow_group, int32_t delta)
+{
+  return 0;
+}
+
+void keepalive_conn_active(struct connection *c)
+{
+}
+
+void stats_cctrace(const struct sp_cctrace_rec *rec)
+{
+  if (trace_f != NULL && fwrite(rec, sizeof(*rec), 1, trace_f) != 1) {
+    fprintf(stderr, "ccsim: writing trace failed\n");
+    fclose(trace_f);
+    trace_f = NULL;
+  }
+}
+
+/******************************************************************************/
+/* Measurements */
+
+static void queue_sample(void)
+{
+  uint32_t i;
+
+  for (i = 0; i < hosts_num; i++) {
+    if (ports[i].used)
+      samples_add(&qsamples, ports[i].qbytes);
+  }
+}
+
+/**
+ * Jain fairness of the flows running through the whole window, for the mix
+ * workload only of the long-lived ones.
+ */
+static void window_end(void)
+{
+  struct window *w;
+  struct sim_flow *f;
+  uint64_t t_start = now - params.window;
+  double x, sum = 0, sum_sq = 0;
+  unsigned num = 0;
+  uint32_t i;
+
+  for (i = 0; i < flows_num; i++) {
+    f = flows[i];
+    if (f->active && f->t_start <= t_start &&
+        (params.wl != WL_MIX || !f->finite))
+    {
+      x = f->acked - f->win_base;
+      sum += x;
+      sum_sq += x * x;
+      num++;
+    }
+    f->win_base = f->acked;
+  }
+  if (num == 0)
+    return;
+
+  if (windows_num == windows_cap) {
+    windows_cap = (windows_cap == 0 ? 1024 : windows_cap * 2);
+    if ((windows = realloc(windows, windows_cap * sizeof(*windows))) == NULL) {
+      fprintf(stderr, "ccsim: realloc failed\n");
+      abort();
+    }
+  }
+  w = &windows[windows_num++];
+  w->t_start = t_start;
+  w->t_end = now;
+  w->num = num;
+  w->jain = (sum_sq > 0 ? sum * sum / (num * sum_sq) : 1);
+
+  if (params.verbose) {
+    printf("window t=%.3fms flows=%u jain=%.3f tput=%.2fGbps\n",
+        now / 1e6, num, w->jain, sum * 8 / params.window);
+  }
+}
+
+/** Time from a flow start until fairness is first reached */
+static int64_t convergence(struct sim_flow *f)
+{
+  size_t i;
+
+  for (i = 0; i < windows_num; i++) {
+    if (windows[i].t_start < f->t_start || windows[i].num < 2)
+      continue;
+    if (windows[i].jain >= params.jain_thr)
+      return windows[i].t_end - f->t_start;
+  }
+  return -1;
+}
+
+static void short_flow(void)
+{
+  /* sizes and senders for the short flows of the mix workload */
+  static const uint32_t sizes[] = { 2048, 8192, 32768, 131072 };
+  double mean = (2048 + 8192 + 32768 + 131072) / 4.;
+  double lambda = params.load * params.bw / (mean * 8);   /*> per ns */
+  uint32_t src = params.n + 1 + utils_rng_gen32(&rng) % params.n;
+
+  flow_add(src, 0, sizes[utils_rng_gen32(&rng) % 4], now);
+  ev_push(now + 1 + -log(1 - utils_rng_gend(&rng)) / lambda, EV_SHORT, 0,
+      NULL);
+}
+
+/******************************************************************************/
+
+static int workload_parse(const char *s)
+{
+  char name[16];
+  unsigned n;
+  double arg;
+  int num;
+
+  num = sscanf(s, "%15[a-z]:%u:%lf", name, &n, &arg);
+  if (num < 1) {
+    return -1;
+  }
+
+  if (!strcmp(name, "incast")) {
+    params.wl = WL_INCAST;
+  } else if (!strcmp(name, "longlived")) {
+    params.wl = WL_LONGLIVED;
+    params.n = 4;
+  } else if (!strcmp(name, "alltoall")) {
+    params.wl = WL_ALLTOALL;
+    params.n = 8;
+    params.bytes = 1024 * 1024;
+  } else if (!strcmp(name, "mix")) {
+    params.wl = WL_MIX;
+    params.n = 2;
+  } else {
+    return -1;
+  }
+
+  if (num >= 2) {
+    params.n = n;
+  }
+  if (num >= 3) {
+    switch (params.wl) {
+      case WL_INCAST:
+      case WL_ALLTOALL:
+        params.bytes = arg;
+        break;
+      case WL_LONGLIVED:
+        params.stagger_ms = arg;
+        break;
+      case WL_MIX:
+        params.load = arg;
+        break;
+    }
+  }
+
+  if (params.n == 0 || (params.wl == WL_ALLTOALL && params.n < 2) ||
+      params.bytes == 0 || params.load <= 0 || params.load >= 1)
+  {
+    return -1;
+  }
+  return 0;
+}
+
+static void workload_setup(void)
+{
+  unsigned i, j;
+
+  switch (params.wl) {
+    case WL_INCAST:
+      hosts_num = params.n + 1;
+      break;
+    case WL_LONGLIVED:
+      hosts_num = params.n + 1;
+      break;
+    case WL_ALLTOALL:
+      hosts_num = params.n;
+      break;
+    case WL_MIX:
+      hosts_num = 2 * params.n + 1;
+      break;
+  }
+  ports = calloc(hosts_num, sizeof(*ports));
+  host_free = calloc(hosts_num, sizeof(*host_free));
+  if (ports == NULL || host_free == NULL) {
+    fprintf(stderr, "ccsim: calloc failed\n");
+    abort();
+  }
+
+  switch (params.wl) {
+    case WL_INCAST:
+      /* a few us of jitter so that the senders are not lock-stepped */
+      for (i = 0; i < params.n; i++) {
+        flow_add(i + 1, 0, params.bytes, utils_rng_gen32(&rng) % 2000);
+      }
+      break;
+
+    case WL_LONGLIVED:
+      for (i = 0; i < params.n; i++) {
+        flow_add(i + 1, 0, 0, i * params.stagger_ms * 1000000ull);
+      }
+      break;
+
+    case WL_ALLTOALL:
+      for (i = 0; i < params.n; i++) {
+        for (j = 0; j < params.n; j++) {
+          if (i != j)
+            flow_add(i, j, params.bytes, utils_rng_gen32(&rng) % 2000);
+        }
+      }
+      break;
+
+    case WL_MIX:
+      /* long-lived flows from hosts 1..n, short flows from n+1..2n */
+      for (i = 0; i < params.n; i++) {
+        flow_add(i + 1, 0, 0, 0);
+      }
+      ev_push(params.window, EV_SHORT, 0, NULL);
+      break;
+  }
+}
+
+static void run(void)
+{
+  struct event ev;
+  unsigned i;
+
+  ev_push(0, EV_CC, 0, NULL);
+  ev_push(0, EV_SAMPLE, 0, NULL);
+  ev_push(params.window, EV_WINDOW, 0, NULL);
+
+  while (heap_num > 0) {
+    ev_pop(&ev);
+    if (ev.t > params.duration)
+      break;
+    now = ev.t;
+
+    switch (ev.type) {
+      case EV_START:
+        flow_start(ev.flow);
+        break;
+
+      case EV_SEND:
+        flows[ev.flow]->send_pending = 0;
+        flow_send(ev.flow);
+        break;
+
+      case EV_ARRIVE:
+        port_arrive(ev.flow, &ev.seg);
+        break;
+
+      case EV_DEPART:
+        port_depart(ev.flow, &ev.seg);
+        break;
+
+      case EV_RECV:
+        flow_recv(ev.flow, &ev.seg);
+        break;
+
+      case EV_ACK:
+        flow_ack(ev.flow, &ev.seg);
+        break;
+
+      case EV_CC:
+        cur_ts = now / 1000;
+        for (i = 0; i < (conns_open + CC_BATCH - 1) / CC_BATCH; i++) {
+          cc_poll(cur_ts);
+        }
+        ev_push(now + config.cc_control_granularity * 1000ull, EV_CC, 0,
+            NULL);
+        break;
+
+      case EV_SAMPLE:
+        queue_sample();
+        ev_push(now + SAMPLE_NS, EV_SAMPLE, 0, NULL);
+        break;
+
+      case EV_WINDOW:
+        window_end();
+        ev_push(now + params.window, EV_WINDOW, 0, NULL);
+        break;
+
+      case EV_SHORT:
+        short_flow();
+        break;
+    }
+
+    /* finite workloads end with their last flow */
+    if (params.wl != WL_MIX && params.wl != WL_LONGLIVED && finite_left == 0)
+      break;
+  }
+}
+
+static const char *cc_name(void)
+{
+  switch (config.cc_algorithm) {
+    case CONFIG_CC_DCTCP_WIN:
+      return "dctcp-win";
+    case CONFIG_CC_DCTCP_RATE:
+      return "dctcp-rate";
+    case CONFIG_CC_TIMELY:
+      return "timely";
+    case CONFIG_CC_CONST_RATE:
+      return "const-rate";
+    default:
+      return "unknown";
+  }
+}
+
+static void report(void)
+{
+  static const char *wl_names[] = { "incast", "longlived", "alltoall", "mix" };
+  struct sim_flow *f;
+  uint64_t tx_bytes = 0, pkts = 0, marks = 0, drops = 0, *fct, ideal;
+  uint64_t rtx_bytes = 0, recoveries = 0;
+  uint32_t i, used = 0, qmax = 0, fct_num = 0;
+  double thr, util, qmean = 0, jain = 0, slowdown = 0;
+  int64_t conv, conv_max = 0;
+  unsigned jain_num = 0, conv_num = 0, conv_fail = 0;
+  size_t k;
+
+  for (i = 0; i < hosts_num; i++) {
+    if (!ports[i].used)
+      continue;
+    used++;
+    tx_bytes += ports[i].tx_bytes;
+    pkts += ports[i].pkts;
+    marks += ports[i].marks;
+    drops += ports[i].drops;
+    qmax = MAX(qmax, ports[i].qmax);
+  }
+  thr = (now > 0 ? tx_bytes * 8. / now : 0);
+  util = thr / ((double) params.bw * used);
+
+  for (k = 0; k < qsamples.num; k++) {
+    qmean += qsamples.v[k];
+  }
+  qmean = (qsamples.num > 0 ? qmean / qsamples.num : 0);
+  qsort(qsamples.v, qsamples.num, sizeof(*qsamples.v), cmp_u32);
+
+  for (i = 0; i < flows_num; i++) {
+    rtx_bytes += flows[i]->tx.rtx_bytes;
+    recoveries += flows[i]->tx.recoveries;
+  }
+
+  /* fairness over the second half of the run */
+  for (k = 0; k < windows_num; k++) {
+    if (windows[k].t_start >= now / 2 && windows[k].num >= 2) {
+      jain += windows[k].jain;
+      jain_num++;
+    }
+  }
+  jain = (jain_num > 0 ? jain / jain_num : 1);
+
+  printf("ccsim: %s n=%u cc=%s bw=%uGbps rtt=%uus ecn-k=%uKB buffer=%uKB "
+      "time=%.3fms\n", wl_names[params.wl], params.n, cc_name(), params.bw,
+      params.rtt, params.ecn_k / 1024, params.buf / 1024, now / 1e6);
+  printf("  throughput   %.2f Gbps on %u ports, utilization %.1f%%\n",
+      thr, used, util * 100);
+  printf("  queue        mean %.1f KB  p99 %.1f KB  max %.1f KB\n",
+      qmean / 1024, (qsamples.num > 0 ?
+        qsamples.v[qsamples.num * 99 / 100] / 1024. : 0), qmax / 1024.);
+  printf("  network      %"PRIu64" packets, %"PRIu64" ECN marked, %"PRIu64
+      " dropped\n", pkts, marks, drops);
+  printf("  recovery     %"PRIu64" recoveries, %.1f KB retransmitted\n",
+      recoveries, rtx_bytes / 1024.);
+  printf("  slowpath     %"PRIu64" retransmits, %"PRIu64" probes\n",
+      spstats.sp_rexmit, spstats.sp_tlp);
+  printf("  fairness     Jain %.3f (second half, %u windows of %"PRIu64
+      " us)\n", jain, jain_num, params.window / 1000);
+
+  /* convergence after each flow that joins running long-lived flows */
+  for (i = 0; i < flows_num; i++) {
+    f = flows[i];
+    if (f->finite || f->t_start == 0)
+      continue;
+    conv = convergence(f);
+    if (conv < 0) {
+      conv_fail++;
+      printf("  convergence  flow %u started at %.3f ms: not reached\n",
+          i, f->t_start / 1e6);
+    } else {
+      conv_num++;
+      conv_max = MAX(conv_max, conv);
+      printf("  convergence  flow %u started at %.3f ms: %.3f ms\n",
+          i, f->t_start / 1e6, conv / 1e6);
+    }
+  }
+
+  /* flow completion times of finite flows */
+  if ((fct = calloc(flows_num + 1, sizeof(*fct))) == NULL) {
+    fprintf(stderr, "ccsim: calloc failed\n");
+    abort();
+  }
+  for (i = 0; i < flows_num; i++) {
+    f = flows[i];
+    if (!f->finite || !f->done)
+      continue;
+    fct[fct_num++] = f->t_end - f->t_start;
+    ideal = f->size * 8 / params.bw + params.rtt * 1000ull;
+    slowdown += (double) (f->t_end - f->t_start) / ideal;
+  }
+  qsort(fct, fct_num, sizeof(*fct), cmp_u64);
+  if (fct_num > 0) {
+    slowdown /= fct_num;
+    printf("  fct          %u flows (%u unfinished): p50 %.1f us  p99 %.1f us"
+        "  max %.1f us  mean slowdown %.2f\n", fct_num, finite_left,
+        fct[fct_num / 2] / 1e3, fct[fct_num * 99 / 100] / 1e3,
+        fct[fct_num - 1] / 1e3, slowdown);
+  }
+
+  printf("result workload=%s n=%u cc=%s tput_gbps=%.3f util=%.4f "
+      "q_mean_kb=%.1f q_p99_kb=%.1f q_max_kb=%.1f drops=%"PRIu64
+      " ecn_frac=%.4f rexmits=%"PRIu64" jain=%.4f conv_max_us=%"PRId64
+      " conv_fail=%u fct_p50_us=%.1f fct_p99_us=%.1f fct_max_us=%.1f "
+      "unfinished=%u\n",
+      wl_names[params.wl], params.n, cc_name(), thr, util, qmean / 1024,
+      (qsamples.num > 0 ? qsamples.v[qsamples.num * 99 / 100] / 1024. : 0),
+      qmax / 1024., drops, (pkts > 0 ? (double) marks / pkts : 0),
+      spstats.sp_rexmit, jain, (conv_num > 0 ? conv_max / 1000 : -1),
+      conv_fail, (fct_num > 0 ? fct[fct_num / 2] / 1e3 : 0),
+      (fct_num > 0 ? fct[fct_num * 99 / 100] / 1e3 : 0),
+      (fct_num > 0 ? fct[fct_num - 1] / 1e3 : 0), finite_left);
+  free(fct);
+}
+
+static int trace_open(const char *path)
+{
+  struct sp_cctrace_file hdr;
+
+  if ((trace_f = fopen(path, "w")) == NULL) {
+    perror("ccsim: opening trace file failed");
+    return -1;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = SP_CCTRACE_FILE_MAGIC;
+  hdr.version = SP_CCTRACE_VERSION;
+  hdr.rec_size = sizeof(struct sp_cctrace_rec);
+  hdr.cc_algorithm = config.cc_algorithm;
+  hdr.sample = config.cc_trace_sample;
+  hdr.interval = config.cc_control_interval;
+  if (fwrite(&hdr, sizeof(hdr), 1, trace_f) != 1) {
+    fprintf(stderr, "ccsim: writing trace failed\n");
+    return -1;
+  }
+  return 0;
+}
+
+static void print_usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [OPTION]... [-- SLOWPATH OPTION...]\n"
+      "Simulate the slowpath congestion control (cc.c) on one switch.\n"
+      "\n"
+      "Options:\n"
+      "  -w, --workload=WL         Workload, one of [incast:16:65536]\n"
+      "                              incast:N:BYTES      N senders, one receiver\n"
+      "                              longlived:N:STAGGER N flows to one receiver,\n"
+      "                                                  started STAGGER ms apart\n"
+      "                              alltoall:N:BYTES    N hosts, every pair\n"
+      "                              mix:N:LOAD          N long-lived flows and\n"
+      "                                                  Poisson short flows of\n"
+      "                                                  2-128KB at LOAD to one\n"
+      "                                                  receiver\n"
+      "  -b, --bw=GBPS             Link rate [tcp-link-bw]\n"
+      "  -r, --rtt=US              Base RTT [20]\n"
+      "  -k, --ecn-k=KB            ECN marking threshold, 0 disables [64]\n"
+      "  -q, --buffer=KB           Buffer per switch port [1024]\n"
+      "  -t, --time=MS             Time limit [100]\n"
+      "  -W, --window=US           Fairness measurement window [500]\n"
+      "  -j, --jain=FRACTION       Jain index counted as converged [0.9]\n"
+      "  -s, --seed=SEED           Random seed [1]\n"
+      "  -o, --trace=FILE          Write CC trace, flextoe-cctrace format\n"
+      "                            (default cc-trace-sample becomes 1)\n"
+      "  -v, --verbose             Print every measurement window\n"
+      "\n"
+      "Slowpath options after -- are parsed like flextoe's, e.g. --cc=timely\n"
+      "or --cc-dctcp-weight=0.0625. The send and receive buffers default to\n"
+      "256KB here.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  static const struct option opts[] = {
+    { "workload", required_argument, NULL, 'w' },
+    { "bw", required_argument, NULL, 'b' },
+    { "rtt", required_argument, NULL, 'r' },
+    { "ecn-k", required_argument, NULL, 'k' },
+    { "buffer", required_argument, NULL, 'q' },
+    { "time", required_argument, NULL, 't' },
+    { "window", required_argument, NULL, 'W' },
+    { "jain", required_argument, NULL, 'j' },
+    { "seed", required_argument, NULL, 's' },
+    { "trace", required_argument, NULL, 'o' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  /* config_parse() edits the arguments in place */
+  char ip_arg[] = "--ip-addr=10.0.0.1/8", rxbuf_arg[] = "--tcp-rxbuf-len=262144",
+       txbuf_arg[] = "--tcp-txbuf-len=262144", quiet_arg[] = "--quiet";
+  char *trace = NULL, **sp_argv;
+  int opt, sp_argc, i;
+
+  while ((opt = getopt_long(argc, argv, "w:b:r:k:q:t:W:j:s:o:vh", opts, NULL))
+      != -1)
+  {
+    switch (opt) {
+      case 'w':
+        if (workload_parse(optarg) != 0) {
+          fprintf(stderr, "ccsim: invalid workload %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'b':
+        params.bw = atoi(optarg);
+        break;
+      case 'r':
+        params.rtt = atoi(optarg);
+        break;
+      case 'k':
+        params.ecn_k = atoi(optarg) * 1024;
+        break;
+      case 'q':
+        params.buf = atoi(optarg) * 1024;
+        break;
+      case 't':
+        params.duration = strtoull(optarg, NULL, 10) * 1000000ull;
+        break;
+      case 'W':
+        params.window = strtoull(optarg, NULL, 10) * 1000ull;
+        break;
+      case 'j':
+        params.jain_thr = atof(optarg);
+        break;
+      case 's':
+        params.seed = strtoull(optarg, NULL, 10);
+        break;
+      case 'o':
+        trace = optarg;
+        break;
+      case 'v':
+        params.verbose = 1;
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  /* slowpath configuration: defaults of the simulator, then the user's */
+  sp_argv = calloc(argc + 5, sizeof(*sp_argv));
+  sp_argc = 0;
+  sp_argv[sp_argc++] = argv[0];
+  sp_argv[sp_argc++] = ip_arg;
+  sp_argv[sp_argc++] = rxbuf_arg;
+  sp_argv[sp_argc++] = txbuf_arg;
+  sp_argv[sp_argc++] = quiet_arg;
+  for (i = optind; i < argc; i++) {
+    sp_argv[sp_argc++] = argv[i];
+  }
+  optind = 1;
+  if (config_parse(&config, sp_argc, sp_argv) != 0) {
+    return EXIT_FAILURE;
+  }
+  free(sp_argv);
+
+  if (params.bw == 0) {
+    params.bw = config.tcp_link_bw;
+  }
+  if (params.rtt == 0 || params.buf < SIM_MSS + SIM_WIRE_OVH ||
+      params.duration == 0 || params.window == 0 || params.bw == 0)
+  {
+    fprintf(stderr, "ccsim: invalid parameters\n");
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (trace != NULL) {
+    if (config.cc_trace_sample == 0) {
+      config.cc_trace_sample = 1;
+    }
+    if (trace_open(trace) != 0) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  d_up = d_down = params.rtt * 1000ull / 4;
+  d_ack = params.rtt * 1000ull - d_up - d_down;
+  utils_rng_init(&rng, params.seed);
+
+  if (cc_init() != 0) {
+    fprintf(stderr, "ccsim: cc_init failed\n");
+    return EXIT_FAILURE;
+  }
+  workload_setup();
+  run();
+  report();
+
+  if (trace_f != NULL && fclose(trace_f) != 0) {
+    perror("ccsim: closing trace file failed");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
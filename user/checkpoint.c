@@ -0,0 +1,233 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * @brief Slowpath checkpoint and warm restart.
+ * @file checkpoint.c
+ * @addtogroup tas-sp-checkpoint
+ *
+ * The checkpoint is written to a temporary file next to the configured path
+ * and renamed once it is complete, a restore never sees a partial file. The
+ * header goes last: sections are appended by the modules owning the state,
+ * and only then are their record counts known.
+ *
+ * A restore rebuilds the state in dependency order. The SP rings and flow ids
+ * come first, then application contexts, then listeners and connections
+ * (which refer to contexts), then TIME_WAIT entries and the ARP cache. Packet
+ * memory not named by any record is free afterwards, this drops contexts
+ * that were still being registered.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util/common.h"
+
+#include "flextoe.h"
+#include "internal.h"
+#include "sp_checkpoint.h"
+
+int checkpoint_write(void)
+{
+  struct sp_ckpt_hdr hdr;
+  uint32_t ctxs, listeners, conns, tws, arps;
+  char path[PATH_MAX + 4];
+  long size;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "%s.tmp", config.checkpoint_path);
+  if ((f = fopen(path, "w")) == NULL) {
+    perror("checkpoint_write: fopen failed");
+    return -1;
+  }
+
+  /* placeholder, rewritten once the counts are known */
+  memset(&hdr, 0, sizeof(hdr));
+  if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) {
+    fprintf(stderr, "checkpoint_write: fwrite failed\n");
+    goto error;
+  }
+
+  if (appif_checkpoint(f, &ctxs) != 0 ||
+      tcp_checkpoint(f, &listeners, &conns) != 0 ||
+      tcp_tw_checkpoint(f, &tws) != 0 ||
+      arp_checkpoint(f, &arps) != 0)
+  {
+    goto error;
+  }
+  nicif_checkpoint(&hdr);
+
+  if ((size = ftell(f)) < 0) {
+    perror("checkpoint_write: ftell failed");
+    goto error;
+  }
+  hdr.magic = SP_CKPT_MAGIC;
+  hdr.version = SP_CKPT_VERSION;
+  hdr.size = size;
+  hdr.shm_len = config.shm_len;
+  hdr.ip = config.ip;
+  hdr.nic_rx_len = config.nic_rx_len;
+  hdr.nic_tx_len = config.nic_tx_len;
+  hdr.cc_algorithm = config.cc_algorithm;
+  hdr.ctxs = ctxs;
+  hdr.listeners = listeners;
+  hdr.conns = conns;
+  hdr.tws = tws;
+  hdr.arps = arps;
+
+  if (fseek(f, 0, SEEK_SET) != 0 ||
+      fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+      fflush(f) != 0 || fsync(fileno(f)) != 0)
+  {
+    perror("checkpoint_write: writing header failed");
+    goto error;
+  }
+  fclose(f);
+
+  if (rename(path, config.checkpoint_path) != 0) {
+    perror("checkpoint_write: rename failed");
+    unlink(path);
+    return -1;
+  }
+
+  if (!config.quiet) {
+    printf("checkpoint: %u contexts, %u listeners, %u connections, %u "
+        "time-wait entries, %u arp entries written to %s\n", hdr.ctxs,
+        hdr.listeners, hdr.conns, hdr.tws, hdr.arps, config.checkpoint_path);
+  }
+  return 0;
+
+error:
+  fclose(f);
+  unlink(path);
+  return -1;
+}
+
+/** Read the whole checkpoint file and check it belongs to this setup */
+static void *checkpoint_read(size_t *psize)
+{
+  const struct sp_ckpt_hdr *hdr;
+  size_t size;
+  void *buf;
+  FILE *f;
+  long len;
+
+  if ((f = fopen(config.checkpoint_path, "r")) == NULL) {
+    perror("checkpoint_read: fopen failed");
+    return NULL;
+  }
+  if (fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0 ||
+      fseek(f, 0, SEEK_SET) != 0)
+  {
+    perror("checkpoint_read: seek failed");
+    fclose(f);
+    return NULL;
+  }
+  size = len;
+
+  if (size < sizeof(*hdr) || (buf = malloc(size)) == NULL) {
+    fprintf(stderr, "checkpoint_read: file too short or malloc failed\n");
+    fclose(f);
+    return NULL;
+  }
+  if (fread(buf, size, 1, f) != 1) {
+    fprintf(stderr, "checkpoint_read: fread failed\n");
+    goto error;
+  }
+  fclose(f);
+  f = NULL;
+
+  hdr = buf;
+  if (hdr->magic != SP_CKPT_MAGIC || hdr->version != SP_CKPT_VERSION ||
+      hdr->size != size)
+  {
+    fprintf(stderr, "checkpoint_read: not a checkpoint of this version\n");
+    goto error;
+  }
+  if (size != sizeof(*hdr) +
+      hdr->ctxs * sizeof(struct sp_ckpt_ctx) +
+      hdr->listeners * sizeof(struct sp_ckpt_listener) +
+      (uint64_t) hdr->conns * sizeof(struct sp_ckpt_conn) +
+      hdr->tws * sizeof(struct sp_ckpt_tw) +
+      hdr->arps * sizeof(struct sp_ckpt_arp))
+  {
+    fprintf(stderr, "checkpoint_read: section sizes do not add up\n");
+    goto error;
+  }
+  if (hdr->shm_len != config.shm_len || hdr->ip != config.ip ||
+      hdr->nic_rx_len != config.nic_rx_len ||
+      hdr->nic_tx_len != config.nic_tx_len)
+  {
+    fprintf(stderr, "checkpoint_read: shm size, ip or SP queue lengths "
+        "differ from the checkpoint\n");
+    goto error;
+  }
+
+  *psize = size;
+  return buf;
+
+error:
+  if (f != NULL) {
+    fclose(f);
+  }
+  free(buf);
+  return NULL;
+}
+
+int checkpoint_restore(void)
+{
+  const struct sp_ckpt_hdr *hdr;
+  const struct sp_ckpt_ctx *ctxs;
+  const struct sp_ckpt_listener *ls;
+  const struct sp_ckpt_conn *cs;
+  const struct sp_ckpt_tw *tws;
+  const struct sp_ckpt_arp *arps;
+  size_t size;
+  void *buf;
+  int ret = -1;
+
+  if ((buf = checkpoint_read(&size)) == NULL) {
+    return -1;
+  }
+
+  hdr = buf;
+  ctxs = (const struct sp_ckpt_ctx *) (hdr + 1);
+  ls = (const struct sp_ckpt_listener *) (ctxs + hdr->ctxs);
+  cs = (const struct sp_ckpt_conn *) (ls + hdr->listeners);
+  tws = (const struct sp_ckpt_tw *) (cs + hdr->conns);
+  arps = (const struct sp_ckpt_arp *) (tws + hdr->tws);
+
+  if (nicif_restore(hdr, cs, hdr->conns) != 0) {
+    fprintf(stderr, "checkpoint_restore: nicif_restore failed\n");
+    goto out;
+  }
+  if (appif_restore(ctxs, hdr->ctxs) != 0) {
+    fprintf(stderr, "checkpoint_restore: appif_restore failed\n");
+    goto out;
+  }
+  if (tcp_restore(ls, hdr->listeners, cs, hdr->conns,
+        hdr->cc_algorithm != config.cc_algorithm) != 0)
+  {
+    fprintf(stderr, "checkpoint_restore: tcp_restore failed\n");
+    goto out;
+  }
+  tcp_tw_restore(tws, hdr->tws);
+  if (arp_restore(arps, hdr->arps) != 0) {
+    fprintf(stderr, "checkpoint_restore: arp_restore failed\n");
+    goto out;
+  }
+
+  if (!config.quiet) {
+    printf("checkpoint: %u contexts, %u listeners, %u connections, %u "
+        "time-wait entries, %u arp entries restored from %s\n", hdr->ctxs,
+        hdr->listeners, hdr->conns, hdr->tws, hdr->arps,
+        config.checkpoint_path);
+  }
+  ret = 0;
+
+out:
+  free(buf);
+  return ret;
+}
@@ -2,6 +2,8 @@
 /* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
 
 #include <getopt.h>
+#include <ctype.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,18 +11,30 @@
 #include <string.h>
 #include <unistd.h>
 #include <libgen.h>
+#include <errno.h>
 
 #include "util/common.h"
 #include "common.h"
 
 #include "config.h"
+#include "tcp_delack.h"
+#include "tcp_rxwnd.h"
+#include "qm_sched.h"
 
+/* values start past the characters getopt_long() returns, like '?' */
 enum cfg_params {
-  CP_SHM_LEN,
+  CP_SHM_LEN = 256,
+  CP_SHM_POPULATE,
+  CP_SHM_PAGES,
+  CP_SHM_THREADS,
   CP_NIC_RX_LEN,
   CP_NIC_TX_LEN,
   CP_APP_SPIN_LEN,
   CP_APP_SPOUT_LEN,
+  CP_APP_GRACE,
+  CP_NUMA_NODES,
+  CP_NUMA_EMULATE,
+  CP_NIC_NODE,
   CP_ARP_TO,
   CP_ARP_TO_MAX,
   CP_TCP_RTT_INIT,
@@ -29,10 +43,17 @@ enum cfg_params {
   CP_TCP_TXBUF_LEN,
   CP_TCP_HANDSHAKE_TO,
   CP_TCP_HANDSHAKE_RETRIES,
+  CP_TCP_DELACK_SEGS,
+  CP_TCP_DELACK_TIMEOUT,
+  CP_TCP_RXWND_MIN,
+  CP_TCP_RXWND_BUDGET,
+  CP_TCP_IDLE_TIMEOUT,
+  CP_QM_CTX_WEIGHT,
   CP_CC,
   CP_CC_CONTROL_GRANULARITY,
   CP_CC_CONTROL_INTERVAL,
   CP_CC_REXMIT_INTS,
+  CP_CC_TLP_INTS,
   CP_CC_DCTCP_WEIGHT,
   CP_CC_DCTCP_INIT,
   CP_CC_DCTCP_STEP,
@@ -48,17 +69,39 @@ enum cfg_params {
   CP_CC_TIMELY_BETA,
   CP_CC_TIMELY_MINRTT,
   CP_CC_TIMELY_MINRATE,
+  CP_CC_TRACE_SAMPLE,
+  CP_CC_TRACE_LEN,
   CP_IP_ROUTE,
   CP_IP_ADDR,
   CP_FP_POLL_INTERVAL_APP,
+  CP_STATS_INTERVAL,
+  CP_PCAP,
+  CP_PCAP_FILTER,
+  CP_PCAP_SNAPLEN,
+  CP_PCAP_MAX_SIZE,
+  CP_PCAP_FILES,
+  CP_PCAP_RING_LEN,
+  CP_PCAP_PAUSED,
+  CP_CHECKPOINT,
+  CP_RESTORE,
   CP_QUIET,
   CP_DEBUG_CONSOLE,
+  CP_CONFIG,
 };
 
 static struct option opts[] = {
   { .name = "shm-len",
     .has_arg = required_argument,
     .val = CP_SHM_LEN },
+  { .name = "shm-populate",
+    .has_arg = required_argument,
+    .val = CP_SHM_POPULATE },
+  { .name = "shm-pages",
+    .has_arg = required_argument,
+    .val = CP_SHM_PAGES },
+  { .name = "shm-threads",
+    .has_arg = required_argument,
+    .val = CP_SHM_THREADS },
   { .name = "nic-rx-len",
     .has_arg = required_argument,
     .val = CP_NIC_RX_LEN },
@@ -71,6 +114,18 @@ static struct option opts[] = {
   { .name = "app-spout-len",
     .has_arg = required_argument,
     .val = CP_APP_SPOUT_LEN },
+  { .name = "app-grace-period",
+    .has_arg = required_argument,
+    .val = CP_APP_GRACE },
+  { .name = "numa-nodes",
+    .has_arg = required_argument,
+    .val = CP_NUMA_NODES },
+  { .name = "numa-emulate",
+    .has_arg = no_argument,
+    .val = CP_NUMA_EMULATE },
+  { .name = "nic-node",
+    .has_arg = required_argument,
+    .val = CP_NIC_NODE },
   { .name = "arp-timout",
     .has_arg = required_argument,
     .val = CP_ARP_TO },
@@ -95,6 +150,24 @@ static struct option opts[] = {
   { .name = "tcp-handshake-retries",
     .has_arg = required_argument,
     .val = CP_TCP_HANDSHAKE_RETRIES },
+  { .name = "tcp-delack-segs",
+    .has_arg = required_argument,
+    .val = CP_TCP_DELACK_SEGS },
+  { .name = "tcp-delack-timeout",
+    .has_arg = required_argument,
+    .val = CP_TCP_DELACK_TIMEOUT },
+  { .name = "tcp-rxwnd-min",
+    .has_arg = required_argument,
+    .val = CP_TCP_RXWND_MIN },
+  { .name = "tcp-rxwnd-budget",
+    .has_arg = required_argument,
+    .val = CP_TCP_RXWND_BUDGET },
+  { .name = "tcp-idle-timeout",
+    .has_arg = required_argument,
+    .val = CP_TCP_IDLE_TIMEOUT },
+  { .name = "qm-ctx-weight",
+    .has_arg = required_argument,
+    .val = CP_QM_CTX_WEIGHT },
   { .name = "cc",
     .has_arg = required_argument,
     .val = CP_CC },
@@ -107,6 +180,9 @@ static struct option opts[] = {
   { .name = "cc-rexmit-ints",
     .has_arg = required_argument,
     .val = CP_CC_REXMIT_INTS },
+  { .name = "cc-tlp-ints",
+    .has_arg = required_argument,
+    .val = CP_CC_TLP_INTS },
   { .name = "cc-dctcp-weight",
     .has_arg = required_argument,
     .val = CP_CC_DCTCP_WEIGHT },
@@ -152,6 +228,12 @@ static struct option opts[] = {
   { .name = "cc-timely-minrate",
     .has_arg = required_argument,
     .val = CP_CC_TIMELY_MINRATE },
+  { .name = "cc-trace-sample",
+    .has_arg = required_argument,
+    .val = CP_CC_TRACE_SAMPLE },
+  { .name = "cc-trace-len",
+    .has_arg = required_argument,
+    .val = CP_CC_TRACE_LEN },
   { .name = "ip-route",
     .has_arg = required_argument,
     .val = CP_IP_ROUTE },
@@ -161,12 +243,45 @@ static struct option opts[] = {
   { .name = "fp-poll-interval-app",
     .has_arg = required_argument,
     .val = CP_FP_POLL_INTERVAL_APP },
+  { .name = "stats-interval",
+    .has_arg = required_argument,
+    .val = CP_STATS_INTERVAL },
+  { .name = "pcap",
+    .has_arg = required_argument,
+    .val = CP_PCAP },
+  { .name = "pcap-filter",
+    .has_arg = required_argument,
+    .val = CP_PCAP_FILTER },
+  { .name = "pcap-snaplen",
+    .has_arg = required_argument,
+    .val = CP_PCAP_SNAPLEN },
+  { .name = "pcap-max-size",
+    .has_arg = required_argument,
+    .val = CP_PCAP_MAX_SIZE },
+  { .name = "pcap-files",
+    .has_arg = required_argument,
+    .val = CP_PCAP_FILES },
+  { .name = "pcap-ring-len",
+    .has_arg = required_argument,
+    .val = CP_PCAP_RING_LEN },
+  { .name = "pcap-paused",
+    .has_arg = no_argument,
+    .val = CP_PCAP_PAUSED },
+  { .name = "checkpoint",
+    .has_arg = required_argument,
+    .val = CP_CHECKPOINT },
+  { .name = "restore",
+    .has_arg = no_argument,
+    .val = CP_RESTORE },
   { .name = "quiet",
     .has_arg = no_argument,
     .val = CP_QUIET },
   { .name = "debug-console",
     .has_arg = no_argument,
     .val = CP_DEBUG_CONSOLE },
+  { .name = "config",
+    .has_arg = required_argument,
+    .val = CP_CONFIG },
   { .name = NULL },
 };
 
@@ -179,7 +294,65 @@ static inline int parse_double(const char *s, double *pd);
 static inline int parse_cidr(char *s, uint32_t *ip, uint8_t *prefix);
 static inline int parse_route(char *s, struct configuration *c);
 
+/** Argument vector with --config files expanded, owns its strings */
+struct config_args {
+  int argc;
+  int cap;
+  char **argv;
+};
+
+static int config_parse_args(struct configuration *c, int argc, char *argv[],
+    int reload);
+static int config_expand(struct config_args *a, int argc, char *argv[]);
+static int config_file(struct config_args *a, const char *path);
+static int args_add(struct config_args *a, const char *s);
+static void args_free(struct config_args *a);
+
+/** Command line as given, parsed again on reloads */
+static struct config_args saved_args;
+
 int config_parse(struct configuration *c, int argc, char *argv[])
+{
+  struct config_args args = { 0 };
+  int i, ret;
+
+  args_free(&saved_args);
+  for (i = 0; i < argc; i++) {
+    if (args_add(&saved_args, argv[i]) != 0) {
+      return -1;
+    }
+  }
+
+  if (config_expand(&args, argc, argv) != 0) {
+    args_free(&args);
+    return -1;
+  }
+  ret = config_parse_args(c, args.argc, args.argv, 0);
+  args_free(&args);
+  return ret;
+}
+
+int config_reload(struct configuration *c)
+{
+  struct config_args args = { 0 };
+  int ret;
+
+  if (saved_args.argc == 0) {
+    fprintf(stderr, "config_reload: configuration was never parsed\n");
+    return -1;
+  }
+
+  if (config_expand(&args, saved_args.argc, saved_args.argv) != 0) {
+    args_free(&args);
+    return -1;
+  }
+  ret = config_parse_args(c, args.argc, args.argv, 1);
+  args_free(&args);
+  return ret;
+}
+
+static int config_parse_args(struct configuration *c, int argc, char *argv[],
+    int reload)
 {
   int ret, done = 0;
   double d;
@@ -189,6 +362,8 @@ int config_parse(struct configuration *c, int argc, char *argv[])
     goto failed;
   }
 
+  /* start over, the vector differs from any earlier call */
+  optind = 0;
   while (!done) {
     ret = getopt_long(argc, argv, "", opts, NULL);
     switch (ret) {
@@ -222,6 +397,60 @@ int config_parse(struct configuration *c, int argc, char *argv[])
           goto failed;
         }
         break;
+      case CP_APP_GRACE:
+        if (parse_int32(optarg, &c->app_grace) != 0) {
+          fprintf(stderr, "app grace period parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_SHM_POPULATE:
+        if (!strcmp(optarg, "serial")) {
+          c->shm_populate = CONFIG_SHM_POPULATE_SERIAL;
+        } else if (!strcmp(optarg, "parallel")) {
+          c->shm_populate = CONFIG_SHM_POPULATE_PARALLEL;
+        } else if (!strcmp(optarg, "lazy")) {
+          c->shm_populate = CONFIG_SHM_POPULATE_LAZY;
+        } else {
+          fprintf(stderr, "shm populate mode parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_SHM_PAGES:
+        if (!strcmp(optarg, "1g")) {
+          c->shm_pages = CONFIG_SHM_PAGES_1G;
+        } else if (!strcmp(optarg, "2m")) {
+          c->shm_pages = CONFIG_SHM_PAGES_2M;
+        } else if (!strcmp(optarg, "auto")) {
+          c->shm_pages = CONFIG_SHM_PAGES_AUTO;
+        } else {
+          fprintf(stderr, "shm pages parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_SHM_THREADS:
+        if (parse_int32(optarg, &c->shm_threads) != 0) {
+          fprintf(stderr, "shm threads parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_NUMA_NODES:
+        if (parse_int32(optarg, &c->numa_nodes) != 0 || c->numa_nodes == 0 ||
+            c->numa_nodes > CONFIG_NUMA_NODES_MAX)
+        {
+          fprintf(stderr, "numa nodes parsing failed (1-%u)\n",
+              CONFIG_NUMA_NODES_MAX);
+          goto failed;
+        }
+        break;
+      case CP_NUMA_EMULATE:
+        c->numa_emulate = 1;
+        break;
+      case CP_NIC_NODE:
+        if (parse_int32(optarg, &c->nic_node) != 0) {
+          fprintf(stderr, "nic node parsing failed\n");
+          goto failed;
+        }
+        break;
       case CP_ARP_TO:
         if (parse_int32(optarg, &c->arp_to) != 0) {
           fprintf(stderr, "arp timeout parsing failed\n");
@@ -278,6 +507,51 @@ int config_parse(struct configuration *c, int argc, char *argv[])
           goto failed;
         }
         break;
+      case CP_TCP_DELACK_SEGS:
+        if (parse_int32(optarg, &c->tcp_delack_segs) != 0 ||
+            c->tcp_delack_segs > TCP_DELACK_SEGS_MAX)
+        {
+          fprintf(stderr, "tcp delack segments parsing failed (max %u)\n",
+              TCP_DELACK_SEGS_MAX);
+          goto failed;
+        }
+        break;
+      case CP_TCP_DELACK_TIMEOUT:
+        if (parse_int32(optarg, &c->tcp_delack_to) != 0) {
+          fprintf(stderr, "tcp delack timeout parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_TCP_RXWND_MIN:
+        if (parse_int32(optarg, &c->tcp_rxwnd_min) != 0 ||
+            c->tcp_rxwnd_min % TCP_RXWND_QUANTUM != 0)
+        {
+          fprintf(stderr, "tcp rxwnd min parsing failed (multiple of %u)\n",
+              TCP_RXWND_QUANTUM);
+          goto failed;
+        }
+        break;
+      case CP_TCP_RXWND_BUDGET:
+        if (parse_int64(optarg, &c->tcp_rxwnd_budget) != 0) {
+          fprintf(stderr, "tcp rxwnd budget parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_TCP_IDLE_TIMEOUT:
+        if (parse_int32(optarg, &c->tcp_idle_to) != 0) {
+          fprintf(stderr, "tcp idle timeout parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_QM_CTX_WEIGHT:
+        if (parse_int32(optarg, &c->qm_ctx_weight) != 0 ||
+            c->qm_ctx_weight == 0 || c->qm_ctx_weight > QM_CTX_WEIGHT_MAX)
+        {
+          fprintf(stderr, "qm context weight parsing failed (1-%u)\n",
+              QM_CTX_WEIGHT_MAX);
+          goto failed;
+        }
+        break;
       case CP_CC:
         if (!strcmp(optarg, "dctcp-win")) {
           c->cc_algorithm = CONFIG_CC_DCTCP_WIN;
@@ -310,6 +584,12 @@ int config_parse(struct configuration *c, int argc, char *argv[])
           goto failed;
         }
         break;
+      case CP_CC_TLP_INTS:
+        if (parse_int32(optarg, &c->cc_tlp_ints) != 0) {
+          fprintf(stderr, "cc tlp intervals parsing failed\n");
+          goto failed;
+        }
+        break;
       case CP_CC_DCTCP_WEIGHT:
         if (parse_double(optarg, &d) != 0 || d < 0 || d > 1) {
           fprintf(stderr, "cc dctcp weight parsing failed\n");
@@ -404,6 +684,20 @@ int config_parse(struct configuration *c, int argc, char *argv[])
           goto failed;
         }
         break;
+      case CP_CC_TRACE_SAMPLE:
+        if (parse_int32(optarg, &c->cc_trace_sample) != 0) {
+          fprintf(stderr, "cc trace sample parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_CC_TRACE_LEN:
+        if (parse_int32(optarg, &c->cc_trace_len) != 0 ||
+            !rte_is_power_of_2(c->cc_trace_len))
+        {
+          fprintf(stderr, "cc trace len parsing failed (power of 2)\n");
+          goto failed;
+        }
+        break;
       case CP_IP_ROUTE:
         if (parse_route(optarg, c) != 0) {
           goto failed;
@@ -421,12 +715,79 @@ int config_parse(struct configuration *c, int argc, char *argv[])
           fprintf(stderr, "fp app poll interval parsing failed\n");
           goto failed;
         }
+        break;
+      case CP_STATS_INTERVAL:
+        if (parse_int32(optarg, &c->stats_interval) != 0) {
+          fprintf(stderr, "stats interval parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_PCAP:
+        if (strlen(optarg) >= sizeof(c->pcap_path)) {
+          fprintf(stderr, "pcap path too long\n");
+          goto failed;
+        }
+        strcpy(c->pcap_path, optarg);
+        break;
+      case CP_PCAP_FILTER:
+        if (strlen(optarg) >= sizeof(c->pcap_filter)) {
+          fprintf(stderr, "pcap filter too long (max %u)\n",
+              CONFIG_PCAP_FILTER_MAX - 1);
+          goto failed;
+        }
+        strcpy(c->pcap_filter, optarg);
+        break;
+      case CP_PCAP_SNAPLEN:
+        if (parse_int32(optarg, &c->pcap_snaplen) != 0 ||
+            c->pcap_snaplen == 0 || c->pcap_snaplen > UINT16_MAX)
+        {
+          fprintf(stderr, "pcap snaplen parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_PCAP_MAX_SIZE:
+        if (parse_int64(optarg, &c->pcap_max_size) != 0) {
+          fprintf(stderr, "pcap max size parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_PCAP_FILES:
+        if (parse_int32(optarg, &c->pcap_files) != 0 || c->pcap_files == 0) {
+          fprintf(stderr, "pcap files parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_PCAP_RING_LEN:
+        if (parse_int32(optarg, &c->pcap_ring_len) != 0 ||
+            !rte_is_power_of_2(c->pcap_ring_len))
+        {
+          fprintf(stderr, "pcap ring len parsing failed (power of 2)\n");
+          goto failed;
+        }
+        break;
+      case CP_PCAP_PAUSED:
+        c->pcap_paused = 1;
+        break;
+      case CP_CHECKPOINT:
+        if (strlen(optarg) >= sizeof(c->checkpoint_path)) {
+          fprintf(stderr, "checkpoint path too long\n");
+          goto failed;
+        }
+        strcpy(c->checkpoint_path, optarg);
+        break;
+      case CP_RESTORE:
+        c->restore = 1;
+        break;
       case CP_QUIET:
 	      c->quiet = 1;
         break;
       case CP_DEBUG_CONSOLE:
         c->console = 1;
         break;
+      case CP_CONFIG:
+        /* replaced by the file contents in config_expand() */
+        fprintf(stderr, "--config is only allowed on the command line\n");
+        goto failed;
       case -1:
         done = 1;
         break;
@@ -446,11 +807,34 @@ int config_parse(struct configuration *c, int argc, char *argv[])
     goto failed;
   }
 
+  if (c->nic_node != CONFIG_NODE_DETECT && c->nic_node >= c->numa_nodes) {
+    fprintf(stderr, "nic node must be below numa nodes\n");
+    goto failed;
+  }
+
+  if (c->restore && c->checkpoint_path[0] == 0) {
+    fprintf(stderr, "restore needs the checkpoint file (--checkpoint)\n");
+    goto failed;
+  }
+
+  /* applications return rx buffer space in batches of a quarter buffer, a
+   * smaller window would stall */
+  if (c->tcp_rxwnd_min != 0 &&
+      (c->tcp_rxwnd_min <= c->tcp_rxbuf_len / 4 ||
+       c->tcp_rxwnd_min > MIN(c->tcp_rxbuf_len, TCP_RXWND_MAX_NOWS)))
+  {
+    fprintf(stderr, "tcp rxwnd min must be above a quarter of the rx buffer "
+        "and at most the rx buffer or %u\n", TCP_RXWND_MAX_NOWS);
+    goto failed;
+  }
+
   return 0;
 
 failed:
-  config_defaults(c, argv[0]);
-  print_usage(c, argv[0]);
+  if (!reload) {
+    config_defaults(c, argv[0]);
+    print_usage(c, argv[0]);
+  }
   return -1;
 }
 
@@ -463,10 +847,17 @@ static int config_defaults(struct configuration *c, char *progname)
 
   c->ip = 0;
   c->shm_len = 1024 * 1024 * 1024;
+  c->shm_populate = CONFIG_SHM_POPULATE_PARALLEL;
+  c->shm_pages = CONFIG_SHM_PAGES_1G;
+  c->shm_threads = 0;
   c->nic_rx_len = 256;
   c->nic_tx_len = 256;
   c->app_spin_len = 1024 * 1024;
   c->app_spout_len = 1024 * 1024;
+  c->app_grace = 2000;
+  c->numa_nodes = 1;
+  c->numa_emulate = 0;
+  c->nic_node = CONFIG_NODE_DETECT;
   c->arp_to = 500;
   c->arp_to_max = 10000000;
   c->tcp_rtt_init = 50;
@@ -475,10 +866,17 @@ static int config_defaults(struct configuration *c, char *progname)
   c->tcp_txbuf_len = 8 * 1024;
   c->tcp_handshake_to = 10000;
   c->tcp_handshake_retries = 10;
+  c->tcp_delack_segs = 1;
+  c->tcp_delack_to = 20;
+  c->tcp_rxwnd_min = 0;
+  c->tcp_rxwnd_budget = 0;
+  c->tcp_idle_to = 0;
+  c->qm_ctx_weight = 1;
   c->cc_algorithm = CONFIG_CC_DCTCP_RATE;
   c->cc_control_granularity = 50;
   c->cc_control_interval = 2;
   c->cc_rexmit_ints = 4;
+  c->cc_tlp_ints = 1;
   c->cc_dctcp_weight = UINT32_MAX / 16;
   c->cc_dctcp_init = 10000;
   c->cc_dctcp_step = 10000;
@@ -494,7 +892,19 @@ static int config_defaults(struct configuration *c, char *progname)
   c->cc_timely_beta = 0.8 * UINT32_MAX;
   c->cc_timely_min_rtt = 11;
   c->cc_timely_min_rate = 10000;
+  c->cc_trace_sample = 0;
+  c->cc_trace_len = 64 * 1024;
   c->fp_poll_interval_app = 10000;
+  c->stats_interval = 100000;
+  c->pcap_path[0] = 0;
+  c->pcap_filter[0] = 0;
+  c->pcap_snaplen = 256;
+  c->pcap_max_size = 0;
+  c->pcap_files = 1;
+  c->pcap_ring_len = 4096;
+  c->pcap_paused = 0;
+  c->checkpoint_path[0] = 0;
+  c->restore = 0;
   c->quiet = 0;
   c->console = 0;
 
@@ -509,6 +919,15 @@ static void print_usage(struct configuration *c, char *progname)
       "Memory Sizes:\n"
       "  --shm-len=LEN               Shared memory len "
           "[default: %"PRIu64"]\n"
+      "  --shm-populate=MODE         Fault in shared memory at startup: "
+          "serial, parallel\n"
+      "     or lazy (when packet memory first uses a hugepage) "
+          "[default: parallel]\n"
+      "  --shm-pages=SIZE            Hugepages for shared memory: 1g, 2m or "
+          "auto (1g,\n"
+      "     2m if not enough) [default: 1g]\n"
+      "  --shm-threads=N             Threads populating shared memory "
+          "[default: online cpus]\n"
       "  --nic-rx-len=LEN            SP rx queue len "
           "[default: %"PRIu64"]\n"
       "  --nic-tx-len=LEN            SP tx queue len "
@@ -517,6 +936,21 @@ static void print_usage(struct configuration *c, char *progname)
           "[default: %"PRIu64"]\n"
       "  --app-spout-len=LEN          SP->App queue len "
           "[default: %"PRIu64"]\n"
+      "  --app-grace-period=MS       Keep contexts and listeners of an "
+          "application with a\n"
+      "     session token this long after it exits, for its restart to "
+          "reclaim, 0\n"
+      "     disables [default: %"PRIu32"]\n"
+      "  --numa-nodes=N              Spread shared memory hugepages over "
+          "nodes 0 to N-1,\n"
+      "     buffers are placed on the node of the owning context "
+          "[default: %"PRIu32"]\n"
+      "  --numa-emulate              Assign hugepages to nodes round robin "
+          "without placing\n"
+      "     them, for testing\n"
+      "  --nic-node=NODE             NUMA node of the NIC, the default for "
+          "buffers\n"
+      "     [default: from sysfs]\n"
       "\n"
       "TCP protocol parameters:\n"
       "  --tcp-rtt-init=RTT          Initial rtt for CC (us) "
@@ -531,6 +965,20 @@ static void print_usage(struct configuration *c, char *progname)
           "[default: %"PRIu32"]\n"
       "  --tcp-handshake-retries=RETRIES  Handshake retries "
           "[default: %"PRIu32"]\n"
+      "  --tcp-delack-segs=SEGS      ACK every SEGS in-order segments, 1 "
+          "disables delayed ACKs [default: %"PRIu32"]\n"
+      "  --tcp-delack-timeout=TIMEOUT  Delayed ACK timeout (us) "
+          "[default: %"PRIu32"]\n"
+      "  --tcp-rxwnd-min=LEN         Autotune rx windows starting at LEN, 0 "
+          "disables [default: %"PRIu32"]\n"
+      "  --tcp-rxwnd-budget=LEN      Limit for sum of autotuned rx windows, 0 "
+          "is unlimited [default: %"PRIu64"]\n"
+      "  --tcp-idle-timeout=TIMEOUT  Reset connections idle for TIMEOUT (s), "
+          "0 disables [default: %"PRIu32"]\n"
+      "\n"
+      "Queue manager parameters:\n"
+      "  --qm-ctx-weight=WEIGHT      DRR weight of app contexts (segments "
+          "per round) [default: %"PRIu32"]\n"
       "\n"
       "Congestion control parameters:\n"
       "  --cc=ALGORITHM              Congestion-control algorithm "
@@ -542,6 +990,8 @@ static void print_usage(struct configuration *c, char *progname)
           "[default: %"PRIu32"]\n"
       "  --cc-rexmit-ints=INTERVALS  #of RTTs without ACKs before rexmit "
           "[default: %"PRIu32"]\n"
+      "  --cc-tlp-ints=INTERVALS     #of RTTs without ACKs before tail loss "
+          "probe, 0 disables [default: %"PRIu32"]\n"
       "  --cc-dctcp-weight=WEIGHT    DCTCP: EWMA weight for ECN rate "
           "[default: %f]\n"
       "  --cc-dctcp-mimd=INC_FACT    DCTCP: enable multiplicative inc  "
@@ -566,6 +1016,10 @@ static void print_usage(struct configuration *c, char *progname)
           "[default: %"PRIu32"]\n"
       "  --cc-timely-minrate=RTT     Timely: minimal rate to use "
           "[default: %"PRIu32"]\n"
+      "  --cc-trace-sample=N         Trace CC of every N-th flow id, 0 "
+          "disables [default: %"PRIu32"]\n"
+      "  --cc-trace-len=LEN          Records in the CC trace ring "
+          "[default: %"PRIu32"]\n"
       "\n"
       "IP protocol parameters:\n"
       "  --ip-route=DEST[/PREFIX],NEXTHOP  Add route\n"
@@ -577,9 +1031,42 @@ static void print_usage(struct configuration *c, char *progname)
       "  --arp-timeout-max=TIMEOUT   ARP request max timeout (us) "
           "[default: %"PRIu32"]\n"
       "\n"
+      "Packet capture:\n"
+      "  --pcap=FILE                 Capture slowpath packets to FILE "
+          "(pcapng) [default: disabled]\n"
+      "  --pcap-filter=EXPR          Only capture matching packets, e.g. "
+          "'arp or tcp and port 80'\n"
+      "     Primitives: arp, ip, tcp, [src|dst] host ADDR, "
+          "[src|dst] port PORT,\n"
+      "     syn, ack, fin, rst, combined with not, and, or\n"
+      "  --pcap-snaplen=LEN          Bytes captured per packet "
+          "[default: %"PRIu32"]\n"
+      "  --pcap-max-size=BYTES       Size limit per file, 0 is unlimited "
+          "[default: %"PRIu64"]\n"
+      "  --pcap-files=N              Rotate over FILE.0 to FILE.N-1 at the "
+          "size limit [default: %"PRIu32"]\n"
+      "  --pcap-ring-len=LEN         Packets buffered for the writer "
+          "[default: %"PRIu32"]\n"
+      "  --pcap-paused               Start paused, toggle with SIGUSR1 or "
+          "the debug console\n"
+      "\n"
+      "Warm restart:\n"
+      "  --checkpoint=FILE           Write connection state to FILE at exit "
+          "and leave the\n"
+      "     NIC and shared memory running [default: disabled]\n"
+      "  --restore                   Resume from the checkpoint FILE "
+          "without resetting the NIC\n"
+      "\n"
       "Miscelaneous:\n"
+      "  --config=FILE               Read options from an INI file, later "
+          "options override\n"
+      "     it. Keys are option names, [SECTION] prefixes SECTION-. SIGHUP "
+          "reloads CC,\n"
+      "     TCP timeout, ARP and route settings at runtime\n"
       "  --fp-poll-interval-app      App polling interval before blocsping "
           "in us [default: %"PRIu32"]\n"
+      "  --stats-interval=INT        Telemetry update interval in us, 0 "
+          "disables [default: %"PRIu32"]\n"
       "  --quiet                     Disable non-essential logging "
           "[default: disabled]\n"
       "  --debug-console             Enable debug console "
@@ -587,15 +1074,22 @@ static void print_usage(struct configuration *c, char *progname)
       "\n",
       progname, c->shm_len,
       c->nic_rx_len, c->nic_tx_len, c->app_spin_len, c->app_spout_len,
+      c->app_grace, c->numa_nodes,
       c->tcp_rtt_init, c->tcp_link_bw, c->tcp_rxbuf_len, c->tcp_txbuf_len,
       c->tcp_handshake_to, c->tcp_handshake_retries,
+      c->tcp_delack_segs, c->tcp_delack_to, c->tcp_rxwnd_min,
+      c->tcp_rxwnd_budget, c->tcp_idle_to, c->qm_ctx_weight,
       c->cc_control_granularity, c->cc_control_interval, c->cc_rexmit_ints,
+      c->cc_tlp_ints,
       (double) c->cc_dctcp_weight / UINT32_MAX, c->cc_dctcp_min,
       c->cc_const_rate, c->cc_timely_tlow, c->cc_timely_thigh,
       c->cc_timely_step, c->cc_timely_init,
       (double) c->cc_timely_alpha / UINT32_MAX,
       (double) c->cc_timely_beta / UINT32_MAX, c->cc_timely_min_rtt,
-      c->cc_timely_min_rate, c->arp_to, c->arp_to_max, c->fp_poll_interval_app);
+      c->cc_timely_min_rate, c->cc_trace_sample, c->cc_trace_len, c->arp_to,
+      c->arp_to_max, c->pcap_snaplen, c->pcap_max_size, c->pcap_files,
+      c->pcap_ring_len,
+      c->fp_poll_interval_app, c->stats_interval);
 }
 static inline int parse_int64(const char *s, uint64_t *pi)
 {
@@ -697,3 +1191,383 @@ static inline int parse_route(char *s, struct configuration *c)
 failed:
   return -1;
 }
+
+static void args_free(struct config_args *a)
+{
+  int i;
+
+  for (i = 0; i < a->argc; i++) {
+    free(a->argv[i]);
+  }
+  free(a->argv);
+  a->argv = NULL;
+  a->argc = a->cap = 0;
+}
+
+static int args_add(struct config_args *a, const char *s)
+{
+  char **argv;
+
+  /* keep a NULL after the last argument like main()'s argv */
+  if (a->argc + 1 >= a->cap) {
+    a->cap = (a->cap == 0 ? 32 : a->cap * 2);
+    if ((argv = realloc(a->argv, a->cap * sizeof(*argv))) == NULL) {
+      fprintf(stderr, "args_add: realloc failed\n");
+      return -1;
+    }
+    a->argv = argv;
+  }
+
+  if ((a->argv[a->argc] = strdup(s)) == NULL) {
+    fprintf(stderr, "args_add: strdup failed\n");
+    return -1;
+  }
+  a->argv[++a->argc] = NULL;
+  return 0;
+}
+
+/**
+ * Check for --config, also abbreviated like getopt_long() accepts it.
+ * Returns the file name after '=', an empty string if it is the next
+ * argument, or NULL for other arguments.
+ */
+static const char *config_arg(const char *arg)
+{
+  const char *eq;
+  size_t len;
+
+  if (strncmp(arg, "--", 2) != 0) {
+    return NULL;
+  }
+  arg += 2;
+
+  eq = strchr(arg, '=');
+  len = (eq != NULL ? (size_t) (eq - arg) : strlen(arg));
+  if (len < 2 || len > strlen("config") || strncmp(arg, "config", len) != 0) {
+    return NULL;
+  }
+  return (eq != NULL ? eq + 1 : "");
+}
+
+/** Copy arguments, replacing --config=FILE by the settings in FILE */
+static int config_expand(struct config_args *a, int argc, char *argv[])
+{
+  const char *path;
+  int i, opts_done = 0;
+
+  for (i = 0; i < argc; i++) {
+    if (i == 0 || opts_done || (path = config_arg(argv[i])) == NULL) {
+      opts_done |= (i > 0 && !strcmp(argv[i], "--"));
+      if (args_add(a, argv[i]) != 0) {
+        return -1;
+      }
+      continue;
+    }
+
+    if (*path == 0 && strchr(argv[i], '=') == NULL) {
+      if (i + 1 == argc) {
+        fprintf(stderr, "--config requires a file name\n");
+        return -1;
+      }
+      path = argv[++i];
+    }
+    if (config_file(a, path) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static char *strip(char *s)
+{
+  char *end;
+
+  while (isspace((unsigned char) *s)) {
+    s++;
+  }
+  end = s + strlen(s);
+  while (end > s && isspace((unsigned char) end[-1])) {
+    *--end = 0;
+  }
+  return s;
+}
+
+/**
+ * Append the settings of an INI style file as --NAME=VALUE arguments. Keys
+ * are the long option names; inside a [SECTION] they are prefixed with
+ * SECTION-, so "weight" in [cc-dctcp] is --cc-dctcp-weight. Flags take
+ * true or false, keys may repeat (ip-route), # and ; start comment lines.
+ */
+static int config_file(struct config_args *a, const char *path)
+{
+  char line[1024], section[64] = "", name[160], *arg, *key, *val, *end;
+  const struct option *o;
+  unsigned lineno = 0;
+  size_t len;
+  FILE *f;
+  int ret = -1;
+
+  if ((f = fopen(path, "r")) == NULL) {
+    fprintf(stderr, "config file %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    lineno++;
+    if (strchr(line, '\n') == NULL && !feof(f)) {
+      fprintf(stderr, "%s:%u: line too long\n", path, lineno);
+      goto out;
+    }
+
+    key = strip(line);
+    if (*key == 0 || *key == '#' || *key == ';') {
+      continue;
+    }
+
+    if (*key == '[') {
+      end = key + strlen(key) - 1;
+      if (*end != ']') {
+        fprintf(stderr, "%s:%u: expected [SECTION]\n", path, lineno);
+        goto out;
+      }
+      *end = 0;
+      key = strip(key + 1);
+      if (strlen(key) >= sizeof(section)) {
+        fprintf(stderr, "%s:%u: section name too long\n", path, lineno);
+        goto out;
+      }
+      strcpy(section, key);
+      continue;
+    }
+
+    if ((val = strchr(key, '=')) == NULL) {
+      fprintf(stderr, "%s:%u: expected KEY = VALUE\n", path, lineno);
+      goto out;
+    }
+    *val++ = 0;
+    key = strip(key);
+    val = strip(val);
+    len = strlen(val);
+    if (len >= 2 && val[0] == '"' && val[len - 1] == '"') {
+      val[len - 1] = 0;
+      val++;
+    }
+
+    if (snprintf(name, sizeof(name), "%s%s%s", section,
+          (*section != 0 ? "-" : ""), key) >= (int) sizeof(name))
+    {
+      fprintf(stderr, "%s:%u: key too long\n", path, lineno);
+      goto out;
+    }
+    for (o = opts; o->name != NULL && strcmp(o->name, name) != 0; o++);
+    if (o->name == NULL || o->val == CP_CONFIG) {
+      fprintf(stderr, "%s:%u: unknown option %s\n", path, lineno, name);
+      goto out;
+    }
+
+    if (o->has_arg == no_argument) {
+      if (!strcmp(val, "false")) {
+        continue;
+      } else if (strcmp(val, "true") != 0) {
+        fprintf(stderr, "%s:%u: %s takes true or false\n", path, lineno,
+            name);
+        goto out;
+      }
+      len = strlen(name) + 3;
+    } else {
+      len = strlen(name) + strlen(val) + 4;
+    }
+
+    if ((arg = malloc(len)) == NULL) {
+      fprintf(stderr, "config_file: malloc failed\n");
+      goto out;
+    }
+    if (o->has_arg == no_argument) {
+      snprintf(arg, len, "--%s", name);
+    } else {
+      snprintf(arg, len, "--%s=%s", name, val);
+    }
+    ret = args_add(a, arg);
+    free(arg);
+    if (ret != 0) {
+      goto out;
+    }
+    ret = -1;
+  }
+  if (ferror(f)) {
+    fprintf(stderr, "config file %s: read failed\n", path);
+    goto out;
+  }
+  ret = 0;
+
+out:
+  fclose(f);
+  return ret;
+}
+
+/******************************************************************************/
+/* Reloads */
+
+/** Field of struct configuration with its option name */
+struct config_field {
+  const char *name;
+  size_t off;
+  size_t len;
+};
+
+#define CONFIG_FIELD(f, n) \
+  { n, offsetof(struct configuration, f), \
+    sizeof(((struct configuration *) NULL)->f) }
+
+/**
+ * Applied to a running slowpath. Everything here is read afresh by the
+ * slowpath whenever it is used, initial values apply to new connections.
+ */
+static const struct config_field fields_reload[] = {
+  CONFIG_FIELD(app_grace, "app-grace-period"),
+  CONFIG_FIELD(arp_to, "arp-timeout"),
+  CONFIG_FIELD(arp_to_max, "arp-timeout-max"),
+  CONFIG_FIELD(tcp_rtt_init, "tcp-rtt-init"),
+  CONFIG_FIELD(tcp_link_bw, "tcp-link-bw"),
+  CONFIG_FIELD(tcp_handshake_to, "tcp-handshake-timeout"),
+  CONFIG_FIELD(tcp_handshake_retries, "tcp-handshake-retries"),
+  CONFIG_FIELD(tcp_idle_to, "tcp-idle-timeout"),
+  CONFIG_FIELD(cc_control_granularity, "cc-control-granularity"),
+  CONFIG_FIELD(cc_control_interval, "cc-control-interval"),
+  CONFIG_FIELD(cc_rexmit_ints, "cc-rexmit-ints"),
+  CONFIG_FIELD(cc_tlp_ints, "cc-tlp-ints"),
+  CONFIG_FIELD(cc_dctcp_weight, "cc-dctcp-weight"),
+  CONFIG_FIELD(cc_dctcp_init, "cc-dctcp-init"),
+  CONFIG_FIELD(cc_dctcp_step, "cc-dctcp-step"),
+  CONFIG_FIELD(cc_dctcp_mimd, "cc-dctcp-mimd"),
+  CONFIG_FIELD(cc_dctcp_min, "cc-dctcp-min"),
+  CONFIG_FIELD(cc_dctcp_minpkts, "cc-dctcp-minpkts"),
+  CONFIG_FIELD(cc_const_rate, "cc-const-rate"),
+  CONFIG_FIELD(cc_timely_tlow, "cc-timely-tlow"),
+  CONFIG_FIELD(cc_timely_thigh, "cc-timely-thigh"),
+  CONFIG_FIELD(cc_timely_step, "cc-timely-step"),
+  CONFIG_FIELD(cc_timely_init, "cc-timely-init"),
+  CONFIG_FIELD(cc_timely_alpha, "cc-timely-alpha"),
+  CONFIG_FIELD(cc_timely_beta, "cc-timely-beta"),
+  CONFIG_FIELD(cc_timely_min_rtt, "cc-timely-minrtt"),
+  CONFIG_FIELD(cc_timely_min_rate, "cc-timely-minrate"),
+};
+
+/** Sized or written to the NIC at startup, only a restart changes these */
+static const struct config_field fields_restart[] = {
+  CONFIG_FIELD(shm_len, "shm-len"),
+  CONFIG_FIELD(shm_populate, "shm-populate"),
+  CONFIG_FIELD(shm_pages, "shm-pages"),
+  CONFIG_FIELD(shm_threads, "shm-threads"),
+  CONFIG_FIELD(nic_rx_len, "nic-rx-len"),
+  CONFIG_FIELD(nic_tx_len, "nic-tx-len"),
+  CONFIG_FIELD(app_spin_len, "app-spin-len"),
+  CONFIG_FIELD(app_spout_len, "app-spout-len"),
+  CONFIG_FIELD(numa_nodes, "numa-nodes"),
+  CONFIG_FIELD(numa_emulate, "numa-emulate"),
+  CONFIG_FIELD(nic_node, "nic-node"),
+  CONFIG_FIELD(tcp_rxbuf_len, "tcp-rxbuf-len"),
+  CONFIG_FIELD(tcp_txbuf_len, "tcp-txbuf-len"),
+  CONFIG_FIELD(tcp_delack_segs, "tcp-delack-segs"),
+  CONFIG_FIELD(tcp_delack_to, "tcp-delack-timeout"),
+  CONFIG_FIELD(tcp_rxwnd_min, "tcp-rxwnd-min"),
+  CONFIG_FIELD(tcp_rxwnd_budget, "tcp-rxwnd-budget"),
+  CONFIG_FIELD(qm_ctx_weight, "qm-ctx-weight"),
+  CONFIG_FIELD(ip, "ip-addr"),
+  CONFIG_FIELD(ip_prefix, "ip-addr"),
+  CONFIG_FIELD(cc_algorithm, "cc"),
+  CONFIG_FIELD(cc_trace_sample, "cc-trace-sample"),
+  CONFIG_FIELD(cc_trace_len, "cc-trace-len"),
+  CONFIG_FIELD(fp_poll_interval_app, "fp-poll-interval-app"),
+  CONFIG_FIELD(stats_interval, "stats-interval"),
+  CONFIG_FIELD(pcap_path, "pcap"),
+  CONFIG_FIELD(pcap_filter, "pcap-filter"),
+  CONFIG_FIELD(pcap_snaplen, "pcap-snaplen"),
+  CONFIG_FIELD(pcap_max_size, "pcap-max-size"),
+  CONFIG_FIELD(pcap_files, "pcap-files"),
+  CONFIG_FIELD(pcap_ring_len, "pcap-ring-len"),
+  CONFIG_FIELD(pcap_paused, "pcap-paused"),
+  CONFIG_FIELD(checkpoint_path, "checkpoint"),
+  CONFIG_FIELD(restore, "restore"),
+  CONFIG_FIELD(console, "debug-console"),
+};
+
+static inline int field_differs(const struct config_field *f,
+    const struct configuration *a, const struct configuration *b)
+{
+  return memcmp((const uint8_t *) a + f->off, (const uint8_t *) b + f->off,
+      f->len) != 0;
+}
+
+static int routes_differ(const struct config_route *a,
+    const struct config_route *b)
+{
+  for (; a != NULL && b != NULL; a = a->next, b = b->next) {
+    if (a->ip != b->ip || a->ip_prefix != b->ip_prefix ||
+        a->next_hop_ip != b->next_hop_ip)
+    {
+      return 1;
+    }
+  }
+  return a != b;
+}
+
+unsigned config_reload_check(const struct configuration *cur,
+    const struct configuration *next)
+{
+  unsigned i, n = 0;
+
+  for (i = 0; i < sizeof(fields_restart) / sizeof(fields_restart[0]); i++) {
+    if (field_differs(&fields_restart[i], cur, next)) {
+      fprintf(stderr, "config reload: %s changed, ignored until restart\n",
+          fields_restart[i].name);
+    }
+  }
+
+  for (i = 0; i < sizeof(fields_reload) / sizeof(fields_reload[0]); i++) {
+    if (field_differs(&fields_reload[i], cur, next)) {
+      fprintf(stderr, "config reload: %s changed\n", fields_reload[i].name);
+      n++;
+    }
+  }
+  if (routes_differ(cur->routes, next->routes)) {
+    fprintf(stderr, "config reload: ip-route changed\n");
+    n++;
+  }
+
+  return n;
+}
+
+int config_reload_apply(struct configuration *cur, struct configuration *next)
+{
+  const struct config_field *f;
+  unsigned i;
+
+  for (i = 0; i < sizeof(fields_reload) / sizeof(fields_reload[0]); i++) {
+    f = &fields_reload[i];
+    memcpy((uint8_t *) cur + f->off, (const uint8_t *) next + f->off, f->len);
+  }
+
+  return routes_differ(cur->routes, next->routes);
+}
+
+void config_reload_routes(struct configuration *cur,
+    struct configuration *next)
+{
+  struct config_route *routes;
+
+  /* next gets the old routes, freed with it */
+  routes = cur->routes;
+  cur->routes = next->routes;
+  next->routes = routes;
+}
+
+void config_free(struct configuration *c)
+{
+  struct config_route *r;
+
+  while ((r = c->routes) != NULL) {
+    c->routes = r->next;
+    free(r);
+  }
+}
@@ -21,10 +21,44 @@ enum config_cc_algorithm {
   CONFIG_CC_CONST_RATE,
 };
 
+/** How the shared memory region is faulted in at startup. */
+enum config_shm_populate {
+  /** Whole region by the kernel on one thread (MAP_POPULATE) */
+  CONFIG_SHM_POPULATE_SERIAL,
+  /** Whole region, pages spread over threads */
+  CONFIG_SHM_POPULATE_PARALLEL,
+  /** First zone only, the others when packet memory first uses them */
+  CONFIG_SHM_POPULATE_LAZY,
+};
+
+/** Hugepage sizes the shared memory region may use. */
+enum config_shm_pages {
+  /** 1 GB pages only */
+  CONFIG_SHM_PAGES_1G,
+  /** 2 MB pages only */
+  CONFIG_SHM_PAGES_2M,
+  /** 1 GB pages, 2 MB pages if there are not enough of those */
+  CONFIG_SHM_PAGES_AUTO,
+};
+
+/** Maximum number of NUMA nodes packet memory is spread over */
+#define CONFIG_NUMA_NODES_MAX 8
+/** Look up the NUMA node of the NIC in sysfs */
+#define CONFIG_NODE_DETECT UINT32_MAX
+
+/** Maximum length of a capture filter expression */
+#define CONFIG_PCAP_FILTER_MAX 256
+
 /** Struct containing the parsed configuration parameters */
 struct configuration {
   /* shared memory size */
   uint64_t shm_len;
+  /** How the shared memory is populated, see enum config_shm_populate */
+  uint8_t shm_populate;
+  /** Hugepage sizes for the shared memory, see enum config_shm_pages */
+  uint8_t shm_pages;
+  /** Threads populating shared memory, 0 for one per online cpu */
+  uint32_t shm_threads;
   /** SP nic receive queue length. */
   uint64_t nic_rx_len;
   /** SP nic transmit queue length. */
@@ -33,6 +67,14 @@ struct configuration {
   uint64_t app_spin_len;
   /** App context <- sp queue length. */
   uint64_t app_spout_len;
+  /** Time the state of an exited application with a session is kept [ms] */
+  uint32_t app_grace;
+  /** NUMA nodes the shared memory hugepages are spread over */
+  uint32_t numa_nodes;
+  /** Assign hugepages to nodes round robin instead of placing them */
+  int numa_emulate;
+  /** NUMA node of the NIC, or CONFIG_NODE_DETECT */
+  uint32_t nic_node;
   /** TCP receive buffer size. */
   uint64_t tcp_rxbuf_len;
   /** TCP transmit buffer size. */
@@ -45,6 +87,22 @@ struct configuration {
   uint32_t tcp_handshake_to;
   /** # of retries for dropped handshake packets */
   uint32_t tcp_handshake_retries;
+  /** Delayed ACKs: ACK every n-th in-order segment, 1 disables */
+  uint32_t tcp_delack_segs;
+  /** Delayed ACKs: timeout [us] */
+  uint32_t tcp_delack_to;
+  /**
+   * Receive window autotuning: initial and minimum window, 0 disables.
+   * Windows grow up to tcp_rxbuf_len with window scaling, up to
+   * MIN(tcp_rxbuf_len, 64KB) without.
+   */
+  uint32_t tcp_rxwnd_min;
+  /** Receive window autotuning: limit for the sum of all windows, 0: none */
+  uint64_t tcp_rxwnd_budget;
+  /** Reset connections without activity for this long [s], 0 disables */
+  uint32_t tcp_idle_to;
+  /** Queue manager: default DRR weight of app contexts [segments] */
+  uint32_t qm_ctx_weight;
   /** IP address for this host */
   uint32_t ip;
   /** IP prefix length for this host */
@@ -63,6 +121,8 @@ struct configuration {
   uint32_t cc_control_interval;
   /** CC: number of intervals without ACKs before retransmit */
   uint32_t cc_rexmit_ints;
+  /** CC: number of intervals without ACKs before a tail loss probe, 0 off */
+  uint32_t cc_tlp_ints;
   /** CC dctcp: EWMA weight for new ECN */
   uint32_t cc_dctcp_weight;
   /** CC dctcp: initial rate [kbps] */
@@ -93,8 +153,32 @@ struct configuration {
   uint32_t cc_timely_min_rtt;
   /** CC timely: minimal rate to use */
   uint32_t cc_timely_min_rate;
+  /** CC trace: trace every n-th flow id, 0 disables */
+  uint32_t cc_trace_sample;
+  /** CC trace: records in the trace ring (power of 2) */
+  uint32_t cc_trace_len;
   /** FP: polling interval for app */
   uint32_t fp_poll_interval_app;
+  /** Telemetry: shm region update interval [us], 0 disables */
+  uint32_t stats_interval;
+  /** Capture: pcapng file for slowpath packets, empty disables */
+  char pcap_path[PATH_MAX];
+  /** Capture: filter expression, empty matches everything */
+  char pcap_filter[CONFIG_PCAP_FILTER_MAX];
+  /** Capture: bytes stored per packet */
+  uint32_t pcap_snaplen;
+  /** Capture: size limit per file [bytes], 0 is unlimited */
+  uint64_t pcap_max_size;
+  /** Capture: number of files to rotate over when the limit is hit */
+  uint32_t pcap_files;
+  /** Capture: packets buffered for the writer thread (power of 2) */
+  uint32_t pcap_ring_len;
+  /** Capture: start paused, enable at runtime */
+  int pcap_paused;
+  /** Restart: checkpoint written at exit, empty disables */
+  char checkpoint_path[PATH_MAX];
+  /** Restart: resume from the checkpoint instead of resetting the NIC */
+  int restore;
   /** Minimize output */
   int quiet;
   /** Debug console */
@@ -126,4 +210,49 @@ struct config_route {
  */
 int config_parse(struct configuration *c, int argc, char *argv[]);
 
+/**
+ * Parse the command line given to config_parse() again, re-reading
+ * configuration files, without printing the usage on errors.
+ *
+ * @param c Zeroed config struct to store parameters in.
+ *
+ * @return 0 on success, != 0 else.
+ */
+int config_reload(struct configuration *c);
+
+/**
+ * Report the differences between the running and a reloaded configuration.
+ *
+ * @param cur  Running configuration.
+ * @param next Reloaded configuration.
+ *
+ * @return Number of changed settings config_reload_apply() will apply.
+ */
+unsigned config_reload_check(const struct configuration *cur,
+    const struct configuration *next);
+
+/**
+ * Copy the settings that can change at runtime into the running
+ * configuration. Routes are left alone, see config_reload_routes().
+ *
+ * @param cur  Running configuration.
+ * @param next Reloaded configuration.
+ *
+ * @return 1 if the routes changed, 0 else.
+ */
+int config_reload_apply(struct configuration *cur, struct configuration *next);
+
+/**
+ * Swap the reloaded routes into the running configuration, once the routing
+ * table was rebuilt from them. next holds the old ones afterwards.
+ *
+ * @param cur  Running configuration.
+ * @param next Reloaded configuration.
+ */
+void config_reload_routes(struct configuration *cur,
+    struct configuration *next);
+
+/** Free the memory a parsed configuration holds, not the struct itself */
+void config_free(struct configuration *c);
+
 #endif /* _CONFIG_H_ */
@@ -13,8 +13,13 @@
 #include "connect.h"
 #include "flextoe.h"
 #include "fp_debug.h"
+#include "tcp_ooo.h"
+#include "tcp_sack.h"
+#include "tcp_rxwnd.h"
+#include "tcp_wscale.h"
 #include "config.h"
 #include "driver.h"
+#include "internal.h"
 
 struct configuration config;
 extern int debug_reset;
@@ -28,6 +33,16 @@ static void handle_signal(int signo)
     exited = 1;
     break;
 
+  case SIGUSR1:
+    /* toggle packet capture */
+    capture_enable(!capture_on);
+    break;
+
+  case SIGHUP:
+    /* re-read configuration */
+    reload_request();
+    break;
+
   // TODO: Handle other signals?
   default:
     // do nothing
@@ -194,7 +209,9 @@ static void* console_main(void* arg)
 #define MAX_CONSOLE_INPUT  128
   char line[MAX_CONSOLE_INPUT];
   char command[MAX_CONSOLE_INPUT];
-  uint32_t flow_id;
+  uint32_t flow_id, ooo, args[2];
+  unsigned i;
+  int n;
 
   /* Wait for SP to get things up and running! */
   while ((flextoe_info->flags & FLEXNIC_FLAG_READY) != FLEXNIC_FLAG_READY) {
@@ -210,7 +227,13 @@ static void* console_main(void* arg)
     if (fgets(line, MAX_CONSOLE_INPUT, stdin)) {
       fprintf(stdout, "\n");
 
-      if (sscanf(line, "%s %u", command, &flow_id) != 2)
+      n = sscanf(line, "%s %u %u %u", command, &flow_id, &args[0], &args[1]);
+      if (n == 1 && strcmp(command, "reload") == 0) {
+        /* reload: re-read configuration like SIGHUP */
+        reload_request();
+        continue;
+      }
+      if (n < 2)
         continue;
 
       if (strncmp(command, "dclr", 4) == 0) {
@@ -229,8 +252,16 @@ static void* console_main(void* arg)
         fprintf(stdout, "TX    nseq   %u\n", nn_readl(&fp_state->flows_tcp_state[flow_id].tx_next_seq));
         fprintf(stdout, "TX    npos   %u\n", nn_readl(&fp_state->flows_tcp_state[flow_id].tx_next_pos));
         fprintf(stdout, "TX    flags  %hx\n", nn_readw(&fp_state->flows_tcp_state[flow_id].flags));
-        fprintf(stdout, "TX    dack   %u\n", nn_readw(&fp_state->flows_tcp_state[flow_id].dupack_cnt));
+        fprintf(stdout, "TX    rack   %u\n", nn_readw(&fp_state->flows_tcp_state[flow_id].rack_ts));
         fprintf(stdout, "TX    nts    %u\n", nn_readl(&fp_state->flows_tcp_state[flow_id].tx_next_ts));
+        ooo = nn_readl(&fp_state->flows_tcp_state[flow_id].tx_sack);
+        if (ooo == TCP_SACK_HOLES) {
+          fprintf(stdout, "TX    sack   holes\n");
+        } else {
+          fprintf(stdout, "TX    sack   +%u len %u\n", TCP_OOO_OFF(ooo), TCP_OOO_LEN(ooo));
+        }
+        ooo = nn_readl(&fp_state->flows_tcp_state[flow_id].tx_rtx);
+        fprintf(stdout, "TX    rtx    rec %u nxt %u\n", TCP_SACK_REC(ooo), TCP_SACK_NXT(ooo));
         fprintf(stdout, "-------------------------------------------------------------------\n");
         fprintf(stdout, "CC    rtt    %u\n", nn_readl(&fp_state->flows_cc_info[flow_id].rtt_est));
         fprintf(stdout, "CC    rxack  %x\n", nn_readl(&fp_state->flows_cc_info[flow_id].cnt_rx_ack_bytes));
@@ -241,10 +272,43 @@ static void* console_main(void* arg)
         fprintf(stdout, "RX    avail  %u\n", nn_readl(&fp_state->flows_tcp_state[flow_id].rx_avail));
         fprintf(stdout, "RX    nseq   %u\n", nn_readl(&fp_state->flows_tcp_state[flow_id].rx_next_seq));
         fprintf(stdout, "RX    npos   %u\n", nn_readl(&fp_state->flows_tcp_state[flow_id].rx_next_pos));
-        fprintf(stdout, "RX    opos   %u\n", nn_readl(&fp_state->flows_tcp_state[flow_id].rx_ooo_start));
-        fprintf(stdout, "RX    olen   %u\n", nn_readl(&fp_state->flows_tcp_state[flow_id].rx_ooo_len));
+        for (i = 0; i < FLEXNIC_PL_OOO_NUM; i++) {
+          ooo = nn_readl(&fp_state->flows_tcp_state[flow_id].rx_ooo[i]);
+          fprintf(stdout, "RX    ooo%u   +%u len %u\n", i, TCP_OOO_OFF(ooo), TCP_OOO_LEN(ooo));
+        }
+        ooo = nn_readl(&fp_state->flows_tcp_state[flow_id].wnd);
+        fprintf(stdout, "RX    wnd    ws %u/%u debt %u\n", TCP_WSCALE_RCV(ooo),
+            TCP_WSCALE_SND(ooo), TCP_RXWND_DEBT(ooo));
         fprintf(stdout, "-------------------------------------------------------------------\n");
       }
+      else if (strncmp(command, "qw", 2) == 0) {
+        /* qw DB WEIGHT: DRR weight of an app context */
+        if (n < 3 || nicif_appctx_weight(flow_id, args[0]) != 0)
+          continue;
+
+        fprintf(stdout, "ctx %u weight %u\n", flow_id, args[0]);
+      }
+      else if (strncmp(command, "qlim", 4) == 0) {
+        /* qlim DB KBPS [BURST]: aggregate rate limit of an app context */
+        if (n < 3)
+          continue;
+        if (n < 4)
+          args[1] = 0;
+        if (nicif_appctx_ratelimit(flow_id, args[0], args[1]) != 0)
+          continue;
+
+        fprintf(stdout, "ctx %u rate %u kbps burst %u\n", flow_id, args[0],
+            nn_readl(&fp_state->appctx[flow_id].qm_burst));
+      }
+      else if (strncmp(command, "pcap", 4) == 0) {
+        /* pcap 0|1: pause or resume packet capture */
+        if (capture_enable(flow_id) != 0) {
+          fprintf(stdout, "capture not configured (--pcap)\n");
+          continue;
+        }
+
+        fprintf(stdout, "capture %s\n", flow_id ? "on" : "off");
+      }
       else if (strncmp(command, "jrnl", 4) == 0) {
         char tmp_path[32] = "flextoe-journal-XXXXXX";
         int tmp_fd = mkstemp(tmp_path);
@@ -316,6 +380,8 @@ int main(int argc, char* argv[])
     .sa_handler = handle_signal,
   };
   sigaction(SIGINT, &act, NULL);
+  sigaction(SIGUSR1, &act, NULL);
+  sigaction(SIGHUP, &act, NULL);
 
   slowpath_main();
 
@@ -23,13 +23,20 @@ extern unsigned int *fp_journal;
 extern struct nfp_handle_t nic_handle;
 extern struct eth_addr eth_addr;
 
+int slowpath_init(void);
 int slowpath_main(void);
 
 int shm_init(void);
+int shm_init_anon(void);
 void shm_cleanup(void);
+void shm_retain(void);
+int shm_numa_node(const void *addr);
+int shm_populate(uint32_t first, uint32_t n);
 void shm_set_ready(void);
+void shm_startup_times(uint32_t *shm_us, uint32_t *ready_us);
 
 int nic_init(void);
+int nic_numa_node(void);
 uint64_t nic_us_to_cyc(uint64_t us);
 void nic_cleanup(void);
 
@@ -5,20 +5,31 @@
 #define INTERNAL_H_
 
 #include <stdint.h>
+#include <stdio.h>
 
 #include "util/nbqueue.h"
 #include "util/timeout.h"
+#include "sp_stats.h"
 
+struct app_context;
 struct config_route;
 struct connection;
 struct listener;
 struct timeout;
+struct sp_ckpt_arp;
+struct sp_ckpt_conn;
+struct sp_ckpt_ctx;
+struct sp_ckpt_hdr;
+struct sp_ckpt_listener;
+struct sp_ckpt_mem;
+struct sp_ckpt_tw;
 enum timeout_type;
 
 extern struct timeout_manager timeout_mgr;
 extern struct sp_statistics spstats;
 extern uint32_t cur_ts;
 extern int sp_notifyfd;
+extern int capture_on;
 
 struct nicif_completion {
   struct nbqueue_el el;
@@ -33,10 +44,26 @@ struct sp_statistics {
   uint64_t drops;
   /** sp re-transmission timeouts */
   uint64_t sp_rexmit;
+  /** sp tail loss probes */
+  uint64_t sp_tlp;
+  /** keepalive probes sent */
+  uint64_t ka_probes;
+  /** connections reset by keepalive or idle timeout */
+  uint64_t ka_resets;
   /** # of ECN marked ACKs */
   uint64_t ecn_marked;
   /** total number of ACKs */
   uint64_t acks;
+  /** connections established */
+  uint64_t conn_opened;
+  /** connections closed */
+  uint64_t conn_closed;
+  /** connection attempts failed */
+  uint64_t conn_failed;
+  /** packets received from NIC, per flow group */
+  uint64_t rx_packets[SP_STATS_FLOWGRPS];
+  /** packets that could not be processed */
+  uint64_t rx_unhandled;
 };
 
 /** Type of timeout */
@@ -45,6 +72,10 @@ enum timeout_type {
   TO_ARP_REQ,
   /** Gratuitous ARP request */
   TO_ARP_GRAT,
+  /** ARP re-validation of a stale entry */
+  TO_ARP_PROBE,
+  /** ARP cache eviction of idle entries */
+  TO_ARP_GC,
   /** TCP handshake sent */
   TO_TCP_HANDSHAKE,
   /** TCP retransmission timeout */
@@ -83,7 +114,31 @@ int nicif_appctx_add(uint16_t appid, uint32_t db, uint64_t rxq_base,
     uint32_t rxq_len, uint64_t txq_base, uint32_t txq_len, int evfd);
 
 /**
- * Clear application context (must be called from poll thread).
+ * Set the queue manager DRR weight of an application context.
+ *
+ * @param db      Doorbell ID
+ * @param weight  Weight in segments per round (1-QM_CTX_WEIGHT_MAX)
+ *
+ * @return 0 on success, <0 else
+ */
+int nicif_appctx_weight(uint32_t db, uint32_t weight);
+
+/**
+ * Set the aggregate rate limit of an application context, applied by the
+ * queue manager to all its flows.
+ *
+ * @param db     Doorbell ID
+ * @param rate   Rate limit [Kbps], 0 removes the limit
+ * @param burst  Burst size [bytes], raised to what the rate needs (0: minimal)
+ *
+ * @return 0 on success, <0 else
+ */
+int nicif_appctx_ratelimit(uint32_t db, uint32_t rate, uint32_t burst);
+
+/**
+ * Clear application context (must be called from poll thread). The fastpath
+ * may still read the queues until nicif_appctx_idle() returns 1, the queue
+ * memory and the doorbell must not be freed or reused before.
  *
  * @param appid     Application ID
  * @param db        Doorbell ID
@@ -92,10 +147,24 @@ int nicif_appctx_add(uint16_t appid, uint32_t db, uint64_t rxq_base,
  */
 int nicif_appctx_clear(uint16_t appid, uint32_t db);
 
+/**
+ * Check whether the fastpath acknowledged the last add or clear of an
+ * application context.
+ *
+ * @param db        Doorbell ID
+ *
+ * @return 1 if acknowledged, 0 if not yet
+ */
+int nicif_appctx_idle(uint32_t db);
+
 /** Flags for connections (used in nicif_connection_add()) */
 enum nicif_connection_flags {
   /** Enable ECN for connection. */
   NICIF_CONN_ECN        = (1 <<  2),
+  /** SACK permitted by peer: fast path generates SACK blocks. */
+  NICIF_CONN_SACK       = (1 <<  3),
+  /** Window scaling negotiated (see tcp_wscale.h). */
+  NICIF_CONN_WSCALE     = (1 <<  4),
 };
 
 /**
@@ -109,12 +178,14 @@ enum nicif_connection_flags {
  * @param port_remote Remote port number
  * @param rx_base     Base address of circular receive buffer
  * @param rx_len      Length of circular receive buffer
+ * @param rx_wnd      Receive window to start with (<= rx_len)
  * @param tx_base     Base address of circular transmit buffer
  * @param tx_len      Length of circular transmit buffer
  * @param remote_seq  Next sequence number expected from remote host
  * @param local_seq   Next sequence number for transmission
  * @param app_opaque  Opaque value to pass in notificaitions
  * @param flags       See #nicif_connection_flags.
+ * @param wscale      Window scale shifts, TCP_WSCALE() (0 if not negotiated)
  * @param rate        Congestion rate to set [Kbps]
  * @param flow_group  Flow group
  * @param pf_id       Pointer to location where flow id should be stored
@@ -123,9 +194,10 @@ enum nicif_connection_flags {
  */
 int nicif_connection_add(uint32_t db, uint64_t mac_remote, uint32_t ip_local,
     uint16_t port_local, uint32_t ip_remote, uint16_t port_remote,
-    uint64_t rx_base, uint32_t rx_len, uint64_t tx_base, uint32_t tx_len,
-    uint32_t remote_seq, uint32_t local_seq, uint64_t app_opaque,
-    uint32_t flags, uint32_t rate, uint16_t flow_group, uint32_t *pf_id);
+    uint64_t rx_base, uint32_t rx_len, uint32_t rx_wnd, uint64_t tx_base,
+    uint32_t tx_len, uint32_t remote_seq, uint32_t local_seq,
+    uint64_t app_opaque, uint32_t flags, uint32_t wscale, uint32_t rate,
+    uint16_t flow_group, uint32_t *pf_id);
 
 /**
  * Disable connection fast path (mark as sp'd and remove from hash table).
@@ -148,6 +220,21 @@ int nicif_connection_disable(uint32_t f_id, uint32_t *tx_seq, uint32_t *rx_seq,
  */
 void nicif_connection_free(uint32_t f_id, uint32_t flow_grp);
 
+/**
+ * Remove flow from the fast path flow hash table, so the flow id can be reused
+ * for a different 4-tuple.
+ *
+ * @param f_id        Flow state ID
+ * @param ip_local    Local IP address
+ * @param port_local  Local port number
+ * @param ip_remote   Remote IP address
+ * @param port_remote Remote port number
+ *
+ * @return 0 on success, <0 else
+ */
+int nicif_connection_unregister(uint32_t f_id, uint32_t ip_local,
+    uint16_t port_local, uint32_t ip_remote, uint16_t port_remote);
+
 /**
  * Move flow to new db.
  *
@@ -158,6 +245,17 @@ void nicif_connection_free(uint32_t f_id, uint32_t flow_grp);
  */
 int nicif_connection_move(uint32_t dst_db, uint32_t f_id);
 
+/**
+ * Set the strict-priority class of a flow in the queue manager (see
+ * qm_sched.h).
+ *
+ * @param f_id  ID of flow
+ * @param cls   Class, 0 (default, lowest) to QM_PRIO_NUM - 1
+ *
+ * @return 0 on success, <0 else
+ */
+int nicif_connection_class(uint32_t f_id, uint32_t cls);
+
 /**
  * Connection statistics for congestion control
  * (see nicif_connection_stats()).
@@ -171,6 +269,8 @@ struct nicif_connection_stats {
   uint32_t c_ackb;
   /** Number of ACKd bytes with ECN marks */
   uint32_t c_ecnb;
+  /** In-order payload bytes received */
+  uint32_t c_rxb;
   /** Has pending data in transmit buffer */
   int txp;
   /** Current rtt estimate */
@@ -188,6 +288,36 @@ struct nicif_connection_stats {
 int nicif_connection_stats(uint32_t f_id,
     struct nicif_connection_stats *p_stats);
 
+/**
+ * Sequence state and activity of a connection
+ * (see nicif_connection_tcpstate()).
+ */
+struct nicif_connection_tcpstate {
+  /** Segments received, not truncated like nicif_connection_stats.c_acks */
+  uint32_t rx_segs;
+  /** Sequence number of next byte to be sent */
+  uint32_t tx_next_seq;
+  /** Unacknowledged bytes */
+  uint32_t tx_sent;
+  /** Next sequence number expected */
+  uint32_t rx_next_seq;
+  /** Timestamp to echo */
+  uint32_t ts_echo;
+};
+
+/**
+ * Read sequence state of a connection from NIC memory, for segments the
+ * slowpath sends on its behalf. The fastpath caches the state of active
+ * flows, so this may lag behind for them, but is current for idle ones.
+ *
+ * @param f_id  ID of flow
+ * @param st    Pointer to state struct.
+ *
+ * @return 0 on success, <0 else
+ */
+int nicif_connection_tcpstate(uint32_t f_id,
+    struct nicif_connection_tcpstate *st);
+
 /**
  * Set rate for flow.
  *
@@ -215,6 +345,29 @@ int nicif_debug_reset();
  */
 int nicif_connection_retransmit(uint32_t f_id, uint16_t core);
 
+/**
+ * Send a tail loss probe: retransmit one segment at the start of the
+ * unacknowledged data, without a rate cut.
+ *
+ * @param f_id ID of flow
+ * @param flow_group FlexNIC flow group
+ *
+ * @return 0 on success, <0 else
+ */
+int nicif_connection_probe(uint32_t f_id, uint16_t flow_group);
+
+/**
+ * Change the receive window of a flow. Growing takes effect right away,
+ * shrinking as the application frees buffer space (see tcp_rxwnd.h).
+ *
+ * @param f_id ID of flow
+ * @param flow_group FlexNIC flow group
+ * @param delta Change in TCP_RXWND_QUANTUM units
+ *
+ * @return 0 on success, <0 else
+ */
+int nicif_connection_rxwnd(uint32_t f_id, uint16_t flow_group, int32_t delta);
+
 /**
  * Allocate transmit buffer for raw packet.
  *
@@ -240,6 +393,27 @@ int nicif_tx_alloc(uint16_t len, void **buf, uint32_t *opaque);
  */
 void nicif_tx_send(uint32_t opaque, int no_ts, uint32_t ts_offset);
 
+/**
+ * Record the packet memory of the SP rings in a checkpoint header.
+ *
+ * @param hdr  Checkpoint header to fill in
+ */
+void nicif_checkpoint(struct sp_ckpt_hdr *hdr);
+
+/**
+ * Attach to the SP rings of the running NIC instead of resetting them, and
+ * mark the flow ids of restored connections allocated. Called instead of the
+ * ring setup in nicif_init() with --restore.
+ *
+ * @param hdr    Checkpoint header
+ * @param conns  Connection records
+ * @param n      Number of connection records
+ *
+ * @return 0 on success, <0 else
+ */
+int nicif_restore(const struct sp_ckpt_hdr *hdr,
+    const struct sp_ckpt_conn *conns, uint32_t n);
+
 /** @} */
 
 /*****************************************************************************/
@@ -248,16 +422,36 @@ void nicif_tx_send(uint32_t opaque, int no_ts, uint32_t ts_offset);
  * @brief Packet Memory Manager.
  * @ingroup tas-sp
  *
- * Manages memory region that can be used by FlexNIC for DMA.
+ * Manages memory region that can be used by FlexNIC for DMA. Every hugepage
+ * of the region is a zone with its own freelist, zones belong to the NUMA
+ * node their hugepage was placed on (see --numa-nodes). With
+ * --shm-populate=lazy a zone is faulted in when it is first allocated from.
  * @{ */
 
 struct packetmem_handle;
 
+/** Node argument of packetmem_alloc_node(): node of the NIC */
+#define PACKETMEM_NODE_NIC -1
+
+/** Packet memory of one NUMA node */
+struct packetmem_node_stats {
+  /** Bytes of packet memory on the node */
+  uint64_t size;
+  /** Bytes allocated */
+  uint64_t used;
+  /** Allocations placed on the node */
+  uint64_t allocs;
+  /** Allocations for the node that were placed elsewhere */
+  uint64_t spills;
+  /** Zones on the node */
+  uint32_t zones;
+};
+
 /** Initialize packet memory interface */
 int packetmem_init(void);
 
 /**
- * Allocate packet memory of specified length.
+ * Allocate packet memory of specified length on the NIC's node.
  *
  * @param length  Required number of bytes
  * @param off     Pointer to location where offset in DMA region should be
@@ -270,6 +464,33 @@ int packetmem_init(void);
 int packetmem_alloc(size_t length, uintptr_t *off,
     struct packetmem_handle **handle);
 
+/**
+ * Allocate packet memory of specified length, preferably on a NUMA node.
+ * Other nodes are used if the node is full.
+ *
+ * @param length  Required number of bytes
+ * @param node    Node, PACKETMEM_NODE_NIC or an invalid node for the NIC's
+ * @param off     Pointer to location where offset in DMA region should be
+ *                stored
+ * @param handle  Pointer to location where handle for memory region should be
+ *                stored
+ *
+ * @return 0 on success, <0 else
+ */
+int packetmem_alloc_node(size_t length, int node, uintptr_t *off,
+    struct packetmem_handle **handle);
+
+/** NUMA node buffers without a context go to */
+int packetmem_nic_node(void);
+
+/**
+ * Read the counters of a NUMA node.
+ *
+ * @param node  Node, below config.numa_nodes
+ * @param st    Counters to fill in
+ */
+void packetmem_node_stats(unsigned node, struct packetmem_node_stats *st);
+
 /**
  * Free packet memory region.
  *
@@ -279,6 +500,27 @@ int packetmem_alloc(size_t length, uintptr_t *off,
  */
 void packetmem_free(struct packetmem_handle *handle);
 
+/**
+ * Describe an allocated region for a checkpoint.
+ *
+ * @param handle  Handle for memory region
+ * @param mem     Checkpoint record to fill in
+ */
+void packetmem_checkpoint(const struct packetmem_handle *handle,
+    struct sp_ckpt_mem *mem);
+
+/**
+ * Allocate exactly the region described by a checkpoint record.
+ *
+ * @param mem     Checkpoint record
+ * @param handle  Pointer to location where handle for memory region should be
+ *                stored
+ *
+ * @return 0 on success, <0 if the region is not free
+ */
+int packetmem_reserve(const struct sp_ckpt_mem *mem,
+    struct packetmem_handle **handle);
+
 /** @} */
 
 /*****************************************************************************/
@@ -333,6 +575,98 @@ void appif_listen_newconn(struct listener *l, uint32_t remote_ip,
  */
 void appif_accept_conn(struct connection *c, int status);
 
+/**
+ * Callback from TCP module: a connection now references the context. The
+ * context (and its application) is not torn down while references remain.
+ *
+ * @param ctx     Application context
+ */
+void appif_ctx_conn_ref(struct app_context *ctx);
+
+/**
+ * Callback from TCP module: connection referencing the context was freed.
+ *
+ * @param ctx     Application context
+ */
+void appif_ctx_conn_unref(struct app_context *ctx);
+
+/**
+ * Fill telemetry entries for application contexts (poll thread).
+ *
+ * @param st      Array of entries to fill
+ * @param max     Number of entries in @p st
+ * @param n_apps  Pointer to location for number of attached applications
+ *
+ * @return Number of entries filled.
+ */
+unsigned appif_stats(struct sp_stats_ctx *st, unsigned max, unsigned *n_apps);
+
+/**
+ * Write a checkpoint record for every registered context.
+ *
+ * @param f  Checkpoint file
+ * @param n  Pointer to location for number of records written
+ *
+ * @return 0 on success, <0 else
+ */
+int appif_checkpoint(FILE *f, uint32_t *n);
+
+/**
+ * Recreate applications and contexts from checkpoint records, before
+ * appif_init(). Restored applications have no unix socket and restored
+ * contexts no eventfd, they keep working through their queues.
+ *
+ * @param ctxs  Context records
+ * @param n     Number of records
+ *
+ * @return 0 on success, <0 else
+ */
+int appif_restore(const struct sp_ckpt_ctx *ctxs, uint32_t n);
+
+/**
+ * Look up a registered context.
+ *
+ * @param app_id  Application id
+ * @param db_id   Doorbell of the context
+ *
+ * @return Context or NULL if not found.
+ */
+struct app_context *appif_ctx_lookup(uint16_t app_id, uint32_t db_id);
+
+/**
+ * Get the ids that identify a context in a checkpoint.
+ *
+ * @param ctx     Application context
+ * @param app_id  Pointer to location for the application id
+ * @param db_id   Pointer to location for the doorbell id
+ */
+void appif_ctx_ids(const struct app_context *ctx, uint16_t *app_id,
+    uint32_t *db_id);
+
+/**
+ * Get the NUMA node buffers of the context's connections are placed on.
+ *
+ * @param ctx     Application context
+ *
+ * @return Node id.
+ */
+int appif_ctx_node(const struct app_context *ctx);
+
+/**
+ * Callback from tcp_restore(): add restored listener to its application.
+ *
+ * @param l  Listener
+ */
+void appif_listen_restored(struct listener *l);
+
+/**
+ * Callback from tcp_restore(): add restored open or closing connection to its
+ * application.
+ *
+ * @param c  Connection
+ */
+void appif_conn_restored(struct connection *c);
+
 /** @} */
 
 /*****************************************************************************/
@@ -501,11 +835,19 @@ struct connection {
     uint32_t cc_last_ackb;
     /** Number of ACKd bytes with ECN marks */
     uint32_t cc_last_ecnb;
+    /** In-order bytes received */
+    uint32_t cc_last_rxb;
+    /** Receive window the fast path converges to (see tcp_rxwnd.h) */
+    uint32_t rx_wnd;
 
     /** Congestion rate limit. */
     uint32_t cc_rate;
     /** Had retransmits. */
     uint32_t cc_rexmits;
+    /** Drops, acked and ECN marked bytes since open (telemetry). */
+    uint64_t cc_total_drops;
+    uint64_t cc_total_ackb;
+    uint64_t cc_total_ecnb;
     /** Data for CC algorithm. */
     union {
       /** Window-based dctcp */
@@ -523,6 +865,33 @@ struct connection {
     struct connection *cc_next;
   /**@}*/
 
+  /**
+   * @name Keepalive and idle timeout (see keepalive.c)
+   * @{
+   */
+    /** Idle time before the first probe [s], 0 if disabled */
+    uint32_t ka_idle;
+    /** Interval between probes [s] */
+    uint32_t ka_intvl;
+    /** Unanswered probes before the connection is reset */
+    uint32_t ka_cnt;
+    /** Probes sent since the peer was last heard from */
+    uint32_t ka_probes;
+    /** Segments received at the last check */
+    uint32_t ka_last_segs;
+    /** Tick the peer was last heard from */
+    uint32_t ka_active;
+    /** Tick of the last check */
+    uint32_t ka_checked;
+    /** Tick of the next deadline */
+    uint32_t ka_expire;
+    /** 1 if on the timer wheel */
+    int ka_armed;
+    /** Linked list in timer wheel slot. */
+    struct connection *ka_next;
+    struct connection *ka_prev;
+  /**@}*/
+
   /** Linked list in hash table. */
   struct connection *ht_next;
   /** Asynchronous completion information. */
@@ -531,6 +900,8 @@ struct connection {
   uint32_t flow_id;
   /** Flags: see #nicif_connection_flags */
   uint32_t flags;
+  /** Window scale shifts, TCP_WSCALE() (see tcp_wscale.h) */
+  uint32_t wscale;
   /** Flow group (RSS bucket for steering). */
   uint16_t flow_group;
 };
@@ -549,6 +920,8 @@ struct listener {
     struct listener *app_next;
     /** Doorbell id. */
     uint32_t db_id;
+    /** Owner exited, waiting for its session to be reclaimed. */
+    int detached;
   /**@}*/
 
   /**
@@ -578,6 +951,53 @@ struct listener {
 /** Initialize TCP subsystem */
 int tcp_init(void);
 
+/**
+ * Write checkpoint records for all listeners, then for all connections.
+ * Connections waiting in accept refer to their listener by record index.
+ *
+ * @param f            Checkpoint file
+ * @param n_listeners  Pointer to location for number of listener records
+ * @param n_conns      Pointer to location for number of connection records
+ *
+ * @return 0 on success, <0 else
+ */
+int tcp_checkpoint(FILE *f, uint32_t *n_listeners, uint32_t *n_conns);
+
+/**
+ * Recreate listeners and connections from checkpoint records, after
+ * appif_restore(). Opens still in their handshake fail towards the
+ * application.
+ *
+ * @param ls           Listener records
+ * @param n_listeners  Number of listener records
+ * @param cs           Connection records
+ * @param n_conns      Number of connection records
+ * @param cc_reinit    Reset congestion control state (algorithm changed)
+ *
+ * @return 0 on success, <0 else
+ */
+int tcp_restore(const struct sp_ckpt_listener *ls, uint32_t n_listeners,
+    const struct sp_ckpt_conn *cs, uint32_t n_conns, int cc_reinit);
+
+/**
+ * Write a checkpoint record for every TIME_WAIT entry that has not expired.
+ *
+ * @param f  Checkpoint file
+ * @param n  Pointer to location for number of records written
+ *
+ * @return 0 on success, <0 else
+ */
+int tcp_tw_checkpoint(FILE *f, uint32_t *n);
+
+/**
+ * Re-enter TIME_WAIT entries from checkpoint records, each with the time it
+ * had left when the checkpoint was taken.
+ *
+ * @param tws  TIME_WAIT records
+ * @param n    Number of records
+ */
+void tcp_tw_restore(const struct sp_ckpt_tw *tws, uint32_t n);
+
 /** Poll for TCP events */
 void tcp_poll(void);
 
@@ -617,6 +1037,35 @@ int tcp_open(struct app_context *ctx, uint64_t opaque, uint32_t remote_ip,
 int tcp_listen(struct app_context *ctx, uint64_t opaque, uint16_t local_port,
     uint32_t backlog, int reuseport, struct listener **listen);
 
+/**
+ * Close a listener: removes it from the port table and releases the
+ * connections of pending accepts along with the backlog.
+ *
+ * @param listen  Listener, freed on success
+ *
+ * @return 0 on success, <0 else
+ */
+int tcp_listen_close(struct listener *listen);
+
+/**
+ * Keep a listener of an exited application: releases the connections of its
+ * pending accepts, the port stays bound and SYNs keep going to the backlog.
+ *
+ * @param listen  Listener
+ */
+void tcp_listen_detach(struct listener *listen);
+
+/**
+ * Hand a detached listener to the restarted application and announce the
+ * SYNs queued in the meantime through appif_listen_newconn().
+ *
+ * @param listen  Detached listener
+ * @param ctx     Application context
+ * @param opaque  Opaque value passed from application
+ */
+void tcp_listen_reattach(struct listener *listen, struct app_context *ctx,
+    uint64_t opaque);
+
 /**
  * Prepare to receive a connection on a listener.
  *
@@ -648,6 +1097,38 @@ int tcp_packet(const void *pkt, uint16_t len, uint16_t flow_group);
  */
 int tcp_close(struct connection *conn);
 
+/**
+ * Send a keepalive probe: an ACK with sequence number snd_una - 1, which the
+ * peer answers with an ACK if the connection is still alive.
+ *
+ * @param conn  Connection
+ * @param st    Sequence state read from the NIC
+ *
+ * @return 0 on success, <0 else
+ */
+int tcp_keepalive_probe(struct connection *conn,
+    const struct nicif_connection_tcpstate *st);
+
+/**
+ * Close an open connection and send a reset to the peer, for peers that
+ * stopped responding or connections that stayed idle too long.
+ *
+ * @param conn  Connection
+ * @param st    Sequence state read from the NIC
+ *
+ * @return 0 on success, <0 else
+ */
+int tcp_abort(struct connection *conn,
+    const struct nicif_connection_tcpstate *st);
+
+/**
+ * Look up connection by 4-tuple.
+ *
+ * @return Connection or NULL if not found.
+ */
+struct connection *tcp_conn_lookup(uint32_t local_ip, uint16_t local_port,
+    uint32_t remote_ip, uint16_t remote_port);
+
 /**
  * Destroy already closed/failed connection.
  *
@@ -696,6 +1177,80 @@ void cc_conn_init(struct connection *conn);
  */
 void cc_conn_remove(struct connection *conn);
 
+/**
+ * Add congestion state of a restored flow, keeping the checkpointed state.
+ *
+ * @param conn   Connection to add.
+ * @param reinit Reset the algorithm state (configured algorithm changed).
+ */
+void cc_conn_restore(struct connection *conn, int reinit);
+
+/**
+ * First connection with congestion state, the list continues via cc_next.
+ */
+struct connection *cc_conn_first(void);
+
+/** @} */
+
+/*****************************************************************************/
+/**
+ * @addtogroup tas-sp-keepalive
+ * @brief Keepalive and Idle Timeout
+ * @ingroup tas-sp
+ * @{ */
+
+/** Initialize keepalive timer wheel */
+int keepalive_init(void);
+
+/**
+ * Run expired keepalive deadlines
+ *
+ * @param cur_ts Current timestamp in micro seconds.
+ *
+ * @return Number of connections checked.
+ */
+unsigned keepalive_poll(uint32_t cur_ts);
+
+/**
+ * Initialize keepalive state of a newly opened connection, and arm the idle
+ * timeout if configured.
+ *
+ * @param conn Connection to initialize.
+ */
+void keepalive_conn_init(struct connection *conn);
+
+/**
+ * Configure keepalive for a connection.
+ *
+ * @param conn  Connection
+ * @param idle  Idle time before the first probe [s], 0 disables keepalive
+ * @param intvl Interval between probes [s]
+ * @param cnt   Unanswered probes before the connection is reset
+ *
+ * @return 0 on success, <0 else
+ */
+int keepalive_conn_set(struct connection *conn, uint32_t idle, uint32_t intvl,
+    uint32_t cnt);
+
+/**
+ * Re-arm all open connections after config.tcp_idle_to changed.
+ */
+void keepalive_reconfig(void);
+
+/**
+ * Record that the peer was heard from during the current tick.
+ *
+ * @param conn Connection
+ */
+void keepalive_conn_active(struct connection *conn);
+
+/**
+ * Remove keepalive state for connection
+ *
+ * @param conn Connection to remove.
+ */
+void keepalive_conn_remove(struct connection *conn);
+
 /** @} */
 
 /*****************************************************************************/
@@ -733,7 +1288,7 @@ int arp_request(struct nicif_completion *comp, uint32_t ip, uint64_t *mac);
 void arp_packet(const void *pkt, uint16_t len);
 
 /**
- * ARP timeout triggered.
+ * ARP request or re-validation probe timeout triggered.
  *
  * @param to    Timeout that triggered
  * @param type  Timeout type
@@ -747,6 +1302,36 @@ void arp_timeout(struct timeout *to, enum timeout_type type);
  * @param type  Timeout type
  */
 void gratuitous_arp_timeout(struct timeout *to, enum timeout_type type);
+
+/**
+ * Periodic ARP cache sweep: evict resolved entries that were not looked up
+ * for a while.
+ *
+ * @param to    Timeout that triggered
+ * @param type  Timeout type
+ */
+void arp_gc_timeout(struct timeout *to, enum timeout_type type);
+
+/**
+ * Write a checkpoint record for every resolved ARP cache entry.
+ *
+ * @param f  Checkpoint file
+ * @param n  Pointer to location for number of records written
+ *
+ * @return 0 on success, <0 else
+ */
+int arp_checkpoint(FILE *f, uint32_t *n);
+
+/**
+ * Insert ARP cache entries from checkpoint records, marked for re-validation
+ * on their next use.
+ *
+ * @param arps  ARP records
+ * @param n     Number of records
+ *
+ * @return 0 on success, <0 else
+ */
+int arp_restore(const struct sp_ckpt_arp *arps, uint32_t n);
 /** @} */
 
 /*****************************************************************************/
@@ -773,6 +1358,158 @@ int routing_init(void);
  */
 int routing_resolve(struct nicif_completion *comp, uint32_t ip, uint64_t *mac);
 
+/**
+ * Rebuild the routing table from reloaded routes, before they replace
+ * config.routes. Connections and ARP entries resolved earlier keep their
+ * next hop.
+ *
+ * @param routes Route list to build the table from.
+ *
+ * @return 0 on success, < 0 if the old table stays in use.
+ */
+int routing_update(const struct config_route *routes);
+
+/** @} */
+
+/*****************************************************************************/
+/**
+ * @addtogroup tas-sp-stats
+ * @brief Telemetry export
+ * @ingroup tas-sp
+ *
+ * Periodically publishes counters in a shared memory region (see sp_stats.h)
+ * for external readers such as flextoe-stat, and keeps the congestion control
+ * trace (see sp_cctrace.h) read by flextoe-cctrace.
+ * @{ */
+
+struct sp_cctrace_rec;
+
+/** Create the telemetry and trace shared memory regions, as configured */
+int stats_init(void);
+
+/**
+ * Refresh the telemetry region if the update interval has elapsed.
+ *
+ * @param cur_ts Current timestamp in micro seconds.
+ */
+void stats_poll(uint32_t cur_ts);
+
+/**
+ * Append a record to the congestion control trace, if enabled.
+ *
+ * @param rec Record to append.
+ */
+void stats_cctrace(const struct sp_cctrace_rec *rec);
+
+/** Remove the telemetry and trace shared memory regions */
+void stats_cleanup(void);
+
+/** @} */
+
+/*****************************************************************************/
+/**
+ * @addtogroup tas-sp-capture
+ * @brief Packet capture
+ * @ingroup tas-sp
+ *
+ * Copies slowpath RX and TX frames into pcapng files (see --pcap). Callers
+ * check #capture_on before calling capture_packet(), so a disabled capture
+ * costs a load and a branch per packet.
+ * @{ */
+
+/** Direction of a captured frame */
+enum capture_dir {
+  /** Received from the NIC */
+  CAPTURE_RX,
+  /** Sent to the NIC */
+  CAPTURE_TX,
+};
+
+/** Parse the filter and start the writer thread, if a file is configured */
+int capture_init(void);
+
+/**
+ * Capture a frame if it matches the filter. Never blocks, frames are dropped
+ * if the writer thread falls behind.
+ *
+ * @param pkt Pointer to frame
+ * @param len Length of frame
+ * @param dir Direction
+ */
+void capture_packet(const void *pkt, uint16_t len, enum capture_dir dir);
+
+/**
+ * Pause or resume capturing, safe to call from any thread.
+ *
+ * @param on 1 to capture, 0 to pause
+ *
+ * @return 0 on success, -1 if no capture file is configured.
+ */
+int capture_enable(int on);
+
+/** Stop the writer thread and close the capture file */
+void capture_cleanup(void);
+
+/** @} */
+
+/*****************************************************************************/
+/**
+ * @addtogroup tas-sp-reload
+ * @brief Configuration reloads
+ * @ingroup tas-sp
+ *
+ * Parses the configuration again on a helper thread (see config_reload())
+ * and hands the result to the main loop, which applies it between two rounds
+ * of polls. Polls never wait for the parser and see either all old or all
+ * new settings.
+ * @{ */
+
+/** Start the reload thread */
+int reload_init(void);
+
+/** Request a reload, async-signal-safe */
+void reload_request(void);
+
+/**
+ * Apply a reloaded configuration, if one is ready.
+ *
+ * @return 1 if a configuration was applied, 0 else.
+ */
+unsigned reload_poll(void);
+
+/** Stop the reload thread */
+void reload_cleanup(void);
+
+/** @} */
+
+/*****************************************************************************/
+/**
+ * @addtogroup tas-sp-checkpoint
+ * @brief Checkpoint and warm restart
+ * @ingroup tas-sp
+ *
+ * With --checkpoint the slowpath writes its control state to a file when it
+ * exits and leaves the NIC and shared memory running. With --restore it
+ * attaches to both and rebuilds its state from the file (see
+ * sp_checkpoint.h).
+ * @{ */
+
+/**
+ * Write the checkpoint file, called after the main loop stopped.
+ *
+ * @return 0 on success, <0 else
+ */
+int checkpoint_write(void);
+
+/**
+ * Restore from the checkpoint file, called after the NIC, congestion
+ * control, ARP, TCP and keepalive modules are initialized and before
+ * appif_init().
+ *
+ * @return 0 on success, <0 else
+ */
+int checkpoint_restore(void);
+
 /** @} */
 
 #endif /* INTERNAL_H_ */
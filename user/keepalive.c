@@ -0,0 +1,250 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * Keepalive and idle connection timeout
+ *
+ * Connections with keepalive enabled, or all open connections if
+ * config.tcp_idle_to is set, sit on a hashed timing wheel with one second
+ * ticks. A connection is on the wheel once, in the slot of its next deadline,
+ * and is only looked at when that deadline comes around: nothing is done per
+ * packet or per control interval. Slots also hold connections due in later
+ * rounds of the wheel, those are skipped until their tick.
+ *
+ * Whether the peer was heard from is decided at the deadline, by comparing the
+ * count of received segments in flows_cc_info with the value at the last
+ * check. Activity moves the deadline, otherwise the connection gets the next
+ * probe or is reset once it ran out of probes or exceeded the idle timeout.
+ *
+ * When the peer was last heard from comes from the congestion control loop,
+ * which reads the ACK counters of every open connection anyway and reports
+ * activity with keepalive_conn_active(). Deadlines are therefore accurate to
+ * a control interval plus a tick. Only activity that loop missed is dated to
+ * the check that found it, which can delay the next probe by up to one more
+ * idle period.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/common.h"
+
+#include "flextoe.h"
+#include "internal.h"
+
+#define KA_SLOTS      4096
+#define KA_TICK_US    1000000
+#define KA_TIME_MAX   32767   /*> Max idle time and interval [s] */
+#define KA_CNT_MAX    127     /*> Max probes */
+
+static struct connection *ka_wheel[KA_SLOTS];
+/** Current tick */
+static uint32_t ka_tick;
+/** Timestamp of the current tick [us] */
+static uint32_t ka_tick_ts;
+
+static inline void wheel_insert(struct connection *c, uint32_t expire);
+static inline void wheel_remove(struct connection *c);
+static void ka_arm(struct connection *c);
+static void ka_expire(struct connection *c);
+
+int keepalive_init(void)
+{
+  ka_tick = 0;
+  ka_tick_ts = util_timeout_time_us();
+  return 0;
+}
+
+unsigned keepalive_poll(uint32_t cur_ts)
+{
+  struct connection *c, *c_next, *due;
+  unsigned n = 0;
+
+  while (cur_ts - ka_tick_ts >= KA_TICK_US) {
+    ka_tick_ts += KA_TICK_US;
+    ka_tick++;
+
+    /* detach due connections first, expiring may re-arm or close them */
+    due = NULL;
+    for (c = ka_wheel[ka_tick % KA_SLOTS]; c != NULL; c = c_next) {
+      c_next = c->ka_next;
+      if (c->ka_expire == ka_tick) {
+        wheel_remove(c);
+        c->ka_next = due;
+        due = c;
+      }
+    }
+
+    for (c = due; c != NULL; c = c_next) {
+      c_next = c->ka_next;
+      ka_expire(c);
+      n++;
+    }
+  }
+
+  return n;
+}
+
+void keepalive_conn_init(struct connection *c)
+{
+  c->ka_idle = 0;
+  c->ka_probes = 0;
+  c->ka_last_segs = 0;
+  c->ka_active = ka_tick;
+  c->ka_checked = ka_tick;
+  c->ka_armed = 0;
+  ka_arm(c);
+}
+
+int keepalive_conn_set(struct connection *c, uint32_t idle, uint32_t intvl,
+    uint32_t cnt)
+{
+  if (c->status != CONN_OPEN) {
+    fprintf(stderr, "keepalive_conn_set: connection not open\n");
+    return -1;
+  }
+  if (idle > KA_TIME_MAX || (idle != 0 && (intvl == 0 ||
+          intvl > KA_TIME_MAX || cnt == 0 || cnt > KA_CNT_MAX)))
+  {
+    fprintf(stderr, "keepalive_conn_set: invalid parameters (idle=%u "
+        "intvl=%u cnt=%u)\n", idle, intvl, cnt);
+    return -1;
+  }
+
+  c->ka_idle = idle;
+  c->ka_intvl = intvl;
+  c->ka_cnt = cnt;
+  c->ka_probes = 0;
+
+  if (c->ka_armed) {
+    wheel_remove(c);
+  }
+  ka_arm(c);
+  return 0;
+}
+
+void keepalive_reconfig(void)
+{
+  struct connection *c;
+
+  for (c = cc_conn_first(); c != NULL; c = c->cc_next) {
+    if (c->status != CONN_OPEN) {
+      continue;
+    }
+    if (c->ka_armed) {
+      wheel_remove(c);
+    }
+    ka_arm(c);
+  }
+}
+
+void keepalive_conn_active(struct connection *c)
+{
+  c->ka_active = ka_tick;
+}
+
+void keepalive_conn_remove(struct connection *c)
+{
+  if (c->ka_armed) {
+    wheel_remove(c);
+  }
+}
+
+static inline void wheel_insert(struct connection *c, uint32_t expire)
+{
+  struct connection **slot = &ka_wheel[expire % KA_SLOTS];
+
+  assert(!c->ka_armed);
+  c->ka_expire = expire;
+  c->ka_prev = NULL;
+  c->ka_next = *slot;
+  if (*slot != NULL) {
+    (*slot)->ka_prev = c;
+  }
+  *slot = c;
+  c->ka_armed = 1;
+}
+
+static inline void wheel_remove(struct connection *c)
+{
+  assert(c->ka_armed);
+  if (c->ka_prev != NULL) {
+    c->ka_prev->ka_next = c->ka_next;
+  } else {
+    ka_wheel[c->ka_expire % KA_SLOTS] = c->ka_next;
+  }
+  if (c->ka_next != NULL) {
+    c->ka_next->ka_prev = c->ka_prev;
+  }
+  c->ka_armed = 0;
+}
+
+/* arm for the next deadline after the last activity, if there is one */
+static void ka_arm(struct connection *c)
+{
+  uint32_t due = 0;
+  int32_t left;
+
+  if (c->ka_idle != 0) {
+    due = c->ka_idle + c->ka_probes * c->ka_intvl;
+  }
+  if (config.tcp_idle_to != 0 && (due == 0 || config.tcp_idle_to < due)) {
+    due = config.tcp_idle_to;
+  }
+  if (due == 0) {
+    return;
+  }
+
+  left = c->ka_active + due - ka_tick;
+  if (left <= 0) {
+    left = 1;
+  }
+  wheel_insert(c, ka_tick + left);
+}
+
+static void ka_expire(struct connection *c)
+{
+  struct nicif_connection_tcpstate st;
+  uint32_t idle;
+
+  /* try again next tick, dropping off the wheel would disable the timers */
+  if (nicif_connection_tcpstate(c->flow_id, &st) != 0) {
+    fprintf(stderr, "ka_expire: nicif_connection_tcpstate failed\n");
+    ka_arm(c);
+    return;
+  }
+
+  /* peer was heard from since the last check, date it to this check unless
+   * the CC loop saw it earlier */
+  if (st.rx_segs != c->ka_last_segs) {
+    c->ka_last_segs = st.rx_segs;
+    if ((int32_t) (c->ka_active - c->ka_checked) <= 0) {
+      c->ka_active = ka_tick;
+    }
+    c->ka_checked = ka_tick;
+    c->ka_probes = 0;
+    ka_arm(c);
+    return;
+  }
+  c->ka_checked = ka_tick;
+
+  idle = ka_tick - c->ka_active;
+  if ((config.tcp_idle_to != 0 && idle >= config.tcp_idle_to) ||
+      (c->ka_idle != 0 && c->ka_probes >= c->ka_cnt &&
+       idle >= c->ka_idle + c->ka_probes * c->ka_intvl))
+  {
+    spstats.ka_resets++;
+    if (tcp_abort(c, &st) != 0) {
+      fprintf(stderr, "ka_expire: tcp_abort failed\n");
+    }
+    return;
+  }
+
+  if (c->ka_idle != 0 && idle >= c->ka_idle + c->ka_probes * c->ka_intvl) {
+    tcp_keepalive_probe(c, &st);
+    c->ka_probes++;
+    spstats.ka_probes++;
+  }
+  ka_arm(c);
+}
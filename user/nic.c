@@ -192,6 +192,10 @@ static int nic_init_config()
   nn_writeq(htobe64(local_mac), &fp_state->cfg.local_mac_1);
   nn_writeq(nic_us_to_cyc(config.fp_poll_interval_app), &fp_state->cfg.poll_cycle_app);
 
+  /* Delayed ACK policy */
+  nn_writel(config.tcp_delack_segs, &fp_state->cfg.delack_segs);
+  nn_writel(nic_us_to_cyc(config.tcp_delack_to), &fp_state->cfg.delack_ts);
+
   return 0;
 }
 
@@ -204,16 +208,12 @@ uint64_t nic_us_to_cyc(uint64_t us)
   return us * tsc_per_us;
 }
 
-int nic_init()
+/** Reset the device, load the firmware and bring up the ethernet ports */
+static int nic_reset_load(void)
 {
   struct nfp_nsp *nsp_handle;
   int ret;
 
-  printf(" - Probe... \n");
-  if ((ret = nfp_probe_device(&nic_handle)) < 0) {
-    fprintf(stderr, "failed to setup network device: %d\n", ret);
-    return EXIT_FAILURE;
-  }
   nsp_handle = nfp_nsp_open(nic_handle.cpp);
   if (!nsp_handle) {
     fprintf(stderr, "failed to setup network device: %d\n", EIO);
@@ -256,6 +256,25 @@ int nic_init()
     return EXIT_FAILURE;
   }
 
+  return EXIT_SUCCESS;
+}
+
+int nic_init()
+{
+  int ret;
+
+  printf(" - Probe... \n");
+  if ((ret = nfp_probe_device(&nic_handle)) < 0) {
+    fprintf(stderr, "failed to setup network device: %d\n", ret);
+    return EXIT_FAILURE;
+  }
+  /* warm restart: the firmware keeps running flows, only map it again */
+  if (config.restore) {
+    printf(" - Attach... \n");
+  } else if ((ret = nic_reset_load()) != EXIT_SUCCESS) {
+    return ret;
+  }
+
   if ((ret = nic_mmap_symbols(nic_handle.cpp)) < 0) {
     fprintf(stderr, "failed to map fastpath symbols: %d\n", ret);
     return EXIT_FAILURE;
@@ -269,6 +288,33 @@ int nic_init()
   return EXIT_SUCCESS;
 }
 
+int nic_numa_node(void)
+{
+  char path[PATH_MAX];
+  int node = -1;
+  FILE *f;
+
+  if (config.nic_node != CONFIG_NODE_DETECT) {
+    return config.nic_node;
+  }
+
+  snprintf(path, PATH_MAX, "%s/" PCI_PRI_FMT "/numa_node",
+            "/sys/bus/pci/devices",
+            nic_handle.dev->addr.domain,
+            nic_handle.dev->addr.bus,
+            nic_handle.dev->addr.devid,
+            nic_handle.dev->addr.function);
+  if ((f = fopen(path, "r")) != NULL) {
+    if (fscanf(f, "%d", &node) != 1) {
+      node = -1;
+    }
+    fclose(f);
+  }
+
+  /* -1 without NUMA */
+  return (node < 0 ? 0 : node);
+}
+
 void nic_cleanup(void)
 {
   fprintf(stderr, "%s: Not yet implemented!\n", __func__);
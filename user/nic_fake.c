@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * @brief Fastpath stand-in for running the slowpath without a NIC.
+ * @file nic_fake.c
+ *
+ * Same symbols as nic.c, see nic_fake.h. The model's state is shared memory
+ * like the NIC's: a slowpath forked off after nic_init() and restarted from a
+ * checkpoint finds it as the previous one left it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <sys/mman.h>
+
+#include <rte/io.h>
+#include <rte/cycles.h>
+
+#include "util/common.h"
+#include "util/shm.h"
+
+#include "connect.h"
+#include "flextoe.h"
+#include "nic_fake.h"
+
+struct nfp_handle_t nic_handle;
+struct flextcp_pl_mem *fp_state = NULL;
+struct flextcp_pl_debug *fp_debug = NULL;
+unsigned int *fp_journal = NULL;
+
+/** Flow table entry as installed by FLOWHT_ADD */
+struct fake_flow {
+  uint32_t local_ip;
+  uint32_t remote_ip;
+  uint16_t local_port;
+  uint16_t remote_port;
+  int valid;
+};
+
+static struct fake_flow *flows;
+static struct nic_fake_stats *stats;
+
+uint64_t nic_us_to_cyc(uint64_t us)
+{
+  /* same timestamp rate as the NFP, so configured values look the same */
+  uint64_t tsc_freq = (NS_PLATFORM_PCLK * 1000000ull)/16;
+  uint64_t tsc_per_us = tsc_freq/US_PER_S;
+
+  return us * tsc_per_us;
+}
+
+/** Zeroed memory shared with forked processes */
+static void *fake_alloc(size_t len)
+{
+  void *p;
+
+  p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+      -1, 0);
+  return (p == MAP_FAILED ? NULL : p);
+}
+
+int nic_init(void)
+{
+  uint64_t local_mac = NIC_FAKE_MAC;
+
+  if ((fp_state = fake_alloc(sizeof(*fp_state))) == NULL ||
+      (flows = fake_alloc(FLEXNIC_PL_FLOWST_NUM * sizeof(*flows))) == NULL ||
+      (stats = fake_alloc(sizeof(*stats))) == NULL)
+  {
+    fprintf(stderr, "nic_init: mmap failed\n");
+    return EXIT_FAILURE;
+  }
+
+  /* the model dereferences the ring addresses the slowpath hands out */
+  util_set_iova_va();
+
+  memcpy(&flextoe_info->mac_address, &local_mac, ETH_ALEN);
+  nn_writeq(htobe64(local_mac), &fp_state->cfg.local_mac_1);
+  nn_writeq(nic_us_to_cyc(config.fp_poll_interval_app),
+      &fp_state->cfg.poll_cycle_app);
+  nn_writel(config.tcp_delack_segs, &fp_state->cfg.delack_segs);
+  nn_writel(nic_us_to_cyc(config.tcp_delack_to), &fp_state->cfg.delack_ts);
+
+  return EXIT_SUCCESS;
+}
+
+int nic_numa_node(void)
+{
+  return (config.nic_node != CONFIG_NODE_DETECT ? config.nic_node : 0);
+}
+
+void nic_cleanup(void)
+{
+  munmap(stats, sizeof(*stats));
+  munmap(flows, FLEXNIC_PL_FLOWST_NUM * sizeof(*flows));
+  munmap(fp_state, sizeof(*fp_state));
+  stats = NULL;
+  flows = NULL;
+  fp_state = NULL;
+}
+
+int nic_fake_rx(const void *pkt, uint16_t len, uint16_t flow_group)
+{
+  struct flextcp_pl_spctx_t *spctx = &fp_state->spctx;
+  volatile struct flextcp_pl_sprx_t *sprx;
+  uint32_t rx_len = nn_readl(&spctx->rx_len);
+  uint32_t rx_tail = nn_readl(&spctx->rx_tail);
+  uint8_t *buf;
+
+  if (len > PKTBUF_SIZE) {
+    fprintf(stderr, "nic_fake_rx: packet too long (%u)\n", len);
+    return -1;
+  }
+
+  /* the slowpath invalidates entries as it consumes them */
+  sprx = (struct flextcp_pl_sprx_t *) (uintptr_t)
+    nn_readq(&spctx->rx_desc_base) + rx_tail;
+  if (be32toh(sprx->type) != FLEXTCP_PL_SPRX_INVALID) {
+    stats->rx_full++;
+    return -1;
+  }
+
+  buf = (uint8_t *) (uintptr_t) nn_readq(&spctx->rx_base) +
+    (uint64_t) rx_tail * PKTBUF_SIZE;
+  memcpy(buf, pkt, len);
+  sprx->msg.packet.len = htobe32(len);
+  sprx->msg.packet.flow_group = htobe32(flow_group);
+  sprx->msg.packet.flow_hash = 0;
+  rte_wmb();
+  sprx->type = htobe32(FLEXTCP_PL_SPRX_PACKET);
+
+  rx_tail = (rx_tail + 1 == rx_len ? 0 : rx_tail + 1);
+  nn_writel(rx_tail, &spctx->rx_tail);
+  stats->rx_packets++;
+  return 0;
+}
+
+static void flowht_update(volatile struct flextcp_pl_sptx_t *sptx, int add)
+{
+  struct fake_flow *f;
+  uint32_t f_id = be32toh(sptx->msg.flowht.flow_id);
+  uint32_t lip = be32toh(sptx->msg.flowht.local_ip);
+  uint32_t rip = be32toh(sptx->msg.flowht.remote_ip);
+  uint16_t lp = be16toh(sptx->msg.flowht.local_port);
+  uint16_t rp = be16toh(sptx->msg.flowht.remote_port);
+
+  if (f_id >= FLEXNIC_PL_FLOWST_NUM) {
+    stats->flowht_err++;
+    return;
+  }
+  f = &flows[f_id];
+
+  if (add) {
+    stats->flowht_add++;
+    if (f->valid) {
+      stats->flowht_err++;
+      return;
+    }
+    f->local_ip = lip;
+    f->remote_ip = rip;
+    f->local_port = lp;
+    f->remote_port = rp;
+    f->valid = 1;
+    stats->flows++;
+  } else {
+    stats->flowht_del++;
+    if (!f->valid || f->local_ip != lip || f->remote_ip != rip ||
+        f->local_port != lp || f->remote_port != rp)
+    {
+      stats->flowht_err++;
+      return;
+    }
+    f->valid = 0;
+    stats->flows--;
+  }
+}
+
+int nic_fake_tx(struct nic_fake_tx *tx)
+{
+  struct flextcp_pl_spctx_t *spctx = &fp_state->spctx;
+  volatile struct flextcp_pl_sptx_t *sptx;
+  uint32_t head = nn_readl(&spctx->tx_head);
+  uint32_t tx_len = nn_readl(&spctx->tx_len);
+
+  if (head == nn_readl(&spctx->tx_tail)) {
+    return 0;
+  }
+  rte_rmb();
+
+  sptx = (struct flextcp_pl_sptx_t *) (uintptr_t)
+    nn_readq(&spctx->tx_desc_base) + head;
+  tx->type = be32toh(sptx->type);
+  tx->flow_id = 0;
+  tx->pkt = NULL;
+  tx->len = 0;
+
+  switch (tx->type) {
+    case FLEXTCP_PL_SPTX_PACKET:
+    case FLEXTCP_PL_SPTX_PACKET_NOTS:
+      tx->pkt = (uint8_t *) (uintptr_t) nn_readq(&spctx->tx_base) +
+        (uint64_t) head * PKTBUF_SIZE;
+      tx->len = be32toh(sptx->msg.packet.len);
+      stats->tx_packets++;
+      break;
+
+    case FLEXTCP_PL_SPTX_FLOWHT_ADD:
+    case FLEXTCP_PL_SPTX_FLOWHT_DEL:
+      tx->flow_id = be32toh(sptx->msg.flowht.flow_id);
+      flowht_update(sptx, tx->type == FLEXTCP_PL_SPTX_FLOWHT_ADD);
+      break;
+
+    case FLEXTCP_PL_SPTX_CONN_CLOSE:
+      tx->flow_id = be32toh(sptx->msg.connclose.flow_id);
+      stats->conn_close++;
+      break;
+
+    default:
+      stats->other++;
+      break;
+  }
+
+  /* hand the entry back, the packet stays put until the slowpath reuses it */
+  sptx->type = htobe32(FLEXTCP_PL_SPTX_INVALID);
+  rte_wmb();
+  nn_writel(head + 1 == tx_len ? 0 : head + 1, &spctx->tx_head);
+  return 1;
+}
+
+unsigned nic_fake_tx_pending(void)
+{
+  struct flextcp_pl_spctx_t *spctx = &fp_state->spctx;
+  uint32_t len = nn_readl(&spctx->tx_len);
+
+  return (nn_readl(&spctx->tx_tail) + len - nn_readl(&spctx->tx_head)) % len;
+}
+
+void nic_fake_stats(struct nic_fake_stats *st)
+{
+  *st = *stats;
+}
@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+#ifndef NIC_FAKE_H_
+#define NIC_FAKE_H_
+
+#include <stdint.h>
+
+/**
+ * @brief In-memory stand-in for the fastpath.
+ * @file nic_fake.h
+ *
+ * nic_fake.c replaces nic.c: nic_init() places fp_state in ordinary memory
+ * and switches device addresses to virtual addresses, so the slowpath runs
+ * unmodified against a device model in the same process. The model side
+ * fills the SPRX ring like the fastpath does for exception packets and drains
+ * the SPTX ring, tracking the flow table updates of the slowpath. Nothing
+ * runs concurrently: the rings only move when the caller calls in here.
+ */
+
+/** Local MAC address of the fake NIC */
+#define NIC_FAKE_MAC  0x010000000002ULL
+
+/** Entry taken off the SPTX ring */
+struct nic_fake_tx {
+  uint32_t type;                  /*> FLEXTCP_PL_SPTX_* */
+  uint32_t flow_id;               /*> Flow table and connection messages */
+  const void *pkt;                /*> Packets, valid until the next poll */
+  uint16_t len;
+};
+
+/** Counters of the device model */
+struct nic_fake_stats {
+  uint64_t rx_packets;            /*> Passed to the slowpath */
+  uint64_t rx_full;               /*> Not passed, SPRX ring full */
+  uint64_t tx_packets;
+  uint64_t flowht_add;
+  uint64_t flowht_del;
+  uint64_t flowht_err;            /*> Adds of live flows, dels of others */
+  uint64_t conn_close;
+  uint64_t other;                 /*> Remaining SPTX messages */
+  uint32_t flows;                 /*> Live flow table entries */
+};
+
+/**
+ * Deliver a packet to the slowpath.
+ *
+ * @return 0 on success, -1 if the SPRX ring is full.
+ */
+int nic_fake_rx(const void *pkt, uint16_t len, uint16_t flow_group);
+
+/**
+ * Take the next entry off the SPTX ring.
+ *
+ * @return 1 if @p tx was filled in, 0 if the ring is empty.
+ */
+int nic_fake_tx(struct nic_fake_tx *tx);
+
+/** Entries the slowpath posted to the SPTX ring and were not taken yet */
+unsigned nic_fake_tx_pending(void);
+
+void nic_fake_stats(struct nic_fake_stats *st);
+
+#endif /* NIC_FAKE_H_ */
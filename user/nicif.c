@@ -20,6 +20,8 @@
 #include "fp_mem.h"
 #include "internal.h"
 #include "packet_defs.h"
+#include "qm_sched.h"
+#include "sp_checkpoint.h"
 
 struct nic_buffer {
   uint64_t addr;
@@ -28,6 +30,7 @@ struct nic_buffer {
 
 struct flow_id_item {
   uint32_t flow_id;
+  uint32_t fgrp;
   struct flow_id_item *next;
 };
 
@@ -36,6 +39,7 @@ struct flow_id_item {
 static int flow_slot_status[4][512];
 
 static int adminq_init(void);
+static int adminq_map(uintptr_t off_bufs, uintptr_t off_desc);
 static inline int rxq_poll(void);
 static inline void process_packet(const void *buf, uint16_t len, uint16_t flow_group);
 static inline volatile struct flextcp_pl_sptx_t *sptx_try_alloc(
@@ -64,6 +68,10 @@ static struct flextcp_pl_sptx_t *txq_base;
 static uint32_t txq_tail;
 static uint32_t txq_len;
 
+/** Packet memory of the SP rings, kept for the checkpoint */
+static struct packetmem_handle *adminq_pm_bufs;
+static struct packetmem_handle *adminq_pm_desc;
+
 int nicif_init(void)
 {
   /* prepare packet memory manager */
@@ -75,6 +83,11 @@ int nicif_init(void)
   /* prepare flow_id allocator */
   flow_id_alloc_init();
 
+  /* a restored slowpath attaches to the running SP rings in nicif_restore */
+  if (config.restore) {
+    return 0;
+  }
+
   if (adminq_init()) {
     fprintf(stderr, "nicif_init: initializing admin queue failed\n");
     return -1;
@@ -137,6 +150,7 @@ static int nicif_appctx_doorbell_write(uint32_t db, int evfd)
     return -1;
   }
 
+  close(fd);
   return 0;
 }
 
@@ -182,6 +196,13 @@ int nicif_appctx_add(uint16_t appid, uint32_t db, uint64_t rxq_base,
   nn_writel(rxq_len/sizeof(struct flextcp_pl_arx_t), &actx->rx.len);
   nn_writel(0, &actx->rx.c_idx);
   nn_writel(0, &actx->rx.p_idx);
+  nn_writel(config.qm_ctx_weight, &actx->qm_weight);
+  nn_writel(0, &actx->qm_rate);
+  nn_writel(0, &actx->qm_burst);
+
+  /* atx loads the queue when it sees the new generation */
+  MEM_BARRIER();
+  nn_writel(nn_readl(&actx->gen) + 1, &actx->gen);
 
   MEM_BARRIER();
   nn_writew(db, &ast->ctx_ids[ast->ctx_num]);
@@ -196,11 +217,88 @@ int nicif_appctx_add(uint16_t appid, uint32_t db, uint64_t rxq_base,
   return 0;
 }
 
-/** Close application */
+/** Set DRR weight of application context */
+int nicif_appctx_weight(uint32_t db, uint32_t weight)
+{
+  if (db >= FLEXNIC_PL_APPCTX_NUM) {
+    fprintf(stderr, "nicif_appctx_weight: invalid doorbell %u\n", db);
+    return -1;
+  }
+  if (weight == 0 || weight > QM_CTX_WEIGHT_MAX) {
+    fprintf(stderr, "nicif_appctx_weight: invalid weight %u (1-%u)\n", weight,
+        QM_CTX_WEIGHT_MAX);
+    return -1;
+  }
+
+  /* picked up by the queue manager when the context next gets its turn */
+  nn_writel(weight, &fp_state->appctx[db].qm_weight);
+  return 0;
+}
+
+/** Set aggregate rate limit of application context */
+int nicif_appctx_ratelimit(uint32_t db, uint32_t rate, uint32_t burst)
+{
+  struct flextcp_pl_appctx_t *actx;
+  uint32_t qm_rate, burst_min;
+
+  if (db >= FLEXNIC_PL_APPCTX_NUM) {
+    fprintf(stderr, "nicif_appctx_ratelimit: invalid doorbell %u\n", db);
+    return -1;
+  }
+  if (burst > QM_TB_BURST_MAX) {
+    fprintf(stderr, "nicif_appctx_ratelimit: burst too large (%u, max=%u)\n",
+        burst, QM_TB_BURST_MAX);
+    return -1;
+  }
+
+  qm_rate = qm_tb_rate(rate);
+  burst_min = qm_tb_burst_min(qm_rate);
+  burst = MAX(burst, burst_min);
+
+  /* the queue manager reads all three words together, rate last so a limit
+   * is never picked up with a stale burst */
+  actx = &fp_state->appctx[db];
+  nn_writel(burst, &actx->qm_burst);
+  MEM_BARRIER();
+  nn_writel(qm_rate, &actx->qm_rate);
+  return 0;
+}
+
+/** Close application context */
 int nicif_appctx_clear(uint16_t appid, uint32_t db)
 {
-  // TODO: Not yet implemented
-  fprintf(stderr, "%s: Not yet implemented!\n", __func__);
+  struct flextcp_pl_appctx_t *actx;
+  struct flextcp_pl_appst_t *ast = &fp_state->appst[appid];
+  uint16_t i, num;
+
+  if (appid >= FLEXNIC_PL_APPST_NUM) {
+    fprintf(stderr, "nicif_appctx_clear: app id too high (%u, max=%u)\n",
+        appid, FLEXNIC_PL_APPST_NUM);
+    return -1;
+  }
+  if (db == 0 || db >= FLEXNIC_PL_APPCTX_NUM) {
+    fprintf(stderr, "nicif_appctx_clear: invalid doorbell %u\n", db);
+    return -1;
+  }
+
+  /* remove from app context list, last entry takes its slot */
+  num = nn_readw(&ast->ctx_num);
+  for (i = 0; i < num && nn_readw(&ast->ctx_ids[i]) != db; i++);
+  if (i < num) {
+    nn_writew(nn_readw(&ast->ctx_ids[num - 1]), &ast->ctx_ids[i]);
+    MEM_BARRIER();
+    nn_writew(num - 1, &ast->ctx_num);
+  }
+
+  /* a zero length and a new generation deactivate the context in the atx
+   * poller, queue indices are left alone so already posted descriptors drain
+   * normally, gen_ack tells when they did (see nicif_appctx_idle) */
+  actx = &fp_state->appctx[db];
+  nn_writel(0, &actx->tx.len);
+  nn_writel(0, &actx->rx.len);
+  MEM_BARRIER();
+  nn_writel(nn_readl(&actx->gen) + 1, &actx->gen);
+  MEM_BARRIER();
 
   if (nicif_appctx_doorbell_clear(db) < 0) {
     return -1;
@@ -209,13 +307,21 @@ int nicif_appctx_clear(uint16_t appid, uint32_t db)
   return 0;
 }
 
+/** Check if atx acknowledged the last add/clear of application context */
+int nicif_appctx_idle(uint32_t db)
+{
+  struct flextcp_pl_appctx_t *actx = &fp_state->appctx[db];
+
+  return nn_readl(&actx->gen_ack) == nn_readl(&actx->gen);
+}
+
 /** Register flow */
 int nicif_connection_add(uint32_t db, uint64_t mac_remote, uint32_t ip_local,
     uint16_t port_local, uint32_t ip_remote, uint16_t port_remote,
-    uint64_t rx_base, uint32_t rx_len, uint64_t tx_base, uint32_t tx_len,
-    uint32_t remote_seq, uint32_t local_seq, uint64_t app_opaque,
-    uint32_t flags, uint32_t rate, uint16_t flow_group,
-    uint32_t *pf_id)
+    uint64_t rx_base, uint32_t rx_len, uint32_t rx_wnd, uint64_t tx_base,
+    uint32_t tx_len, uint32_t remote_seq, uint32_t local_seq,
+    uint64_t app_opaque, uint32_t flags, uint32_t wscale, uint32_t rate,
+    uint16_t flow_group, uint32_t *pf_id)
 {
   struct flowst_tcp_t* fs_tcp;
   struct flowst_conn_t* fs_conn;
@@ -223,6 +329,7 @@ int nicif_connection_add(uint32_t db, uint64_t mac_remote, uint32_t ip_local,
   struct flowst_cc_t* fs_cc;
   uint32_t f_id;
   uint16_t tx_flags = 0;
+  unsigned i;
 
   /* allocate flow id */
   if (flow_id_alloc(&f_id, flow_group) != 0) {
@@ -236,30 +343,35 @@ int nicif_connection_add(uint32_t db, uint64_t mac_remote, uint32_t ip_local,
   if ((flags & NICIF_CONN_ECN) == NICIF_CONN_ECN) {
     tx_flags |= FLEXNIC_PL_FLOWST_ECN;
   }
+  if ((flags & NICIF_CONN_SACK) == NICIF_CONN_SACK) {
+    tx_flags |= FLEXNIC_PL_FLOWST_SACK;
+  }
 
   fs_tcp = &fp_state->flows_tcp_state[f_id];
   fs_conn = &fp_state->flows_conn_info[f_id];
   fs_mem = &fp_state->flows_mem_info[f_id];
   fs_cc = &fp_state->flows_cc_info[f_id];
 
-  nn_writel(tx_len, &fs_tcp->tx_len);
+  nn_writel(0, &fs_tcp->tx_sack);
   nn_writel(0, &fs_tcp->tx_avail);
   nn_writel(rx_len, &fs_tcp->tx_remote_avail);
   nn_writel(0, &fs_tcp->tx_sent);
   nn_writel(local_seq, &fs_tcp->tx_next_seq);
   nn_writel(0, &fs_tcp->tx_next_pos);
-  nn_writew(0, &fs_tcp->dupack_cnt);
-  nn_writew(flags, &fs_tcp->flags);
-  nn_writel(rx_len, &fs_tcp->rx_len);
-  nn_writel(rx_len, &fs_tcp->rx_avail);
+  nn_writew(0, &fs_tcp->rack_ts);
+  nn_writew(tx_flags, &fs_tcp->flags);
+  nn_writel(0, &fs_tcp->tx_rtx);
+  nn_writel(rx_wnd, &fs_tcp->rx_avail);
   nn_writel(remote_seq, &fs_tcp->rx_next_seq);
   nn_writel(0, &fs_tcp->rx_next_pos);
-  nn_writel(0, &fs_tcp->rx_ooo_len);
-  nn_writel(0, &fs_tcp->rx_ooo_start);
+  for (i = 0; i < FLEXNIC_PL_OOO_NUM; i++) {
+    nn_writel(0, &fs_tcp->rx_ooo[i]);
+  }
+  nn_writel(wscale, &fs_tcp->wnd);
 
   nn_writel(flow_group, &fs_conn->flow_grp);
   nn_writeq(htobe64(mac_remote), &fs_conn->remote_mac_1);
-  nn_writew(flags, &fs_conn->flags);
+  nn_writew(tx_flags, &fs_conn->flags);
   nn_writel(ip_local, &fs_conn->local_ip);
   nn_writel(ip_remote, &fs_conn->remote_ip);
   nn_writew(port_local, &fs_conn->local_port);
@@ -275,18 +387,21 @@ int nicif_connection_add(uint32_t db, uint64_t mac_remote, uint32_t ip_local,
 
   nn_writel(0, &fs_cc->tx_avail);
   nn_writel(0, &fs_cc->tx_rate);
+  nn_writel(db, &fs_cc->qm_params);
   nn_writel(config.tcp_rtt_init, &fs_cc->rtt_est);
   nn_writel(0, &fs_cc->txp);
   nn_writel(0, &fs_cc->cnt_tx_drops);
   nn_writel(0, &fs_cc->cnt_rx_acks);
   nn_writel(0, &fs_cc->cnt_rx_ack_bytes);
   nn_writel(0, &fs_cc->cnt_rx_ecn_bytes);
+  nn_writel(0, &fs_cc->cnt_rx_bytes);
 
   /* write to empty entry first */
   MEM_BARRIER();
   /* calculate hash and find empty slot */
   if (flow_slot_alloc(ip_local, ip_remote, port_local, port_remote, f_id) != 0) {
     flow_id_free(f_id, flow_group);
+    *pf_id = 0;
     fprintf(stderr, "nicif_connection_add: allocating slot failed\n");
     return -1;
   }
@@ -327,10 +442,17 @@ void nicif_connection_free(uint32_t f_id, uint32_t flow_grp)
   flow_id_free(f_id, flow_grp);
 }
 
+int nicif_connection_unregister(uint32_t f_id, uint32_t ip_local,
+    uint16_t port_local, uint32_t ip_remote, uint16_t port_remote)
+{
+  return flow_slot_clear(f_id, ip_local, port_local, ip_remote, port_remote);
+}
+
 /** Move flow to new db */
 int nicif_connection_move(uint32_t dst_db, uint32_t f_id)
 {
   struct flowst_mem_t *fs;
+  struct flowst_cc_t *fs_cc;
 
   if (f_id >= FLEXNIC_PL_FLOWST_NUM) {
     fprintf(stderr, "%s: bad flow id\n", __func__);
@@ -339,6 +461,32 @@ int nicif_connection_move(uint32_t dst_db, uint32_t f_id)
 
   fs = &fp_state->flows_mem_info[f_id];
   nn_writew(dst_db, &fs->db_id);
+
+  /* queued flows switch DRR context when next scheduled, keep the class */
+  fs_cc = &fp_state->flows_cc_info[f_id];
+  nn_writel(QM_PARAMS(dst_db, QM_PARAMS_CLASS(nn_readl(&fs_cc->qm_params))),
+      &fs_cc->qm_params);
+  return 0;
+}
+
+/** Set priority class of flow */
+int nicif_connection_class(uint32_t f_id, uint32_t cls)
+{
+  struct flowst_cc_t *fs;
+
+  if (f_id >= FLEXNIC_PL_FLOWST_NUM) {
+    fprintf(stderr, "%s: bad flow id\n", __func__);
+    return -1;
+  }
+  if (cls >= QM_PRIO_NUM) {
+    fprintf(stderr, "%s: invalid class %u (0-%u)\n", __func__, cls,
+        QM_PRIO_NUM - 1);
+    return -1;
+  }
+
+  /* queued flows switch to the class FIFO when next scheduled */
+  fs = &fp_state->flows_cc_info[f_id];
+  nn_writel(QM_PARAMS(nn_readl(&fs->qm_params), cls), &fs->qm_params);
   return 0;
 }
 
@@ -360,6 +508,28 @@ int nicif_connection_stats(uint32_t f_id,
   p_stats->c_acks  = (uint16_t) nn_readl(&fs->cnt_rx_acks);
   p_stats->c_ackb  = nn_readl(&fs->cnt_rx_ack_bytes);
   p_stats->c_ecnb  = nn_readl(&fs->cnt_rx_ecn_bytes);
+  p_stats->c_rxb   = nn_readl(&fs->cnt_rx_bytes);
+
+  return 0;
+}
+
+/** Read sequence state and activity from NIC. */
+int nicif_connection_tcpstate(uint32_t f_id,
+    struct nicif_connection_tcpstate *st)
+{
+  struct flowst_tcp_t *fs;
+
+  if (f_id >= FLEXNIC_PL_FLOWST_NUM) {
+    fprintf(stderr, "%s: bad flow id\n", __func__);
+    return -1;
+  }
+
+  fs = &fp_state->flows_tcp_state[f_id];
+  st->rx_segs = nn_readl(&fp_state->flows_cc_info[f_id].cnt_rx_acks);
+  st->tx_next_seq = nn_readl(&fs->tx_next_seq);
+  st->tx_sent = nn_readl(&fs->tx_sent);
+  st->rx_next_seq = nn_readl(&fs->rx_next_seq);
+  st->ts_echo = nn_readl(&fs->tx_next_ts);
 
   return 0;
 }
@@ -398,8 +568,8 @@ int nicif_connection_setrate(uint32_t f_id, uint32_t rate)
   return 0;
 }
 
-/** Mark flow for retransmit after timeout. */
-int nicif_connection_retransmit(uint32_t f_id, uint16_t flow_group)
+static int connection_retx_msg(uint32_t f_id, uint16_t flow_group,
+    uint32_t type)
 {
   volatile struct flextcp_pl_sptx_t *sptx;
   struct nic_buffer *buf;
@@ -412,7 +582,44 @@ int nicif_connection_retransmit(uint32_t f_id, uint16_t flow_group)
 
   sptx->msg.connretran.flow_id = htobe32(f_id);
   sptx->msg.connretran.flow_grp = htobe32(flow_group);
-  sptx->type = htobe32(FLEXTCP_PL_SPTX_CONN_RETX);
+  sptx->type = htobe32(type);
+
+  rte_wmb();
+
+  /* Doorbell to consumer */
+  nn_writel(tail, &fp_state->spctx.tx_tail);
+
+  return 0;
+}
+
+/** Mark flow for retransmit after timeout. */
+int nicif_connection_retransmit(uint32_t f_id, uint16_t flow_group)
+{
+  return connection_retx_msg(f_id, flow_group, FLEXTCP_PL_SPTX_CONN_RETX);
+}
+
+/** Send a tail loss probe for flow. */
+int nicif_connection_probe(uint32_t f_id, uint16_t flow_group)
+{
+  return connection_retx_msg(f_id, flow_group, FLEXTCP_PL_SPTX_CONN_PROBE);
+}
+
+/** Change receive window for flow. */
+int nicif_connection_rxwnd(uint32_t f_id, uint16_t flow_group, int32_t delta)
+{
+  volatile struct flextcp_pl_sptx_t *sptx;
+  struct nic_buffer *buf;
+  uint32_t tail;
+
+  if ((sptx = sptx_try_alloc(&buf, &tail)) == NULL) {
+    return -1;
+  }
+  txq_tail = tail;
+
+  sptx->msg.connrxwnd.flow_id = htobe32(f_id);
+  sptx->msg.connrxwnd.flow_grp = htobe32(flow_group);
+  sptx->msg.connrxwnd.delta = htobe32((uint32_t) delta);
+  sptx->type = htobe32(FLEXTCP_PL_SPTX_CONN_RXWND);
 
   rte_wmb();
 
@@ -464,6 +671,12 @@ void nicif_tx_send(uint32_t opaque, int no_ts, uint32_t ts_offset)
   uint32_t tail = (opaque == 0 ? txq_len - 1 : opaque - 1);
   volatile struct flextcp_pl_sptx_t *sptx = &txq_base[tail];
 
+  /* the NIC fills in the TCP timestamp later, the capture has the old one */
+  if (capture_on) {
+    capture_packet(txq_bufs[tail].buf, be32toh(sptx->msg.packet.len),
+        CAPTURE_TX);
+  }
+
   sptx->msg.packet.ts_offset = htobe32(ts_offset);
   sptx->type = htobe32((!no_ts ? FLEXTCP_PL_SPTX_PACKET : FLEXTCP_PL_SPTX_PACKET_NOTS));
 
@@ -476,31 +689,13 @@ void nicif_tx_send(uint32_t opaque, int no_ts, uint32_t ts_offset)
 static int adminq_init(void)
 {
   struct packetmem_handle *pm_bufs, *pm_desc;
-  uintptr_t off_bufs, off_rxbufs, off_txbufs, off_desc;
-  size_t i, sz_bufs, sz_rx, sz_tx;
-
-  rxq_len = config.nic_rx_len;
-  txq_len = config.nic_tx_len;
-
-  rxq_next = 0;
-
-  if ((rxq_bufs = calloc(config.nic_rx_len, sizeof(*rxq_bufs)))
-      == NULL)
-  {
-    fprintf(stderr, "adminq_init: calloc rx bufs failed\n");
-    return -1;
-  }
-  if ((txq_bufs = calloc(config.nic_tx_len, sizeof(*txq_bufs)))
-      == NULL)
-  {
-    fprintf(stderr, "adminq_init: calloc tx bufs failed\n");
-    goto free_rxqbufs;
-  }
+  uintptr_t off_bufs, off_desc;
+  size_t sz_bufs, sz_rx, sz_tx;
 
   sz_bufs = ((config.nic_rx_len + config.nic_tx_len) * PKTBUF_SIZE) & ~0xfffULL;
   if (packetmem_alloc(sz_bufs, &off_bufs, &pm_bufs) != 0) {
     fprintf(stderr, "adminq_init: packetmem_alloc bufs failed\n");
-    goto free_txqbufs;
+    return -1;
   }
 
   sz_rx = config.nic_rx_len * sizeof(struct flextcp_pl_sprx_t);
@@ -511,32 +706,22 @@ static int adminq_init(void)
     goto free_pmbufs;
   }
 
-  rxq_base = (struct flextcp_pl_sprx_t*) ((uint8_t*) flextoe_dma_mem + off_desc);
+  if (adminq_map(off_bufs, off_desc) != 0) {
+    goto free_pmdesc;
+  }
+  adminq_pm_bufs = pm_bufs;
+  adminq_pm_desc = pm_desc;
+
   rxq_head = 0;
-  txq_base = (struct flextcp_pl_sptx_t*) ((uint8_t*) flextoe_dma_mem + off_desc + sz_rx);
   txq_tail = 0;
 
   memset((void *) rxq_base, 0, sz_rx);
   memset((void *) txq_base, 0, sz_tx);
 
-  off_rxbufs = off_bufs;
-  for (i = 0; i < config.nic_rx_len; i++) {
-    rxq_bufs[i].addr = off_bufs;
-    rxq_bufs[i].buf = (uint8_t *) flextoe_dma_mem + off_bufs;
-    off_bufs += PKTBUF_SIZE;
-  }
-
-  off_txbufs = off_bufs;
-  for (i = 0; i < config.nic_tx_len; i++) {
-    txq_bufs[i].addr = off_bufs;
-    txq_bufs[i].buf = (uint8_t *) flextoe_dma_mem + off_bufs;
-    off_bufs += PKTBUF_SIZE;
-  }
-
-  nn_writeq(util_virt2phy((uint8_t*) flextoe_dma_mem + off_rxbufs), &fp_state->spctx.rx_base);
+  nn_writeq(util_virt2phy(rxq_bufs[0].buf), &fp_state->spctx.rx_base);
   nn_writeq(util_virt2phy(rxq_base), &fp_state->spctx.rx_desc_base);
   nn_writel(config.nic_rx_len, &fp_state->spctx.rx_len);
-  nn_writeq(util_virt2phy((uint8_t*) flextoe_dma_mem + off_txbufs), &fp_state->spctx.tx_base);
+  nn_writeq(util_virt2phy(txq_bufs[0].buf), &fp_state->spctx.tx_base);
   nn_writeq(util_virt2phy(txq_base), &fp_state->spctx.tx_desc_base);
   nn_writel(config.nic_tx_len, &fp_state->spctx.tx_len);
   nn_writel(0, &fp_state->spctx.rx_head);
@@ -548,15 +733,130 @@ static int adminq_init(void)
 
   return 0;
 
+free_pmdesc:
+  packetmem_free(pm_desc);
 free_pmbufs:
   packetmem_free(pm_bufs);
-free_txqbufs:
-  free(txq_bufs);
-free_rxqbufs:
-  free(rxq_bufs);
   return -1;
 }
 
+/** Set up the SP ring pointers for buffers and descriptors at these offsets */
+static int adminq_map(uintptr_t off_bufs, uintptr_t off_desc)
+{
+  size_t i;
+
+  rxq_len = config.nic_rx_len;
+  txq_len = config.nic_tx_len;
+
+  rxq_next = 0;
+
+  if ((rxq_bufs = calloc(config.nic_rx_len, sizeof(*rxq_bufs)))
+      == NULL)
+  {
+    fprintf(stderr, "adminq_map: calloc rx bufs failed\n");
+    return -1;
+  }
+  if ((txq_bufs = calloc(config.nic_tx_len, sizeof(*txq_bufs)))
+      == NULL)
+  {
+    fprintf(stderr, "adminq_map: calloc tx bufs failed\n");
+    free(rxq_bufs);
+    return -1;
+  }
+
+  rxq_base = (struct flextcp_pl_sprx_t*) ((uint8_t*) flextoe_dma_mem + off_desc);
+  txq_base = (struct flextcp_pl_sptx_t*) ((uint8_t*) flextoe_dma_mem + off_desc +
+      config.nic_rx_len * sizeof(struct flextcp_pl_sprx_t));
+
+  for (i = 0; i < config.nic_rx_len; i++) {
+    rxq_bufs[i].addr = off_bufs;
+    rxq_bufs[i].buf = (uint8_t *) flextoe_dma_mem + off_bufs;
+    off_bufs += PKTBUF_SIZE;
+  }
+
+  for (i = 0; i < config.nic_tx_len; i++) {
+    txq_bufs[i].addr = off_bufs;
+    txq_bufs[i].buf = (uint8_t *) flextoe_dma_mem + off_bufs;
+    off_bufs += PKTBUF_SIZE;
+  }
+
+  return 0;
+}
+
+void nicif_checkpoint(struct sp_ckpt_hdr *hdr)
+{
+  packetmem_checkpoint(adminq_pm_bufs, &hdr->adminq_bufs);
+  packetmem_checkpoint(adminq_pm_desc, &hdr->adminq_desc);
+}
+
+int nicif_restore(const struct sp_ckpt_hdr *hdr,
+    const struct sp_ckpt_conn *conns, uint32_t n)
+{
+  struct flow_id_item *it, *prev;
+  uint32_t i, f_id, fgrp;
+  uint8_t *used;
+
+  if (packetmem_reserve(&hdr->adminq_bufs, &adminq_pm_bufs) != 0 ||
+      packetmem_reserve(&hdr->adminq_desc, &adminq_pm_desc) != 0)
+  {
+    fprintf(stderr, "nicif_restore: reserving SP rings failed\n");
+    return -1;
+  }
+  if (adminq_map(hdr->adminq_bufs.off, hdr->adminq_desc.off) != 0) {
+    return -1;
+  }
+
+  /* the NIC kept going, continue where it is */
+  rxq_head = nn_readl(&fp_state->spctx.rx_head);
+  txq_tail = nn_readl(&fp_state->spctx.tx_tail);
+  if (rxq_head >= rxq_len || txq_tail >= txq_len) {
+    fprintf(stderr, "nicif_restore: SP ring positions out of range\n");
+    return -1;
+  }
+
+  /* flow ids of restored connections stay allocated */
+  if ((used = calloc(FLEXNIC_PL_FLOWST_NUM, 1)) == NULL) {
+    fprintf(stderr, "nicif_restore: calloc failed\n");
+    return -1;
+  }
+  for (i = 0; i < n; i++) {
+    f_id = conns[i].flow_id;
+    fgrp = conns[i].flow_group;
+    if (f_id == 0) {
+      continue;
+    }
+    if (f_id >= FLEXNIC_PL_FLOWST_NUM || fgrp >= 4 || used[f_id]) {
+      fprintf(stderr, "nicif_restore: invalid flow id %u (group %u)\n",
+          f_id, fgrp);
+      free(used);
+      return -1;
+    }
+    used[f_id] = 1;
+    flow_id_items[f_id].fgrp = fgrp;
+    flow_slot_status[fgrp][f_id % 512]++;
+  }
+
+  flow_id_freelist = NULL;
+  prev = NULL;
+  for (i = 1; i < FLEXNIC_PL_FLOWST_NUM; i++) {
+    it = &flow_id_items[i];
+    it->next = NULL;
+    if (used[i]) {
+      continue;
+    }
+
+    if (prev == NULL) {
+      flow_id_freelist = it;
+    } else {
+      prev->next = it;
+    }
+    prev = it;
+  }
+
+  free(used);
+  return 0;
+}
+
 static inline int rxq_poll(void)
 {
   uint32_t head, updated_head;
@@ -579,6 +879,10 @@ static inline int rxq_poll(void)
 
   switch (type) {
     case FLEXTCP_PL_SPRX_PACKET:
+      if (capture_on) {
+        capture_packet(buf->buf, (uint16_t) be32toh(sprx->msg.packet.len),
+            CAPTURE_RX);
+      }
       process_packet(buf->buf,
           (uint16_t) be32toh(sprx->msg.packet.len),
           (uint16_t) be32toh(sprx->msg.packet.flow_group));
@@ -616,6 +920,8 @@ static inline void process_packet(const void *buf, uint16_t len, uint16_t flow_g
   const struct tcp_hdr *tcp = (struct tcp_hdr *) (ip + 1);
   int ret = 1;
 
+  spstats.rx_packets[flow_group % SP_STATS_FLOWGRPS]++;
+
   if (f_beui16(eth->type) == ETH_TYPE_ARP) {
     if (len < sizeof(struct pkt_arp)) {
       fprintf(stderr, "process_packet: short arp packet\n");
@@ -640,8 +946,11 @@ static inline void process_packet(const void *buf, uint16_t len, uint16_t flow_g
     }
   }
 
-  if (ret && !config.quiet) {
-    fprintf(stderr, "fail to process nicif packet\n");
+  if (ret) {
+    spstats.rx_unhandled++;
+    if (!config.quiet) {
+      fprintf(stderr, "fail to process nicif packet\n");
+    }
   }
 }
 
@@ -824,12 +1133,14 @@ static int flow_id_alloc(uint32_t *fid, uint32_t fgrp)
 
   if (i == 512) {
     flow_id_freelist = it->next;
+    it->fgrp = fgrp;
     *fid = it->flow_id;
     return 0;
   }
 
   if (it->flow_id % 512 == i) {
     flow_slot_status[fgrp][i]++;
+    it->fgrp = fgrp;
     *fid = it->flow_id;
     flow_id_freelist = it->next;
     return 0;
@@ -842,6 +1153,7 @@ static int flow_id_alloc(uint32_t *fid, uint32_t fgrp)
   while (it != NULL) {
     if (it->flow_id % 512 == i) {
       flow_slot_status[fgrp][i]++;
+      it->fgrp = fgrp;
       *fid = it->flow_id;
       iprev->next = it->next;
 
@@ -852,7 +1164,10 @@ static int flow_id_alloc(uint32_t *fid, uint32_t fgrp)
     it = it->next;
   }
 
+  /* no free id maps to the empty slot, take the head of the freelist */
+  it = flow_id_freelist;
   flow_id_freelist = it->next;
+  it->fgrp = fgrp;
   *fid = it->flow_id;
   flow_slot_status[fgrp][it->flow_id % 512]++;
   return 0;
@@ -148,6 +148,9 @@ struct tcp_hdr {
 #define TCP_OPT_END_OF_OPTIONS 0
 #define TCP_OPT_NO_OP 1
 #define TCP_OPT_MSS 2
+#define TCP_OPT_WINDOW_SCALE 3
+#define TCP_OPT_SACK_PERMITTED 4
+#define TCP_OPT_SACK 5
 #define TCP_OPT_TIMESTAMP 8
 
 struct tcp_noop_opt {
@@ -161,6 +164,17 @@ struct tcp_mss_opt {
 } __attribute__((packed));
 
 
+struct tcp_sack_permitted_opt {
+  uint8_t kind;
+  uint8_t length;
+} __attribute__((packed));
+
+struct tcp_wscale_opt {
+  uint8_t kind;
+  uint8_t length;
+  uint8_t shift;
+} __attribute__((packed));
+
 struct tcp_timestamp_opt {
   uint8_t kind;
   uint8_t length;
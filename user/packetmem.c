@@ -3,15 +3,23 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
 
 #include "util/shm.h"
 
 #include "connect.h"
 #include "flextoe.h"
 #include "internal.h"
+#include "sp_checkpoint.h"
 
 #define PACKETMEM_MAX_ZONES   16    /* Restrict to 16 hugepages */
 
+/* Zones are faulted in before anything in them is handed out */
+#define ZONE_UNPOPULATED      0
+#define ZONE_READY            1
+#define ZONE_FAILED           2
+
 struct packetmem_handle {
   uintptr_t base;
   size_t len;
@@ -28,10 +36,40 @@ static inline void merge_items(uint32_t zone, struct packetmem_handle *ph_prev);
 
 static struct packetmem_handle *freelist[PACKETMEM_MAX_ZONES];
 static uint32_t total_zones;
+/** NUMA node of each zone, the one it is bound to until it is populated */
+static uint8_t zone_node[PACKETMEM_MAX_ZONES];
+static uint8_t zone_state[PACKETMEM_MAX_ZONES];
+static struct packetmem_node_stats nodes[CONFIG_NUMA_NODES_MAX];
+static int nic_node;
+/** Allocations come from the UX and the poll thread */
+static pthread_mutex_t pm_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Node the hugepage of a zone is on */
+static unsigned zone_node_get(uint32_t zone)
+{
+  int node;
+
+  if (config.numa_nodes <= 1) {
+    return 0;
+  }
+  if (config.numa_emulate) {
+    return zone % config.numa_nodes;
+  }
+
+  node = shm_numa_node((uint8_t *) flextoe_dma_mem +
+      (uint64_t) zone * HUGE_PAGE_SIZE);
+  if (node < 0 || node >= config.numa_nodes) {
+    fprintf(stderr, "packetmem_init: zone %u is on unexpected node %d, "
+        "assuming %u\n", zone, node, zone % config.numa_nodes);
+    return zone % config.numa_nodes;
+  }
+  return node;
+}
 
 int packetmem_init(void)
 {
   uint32_t zone;
+  unsigned node;
 
   if (flextoe_info->dma_mem_size % HUGE_PAGE_SIZE != 0) {
     fprintf(stderr, "%s(): invalid flextoe_dma_mem memory\n", __func__);
@@ -52,13 +90,72 @@ int packetmem_init(void)
       return -1;
     }
 
-    ph->base = 0;
+    ph->base = (uintptr_t) zone * HUGE_PAGE_SIZE;
     ph->len  = HUGE_PAGE_SIZE;
     ph->zone = zone;
     ph->next = NULL;
     freelist[zone] = ph;
+
+    /* shm_init() populated the first zone or all of them, a restored
+     * slowpath populates zones as it reserves memory in them */
+    if (config.restore || (zone > 0 &&
+          config.shm_populate == CONFIG_SHM_POPULATE_LAZY))
+    {
+      zone_state[zone] = ZONE_UNPOPULATED;
+      node = zone % config.numa_nodes;
+    } else {
+      zone_state[zone] = ZONE_READY;
+      node = zone_node_get(zone);
+    }
+    zone_node[zone] = node;
+    nodes[node].zones++;
+    nodes[node].size += HUGE_PAGE_SIZE;
+  }
+
+  /* a NIC on a node without memory gets the first zone's */
+  nic_node = nic_numa_node();
+  if (nic_node >= config.numa_nodes || nodes[nic_node].zones == 0) {
+    fprintf(stderr, "packetmem_init: no packet memory on the NIC's node %d, "
+        "using node %u\n", nic_node, zone_node[0]);
+    nic_node = zone_node[0];
+  }
+
+  if (!config.quiet && config.numa_nodes > 1) {
+    for (node = 0; node < config.numa_nodes; node++) {
+      printf("packetmem: node %u: %u zones%s\n", node, nodes[node].zones,
+          (node == nic_node ? " (NIC)" : ""));
+    }
+  }
+
+  return 0;
+}
+
+/** Fault in a zone on first use, its node is only known afterwards */
+static int zone_populate(uint32_t zone)
+{
+  unsigned node, old = zone_node[zone];
+
+  if (zone_state[zone] != ZONE_UNPOPULATED) {
+    return (zone_state[zone] == ZONE_READY ? 0 : -1);
   }
 
+  if (shm_populate(zone, 1) != 0) {
+    fprintf(stderr, "packetmem: populating zone %u failed, not using it\n",
+        zone);
+    zone_state[zone] = ZONE_FAILED;
+    nodes[old].zones--;
+    nodes[old].size -= HUGE_PAGE_SIZE;
+    return -1;
+  }
+  zone_state[zone] = ZONE_READY;
+
+  if ((node = zone_node_get(zone)) != old) {
+    nodes[old].zones--;
+    nodes[old].size -= HUGE_PAGE_SIZE;
+    nodes[node].zones++;
+    nodes[node].size += HUGE_PAGE_SIZE;
+    zone_node[zone] = node;
+  }
   return 0;
 }
 
@@ -118,19 +215,48 @@ static int packetmem_zone_alloc(uint32_t zone, size_t length, uintptr_t *off,
 int packetmem_alloc(size_t length, uintptr_t *off,
     struct packetmem_handle **handle)
 {
-  uint32_t zone;
-  int ret;
+  return packetmem_alloc_node(length, PACKETMEM_NODE_NIC, off, handle);
+}
 
-  for (zone = 0; zone < total_zones; zone ++) {
-    ret = packetmem_zone_alloc(zone, length, off, handle);
+int packetmem_alloc_node(size_t length, int node, uintptr_t *off,
+    struct packetmem_handle **handle)
+{
+  uint32_t zone = 0;
+  int ret = -1, pass;
 
-    if (ret < 0)
-      continue;
+  if (node < 0 || node >= config.numa_nodes) {
+    node = nic_node;
+  }
 
-    return 0;
+  pthread_mutex_lock(&pm_mutex);
+  /* zones on the node first, then the others */
+  for (pass = 0; pass < 2 && ret < 0; pass++) {
+    for (zone = 0; zone < total_zones; zone ++) {
+      if ((zone_node[zone] == node) != (pass == 0) ||
+          zone_populate(zone) != 0)
+      {
+        continue;
+      }
+
+      ret = packetmem_zone_alloc(zone, length, off, handle);
+
+      if (ret < 0)
+        continue;
+
+      break;
+    }
   }
 
-  return -1;
+  if (ret == 0) {
+    nodes[zone_node[zone]].allocs++;
+    nodes[zone_node[zone]].used += length;
+    if (zone_node[zone] != node) {
+      nodes[node].spills++;
+    }
+  }
+  pthread_mutex_unlock(&pm_mutex);
+
+  return (ret < 0 ? -1 : 0);
 }
 
 void packetmem_free(struct packetmem_handle *handle)
@@ -138,10 +264,13 @@ void packetmem_free(struct packetmem_handle *handle)
   struct packetmem_handle *ph, *ph_prev;
   uint32_t zone = handle->zone;
 
-  /* look for first successor */
+  pthread_mutex_lock(&pm_mutex);
+  nodes[zone_node[zone]].used -= handle->len;
+
+  /* look for last predecessor, the list is sorted by base */
   ph_prev = NULL;
   ph = freelist[zone];
-  while (ph != NULL && ph->next != NULL && ph->next->base < handle->base) {
+  while (ph != NULL && ph->base < handle->base) {
     ph_prev = ph;
     ph = ph->next;
   }
@@ -157,6 +286,104 @@ void packetmem_free(struct packetmem_handle *handle)
 
   /* merge items if necessary */
   merge_items(zone, ph_prev);
+
+  pthread_mutex_unlock(&pm_mutex);
+}
+
+void packetmem_checkpoint(const struct packetmem_handle *handle,
+    struct sp_ckpt_mem *mem)
+{
+  mem->off = handle->base;
+  mem->len = handle->len;
+  mem->zone = handle->zone;
+}
+
+int packetmem_reserve(const struct sp_ckpt_mem *mem,
+    struct packetmem_handle **handle)
+{
+  struct packetmem_handle *ph, *ph_prev, *ph_new, *ph_tail;
+  uint32_t zone = mem->zone;
+
+  if (zone >= total_zones || mem->len == 0 ||
+      mem->off < (uint64_t) zone * HUGE_PAGE_SIZE ||
+      mem->off + mem->len > (uint64_t) (zone + 1) * HUGE_PAGE_SIZE)
+  {
+    fprintf(stderr, "packetmem_reserve: invalid range %"PRIx64"+%x zone %u\n",
+        mem->off, mem->len, zone);
+    return -1;
+  }
+
+  pthread_mutex_lock(&pm_mutex);
+  if (zone_populate(zone) != 0) {
+    pthread_mutex_unlock(&pm_mutex);
+    return -1;
+  }
+
+  /* free range containing the reservation */
+  ph_prev = NULL;
+  ph = freelist[zone];
+  while (ph != NULL && ph->base + ph->len <= mem->off) {
+    ph_prev = ph;
+    ph = ph->next;
+  }
+  if (ph == NULL || ph->base > mem->off ||
+      ph->base + ph->len < mem->off + mem->len)
+  {
+    pthread_mutex_unlock(&pm_mutex);
+    fprintf(stderr, "packetmem_reserve: range %"PRIx64"+%x zone %u not free\n",
+        mem->off, mem->len, zone);
+    return -1;
+  }
+
+  if ((ph_new = ph_alloc()) == NULL || (ph_tail = ph_alloc()) == NULL) {
+    pthread_mutex_unlock(&pm_mutex);
+    ph_free(ph_new);
+    fprintf(stderr, "packetmem_reserve: ph_alloc failed\n");
+    return -1;
+  }
+  ph_new->base = mem->off;
+  ph_new->len = mem->len;
+  ph_new->zone = zone;
+  ph_new->next = NULL;
+
+  /* split off what is left behind the reservation, then in front of it */
+  ph_tail->base = mem->off + mem->len;
+  ph_tail->len = ph->base + ph->len - ph_tail->base;
+  ph_tail->zone = zone;
+  ph_tail->next = ph->next;
+  if (ph_tail->len > 0) {
+    ph->next = ph_tail;
+  } else {
+    ph_free(ph_tail);
+  }
+
+  ph->len = mem->off - ph->base;
+  if (ph->len == 0) {
+    if (ph_prev == NULL) {
+      freelist[zone] = ph->next;
+    } else {
+      ph_prev->next = ph->next;
+    }
+    ph_free(ph);
+  }
+
+  nodes[zone_node[zone]].used += mem->len;
+  pthread_mutex_unlock(&pm_mutex);
+
+  *handle = ph_new;
+  return 0;
+}
+
+int packetmem_nic_node(void)
+{
+  return nic_node;
+}
+
+void packetmem_node_stats(unsigned node, struct packetmem_node_stats *st)
+{
+  pthread_mutex_lock(&pm_mutex);
+  *st = nodes[node];
+  pthread_mutex_unlock(&pm_mutex);
 }
 
 /** Merge handles around newly inserted item (pointer to predecessor or NULL
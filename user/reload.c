@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * @brief Runtime configuration reloads.
+ * @file reload.c
+ * @addtogroup tas-sp-reload
+ *
+ * SIGHUP or the console post a semaphore. The reload thread then parses the
+ * command line and configuration files into a new struct configuration,
+ * reports what changed and publishes the struct in #reload_next. The main
+ * loop copies the reloadable fields over in reload_poll() and clears
+ * #reload_next, after which the thread frees the struct, old routes
+ * included. New routes only replace config.routes once the routing table
+ * was rebuilt from them. Until then the thread does not parse again, so
+ * the main loop owns config while a reload is pending.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+
+#include "util/common.h"
+
+#include "flextoe.h"
+#include "internal.h"
+
+static void *reload_main(void *arg);
+
+static pthread_t reload_thread;
+static sem_t reload_sem;
+static int reload_started = 0;
+static int reload_stop = 0;
+static struct configuration *reload_next = NULL;
+
+int reload_init(void)
+{
+  if (sem_init(&reload_sem, 0, 0) != 0) {
+    fprintf(stderr, "reload_init: sem_init failed\n");
+    return -1;
+  }
+
+  if (pthread_create(&reload_thread, NULL, reload_main, NULL) != 0) {
+    fprintf(stderr, "reload_init: pthread_create failed\n");
+    sem_destroy(&reload_sem);
+    return -1;
+  }
+
+  reload_started = 1;
+  return 0;
+}
+
+void reload_request(void)
+{
+  if (reload_started) {
+    sem_post(&reload_sem);
+  }
+}
+
+unsigned reload_poll(void)
+{
+  struct configuration *next;
+  uint32_t idle_to;
+
+  next = __atomic_load_n(&reload_next, __ATOMIC_ACQUIRE);
+  if (next == NULL) {
+    return 0;
+  }
+
+  idle_to = config.tcp_idle_to;
+  if (config_reload_apply(&config, next)) {
+    /* config.routes has to keep matching the table in use */
+    if (routing_update(next->routes) == 0) {
+      config_reload_routes(&config, next);
+    } else {
+      fprintf(stderr, "reload_poll: routes not updated\n");
+    }
+  }
+
+  /* deadlines of open connections depend on it */
+  if (config.tcp_idle_to != idle_to) {
+    keepalive_reconfig();
+  }
+
+  __atomic_store_n(&reload_next, NULL, __ATOMIC_RELEASE);
+  return 1;
+}
+
+void reload_cleanup(void)
+{
+  if (!reload_started) {
+    return;
+  }
+
+  __atomic_store_n(&reload_stop, 1, __ATOMIC_RELEASE);
+  sem_post(&reload_sem);
+  pthread_join(reload_thread, NULL);
+  sem_destroy(&reload_sem);
+  reload_started = 0;
+}
+
+static void *reload_main(void *arg)
+{
+  struct configuration *next;
+  unsigned n;
+
+  while (1) {
+    if (sem_wait(&reload_sem) != 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "reload_main: sem_wait failed\n");
+      break;
+    }
+    if (__atomic_load_n(&reload_stop, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+
+    if ((next = calloc(1, sizeof(*next))) == NULL) {
+      fprintf(stderr, "reload_main: calloc failed\n");
+      continue;
+    }
+
+    if (config_reload(next) != 0) {
+      fprintf(stderr, "config reload: failed, configuration unchanged\n");
+      config_free(next);
+      free(next);
+      continue;
+    }
+
+    n = config_reload_check(&config, next);
+    if (n > 0) {
+      /* the main loop applies it between two rounds of polls */
+      __atomic_store_n(&reload_next, next, __ATOMIC_RELEASE);
+      while (__atomic_load_n(&reload_next, __ATOMIC_ACQUIRE) != NULL &&
+          !__atomic_load_n(&reload_stop, __ATOMIC_ACQUIRE))
+      {
+        usleep(1000);
+      }
+    }
+    if (__atomic_load_n(&reload_next, __ATOMIC_ACQUIRE) == NULL) {
+      fprintf(stderr, "config reload: %u settings applied\n", n);
+    }
+
+    config_free(next);
+    free(next);
+  }
+
+  return NULL;
+}
@@ -3,6 +3,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "flextoe.h"
 #include "internal.h"
@@ -17,57 +18,142 @@ struct routing_table_entry {
   uint32_t next_hop;
 };
 
+/** Binary trie node for longest prefix match */
+struct routing_trie_node {
+  /** Children for next address bit 0 and 1 */
+  struct routing_trie_node *child[2];
+  /** Route for the prefix ending at this node (or NULL) */
+  struct routing_table_entry *rte;
+};
+
+/** Route cache entry: destination to final next hop */
+struct routing_cache_entry {
+  uint32_t ip;
+  uint32_t next_hop;
+  int valid;
+};
+
+/* Number of entries in the direct-mapped route cache */
+#define ROUTING_CACHE_SIZE 4096
+
 static inline uint32_t prefix_len_mask(uint8_t len);
+static int routing_build(const struct config_route *routes,
+    struct routing_table_entry **p_table, size_t *p_len,
+    struct routing_trie_node *root);
+static int trie_insert(struct routing_trie_node *root,
+    struct routing_table_entry *rte, uint8_t prefix);
+static void trie_free(struct routing_trie_node *n);
 static inline struct routing_table_entry *resolve(uint32_t ip);
 
 /** Routing table */
 static struct routing_table_entry *routing_table = NULL;
 static size_t routing_table_len = 0;
+/** LPM trie over routing table */
+static struct routing_trie_node trie_root;
+/** Route cache, flushed when the routes are reloaded */
+static struct routing_cache_entry *routing_cache = NULL;
 
 int routing_init(void)
 {
-  struct config_route *cr;
-  size_t i;
+  if ((routing_cache = calloc(ROUTING_CACHE_SIZE, sizeof(*routing_cache)))
+      == NULL)
+  {
+    fprintf(stderr, "routing_init: allocating route cache failed\n");
+    return -1;
+  }
+
+  return routing_build(config.routes, &routing_table, &routing_table_len,
+      &trie_root);
+}
+
+int routing_update(const struct config_route *routes)
+{
+  struct routing_trie_node root = { .child = { NULL, NULL }, .rte = NULL };
+  struct routing_table_entry *table;
+  size_t len;
+
+  /* build the new table aside, the old one stays on errors */
+  if (routing_build(routes, &table, &len, &root) != 0) {
+    trie_free(&root);
+    return -1;
+  }
+
+  trie_free(&trie_root);
+  free(routing_table);
+  trie_root = root;
+  routing_table = table;
+  routing_table_len = len;
+  memset(routing_cache, 0, ROUTING_CACHE_SIZE * sizeof(*routing_cache));
+  return 0;
+}
+
+/** Fill a table and trie with the network route and @p routes */
+static int routing_build(const struct config_route *routes,
+    struct routing_table_entry **p_table, size_t *p_len,
+    struct routing_trie_node *root)
+{
+  struct routing_table_entry *table;
+  const struct config_route *cr;
+  size_t i, len;
   uint32_t mask;
 
   /* count number of entries to be added */
-  routing_table_len = 1;
-  for (cr = config.routes; cr != NULL; routing_table_len++, cr = cr->next);
+  len = 1;
+  for (cr = routes; cr != NULL; len++, cr = cr->next);
 
   /* allocate table */
-  if ((routing_table = calloc(routing_table_len, sizeof(*routing_table)))
-      == NULL)
-  {
+  if ((table = calloc(len, sizeof(*table))) == NULL) {
     fprintf(stderr, "routing_init: allocating routing table failed\n");
     return -1;
   }
+  *p_table = table;
+  *p_len = len;
 
   /* first fill in network route based on ip and prefix */
   mask = prefix_len_mask(config.ip_prefix);
-  routing_table[0].dest_ip = config.ip & mask;
-  routing_table[0].dest_mask = mask;
-  routing_table[0].next_hop = 0;
+  table[0].dest_ip = config.ip & mask;
+  table[0].dest_mask = mask;
+  table[0].next_hop = 0;
+  if (trie_insert(root, &table[0], config.ip_prefix) != 0) {
+    goto failed;
+  }
 
   /* fill in routing table */
-  for (i = 1, cr = config.routes; cr != NULL; i++, cr = cr->next) {
+  for (i = 1, cr = routes; cr != NULL; i++, cr = cr->next) {
     mask = prefix_len_mask(cr->ip_prefix);
     if ((mask & cr->ip) != cr->ip) {
       fprintf(stderr, "routing_init: mask removes non-0 bits "
           "(d=%x m=%x n=%x)\n", cr->ip, mask, cr->next_hop_ip);
-      return -1;
+      goto failed;
     }
 
-    routing_table[i].dest_ip = cr->ip;
-    routing_table[i].dest_mask = mask;
-    routing_table[i].next_hop = cr->next_hop_ip;
+    table[i].dest_ip = cr->ip;
+    table[i].dest_mask = mask;
+    table[i].next_hop = cr->next_hop_ip;
+    if (trie_insert(root, &table[i], cr->ip_prefix) != 0) {
+      goto failed;
+    }
   }
 
   return 0;
+
+failed:
+  free(table);
+  *p_table = NULL;
+  return -1;
 }
 
 int routing_resolve(struct nicif_completion *comp, uint32_t ip, uint64_t *mac)
 {
   struct routing_table_entry *rte;
+  struct routing_cache_entry *rce;
+  uint32_t dst = ip;
+  size_t hops = 0;
+
+  rce = &routing_cache[(ip * 2654435761u) % ROUTING_CACHE_SIZE];
+  if (rce->valid && rce->ip == ip) {
+    return arp_request(comp, rce->next_hop, mac);
+  }
 
   while (1) {
     rte = resolve(ip);
@@ -80,9 +166,19 @@ int routing_resolve(struct nicif_completion *comp, uint32_t ip, uint64_t *mac)
       break;
     }
 
+    /* guard against routing loops in the configuration */
+    if (++hops > routing_table_len) {
+      fprintf(stderr, "routing_resolve: routing loop for %x\n", dst);
+      return -1;
+    }
+
     ip = rte->next_hop;
   }
 
+  rce->ip = dst;
+  rce->next_hop = ip;
+  rce->valid = 1;
+
   return arp_request(comp, ip, mac);
 }
 
@@ -91,15 +187,60 @@ static inline uint32_t prefix_len_mask(uint8_t len)
   return ~((1ULL << (32 - len)) - 1);
 }
 
+static int trie_insert(struct routing_trie_node *root,
+    struct routing_table_entry *rte, uint8_t prefix)
+{
+  struct routing_trie_node *n = root;
+  uint8_t i, bit;
+
+  for (i = 0; i < prefix; i++) {
+    bit = (rte->dest_ip >> (31 - i)) & 1;
+    if (n->child[bit] == NULL &&
+        (n->child[bit] = calloc(1, sizeof(*n))) == NULL)
+    {
+      fprintf(stderr, "routing_init: allocating trie node failed\n");
+      return -1;
+    }
+    n = n->child[bit];
+  }
+
+  /* first entry for a prefix wins, as in the order of the config */
+  if (n->rte == NULL) {
+    n->rte = rte;
+  }
+  return 0;
+}
+
+/** Free the nodes below n, n itself belongs to the caller */
+static void trie_free(struct routing_trie_node *n)
+{
+  unsigned i;
+
+  for (i = 0; i < 2; i++) {
+    if (n->child[i] != NULL) {
+      trie_free(n->child[i]);
+      free(n->child[i]);
+      n->child[i] = NULL;
+    }
+  }
+  n->rte = NULL;
+}
+
 static inline struct routing_table_entry *resolve(uint32_t ip)
 {
-  size_t i;
+  struct routing_trie_node *n = &trie_root;
+  struct routing_table_entry *rte = NULL;
+  uint8_t i;
 
-  for (i = 0; i < routing_table_len; i++) {
-    if (routing_table[i].dest_ip == (ip & routing_table[i].dest_mask)) {
-      return &routing_table[i];
+  for (i = 0; n != NULL; i++) {
+    if (n->rte != NULL) {
+      rte = n->rte;
+    }
+    if (i == 32) {
+      break;
     }
+    n = n->child[(ip >> (31 - i)) & 1];
   }
 
-  return NULL;
+  return rte;
 }
@@ -8,10 +8,13 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include "util/shm.h"
 #include "util/timeout.h"
@@ -22,18 +25,195 @@
 
 void *flextoe_dma_mem = NULL;
 struct flexnic_info_t *flextoe_info = NULL;
+/** Regions are anonymous memory (see shm_init_anon()) */
+static int shm_anon = 0;
+/** Regions stay in place for a restarted slowpath (see shm_retain()) */
+static int shm_retained = 0;
+/** Page size of the dma memory */
+static size_t shm_page = HUGE_PAGE_SIZE;
+/** Device address of the dma memory, the NIC sees it as one range */
+static uint64_t shm_phys;
+/** Startup timestamps (us), see shm_set_ready() */
+static uint64_t ts_start, ts_shm, ts_ready;
 
-int shm_init(void)
+static uint64_t shm_time_us(void)
 {
-  flextoe_dma_mem = util_create_shm_huge(FLEXNIC_NAME_DMA_MEM, config.shm_len, NULL);
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/** Map the regions a previous slowpath left behind, keeping their contents */
+static int shm_attach(void)
+{
+  flextoe_info = util_map_region(FLEXNIC_NAME_INFO, FLEXNIC_INFO_BYTES);
+  if (flextoe_info == NULL) {
+    fprintf(stderr, "attaching to flextoe_info failed\n");
+    return -1;
+  }
+
+  if (flextoe_info->dma_mem_size != config.shm_len) {
+    fprintf(stderr, "dma memory size does not match (%"PRIu64" != %"PRIu64
+        ")\n", flextoe_info->dma_mem_size, config.shm_len);
+    util_unmap_region(flextoe_info, FLEXNIC_INFO_BYTES);
+    flextoe_info = NULL;
+    return -1;
+  }
+
+  /* zones are populated again as packet memory reserves them */
+  if (flextoe_info->flags & FLEXNIC_FLAG_HUGEPAGES_2M) {
+    shm_page = HUGE_PAGE_SIZE_2M;
+  }
+  flextoe_dma_mem = util_map_region_huge_pg(FLEXNIC_NAME_DMA_MEM,
+      config.shm_len, shm_page);
   if (flextoe_dma_mem == NULL) {
+    fprintf(stderr, "attaching to dma memory failed\n");
+    util_unmap_region(flextoe_info, FLEXNIC_INFO_BYTES);
+    flextoe_info = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/** Prefer the node a zone is assigned to when it is faulted in */
+static int shm_numa_bind(uint32_t zone)
+{
+  unsigned long mask = 1UL << (zone % config.numa_nodes);
+
+  if (config.numa_nodes <= 1 || config.numa_emulate) {
+    return 0;
+  }
+
+  if (syscall(SYS_mbind, (uint8_t *) flextoe_dma_mem +
+        (uint64_t) zone * HUGE_PAGE_SIZE, HUGE_PAGE_SIZE, MPOL_PREFERRED,
+        &mask, config.numa_nodes + 1, 0) != 0)
+  {
+    perror("shm_numa_bind: mbind failed");
+    return -1;
+  }
+  return 0;
+}
+
+int shm_numa_node(const void *addr)
+{
+  int node;
+
+  if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr,
+        MPOL_F_NODE | MPOL_F_ADDR) != 0)
+  {
+    return -1;
+  }
+  return node;
+}
+
+/** The NIC addresses the region as one physical range from its start */
+static int shm_check_contig(uint32_t first, uint32_t n)
+{
+  uint64_t off, end = (uint64_t) (first + n) * HUGE_PAGE_SIZE;
+  uint8_t *base = flextoe_dma_mem;
+
+  if (shm_phys == 0) {
+    shm_phys = util_virt2phy(base);
+  }
+  for (off = (uint64_t) first * HUGE_PAGE_SIZE; off < end; off += shm_page) {
+    if (util_virt2phy(base + off) != shm_phys + off) {
+      fprintf(stderr, "shm_populate: page at offset %"PRIx64" is not "
+          "physically contiguous with the region\n", off);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int shm_populate(uint32_t first, uint32_t n)
+{
+  uint32_t zone;
+  unsigned threads = config.shm_threads;
+
+  if (config.shm_populate == CONFIG_SHM_POPULATE_SERIAL) {
+    threads = 1;
+  }
+  for (zone = first; zone < first + n; zone++) {
+    if (shm_numa_bind(zone) != 0) {
+      return -1;
+    }
+  }
+
+  if (threads == 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (util_populate((uint8_t *) flextoe_dma_mem +
+        (uint64_t) first * HUGE_PAGE_SIZE, (uint64_t) n * HUGE_PAGE_SIZE,
+        shm_page, threads) != 0)
+  {
+    return -1;
+  }
+
+  /* a 1 GB page is a zone of its own, 2 MB pages have to line up like one */
+  if (shm_anon || shm_page == HUGE_PAGE_SIZE) {
+    return 0;
+  }
+  return shm_check_contig(first, n);
+}
+
+/** Create the dma memory on the largest hugepages with enough free pages */
+static void *shm_create(int populate)
+{
+  void *p = NULL;
+
+  if (config.shm_pages != CONFIG_SHM_PAGES_2M) {
+    shm_page = HUGE_PAGE_SIZE;
+    p = util_create_shm_huge_pg(FLEXNIC_NAME_DMA_MEM, config.shm_len,
+        shm_page, populate);
+  }
+  if (p == NULL && config.shm_pages != CONFIG_SHM_PAGES_1G) {
+    if (config.shm_pages == CONFIG_SHM_PAGES_AUTO) {
+      fprintf(stderr, "shm_init: not enough 1 GB hugepages, falling back to "
+          "2 MB pages\n");
+    }
+    shm_page = HUGE_PAGE_SIZE_2M;
+    p = util_create_shm_huge_pg(FLEXNIC_NAME_DMA_MEM, config.shm_len,
+        shm_page, populate);
+  }
+  return p;
+}
+
+int shm_init(void)
+{
+  uint32_t zones = config.shm_len / HUGE_PAGE_SIZE;
+  int serial = (config.shm_populate == CONFIG_SHM_POPULATE_SERIAL);
+  int ret;
+
+  ts_start = shm_time_us();
+  if (config.restore) {
+    ret = shm_attach();
+    ts_shm = shm_time_us();
+    return ret;
+  }
+
+  /* MAP_POPULATE ignores the per zone NUMA policy, bind before faulting */
+  if ((flextoe_dma_mem = shm_create(serial && config.numa_nodes <= 1))
+      == NULL)
+  {
     fprintf(stderr, "dma memory allocation failed\n");
     return -1;
   }
 
+  /* the first zone has the SP rings, the NIC needs its address right away */
+  if (config.shm_populate == CONFIG_SHM_POPULATE_LAZY) {
+    zones = 1;
+  }
+  if (shm_populate(0, zones) != 0) {
+    shm_cleanup();
+    return -1;
+  }
+
   if (!config.quiet) {
-    printf("flextoe_dma_mem virt:%p phy:%p len:%lx\n",
-      (uint8_t*) flextoe_dma_mem, (uint8_t*) util_virt2phy(flextoe_dma_mem), config.shm_len);
+    printf("flextoe_dma_mem virt:%p phy:%p len:%lx pages:%zuM\n",
+      (uint8_t*) flextoe_dma_mem, (uint8_t*) util_virt2phy(flextoe_dma_mem),
+      config.shm_len, shm_page >> 20);
   }
 
   flextoe_info = util_create_shm(FLEXNIC_NAME_INFO, FLEXNIC_INFO_BYTES, NULL);
@@ -50,15 +230,69 @@ int shm_init(void)
   flextoe_info->poll_cycle_app = util_us_to_cyc(config.fp_poll_interval_app);
 
   flextoe_info->flags |= FLEXNIC_FLAG_HUGEPAGES;
+  if (shm_page == HUGE_PAGE_SIZE_2M) {
+    flextoe_info->flags |= FLEXNIC_FLAG_HUGEPAGES_2M;
+  }
 
+  ts_shm = shm_time_us();
   return 0;
 }
 
+/**
+ * Set up the regions in anonymous memory, for running the slowpath against
+ * an in-process device model without hugetlbfs. Nothing is shared with
+ * applications, only with forked children (restarts in spbench).
+ */
+int shm_init_anon(void)
+{
+  ts_start = shm_time_us();
+  flextoe_dma_mem = mmap(NULL, config.shm_len, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (flextoe_dma_mem == MAP_FAILED) {
+    flextoe_dma_mem = NULL;
+    fprintf(stderr, "dma memory allocation failed\n");
+    return -1;
+  }
+
+  flextoe_info = mmap(NULL, FLEXNIC_INFO_BYTES, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (flextoe_info == MAP_FAILED) {
+    flextoe_info = NULL;
+    fprintf(stderr, "flextoe_info allocation failed\n");
+    munmap(flextoe_dma_mem, config.shm_len);
+    flextoe_dma_mem = NULL;
+    return -1;
+  }
+  shm_anon = 1;
+
+  flextoe_info->dma_mem_size = config.shm_len;
+  flextoe_info->cores_num = 1;
+  flextoe_info->mac_address = 0;
+  flextoe_info->poll_cycle_app = util_us_to_cyc(config.fp_poll_interval_app);
+
+  ts_shm = shm_time_us();
+  return 0;
+}
+
+void shm_retain(void)
+{
+  shm_retained = 1;
+}
+
 void shm_cleanup(void)
 {
+  if (shm_anon || shm_retained) {
+    munmap(flextoe_dma_mem, config.shm_len);
+    munmap(flextoe_info, FLEXNIC_INFO_BYTES);
+    flextoe_dma_mem = NULL;
+    flextoe_info = NULL;
+    return;
+  }
+
   /* cleanup dma memory region */
   if (flextoe_dma_mem != NULL) {
-    util_destroy_shm_huge(FLEXNIC_NAME_DMA_MEM, config.shm_len, flextoe_dma_mem);
+    util_destroy_shm_huge_pg(FLEXNIC_NAME_DMA_MEM, config.shm_len, shm_page,
+        flextoe_dma_mem);
   }
 
   /* cleanup flextoe_info memory region */
@@ -70,4 +304,16 @@ void shm_cleanup(void)
 void shm_set_ready(void)
 {
   flextoe_info->flags |= FLEXNIC_FLAG_READY;
+
+  ts_ready = shm_time_us();
+  if (!config.quiet) {
+    printf("startup: ready after %.1f ms, shared memory %.1f ms\n",
+        (ts_ready - ts_start) / 1000.0, (ts_shm - ts_start) / 1000.0);
+  }
+}
+
+void shm_startup_times(uint32_t *shm_us, uint32_t *ready_us)
+{
+  *shm_us = ts_shm - ts_start;
+  *ready_us = (ts_ready != 0 ? ts_ready - ts_start : 0);
 }
@@ -0,0 +1,274 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * @brief Time shared memory setup at slowpath startup.
+ * @file shmbench.c
+ *
+ * Runs the slowpath's shm_init() and packetmem_init() for each region size
+ * and populate mode, on the hugetlbfs mounts the slowpath uses, and prints
+ * how long they take. That is the part of startup that grows with shm-len,
+ * the NIC is not involved. Lazy population moves work from startup to the
+ * first allocation in each zone, so the benchmark also takes one zone sized
+ * allocation after the other until all of packet memory has been handed out.
+ *
+ * Every run is a process of its own, so each starts with unpopulated
+ * hugepages and fresh packetmem state. Results are medians over the
+ * repetitions. Without a NIC device addresses are virtual, so 2 MB pages
+ * pass the contiguity check the slowpath makes for the NIC.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "util/common.h"
+#include "util/shm.h"
+
+#include "flextoe.h"
+#include "internal.h"
+
+struct configuration config;
+
+#define REPS_MAX        64
+
+/** Timings of one run, us */
+struct run_result {
+  int ok;
+  uint32_t pages;                 /*> Page size in MB */
+  uint64_t shm;                   /*> shm_init() */
+  uint64_t ready;                 /*> ... and packetmem_init() */
+  uint64_t all;                   /*> ... and allocating every zone */
+};
+
+static const char *mode_names[] = {
+  [CONFIG_SHM_POPULATE_SERIAL] = "serial",
+  [CONFIG_SHM_POPULATE_PARALLEL] = "parallel",
+  [CONFIG_SHM_POPULATE_LAZY] = "lazy",
+};
+
+/** No NIC here, packet memory prefers the first node */
+int nic_numa_node(void)
+{
+  return 0;
+}
+
+static uint64_t time_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/** One startup, in the forked child */
+static void run_one(struct run_result *r)
+{
+  struct packetmem_handle *h;
+  uint32_t zone, zones = config.shm_len / HUGE_PAGE_SIZE;
+  uintptr_t off;
+  uint64_t t;
+
+  util_set_iova_va();
+  t = time_us();
+  if (shm_init() != 0) {
+    return;
+  }
+  r->shm = time_us() - t;
+  r->pages = (flextoe_info->flags & FLEXNIC_FLAG_HUGEPAGES_2M) ? 2 : 1024;
+
+  if (packetmem_init() != 0) {
+    shm_cleanup();
+    return;
+  }
+  r->ready = time_us() - t;
+
+  for (zone = 0; zone < zones; zone++) {
+    if (packetmem_alloc(HUGE_PAGE_SIZE, &off, &h) != 0) {
+      fprintf(stderr, "shmbench: allocating zone %u failed\n", zone);
+      shm_cleanup();
+      return;
+    }
+  }
+  r->all = time_us() - t;
+
+  shm_cleanup();
+  r->ok = 1;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static double median_ms(struct run_result *rs, unsigned n, size_t field)
+{
+  uint64_t v[REPS_MAX];
+  unsigned i;
+
+  for (i = 0; i < n; i++) {
+    v[i] = *(uint64_t *) ((uint8_t *) &rs[i] + field);
+  }
+  qsort(v, n, sizeof(v[0]), cmp_u64);
+  return v[n / 2] / 1000.0;
+}
+
+/** All repetitions of one size and mode */
+static int run_config(unsigned size_gb, int mode, unsigned reps,
+    struct run_result *rs)
+{
+  unsigned i;
+  int status;
+  pid_t pid;
+
+  config.shm_len = (uint64_t) size_gb * HUGE_PAGE_SIZE;
+  config.shm_populate = mode;
+  memset(rs, 0, reps * sizeof(*rs));
+
+  for (i = 0; i < reps; i++) {
+    fflush(stdout);
+    if ((pid = fork()) < 0) {
+      perror("shmbench: fork failed");
+      return -1;
+    }
+    if (pid == 0) {
+      run_one(&rs[i]);
+      _exit(rs[i].ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != EXIT_SUCCESS)
+    {
+      fprintf(stderr, "shmbench: %u GB %s failed\n", size_gb,
+          mode_names[mode]);
+      return -1;
+    }
+  }
+
+  printf("%7u %9s %6u %10.1f %10.1f %10.1f\n", size_gb, mode_names[mode],
+      rs[0].pages, median_ms(rs, reps, offsetof(struct run_result, shm)),
+      median_ms(rs, reps, offsetof(struct run_result, ready)),
+      median_ms(rs, reps, offsetof(struct run_result, all)));
+  return 0;
+}
+
+static void print_usage(const char *progname)
+{
+  fprintf(stderr, "Usage: %s [OPTION]... [-- SLOWPATH-OPTION...]\n"
+      "  -s, --sizes=LIST      Comma separated region sizes in GB "
+      "[default: 1,2,4]\n"
+      "  -m, --modes=LIST      Populate modes to compare "
+      "[default: serial,parallel,lazy]\n"
+      "  -r, --reps=N          Repetitions per size and mode [default: 3]\n"
+      "  -h, --help            Show this help\n"
+      "Slowpath options after -- are passed on, e.g. --shm-pages=auto or "
+      "--shm-threads.\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+  static const struct option opts[] = {
+    { "sizes", required_argument, NULL, 's' },
+    { "modes", required_argument, NULL, 'm' },
+    { "reps", required_argument, NULL, 'r' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  char default_sizes[] = "1,2,4", default_modes[] = "serial,parallel,lazy";
+  /* config_parse() edits the arguments in place */
+  char ip_arg[] = "--ip-addr=10.0.0.1/8", quiet_arg[] = "--quiet";
+  char *sizes = default_sizes, *modes = default_modes, **sp_argv;
+  char *size_tok, *mode_tok, *size_save, *mode_save, *mode_list;
+  struct run_result *rs;
+  unsigned reps = 3, size_gb;
+  int opt, sp_argc, i, mode, ret = EXIT_SUCCESS;
+
+  while ((opt = getopt_long(argc, argv, "s:m:r:h", opts, NULL)) != -1) {
+    switch (opt) {
+      case 's':
+        sizes = optarg;
+        break;
+      case 'm':
+        modes = optarg;
+        break;
+      case 'r':
+        reps = atoi(optarg);
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (reps == 0 || reps > REPS_MAX) {
+    fprintf(stderr, "shmbench: reps must be 1-%u\n", REPS_MAX);
+    return EXIT_FAILURE;
+  }
+
+  /* slowpath configuration: defaults of the harness, then the user's */
+  sp_argv = calloc(argc + 3, sizeof(*sp_argv));
+  sp_argc = 0;
+  sp_argv[sp_argc++] = argv[0];
+  sp_argv[sp_argc++] = ip_arg;
+  sp_argv[sp_argc++] = quiet_arg;
+  for (i = optind; i < argc; i++) {
+    sp_argv[sp_argc++] = argv[i];
+  }
+  optind = 1;
+  if (config_parse(&config, sp_argc, sp_argv) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  /* results are written by the children */
+  rs = mmap(NULL, REPS_MAX * sizeof(*rs), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (rs == MAP_FAILED) {
+    fprintf(stderr, "shmbench: mmap failed\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("%u threads, median of %u runs, times in ms since shm_init()\n",
+      (config.shm_threads != 0 ? config.shm_threads :
+       (unsigned) sysconf(_SC_NPROCESSORS_ONLN)), reps);
+  printf("%7s %9s %6s %10s %10s %10s\n", "size_gb", "populate", "page_m",
+      "shm", "ready", "all_zones");
+
+  for (size_tok = strtok_r(sizes, ",", &size_save); size_tok != NULL;
+      size_tok = strtok_r(NULL, ",", &size_save))
+  {
+    size_gb = atoi(size_tok);
+    if (size_gb == 0) {
+      fprintf(stderr, "shmbench: invalid size %s\n", size_tok);
+      return EXIT_FAILURE;
+    }
+
+    /* strtok_r() cuts the list, walk a copy for every size */
+    mode_list = strdup(modes);
+    for (mode_tok = strtok_r(mode_list, ",", &mode_save); mode_tok != NULL;
+        mode_tok = strtok_r(NULL, ",", &mode_save))
+    {
+      for (mode = 0; mode <= CONFIG_SHM_POPULATE_LAZY &&
+          strcmp(mode_tok, mode_names[mode]) != 0; mode++);
+      if (mode > CONFIG_SHM_POPULATE_LAZY) {
+        fprintf(stderr, "shmbench: invalid mode %s\n", mode_tok);
+        free(mode_list);
+        return EXIT_FAILURE;
+      }
+
+      if (run_config(size_gb, mode, reps, rs) != 0) {
+        ret = EXIT_FAILURE;
+      }
+    }
+    free(mode_list);
+  }
+
+  return ret;
+}
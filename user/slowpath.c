@@ -28,11 +28,10 @@ static int epfd;
 int debug_reset = 0;
 
 extern void *flextoe_dma_mem;
-int slowpath_main(void)
-{
-  uint32_t last_print = 0;
-  int local_debug_reset = 0;
 
+/** Set up all slowpath modules, the NIC and shared memory are ready */
+int slowpath_init(void)
+{
   sp_notifyfd = eventfd(0, EFD_NONBLOCK);
   assert(sp_notifyfd != -1);
 
@@ -50,44 +49,81 @@ int slowpath_main(void)
   /* initialize timers for timeouts */
   if (util_timeout_init(&timeout_mgr, timeout_trigger, NULL)) {
     fprintf(stderr, "timeout_init failed\n");
-    return EXIT_FAILURE;
+    return -1;
   }
 
   /* initialize routing subsystem */
   if (routing_init()) {
     fprintf(stderr, "routing_init failed\n");
-    return EXIT_FAILURE;
+    return -1;
   }
 
   /* connect to NIC */
   if (nicif_init()) {
     fprintf(stderr, "nicif_init failed\n");
-    return EXIT_FAILURE;
+    return -1;
   }
 
   /* initialize congestion control */
   if (cc_init()) {
     fprintf(stderr, "cc_init failed\n");
-    return EXIT_FAILURE;
+    return -1;
+  }
+
+  if (arp_init()) {
+    fprintf(stderr, "arp_init failed\n");
+    return -1;
+  }
+
+  if (tcp_init()) {
+    fprintf(stderr, "tcp_init failed\n");
+    return -1;
+  }
+
+  if (keepalive_init()) {
+    fprintf(stderr, "keepalive_init failed\n");
+    return -1;
+  }
+
+  /* rebuild state of the previous slowpath, before applications attach */
+  if (config.restore && checkpoint_restore()) {
+    fprintf(stderr, "checkpoint_restore failed\n");
+    return -1;
   }
 
   /* prepare application interface */
   if (appif_init()) {
     fprintf(stderr, "appif_init failed\n");
-    return EXIT_FAILURE;
+    return -1;
   }
 
-  if (arp_init()) {
-    fprintf(stderr, "arp_init failed\n");
-    return EXIT_FAILURE;
+  if (stats_init()) {
+    fprintf(stderr, "stats_init failed\n");
+    return -1;
   }
 
-  if (tcp_init()) {
-    fprintf(stderr, "tcp_init failed\n");
-    return EXIT_FAILURE;
+  if (capture_init()) {
+    fprintf(stderr, "capture_init failed\n");
+    return -1;
+  }
+
+  if (reload_init()) {
+    fprintf(stderr, "reload_init failed\n");
+    return -1;
   }
 
   signal_flextoe_ready();
+  return 0;
+}
+
+int slowpath_main(void)
+{
+  uint32_t last_print = 0;
+  int local_debug_reset = 0;
+
+  if (slowpath_init() != 0) {
+    return EXIT_FAILURE;
+  }
 
   while (exited == 0) {
     unsigned n = 0;
@@ -98,6 +134,9 @@ int slowpath_main(void)
     n += appif_poll();
     tcp_poll();
     util_timeout_poll_ts(&timeout_mgr, cur_ts);
+    n += keepalive_poll(cur_ts);
+    stats_poll(cur_ts);
+    reload_poll();
 
     /* Reset stats if indicated */
     /* NOTE: wraparound not handled because 2^31 resets not possible */
@@ -120,9 +159,21 @@ int slowpath_main(void)
     }
   }
 
+  /* leave the NIC and shared memory running for the next slowpath */
+  if (config.checkpoint_path[0] != 0) {
+    if (checkpoint_write() == 0) {
+      shm_retain();
+    } else {
+      fprintf(stderr, "checkpoint_write failed\n");
+    }
+  }
+
   /* TODO: Gracefully close nicif */
   /* Close appif */
   appif_close();
+  reload_cleanup();
+  stats_cleanup();
+  capture_cleanup();
 
   return EXIT_SUCCESS;
 }
@@ -131,6 +182,7 @@ static void timeout_trigger(struct timeout *to, uint8_t type, void *opaque)
 {
   switch (type) {
     case TO_ARP_REQ:
+    case TO_ARP_PROBE:
       arp_timeout(to, type);
       break;
 
@@ -138,6 +190,10 @@ static void timeout_trigger(struct timeout *to, uint8_t type, void *opaque)
       gratuitous_arp_timeout(to, type);
       break;
 
+    case TO_ARP_GC:
+      arp_gc_timeout(to, type);
+      break;
+
     case TO_TCP_HANDSHAKE:
     case TO_TCP_RETRANSMIT:
     case TO_TCP_CLOSED:
@@ -152,7 +208,13 @@ static void timeout_trigger(struct timeout *to, uint8_t type, void *opaque)
 
 static void signal_flextoe_ready(void)
 {
-  flextoe_info->flags |= FLEXNIC_FLAG_READY;
+  shm_set_ready();
+
+  /* the fast path was started by the previous slowpath */
+  if (config.restore) {
+    return;
+  }
+
   nn_writeq(util_virt2phy(flextoe_dma_mem), &fp_state->cfg.phyaddr);
   nn_writeq(config.shm_len, &fp_state->cfg.memsize);
   nn_writeq(1, &fp_state->cfg.sig);
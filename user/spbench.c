@@ -0,0 +1,1501 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * @brief Replay control traffic through the slowpath and time it.
+ * @file spbench.c
+ *
+ * Runs the slowpath modules against the fake NIC of nic_fake.c and an
+ * application context living in this process, with a peer model on the
+ * other side of the SPRX/SPTX rings: it answers ARP requests and SYNs and
+ * generates handshakes, resets, ARP requests and SYN floods from many hosts,
+ * or replays the frames of a pcap file. The entry points are called one after
+ * the other like in slowpath_main() and each call is timed with rdtsc.
+ *
+ * Per scenario the harness prints the rate, the end-to-end latency of its
+ * events (SYN to accepted connection, open request to opened connection,
+ * close request or RST to close notification, ARP request to reply, open
+ * request to close notification for churn) and the
+ * cycles spent in each entry point per event it handled: packets for
+ * nicif_poll(), requests for appif_ctx_poll(), the return value of
+ * cc_poll() and keepalive_poll(), and SPTX messages posted for tcp_poll()
+ * and the timeouts.
+ *
+ * Active opens go to port PEER_SERVER of the peer hosts, so with a small
+ * --hosts connect and churn storm few backends and every connection needs an
+ * ephemeral port of its own towards the same destination.
+ *
+ * The fake NIC only drains the SPTX ring between calls, so a single call
+ * must not post more than the ring holds: the window of outstanding events
+ * is kept well below nic-tx-len.
+ *
+ * A restart in the scenario list checkpoints the slowpath and continues in a
+ * fresh one restored from the checkpoint. Each slowpath runs in a process of
+ * its own forked off after nic_init(), the fake NIC, packet memory and the
+ * harness state that has to survive the restart are shared memory.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include <rte/ip.h>
+
+#include "util/common.h"
+#include "util/timeout.h"
+#include "util/rng.h"
+
+#include "flextoe.h"
+#include "internal.h"
+#include "appif.h"
+#include "packet_defs.h"
+#include "nic_fake.h"
+#include "sp_checkpoint.h"
+
+struct configuration config;
+int exited = 0;
+
+#define PEER_IP         0x0a010000  /*> 10.1.0.0: peers with connections */
+#define ARP_IP          0x0a020000  /*> 10.2.0.0: peers sending ARP */
+#define FLOOD_IP        0x0a030000  /*> 10.3.0.0: SYN flood sources */
+#define PEER_PORT_MIN   1024
+#define PEER_SERVER     5000        /*> Port peers listen on */
+#define LISTEN_PORT     80
+#define FLOOD_PORT      81
+#define LISTEN_OP       1           /*> Opaque of the accepting listener */
+#define FLOOD_OP        2
+#define APP_ID          0
+/** Doorbell of the harness context, the last one appif_init() hands out */
+#define APP_DB          (FLEXNIC_PL_APPCTX_NUM - 1)
+#define APP_QLEN        64          /*> Entries of the unused data queues */
+#define EXIT_RESTART    2           /*> Phase ended with a restart */
+
+#define PKT_MAX         128
+#define INJECT_LEN      (1 << 16)
+#define SAMPLES_MAX     (1 << 22)
+#define STALL_US        2000000
+
+enum ep_e {
+  EP_NICIF,
+  EP_CC,
+  EP_APPIF,
+  EP_TCP,
+  EP_TIMEOUT,
+  EP_KEEPALIVE,
+  EP_STATS,
+  EP_NUM,
+};
+
+static const char *ep_names[EP_NUM] = {
+  "nicif_poll", "cc_poll", "appif_ctx_poll", "tcp_poll", "timeouts",
+  "keepalive_poll", "stats_poll",
+};
+
+struct samples {
+  uint32_t *v;
+  size_t num;
+  size_t cap;
+};
+
+/** Entry point counters for the current scenario */
+struct ep_stat {
+  uint64_t calls;
+  uint64_t busy;                  /*> Calls that handled events */
+  uint64_t events;
+  uint64_t cycles;
+  struct samples cyc_ev;          /*> Cycles per event of busy calls */
+};
+
+enum hconn_state_e {
+  HC_FREE = 0,
+  HC_OPENING,
+  HC_OPEN,
+  HC_CLOSING,
+  HC_CLOSED,
+};
+
+/** Connection as seen by the application */
+struct hconn {
+  uint64_t t_start;
+  uint64_t opaque;
+  uint32_t remote_ip;
+  uint16_t remote_port;
+  uint16_t local_port;
+  uint8_t state;
+};
+
+/** Frame waiting for room in the SPRX ring */
+struct inject {
+  uint16_t len;
+  uint8_t buf[PKT_MAX];
+};
+
+struct bench_params {
+  uint32_t hosts;                 /*> Distinct peer hosts */
+  uint32_t window;                /*> Outstanding events */
+  uint32_t backlog;
+  uint32_t max_conns;
+  int node;                       /*> NUMA node of the harness context */
+};
+
+static struct bench_params params = {
+  .hosts = 256, .window = 32, .backlog = 1024, .max_conns = 1 << 20,
+  .node = PACKETMEM_NODE_NIC,
+};
+
+/** Harness state surviving a restart, see run_restarts() */
+struct bench_shared {
+  uint32_t conns_num;
+  uint32_t accepted_num;
+  uint32_t accepts_pending;
+  uint32_t injq_head;
+  uint32_t injq_num;
+  uint32_t app_spin_pos;
+  uint32_t app_spout_pos;
+  int flood_listening;
+  uint64_t peer_rsts;
+  uint64_t peer_synacks;
+};
+
+static struct app_context *ctx;
+static struct bench_shared *sh;
+
+static struct ep_stat eps[EP_NUM];
+static struct hconn *conns;
+/** Connections by accept order, accepts use opaque max_conns + order */
+static uint32_t *accepted;
+static struct samples lat;
+static uint64_t tsc_per_us;
+
+static struct inject *injq;
+
+/* scenario progress */
+static uint64_t done;
+static uint64_t failed;
+static uint64_t flood_newconns;
+static uint64_t *arp_start;
+
+static int listen_done;
+static int listen_status;
+/** Churn scenario: a connection is done once it was opened and closed */
+static int churn;
+
+static void samples_add(struct samples *s, uint64_t v)
+{
+  if (s->num == s->cap) {
+    if (s->cap == SAMPLES_MAX) {
+      return;
+    }
+    s->cap = (s->cap == 0 ? 1024 : s->cap * 2);
+    if ((s->v = realloc(s->v, s->cap * sizeof(*s->v))) == NULL) {
+      fprintf(stderr, "spbench: realloc failed\n");
+      abort();
+    }
+  }
+  s->v[s->num++] = (v > UINT32_MAX ? UINT32_MAX : v);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+static uint32_t samples_pct(struct samples *s, unsigned permille)
+{
+  if (s->num == 0) {
+    return 0;
+  }
+  return s->v[(uint64_t) (s->num - 1) * permille / 1000];
+}
+
+static inline uint64_t peer_mac(uint32_t ip)
+{
+  /* locally administered, ip in the low bytes */
+  return 0x02 | ((uint64_t) htonl(ip) << 16);
+}
+
+/*****************************************************************************/
+/* Peer side */
+
+static void inject(const void *pkt, uint16_t len)
+{
+  struct inject *in;
+
+  if (sh->injq_num == INJECT_LEN) {
+    fprintf(stderr, "spbench: injection queue full\n");
+    abort();
+  }
+  in = &injq[(sh->injq_head + sh->injq_num) % INJECT_LEN];
+  memcpy(in->buf, pkt, len);
+  in->len = len;
+  sh->injq_num++;
+}
+
+static void inject_flush(void)
+{
+  struct inject *in;
+
+  while (sh->injq_num > 0) {
+    in = &injq[sh->injq_head];
+    if (nic_fake_rx(in->buf, in->len, 0) != 0) {
+      return;
+    }
+    sh->injq_head = (sh->injq_head + 1) % INJECT_LEN;
+    sh->injq_num--;
+  }
+}
+
+static void send_arp(uint16_t oper, uint32_t spa, uint32_t tpa,
+    uint64_t tha)
+{
+  struct pkt_arp p;
+  uint64_t sha = peer_mac(spa);
+
+  memset(&p, 0, sizeof(p));
+  memcpy(&p.eth.src, &sha, ETH_ADDR_LEN);
+  memcpy(&p.eth.dest, &tha, ETH_ADDR_LEN);
+  p.eth.type = t_beui16(ETH_TYPE_ARP);
+  p.arp.htype = t_beui16(ARP_HTYPE_ETHERNET);
+  p.arp.ptype = t_beui16(ARP_PTYPE_IPV4);
+  p.arp.hlen = 6;
+  p.arp.plen = 4;
+  p.arp.oper = t_beui16(oper);
+  memcpy(&p.arp.sha, &sha, ETH_ADDR_LEN);
+  p.arp.spa = t_beui32(spa);
+  memcpy(&p.arp.tha, &tha, ETH_ADDR_LEN);
+  p.arp.tpa = t_beui32(tpa);
+  inject(&p, sizeof(p));
+}
+
+/** TCP segment from a peer, SYNs carry MSS, timestamp and SACK options */
+static void send_tcp(uint32_t src_ip, uint16_t src_port, uint16_t dst_port,
+    uint32_t seq, uint32_t ack, uint16_t flags, uint32_t ts_ecr)
+{
+  uint8_t buf[PKT_MAX];
+  struct pkt_tcp *p = (struct pkt_tcp *) buf;
+  uint8_t *opt = (uint8_t *) (p + 1);
+  uint64_t src_mac = peer_mac(src_ip), dst_mac = NIC_FAKE_MAC;
+  uint16_t optlen = 0, len;
+
+  memset(buf, 0, sizeof(buf));
+  if ((flags & TCP_SYN) == TCP_SYN) {
+    struct tcp_mss_opt *mss = (struct tcp_mss_opt *) opt;
+    struct tcp_sack_permitted_opt *sack =
+      (struct tcp_sack_permitted_opt *) (opt + 4);
+    struct tcp_timestamp_opt *ts = (struct tcp_timestamp_opt *) (opt + 6);
+
+    mss->kind = TCP_OPT_MSS;
+    mss->length = sizeof(*mss);
+    mss->mss = t_beui16(1460);
+    sack->kind = TCP_OPT_SACK_PERMITTED;
+    sack->length = sizeof(*sack);
+    ts->kind = TCP_OPT_TIMESTAMP;
+    ts->length = sizeof(*ts);
+    ts->ts_val = t_beui32(1);
+    ts->ts_ecr = t_beui32(ts_ecr);
+    memset(opt + 16, TCP_OPT_NO_OP, 4);
+    optlen = 20;
+  }
+  len = sizeof(*p) + optlen;
+
+  memcpy(&p->eth.src, &src_mac, ETH_ADDR_LEN);
+  memcpy(&p->eth.dest, &dst_mac, ETH_ADDR_LEN);
+  p->eth.type = t_beui16(ETH_TYPE_IP);
+
+  IPH_VHL_SET(&p->ip, 4, 5);
+  p->ip.len = t_beui16(len - offsetof(struct pkt_tcp, ip));
+  p->ip.ttl = 64;
+  p->ip.proto = IP_PROTO_TCP;
+  p->ip.src = t_beui32(src_ip);
+  p->ip.dest = t_beui32(config.ip);
+
+  p->tcp.src = t_beui16(src_port);
+  p->tcp.dest = t_beui16(dst_port);
+  p->tcp.seqno = t_beui32(seq);
+  p->tcp.ackno = t_beui32(ack);
+  TCPH_HDRLEN_FLAGS_SET(&p->tcp, 5 + optlen / 4, flags);
+  p->tcp.wnd = t_beui16(65535);
+
+  p->ip.chksum = rte_ipv4_cksum((void *) &p->ip);
+  p->tcp.chksum = rte_ipv4_udptcp_cksum((void *) &p->ip, (void *) &p->tcp);
+  inject(buf, len);
+}
+
+/** Tuple of peer connection @p i towards the listener */
+static inline void peer_tuple(uint32_t i, uint32_t *ip, uint16_t *port)
+{
+  *ip = PEER_IP + i % params.hosts;
+  *port = PEER_PORT_MIN + i / params.hosts;
+}
+
+static inline int peer_conn(uint32_t ip, uint16_t port, uint32_t *i)
+{
+  if (ip < PEER_IP || ip >= PEER_IP + params.hosts || port < PEER_PORT_MIN) {
+    return -1;
+  }
+  *i = (uint32_t) (port - PEER_PORT_MIN) * params.hosts + (ip - PEER_IP);
+  return *i < sh->conns_num ? 0 : -1;
+}
+
+static void peer_tcp(const struct pkt_tcp *p, uint16_t len)
+{
+  uint16_t flags = TCPH_FLAGS(&p->tcp);
+  const uint8_t *opt = (const uint8_t *) (p + 1);
+  const uint8_t *end = (const uint8_t *) p + len;
+  uint32_t ts_val = 0;
+
+  if ((flags & TCP_RST) == TCP_RST) {
+    sh->peer_rsts++;
+    return;
+  }
+  if ((flags & (TCP_SYN | TCP_ACK)) == (TCP_SYN | TCP_ACK)) {
+    sh->peer_synacks++;
+    return;
+  }
+  if ((flags & TCP_SYN) != TCP_SYN) {
+    return;
+  }
+
+  /* active open: answer with a SYN-ACK echoing the timestamp */
+  while (opt < end && *opt != TCP_OPT_END_OF_OPTIONS) {
+    if (*opt == TCP_OPT_NO_OP) {
+      opt++;
+      continue;
+    }
+    if (opt + 1 >= end || opt[1] < 2) {
+      break;
+    }
+    if (*opt == TCP_OPT_TIMESTAMP && opt + 10 <= end) {
+      memcpy(&ts_val, opt + 2, sizeof(ts_val));
+      ts_val = ntohl(ts_val);
+    }
+    opt += opt[1];
+  }
+  send_tcp(f_beui32(p->ip.dest), f_beui16(p->tcp.dest), f_beui16(p->tcp.src),
+      1000, f_beui32(p->tcp.seqno) + 1, TCP_SYN | TCP_ACK, ts_val);
+}
+
+static void peer_arp(const struct pkt_arp *p)
+{
+  uint32_t tpa = f_beui32(p->arp.tpa), i;
+  uint64_t tha = 0;
+
+  if (f_beui16(p->arp.oper) == ARP_OPER_REQUEST) {
+    /* gratuitous requests for our own address need no answer */
+    if (tpa != config.ip) {
+      memcpy(&tha, &p->arp.sha, ETH_ADDR_LEN);
+      send_arp(ARP_OPER_REPLY, tpa, config.ip, tha);
+    }
+  } else if (f_beui16(p->arp.oper) == ARP_OPER_REPLY && arp_start != NULL &&
+      tpa >= ARP_IP && tpa < ARP_IP + params.hosts)
+  {
+    i = tpa - ARP_IP;
+    if (arp_start[i] != 0) {
+      samples_add(&lat, util_rdtsc() - arp_start[i]);
+      arp_start[i] = 0;
+      done++;
+    }
+  }
+}
+
+/** Take everything the slowpath posted off the SPTX ring */
+static void peer_drain(void)
+{
+  struct nic_fake_tx tx;
+  const struct eth_hdr *eth;
+
+  while (nic_fake_tx(&tx)) {
+    if (tx.pkt == NULL || tx.len < sizeof(*eth)) {
+      continue;
+    }
+    eth = tx.pkt;
+    if (f_beui16(eth->type) == ETH_TYPE_ARP &&
+        tx.len >= sizeof(struct pkt_arp))
+    {
+      peer_arp(tx.pkt);
+    } else if (f_beui16(eth->type) == ETH_TYPE_IP &&
+        tx.len >= sizeof(struct pkt_tcp) &&
+        ((const struct pkt_ip *) tx.pkt)->ip.proto == IP_PROTO_TCP)
+    {
+      peer_tcp(tx.pkt, tx.len);
+    }
+  }
+}
+
+/*****************************************************************************/
+/* Application side */
+
+static int app_post(const struct sp_appout *req)
+{
+  volatile struct sp_appout *spin =
+    (struct sp_appout *) ctx->spin_base + sh->app_spin_pos;
+
+  if (spin->type != SP_APPOUT_INVALID) {
+    return -1;
+  }
+  memcpy((void *) &spin->data, &req->data, sizeof(req->data));
+  MEM_BARRIER();
+  spin->type = req->type;
+  sh->app_spin_pos = (sh->app_spin_pos + 1) % ctx->spin_len;
+  return 0;
+}
+
+static void app_conn_done(uint64_t opaque, int status,
+    enum hconn_state_e state)
+{
+  struct hconn *c;
+
+  if (opaque >= params.max_conns) {
+    opaque = accepted[opaque - params.max_conns];
+  }
+  c = &conns[opaque];
+
+  if (status != 0) {
+    failed++;
+    c->state = HC_FREE;
+    return;
+  }
+  if (churn && state == HC_OPEN) {
+    c->state = state;
+    return;
+  }
+  samples_add(&lat, util_rdtsc() - c->t_start);
+  c->state = state;
+  done++;
+}
+
+/** Handle sp -> app notifications */
+static void app_poll(void)
+{
+  volatile struct sp_appin *spout;
+  struct sp_appout req;
+  uint8_t type;
+  uint32_t i;
+
+  for (;;) {
+    spout = (struct sp_appin *) ctx->spout_base + sh->app_spout_pos;
+    if ((type = spout->type) == SP_APPIN_INVALID) {
+      break;
+    }
+    MEM_BARRIER();
+
+    switch (type) {
+      case SP_APPIN_STATUS_LISTEN_OPEN:
+        listen_done = 1;
+        listen_status = spout->data.status.status;
+        break;
+
+      case SP_APPIN_LISTEN_NEWCONN:
+        if (spout->data.listen_newconn.opaque == LISTEN_OP) {
+          sh->accepts_pending++;
+        } else {
+          flood_newconns++;
+        }
+        break;
+
+      case SP_APPIN_ACCEPTED_CONN:
+        if (spout->data.accept_connection.status != 0 ||
+            peer_conn(spout->data.accept_connection.remote_ip,
+              spout->data.accept_connection.remote_port, &i) != 0)
+        {
+          failed++;
+          break;
+        }
+        conns[i].opaque = spout->data.accept_connection.opaque;
+        conns[i].local_port = LISTEN_PORT;
+        accepted[conns[i].opaque - params.max_conns] = i;
+        app_conn_done(i, 0, HC_OPEN);
+        break;
+
+      case SP_APPIN_CONN_OPENED:
+        i = spout->data.conn_opened.opaque;
+        conns[i].local_port = spout->data.conn_opened.local_port;
+        app_conn_done(i, spout->data.conn_opened.status, HC_OPEN);
+        break;
+
+      case SP_APPIN_STATUS_CONN_CLOSE:
+        app_conn_done(spout->data.status.opaque, spout->data.status.status,
+            HC_CLOSED);
+        break;
+
+      default:
+        fprintf(stderr, "spbench: unexpected notification %u\n", type);
+        break;
+    }
+
+    MEM_BARRIER();
+    spout->type = SP_APPIN_INVALID;
+    sh->app_spout_pos = (sh->app_spout_pos + 1) % ctx->spout_len;
+  }
+
+  /* accept as many connections as were announced */
+  while (sh->accepts_pending > 0) {
+    memset(&req, 0, sizeof(req));
+    req.type = SP_APPOUT_ACCEPT_CONN;
+    req.data.accept_conn.listen_opaque = LISTEN_OP;
+    req.data.accept_conn.conn_opaque =
+      params.max_conns + sh->accepted_num++;
+    req.data.accept_conn.local_port = LISTEN_PORT;
+    if (app_post(&req) != 0) {
+      break;
+    }
+    sh->accepts_pending--;
+  }
+}
+
+/** Look up the harness context, after app_init() or a restore */
+static int app_attach(void)
+{
+  if ((ctx = appif_ctx_lookup(APP_ID, APP_DB)) == NULL) {
+    fprintf(stderr, "spbench: harness context not found\n");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * The harness context is registered like a restored one: its queues are in
+ * packet memory so that a checkpoint covers it, and it has no eventfd.
+ */
+static int app_init(void)
+{
+  struct sp_ckpt_ctx rec;
+  struct sp_ckpt_mem *mems[4] = { &rec.spin, &rec.spout, &rec.rxq, &rec.txq };
+  struct packetmem_handle *h[4];
+  size_t lens[4];
+  uintptr_t off;
+  unsigned i;
+
+  memset(&rec, 0, sizeof(rec));
+  rec.app_id = APP_ID;
+  rec.db_id = APP_DB;
+  rec.spin_len = config.app_spin_len / sizeof(struct sp_appout);
+  rec.spout_len = config.app_spout_len / sizeof(struct sp_appin);
+  rec.rxq_len = APP_QLEN;
+  rec.txq_len = APP_QLEN;
+  rec.numa_node = (params.node == PACKETMEM_NODE_NIC ?
+      packetmem_nic_node() : params.node);
+  lens[0] = rec.spin_len * sizeof(struct sp_appout);
+  lens[1] = rec.spout_len * sizeof(struct sp_appin);
+  lens[2] = APP_QLEN * sizeof(struct flextcp_pl_arx_t);
+  lens[3] = APP_QLEN * sizeof(struct flextcp_pl_atx_t);
+
+  /* pick free ranges, appif_restore() takes them again */
+  for (i = 0; i < 4; i++) {
+    if (packetmem_alloc_node(lens[i], rec.numa_node, &off, &h[i]) != 0) {
+      fprintf(stderr, "spbench: allocating app queues failed\n");
+      return -1;
+    }
+    memset((uint8_t *) flextoe_dma_mem + off, 0, lens[i]);
+    packetmem_checkpoint(h[i], mems[i]);
+  }
+  for (i = 0; i < 4; i++) {
+    packetmem_free(h[i]);
+  }
+
+  if (appif_restore(&rec, 1) != 0) {
+    return -1;
+  }
+  return app_attach();
+}
+
+/*****************************************************************************/
+/* Driving the slowpath */
+
+static inline void ep_account(enum ep_e ep, uint64_t cyc, unsigned events)
+{
+  struct ep_stat *s = &eps[ep];
+
+  s->calls++;
+  s->cycles += cyc;
+  if (events > 0) {
+    s->busy++;
+    s->events += events;
+    samples_add(&s->cyc_ev, cyc / events);
+  }
+}
+
+/** One round over the slowpath entry points, like slowpath_main() */
+static void step(void)
+{
+  uint64_t t;
+  unsigned n;
+
+  cur_ts = util_timeout_time_us();
+  inject_flush();
+
+  t = util_rdtsc();
+  n = nicif_poll();
+  ep_account(EP_NICIF, util_rdtsc() - t, n);
+  peer_drain();
+
+  t = util_rdtsc();
+  n = cc_poll(cur_ts);
+  ep_account(EP_CC, util_rdtsc() - t, n);
+  peer_drain();
+
+  do {
+    app_poll();
+    t = util_rdtsc();
+    n = appif_ctx_poll(ctx->app, ctx);
+    ep_account(EP_APPIF, util_rdtsc() - t, n);
+    peer_drain();
+  } while (n != 0);
+
+  t = util_rdtsc();
+  tcp_poll();
+  ep_account(EP_TCP, util_rdtsc() - t, nic_fake_tx_pending());
+  peer_drain();
+
+  t = util_rdtsc();
+  util_timeout_poll_ts(&timeout_mgr, cur_ts);
+  ep_account(EP_TIMEOUT, util_rdtsc() - t, nic_fake_tx_pending());
+  peer_drain();
+
+  t = util_rdtsc();
+  n = keepalive_poll(cur_ts);
+  ep_account(EP_KEEPALIVE, util_rdtsc() - t, n);
+  peer_drain();
+
+  t = util_rdtsc();
+  stats_poll(cur_ts);
+  ep_account(EP_STATS, util_rdtsc() - t, 0);
+
+  app_poll();
+}
+
+/** Step until @p cond holds, 0 if it did before the slowpath stalled */
+static int step_until(int (*cond)(void))
+{
+  uint64_t last = done + failed;
+  uint32_t ts = util_timeout_time_us();
+
+  while (!cond()) {
+    step();
+    if (done + failed != last) {
+      last = done + failed;
+      ts = cur_ts;
+    } else if (cur_ts - ts > STALL_US) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int listen_cond(void)
+{
+  return listen_done;
+}
+
+static int open_listener(uint64_t opaque, uint16_t port, uint32_t backlog)
+{
+  struct sp_appout req;
+
+  memset(&req, 0, sizeof(req));
+  req.type = SP_APPOUT_LISTEN_OPEN;
+  req.data.listen_open.opaque = opaque;
+  req.data.listen_open.local_port = port;
+  req.data.listen_open.backlog = backlog;
+
+  listen_done = 0;
+  if (app_post(&req) != 0 || step_until(listen_cond) != 0 ||
+      listen_status != 0)
+  {
+    fprintf(stderr, "spbench: opening listener on port %u failed\n", port);
+    return -1;
+  }
+  return 0;
+}
+
+/*****************************************************************************/
+/* Scenarios */
+
+static uint64_t scen_n;
+static uint64_t scen_issued;
+static uint64_t scen_t0;
+
+static void scen_begin(void)
+{
+  unsigned i;
+
+  for (i = 0; i < EP_NUM; i++) {
+    free(eps[i].cyc_ev.v);
+    memset(&eps[i], 0, sizeof(eps[i]));
+  }
+  lat.num = 0;
+  done = failed = scen_issued = 0;
+  scen_t0 = util_rdtsc();
+}
+
+static void scen_end(const char *name, const char *unit, int has_lat)
+{
+  double secs = (double) (util_rdtsc() - scen_t0) / tsc_per_us / 1e6;
+  struct ep_stat *s;
+  unsigned i;
+
+  printf("\n%s: %"PRIu64" of %"PRIu64" done, %"PRIu64" failed, "
+      "%.3f s, %.0f %s/s\n", name, done, scen_n, failed, secs,
+      secs > 0 ? done / secs : 0, unit);
+
+  if (has_lat && lat.num > 0) {
+    qsort(lat.v, lat.num, sizeof(*lat.v), cmp_u32);
+    printf("  latency [us]   p50 %9.1f  p99 %9.1f  p99.9 %9.1f  max %9.1f\n",
+        (double) samples_pct(&lat, 500) / tsc_per_us,
+        (double) samples_pct(&lat, 990) / tsc_per_us,
+        (double) samples_pct(&lat, 999) / tsc_per_us,
+        (double) samples_pct(&lat, 1000) / tsc_per_us);
+  }
+
+  printf("  %-15s %10s %9s %9s %9s %8s %8s %8s %8s\n", "entry point",
+      "calls", "busy", "events", "cyc/call", "cyc/ev", "p50", "p99",
+      "max");
+  for (i = 0; i < EP_NUM; i++) {
+    s = &eps[i];
+    qsort(s->cyc_ev.v, s->cyc_ev.num, sizeof(*s->cyc_ev.v), cmp_u32);
+    printf("  %-15s %10"PRIu64" %9"PRIu64" %9"PRIu64" %9.0f %8.0f %8u %8u "
+        "%8u\n", ep_names[i], s->calls, s->busy, s->events,
+        s->calls ? (double) s->cycles / s->calls : 0,
+        s->events ? (double) s->cycles / s->events : 0,
+        samples_pct(&s->cyc_ev, 500), samples_pct(&s->cyc_ev, 990),
+        samples_pct(&s->cyc_ev, 1000));
+  }
+}
+
+/** Run until the scenario is done, @p offer issues new events */
+static void scen_run(void (*offer)(void))
+{
+  uint64_t last = 0;
+  uint32_t ts = util_timeout_time_us();
+
+  while (done + failed < scen_n) {
+    offer();
+    step();
+    if (done + failed != last) {
+      last = done + failed;
+      ts = cur_ts;
+    } else if (cur_ts - ts > STALL_US) {
+      fprintf(stderr, "spbench: stalled after %"PRIu64" events\n", last);
+      return;
+    }
+  }
+}
+
+static uint32_t conn_first;
+
+static void accept_offer(void)
+{
+  uint32_t i, ip;
+  uint16_t port;
+
+  while (scen_issued < scen_n && scen_issued - done - failed < params.window) {
+    i = conn_first + scen_issued++;
+    peer_tuple(i, &ip, &port);
+    conns[i].t_start = util_rdtsc();
+    conns[i].remote_ip = ip;
+    conns[i].remote_port = port;
+    conns[i].state = HC_OPENING;
+    send_tcp(ip, port, LISTEN_PORT, 1, 0, TCP_SYN | TCP_ECE | TCP_CWR, 0);
+  }
+}
+
+static void connect_offer(void)
+{
+  struct sp_appout req;
+  struct hconn *c;
+  uint32_t i;
+
+  while (scen_issued < scen_n && scen_issued - done - failed < params.window) {
+    i = conn_first + scen_issued;
+    c = &conns[i];
+    c->remote_ip = PEER_IP + i % params.hosts;
+    c->remote_port = PEER_SERVER;
+
+    memset(&req, 0, sizeof(req));
+    req.type = SP_APPOUT_CONN_OPEN;
+    req.data.conn_open.opaque = c->opaque = i;
+    req.data.conn_open.remote_ip = c->remote_ip;
+    req.data.conn_open.remote_port = c->remote_port;
+    if (app_post(&req) != 0) {
+      return;
+    }
+    c->t_start = util_rdtsc();
+    c->state = HC_OPENING;
+    scen_issued++;
+  }
+}
+
+static int conns_alloc(uint64_t n)
+{
+  /* passive tuples encode the index, keep them in the port range */
+  if (sh->conns_num + n > params.max_conns ||
+      (sh->conns_num + n) / params.hosts + PEER_PORT_MIN > UINT16_MAX)
+  {
+    fprintf(stderr, "spbench: too many connections, at most %u\n",
+        params.max_conns);
+    return -1;
+  }
+  conn_first = sh->conns_num;
+  sh->conns_num += n;
+  return 0;
+}
+
+static void scen_accept(uint64_t n)
+{
+  if (conns_alloc(n) != 0) {
+    return;
+  }
+  scen_n = n;
+  scen_begin();
+  scen_run(accept_offer);
+  scen_end("accept", "conn", 1);
+}
+
+static void scen_connect(uint64_t n)
+{
+  if (conns_alloc(n) != 0) {
+    return;
+  }
+  scen_n = n;
+  scen_begin();
+  scen_run(connect_offer);
+  scen_end("connect", "conn", 1);
+}
+
+/** Post a close for an open connection, 0 if there was room in the queue */
+static int conn_close_post(struct hconn *c)
+{
+  struct sp_appout req;
+
+  memset(&req, 0, sizeof(req));
+  req.type = SP_APPOUT_CONN_CLOSE;
+  req.data.conn_close.opaque = c->opaque;
+  req.data.conn_close.remote_ip = c->remote_ip;
+  req.data.conn_close.local_ip = config.ip;
+  req.data.conn_close.remote_port = c->remote_port;
+  req.data.conn_close.local_port = c->local_port;
+  return app_post(&req);
+}
+
+static uint32_t close_pos;
+static int close_rst;
+
+static void close_offer(void)
+{
+  struct hconn *c;
+
+  while (scen_issued < scen_n && scen_issued - done - failed < params.window &&
+      close_pos < sh->conns_num)
+  {
+    c = &conns[close_pos];
+    if (c->state != HC_OPEN) {
+      close_pos++;
+      continue;
+    }
+
+    if (close_rst) {
+      send_tcp(c->remote_ip, c->remote_port, c->local_port, 0, 0, TCP_RST, 0);
+    } else if (conn_close_post(c) != 0) {
+      return;
+    }
+    c->t_start = util_rdtsc();
+    c->state = HC_CLOSING;
+    close_pos++;
+    scen_issued++;
+  }
+}
+
+static void scen_close(uint64_t n, int rst)
+{
+  uint32_t i, open = 0;
+
+  for (i = 0; i < sh->conns_num; i++) {
+    open += (conns[i].state == HC_OPEN);
+  }
+  scen_n = (n == 0 || n > open ? open : n);
+  close_pos = 0;
+  close_rst = rst;
+  scen_begin();
+  scen_run(close_offer);
+  scen_end(rst ? "rst" : "close", "conn", 1);
+}
+
+static uint32_t churn_conns;
+
+/**
+ * Each of the window's connections is opened towards its backend, closed as
+ * soon as it is open and then opened again. The request and response in
+ * between are fastpath traffic, the slowpath does not see them.
+ */
+static void churn_offer(void)
+{
+  struct sp_appout req;
+  struct hconn *c;
+  uint32_t i;
+
+  for (i = conn_first; i < conn_first + churn_conns; i++) {
+    c = &conns[i];
+    if (c->state == HC_OPEN) {
+      if (conn_close_post(c) != 0) {
+        return;
+      }
+      c->state = HC_CLOSING;
+    } else if ((c->state == HC_FREE || c->state == HC_CLOSED) &&
+        scen_issued < scen_n)
+    {
+      memset(&req, 0, sizeof(req));
+      req.type = SP_APPOUT_CONN_OPEN;
+      req.data.conn_open.opaque = c->opaque = i;
+      req.data.conn_open.remote_ip = c->remote_ip;
+      req.data.conn_open.remote_port = c->remote_port;
+      if (app_post(&req) != 0) {
+        return;
+      }
+      c->t_start = util_rdtsc();
+      c->state = HC_OPENING;
+      scen_issued++;
+    }
+  }
+}
+
+/** @p n open-close cycles over window connections, few backends */
+static void scen_churn(uint64_t n)
+{
+  uint32_t i;
+
+  churn_conns = params.window;
+  if (conns_alloc(churn_conns) != 0) {
+    return;
+  }
+  for (i = conn_first; i < conn_first + churn_conns; i++) {
+    conns[i].remote_ip = PEER_IP + i % params.hosts;
+    conns[i].remote_port = PEER_SERVER;
+    conns[i].state = HC_FREE;
+  }
+
+  churn = 1;
+  scen_n = n;
+  scen_begin();
+  scen_run(churn_offer);
+  scen_end("churn", "conn", 1);
+  churn = 0;
+}
+
+static uint32_t arp_next;
+
+static void arp_offer(void)
+{
+  uint32_t i;
+
+  while (scen_issued < scen_n && scen_issued - done - failed < params.window) {
+    /* hosts with a request in flight wait for the next round */
+    i = arp_next;
+    if (arp_start[i] != 0) {
+      return;
+    }
+    arp_next = (arp_next + 1) % params.hosts;
+    arp_start[i] = util_rdtsc();
+    send_arp(ARP_OPER_REQUEST, ARP_IP + i, config.ip, 0);
+    scen_issued++;
+  }
+}
+
+static void scen_arp(uint64_t n)
+{
+  arp_start = calloc(params.hosts, sizeof(*arp_start));
+  if (arp_start == NULL) {
+    fprintf(stderr, "spbench: calloc failed\n");
+    return;
+  }
+  arp_next = 0;
+  scen_n = n;
+  scen_begin();
+  scen_run(arp_offer);
+  scen_end("arp", "req", 1);
+  free(arp_start);
+  arp_start = NULL;
+}
+
+static uint64_t rx_base;
+static struct utils_rng flood_rng;
+
+static void flood_offer(void)
+{
+  struct nic_fake_stats st;
+  uint32_t r;
+
+  /* packets consumed by the slowpath are done, rx_base skips earlier ones */
+  nic_fake_stats(&st);
+  done = (st.rx_packets > rx_base ? st.rx_packets - rx_base : 0);
+
+  while (scen_issued < scen_n && sh->injq_num < INJECT_LEN / 2) {
+    r = utils_rng_gen32(&flood_rng);
+    send_tcp(FLOOD_IP + (r & 0xffff), PEER_PORT_MIN + (r >> 16) % 60000,
+        FLOOD_PORT, r, 0, TCP_SYN, 0);
+    scen_issued++;
+  }
+}
+
+static void scen_synflood(uint64_t n)
+{
+  struct nic_fake_stats st;
+
+  if (!sh->flood_listening) {
+    if (open_listener(FLOOD_OP, FLOOD_PORT, params.backlog) != 0) {
+      return;
+    }
+    sh->flood_listening = 1;
+  }
+
+  utils_rng_init(&flood_rng, 1);
+  scen_n = n;
+  scen_begin();
+  nic_fake_stats(&st);
+  rx_base = st.rx_packets + sh->injq_num;
+  flood_newconns = 0;
+  scen_run(flood_offer);
+  scen_end("synflood", "syn", 0);
+  printf("  %"PRIu64" SYNs were announced to the app, the rest was dropped\n",
+      flood_newconns);
+}
+
+/*****************************************************************************/
+/* pcap replay */
+
+#define PCAP_MAGIC      0xa1b2c3d4
+#define PCAP_MAGIC_NS   0xa1b23c4d
+#define PCAP_LINK_ETH   1
+
+struct pcap_hdr {
+  uint32_t magic;
+  uint16_t version_major;
+  uint16_t version_minor;
+  int32_t thiszone;
+  uint32_t sigfigs;
+  uint32_t snaplen;
+  uint32_t network;
+};
+
+struct pcap_rec {
+  uint32_t ts_sec;
+  uint32_t ts_frac;
+  uint32_t incl_len;
+  uint32_t orig_len;
+};
+
+static FILE *pcap_f;
+static int pcap_swap;
+static uint64_t pcap_skipped;
+
+static inline uint32_t pcap_u32(uint32_t x)
+{
+  return pcap_swap ? __builtin_bswap32(x) : x;
+}
+
+static void pcap_offer(void)
+{
+  struct pcap_rec rec;
+  uint8_t buf[PKTBUF_SIZE];
+  struct nic_fake_stats st;
+  uint32_t len;
+
+  nic_fake_stats(&st);
+  done = (st.rx_packets > rx_base ? st.rx_packets - rx_base : 0);
+
+  while (pcap_f != NULL && sh->injq_num < INJECT_LEN / 2) {
+    if (fread(&rec, sizeof(rec), 1, pcap_f) != 1) {
+      pcap_f = NULL;
+      scen_n = scen_issued;
+      return;
+    }
+    len = pcap_u32(rec.incl_len);
+    if (len > sizeof(buf) || fread(buf, len, 1, pcap_f) != 1) {
+      fprintf(stderr, "spbench: truncated pcap record\n");
+      pcap_f = NULL;
+      scen_n = scen_issued;
+      return;
+    }
+    if (len > PKT_MAX || len < sizeof(struct eth_hdr)) {
+      pcap_skipped++;
+      continue;
+    }
+    inject(buf, len);
+    scen_issued++;
+  }
+}
+
+static void scen_pcap(const char *path)
+{
+  struct pcap_hdr hdr;
+  struct nic_fake_stats st;
+  FILE *f;
+
+  if ((f = fopen(path, "r")) == NULL) {
+    perror("spbench: opening pcap failed");
+    return;
+  }
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1) {
+    fprintf(stderr, "spbench: short pcap file\n");
+    goto out;
+  }
+  if (hdr.magic == PCAP_MAGIC || hdr.magic == PCAP_MAGIC_NS) {
+    pcap_swap = 0;
+  } else if (__builtin_bswap32(hdr.magic) == PCAP_MAGIC ||
+      __builtin_bswap32(hdr.magic) == PCAP_MAGIC_NS)
+  {
+    pcap_swap = 1;
+  } else {
+    fprintf(stderr, "spbench: %s is not a pcap file\n", path);
+    goto out;
+  }
+  if (pcap_u32(hdr.network) != PCAP_LINK_ETH) {
+    fprintf(stderr, "spbench: pcap link type %u, only ethernet is supported\n",
+        pcap_u32(hdr.network));
+    goto out;
+  }
+
+  pcap_f = f;
+  pcap_skipped = 0;
+  scen_n = UINT64_MAX;
+  scen_begin();
+  nic_fake_stats(&st);
+  rx_base = st.rx_packets + sh->injq_num;
+  scen_run(pcap_offer);
+  scen_end("pcap", "pkt", 0);
+  if (pcap_skipped > 0) {
+    printf("  skipped %"PRIu64" frames longer than %u bytes\n", pcap_skipped,
+        PKT_MAX);
+  }
+
+out:
+  fclose(f);
+}
+
+/*****************************************************************************/
+
+static void print_usage(const char *progname)
+{
+  fprintf(stderr, "Usage: %s [OPTION]... [-- SLOWPATH-OPTION...]\n"
+      "  -s, --scenarios=LIST  Comma separated scenarios, run in order\n"
+      "                        [default: accept:10000,connect:10000,rst,"
+      "accept:10000,close,arp:10000,synflood:100000]\n"
+      "                          accept:N    N passive opens\n"
+      "                          connect:N   N active opens towards the peer"
+      " hosts, a\n"
+      "                                      connect storm with few -H\n"
+      "                          close[:N]   application closes open conns\n"
+      "                          rst[:N]     peers reset open conns\n"
+      "                          arp:N       N ARP requests from peers\n"
+      "                          synflood:N  N SYNs to a listener that never"
+      " accepts\n"
+      "                          churn:N     N open and close cycles, window"
+      " conns at a\n"
+      "                                      time towards the peer hosts\n"
+      "                          restart     checkpoint, continue in a restored"
+      " slowpath\n"
+      "  -r, --replay=FILE     Replay the ethernet frames of a pcap file\n"
+      "  -H, --hosts=N         Distinct peer hosts [default: 256]\n"
+      "  -w, --window=N        Outstanding events [default: 32]\n"
+      "  -b, --backlog=N       Listener backlog [default: 1024]\n"
+      "  -N, --node=N          NUMA node of the harness context, its\n"
+      "                        connections' buffers go there [default: NIC's]\n"
+      "  -h, --help            Show this help\n"
+      "Slowpath options after -- are passed on, e.g. --ip-addr "
+      "[default: 10.0.0.1/8].\n", progname);
+}
+
+/** Run the scenarios of @p phase, 1 if it ends with a restart */
+static int run_scenarios(char *list, unsigned phase)
+{
+  char *tok, *arg, *save;
+  unsigned cur = 0;
+  uint64_t n;
+
+  for (tok = strtok_r(list, ",", &save); tok != NULL;
+      tok = strtok_r(NULL, ",", &save))
+  {
+    n = 0;
+    if ((arg = strchr(tok, ':')) != NULL) {
+      *arg++ = 0;
+      n = strtoull(arg, NULL, 10);
+    }
+
+    if (!strcmp(tok, "restart")) {
+      if (cur++ == phase) {
+        return 1;
+      }
+    } else if (cur != phase) {
+      continue;
+    } else if (!strcmp(tok, "accept") && n > 0) {
+      scen_accept(n);
+    } else if (!strcmp(tok, "connect") && n > 0) {
+      scen_connect(n);
+    } else if (!strcmp(tok, "close")) {
+      scen_close(n, 0);
+    } else if (!strcmp(tok, "rst")) {
+      scen_close(n, 1);
+    } else if (!strcmp(tok, "arp") && n > 0) {
+      scen_arp(n);
+    } else if (!strcmp(tok, "synflood") && n > 0) {
+      scen_synflood(n);
+    } else if (!strcmp(tok, "churn") && n > 0) {
+      scen_churn(n);
+    } else {
+      fprintf(stderr, "spbench: invalid scenario %s\n", tok);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/** Packet memory per node, with emulated or real nodes */
+static void print_nodes(void)
+{
+  struct packetmem_node_stats st;
+  unsigned i;
+
+  if (config.numa_nodes <= 1) {
+    return;
+  }
+
+  printf("\npacketmem: nic node %d\n", packetmem_nic_node());
+  for (i = 0; i < config.numa_nodes; i++) {
+    packetmem_node_stats(i, &st);
+    printf("  node %u: %u zones, %"PRIu64" MB used, %"PRIu64" allocs, "
+        "%"PRIu64" spilled to other nodes\n", i, st.zones, st.used >> 20,
+        st.allocs, st.spills);
+  }
+}
+
+/** Slowpath of @p phase, restored from the checkpoint after the first one */
+static int run_phase(char *scen, const char *replay, unsigned phase)
+{
+  uint64_t t;
+  int ret = 0;
+
+  config.restore = (phase > 0);
+  t = util_rdtsc();
+  if (slowpath_init() != 0 || (phase == 0 ? app_init() : app_attach()) != 0) {
+    return -1;
+  }
+  if (phase > 0) {
+    printf("\nrestart: slowpath_init() restored in %.1f ms\n",
+        (double) (util_rdtsc() - t) / tsc_per_us / 1000);
+  } else if (open_listener(LISTEN_OP, LISTEN_PORT, params.backlog) != 0) {
+    return -1;
+  }
+
+  if (scen != NULL && (ret = run_scenarios(scen, phase)) < 0) {
+    return -1;
+  }
+  if (ret == 0 && replay != NULL) {
+    scen_pcap(replay);
+  }
+
+  if (ret == 1) {
+    t = util_rdtsc();
+    if (checkpoint_write() != 0) {
+      return -1;
+    }
+    printf("\nrestart: checkpoint written in %.1f ms\n",
+        (double) (util_rdtsc() - t) / tsc_per_us / 1000);
+  }
+
+  print_nodes();
+
+  /* flush a capture requested with --pcap, remove shm regions */
+  capture_cleanup();
+  stats_cleanup();
+  return ret;
+}
+
+/** Run each phase in a process of its own, the parent only waits */
+static int run_restarts(char *scen, const char *replay)
+{
+  char tmp[] = "/tmp/spbench-ckpt.XXXXXX";
+  unsigned phase;
+  int fd, status, ret = 0;
+  pid_t pid;
+
+  if (config.checkpoint_path[0] == 0) {
+    if ((fd = mkstemp(tmp)) < 0) {
+      perror("spbench: mkstemp failed");
+      return -1;
+    }
+    close(fd);
+    strcpy(config.checkpoint_path, tmp);
+  }
+
+  for (phase = 0; ; phase++) {
+    fflush(stdout);
+    fflush(stderr);
+    if ((pid = fork()) < 0) {
+      perror("spbench: fork failed");
+      ret = -1;
+      break;
+    }
+    if (pid == 0) {
+      ret = run_phase(scen, replay, phase);
+      fflush(stdout);
+      _exit(ret < 0 ? EXIT_FAILURE : (ret == 1 ? EXIT_RESTART : EXIT_SUCCESS));
+    }
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        (WEXITSTATUS(status) != EXIT_SUCCESS &&
+         WEXITSTATUS(status) != EXIT_RESTART))
+    {
+      fprintf(stderr, "spbench: slowpath of phase %u failed\n", phase);
+      ret = -1;
+      break;
+    }
+    if (WEXITSTATUS(status) == EXIT_SUCCESS) {
+      break;
+    }
+  }
+
+  if (!strcmp(config.checkpoint_path, tmp)) {
+    unlink(tmp);
+  }
+  return ret;
+}
+
+/** Zeroed memory shared with the processes of later phases */
+static void *shared_alloc(size_t len)
+{
+  void *p;
+
+  p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  return (p == MAP_FAILED ? NULL : p);
+}
+
+int main(int argc, char *argv[])
+{
+  static const struct option opts[] = {
+    { "scenarios", required_argument, NULL, 's' },
+    { "replay", required_argument, NULL, 'r' },
+    { "hosts", required_argument, NULL, 'H' },
+    { "window", required_argument, NULL, 'w' },
+    { "backlog", required_argument, NULL, 'b' },
+    { "node", required_argument, NULL, 'N' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  char default_scen[] = "accept:10000,connect:10000,rst,accept:10000,close,"
+    "arp:10000,synflood:100000";
+  /* config_parse() edits the arguments in place */
+  char ip_arg[] = "--ip-addr=10.0.0.1/8", stats_arg[] = "--stats-interval=0",
+       quiet_arg[] = "--quiet";
+  char *scen = NULL, *replay = NULL, **sp_argv;
+  struct nic_fake_stats st;
+  int opt, sp_argc, i;
+
+  while ((opt = getopt_long(argc, argv, "s:r:H:w:b:N:h", opts, NULL)) != -1) {
+    switch (opt) {
+      case 's':
+        scen = optarg;
+        break;
+      case 'r':
+        replay = optarg;
+        break;
+      case 'H':
+        params.hosts = atoi(optarg);
+        break;
+      case 'w':
+        params.window = atoi(optarg);
+        break;
+      case 'b':
+        params.backlog = atoi(optarg);
+        break;
+      case 'N':
+        params.node = atoi(optarg);
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (params.hosts == 0 || params.hosts > 0xffff || params.window == 0 ||
+      params.backlog == 0)
+  {
+    fprintf(stderr, "spbench: invalid parameters\n");
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (scen == NULL && replay == NULL) {
+    scen = default_scen;
+  }
+
+  /* slowpath configuration: defaults of the harness, then the user's */
+  sp_argv = calloc(argc + 4, sizeof(*sp_argv));
+  sp_argc = 0;
+  sp_argv[sp_argc++] = argv[0];
+  sp_argv[sp_argc++] = ip_arg;
+  sp_argv[sp_argc++] = stats_arg;
+  sp_argv[sp_argc++] = quiet_arg;
+  for (i = optind; i < argc; i++) {
+    sp_argv[sp_argc++] = argv[i];
+  }
+  optind = 1;
+  if (config_parse(&config, sp_argc, sp_argv) != 0) {
+    return EXIT_FAILURE;
+  }
+  if (params.node != PACKETMEM_NODE_NIC &&
+      (params.node < 0 || params.node >= (int) config.numa_nodes))
+  {
+    fprintf(stderr, "spbench: node must be below numa-nodes\n");
+    return EXIT_FAILURE;
+  }
+  if (params.window * 2 >= config.nic_tx_len) {
+    fprintf(stderr, "spbench: window must be below half of nic-tx-len\n");
+    return EXIT_FAILURE;
+  }
+
+  tsc_per_us = util_us_to_cyc(1);
+  sh = shared_alloc(sizeof(*sh));
+  conns = shared_alloc(params.max_conns * sizeof(*conns));
+  accepted = shared_alloc(params.max_conns * sizeof(*accepted));
+  injq = shared_alloc(INJECT_LEN * sizeof(*injq));
+  if (sh == NULL || conns == NULL || accepted == NULL || injq == NULL) {
+    fprintf(stderr, "spbench: mmap failed\n");
+    return EXIT_FAILURE;
+  }
+
+  if (shm_init_anon() != 0 || nic_init() != 0) {
+    return EXIT_FAILURE;
+  }
+
+  printf("%u peer hosts, window %u, backlog %u, %.0f cycles/us\n",
+      params.hosts, params.window, params.backlog, (double) tsc_per_us);
+
+  /* restarts need a fresh process, without them everything runs in this one */
+  if (scen != NULL && strstr(scen, "restart") != NULL) {
+    if (run_restarts(scen, replay) != 0) {
+      return EXIT_FAILURE;
+    }
+  } else if (run_phase(scen, replay, 0) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  nic_fake_stats(&st);
+  printf("\nfake nic: rx %"PRIu64" (ring full %"PRIu64") tx %"PRIu64
+      " flowht add %"PRIu64" del %"PRIu64" errors %"PRIu64" flows %u"
+      " conn close %"PRIu64" other %"PRIu64"\n", st.rx_packets, st.rx_full,
+      st.tx_packets, st.flowht_add, st.flowht_del, st.flowht_err, st.flows,
+      st.conn_close, st.other);
+  printf("peer: %"PRIu64" SYN-ACKs %"PRIu64" RSTs received\n",
+      sh->peer_synacks, sh->peer_rsts);
+
+  exited = 1;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,371 @@
+/* SPDX-License-Identifier: BSD 3-Clause License */
+/* Copyright (c) 2022, University of Washington, Max Planck Institute for Software Systems, and The University of Texas at Austin */
+
+/**
+ * @brief Telemetry export over shared memory.
+ * @file stats.c
+ * @addtogroup tas-sp-stats
+ *
+ * The region layout is defined in sp_stats.h. Everything is rebuilt from the
+ * slowpath state on each update, so readers never see partial structures as
+ * long as they follow the sequence counter protocol.
+ *
+ * The congestion control trace (sp_cctrace.h) is a separate region, appended
+ * to by cc_poll() for sampled connections.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/common.h"
+#include "util/shm.h"
+
+#include "flextoe.h"
+#include "internal.h"
+#include "appif.h"
+#include "sp_cctrace.h"
+
+STATIC_ASSERT(CONFIG_NUMA_NODES_MAX <= SP_STATS_NODES, stats_nodes);
+
+/* always-on counters in fp_state, see fp_mem.h */
+static const char *fp_cnt_names[FP_CNT_NUM] = {
+  [FP_CNT_RX] = "rx",
+  [FP_CNT_RX_SP] = "rx_sp",
+  [FP_CNT_RX_DROP] = "rx_drop",
+  [FP_CNT_TX] = "tx",
+  [FP_CNT_TX_SEG] = "tx_seg",
+  [FP_CNT_TX_ACK] = "tx_ack",
+  [FP_CNT_RETX] = "retx",
+  [FP_CNT_AC] = "ac",
+  [FP_CNT_GRP0] = "rx_grp0",
+  [FP_CNT_GRP1] = "rx_grp1",
+  [FP_CNT_GRP2] = "rx_grp2",
+  [FP_CNT_GRP3] = "rx_grp3",
+};
+
+#if FP_STAT_ENABLE
+static const struct {
+  unsigned idx;
+  const char *name;
+} fp_stat_names[] = {
+  { FP_STAT_RX_TOTAL, "rx_total" },
+  { FP_STAT_TX_TOTAL, "tx_total" },
+  { FP_STAT_AC_TOTAL, "ac_total" },
+  { FP_STAT_RETX_TOTAL, "retx_total" },
+  { FP_STAT_RX_SP, "rx_sp" },
+  { FP_STAT_RX_PROC, "rx_proc" },
+  { FP_STAT_TX_PROC, "tx_proc" },
+  { FP_STAT_AC_PROC, "ac_proc" },
+  { FP_STAT_RETX_PROC, "retx_proc" },
+  { FP_STAT_RX_POSTPROC_IN, "rx_postproc_in" },
+  { FP_STAT_TX_POSTPROC_IN, "tx_postproc_in" },
+  { FP_STAT_AC_POSTPROC_IN, "ac_postproc_in" },
+  { FP_STAT_RETX_POSTPROC_IN, "retx_postproc_in" },
+  { FP_STAT_DMA_RX_PAYLOAD_ISSUE, "dma_rx_payload_issue" },
+  { FP_STAT_DMA_RX_FWD_ACK, "dma_rx_fwd_ack" },
+  { FP_STAT_DMA_RX_FWD_DROP, "dma_rx_fwd_drop" },
+  { FP_STAT_DMA_RX_FWD_ARX, "dma_rx_fwd_arx" },
+  { FP_STAT_DMA_TX_PAYLOAD_ISSUE, "dma_tx_payload_issue" },
+  { FP_STAT_DMA_TX_FWD_SEG, "dma_tx_fwd_seg" },
+  { FP_STAT_DMA_TX_FWD_DROP, "dma_tx_fwd_drop" },
+  { FP_STAT_DMA_ARX_DESC_ISSUE, "dma_arx_desc_issue" },
+  { FP_STAT_DMA_ARX_DESC_FWD_FREE, "dma_arx_desc_fwd_free" },
+  { FP_STAT_DMA_ATX_DESC_ISSUE, "dma_atx_desc_issue" },
+  { FP_STAT_DMA_ATX_DESC_FWD_AC, "dma_atx_desc_fwd_ac" },
+  { FP_STAT_ARX, "arx" },
+  { FP_STAT_ATX, "atx" },
+  { FP_STAT_ATX_NODESC, "atx_nodesc" },
+  { FP_STAT_PROC_CACHE_MISS, "proc_cache_miss" },
+  { FP_STAT_PROC_EMEM_CACHE_MISS, "proc_emem_cache_miss" },
+  { FP_STAT_QM_SCHEDULE, "qm_schedule" },
+  { FP_STAT_SP_FWD, "sp_fwd" },
+};
+#endif
+
+#if FP_PROF_ENABLE
+static const char *fp_prof_names[] = {
+  "prof_proc_rx",
+  "prof_proc_tx",
+  "prof_proc_ac",
+  "prof_proc_retx",
+  "prof_proc_ack",
+};
+#endif
+
+static struct sp_stats *stats = NULL;
+static uint32_t last_update;
+static struct sp_cctrace *cctrace = NULL;
+
+static int cctrace_init(void);
+
+/** Fastpath counters are stored with swapped 32-bit halves */
+static inline uint64_t fp_counter_read(volatile void *p)
+{
+  uint64_t x = nn_readq(p);
+  return (x << 32) | (x >> 32);
+}
+
+int stats_init(void)
+{
+  if (config.cc_trace_sample != 0 && cctrace_init() != 0) {
+    return -1;
+  }
+
+  if (config.stats_interval == 0) {
+    return 0;
+  }
+
+  stats = util_create_shm(FLEXNIC_NAME_STATS, sizeof(*stats), NULL);
+  if (stats == NULL) {
+    fprintf(stderr, "stats_init: creating shm region failed\n");
+    return -1;
+  }
+
+  stats->hdr.version = SP_STATS_VERSION;
+  stats->hdr.size = sizeof(*stats);
+  stats->hdr.interval_us = config.stats_interval;
+#if FP_STAT_ENABLE
+  stats->hdr.flags |= SP_STATS_FLAG_FP_STATS;
+#endif
+#if FP_PROF_ENABLE
+  stats->hdr.flags |= SP_STATS_FLAG_FP_PROF;
+#endif
+  MEM_BARRIER();
+  /* magic last: readers attaching early wait for it */
+  stats->hdr.magic = SP_STATS_MAGIC;
+
+  return 0;
+}
+
+static void stats_fill_fp(void)
+{
+  unsigned n = 0;
+  unsigned i;
+
+  if (fp_state == NULL) {
+    stats->hdr.num_fp = 0;
+    return;
+  }
+
+  for (i = 0; i < FP_CNT_NUM && n < SP_STATS_FP_NUM; i++, n++) {
+    strncpy(stats->fp[n].name, fp_cnt_names[i], SP_STATS_NAME_LEN - 1);
+    stats->fp[n].value = fp_counter_read(&fp_state->counters.cnt[i]);
+    stats->fp[n].cycles = 0;
+  }
+  for (i = 0; i < SP_STATS_FLOWGRPS; i++) {
+    stats->fgs[i].fp_packets =
+      fp_counter_read(&fp_state->counters.cnt[FP_CNT_GRP0 + i]);
+  }
+
+  /* detailed counters only in debug builds */
+  if (fp_debug == NULL) {
+    stats->hdr.num_fp = n;
+    return;
+  }
+
+#if FP_STAT_ENABLE
+  for (i = 0; i < sizeof(fp_stat_names) / sizeof(fp_stat_names[0]) &&
+      n < SP_STATS_FP_NUM; i++, n++)
+  {
+    strncpy(stats->fp[n].name, fp_stat_names[i].name, SP_STATS_NAME_LEN - 1);
+    stats->fp[n].value =
+      fp_counter_read(&fp_debug->stats_buffer[fp_stat_names[i].idx]);
+    stats->fp[n].cycles = 0;
+  }
+#endif
+
+#if FP_PROF_ENABLE
+  for (i = 0; i < sizeof(fp_prof_names) / sizeof(fp_prof_names[0]) &&
+      n < SP_STATS_FP_NUM; i++, n++)
+  {
+    strncpy(stats->fp[n].name, fp_prof_names[i], SP_STATS_NAME_LEN - 1);
+    stats->fp[n].value = fp_counter_read(&fp_debug->prof_count[i]);
+    stats->fp[n].cycles = fp_counter_read(&fp_debug->prof_cycles[i]);
+  }
+#endif
+
+  stats->hdr.num_fp = n;
+}
+
+static void stats_fill_conns(void)
+{
+  struct connection *c;
+  struct sp_stats_conn *sc;
+  unsigned n = 0, total = 0;
+  unsigned i;
+
+  for (i = 0; i < SP_STATS_FLOWGRPS; i++) {
+    stats->fgs[i].conns = 0;
+  }
+  memset(&stats->rtt_hist, 0, sizeof(stats->rtt_hist));
+
+  for (c = cc_conn_first(); c != NULL; c = c->cc_next) {
+    total++;
+    stats->fgs[c->flow_group % SP_STATS_FLOWGRPS].conns++;
+    if (c->status == CONN_OPEN) {
+      sp_stats_hist_add(&stats->rtt_hist, c->cc_rtt);
+    }
+
+    if (n >= SP_STATS_CONNS) {
+      continue;
+    }
+
+    sc = &stats->conns[n++];
+    sc->flow_id = c->flow_id;
+    sc->local_ip = c->local_ip;
+    sc->remote_ip = c->remote_ip;
+    sc->local_port = c->local_port;
+    sc->remote_port = c->remote_port;
+    sc->flow_group = c->flow_group;
+    sc->db_id = c->db_id;
+    sc->status = c->status;
+    sc->rtt = c->cc_rtt;
+    sc->rate = c->cc_rate;
+    sc->rexmits = c->cc_rexmits;
+    sc->drops = c->cc_total_drops;
+    sc->ackb = c->cc_total_ackb;
+    sc->ecnb = c->cc_total_ecnb;
+  }
+
+  stats->hdr.num_conns = n;
+  stats->hdr.num_conns_total = total;
+  stats->sp.conns = total;
+}
+
+static void stats_fill_ctxs(void)
+{
+  unsigned i, n, apps;
+
+  n = appif_stats(stats->ctxs, SP_STATS_CTXS, &apps);
+
+  memset(&stats->txq_hist, 0, sizeof(stats->txq_hist));
+  for (i = 0; i < n; i++) {
+    sp_stats_hist_add(&stats->txq_hist, stats->ctxs[i].txq_depth);
+  }
+
+  stats->hdr.num_ctxs = n;
+  stats->sp.apps = apps;
+}
+
+static void stats_fill_nodes(void)
+{
+  struct packetmem_node_stats pst;
+  struct sp_stats_node *sn;
+  uint32_t shm_us, ready_us;
+  unsigned i;
+
+  memset(stats->nodes, 0, sizeof(stats->nodes));
+  for (i = 0; i < config.numa_nodes; i++) {
+    sn = &stats->nodes[i];
+    packetmem_node_stats(i, &pst);
+    sn->size = pst.size;
+    sn->used = pst.used;
+    sn->allocs = pst.allocs;
+    sn->spills = pst.spills;
+    sn->zones = pst.zones;
+  }
+  for (i = 0; i < stats->hdr.num_ctxs; i++) {
+    stats->nodes[stats->ctxs[i].numa_node].ctxs++;
+  }
+
+  stats->hdr.num_nodes = config.numa_nodes;
+  stats->hdr.nic_node = packetmem_nic_node();
+  shm_startup_times(&shm_us, &ready_us);
+  stats->hdr.shm_us = shm_us;
+  stats->hdr.ready_us = ready_us;
+}
+
+void stats_poll(uint32_t cur_ts)
+{
+  unsigned i;
+
+  if (stats == NULL || cur_ts - last_update < config.stats_interval) {
+    return;
+  }
+  last_update = cur_ts;
+
+  /* odd sequence number while updating */
+  stats->hdr.seq++;
+  MEM_BARRIER();
+
+  stats->hdr.ts_us = cur_ts;
+
+  stats->sp.drops = spstats.drops;
+  stats->sp.sp_rexmit = spstats.sp_rexmit;
+  stats->sp.sp_tlp = spstats.sp_tlp;
+  stats->sp.ka_probes = spstats.ka_probes;
+  stats->sp.ka_resets = spstats.ka_resets;
+  stats->sp.ecn_marked = spstats.ecn_marked;
+  stats->sp.acks = spstats.acks;
+  stats->sp.conn_opened = spstats.conn_opened;
+  stats->sp.conn_closed = spstats.conn_closed;
+  stats->sp.conn_failed = spstats.conn_failed;
+  stats->sp.rx_packets = 0;
+  for (i = 0; i < SP_STATS_FLOWGRPS; i++) {
+    stats->fgs[i].rx_packets = spstats.rx_packets[i];
+    stats->sp.rx_packets += spstats.rx_packets[i];
+  }
+  stats->sp.rx_unhandled = spstats.rx_unhandled;
+
+  stats_fill_conns();
+  stats_fill_ctxs();
+  stats_fill_nodes();
+  stats_fill_fp();
+
+  MEM_BARRIER();
+  stats->hdr.seq++;
+}
+
+void stats_cleanup(void)
+{
+  if (stats != NULL) {
+    util_destroy_shm(FLEXNIC_NAME_STATS, sizeof(*stats), stats);
+    stats = NULL;
+  }
+  if (cctrace != NULL) {
+    util_destroy_shm(FLEXNIC_NAME_CCTRACE,
+        sp_cctrace_size(config.cc_trace_len), cctrace);
+    cctrace = NULL;
+  }
+}
+
+/*****************************************************************************/
+/* Congestion control trace */
+
+static int cctrace_init(void)
+{
+  size_t size = sp_cctrace_size(config.cc_trace_len);
+
+  cctrace = util_create_shm(FLEXNIC_NAME_CCTRACE, size, NULL);
+  if (cctrace == NULL) {
+    fprintf(stderr, "cctrace_init: creating shm region failed\n");
+    return -1;
+  }
+
+  cctrace->hdr.version = SP_CCTRACE_VERSION;
+  cctrace->hdr.size = size;
+  cctrace->hdr.rec_num = config.cc_trace_len;
+  cctrace->hdr.sample = config.cc_trace_sample;
+  cctrace->hdr.cc_algorithm = config.cc_algorithm;
+  cctrace->hdr.interval = config.cc_control_interval;
+  cctrace->hdr.head = 0;
+  MEM_BARRIER();
+  cctrace->hdr.magic = SP_CCTRACE_MAGIC;
+
+  return 0;
+}
+
+void stats_cctrace(const struct sp_cctrace_rec *rec)
+{
+  uint64_t head;
+
+  if (cctrace == NULL) {
+    return;
+  }
+
+  head = cctrace->hdr.head;
+  cctrace->recs[head & (config.cc_trace_len - 1)] = *rec;
+  MEM_BARRIER();
+  cctrace->hdr.head = head + 1;
+}
@@ -17,6 +17,8 @@
 #include "flextoe.h"
 #include "internal.h"
 #include "packet_defs.h"
+#include "sp_checkpoint.h"
+#include "tcp_wscale.h"
 
 #define TCP_MSS 1460
 #define TCP_HTSIZE 4096
@@ -29,10 +31,22 @@
 #define PORT_TYPE_LMULTI 0x2ULL
 #define PORT_TYPE_CONN   0x3ULL
 #define PORT_TYPE_MASK   0x3ULL
+/* for PORT_TYPE_CONN the remaining bits count the connections on the port */
+#define PORT_CONN_SHIFT  2
+
+/* ephemeral port bitmaps: one bit per port */
+#define PORT_BMP_WORDS ((PORT_MAX + 1) / 64)
+#define PORT_DEST_HTSIZE 256
 
 /* maximum number of listening sockets per port */
 #define LISTEN_MULTI_MAX 32
 
+/* TIME_WAIT table: TCP_TW_HTSIZE buckets with TCP_TW_WAYS entries each */
+#define TCP_TW_HTSIZE 4096
+#define TCP_TW_WAYS 4
+/* TIME_WAIT duration (2 * MSL) in us */
+#define TCP_TW_TIMEOUT 60000000
+
 #define CONN_DEBUG(c, f, x...) do { } while (0)
 #define CONN_DEBUG0(c, f) do { } while (0)
 // #define CONN_DEBUG(c, f, x...) fprintf(stderr, "conn(%p): " f, c, x)
@@ -51,12 +65,36 @@ struct backlog_slot {
 struct tcp_opts {
   struct tcp_mss_opt *mss;
   struct tcp_timestamp_opt *ts;
+  struct tcp_sack_permitted_opt *sack_perm;
+  struct tcp_wscale_opt *wscale;
+};
+
+/** Ephemeral ports in use towards one remote ip:port */
+struct port_dest {
+  uint32_t remote_ip;
+  uint16_t remote_port;
+  uint16_t hint;
+  uint32_t num;
+  struct port_dest *next;
+  uint64_t used[PORT_BMP_WORDS];
+};
+
+/** TIME_WAIT entry, expired entries are simply overwritten */
+struct tw_entry {
+  uint64_t remote_mac;
+  uint32_t remote_ip;
+  uint16_t local_port;
+  uint16_t remote_port;
+  uint32_t local_seq;
+  uint32_t remote_seq;
+  uint32_t expire;
+  uint32_t valid;
 };
 
 static int conn_arp_done(struct connection *conn);
 static void conn_packet(struct connection *c, const struct pkt_tcp *p,
     const struct tcp_opts *opts, uint16_t flow_group);
-static inline struct connection *conn_alloc(void);
+static inline struct connection *conn_alloc(int node);
 static inline void conn_free(struct connection *conn);
 static void conn_register(struct connection *conn);
 static void conn_unregister(struct connection *conn);
@@ -74,7 +112,20 @@ static void listener_packet(struct listener *l, const struct pkt_tcp *p,
     const struct tcp_opts *opts, uint16_t flow_group);
 static void listener_accept(struct listener *l);
 
-static inline uint16_t port_alloc(void);
+static inline uint16_t port_alloc(uint32_t remote_ip, uint16_t remote_port);
+static inline void port_free(uint16_t local_port, uint32_t remote_ip,
+    uint16_t remote_port);
+static inline void port_reserve(uint16_t local_port, uint32_t remote_ip,
+    uint16_t remote_port);
+static struct tw_entry *tw_slot(uint32_t remote_ip, uint16_t local_port,
+    uint16_t remote_port, uint32_t now);
+static void tw_insert(const struct connection *c);
+static struct tw_entry *tw_lookup(uint32_t remote_ip, uint16_t local_port,
+    uint16_t remote_port);
+static inline int send_control_raw(uint64_t remote_mac, uint32_t remote_ip,
+    uint16_t remote_port, uint16_t local_port, uint32_t local_seq,
+    uint32_t remote_seq, uint16_t flags, int ts_opt, uint32_t ts_echo,
+    uint16_t mss_opt, int sack_opt, int ws_opt);
 static inline int send_control(const struct connection *conn, uint16_t flags,
     int ts_opt, uint32_t ts_echo, uint16_t mss_opt);
 static inline int send_reset(const struct pkt_tcp *p,
@@ -84,19 +135,31 @@ static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
 
 static uintptr_t ports[PORT_MAX + 1];
 static uint16_t port_eph_hint = PORT_FIRST_EPH;
+static uint64_t ports_listen_bmp[PORT_BMP_WORDS];
+static struct port_dest *port_dests[PORT_DEST_HTSIZE];
 static struct nbqueue conn_async_q;
 struct connection **tcp_hashtable = NULL;
 static struct utils_rng rng;
+static struct tw_entry *tw_table;
+
+STATIC_ASSERT(sizeof(((struct connection *) 0)->cc) <= SP_CKPT_CC_BYTES,
+    ckpt_cc_size);
 
 int tcp_init(void)
 {
   nbqueue_init(&conn_async_q);
   utils_rng_init(&rng, util_timeout_time_us());
 
-  port_eph_hint = utils_rng_gen32(&rng) % ((1 << 16) - 1 - PORT_FIRST_EPH);
+  port_eph_hint = PORT_FIRST_EPH +
+    utils_rng_gen32(&rng) % ((1 << 16) - 1 - PORT_FIRST_EPH);
   if ((tcp_hashtable = calloc(TCP_HTSIZE, sizeof(*tcp_hashtable))) == NULL) {
     return -1;
   }
+  if ((tw_table = calloc(TCP_TW_HTSIZE * TCP_TW_WAYS, sizeof(*tw_table))) ==
+      NULL)
+  {
+    return -1;
+  }
   return 0;
 }
 
@@ -131,7 +194,7 @@ int tcp_open(struct app_context *ctx, uint64_t opaque, uint32_t remote_ip,
   uint16_t local_port;
 
   /* allocate connection struct */
-  if ((conn = conn_alloc()) == NULL) {
+  if ((conn = conn_alloc(appif_ctx_node(ctx))) == NULL) {
     fprintf(stderr, "%s: malloc failed\n", __func__);
     return -1;
   }
@@ -140,13 +203,14 @@ int tcp_open(struct app_context *ctx, uint64_t opaque, uint32_t remote_ip,
       "db=%u)\n", ctx, opaque, remote_ip, remote_port, db_id);
 
   /* allocate local port */
-  if ((local_port = port_alloc()) == 0) {
+  if ((local_port = port_alloc(remote_ip, remote_port)) == 0) {
     fprintf(stderr, "tcp_open: port_alloc failed\n");
     conn_free(conn);
     return -1;
   }
 
   conn->ctx = ctx;
+  appif_ctx_conn_ref(ctx);
   conn->opaque = opaque;
   conn->status = CONN_ARP_PENDING;
   conn->remote_ip = remote_ip;
@@ -157,7 +221,9 @@ int tcp_open(struct app_context *ctx, uint64_t opaque, uint32_t remote_ip,
   conn->remote_seq = 0;
   conn->cnt_tx_pending = 0;
   conn->db_id = db_id;
-  conn->flags = 0;
+  /* offered in SYN, cleared if not returned */
+  conn->flags = NICIF_CONN_SACK | NICIF_CONN_WSCALE;
+  conn->wscale = TCP_WSCALE(0, tcp_wscale_shift(conn->rx_len));
 
   conn->comp.q = &conn_async_q;
   conn->comp.notify_fd = -1;
@@ -167,6 +233,7 @@ int tcp_open(struct app_context *ctx, uint64_t opaque, uint32_t remote_ip,
   ret = routing_resolve(&conn->comp, remote_ip, &conn->remote_mac);
   if (ret < 0) {
     fprintf(stderr, "%s: nicif_arp failed\n", __func__);
+    port_free(local_port, remote_ip, remote_port);
     conn_free(conn);
     return -1;
   } else if (ret == 0) {
@@ -180,8 +247,6 @@ int tcp_open(struct app_context *ctx, uint64_t opaque, uint32_t remote_ip,
     ret = 0;
   }
 
-  ports[local_port] = (uintptr_t) conn | PORT_TYPE_CONN;
-
   *pconn = conn;
   return ret;
 }
@@ -268,8 +333,10 @@ int tcp_listen(struct app_context *ctx, uint64_t opaque, uint16_t local_port,
   lst->backlog_pos = 0;
   lst->backlog_used = 0;
   lst->flags = 0;
+  lst->detached = 0;
 
   /* add to port tables */
+  ports_listen_bmp[local_port / 64] |= 1ULL << (local_port % 64);
   if (reuseport == 0) {
     ports[local_port] = (uintptr_t) lst | PORT_TYPE_LISTEN;
   } else {
@@ -286,18 +353,99 @@ int tcp_listen(struct app_context *ctx, uint64_t opaque, uint16_t local_port,
   return 0;
 }
 
+int tcp_listen_close(struct listener *lst)
+{
+  struct listen_multi *lm;
+  struct connection *c;
+  uint16_t port = lst->port;
+  uint8_t type;
+  size_t i;
+
+  /* remove from port tables */
+  type = ports[port] & PORT_TYPE_MASK;
+  if (type == PORT_TYPE_LISTEN &&
+      (struct listener *) (ports[port] & ~PORT_TYPE_MASK) == lst)
+  {
+    ports[port] = PORT_TYPE_UNUSED;
+  } else if (type == PORT_TYPE_LMULTI) {
+    lm = (struct listen_multi *) (ports[port] & ~PORT_TYPE_MASK);
+    for (i = 0; i < lm->num && lm->ls[i] != lst; i++);
+    if (i == lm->num) {
+      fprintf(stderr, "tcp_listen_close: listener not found\n");
+      return -1;
+    }
+    lm->ls[i] = lm->ls[--lm->num];
+    if (lm->num == 0) {
+      free(lm);
+      ports[port] = PORT_TYPE_UNUSED;
+    }
+  } else {
+    fprintf(stderr, "tcp_listen_close: listener not found\n");
+    return -1;
+  }
+  if (ports[port] == PORT_TYPE_UNUSED) {
+    ports_listen_bmp[port / 64] &= ~(1ULL << (port % 64));
+  }
+
+  /* connections from pending accepts were never registered */
+  while ((c = lst->wait_conns) != NULL) {
+    lst->wait_conns = c->ht_next;
+    conn_free(c);
+  }
+
+  /* backlog slots were allocated as one array in tcp_listen */
+  free(lst->backlog_ptrs[0]);
+  free(lst->backlog_ptrs);
+  free(lst->backlog_fgs);
+  free(lst);
+  return 0;
+}
+
+void tcp_listen_detach(struct listener *lst)
+{
+  struct connection *c;
+
+  /* accepts were requested by the exited process */
+  while ((c = lst->wait_conns) != NULL) {
+    lst->wait_conns = c->ht_next;
+    conn_free(c);
+  }
+  lst->detached = 1;
+}
+
+void tcp_listen_reattach(struct listener *lst, struct app_context *ctx,
+    uint64_t opaque)
+{
+  struct backlog_slot *bls;
+  struct pkt_tcp *p;
+  uint32_t n, bp;
+
+  lst->ctx = ctx;
+  lst->opaque = opaque;
+  lst->detached = 0;
+
+  for (n = 0, bp = lst->backlog_pos; n < lst->backlog_used;
+      n++, bp = (bp + 1) % lst->backlog_len)
+  {
+    bls = lst->backlog_ptrs[bp];
+    p = (struct pkt_tcp *) bls->buf;
+    appif_listen_newconn(lst, f_beui32(p->ip.src), f_beui16(p->tcp.src));
+  }
+}
+
 int tcp_accept(struct app_context *ctx, uint64_t opaque,
     struct listener *listen, uint32_t db_id)
 {
   struct connection *conn;
 
   /* allocate listener struct */
-  if ((conn = conn_alloc()) == NULL) {
+  if ((conn = conn_alloc(appif_ctx_node(ctx))) == NULL) {
     fprintf(stderr, "tcp_accept: conn_alloc failed\n");
     return -1;
   }
 
   conn->ctx = ctx;
+  appif_ctx_conn_ref(ctx);
   conn->opaque = opaque;
   conn->status = CONN_SYN_WAIT;
   conn->local_port = listen->port;
@@ -320,6 +468,7 @@ int tcp_packet(const void *pkt, uint16_t len, uint16_t flow_group)
   struct listener *l;
   const struct pkt_tcp *p = pkt;
   struct tcp_opts opts;
+  struct tw_entry *tw;
   int ret = 0;
 
   if (len < sizeof(*p)) {
@@ -341,6 +490,17 @@ int tcp_packet(const void *pkt, uint16_t len, uint16_t flow_group)
 
   if ((c = conn_lookup(p)) != NULL) {
     conn_packet(c, p, &opts, flow_group);
+  } else if ((TCPH_FLAGS(&p->tcp) & TCP_SYN) == 0 &&
+      (tw = tw_lookup(f_beui32(p->ip.src), f_beui16(p->tcp.dest),
+                      f_beui16(p->tcp.src))) != NULL)
+  {
+    /* re-ACK a FIN for a connection in TIME_WAIT, drop anything else */
+    if ((TCPH_FLAGS(&p->tcp) & TCP_FIN) == TCP_FIN) {
+      send_control_raw(tw->remote_mac, tw->remote_ip, tw->remote_port,
+          tw->local_port, tw->local_seq, tw->remote_seq, TCP_ACK,
+          opts.ts != NULL, opts.ts != NULL ? f_beui32(opts.ts->ts_val) : 0, 0,
+          0, -1);
+    }
   } else if ((l = listener_lookup(p)) != NULL) {
     listener_packet(l, p, &opts, flow_group);
   } else {
@@ -380,6 +540,7 @@ int tcp_close(struct connection *conn)
   }
 
   cc_conn_remove(conn);
+  keepalive_conn_remove(conn);
 
   conn->status = CONN_CLOSED;
 
@@ -390,6 +551,29 @@ int tcp_close(struct connection *conn)
   return 0;
 }
 
+int tcp_keepalive_probe(struct connection *conn,
+    const struct nicif_connection_tcpstate *st)
+{
+  /* old sequence number: the peer only ACKs, whatever we have in flight */
+  return send_control_raw(conn->remote_mac, conn->remote_ip,
+      conn->remote_port, conn->local_port,
+      st->tx_next_seq - st->tx_sent - 1, st->rx_next_seq, TCP_ACK, 1,
+      st->ts_echo, 0, 0, -1);
+}
+
+int tcp_abort(struct connection *conn,
+    const struct nicif_connection_tcpstate *st)
+{
+  if (tcp_close(conn) != 0) {
+    return -1;
+  }
+
+  /* the fastpath has been told to stop, reset with its sequence numbers */
+  conn->local_seq = st->tx_next_seq;
+  conn->remote_seq = st->rx_next_seq;
+  return send_control(conn, TCP_RST | TCP_ACK, 1, st->ts_echo, 0);
+}
+
 void tcp_destroy(struct connection *conn)
 {
   assert(conn->status == CONN_FAILED);
@@ -432,6 +616,377 @@ void tcp_timeout(struct timeout *to, enum timeout_type type)
   send_control(c, TCP_SYN | TCP_ECE | TCP_CWR, 1, 0, TCP_MSS);
 }
 
+static void conn_checkpoint(const struct connection *c,
+    struct sp_ckpt_conn *rec)
+{
+  uint16_t app_id;
+  uint32_t ctx_db;
+
+  memset(rec, 0, sizeof(*rec));
+  rec->opaque = c->opaque;
+  rec->remote_mac = c->remote_mac;
+  rec->remote_ip = c->remote_ip;
+  rec->local_ip = c->local_ip;
+  rec->remote_port = c->remote_port;
+  rec->local_port = c->local_port;
+  appif_ctx_ids(c->ctx, &app_id, &ctx_db);
+  rec->app_id = app_id;
+  rec->ctx_db = ctx_db;
+  rec->flow_group = c->flow_group;
+  rec->db_id = c->db_id;
+  rec->status = c->status;
+  rec->listener = SP_CKPT_NO_LISTENER;
+  rec->remote_seq = c->remote_seq;
+  rec->local_seq = c->local_seq;
+  rec->syn_ts = c->syn_ts;
+  rec->flags = c->flags;
+  rec->wscale = c->wscale;
+  packetmem_checkpoint(c->rx_handle, &rec->rx);
+  packetmem_checkpoint(c->tx_handle, &rec->tx);
+
+  /* only connections the NIC knows about keep their flow id */
+  if (c->status == CONN_OPEN || c->status == CONN_CLOSED ||
+      c->status == CONN_REG_SYNACK)
+  {
+    rec->flow_id = c->flow_id;
+    rec->eph_port =
+      (ports[c->local_port] & PORT_TYPE_MASK) == PORT_TYPE_CONN;
+  }
+
+  rec->cc_rtt = c->cc_rtt;
+  rec->cc_last_ackb = c->cc_last_ackb;
+  rec->cc_last_ecnb = c->cc_last_ecnb;
+  rec->cc_last_rxb = c->cc_last_rxb;
+  rec->cc_last_drops = c->cc_last_drops;
+  rec->cc_last_acks = c->cc_last_acks;
+  rec->cc_rate = c->cc_rate;
+  rec->cc_rexmits = c->cc_rexmits;
+  rec->rx_wnd = c->rx_wnd;
+  rec->cc_total_drops = c->cc_total_drops;
+  rec->cc_total_ackb = c->cc_total_ackb;
+  rec->cc_total_ecnb = c->cc_total_ecnb;
+  memcpy(rec->cc, &c->cc, sizeof(c->cc));
+
+  rec->ka_idle = c->ka_idle;
+  rec->ka_intvl = c->ka_intvl;
+  rec->ka_cnt = c->ka_cnt;
+}
+
+int tcp_checkpoint(FILE *f, uint32_t *n_listeners, uint32_t *n_conns)
+{
+  struct sp_ckpt_listener lrec;
+  struct sp_ckpt_conn crec;
+  struct listen_multi *lm;
+  struct listener *l;
+  struct connection *c;
+  uint32_t i, j, n, idx, ctx_db;
+  uint16_t app_id;
+  uint8_t type;
+
+  /* listeners in port order, reuseport groups in their hashing order */
+  n = 0;
+  memset(&lrec, 0, sizeof(lrec));
+  for (i = 0; i <= PORT_MAX; i++) {
+    type = ports[i] & PORT_TYPE_MASK;
+    if (type == PORT_TYPE_LISTEN) {
+      lm = NULL;
+    } else if (type == PORT_TYPE_LMULTI) {
+      lm = (struct listen_multi *) (ports[i] & ~PORT_TYPE_MASK);
+    } else {
+      continue;
+    }
+
+    for (j = 0; j < (lm != NULL ? lm->num : 1); j++) {
+      l = (lm != NULL ? lm->ls[j] :
+          (struct listener *) (ports[i] & ~PORT_TYPE_MASK));
+      /* left behind by an exited application, not carried over */
+      if (l->detached) {
+        continue;
+      }
+      lrec.opaque = l->opaque;
+      appif_ctx_ids(l->ctx, &app_id, &ctx_db);
+      lrec.app_id = app_id;
+      lrec.ctx_db = ctx_db;
+      lrec.port = l->port;
+      lrec.backlog = l->backlog_len;
+      lrec.reuseport = (lm != NULL);
+      if (fwrite(&lrec, sizeof(lrec), 1, f) != 1) {
+        goto error;
+      }
+      n++;
+    }
+  }
+  *n_listeners = n;
+
+  /* registered connections */
+  n = 0;
+  for (i = 0; i < TCP_HTSIZE; i++) {
+    for (c = tcp_hashtable[i]; c != NULL; c = c->ht_next) {
+      conn_checkpoint(c, &crec);
+      if (fwrite(&crec, sizeof(crec), 1, f) != 1) {
+        goto error;
+      }
+      n++;
+    }
+  }
+
+  /* pending accepts, same listener order as above */
+  idx = 0;
+  for (i = 0; i <= PORT_MAX; i++) {
+    type = ports[i] & PORT_TYPE_MASK;
+    if (type == PORT_TYPE_LISTEN) {
+      lm = NULL;
+    } else if (type == PORT_TYPE_LMULTI) {
+      lm = (struct listen_multi *) (ports[i] & ~PORT_TYPE_MASK);
+    } else {
+      continue;
+    }
+
+    for (j = 0; j < (lm != NULL ? lm->num : 1); j++) {
+      l = (lm != NULL ? lm->ls[j] :
+          (struct listener *) (ports[i] & ~PORT_TYPE_MASK));
+      if (l->detached) {
+        continue;
+      }
+      for (c = l->wait_conns; c != NULL; c = c->ht_next) {
+        conn_checkpoint(c, &crec);
+        crec.listener = idx;
+        if (fwrite(&crec, sizeof(crec), 1, f) != 1) {
+          goto error;
+        }
+        n++;
+      }
+      idx++;
+    }
+  }
+  *n_conns = n;
+  return 0;
+
+error:
+  fprintf(stderr, "tcp_checkpoint: fwrite failed\n");
+  return -1;
+}
+
+/** Rebuild a connection that was registered when the checkpoint was taken */
+static struct connection *conn_restore(const struct sp_ckpt_conn *rec,
+    struct app_context *ctx)
+{
+  struct connection *c;
+
+  if ((c = calloc(1, sizeof(*c))) == NULL) {
+    fprintf(stderr, "conn_restore: calloc failed\n");
+    return NULL;
+  }
+  if (packetmem_reserve(&rec->rx, &c->rx_handle) != 0) {
+    free(c);
+    return NULL;
+  }
+  if (packetmem_reserve(&rec->tx, &c->tx_handle) != 0) {
+    packetmem_free(c->rx_handle);
+    free(c);
+    return NULL;
+  }
+
+  c->opaque = rec->opaque;
+  c->ctx = ctx;
+  appif_ctx_conn_ref(ctx);
+  c->db_id = rec->db_id;
+  c->rx_buf = (uint8_t *) flextoe_dma_mem + rec->rx.off;
+  c->rx_len = rec->rx.len;
+  c->tx_buf = (uint8_t *) flextoe_dma_mem + rec->tx.off;
+  c->tx_len = rec->tx.len;
+  c->remote_mac = rec->remote_mac;
+  c->remote_ip = rec->remote_ip;
+  c->local_ip = rec->local_ip;
+  c->remote_port = rec->remote_port;
+  c->local_port = rec->local_port;
+  c->status = rec->status;
+  c->remote_seq = rec->remote_seq;
+  c->local_seq = rec->local_seq;
+  c->syn_ts = rec->syn_ts;
+
+  c->cc_rtt = rec->cc_rtt;
+  c->cc_last_ackb = rec->cc_last_ackb;
+  c->cc_last_ecnb = rec->cc_last_ecnb;
+  c->cc_last_rxb = rec->cc_last_rxb;
+  c->cc_last_drops = rec->cc_last_drops;
+  c->cc_last_acks = rec->cc_last_acks;
+  c->cc_rate = rec->cc_rate;
+  c->cc_rexmits = rec->cc_rexmits;
+  c->rx_wnd = rec->rx_wnd;
+  c->cc_total_drops = rec->cc_total_drops;
+  c->cc_total_ackb = rec->cc_total_ackb;
+  c->cc_total_ecnb = rec->cc_total_ecnb;
+  memcpy(&c->cc, rec->cc, sizeof(c->cc));
+
+  c->comp.q = &conn_async_q;
+  c->comp.notify_fd = -1;
+  c->comp.status = 0;
+  c->flow_id = rec->flow_id;
+  c->flags = rec->flags;
+  c->wscale = rec->wscale;
+  c->flow_group = rec->flow_group;
+  return c;
+}
+
+int tcp_restore(const struct sp_ckpt_listener *ls, uint32_t n_listeners,
+    const struct sp_ckpt_conn *cs, uint32_t n_conns, int cc_reinit)
+{
+  struct listener **listeners;
+  struct app_context *ctx;
+  struct connection *c;
+  uint32_t i;
+  int ret = -1;
+
+  if ((listeners = calloc(n_listeners + 1, sizeof(*listeners))) == NULL) {
+    fprintf(stderr, "tcp_restore: calloc failed\n");
+    return -1;
+  }
+
+  for (i = 0; i < n_listeners; i++) {
+    if ((ctx = appif_ctx_lookup(ls[i].app_id, ls[i].ctx_db)) == NULL) {
+      fprintf(stderr, "tcp_restore: no context for listener on port %u\n",
+          ls[i].port);
+      goto out;
+    }
+    if (tcp_listen(ctx, ls[i].opaque, ls[i].port, ls[i].backlog,
+          ls[i].reuseport, &listeners[i]) != 0)
+    {
+      goto out;
+    }
+    appif_listen_restored(listeners[i]);
+  }
+
+  /* registered connections first: their buffers must be reserved before
+   * pending accepts allocate new ones */
+  for (i = 0; i < n_conns; i++) {
+    if (cs[i].status == CONN_SYN_WAIT) {
+      continue;
+    }
+    if ((ctx = appif_ctx_lookup(cs[i].app_id, cs[i].ctx_db)) == NULL) {
+      fprintf(stderr, "tcp_restore: no context for connection\n");
+      goto out;
+    }
+    if ((c = conn_restore(&cs[i], ctx)) == NULL) {
+      goto out;
+    }
+
+    if (cs[i].eph_port) {
+      port_reserve(c->local_port, c->remote_ip, c->remote_port);
+    }
+
+    switch (c->status) {
+      case CONN_OPEN:
+        conn_register(c);
+        cc_conn_restore(c, cc_reinit);
+        keepalive_conn_init(c);
+        if (cs[i].ka_idle != 0) {
+          keepalive_conn_set(c, cs[i].ka_idle, cs[i].ka_intvl, cs[i].ka_cnt);
+        }
+        appif_conn_restored(c);
+        break;
+
+      case CONN_CLOSED:
+        /* the close timeout runs again from the start */
+        conn_register(c);
+        util_timeout_arm(&timeout_mgr, &c->to, 10000, TO_TCP_CLOSED);
+        c->to_armed = 1;
+        appif_conn_restored(c);
+        break;
+
+      case CONN_REG_SYNACK:
+        conn_register(c);
+        cc_conn_restore(c, cc_reinit);
+        conn_reg_synack(c);
+        break;
+
+      case CONN_ARP_PENDING:
+      case CONN_SYN_SENT:
+        /* handshake state is not kept, the application sees a failed open */
+        c->status = CONN_FAILED;
+        spstats.conn_failed++;
+        appif_conn_opened(c, -1);
+        break;
+
+      default:
+        fprintf(stderr, "tcp_restore: unexpected connection state %u\n",
+            c->status);
+        goto out;
+    }
+  }
+
+  for (i = 0; i < n_conns; i++) {
+    if (cs[i].status != CONN_SYN_WAIT) {
+      continue;
+    }
+    if (cs[i].listener >= n_listeners ||
+        (ctx = appif_ctx_lookup(cs[i].app_id, cs[i].ctx_db)) == NULL)
+    {
+      fprintf(stderr, "tcp_restore: invalid pending accept\n");
+      goto out;
+    }
+    if (tcp_accept(ctx, cs[i].opaque, listeners[cs[i].listener],
+          cs[i].db_id) != 0)
+    {
+      goto out;
+    }
+  }
+
+  ret = 0;
+out:
+  free(listeners);
+  return ret;
+}
+
+int tcp_tw_checkpoint(FILE *f, uint32_t *n)
+{
+  struct sp_ckpt_tw rec;
+  struct tw_entry *e;
+  uint32_t i, now = util_timeout_time_us();
+
+  *n = 0;
+  memset(&rec, 0, sizeof(rec));
+  for (i = 0; i < TCP_TW_HTSIZE * TCP_TW_WAYS; i++) {
+    e = &tw_table[i];
+    if (!e->valid || (int32_t) (e->expire - now) <= 0) {
+      continue;
+    }
+
+    rec.remote_mac = e->remote_mac;
+    rec.remote_ip = e->remote_ip;
+    rec.local_port = e->local_port;
+    rec.remote_port = e->remote_port;
+    rec.local_seq = e->local_seq;
+    rec.remote_seq = e->remote_seq;
+    rec.remaining = e->expire - now;
+    if (fwrite(&rec, sizeof(rec), 1, f) != 1) {
+      fprintf(stderr, "tcp_tw_checkpoint: fwrite failed\n");
+      return -1;
+    }
+    (*n)++;
+  }
+  return 0;
+}
+
+void tcp_tw_restore(const struct sp_ckpt_tw *tws, uint32_t n)
+{
+  struct tw_entry *e;
+  uint32_t i, now = util_timeout_time_us();
+
+  for (i = 0; i < n; i++) {
+    /* the timer clock restarted with the process, keep the time left */
+    e = tw_slot(tws[i].remote_ip, tws[i].local_port, tws[i].remote_port, now);
+    e->remote_mac = tws[i].remote_mac;
+    e->remote_ip = tws[i].remote_ip;
+    e->local_port = tws[i].local_port;
+    e->remote_port = tws[i].remote_port;
+    e->local_seq = tws[i].local_seq;
+    e->remote_seq = tws[i].remote_seq;
+    e->expire = now + MIN(tws[i].remaining, TCP_TW_TIMEOUT);
+    e->valid = 1;
+  }
+}
+
 static void conn_packet(struct connection *c, const struct pkt_tcp *p,
     const struct tcp_opts *opts, uint16_t flow_group)
 {
@@ -530,6 +1085,20 @@ static int conn_syn_sent_packet(struct connection *c, const struct pkt_tcp *p,
     c->flags |= NICIF_CONN_ECN;
   }
 
+  /* keep SACK only if the peer permits it as well */
+  if (opts->sack_perm == NULL) {
+    c->flags &= ~NICIF_CONN_SACK;
+  }
+
+  /* same for window scaling */
+  if (opts->wscale == NULL) {
+    c->flags &= ~NICIF_CONN_WSCALE;
+    c->wscale = 0;
+  } else {
+    c->wscale = TCP_WSCALE(MIN(opts->wscale->shift, TCP_WSCALE_MAX),
+        TCP_WSCALE_RCV(c->wscale));
+  }
+
   cc_conn_init(c);
 
   c->comp.q = &conn_async_q;
@@ -540,10 +1109,11 @@ static int conn_syn_sent_packet(struct connection *c, const struct pkt_tcp *p,
         c->remote_ip, c->remote_port,
         (uint64_t) c->rx_buf,
         c->rx_len,
+        c->rx_wnd,
         (uint64_t) c->tx_buf,
         c->tx_len,
-        c->remote_seq, c->local_seq, c->opaque, c->flags, c->cc_rate,
-        c->flow_group, &c->flow_id)
+        c->remote_seq, c->local_seq, c->opaque, c->flags, c->wscale,
+        c->cc_rate, c->flow_group, &c->flow_id)
       != 0)
   {
     fprintf(stderr, "%s: nicif_connection_add failed\n", __func__);
@@ -553,6 +1123,8 @@ static int conn_syn_sent_packet(struct connection *c, const struct pkt_tcp *p,
   CONN_DEBUG0(c, "conn_syn_sent_packet: connection registered\n");
 
   c->status = CONN_OPEN;
+  spstats.conn_opened++;
+  keepalive_conn_init(c);
 
   /* send ACK */
   send_control(c, TCP_ACK, 1, c->syn_ts, 0);
@@ -569,6 +1141,8 @@ static int conn_reg_synack(struct connection *c)
   uint32_t ecn_flags = 0;
 
   c->status = CONN_OPEN;
+  spstats.conn_opened++;
+  keepalive_conn_init(c);
 
   if ((c->flags & NICIF_CONN_ECN) == NICIF_CONN_ECN) {
     ecn_flags = TCP_ECE;
@@ -582,27 +1156,142 @@ static int conn_reg_synack(struct connection *c)
   return 0;
 }
 
-static inline uint16_t port_alloc(void)
+/** simple hash of 64-bits to 32 bits */
+static inline uint32_t hash_64_to_32(uint64_t key)
+{
+  key = (~key) + (key << 18);
+  key = key ^ (key >> 31);
+  key = key * 21;
+  key = key ^ (key >> 11);
+  key = key + (key << 6);
+  key = key ^ (key >> 22);
+  return (uint32_t) key;
+}
+
+static inline struct port_dest *port_dest_get(uint32_t remote_ip,
+    uint16_t remote_port, int create)
+{
+  struct port_dest *pd;
+  uint32_t h;
+
+  h = hash_64_to_32(((uint64_t) remote_ip << 16) | remote_port) %
+    PORT_DEST_HTSIZE;
+  for (pd = port_dests[h]; pd != NULL; pd = pd->next) {
+    if (pd->remote_ip == remote_ip && pd->remote_port == remote_port) {
+      return pd;
+    }
+  }
+
+  if (!create) {
+    return NULL;
+  }
+
+  if ((pd = calloc(1, sizeof(*pd))) == NULL) {
+    fprintf(stderr, "port_dest_get: calloc failed\n");
+    return NULL;
+  }
+  pd->remote_ip = remote_ip;
+  pd->remote_port = remote_port;
+  pd->hint = port_eph_hint / 64;
+  pd->next = port_dests[h];
+  port_dests[h] = pd;
+  return pd;
+}
+
+static inline void port_dest_remove(struct port_dest *pd)
 {
-  uint16_t p, p_start, p_next;
+  struct port_dest **ppd;
+  uint32_t h;
 
-  p = p_start = port_eph_hint;
+  h = hash_64_to_32(((uint64_t) pd->remote_ip << 16) | pd->remote_port) %
+    PORT_DEST_HTSIZE;
+  for (ppd = &port_dests[h]; *ppd != pd; ppd = &(*ppd)->next);
+  *ppd = pd->next;
+  free(pd);
+}
+
+/**
+ * Allocate ephemeral port towards remote_ip:remote_port. Local ports are only
+ * unique per destination, the first port not used by a connection to the same
+ * destination, a listener, or a 4-tuple in TIME_WAIT is picked.
+ */
+static inline uint16_t port_alloc(uint32_t remote_ip, uint16_t remote_port)
+{
+  struct port_dest *pd;
+  uint64_t avail;
+  uint32_t w, w_start, p;
+
+  if ((pd = port_dest_get(remote_ip, remote_port, 1)) == NULL) {
+    return 0;
+  }
+
+  w = w_start = pd->hint;
   do {
-    p_next = (((uint16_t) (p + 1)) < (uint16_t) PORT_FIRST_EPH ?
-        PORT_FIRST_EPH : p + 1);
+    avail = ~(pd->used[w] | ports_listen_bmp[w]);
+    while (avail != 0) {
+      p = w * 64 + __builtin_ctzll(avail);
+      avail &= avail - 1;
+
+      if (tw_lookup(remote_ip, p, remote_port) != NULL) {
+        continue;
+      }
 
-    if ((ports[p] & PORT_TYPE_MASK) == PORT_TYPE_UNUSED) {
-      port_eph_hint = p_next;
+      pd->used[w] |= 1ULL << (p % 64);
+      pd->num++;
+      pd->hint = w;
+      ports[p] = (ports[p] + (1ULL << PORT_CONN_SHIFT)) | PORT_TYPE_CONN;
       return p;
     }
 
-    p = p_next;
-  } while (p != p_start);
+    w = (w + 1 < PORT_BMP_WORDS ? w + 1 : PORT_FIRST_EPH / 64);
+  } while (w != w_start);
 
+  if (pd->num == 0) {
+    port_dest_remove(pd);
+  }
   return 0;
 }
 
-static inline struct connection *conn_alloc(void)
+static inline void port_free(uint16_t local_port, uint32_t remote_ip,
+    uint16_t remote_port)
+{
+  struct port_dest *pd;
+
+  if ((pd = port_dest_get(remote_ip, remote_port, 0)) == NULL ||
+      (pd->used[local_port / 64] & (1ULL << (local_port % 64))) == 0)
+  {
+    fprintf(stderr, "port_free: port %u not allocated\n", local_port);
+    return;
+  }
+
+  pd->used[local_port / 64] &= ~(1ULL << (local_port % 64));
+  if (--pd->num == 0) {
+    port_dest_remove(pd);
+  }
+
+  ports[local_port] -= 1ULL << PORT_CONN_SHIFT;
+  if ((ports[local_port] >> PORT_CONN_SHIFT) == 0) {
+    ports[local_port] = PORT_TYPE_UNUSED;
+  }
+}
+
+/** Mark a restored connection's ephemeral port as used */
+static inline void port_reserve(uint16_t local_port, uint32_t remote_ip,
+    uint16_t remote_port)
+{
+  struct port_dest *pd;
+
+  if ((pd = port_dest_get(remote_ip, remote_port, 1)) == NULL) {
+    return;
+  }
+
+  pd->used[local_port / 64] |= 1ULL << (local_port % 64);
+  pd->num++;
+  ports[local_port] = (ports[local_port] + (1ULL << PORT_CONN_SHIFT)) |
+    PORT_TYPE_CONN;
+}
+
+static inline struct connection *conn_alloc(int node)
 {
   struct connection *conn;
   uintptr_t off_rx, off_tx;
@@ -613,13 +1302,17 @@ static inline struct connection *conn_alloc(void)
   }
   memset(conn, 0, sizeof(*conn));
 
-  if (packetmem_alloc(config.tcp_rxbuf_len, &off_rx, &conn->rx_handle) != 0) {
+  if (packetmem_alloc_node(config.tcp_rxbuf_len, node, &off_rx,
+        &conn->rx_handle) != 0)
+  {
     fprintf(stderr, "conn_alloc: packetmem_alloc rx failed\n");
     free(conn);
     return NULL;
   }
 
-  if (packetmem_alloc(config.tcp_txbuf_len, &off_tx, &conn->tx_handle) != 0) {
+  if (packetmem_alloc_node(config.tcp_txbuf_len, node, &off_tx,
+        &conn->tx_handle) != 0)
+  {
     fprintf(stderr, "conn_alloc: packetmem_alloc tx failed\n");
     packetmem_free(conn->rx_handle);
     free(conn);
@@ -635,8 +1328,20 @@ static inline struct connection *conn_alloc(void)
   return conn;
 }
 
+/**
+ * Release connection with its buffers and flow id. The flow id must no longer
+ * be in the fast path flow table.
+ */
 static inline void conn_free(struct connection *conn)
 {
+  if (conn->ctx != NULL) {
+    appif_ctx_conn_unref(conn->ctx);
+    conn->ctx = NULL;
+  }
+
+  if (conn->flow_id != 0) {
+    nicif_connection_free(conn->flow_id, conn->flow_group);
+  }
   packetmem_free(conn->tx_handle);
   packetmem_free(conn->rx_handle);
   free(conn);
@@ -682,17 +1387,23 @@ static void conn_unregister(struct connection *conn)
 }
 
 static struct connection *conn_lookup(const struct pkt_tcp *p)
+{
+  return tcp_conn_lookup(f_beui32(p->ip.dest), f_beui16(p->tcp.dest),
+      f_beui32(p->ip.src), f_beui16(p->tcp.src));
+}
+
+struct connection *tcp_conn_lookup(uint32_t local_ip, uint16_t local_port,
+    uint32_t remote_ip, uint16_t remote_port)
 {
   uint32_t h;
   struct connection *c;
 
-  h = conn_hash(f_beui32(p->ip.dest), f_beui32(p->ip.src),
-      f_beui16(p->tcp.dest), f_beui16(p->tcp.src)) % TCP_HTSIZE;
+  h = conn_hash(local_ip, remote_ip, local_port, remote_port) % TCP_HTSIZE;
 
   for (c = tcp_hashtable[h]; c != NULL; c = c->ht_next) {
-    if (f_beui32(p->ip.src) == c->remote_ip &&
-        f_beui16(p->tcp.dest) == c->local_port &&
-        f_beui16(p->tcp.src) == c->remote_port)
+    if (remote_ip == c->remote_ip &&
+        local_port == c->local_port &&
+        remote_port == c->remote_port)
     {
       return c;
     }
@@ -707,7 +1418,13 @@ static void conn_failed(struct connection *c, int status)
     conn_timeout_disarm(c);
   }
 
+  /* free ephemeral port */
+  if ((ports[c->local_port] & PORT_TYPE_MASK) == PORT_TYPE_CONN) {
+    port_free(c->local_port, c->remote_ip, c->remote_port);
+  }
+
   c->status = CONN_FAILED;
+  spstats.conn_failed++;
 
   appif_conn_opened(c, status);
 }
@@ -734,42 +1451,116 @@ static void conn_timeout_disarm(struct connection *c)
 
 static void conn_close_timeout(struct connection *c)
 {
-  /* free port */
-  if ((ports[c->local_port] & PORT_TYPE_MASK) == PORT_TYPE_CONN) {
-    ports[c->local_port] = 0;
-  }
-
   /* remove from global connection list */
   conn_unregister(c);
 
-  /* free connection data buffers */
-  packetmem_free(c->tx_handle);
-  packetmem_free(c->rx_handle);
+  /* remove 4-tuple from fast path */
+  if (nicif_connection_unregister(c->flow_id, c->local_ip, c->local_port,
+        c->remote_ip, c->remote_port) != 0)
+  {
+    fprintf(stderr, "conn_close_timeout: nicif_connection_unregister "
+        "failed\n");
+    nicif_connection_free(c->flow_id, c->flow_group);
+    c->flow_id = 0;
+  }
 
-  /* free connection id */
-  nicif_connection_free(c->flow_id, c->flow_group);
+  /* keep 4-tuple in TIME_WAIT to protect port reuse */
+  tw_insert(c);
 
   /* free ephemeral port */
   if ((ports[c->local_port] & PORT_TYPE_MASK) == PORT_TYPE_CONN) {
-    ports[c->local_port] = PORT_TYPE_UNUSED;
+    port_free(c->local_port, c->remote_ip, c->remote_port);
   }
 
   /* notify application */
+  spstats.conn_closed++;
   appif_conn_closed(c, 0);
 
-  free(c);
+  /* free connection, its buffers and flow id */
+  conn_free(c);
 }
 
-/** simple hash of 64-bits to 32 bits */
-static inline uint32_t hash_64_to_32(uint64_t key)
+static inline struct tw_entry *tw_bucket(uint32_t remote_ip,
+    uint16_t local_port, uint16_t remote_port)
 {
-  key = (~key) + (key << 18);
-  key = key ^ (key >> 31);
-  key = key * 21;
-  key = key ^ (key >> 11);
-  key = key + (key << 6);
-  key = key ^ (key >> 22);
-  return (uint32_t) key;
+  uint32_t h;
+
+  h = conn_hash(config.ip, remote_ip, local_port, remote_port);
+  return &tw_table[(h % TCP_TW_HTSIZE) * TCP_TW_WAYS];
+}
+
+/** Entry to (re)use for a 4-tuple entering TIME_WAIT */
+static struct tw_entry *tw_slot(uint32_t remote_ip, uint16_t local_port,
+    uint16_t remote_port, uint32_t now)
+{
+  struct tw_entry *b, *e = NULL;
+  int i;
+
+  b = tw_bucket(remote_ip, local_port, remote_port);
+
+  /* entry for the same 4-tuple, else a free or expired one */
+  for (i = 0; i < TCP_TW_WAYS && e == NULL; i++) {
+    if (b[i].valid && b[i].remote_ip == remote_ip &&
+        b[i].local_port == local_port && b[i].remote_port == remote_port)
+    {
+      e = &b[i];
+    }
+  }
+  for (i = 0; i < TCP_TW_WAYS && e == NULL; i++) {
+    if (!b[i].valid || (int32_t) (b[i].expire - now) <= 0) {
+      e = &b[i];
+    }
+  }
+
+  /* bucket full: evict the entry closest to expiry */
+  if (e == NULL) {
+    e = &b[0];
+    for (i = 1; i < TCP_TW_WAYS; i++) {
+      if ((int32_t) (b[i].expire - e->expire) < 0) {
+        e = &b[i];
+      }
+    }
+  }
+  return e;
+}
+
+static void tw_insert(const struct connection *c)
+{
+  struct tw_entry *e;
+  uint32_t now = util_timeout_time_us();
+
+  e = tw_slot(c->remote_ip, c->local_port, c->remote_port, now);
+  e->remote_mac = c->remote_mac;
+  e->remote_ip = c->remote_ip;
+  e->local_port = c->local_port;
+  e->remote_port = c->remote_port;
+  e->local_seq = c->local_seq;
+  e->remote_seq = c->remote_seq;
+  e->expire = now + TCP_TW_TIMEOUT;
+  e->valid = 1;
+}
+
+static struct tw_entry *tw_lookup(uint32_t remote_ip, uint16_t local_port,
+    uint16_t remote_port)
+{
+  struct tw_entry *b;
+  uint32_t now;
+  int i;
+
+  b = tw_bucket(remote_ip, local_port, remote_port);
+  for (i = 0; i < TCP_TW_WAYS; i++) {
+    if (b[i].valid && b[i].remote_ip == remote_ip &&
+        b[i].local_port == local_port && b[i].remote_port == remote_port)
+    {
+      now = util_timeout_time_us();
+      if ((int32_t) (b[i].expire - now) <= 0) {
+        b[i].valid = 0;
+        return NULL;
+      }
+      return &b[i];
+    }
+  }
+  return NULL;
 }
 
 static struct listener *listener_lookup(const struct pkt_tcp *p)
@@ -902,6 +1693,19 @@ static void listener_accept(struct listener *l)
     c->flags |= NICIF_CONN_ECN;
   }
 
+  /* check if SACK is offered */
+  if (opts.sack_perm != NULL) {
+    c->flags |= NICIF_CONN_SACK;
+  }
+
+  /* check if window scaling is offered, answer with ours */
+  c->wscale = 0;
+  if (opts.wscale != NULL) {
+    c->flags |= NICIF_CONN_WSCALE;
+    c->wscale = TCP_WSCALE(MIN(opts.wscale->shift, TCP_WSCALE_MAX),
+        tcp_wscale_shift(c->rx_len));
+  }
+
   cc_conn_init(c);
 
   c->status = CONN_REG_SYNACK;
@@ -914,10 +1718,11 @@ static void listener_accept(struct listener *l)
         c->remote_ip, c->remote_port,
         (uint64_t) c->rx_buf,
         c->rx_len,
+        c->rx_wnd,
         (uint64_t) c->tx_buf,
         c->tx_len,
-        c->remote_seq, c->local_seq + 1, c->opaque, c->flags, c->cc_rate,
-        c->flow_group, &c->flow_id)
+        c->remote_seq, c->local_seq + 1, c->opaque, c->flags, c->wscale,
+        c->cc_rate, c->flow_group, &c->flow_id)
       != 0)
   {
     fprintf(stderr, "listener_packet: nicif_connection_add failed\n");
@@ -939,7 +1744,7 @@ out:
 static inline int send_control_raw(uint64_t remote_mac, uint32_t remote_ip,
     uint16_t remote_port, uint16_t local_port, uint32_t local_seq,
     uint32_t remote_seq, uint16_t flags, int ts_opt, uint32_t ts_echo,
-    uint16_t mss_opt)
+    uint16_t mss_opt, int sack_opt, int ws_opt)
 {
   uint32_t new_tail;
   struct pkt_tcp *p;
@@ -947,8 +1752,10 @@ static inline int send_control_raw(uint64_t remote_mac, uint32_t remote_ip,
   struct tcp_noop_opt *opt_noop2;
   struct tcp_mss_opt *opt_mss;
   struct tcp_timestamp_opt *opt_ts;
+  struct tcp_sack_permitted_opt *opt_sack;
+  struct tcp_wscale_opt *opt_ws;
   uint8_t optlen;
-  uint16_t len, off_ts, off_mss, off_noop1, off_noop2;
+  uint16_t len, off_ts, off_mss, off_sack, off_ws, off_noop1, off_noop2;
 
   /* calculate header length depending on options */
   optlen = 0;
@@ -960,6 +1767,10 @@ static inline int send_control_raw(uint64_t remote_mac, uint32_t remote_ip,
   optlen += (ts_opt ? sizeof(*opt_ts) : 0);
   off_mss = optlen;
   optlen += (mss_opt ? sizeof(*opt_mss) : 0);
+  off_sack = optlen;
+  optlen += (sack_opt ? sizeof(*opt_sack) : 0);
+  off_ws = optlen;
+  optlen += (ws_opt >= 0 ? sizeof(*opt_ws) : 0);
   optlen = (optlen + 3) & ~3;
   len = sizeof(*p) + optlen;
 
@@ -996,6 +1807,9 @@ static inline int send_control_raw(uint64_t remote_mac, uint32_t remote_ip,
   p->tcp.chksum = 0;
   p->tcp.urgp = t_beui16(0);
 
+  /* zero padding after the last option */
+  memset(p + 1, 0, optlen);
+
   opt_noop1 = (struct tcp_noop_opt *) ((uint8_t *) (p + 1) + off_noop1);
   opt_noop1->kind = TCP_OPT_NO_OP;
   opt_noop2 = (struct tcp_noop_opt *) ((uint8_t *) (p + 1) + off_noop2);
@@ -1012,13 +1826,28 @@ static inline int send_control_raw(uint64_t remote_mac, uint32_t remote_ip,
   /* if requested: add timestamp option */
   if (ts_opt) {
     opt_ts = (struct tcp_timestamp_opt *) ((uint8_t *) (p + 1) + off_ts);
-    memset(opt_ts, 0, optlen);
     opt_ts->kind = TCP_OPT_TIMESTAMP;
     opt_ts->length = sizeof(*opt_ts);
     opt_ts->ts_val = t_beui32(0);
     opt_ts->ts_ecr = t_beui32(ts_echo);
   }
 
+  /* if requested: add sack permitted option */
+  if (sack_opt) {
+    opt_sack = (struct tcp_sack_permitted_opt *) ((uint8_t *) (p + 1) +
+        off_sack);
+    opt_sack->kind = TCP_OPT_SACK_PERMITTED;
+    opt_sack->length = sizeof(*opt_sack);
+  }
+
+  /* if requested: add window scale option */
+  if (ws_opt >= 0) {
+    opt_ws = (struct tcp_wscale_opt *) ((uint8_t *) (p + 1) + off_ws);
+    opt_ws->kind = TCP_OPT_WINDOW_SCALE;
+    opt_ws->length = sizeof(*opt_ws);
+    opt_ws->shift = ws_opt;
+  }
+
   /* calculate header checksums */
   p->ip.chksum = rte_ipv4_cksum((void *) &p->ip);
   p->tcp.chksum = rte_ipv4_udptcp_cksum((void *) &p->ip, (void *) &p->tcp);
@@ -1034,7 +1863,11 @@ static inline int send_control(const struct connection *conn, uint16_t flags,
   // TODO: Temporary fix
   return send_control_raw(conn->remote_mac, conn->remote_ip, conn->remote_port,
       conn->local_port, conn->local_seq, conn->remote_seq, flags, ts_opt,
-      ts_echo, 0);
+      ts_echo, 0, (flags & TCP_SYN) == TCP_SYN &&
+      (conn->flags & NICIF_CONN_SACK) == NICIF_CONN_SACK,
+      (flags & TCP_SYN) == TCP_SYN &&
+      (conn->flags & NICIF_CONN_WSCALE) == NICIF_CONN_WSCALE ?
+      (int) TCP_WSCALE_RCV(conn->wscale) : -1);
 }
 
 static inline int send_reset(const struct pkt_tcp *p,
@@ -1052,7 +1885,7 @@ static inline int send_reset(const struct pkt_tcp *p,
   memcpy(&remote_mac, &p->eth.src, ETH_ADDR_LEN);
   return send_control_raw(remote_mac, f_beui32(p->ip.src), f_beui16(p->tcp.src),
       f_beui16(p->tcp.dest), f_beui32(p->tcp.ackno), f_beui32(p->tcp.seqno) + 1,
-      TCP_RST | TCP_ACK, ts_opt, ts_val, 0);
+      TCP_RST | TCP_ACK, ts_opt, ts_val, 0, 0, -1);
 }
 
 static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
@@ -1065,6 +1898,8 @@ static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
 
   opts->ts = NULL;
   opts->mss = NULL;
+  opts->sack_perm = NULL;
+  opts->wscale = NULL;
 
   /* whole header not in buf */
   if (TCPH_HDRLEN(&p->tcp) < 5 || opts_len > (len - sizeof(*p))) {
@@ -1101,6 +1936,29 @@ static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
         }
 
         opts->ts = (struct tcp_timestamp_opt *) (opt + off);
+      } else if (opt_kind == TCP_OPT_SACK_PERMITTED) {
+        if (opt_len != sizeof(struct tcp_sack_permitted_opt)) {
+          fprintf(stderr, "parse_options: sack permitted option size wrong "
+              "(got %u)\n", opt_len);
+          return -1;
+        }
+
+        opts->sack_perm = (struct tcp_sack_permitted_opt *) (opt + off);
+      } else if (opt_kind == TCP_OPT_WINDOW_SCALE) {
+        if (opt_len != sizeof(struct tcp_wscale_opt)) {
+          fprintf(stderr, "parse_options: window scale option size wrong "
+              "(expect %zu got %u)\n", sizeof(struct tcp_wscale_opt), opt_len);
+          return -1;
+        }
+
+        opts->wscale = (struct tcp_wscale_opt *) (opt + off);
+      } else if (opt_kind == TCP_OPT_SACK) {
+        /* SACK blocks on segments handled here are not used */
+        if (opt_len < 2 || (opt_len - 2) % 8 != 0) {
+          fprintf(stderr, "parse_options: sack option size wrong (got %u)\n",
+              opt_len);
+          return -1;
+        }
       }
       else {
         fprintf(stderr, "parse_options: invalid option (kind %u "
@@ -12,6 +12,7 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <linux/limits.h>
 
 #include "connect.h"
@@ -19,12 +20,16 @@
 
 #define PFN_MASK_SIZE           8
 
+/** Device addresses are virtual addresses (see util_set_iova_va()) */
+static int iova_va = 0;
+
 static void destroy_shm(const char* path, size_t size, void* addr)
 {
   if (munmap(addr, size) != 0) {
     fprintf(stderr, "Warning: munmap failed (%s)\n", strerror(errno));
   }
-  shm_unlink(path);
+  /* path is a file on the shm or hugetlbfs mount, not a shm_open() name */
+  unlink(path);
 }
 
 void util_destroy_shm(const char *name, size_t size, void *addr)
@@ -43,6 +48,21 @@ void util_destroy_shm_huge(const char *name, size_t size, void *addr)
   destroy_shm(path, size, addr);
 }
 
+static const char *huge_prefix(size_t page)
+{
+  return (page == HUGE_PAGE_SIZE_2M ? FLEXNIC_HUGE2M_PREFIX :
+      FLEXNIC_HUGE_PREFIX);
+}
+
+void util_destroy_shm_huge_pg(const char *name, size_t size, size_t page,
+    void *addr)
+{
+  char path[PATH_MAX];
+  snprintf(path, PATH_MAX, "%s/%s", huge_prefix(page), name);
+
+  destroy_shm(path, size, addr);
+}
+
 static void* create_shm(const char* path, size_t size, void* addr)
 {
   int fd;
@@ -94,6 +114,39 @@ void* util_create_shm_huge(const char *name, size_t size, void *addr)
   return create_shm(path, size, addr);
 }
 
+void* util_create_shm_huge_pg(const char *name, size_t size, size_t page,
+    int populate)
+{
+  char path[PATH_MAX];
+  int fd;
+  void *p;
+
+  snprintf(path, PATH_MAX, "%s/%s", huge_prefix(page), name);
+  if ((fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0666)) == -1) {
+    perror("open failed");
+    return NULL;
+  }
+  if (ftruncate(fd, size) != 0) {
+    perror("ftruncate failed");
+    goto error_remove;
+  }
+
+  /* fails if the mount does not have enough free hugepages */
+  if ((p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0)) == (void *) -1)
+  {
+    goto error_remove;
+  }
+
+  close(fd);
+  return p;
+
+error_remove:
+  close(fd);
+  unlink(path);
+  return NULL;
+}
+
 void* map_region(const char* path, size_t size)
 {
   int fd;
@@ -129,11 +182,100 @@ void* util_map_region_huge(const char *name, size_t size)
   return map_region(path, size);
 }
 
+void* util_map_region_huge_pg(const char *name, size_t size, size_t page)
+{
+  char path[PATH_MAX];
+  int fd;
+  void *m;
+
+  snprintf(path, PATH_MAX, "%s/%s", huge_prefix(page), name);
+  if ((fd = open(path, O_RDWR)) == -1) {
+    perror("map_region: open failed");
+    return NULL;
+  }
+  m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m == (void *) -1) {
+    perror("map_region: mmap failed");
+    return NULL;
+  }
+
+  return m;
+}
+
 void util_unmap_region(void* addr, size_t size)
 {
   munmap(addr, size);
 }
 
+struct populate_range {
+  pthread_t thread;
+  uint8_t *start;
+  size_t pages;
+  size_t page;
+};
+
+static void *populate_thread(void *arg)
+{
+  struct populate_range *r = arg;
+  size_t i;
+
+  /* a write fault allocates and zeroes the whole page */
+  for (i = 0; i < r->pages; i++) {
+    ((volatile uint8_t *) r->start)[i * r->page] = 0;
+  }
+  return NULL;
+}
+
+int util_populate(void *addr, size_t size, size_t page, unsigned threads)
+{
+  struct populate_range *rs;
+  size_t pages = (size + page - 1) / page, per, off = 0;
+  unsigned i, started;
+  int ret = 0;
+
+  if (threads > pages) {
+    threads = pages;
+  }
+  if (threads <= 1) {
+    struct populate_range r = { .start = addr, .pages = pages, .page = page };
+    populate_thread(&r);
+    return 0;
+  }
+
+  if ((rs = calloc(threads, sizeof(*rs))) == NULL) {
+    return -1;
+  }
+
+  /* contiguous runs of pages, the first ones get the remainder */
+  for (started = 0; started < threads; started++) {
+    per = pages / threads + (started < pages % threads);
+    rs[started].start = (uint8_t *) addr + off * page;
+    rs[started].pages = per;
+    rs[started].page = page;
+    off += per;
+
+    if (pthread_create(&rs[started].thread, NULL, populate_thread,
+          &rs[started]) != 0)
+    {
+      fprintf(stderr, "util_populate: pthread_create failed\n");
+      ret = -1;
+      break;
+    }
+  }
+
+  for (i = 0; i < started; i++) {
+    pthread_join(rs[i].thread, NULL);
+  }
+  free(rs);
+  return ret;
+}
+
+void util_set_iova_va(void)
+{
+  iova_va = 1;
+}
+
 /**
  * Convert virtual address to physical address.
  * Hacky solution used by DPDK!
@@ -149,6 +291,10 @@ util_virt2phy(const void* virtaddr)
   unsigned long virt_pfn;
   off_t offset;
 
+  if (iova_va) {
+    return (uintptr_t) virtaddr;
+  }
+
   fd = open("/proc/self/pagemap", O_RDONLY);
   if (fd < 0)
   {
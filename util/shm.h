@@ -10,6 +10,7 @@
 #define CACHE_LINE_SIZE         64
 #define PAGE_SIZE               (1 << 12)
 #define HUGE_PAGE_SIZE          (1 << 30)
+#define HUGE_PAGE_SIZE_2M       (1 << 21)
 
 #define BAD_IOVA        -1
 
@@ -20,6 +21,33 @@ void* util_map_region_huge(const char *name, size_t size);
 void util_destroy_shm(const char *name, size_t size, void *addr);
 void util_destroy_shm_huge(const char *name, size_t size, void *addr);
 void util_unmap_region(void* addr, size_t size);
+
+/**
+ * Create a region on the hugetlbfs mount for @p page sized pages
+ * (HUGE_PAGE_SIZE or HUGE_PAGE_SIZE_2M). The file is truncated first, so
+ * pages come zeroed from the kernel and need no memset. Hugepages are
+ * reserved, but only faulted in if @p populate is set.
+ */
+void* util_create_shm_huge_pg(const char *name, size_t size, size_t page,
+    int populate);
+/** Map a region created by util_create_shm_huge_pg(), without faulting it in */
+void* util_map_region_huge_pg(const char *name, size_t size, size_t page);
+void util_destroy_shm_huge_pg(const char *name, size_t size, size_t page,
+    void *addr);
+
+/**
+ * Fault in the pages of a mapped region, with the pages spread over
+ * @p threads threads (up to one per page).
+ *
+ * @return 0 on success, -1 if a thread could not be started.
+ */
+int util_populate(void *addr, size_t size, size_t page, unsigned threads);
 uint64_t util_virt2phy(const void* virtaddr);
 
+/**
+ * Hand out virtual addresses as device addresses from util_virt2phy(), for a
+ * device model running in the same process (see user/nic_fake.c).
+ */
+void util_set_iova_va(void);
+
 #endif /* UTILS_SHM_H_ */